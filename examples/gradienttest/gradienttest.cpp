@@ -0,0 +1,390 @@
+/*
+ *  gradienttest.cpp
+ *  BEAGLE
+ *
+ *  Checks the derivatives of the log likelihood with respect to every edge length, computed
+ *  from pre-order partials by beagleCalculateEdgeDerivatives, against central differences of
+ *  the root log likelihood, and likewise the derivatives with respect to the parameters of a
+ *  rate matrix computed by beagleCalculateParameterDerivatives.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+
+static const int kTaxa = 8;
+static const int kStates = 4;
+static const int kPatterns = 200;
+static const int kCategories = 4;
+
+static const int kNodes = 2 * kTaxa - 1;
+static const int kRoot = kNodes - 1;
+
+// the F81 model, whose transition matrices are not symmetric for unequal frequencies
+static const double kFrequencies[kStates] = { 0.1, 0.2, 0.3, 0.4 };
+static const double kRates[kCategories] = { 0.2, 0.6, 1.2, 2.0 };
+static const double kWeights[kCategories] = { 0.25, 0.25, 0.25, 0.25 };
+
+// a rate matrix with frequencies kFrequencies whose exchangeabilities are kappa for the
+// transitions A-G and C-T, x for A-C and 1 otherwise; it is linear in both parameters
+static const int kParameterCount = 2;
+static const double kParameters[kParameterCount] = { 2.5, 0.7 };
+
+static double uniform() {
+    return rand() / (double) RAND_MAX;
+}
+
+// the transition matrices of every category over edgeLength, or their derivatives
+static void getF81Matrices(double edgeLength,
+                           bool derivative,
+                           double* outMatrices) {
+    double sumSquares = 0.0;
+    for (int i = 0; i < kStates; i++)
+        sumSquares += kFrequencies[i] * kFrequencies[i];
+    const double mu = 1.0 / (1.0 - sumSquares);
+
+    for (int c = 0; c < kCategories; c++) {
+        const double rate = mu * kRates[c];
+        const double decay = exp(-rate * edgeLength);
+        for (int i = 0; i < kStates; i++) {
+            for (int j = 0; j < kStates; j++) {
+                const double identity = (i == j ? 1.0 : 0.0);
+                outMatrices[(c * kStates + i) * kStates + j] = (derivative ?
+                    rate * decay * (kFrequencies[j] - identity) :
+                    decay * identity + (1.0 - decay) * kFrequencies[j]);
+            }
+        }
+    }
+}
+
+// the rate matrix for the given parameters, or its derivative with respect to one of them if
+// parameter is not negative
+static void getRateMatrix(const double* parameters,
+                          int parameter,
+                          double* outMatrix) {
+    for (int i = 0; i < kStates; i++) {
+        double rowSum = 0.0;
+        for (int j = 0; j < kStates; j++) {
+            if (i == j)
+                continue;
+            const bool transition = (i % 2 == j % 2);
+            const bool ac = (i + j == 1);
+            const int exchangeability = (transition ? 0 : (ac ? 1 : -1));
+            double value;
+            if (parameter < 0)
+                value = (exchangeability < 0 ? 1.0 : parameters[exchangeability]);
+            else
+                value = (exchangeability == parameter ? 1.0 : 0.0);
+            outMatrix[i * kStates + j] = value * kFrequencies[j];
+            rowSum += outMatrix[i * kStates + j];
+        }
+        outMatrix[i * kStates + i] = -rowSum;
+    }
+}
+
+// post-order partials are buffers 0 to kRoot, pre-order partials follow
+static int preIndex(int node) {
+    return kNodes + node;
+}
+
+// post-order scale buffers of the internal nodes, then the cumulative one, then pre-order
+static int postScaleIndex(int node) {
+    return node - kTaxa;
+}
+
+static int preScaleIndex(int node) {
+    return kTaxa + node;
+}
+
+static const int kCumulativeScaleIndex = kTaxa - 1;
+static const int kScaleCount = kTaxa + kNodes - 1;
+
+static std::vector<int> children;
+static std::vector<double> edgeLengths;
+
+static void setEdgeMatrices(int instance,
+                            int node) {
+    std::vector<double> matrices(kCategories * kStates * kStates);
+    getF81Matrices(edgeLengths[node], false, &matrices[0]);
+    beagleSetTransitionMatrix(instance, node, &matrices[0], 1.0);
+    getF81Matrices(edgeLengths[node], true, &matrices[0]);
+    beagleSetTransitionMatrix(instance, kNodes + node, &matrices[0], 0.0);
+}
+
+// the transition matrices of every edge under the rate matrix, and their derivatives with
+// respect to parameter p in matrices (p + 1) * kNodes onwards
+static void setModelMatrices(int instance,
+                             const double* parameters) {
+    std::vector<int> matrixIndices;
+    for (int node = 0; node < kRoot; node++)
+        matrixIndices.push_back(node);
+
+    double rateMatrix[kStates * kStates];
+    getRateMatrix(parameters, -1, rateMatrix);
+    beagleUpdateTransitionMatricesWithRateMatrix(instance, rateMatrix, &matrixIndices[0],
+                                                 &edgeLengths[0], kRoot);
+    for (int p = 0; p < kParameterCount; p++) {
+        double derivative[kStates * kStates];
+        getRateMatrix(parameters, p, derivative);
+        std::vector<int> derivativeIndices;
+        for (int node = 0; node < kRoot; node++)
+            derivativeIndices.push_back((p + 1) * kNodes + node);
+        beagleUpdateTransitionMatrixDerivativesWithRateMatrix(instance, rateMatrix, derivative,
+                                                              &derivativeIndices[0],
+                                                              &edgeLengths[0], kRoot);
+    }
+}
+
+static double rootLogLikelihood(int instance,
+                                bool scaling) {
+    std::vector<BeagleOperation> operations;
+    for (int node = kTaxa; node < kNodes; node++) {
+        BeagleOperation operation = {
+            node, (scaling ? postScaleIndex(node) : BEAGLE_OP_NONE), BEAGLE_OP_NONE,
+            children[2 * node], children[2 * node], children[2 * node + 1], children[2 * node + 1]
+        };
+        operations.push_back(operation);
+    }
+
+    int cumulativeScaleIndex = (scaling ? kCumulativeScaleIndex : BEAGLE_OP_NONE);
+    if (scaling)
+        beagleResetScaleFactors(instance, cumulativeScaleIndex);
+    beagleUpdatePartials(instance, &operations[0], operations.size(), cumulativeScaleIndex);
+
+    int rootIndex = kRoot;
+    int weightsIndex = 0;
+    int frequenciesIndex = 0;
+    double logL = 0.0;
+    beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex, &frequenciesIndex,
+                                      &cumulativeScaleIndex, 1, &logL);
+    return logL;
+}
+
+// pre-order partials from the root down, in reverse of the post-order
+static int updatePrePartials(int instance,
+                             bool scaling) {
+    int rootPre = preIndex(kRoot);
+    int frequenciesIndex = 0;
+    beagleSetRootPrePartials(instance, &rootPre, &frequenciesIndex, 1);
+
+    std::vector<BeagleOperation> preOperations;
+    for (int node = kRoot; node >= kTaxa; node--) {
+        for (int c = 0; c < 2; c++) {
+            const int child = children[2 * node + c];
+            const int sibling = children[2 * node + 1 - c];
+            BeagleOperation operation = {
+                preIndex(child), (scaling ? preScaleIndex(child) : BEAGLE_OP_NONE), BEAGLE_OP_NONE,
+                preIndex(node), (node == kRoot ? BEAGLE_OP_NONE : node),
+                sibling, sibling
+            };
+            preOperations.push_back(operation);
+        }
+    }
+    return beagleUpdatePrePartials(instance, &preOperations[0], preOperations.size(),
+                                   BEAGLE_OP_NONE);
+}
+
+// checks the derivatives with respect to the rate matrix parameters against central differences
+static int checkParameterDerivatives(int instance,
+                                     bool scaling) {
+    double parameters[kParameterCount];
+    for (int p = 0; p < kParameterCount; p++)
+        parameters[p] = kParameters[p];
+    setModelMatrices(instance, parameters);
+    rootLogLikelihood(instance, scaling);
+    int returnCode = updatePrePartials(instance, scaling);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "beagleUpdatePrePartials returned %d\n", returnCode);
+        return 1;
+    }
+
+    std::vector<int> postIndices, preIndices, matrixIndices, derivativeIndices, weightsIndices;
+    for (int node = 0; node < kRoot; node++) {
+        postIndices.push_back(node);
+        preIndices.push_back(preIndex(node));
+        matrixIndices.push_back(node);
+        weightsIndices.push_back(0);
+    }
+    for (int p = 0; p < kParameterCount; p++) {
+        for (int node = 0; node < kRoot; node++)
+            derivativeIndices.push_back((p + 1) * kNodes + node);
+    }
+    double gradient[kParameterCount];
+    returnCode = beagleCalculateParameterDerivatives(instance, &postIndices[0], &preIndices[0],
+                                                     &matrixIndices[0], &derivativeIndices[0],
+                                                     &weightsIndices[0], kRoot, kParameterCount,
+                                                     gradient);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "beagleCalculateParameterDerivatives returned %d\n", returnCode);
+        return 1;
+    }
+
+    int failures = 0;
+    const double h = 1e-6;
+    for (int p = 0; p < kParameterCount; p++) {
+        parameters[p] = kParameters[p] + h;
+        setModelMatrices(instance, parameters);
+        const double logLPlus = rootLogLikelihood(instance, scaling);
+        parameters[p] = kParameters[p] - h;
+        setModelMatrices(instance, parameters);
+        const double logLMinus = rootLogLikelihood(instance, scaling);
+        parameters[p] = kParameters[p];
+
+        const double difference = (logLPlus - logLMinus) / (2.0 * h);
+        const bool pass = fabs(gradient[p] - difference) < 1e-4 * (1.0 + fabs(difference));
+        fprintf(stdout, "parameter %d: d logL/dx = %12.6f, central difference = %12.6f%s\n",
+                p, gradient[p], difference, (pass ? "" : "  MISMATCH"));
+        if (!pass)
+            failures++;
+    }
+    return failures;
+}
+
+static int runTest(long preferenceFlags,
+                   bool scaling) {
+    BeagleInstanceDetails instDetails;
+    int instance = beagleCreateInstance(kTaxa,              /**< Number of tip data elements */
+                                        2 * kNodes,         /**< Number of partials buffers */
+                                        kTaxa,              /**< Number of compact buffers */
+                                        kStates,            /**< Number of states */
+                                        kPatterns,          /**< Number of site patterns */
+                                        1,                  /**< Number of eigen-decompositions */
+                                        (kParameterCount + 1) * kNodes, /**< Number of matrix buffers */
+                                        kCategories,        /**< Number of rate categories */
+                                        kScaleCount,        /**< Number of scaling buffers */
+                                        NULL, 0,            /**< No resource restriction */
+                                        preferenceFlags |
+                                        (scaling ? BEAGLE_FLAG_SCALING_MANUAL : 0),
+                                        BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                        &instDetails);
+    if (instance < 0) {
+        fprintf(stderr, "Failed to obtain BEAGLE instance\n\n");
+        return 1;
+    }
+    fprintf(stdout, "Impl : %s%s\n", instDetails.implName, (scaling ? ", scaled" : ""));
+
+    // half the tips as compact states with some missing, the others as partials
+    for (int tip = 0; tip < kTaxa; tip++) {
+        std::vector<int> states(kPatterns);
+        for (int k = 0; k < kPatterns; k++)
+            states[k] = (uniform() < 0.05 ? kStates : rand() % kStates);
+        if (tip % 2 == 0) {
+            beagleSetTipStates(instance, tip, &states[0]);
+        } else {
+            std::vector<double> partials(kPatterns * kStates);
+            for (int k = 0; k < kPatterns; k++) {
+                for (int i = 0; i < kStates; i++)
+                    partials[k * kStates + i] = (states[k] == kStates || states[k] == i ? 1.0 : 0.0);
+            }
+            beagleSetTipPartials(instance, tip, &partials[0]);
+        }
+    }
+
+    std::vector<double> patternWeights(kPatterns);
+    for (int k = 0; k < kPatterns; k++)
+        patternWeights[k] = 1 + rand() % 3;
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+    beagleSetStateFrequencies(instance, 0, kFrequencies);
+    beagleSetCategoryWeights(instance, 0, kWeights);
+    beagleSetCategoryRates(instance, kRates);
+
+    for (int node = 0; node < kRoot; node++)
+        setEdgeMatrices(instance, node);
+
+    double logL = rootLogLikelihood(instance, scaling);
+    fprintf(stdout, "logL = %.5f\n", logL);
+
+    int returnCode = updatePrePartials(instance, scaling);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "beagleUpdatePrePartials returned %d\n", returnCode);
+        return 1;
+    }
+
+    std::vector<int> postIndices, preIndices, matrixIndices, derivativeIndices, weightsIndices;
+    for (int node = 0; node < kRoot; node++) {
+        postIndices.push_back(node);
+        preIndices.push_back(preIndex(node));
+        matrixIndices.push_back(node);
+        derivativeIndices.push_back(kNodes + node);
+        weightsIndices.push_back(0);
+    }
+    std::vector<double> gradient(kRoot);
+    std::vector<double> siteGradient(kRoot * kPatterns);
+    returnCode = beagleCalculateEdgeDerivatives(instance, &postIndices[0], &preIndices[0],
+                                                &matrixIndices[0], &derivativeIndices[0],
+                                                &weightsIndices[0], kRoot,
+                                                &siteGradient[0], &gradient[0]);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "beagleCalculateEdgeDerivatives returned %d\n", returnCode);
+        return 1;
+    }
+
+    int failures = 0;
+    const double h = 1e-6;
+    for (int node = 0; node < kRoot; node++) {
+        const double edgeLength = edgeLengths[node];
+        edgeLengths[node] = edgeLength + h;
+        setEdgeMatrices(instance, node);
+        const double logLPlus = rootLogLikelihood(instance, scaling);
+        edgeLengths[node] = edgeLength - h;
+        setEdgeMatrices(instance, node);
+        const double logLMinus = rootLogLikelihood(instance, scaling);
+        edgeLengths[node] = edgeLength;
+        setEdgeMatrices(instance, node);
+
+        const double difference = (logLPlus - logLMinus) / (2.0 * h);
+        double siteSum = 0.0;
+        for (int k = 0; k < kPatterns; k++)
+            siteSum += siteGradient[node * kPatterns + k] * patternWeights[k];
+
+        const double tolerance = 1e-4 * (1.0 + fabs(difference));
+        const bool pass = (fabs(gradient[node] - difference) < tolerance &&
+                           fabs(siteSum - gradient[node]) < tolerance);
+        fprintf(stdout, "edge %2d: d logL/dt = %12.6f, central difference = %12.6f%s\n",
+                node, gradient[node], difference, (pass ? "" : "  MISMATCH"));
+        if (!pass)
+            failures++;
+    }
+    failures += checkParameterDerivatives(instance, scaling);
+    fprintf(stdout, "\n");
+
+    beagleFinalizeInstance(instance);
+    return failures;
+}
+
+int main( int argc, const char* argv[] )
+{
+    srand(42);
+
+    // a random rooted tree joining two nodes at a time
+    children.assign(2 * kNodes, -1);
+    edgeLengths.assign(kNodes, 0.0);
+    std::vector<int> roots;
+    for (int tip = 0; tip < kTaxa; tip++)
+        roots.push_back(tip);
+    for (int node = kTaxa; node < kNodes; node++) {
+        for (int c = 0; c < 2; c++) {
+            const int pick = rand() % roots.size();
+            children[2 * node + c] = roots[pick];
+            roots.erase(roots.begin() + pick);
+        }
+        roots.push_back(node);
+    }
+    for (int node = 0; node < kRoot; node++)
+        edgeLengths[node] = 0.01 + 0.3 * uniform();
+
+    int failures = 0;
+    failures += runTest(BEAGLE_FLAG_VECTOR_NONE, false);
+    failures += runTest(BEAGLE_FLAG_VECTOR_NONE, true);
+    failures += runTest(BEAGLE_FLAG_VECTOR_SSE, false);
+    failures += runTest(BEAGLE_FLAG_VECTOR_SSE, true);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d gradient mismatches\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,378 @@
+/*
+ *  kernelbench.cpp
+ *  BEAGLE
+ *
+ *  Times each likelihood kernel in isolation on a resource, for a range of state counts,
+ *  pattern counts and precisions, and reports the achieved floating-point and memory
+ *  throughput against the peaks of the machine, so that a kernel can be told to be bound by
+ *  memory bandwidth or by arithmetic.
+ *
+ *  Operation and byte counts are those of a straightforward implementation: a kernel that
+ *  skips work, such as one reusing cached matrices, reports more than it performs.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+
+static const int kTipCount = 4;
+static const int kPartialsBufferCount = 8;
+static const int kMatrixCount = 4;
+
+struct Options {
+    std::vector<int> resources;
+    std::vector<int> stateCounts;
+    std::vector<int> patternCounts;
+    std::vector<bool> doublePrecision;
+    int categoryCount;
+    int reps;
+    double peakGflops;      // 0 if unknown
+    double peakGBs;         // 0 if unknown, then measured on CPU resources
+};
+
+// counts of one call of a kernel
+struct KernelCost {
+    double flops;
+    double bytes;
+};
+
+static double uniform() {
+    return (rand() + 1.0) / ((double) RAND_MAX + 1.0);
+}
+
+static std::vector<int> parseList(const char* text) {
+    std::vector<int> values;
+    const char* p = text;
+    while (*p != '\0') {
+        values.push_back(atoi(p));
+        p = strchr(p, ',');
+        if (p == NULL)
+            break;
+        p++;
+    }
+    return values;
+}
+
+// best host memory bandwidth of a triad over arrays much larger than the caches, in GB/s
+static double measureHostBandwidth() {
+    const size_t length = 1 << 22;
+    std::vector<double> a(length, 0.0), b(length, 1.0), c(length, 2.0);
+
+    double best = 0.0;
+    for (int rep = 0; rep < 5; rep++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < length; i++)
+            a[i] = b[i] + 0.5 * c[i];
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        double rate = 3.0 * sizeof(double) * length / seconds.count() / 1e9;
+        if (rate > best)
+            best = rate;
+    }
+    // keep the loop from being removed
+    if (a[length / 2] != 1.0 + 0.5 * 2.0)
+        fprintf(stderr, "unexpected triad result\n");
+    return best;
+}
+
+// reading the site log likelihoods back waits for the work queued before it on a device
+static void waitForDevice(int instance,
+                          int patternCount) {
+    std::vector<double> siteLogLikelihoods(patternCount);
+    beagleGetSiteLogLikelihoods(instance, &siteLogLikelihoods[0]);
+}
+
+// seconds per call, after one call that is not timed; waits for the device
+static double timeCalls(int instance,
+                        int patternCount,
+                        int reps,
+                        const std::function<void()>& call) {
+    call();
+    waitForDevice(instance, patternCount);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int rep = 0; rep < reps; rep++)
+        call();
+    waitForDevice(instance, patternCount);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+    return seconds.count() / reps;
+}
+
+static void printResult(const char* kernel,
+                        int stateCount,
+                        int patternCount,
+                        bool doublePrecision,
+                        double seconds,
+                        const KernelCost& cost,
+                        double peakGflops,
+                        double peakGBs) {
+    double gflops = cost.flops / seconds / 1e9;
+    double gbs = cost.bytes / seconds / 1e9;
+
+    char flopShare[16] = "-";
+    char byteShare[16] = "-";
+    const char* bound = "-";
+    if (peakGflops > 0.0)
+        snprintf(flopShare, sizeof(flopShare), "%.1f%%", 100.0 * gflops / peakGflops);
+    if (peakGBs > 0.0)
+        snprintf(byteShare, sizeof(byteShare), "%.1f%%", 100.0 * gbs / peakGBs);
+    if (peakGflops > 0.0 && peakGBs > 0.0) {
+        // below the ridge point of the roofline, bandwidth limits the kernel
+        double intensity = cost.flops / cost.bytes;
+        bound = (intensity < peakGflops / peakGBs ? "memory" : "compute");
+    }
+
+    fprintf(stdout, "%-18s %6d %9d %-6s %11.4f %9.2f %9.2f %9s %9s %8.2f  %s\n",
+            kernel, stateCount, patternCount, (doublePrecision ? "double" : "single"),
+            seconds * 1e3, gflops, gbs, flopShare, byteShare, cost.flops / cost.bytes, bound);
+}
+
+static int runKernels(const Options& options,
+                      int resource,
+                      int stateCount,
+                      int patternCount,
+                      bool doublePrecision) {
+    const int s = stateCount;
+    const int c = options.categoryCount;
+    const double p = patternCount;
+    const double real = (doublePrecision ? sizeof(double) : sizeof(float));
+
+    long requirementFlags = (doublePrecision ? BEAGLE_FLAG_PRECISION_DOUBLE : BEAGLE_FLAG_PRECISION_SINGLE);
+    BeagleInstanceDetails details;
+    int instance = beagleCreateInstance(kTipCount, kPartialsBufferCount, 2, stateCount,
+                                        patternCount, 1, kMatrixCount, c, 2,
+                                        &resource, 1, BEAGLE_FLAG_SCALING_MANUAL,
+                                        requirementFlags, &details);
+    if (instance < 0) {
+        fprintf(stderr, "no %s precision implementation with %d states on resource %d\n",
+                (doublePrecision ? "double" : "single"), stateCount, resource);
+        return 1;
+    }
+
+    // tips 0 and 1 hold states, tips 2 and 3 partials
+    std::vector<int> states(patternCount);
+    std::vector<double> partials(patternCount * s);
+    for (int tip = 0; tip < kTipCount; tip++) {
+        if (tip < 2) {
+            for (int k = 0; k < patternCount; k++)
+                states[k] = rand() % s;
+            beagleSetTipStates(instance, tip, &states[0]);
+        } else {
+            for (int k = 0; k < patternCount * s; k++)
+                partials[k] = uniform();
+            beagleSetTipPartials(instance, tip, &partials[0]);
+        }
+    }
+
+    // any finite model will do: a diagonal decomposition gives diagonal matrices
+    std::vector<double> identity(s * s, 0.0);
+    std::vector<double> eigenValues(s, -1.0);
+    std::vector<double> frequencies(s, 1.0 / s);
+    for (int i = 0; i < s; i++)
+        identity[i * s + i] = 1.0;
+    eigenValues[0] = 0.0;
+    beagleSetEigenDecomposition(instance, 0, &identity[0], &identity[0], &eigenValues[0]);
+    beagleSetStateFrequencies(instance, 0, &frequencies[0]);
+
+    std::vector<double> rates(c), weights(c, 1.0 / c);
+    for (int i = 0; i < c; i++)
+        rates[i] = (i + 1.0) / c;
+    beagleSetCategoryRates(instance, &rates[0]);
+    beagleSetCategoryWeights(instance, 0, &weights[0]);
+
+    std::vector<double> patternWeights(patternCount, 1.0);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+
+    int matrixIndices[kMatrixCount] = { 0, 1, 2, 3 };
+    double edgeLengths[kMatrixCount] = { 0.1, 0.2, 0.3, 0.4 };
+    beagleUpdateTransitionMatrices(instance, 0, matrixIndices, NULL, NULL, edgeLengths, kMatrixCount);
+
+    BeagleOperation statesStates   = { 4, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 1, 1 };
+    BeagleOperation statesPartials = { 5, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 2, 1 };
+    BeagleOperation partialsPartials = { 6, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 2, 0, 3, 1 };
+    BeagleOperation rescaled       = { 7, 0, BEAGLE_OP_NONE, 2, 0, 3, 1 };
+
+    // per pattern and category: one product of two matrix entries per state for states,
+    // a dot product per state for partials; partials are read and written once
+    const double matrixBytes = 2.0 * c * s * s * real;
+    KernelCost statesStatesCost     = { p * c * s,
+                                        p * c * s * real + 2 * p * sizeof(int) + matrixBytes };
+    KernelCost statesPartialsCost   = { p * c * s * (2.0 * s + 1),
+                                        2 * p * c * s * real + p * sizeof(int) + matrixBytes };
+    KernelCost partialsPartialsCost = { p * c * s * (4.0 * s + 1),
+                                        3 * p * c * s * real + matrixBytes };
+    // the largest partial of a pattern, the division by it and its logarithm
+    KernelCost rescaledCost         = { partialsPartialsCost.flops + p * (2.0 * c * s + 1),
+                                        partialsPartialsCost.bytes + 2 * p * c * s * real + p * real };
+    KernelCost rootCost             = { p * (2.0 * c * s + 1),
+                                        p * c * s * real + p * real };
+    KernelCost edgeCost             = { p * (c * s * (2.0 * s + 2) + 1),
+                                        2 * p * c * s * real + c * s * s * real + p * real };
+    // U diag(exp(rate t lambda)) V for every category and matrix
+    KernelCost matrixCost           = { kMatrixCount * c * (2.0 * s * s * s + s),
+                                        kMatrixCount * c * s * s * real + 2.0 * s * s * real };
+
+    int reps = options.reps;
+    double peakGBs = options.peakGBs;
+    if (peakGBs == 0.0 && (details.flags & BEAGLE_FLAG_PROCESSOR_CPU)) {
+        static double hostGBs = measureHostBandwidth();
+        peakGBs = hostGBs;
+    }
+
+    double seconds;
+    seconds = timeCalls(instance, patternCount, reps, [&] () {
+        beagleUpdatePartials(instance, &statesStates, 1, BEAGLE_OP_NONE); });
+    printResult("states-states", s, patternCount, doublePrecision, seconds, statesStatesCost,
+                options.peakGflops, peakGBs);
+
+    seconds = timeCalls(instance, patternCount, reps, [&] () {
+        beagleUpdatePartials(instance, &statesPartials, 1, BEAGLE_OP_NONE); });
+    printResult("states-partials", s, patternCount, doublePrecision, seconds, statesPartialsCost,
+                options.peakGflops, peakGBs);
+
+    seconds = timeCalls(instance, patternCount, reps, [&] () {
+        beagleUpdatePartials(instance, &partialsPartials, 1, BEAGLE_OP_NONE); });
+    printResult("partials-partials", s, patternCount, doublePrecision, seconds, partialsPartialsCost,
+                options.peakGflops, peakGBs);
+
+    seconds = timeCalls(instance, patternCount, reps, [&] () {
+        beagleUpdatePartials(instance, &rescaled, 1, BEAGLE_OP_NONE); });
+    printResult("rescaled-partials", s, patternCount, doublePrecision, seconds, rescaledCost,
+                options.peakGflops, peakGBs);
+
+    int rootIndex = 6;
+    int childIndex = 5;
+    int zero = 0;
+    int noScale = BEAGLE_OP_NONE;
+    double logL;
+    seconds = timeCalls(instance, patternCount, reps, [&] () {
+        beagleCalculateRootLogLikelihoods(instance, &rootIndex, &zero, &zero, &noScale, 1, &logL); });
+    printResult("root-likelihood", s, patternCount, doublePrecision, seconds, rootCost,
+                options.peakGflops, peakGBs);
+
+    seconds = timeCalls(instance, patternCount, reps, [&] () {
+        beagleCalculateEdgeLogLikelihoods(instance, &rootIndex, &childIndex, &zero, NULL, NULL,
+                                          &zero, &zero, &noScale, 1, &logL, NULL, NULL); });
+    printResult("edge-likelihood", s, patternCount, doublePrecision, seconds, edgeCost,
+                options.peakGflops, peakGBs);
+
+    // new edge lengths on every call, so that no implementation can reuse the matrices
+    double scale = 1.0;
+    seconds = timeCalls(instance, patternCount, reps, [&] () {
+        scale *= 1.0001;
+        double lengths[kMatrixCount];
+        for (int m = 0; m < kMatrixCount; m++)
+            lengths[m] = edgeLengths[m] * scale;
+        beagleUpdateTransitionMatrices(instance, 0, matrixIndices, NULL, NULL, lengths, kMatrixCount); });
+    printResult("matrix-exponential", s, patternCount, doublePrecision, seconds, matrixCost,
+                options.peakGflops, peakGBs);
+
+    beagleFinalizeInstance(instance);
+    return 0;
+}
+
+static void printHelp() {
+    fprintf(stderr, "kernelbench [--help] [--rsrc <list>] [--states <list>] [--patterns <list>] "
+                    "[--rates <integer>] [--precision single|double|both] [--reps <integer>] "
+                    "[--peakgflops <number>] [--peakgbs <number>]\n");
+    fprintf(stderr, "Lists are comma separated. Without --peakgbs, the memory bandwidth of CPU\n"
+                    "resources is measured; without --peakgflops, shares of the peak are not shown.\n");
+}
+
+int main( int argc, const char* argv[] )
+{
+    Options options;
+    options.resources.push_back(0);
+    options.stateCounts.push_back(4);
+    options.stateCounts.push_back(20);
+    options.stateCounts.push_back(61);
+    options.patternCounts.push_back(10000);
+    options.doublePrecision.push_back(false);
+    options.doublePrecision.push_back(true);
+    options.categoryCount = 4;
+    options.reps = 20;
+    options.peakGflops = 0.0;
+    options.peakGBs = 0.0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        const char* value = (i + 1 < argc ? argv[i + 1] : NULL);
+        if (option == "--help") {
+            printHelp();
+            return 0;
+        } else if (value == NULL) {
+            fprintf(stderr, "Missing value of %s\n", option.c_str());
+            printHelp();
+            return 1;
+        } else if (option == "--rsrc") {
+            options.resources = parseList(value);
+        } else if (option == "--states") {
+            options.stateCounts = parseList(value);
+        } else if (option == "--patterns") {
+            options.patternCounts = parseList(value);
+        } else if (option == "--rates") {
+            options.categoryCount = atoi(value);
+        } else if (option == "--precision") {
+            options.doublePrecision.clear();
+            if (strcmp(value, "double") != 0)
+                options.doublePrecision.push_back(false);
+            if (strcmp(value, "single") != 0)
+                options.doublePrecision.push_back(true);
+        } else if (option == "--reps") {
+            options.reps = atoi(value);
+        } else if (option == "--peakgflops") {
+            options.peakGflops = atof(value);
+        } else if (option == "--peakgbs") {
+            options.peakGBs = atof(value);
+        } else {
+            fprintf(stderr, "Unknown command line parameter \"%s\"\n", option.c_str());
+            printHelp();
+            return 1;
+        }
+        i++;
+    }
+
+    if (options.categoryCount < 1 || options.reps < 1) {
+        printHelp();
+        return 1;
+    }
+
+    srand(42);
+
+    BeagleResourceList* resourceList = beagleGetResourceList();
+
+    int failures = 0;
+    for (size_t r = 0; r < options.resources.size(); r++) {
+        int resource = options.resources[r];
+        if (resource < 0 || resource >= resourceList->length) {
+            fprintf(stderr, "No resource %d\n", resource);
+            return 1;
+        }
+        fprintf(stdout, "Resource %d: %s %s\n", resource, resourceList->list[resource].name,
+                resourceList->list[resource].description);
+        fprintf(stdout, "%-18s %6s %9s %-6s %11s %9s %9s %9s %9s %8s  %s\n",
+                "kernel", "states", "patterns", "prec", "time (ms)", "GFLOP/s", "GB/s",
+                "%peakFLOP", "%peakBW", "FLOP/B", "bound");
+
+        for (size_t si = 0; si < options.stateCounts.size(); si++) {
+            for (size_t pi = 0; pi < options.patternCounts.size(); pi++) {
+                for (size_t di = 0; di < options.doublePrecision.size(); di++) {
+                    failures += runKernels(options, resource, options.stateCounts[si],
+                                           options.patternCounts[pi], options.doublePrecision[di]);
+                }
+            }
+        }
+        fprintf(stdout, "\n");
+    }
+
+    beagleFinalize();
+
+    return (failures > 0 ? 1 : 0);
+}
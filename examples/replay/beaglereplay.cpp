@@ -0,0 +1,639 @@
+/*
+ *  beaglereplay.cpp
+ *  BEAGLE
+ *
+ *  Runs the calls of a recording made with the BEAGLE_RECORD_FILE environment variable again,
+ *  on the resources of the recording or on another one, and reports the time spent in each
+ *  kind of call. With --check, the likelihoods computed are compared to the recorded ones, so
+ *  that a resource can be checked against the results of the application that made the
+ *  recording without running the application.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CallRecorder.h"
+
+using namespace beagle;
+
+static const long kResourceFlags = BEAGLE_FLAG_PROCESSOR_CPU | BEAGLE_FLAG_PROCESSOR_GPU |
+                                   BEAGLE_FLAG_PROCESSOR_FPGA | BEAGLE_FLAG_PROCESSOR_CELL |
+                                   BEAGLE_FLAG_PROCESSOR_PHI | BEAGLE_FLAG_PROCESSOR_OTHER |
+                                   BEAGLE_FLAG_FRAMEWORK_CUDA | BEAGLE_FLAG_FRAMEWORK_OPENCL |
+                                   BEAGLE_FLAG_FRAMEWORK_CPU;
+
+static const char* callNames[RECORDED_CALL_COUNT] = {
+    "", "createInstance", "finalizeInstance", "setCPUThreadCount", "setTipStates",
+    "setTipPartials", "setPartials", "setEigenDecomposition", "setStateFrequencies",
+    "setCategoryWeights", "setCategoryRates", "setCategoryRatesWithIndex",
+    "setPatternWeights", "setPatternPartitions", "setTransitionMatrix",
+    "setTransitionMatrices", "updateTransitionMatrices",
+    "updateTransitionMatricesWithModelCategories",
+    "updateTransitionMatricesWithMultipleModels", "updatePartials",
+    "updatePartialsByPartition", "accumulateScaleFactors", "removeScaleFactors",
+    "resetScaleFactors", "copyScaleFactors", "calculateRootLogLikelihoods",
+    "calculateEdgeLogLikelihoods", "getSiteLogLikelihoods", "resetInstance",
+    "updateTransitionMatricesWithRateMatrix", "convolveTransitionMatrixChains",
+    "calculateRootLogLikelihoodsWithPatternWeights", "updateTransitionMatricesForReplicates",
+    "calculateRootLogLikelihoodsForReplicates", "calculateEdgeSiteLogLikelihoods",
+    "growInstance"
+};
+
+struct Options {
+    const char* fileName;
+    int resource;           // -1 for the resources of the recording
+    bool check;
+    double tolerance;       // relative
+};
+
+struct CallTimes {
+    int count;
+    double seconds;
+};
+
+static void printHelp() {
+    fprintf(stderr, "beaglereplay [--help] [--rsrc <integer>] [--check] [--tolerance <number>] "
+                    "<recording>\n");
+    fprintf(stderr, "Replays a recording made with BEAGLE_RECORD_FILE=<recording>. --check compares\n"
+                    "the likelihoods to the recorded ones, to a relative tolerance of 1e-6 by default.\n");
+}
+
+static const int* orNull(const std::vector<int>& values,
+                         bool present) {
+    return (present ? (values.empty() ? NULL : &values[0]) : NULL);
+}
+
+static const double* orNull(const std::vector<double>& values,
+                            bool present) {
+    return (present ? (values.empty() ? NULL : &values[0]) : NULL);
+}
+
+static bool differs(double replayed,
+                    double recorded,
+                    double tolerance) {
+    if (isnan(replayed) || isnan(recorded))
+        return isnan(replayed) != isnan(recorded);
+    return fabs(replayed - recorded) > tolerance * fmax(1.0, fabs(recorded));
+}
+
+int main( int argc, const char* argv[] )
+{
+    Options options;
+    options.fileName = NULL;
+    options.resource = -1;
+    options.check = false;
+    options.tolerance = 1e-6;
+
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--help") {
+            printHelp();
+            return 0;
+        } else if (option == "--check") {
+            options.check = true;
+        } else if (option == "--rsrc" && i + 1 < argc) {
+            options.resource = atoi(argv[++i]);
+        } else if (option == "--tolerance" && i + 1 < argc) {
+            options.tolerance = atof(argv[++i]);
+        } else if (option[0] != '-' && options.fileName == NULL) {
+            options.fileName = argv[i];
+        } else {
+            fprintf(stderr, "Unknown command line parameter \"%s\"\n", option.c_str());
+            printHelp();
+            return 1;
+        }
+    }
+
+    if (options.fileName == NULL) {
+        printHelp();
+        return 1;
+    }
+
+    CallReader reader(options.fileName);
+    if (!reader.isOpen()) {
+        fprintf(stderr, "Cannot read the recording %s\n", options.fileName);
+        return 1;
+    }
+
+    std::map<int, int> replayedInstances;   // recorded instance to replayed instance
+    std::map<int, int> patternCounts;       // of the replayed instances
+    CallTimes times[RECORDED_CALL_COUNT];
+    memset(times, 0, sizeof(times));
+    int skipped = 0;
+    int mismatches = 0;
+    int checked = 0;
+
+    std::vector<int> i1, i2, i3, i4, i5, i6, i7, i8;
+    std::vector<double> d1, d2, d3;
+
+    int call, recordedInstance, recordedReturn;
+    while (reader.next(&call, &recordedInstance, &recordedReturn)) {
+        if (call < 1 || call >= RECORDED_CALL_COUNT) {
+            fprintf(stderr, "Unknown call %d in the recording\n", call);
+            return 1;
+        }
+
+        std::map<int, int>::iterator mapped = replayedInstances.find(recordedInstance);
+        bool known = (mapped != replayedInstances.end());
+        int instance = (known ? mapped->second : -1);
+        // replays a call of a known instance and times it
+        bool run = known || call == RECORDED_CREATE_INSTANCE;
+        std::chrono::steady_clock::time_point start;
+        int returnValue = BEAGLE_SUCCESS;
+#define REPLAY(expression) \
+        if (run) { \
+            start = std::chrono::steady_clock::now(); \
+            returnValue = (expression); \
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start; \
+            times[call].count++; \
+            times[call].seconds += seconds.count(); \
+        }
+
+        switch (call) {
+            case RECORDED_CREATE_INSTANCE: {
+                int tipCount = reader.getInt();
+                int partialsBufferCount = reader.getInt();
+                int compactBufferCount = reader.getInt();
+                int stateCount = reader.getInt();
+                int patternCount = reader.getInt();
+                int eigenBufferCount = reader.getInt();
+                int matrixBufferCount = reader.getInt();
+                int categoryCount = reader.getInt();
+                int scaleBufferCount = reader.getInt();
+                bool hasResources = reader.getInts(i1);
+                long preferenceFlags = reader.getLong();
+                long requirementFlags = reader.getLong();
+                long recordedFlags = reader.getLong();
+                if (recordedInstance < 0) {
+                    run = false;
+                    break;
+                }
+                if (options.resource >= 0) {
+                    i1.assign(1, options.resource);
+                    hasResources = true;
+                    requirementFlags &= ~kResourceFlags;
+                }
+                // the replay computes in the precision of the recording
+                requirementFlags |= recordedFlags & (BEAGLE_FLAG_PRECISION_SINGLE |
+                                                     BEAGLE_FLAG_PRECISION_DOUBLE);
+                BeagleInstanceDetails details;
+                REPLAY(beagleCreateInstance(tipCount, partialsBufferCount, compactBufferCount,
+                                            stateCount, patternCount, eigenBufferCount,
+                                            matrixBufferCount, categoryCount, scaleBufferCount,
+                                            (int*) orNull(i1, hasResources), (int) i1.size(),
+                                            preferenceFlags, requirementFlags, &details));
+                if (returnValue < 0) {
+                    fprintf(stderr, "Cannot create instance %d of the recording (error %d)\n",
+                            recordedInstance, returnValue);
+                    return 1;
+                }
+                fprintf(stdout, "Instance %d: %s, %s\n", recordedInstance,
+                        details.resourceName, details.implName);
+                replayedInstances[recordedInstance] = returnValue;
+                patternCounts[returnValue] = patternCount;
+                returnValue = recordedReturn;
+                break;
+            }
+            case RECORDED_FINALIZE_INSTANCE:
+                REPLAY(beagleFinalizeInstance(instance));
+                replayedInstances.erase(recordedInstance);
+                break;
+            case RECORDED_RESET_INSTANCE:
+                REPLAY(beagleResetInstance(instance));
+                break;
+            case RECORDED_GROW_INSTANCE: {
+                int tipCount = reader.getInt();
+                int partialsBufferCount = reader.getInt();
+                int compactBufferCount = reader.getInt();
+                int patternCount = reader.getInt();
+                int matrixBufferCount = reader.getInt();
+                int scaleBufferCount = reader.getInt();
+                REPLAY(beagleGrowInstance(instance, tipCount, partialsBufferCount, compactBufferCount,
+                                          patternCount, matrixBufferCount, scaleBufferCount));
+                if (run && returnValue == BEAGLE_SUCCESS)
+                    patternCounts[instance] = patternCount;
+                break;
+            }
+            case RECORDED_SET_CPU_THREAD_COUNT: {
+                int threadCount = reader.getInt();
+                REPLAY(beagleSetCPUThreadCount(instance, threadCount));
+                break;
+            }
+            case RECORDED_SET_TIP_STATES: {
+                int tipIndex = reader.getInt();
+                bool has = reader.getInts(i1);
+                REPLAY(beagleSetTipStates(instance, tipIndex, orNull(i1, has)));
+                break;
+            }
+            case RECORDED_SET_TIP_PARTIALS: {
+                int tipIndex = reader.getInt();
+                bool has = reader.getDoubles(d1);
+                REPLAY(beagleSetTipPartials(instance, tipIndex, orNull(d1, has)));
+                break;
+            }
+            case RECORDED_SET_PARTIALS: {
+                int bufferIndex = reader.getInt();
+                bool has = reader.getDoubles(d1);
+                REPLAY(beagleSetPartials(instance, bufferIndex, orNull(d1, has)));
+                break;
+            }
+            case RECORDED_SET_EIGEN_DECOMPOSITION: {
+                int eigenIndex = reader.getInt();
+                bool has1 = reader.getDoubles(d1);
+                bool has2 = reader.getDoubles(d2);
+                bool has3 = reader.getDoubles(d3);
+                REPLAY(beagleSetEigenDecomposition(instance, eigenIndex, orNull(d1, has1),
+                                                   orNull(d2, has2), orNull(d3, has3)));
+                break;
+            }
+            case RECORDED_SET_STATE_FREQUENCIES: {
+                int index = reader.getInt();
+                bool has = reader.getDoubles(d1);
+                REPLAY(beagleSetStateFrequencies(instance, index, orNull(d1, has)));
+                break;
+            }
+            case RECORDED_SET_CATEGORY_WEIGHTS: {
+                int index = reader.getInt();
+                bool has = reader.getDoubles(d1);
+                REPLAY(beagleSetCategoryWeights(instance, index, orNull(d1, has)));
+                break;
+            }
+            case RECORDED_SET_CATEGORY_RATES: {
+                bool has = reader.getDoubles(d1);
+                REPLAY(beagleSetCategoryRates(instance, orNull(d1, has)));
+                break;
+            }
+            case RECORDED_SET_CATEGORY_RATES_WITH_INDEX: {
+                int index = reader.getInt();
+                bool has = reader.getDoubles(d1);
+                REPLAY(beagleSetCategoryRatesWithIndex(instance, index, orNull(d1, has)));
+                break;
+            }
+            case RECORDED_SET_PATTERN_WEIGHTS: {
+                bool has = reader.getDoubles(d1);
+                REPLAY(beagleSetPatternWeights(instance, orNull(d1, has)));
+                break;
+            }
+            case RECORDED_SET_PATTERN_PARTITIONS: {
+                int partitionCount = reader.getInt();
+                bool has = reader.getInts(i1);
+                REPLAY(beagleSetPatternPartitions(instance, partitionCount, orNull(i1, has)));
+                break;
+            }
+            case RECORDED_SET_TRANSITION_MATRIX: {
+                int matrixIndex = reader.getInt();
+                bool has = reader.getDoubles(d1);
+                double paddedValue = reader.getDouble();
+                REPLAY(beagleSetTransitionMatrix(instance, matrixIndex, orNull(d1, has),
+                                                 paddedValue));
+                break;
+            }
+            case RECORDED_SET_TRANSITION_MATRICES: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getDoubles(d1);
+                bool has3 = reader.getDoubles(d2);
+                REPLAY(beagleSetTransitionMatrices(instance, orNull(i1, has1), orNull(d1, has2),
+                                                   orNull(d2, has3), (int) i1.size()));
+                break;
+            }
+            case RECORDED_UPDATE_TRANSITION_MATRICES: {
+                int eigenIndex = reader.getInt();
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getDoubles(d1);
+                REPLAY(beagleUpdateTransitionMatrices(instance, eigenIndex, orNull(i1, has1),
+                                                      orNull(i2, has2), orNull(i3, has3),
+                                                      orNull(d1, has4), (int) i1.size()));
+                break;
+            }
+            case RECORDED_UPDATE_TRANSITION_MATRICES_WITH_MODEL_CATEGORIES: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getInts(i4);
+                bool has5 = reader.getDoubles(d1);
+                REPLAY(beagleUpdateTransitionMatricesWithModelCategories(instance,
+                           (int*) orNull(i1, has1), orNull(i2, has2), orNull(i3, has3),
+                           orNull(i4, has4), orNull(d1, has5), (int) i2.size()));
+                break;
+            }
+            case RECORDED_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getInts(i4);
+                bool has5 = reader.getInts(i5);
+                bool has6 = reader.getDoubles(d1);
+                REPLAY(beagleUpdateTransitionMatricesWithMultipleModels(instance,
+                           orNull(i1, has1), orNull(i2, has2), orNull(i3, has3),
+                           orNull(i4, has4), orNull(i5, has5), orNull(d1, has6),
+                           (int) i3.size()));
+                break;
+            }
+            case RECORDED_UPDATE_TRANSITION_MATRICES_WITH_RATE_MATRIX: {
+                bool has1 = reader.getDoubles(d1);
+                bool has2 = reader.getInts(i1);
+                bool has3 = reader.getDoubles(d2);
+                REPLAY(beagleUpdateTransitionMatricesWithRateMatrix(instance, orNull(d1, has1),
+                           orNull(i1, has2), orNull(d2, has3), (int) i1.size()));
+                break;
+            }
+            case RECORDED_CONVOLVE_TRANSITION_MATRIX_CHAINS: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getInts(i4);
+                REPLAY(beagleConvolveTransitionMatrixChains(instance, orNull(i1, has1),
+                           orNull(i2, has2), orNull(i3, has3), orNull(i4, has4),
+                           (int) i4.size()));
+                break;
+            }
+            case RECORDED_UPDATE_TRANSITION_MATRICES_FOR_REPLICATES: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getDoubles(d1);
+                REPLAY(beagleUpdateTransitionMatricesForReplicates(instance, orNull(i1, has1),
+                           orNull(i2, has2), orNull(d1, has3), (int) i2.size(), (int) i1.size()));
+                break;
+            }
+            case RECORDED_UPDATE_PARTIALS: {
+                bool has = reader.getInts(i1);
+                int cumulativeScaleIndex = reader.getInt();
+                REPLAY(beagleUpdatePartials(instance, (const BeagleOperation*) orNull(i1, has),
+                                            (int) i1.size() / BEAGLE_OP_COUNT,
+                                            cumulativeScaleIndex));
+                break;
+            }
+            case RECORDED_UPDATE_PARTIALS_BY_PARTITION: {
+                bool has = reader.getInts(i1);
+                REPLAY(beagleUpdatePartialsByPartition(instance,
+                           (const BeagleOperationByPartition*) orNull(i1, has),
+                           (int) i1.size() / BEAGLE_PARTITION_OP_COUNT));
+                break;
+            }
+            case RECORDED_ACCUMULATE_SCALE_FACTORS:
+            case RECORDED_REMOVE_SCALE_FACTORS: {
+                bool has = reader.getInts(i1);
+                int cumulativeScaleIndex = reader.getInt();
+                int partition = reader.getInt();
+                const int* indices = orNull(i1, has);
+                int count = (int) i1.size();
+                if (call == RECORDED_ACCUMULATE_SCALE_FACTORS && partition == kNoPartition) {
+                    REPLAY(beagleAccumulateScaleFactors(instance, indices, count,
+                                                        cumulativeScaleIndex));
+                } else if (call == RECORDED_ACCUMULATE_SCALE_FACTORS) {
+                    REPLAY(beagleAccumulateScaleFactorsByPartition(instance, indices, count,
+                                                                   cumulativeScaleIndex,
+                                                                   partition));
+                } else if (partition == kNoPartition) {
+                    REPLAY(beagleRemoveScaleFactors(instance, indices, count,
+                                                    cumulativeScaleIndex));
+                } else {
+                    REPLAY(beagleRemoveScaleFactorsByPartition(instance, indices, count,
+                                                               cumulativeScaleIndex, partition));
+                }
+                break;
+            }
+            case RECORDED_RESET_SCALE_FACTORS: {
+                int cumulativeScaleIndex = reader.getInt();
+                int partition = reader.getInt();
+                if (partition == kNoPartition) {
+                    REPLAY(beagleResetScaleFactors(instance, cumulativeScaleIndex));
+                } else {
+                    REPLAY(beagleResetScaleFactorsByPartition(instance, cumulativeScaleIndex,
+                                                              partition));
+                }
+                break;
+            }
+            case RECORDED_COPY_SCALE_FACTORS: {
+                int destination = reader.getInt();
+                int source = reader.getInt();
+                REPLAY(beagleCopyScaleFactors(instance, destination, source));
+                break;
+            }
+            case RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getInts(i4);
+                bool hasPartitions = reader.getInts(i5);
+                int partitionCount = reader.getInt();
+                bool hasSums = reader.getDoubles(d1);
+                double recordedSum = reader.getDouble();
+                d2.assign(d1.size(), 0.0);
+                double sum = 0.0;
+                if (hasPartitions) {
+                    REPLAY(beagleCalculateRootLogLikelihoodsByPartition(instance,
+                               orNull(i1, has1), orNull(i2, has2), orNull(i3, has3),
+                               orNull(i4, has4), orNull(i5, true), partitionCount,
+                               (int) i1.size() / partitionCount, (double*) orNull(d2, hasSums), &sum));
+                } else {
+                    REPLAY(beagleCalculateRootLogLikelihoods(instance, orNull(i1, has1),
+                               orNull(i2, has2), orNull(i3, has3), orNull(i4, has4),
+                               (int) i1.size(), &sum));
+                }
+                if (run && options.check && recordedReturn == BEAGLE_SUCCESS) {
+                    checked++;
+                    bool mismatch = differs(sum, recordedSum, options.tolerance);
+                    for (size_t i = 0; i < d1.size(); i++)
+                        mismatch = mismatch || differs(d2[i], d1[i], options.tolerance);
+                    if (mismatch) {
+                        mismatches++;
+                        fprintf(stdout, "Mismatch of the root log likelihood of instance %d: "
+                                        "%.10f, recorded %.10f\n", recordedInstance, sum,
+                                recordedSum);
+                    }
+                }
+                break;
+            }
+            case RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS_WITH_PATTERN_WEIGHTS: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getInts(i4);
+                bool hasWeights = reader.getDoubles(d1);
+                reader.getDoubles(d2);
+                int patternCount = (known ? patternCounts[instance] : 0);
+                int weightVectorCount = (patternCount > 0 ? (int) d1.size() / patternCount : 0);
+                d3.assign(weightVectorCount, 0.0);
+                REPLAY(beagleCalculateRootLogLikelihoodsWithPatternWeights(instance,
+                           orNull(i1, has1), orNull(i2, has2), orNull(i3, has3),
+                           orNull(i4, has4), (int) i1.size(), orNull(d1, hasWeights),
+                           weightVectorCount, (double*) orNull(d3, weightVectorCount > 0)));
+                if (run && options.check && recordedReturn == BEAGLE_SUCCESS) {
+                    checked++;
+                    bool mismatch = false;
+                    for (size_t i = 0; i < d2.size() && i < d3.size(); i++)
+                        mismatch = mismatch || differs(d3[i], d2[i], options.tolerance);
+                    if (mismatch) {
+                        mismatches++;
+                        fprintf(stdout, "Mismatch of the root log likelihoods with pattern weights "
+                                        "of instance %d\n", recordedInstance);
+                    }
+                }
+                break;
+            }
+            case RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS_FOR_REPLICATES: {
+                int bufferIndex = reader.getInt();
+                int categoryWeightsIndex = reader.getInt();
+                bool has = reader.getInts(i1);
+                int cumulativeScaleIndex = reader.getInt();
+                reader.getDoubles(d1);
+                d2.assign(i1.size(), 0.0);
+                REPLAY(beagleCalculateRootLogLikelihoodsForReplicates(instance, bufferIndex,
+                           categoryWeightsIndex, orNull(i1, has), cumulativeScaleIndex,
+                           (int) i1.size(), (double*) orNull(d2, !d2.empty())));
+                if (run && options.check && recordedReturn == BEAGLE_SUCCESS) {
+                    checked++;
+                    bool mismatch = false;
+                    for (size_t i = 0; i < d1.size() && i < d2.size(); i++)
+                        mismatch = mismatch || differs(d2[i], d1[i], options.tolerance);
+                    if (mismatch) {
+                        mismatches++;
+                        fprintf(stdout, "Mismatch of the replicate root log likelihoods of "
+                                        "instance %d\n", recordedInstance);
+                    }
+                }
+                break;
+            }
+            case RECORDED_CALCULATE_EDGE_LOG_LIKELIHOODS: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getInts(i4);
+                bool has5 = reader.getInts(i5);
+                bool has6 = reader.getInts(i6);
+                bool has7 = reader.getInts(i7);
+                bool has8 = reader.getInts(i8);
+                bool hasSum = reader.getDoubles(d1);
+                bool hasFirst = reader.getDoubles(d2);
+                bool hasSecond = reader.getDoubles(d3);
+                double sums[3] = { 0.0, 0.0, 0.0 };
+                REPLAY(beagleCalculateEdgeLogLikelihoods(instance, orNull(i1, has1),
+                           orNull(i2, has2), orNull(i3, has3), orNull(i4, has4),
+                           orNull(i5, has5), orNull(i6, has6), orNull(i7, has7),
+                           orNull(i8, has8), (int) i1.size(),
+                           (hasSum ? &sums[0] : NULL), (hasFirst ? &sums[1] : NULL),
+                           (hasSecond ? &sums[2] : NULL)));
+                if (run && options.check && recordedReturn == BEAGLE_SUCCESS) {
+                    checked++;
+                    bool mismatch = (hasSum && differs(sums[0], d1[0], options.tolerance)) ||
+                                    (hasFirst && differs(sums[1], d2[0], options.tolerance)) ||
+                                    (hasSecond && differs(sums[2], d3[0], options.tolerance));
+                    if (mismatch) {
+                        mismatches++;
+                        fprintf(stdout, "Mismatch of the edge log likelihood of instance %d: "
+                                        "%.10f, recorded %.10f\n", recordedInstance, sums[0],
+                                (hasSum ? d1[0] : 0.0));
+                    }
+                }
+                break;
+            }
+            case RECORDED_CALCULATE_EDGE_SITE_LOG_LIKELIHOODS: {
+                bool has1 = reader.getInts(i1);
+                bool has2 = reader.getInts(i2);
+                bool has3 = reader.getInts(i3);
+                bool has4 = reader.getInts(i4);
+                bool has5 = reader.getInts(i5);
+                bool has6 = reader.getInts(i6);
+                bool has7 = reader.getInts(i7);
+                bool has8 = reader.getInts(i8);
+                reader.getDoubles(d1);
+                reader.getDoubles(d2);
+                reader.getDoubles(d3);
+                const size_t siteCount = i1.size() * (known ? patternCounts[instance] : 0);
+                std::vector<double> sites(siteCount), first(siteCount), second(siteCount);
+                REPLAY(beagleCalculateEdgeSiteLogLikelihoods(instance, orNull(i1, has1),
+                           orNull(i2, has2), orNull(i3, has3), orNull(i4, has4),
+                           orNull(i5, has5), orNull(i6, has6), orNull(i7, has7),
+                           orNull(i8, has8), (int) i1.size(),
+                           (double*) orNull(sites, siteCount > 0),
+                           (double*) orNull(first, siteCount > 0),
+                           (double*) orNull(second, siteCount > 0)));
+                if (run && options.check && recordedReturn == BEAGLE_SUCCESS) {
+                    checked++;
+                    bool mismatch = false;
+                    for (size_t i = 0; i < siteCount; i++) {
+                        mismatch = mismatch ||
+                                   (i < d1.size() && differs(sites[i], d1[i], options.tolerance)) ||
+                                   (i < d2.size() && differs(first[i], d2[i], options.tolerance)) ||
+                                   (i < d3.size() && differs(second[i], d3[i], options.tolerance));
+                    }
+                    if (mismatch) {
+                        mismatches++;
+                        fprintf(stdout, "Mismatch of the edge site log likelihoods of instance %d\n",
+                                recordedInstance);
+                    }
+                }
+                break;
+            }
+            case RECORDED_GET_SITE_LOG_LIKELIHOODS: {
+                bool has = reader.getDoubles(d1);
+                d2.assign(known ? patternCounts[instance] : 0, 0.0);
+                REPLAY(beagleGetSiteLogLikelihoods(instance, (double*) orNull(d2, has)));
+                if (run && has && options.check && recordedReturn == BEAGLE_SUCCESS) {
+                    checked++;
+                    for (size_t i = 0; i < d1.size() && i < d2.size(); i++) {
+                        if (differs(d2[i], d1[i], options.tolerance)) {
+                            mismatches++;
+                            fprintf(stdout, "Mismatch of the log likelihood of site %d of "
+                                            "instance %d: %.10f, recorded %.10f\n", (int) i,
+                                    recordedInstance, d2[i], d1[i]);
+                            break;
+                        }
+                    }
+                }
+                break;
+            }
+        }
+#undef REPLAY
+
+        if (reader.hasFailed()) {
+            fprintf(stderr, "The recording ends within a call\n");
+            return 1;
+        }
+        if (!run) {
+            skipped++;
+        } else if (options.check && returnValue != recordedReturn) {
+            mismatches++;
+            fprintf(stdout, "Mismatch of the result of %s of instance %d: %d, recorded %d\n",
+                    callNames[call], recordedInstance, returnValue, recordedReturn);
+        }
+    }
+
+    for (std::map<int, int>::iterator i = replayedInstances.begin();
+         i != replayedInstances.end(); i++)
+        beagleFinalizeInstance(i->second);
+
+    fprintf(stdout, "\n%-30s %10s %12s %12s\n", "call", "count", "total ms", "mean us");
+    double total = 0.0;
+    for (int call = 1; call < RECORDED_CALL_COUNT; call++) {
+        if (times[call].count == 0)
+            continue;
+        total += times[call].seconds;
+        fprintf(stdout, "%-30s %10d %12.3f %12.3f\n", callNames[call], times[call].count,
+                times[call].seconds * 1e3, times[call].seconds * 1e6 / times[call].count);
+    }
+    fprintf(stdout, "%-30s %10s %12.3f\n", "all", "", total * 1e3);
+    if (skipped > 0)
+        fprintf(stdout, "%d calls of instances not created by beagleCreateInstance were skipped\n",
+                skipped);
+
+    if (options.check) {
+        fprintf(stdout, "%d results checked, %d mismatches\n", checked, mismatches);
+        if (mismatches > 0)
+            return 1;
+    }
+
+    beagleFinalize();
+
+    return 0;
+}
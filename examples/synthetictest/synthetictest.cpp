@@ -31,6 +31,9 @@
 #endif
 
 #include "libhmsbeagle/beagle.h"
+#ifdef HAVE_MPI
+    #include <mpi.h>
+#endif
 #include "linalg.h"
 
 #ifdef HAVE_NCL
@@ -70,6 +73,9 @@ double cpuTimeSetPartitions, cpuTimeUpdateTransitionMatrices, cpuTimeUpdateParti
 
 bool useStdlibRand;
 
+// rate matrices rebuilt from the eigen decompositions, stateCount * stateCount per model
+std::vector<double> rateMatrices;
+
 static unsigned int rand_state = 1;
 
 int gt_rand_r(unsigned int *seed)
@@ -134,6 +140,30 @@ int* getRandomTipStates( int nsites, int stateCount )
     return states;
 }
 
+// keeps a window of half the sites at a random offset, as in fragmentary sequences, and
+// makes the other sites missing
+void addRandomTipGaps( double* partials, int nsites, int stateCount )
+{
+    int offset = gt_rand()%nsites;
+    for( int i=0; i<nsites; i++ )
+    {
+        if ((i - offset + nsites) % nsites >= nsites / 2) {
+            for( int j=0; j<stateCount; j++ )
+                partials[i*stateCount+j]=1.0;
+        }
+    }
+}
+
+void addRandomTipGaps( int* states, int nsites, int stateCount )
+{
+    int offset = gt_rand()%nsites;
+    for( int i=0; i<nsites; i++ )
+    {
+        if ((i - offset + nsites) % nsites >= nsites / 2)
+            states[i]=stateCount;
+    }
+}
+
 struct threadData
 {
     std::thread t; // The thread object
@@ -165,16 +195,83 @@ node* createNewNode(int data)
     return (temp);
 }
 
-#ifdef HAVE_NCL
+// states of an alignment read or simulated before the run, one row of nsites per taxon
+std::vector<int> alignmentStates;
+
+// weights of the patterns of alignmentStates once compressed, empty otherwise
+std::vector<double> alignmentWeights;
+
+// the alignment before compression, for the reference run on the plain path
+std::vector<int> uncompressedStates;
+int uncompressedSiteCount = 0;
+
+int* getAlignmentTipStates( int nsites, int taxa)
+{
+    int *states = (int*) calloc(sizeof(int), nsites); 
+    for( int i=0; i<nsites; i++ )
+    {
+        states[i]= alignmentStates[(size_t) taxa * nsites + i];
+    }
+    return states;
+}
+
+// replaces the alignment by its unique site patterns, as compressed by the library, and
+// checks that every site reads back as its pattern
+void compressAlignment(int ntaxa, int* nsites, int threadCount)
+{
+    int npatterns = 0;
+    std::vector<int> patternStates(alignmentStates.size());
+    std::vector<double> patternWeights(*nsites);
+    std::vector<int> sitePatterns(*nsites);
+    int error = beagleCompressSitePatterns(ntaxa, *nsites, &alignmentStates[0], NULL, threadCount,
+                                           &npatterns, &patternStates[0], &patternWeights[0],
+                                           &sitePatterns[0]);
+    if (error != BEAGLE_SUCCESS) {
+        fprintf(stderr, "Failed to compress site patterns (error %d)\n\n", error);
+        exit(1);
+    }
+
+    double weightSum = 0.0;
+    for (int p = 0; p < npatterns; p++)
+        weightSum += patternWeights[p];
+    bool matches = (weightSum == *nsites);
+    for (int t = 0; t < ntaxa && matches; t++) {
+        for (int s = 0; s < *nsites; s++) {
+            if (alignmentStates[(size_t) t * *nsites + s] !=
+                patternStates[(size_t) t * npatterns + sitePatterns[s]]) {
+                matches = false;
+                break;
+            }
+        }
+    }
+    if (!matches)
+        abort("compressed site patterns do not match their sites");
+
+    uncompressedStates = alignmentStates;
+    uncompressedSiteCount = *nsites;
+    alignmentWeights.assign(patternWeights.begin(), patternWeights.begin() + npatterns);
 
-typedef std::vector<double>             pattern_counts_t;
-typedef std::vector<int>                pattern_t;
-typedef std::map< pattern_t, unsigned > pattern_map_t;
-typedef std::vector< pattern_t >        data_matrix_t;
+    patternStates.resize((size_t) ntaxa * npatterns);
+    alignmentStates.swap(patternStates);
+
+    std::cout << " (" << npatterns << " unique patterns)";
+
+    *nsites = npatterns;
+}
+
+void simulateAlignment(int ntaxa, int nsites, int stateCount, bool gaps)
+{
+    alignmentStates.resize((size_t) ntaxa * nsites);
+    for (int t = 0; t < ntaxa; t++) {
+        int* states = getRandomTipStates(nsites, stateCount);
+        if (gaps)
+            addRandomTipGaps(states, nsites, stateCount);
+        std::copy(states, states + nsites, alignmentStates.begin() + (size_t) t * nsites);
+        free(states);
+    }
+}
 
-pattern_map_t                           _pattern_map;       // used as workspace
-data_matrix_t                           _data_matrix;
-pattern_counts_t                        _pattern_counts;
+#ifdef HAVE_NCL
 
 NxsTaxaBlock* taxaBlock;
 NxsCharactersBlock* charBlock;
@@ -184,7 +281,7 @@ NxsCharactersBlock* charBlock;
 // and Phylogenetic Software Development Tutorial (version 2)
 //  (Paul O. Lewis Laboratory, https://phylogeny.uconn.edu/tutorial-v2)
 
-void ncl_readAlignmentDNA(char* filename, int* ntaxa, int* nsites, bool compress)
+void ncl_readAlignmentDNA(char* filename, int* ntaxa, int* nsites, bool compress, int threadCount)
 {
     MultiFormatReader nexusReader(-1, NxsReader::IGNORE_WARNINGS);
     nexusReader.ReadFilepath(filename, MultiFormatReader::RELAXED_PHYLIP_DNA_FORMAT);
@@ -200,101 +297,24 @@ void ncl_readAlignmentDNA(char* filename, int* ntaxa, int* nsites, bool compress
 
     unsigned ntax = *ntaxa;
 
-    _data_matrix.resize(ntax);
+    alignmentStates.resize((size_t) ntax * *nsites);
 
     for (unsigned t = 0; t < ntax; ++t) {
         const NxsDiscreteStateRow & row = charBlock->GetDiscreteMatrixRow(t);
-        unsigned seqlen = (unsigned)row.size();
-        _data_matrix[t].resize(seqlen);
-        unsigned k = 0;
+        size_t k = (size_t) t * *nsites;
         for (auto state_code : row) {
             if (state_code < 0 || state_code > 3) {
-                _data_matrix[t][k++] = 4; 
+                alignmentStates[k++] = 4; 
             } else {
-                _data_matrix[t][k++] = state_code;
+                alignmentStates[k++] = state_code;
             }
         }
     }
 
-    if (compress) {
-        // create map with keys equal to patterns and values equal to site counts
-        _pattern_map.clear();
-
-        std::vector<int> pattern;
-        unsigned numtaxa = (unsigned)_data_matrix.size();
-        unsigned seqlen = (unsigned)_data_matrix[0].size();
-        for (unsigned i = 0; i < seqlen; ++i)
-            {
-            // Create vector representing pattern at site i
-            pattern.clear();
-            for (unsigned j = 0; j < numtaxa; ++j)
-                {
-                pattern.push_back(_data_matrix[j][i]);
-                }
-
-            // Add this pattern to pattern_counts
-            // If pattern is not already in pattern_map, insert it and set value to 1.
-            // If it does exist, increment its current value.
-            // (see item 24, p. 110, in Meyers' Efficient STL for more info on the technique used here)
-            pattern_map_t::iterator lowb = _pattern_map.lower_bound(pattern);
-            if (lowb != _pattern_map.end() && !(_pattern_map.key_comp()(pattern, lowb->first)))
-                {
-                // this pattern has already been seen
-                lowb->second += 1;
-                }
-            else
-                {
-                // this pattern has not yet been seen
-                _pattern_map.insert(lowb, pattern_map_t::value_type(pattern, 1));
-                }
-            }
-            
-        // resize _pattern_counts
-        unsigned npatterns = (unsigned)_pattern_map.size();
-        _pattern_counts.resize(npatterns);
-        
-        // resize _data_matrix so that we can use operator[] to assign values
-        _data_matrix.resize(numtaxa);
-        for (auto & row : _data_matrix)
-            {
-            row.resize(npatterns);
-            }
-
-        unsigned j = 0;
-        for (auto & pc : _pattern_map)
-            {
-            _pattern_counts[j] = pc.second;
-
-            unsigned i = 0;
-            for (auto sc : pc.first)
-                {
-                _data_matrix[i][j] = sc;
-                ++i;
-                }
-
-            ++j;
-            }
-
-        // Everything has been transferred to _data_matrix and _pattern_counts, so can now free this memory
-        _pattern_map.clear();
-
-        std::cout << " (" << npatterns << " unique patterns)";
-
-        *nsites = npatterns;
-    }
-}
-
-int* ncl_getAlignmentTipStates( int nsites, int taxa)
-{
-    int *states = (int*) calloc(sizeof(int), nsites); 
-    for( int i=0; i<nsites; i++ )
-    {
-        states[i]= _data_matrix[taxa][i];
-    }
-    return states;
+    if (compress)
+        compressAlignment(*ntaxa, nsites, threadCount);
 }
 
-
 void ncl_generateTreeFromNewick(char* filename, int ntaxa, std::vector <node*> &nodes, node* root)
 {
     bool rooted = true;
@@ -1195,6 +1215,9 @@ void setNewPatternWeights(int nsites,
 {
     for (int i = 0; i < nsites; i++) {
         patternWeights[i] =  gt_rand()%10;
+        // the patterns of a compressed alignment count their sites
+        if (!alignmentWeights.empty())
+            patternWeights[i] = alignmentWeights[i];
     }    
 
     size_t instanceOffset = 0;
@@ -1419,6 +1442,38 @@ void setNewEigenModels(int modelCount,
             abort("should not be here");
         }
 
+        // Q = E D E^-1, with a 2 x 2 block [a b; -b a] in D for each complex conjugate pair
+        std::vector<double> dInv(stateCount * stateCount);
+        for (int k=0; k<stateCount; k++) {
+            for (int y=0; y<stateCount; y++)
+                dInv[k*stateCount+y] = (ievectrans ? ivec[y*stateCount+k] : ivec[k*stateCount+y]);
+        }
+        for (int k=0; k<stateCount; k++) {
+            double b = (eigencomplex ? eval[stateCount + k] : 0.0);
+            for (int y=0; y<stateCount; y++) {
+                if (b == 0) {
+                    dInv[k*stateCount+y] *= eval[k];
+                } else {
+                    double first = dInv[k*stateCount+y];
+                    double second = dInv[(k+1)*stateCount+y];
+                    dInv[k*stateCount+y] = eval[k] * first + b * second;
+                    dInv[(k+1)*stateCount+y] = eval[k+1] * second - b * first;
+                }
+            }
+            if (b != 0)
+                k++;
+        }
+        rateMatrices.resize(modelCount * stateCount * stateCount);
+        double* rateMatrix = &rateMatrices[eigenIndex * stateCount * stateCount];
+        for (int x=0; x<stateCount; x++) {
+            for (int y=0; y<stateCount; y++) {
+                double sum = 0.0;
+                for (int k=0; k<stateCount; k++)
+                    sum += evec[x*stateCount+k] * dInv[k*stateCount+y];
+                rateMatrix[x*stateCount+y] = sum;
+            }
+        }
+
         for(int inst=0; inst<instanceCount; inst++) {
 #ifdef HAVE_PLL
            if (!pllOnly) {
@@ -1476,6 +1531,7 @@ void printFlags(long inFlags) {
     if (inFlags & BEAGLE_FLAG_INVEVEC_TRANSPOSED ) fprintf(stdout, " INVEVEC_TRANSPOSED" );
     if (inFlags & BEAGLE_FLAG_VECTOR_SSE         ) fprintf(stdout, " VECTOR_SSE"         );
     if (inFlags & BEAGLE_FLAG_VECTOR_AVX         ) fprintf(stdout, " VECTOR_AVX"         );
+    if (inFlags & BEAGLE_FLAG_VECTOR_AVX512      ) fprintf(stdout, " VECTOR_AVX512"      );
     if (inFlags & BEAGLE_FLAG_VECTOR_NONE        ) fprintf(stdout, " VECTOR_NONE"        );
     if (inFlags & BEAGLE_FLAG_THREADING_CPP      ) fprintf(stdout, " THREADING_CPP"      );
     if (inFlags & BEAGLE_FLAG_THREADING_OPENMP   ) fprintf(stdout, " THREADING_OPENMP"   );
@@ -1520,6 +1576,50 @@ void threadWaiting(threadData* tData)
     }
 }
 
+// beagleCreateHybridInstance with the arguments of beagleCreateShardedInstance
+int createHybridInstance(int tipCount,
+                         int partialsBufferCount,
+                         int compactBufferCount,
+                         int stateCount,
+                         int patternCount,
+                         int eigenBufferCount,
+                         int matrixBufferCount,
+                         int categoryCount,
+                         int scaleBufferCount,
+                         int* resourceList,
+                         int resourceCount,
+                         long preferenceFlags,
+                         long requirementFlags,
+                         BeagleInstanceDetails* returnInfo) {
+    return beagleCreateHybridInstance(tipCount, partialsBufferCount, compactBufferCount,
+                                      stateCount, patternCount, eigenBufferCount,
+                                      matrixBufferCount, categoryCount, scaleBufferCount,
+                                      resourceList, resourceCount, preferenceFlags,
+                                      requirementFlags, 0, returnInfo);
+}
+
+// beagleCreateDistributedInstance over MPI_COMM_WORLD with the arguments of beagleCreateShardedInstance
+int createDistributedInstance(int tipCount,
+                              int partialsBufferCount,
+                              int compactBufferCount,
+                              int stateCount,
+                              int patternCount,
+                              int eigenBufferCount,
+                              int matrixBufferCount,
+                              int categoryCount,
+                              int scaleBufferCount,
+                              int* resourceList,
+                              int resourceCount,
+                              long preferenceFlags,
+                              long requirementFlags,
+                              BeagleInstanceDetails* returnInfo) {
+    return beagleCreateDistributedInstance(tipCount, partialsBufferCount, compactBufferCount,
+                                           stateCount, patternCount, eigenBufferCount,
+                                           matrixBufferCount, categoryCount, scaleBufferCount,
+                                           resourceList, resourceCount, preferenceFlags,
+                                           requirementFlags, NULL, returnInfo);
+}
+
 void runBeagle(int resource, 
                int stateCount, 
                int ntaxa, 
@@ -1533,6 +1633,7 @@ void runBeagle(int resource,
                bool requireDoublePrecision,
                bool disableVector,
                bool enableThreads,
+               bool enableOpenMP,
                int compactTipCount,
                int randomSeed,
                int rescaleFrequency,
@@ -1563,7 +1664,46 @@ void runBeagle(int resource,
                int  resourceCount,
                bool alignmentFromFile,
                char* treenewick,
-               bool clientThreadingEnabled)
+               bool clientThreadingEnabled,
+               bool calibrateThreads,
+               bool numaPlacement,
+               int threadSpin,
+               bool parallelOperations,
+               bool avx512,
+               bool sse,
+               bool sharded,
+               bool matrixCache,
+               bool bufferVersioning,
+               bool siteRepeats,
+               bool packedTips,
+               bool edgeTrials,
+               bool powerOfTwoScaling,
+               bool lazyScaling,
+               bool multiCall,
+               bool bufferArena,
+               bool lazyBuffers,
+               bool checkpointing,
+               bool scratchFile,
+               bool patternTiling,
+               bool interleavedPatterns,
+               bool fusedRoot,
+               bool gaps,
+               bool gapSkipping,
+               bool printStatistics,
+               bool benchmarkCache,
+               bool tuneCPU,
+               bool hybrid,
+               bool distributed,
+               bool resetInstances,
+               bool growInstances,
+               bool saveState,
+               bool estimateUsage,
+               bool newPartitionsPerRep,
+               bool useRateMatrix,
+               bool bootstrapWeights,
+               int replicateCount,
+               bool mixedPrecision,
+               double* outLogL)
 {
 
     int instanceCount = 1;
@@ -1592,6 +1732,13 @@ void runBeagle(int resource,
     int partialCount = ((ntaxa+internalCount)-compactTipCount)*eigenCount;
     int scaleCount = ((manualScaling || dynamicScaling) ? ntaxa : 0);
 
+    // the scale factors are accumulated between the update and the root likelihood otherwise
+    if (fusedRoot && (unrooted || partitionCount > 1 || eigenCount > 1 || instanceCount > 1 ||
+                      multiCall || manualScaling || autoScaling || dynamicScaling)) {
+        fprintf(stdout, "Fused root likelihood only used for one rooted, unscaled instance\n\n");
+        fusedRoot = false;
+    }
+
     int modelCount = eigenCount * partitionCount;
     
     BeagleInstanceDetails instDetails;
@@ -1611,7 +1758,14 @@ void runBeagle(int resource,
                 benchmarkFlags = BEAGLE_BENCHFLAG_SCALING_ALWAYS;
         }
 
-        long preferenceFlags = (enableThreads ? BEAGLE_FLAG_THREADING_CPP : 0);
+        if (benchmarkCache)
+            benchmarkFlags |= BEAGLE_BENCHFLAG_CACHE;
+
+        if (tuneCPU)
+            benchmarkFlags |= BEAGLE_BENCHFLAG_TUNE_CPU;
+
+        long preferenceFlags = (enableThreads ? BEAGLE_FLAG_THREADING_CPP : 0) |
+                               (enableOpenMP ? BEAGLE_FLAG_THREADING_OPENMP : 0);
         long requirementFlags =
         (requireDoublePrecision ? BEAGLE_FLAG_PRECISION_DOUBLE : BEAGLE_FLAG_PRECISION_SINGLE) |
 	  (disableVector ? BEAGLE_FLAG_VECTOR_NONE : 0);
@@ -1650,6 +1804,8 @@ void runBeagle(int resource,
             printFlags(rBList->list[i].benchedFlags);
             fprintf(stdout, "\n");
             fprintf(stdout, "\t\t\tPerf : %.4f ms (%.2fx CPU)\n", rBList->list[i].benchmarkResult, rBList->list[i].performanceRatio);
+            if (rBList->list[i].threadCount > 0)
+                fprintf(stdout, "\t\t\tThreads : %d\n", rBList->list[i].threadCount);
         }
         fprintf(stdout, "\n");
         std::exit(0);
@@ -1688,6 +1844,40 @@ void runBeagle(int resource,
 #endif // HAVE_PLL
 
     std::vector<int> instances;
+    int matrixCount = (calcderivs ? (3*edgeCount*modelCount) : edgeCount*modelCount);
+
+    if (estimateUsage) {
+        BeagleResourceEstimateList* estimates = beagleEstimateResourceUsage(
+                    ntaxa, partialCount, compactTipCount, stateCount, instanceSitesCount[0],
+                    modelCount, matrixCount, rateCategoryCount, scaleCount*eigenCount,
+                    (multiRsrc ? resourceList : &resource), (multiRsrc ? resourceCount : 1),
+                    (enableThreads ? BEAGLE_FLAG_THREADING_CPP : 0) |
+                    (enableOpenMP ? BEAGLE_FLAG_THREADING_OPENMP : 0),
+                    (disableVector ? BEAGLE_FLAG_VECTOR_NONE : 0) |
+                    (opencl ? BEAGLE_FLAG_FRAMEWORK_OPENCL : 0) |
+                    (eigencomplex ? BEAGLE_FLAG_EIGEN_COMPLEX : BEAGLE_FLAG_EIGEN_REAL) |
+                    (dynamicScaling ? BEAGLE_FLAG_SCALING_DYNAMIC : 0) |
+                    (autoScaling ? BEAGLE_FLAG_SCALING_AUTO : 0) |
+                    (requireDoublePrecision ? BEAGLE_FLAG_PRECISION_DOUBLE : BEAGLE_FLAG_PRECISION_SINGLE));
+        if (estimates == NULL)
+            abort("Error: no resource usage estimates");
+        fprintf(stdout, "Resource usage estimates:\n");
+        for (int i = 0; i < estimates->length; i++) {
+            BeagleResourceEstimate* estimate = &estimates->list[i];
+            if (estimate->returnCode != BEAGLE_SUCCESS) {
+                fprintf(stdout, "\tResource %d (%s): no estimate\n", estimate->number, estimate->name);
+                continue;
+            }
+            fprintf(stdout, "\tResource %d (%s), %s: host %.2f MB, device %.2f MB",
+                    estimate->number, estimate->name, estimate->implName,
+                    estimate->hostBytes / 1048576.0, estimate->deviceBytes / 1048576.0);
+            if (estimate->benchmarkResult >= 0)
+                fprintf(stdout, ", cached benchmark %.4f ms (%.2fx CPU)",
+                        estimate->benchmarkResult, estimate->performanceRatio);
+            fprintf(stdout, "\n");
+        }
+        fprintf(stdout, "\n");
+    }
 #ifdef HAVE_PLL
     if (!pllOnly) {
 #endif
@@ -1700,23 +1890,28 @@ void runBeagle(int resource,
         }
 
         // create an instance of the BEAGLE library
-        int instance = beagleCreateInstance(
+        int instance = (hybrid ? createHybridInstance :
+                        distributed ? createDistributedInstance :
+                        sharded ? beagleCreateShardedInstance : beagleCreateInstance)(
                     ntaxa,            /**< Number of tip data elements (input) */
                     partialCount, /**< Number of partials buffers to create (input) */
                     compactTipCount,    /**< Number of compact state representation buffers to create (input) */
                     stateCount,       /**< Number of states in the continuous-time Markov chain (input) */
-                    instanceSitesCount[inst],           /**< Number of site patterns to be handled by the instance (input) */
+                    (growInstances ? (instanceSitesCount[inst] + 1) / 2 : instanceSitesCount[inst]),           /**< Number of site patterns to be handled by the instance (input) */
                     modelCount,               /**< Number of rate matrix eigen-decomposition buffers to allocate (input) */
-                    (calcderivs ? (3*edgeCount*modelCount) : edgeCount*modelCount),/**< Number of rate matrix buffers (input) */
+                    (growInstances ? edgeCount : matrixCount),/**< Number of rate matrix buffers (input) */
                     rateCategoryCount,/**< Number of rate categories */
                     scaleCount*eigenCount,          /**< scaling buffers */
-                    &instanceResource,        /**< List of potential resource on which this instance is allowed (input, NULL implies no restriction */
-                    1,                /**< Length of resourceList list (input) */
+                    (sharded ? resourceList : &instanceResource),        /**< List of potential resource on which this instance is allowed (input, NULL implies no restriction */
+                    (sharded ? resourceCount : 1),                /**< Length of resourceList list (input) */
                     (enableThreads ? BEAGLE_FLAG_THREADING_CPP : 0) |
-                    ((multiRsrc && !clientThreadingEnabled) ? BEAGLE_FLAG_COMPUTATION_ASYNCH : 0) |
+                    (enableOpenMP ? BEAGLE_FLAG_THREADING_OPENMP : 0) |
+                    ((multiRsrc && !clientThreadingEnabled && !multiCall) ? BEAGLE_FLAG_COMPUTATION_ASYNCH : 0) |
 		    (multiRsrc ? BEAGLE_FLAG_PARALLELOPS_STREAMS : 0),         /**< Bit-flags indicating preferred implementation charactertistics, see BeagleFlags (input) */
                     (disableVector ? BEAGLE_FLAG_VECTOR_NONE : 0) |
                     (opencl ? BEAGLE_FLAG_FRAMEWORK_OPENCL : 0) |
+                    (avx512 ? BEAGLE_FLAG_VECTOR_AVX512 : 0) |
+                    (sse ? BEAGLE_FLAG_VECTOR_SSE : 0) |
                     (ievectrans ? BEAGLE_FLAG_INVEVEC_TRANSPOSED : BEAGLE_FLAG_INVEVEC_STANDARD) |
                     (logscalers ? BEAGLE_FLAG_SCALERS_LOG : BEAGLE_FLAG_SCALERS_RAW) |
                     (eigencomplex ? BEAGLE_FLAG_EIGEN_COMPLEX : BEAGLE_FLAG_EIGEN_REAL) |
@@ -1726,8 +1921,12 @@ void runBeagle(int resource,
                     &instDetails);
 
         if (instance < 0) {
-            fprintf(stderr, "Failed to obtain BEAGLE instance\n\n");
-            return;
+            abort("Failed to obtain BEAGLE instance");
+        } else if (growInstances &&
+                   beagleGrowInstance(instance, ntaxa, partialCount, compactTipCount,
+                                      instanceSitesCount[inst], matrixCount,
+                                      scaleCount*eigenCount) != BEAGLE_SUCCESS) {
+            abort("Failed to grow BEAGLE instance");
         } else {
             instances.push_back(instance);
 
@@ -1747,6 +1946,82 @@ void runBeagle(int resource,
                 beagleSetCPUThreadCount(instance, threadCount);
             }
 
+            if (calibrateThreads) {
+                beagleCalibrateCPUThreadCount(instance);
+            }
+
+            if (numaPlacement) {
+                beagleSetCPUNumaPlacement(instance, 1);
+            }
+
+            if (threadSpin > 0) {
+                beagleSetCPUThreadSpin(instance, threadSpin);
+            }
+
+            if (bufferArena && beagleSetCPUBufferArena(instance, 1, 2 * 1024 * 1024) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Buffer arena not available\n\n");
+            }
+
+            if (scratchFile) {
+                const char* scratchDirectory = getenv("TMPDIR");
+                if (beagleSetCPUScratchFile(instance, (scratchDirectory != NULL ? scratchDirectory : "/tmp"),
+                                            4) != BEAGLE_SUCCESS)
+                    fprintf(stdout, "Scratch file not available\n\n");
+            }
+
+            if (lazyBuffers && beagleSetLazyBufferAllocation(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Lazy buffer allocation not available\n\n");
+            }
+
+            if (patternTiling && beagleSetCPUPatternTiling(instance, 256) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Pattern tiling not available\n\n");
+            }
+
+            if (interleavedPatterns && beagleSetCPUInterleavedPatterns(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Interleaved patterns not available\n\n");
+            }
+
+            if (checkpointing &&
+                beagleSetPartialsCheckpointing(instance, std::max(ntaxa / 4, 2)) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Partials checkpointing not available\n\n");
+            }
+
+            if (parallelOperations) {
+                beagleSetCPUParallelOperations(instance, 1);
+            }
+
+            if (matrixCache && beagleSetTransitionMatrixCache(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Transition matrix cache not available\n\n");
+            }
+
+            if (bufferVersioning && beagleSetBufferVersioning(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Buffer versioning not available\n\n");
+            }
+
+            if (siteRepeats && beagleSetSiteRepeats(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Site repeats not available\n\n");
+            }
+
+            if (gapSkipping && beagleSetGapPatternSkipping(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Gap pattern skipping not available\n\n");
+            }
+
+            if (packedTips && beagleSetTipStatesPacking(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Packed tip states not available\n\n");
+            }
+
+            if (powerOfTwoScaling && beagleSetPowerOfTwoScaling(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Power-of-two scaling not available\n\n");
+            }
+
+            if (lazyScaling && beagleSetScalingThreshold(instance, ldexp(1.0, -32)) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Scaling threshold not available\n\n");
+            }
+
+            if (mixedPrecision && beagleSetMixedPrecision(instance, 1) != BEAGLE_SUCCESS) {
+                fprintf(stdout, "Mixed precision not available\n\n");
+            }
+
         }
     }
 #ifdef HAVE_PLL
@@ -1762,6 +2037,8 @@ void runBeagle(int resource,
     {
         if (compactTipCount == 0 || (i >= (compactTipCount-1) && i != (ntaxa-1))) {
             double* tmpPartials = getRandomTipPartials(nsites, stateCount);
+            if (gaps)
+                addRandomTipGaps(tmpPartials, nsites, stateCount);
             size_t instanceOffset = 0;
             for(int inst=0; inst<instanceCount; inst++) {
 #ifdef HAVE_PLL
@@ -1783,12 +2060,12 @@ void runBeagle(int resource,
             int* tmpStates;
             if (!alignmentFromFile) {
                 tmpStates = getRandomTipStates(nsites, stateCount);
+                if (gaps)
+                    addRandomTipGaps(tmpStates, nsites, stateCount);
             }
-#ifdef HAVE_NCL
             else {
-                tmpStates = ncl_getAlignmentTipStates(nsites, i);
+                tmpStates = getAlignmentTipStates(nsites, i);
             }
-#endif // HAVE_NCL
             size_t instanceOffset = 0;
             for(int inst=0; inst<instanceCount; inst++) {
 #ifdef HAVE_PLL
@@ -2071,7 +2348,12 @@ void runBeagle(int resource,
                                   int* replicateInstances,
                                   int* replicateInstanceSitesCount) {
 
-        if (partitionCount > 1 && i==0) { //!(i % rescaleFrequency)) {
+        if (partitionCount > 1 && (i==0 || newPartitionsPerRep)) { //!(i % rescaleFrequency)) {
+            if (i > 0) {
+                // patterns move to other partitions, as during a search over partition schemes
+                for (int j = 0; j < nsites; j++)
+                    patternPartitions[j] = gt_rand()%partitionCount;
+            }
             if (beagleSetPatternPartitions(replicateInstances[0], partitionCount, patternPartitions) != BEAGLE_SUCCESS) {
                 printf("ERROR: No BEAGLE implementation for beagleSetPatternPartitions\n");
                 exit(-1);
@@ -2095,6 +2377,15 @@ void runBeagle(int resource,
             for (int eigenIndex=0; eigenIndex < modelCount; eigenIndex++) {
                 if (!setmatrix) {
                     for(int inst=0; inst<replicateInstanceCount; inst++) {
+                        if (useRateMatrix && !calcderivs) {
+                            // exponentiate the rate matrix directly instead of its eigen decomposition
+                            beagleUpdateTransitionMatricesWithRateMatrix(replicateInstances[inst],
+                                                       &rateMatrices[eigenIndex*stateCount*stateCount],
+                                                       &edgeIndices[eigenIndex*edgeCount],
+                                                       edgeLengths,
+                                                       edgeCount);
+                            continue;
+                        }
                         // tell BEAGLE to populate the transition matrices for the above edge lengths
                         beagleUpdateTransitionMatrices(replicateInstances[inst],     // instance
                                                        eigenIndex,             // eigenIndex
@@ -2141,10 +2432,33 @@ void runBeagle(int resource,
             gettimeofday(&time2, NULL);
 
             // update the partials
-            if (partitionCount > 1) {
-                beagleUpdatePartialsByPartition( replicateInstances[0],                   // instance
+            if (fusedRoot) {
+                beagleUpdatePartialsAndCalculateRootLogLikelihood(replicateInstances[0],     // instance
+                                    (BeagleOperation*)operations,     // operations
+                                    internalCount,                    // operationCount
+                                    BEAGLE_OP_NONE,                   // cumulative scaling index
+                                    categoryWeightsIndices[0],        // weights
+                                    stateFrequencyIndices[0],         // stateFrequencies
+                                    0,                                // writeRootPartials
+                                    replicateLogL);                   // outLogLikelihood
+            } else if (partitionCount > 1) {
+                if (beagleUpdatePartialsByPartition( replicateInstances[0],                   // instance
                                 (BeagleOperationByPartition*)operations,     // operations
-                                internalCount*eigenCount*partitionCount);    // operationCount
+                                internalCount*eigenCount*partitionCount) != BEAGLE_SUCCESS) {    // operationCount
+                    printf("ERROR: No BEAGLE implementation for beagleUpdatePartialsByPartition\n");
+                    exit(-1);
+                }
+            } else if (multiCall && replicateInstanceCount > 1) {
+                std::vector<const BeagleOperation*> instOperations(replicateInstanceCount,
+                                                                   (BeagleOperation*)operations);
+                std::vector<int> instOperationCounts(replicateInstanceCount, internalCount*eigenCount);
+                std::vector<int> instCumulativeScaleIndices(replicateInstanceCount,
+                                                            (dynamicScaling ? internalCount : BEAGLE_OP_NONE));
+                beagleUpdatePartialsMulti(replicateInstances,
+                                          replicateInstanceCount,
+                                          &instOperations[0],
+                                          &instOperationCounts[0],
+                                          &instCumulativeScaleIndices[0]);
             } else {
                 for(int inst=0; inst<replicateInstanceCount; inst++) {
                     beagleUpdatePartials( replicateInstances[inst],      // instance
@@ -2188,7 +2502,9 @@ void runBeagle(int resource,
 
         // calculate the site likelihoods at the root node
         if (!unrooted) {
-            if (partitionCount > 1) {
+            if (fusedRoot) {
+                // computed with the partials
+            } else if (partitionCount > 1) {
                 beagleCalculateRootLogLikelihoodsByPartition(
                                             replicateInstances[0],               // instance
                                             rootIndices,// bufferIndices
@@ -2200,6 +2516,29 @@ void runBeagle(int resource,
                                             eigenCount,                      // count
                                             partitionLogLs,
                                             replicateLogL);         // outLogLikelihoods
+            } else if (multiCall && replicateInstanceCount > 1) {
+                std::vector<int> instRootIndices, instWeightsIndices, instFrequencyIndices, instScaleIndices;
+                for(int inst=0; inst<replicateInstanceCount; inst++) {
+                    instRootIndices.insert(instRootIndices.end(), rootIndices, rootIndices + eigenCount);
+                    instWeightsIndices.insert(instWeightsIndices.end(), categoryWeightsIndices,
+                                              categoryWeightsIndices + eigenCount);
+                    instFrequencyIndices.insert(instFrequencyIndices.end(), stateFrequencyIndices,
+                                                stateFrequencyIndices + eigenCount);
+                    instScaleIndices.insert(instScaleIndices.end(), cumulativeScalingFactorIndices,
+                                            cumulativeScalingFactorIndices + eigenCount);
+                }
+                std::vector<double> instLogL(replicateInstanceCount);
+                beagleCalculateRootLogLikelihoodsMulti(replicateInstances,
+                                                       replicateInstanceCount,
+                                                       &instRootIndices[0],
+                                                       &instWeightsIndices[0],
+                                                       &instFrequencyIndices[0],
+                                                       &instScaleIndices[0],
+                                                       eigenCount,
+                                                       &instLogL[0]);
+                *replicateLogL = 0.0;
+                for(int inst=0; inst<replicateInstanceCount; inst++)
+                    *replicateLogL += instLogL[inst];
             } else {
                 for(int inst=0; inst<replicateInstanceCount; inst++) {
                     beagleCalculateRootLogLikelihoods(replicateInstances[inst],               // instance
@@ -2285,15 +2624,31 @@ void runBeagle(int resource,
 //  replicate loop
     for (int i=0; i<nreps; i++){
 
+        // every partial and scale factor is computed again in this replicate
+        if (hybrid && i > 0 && !(manualScaling && (i % rescaleFrequency))) {
+            for (size_t inst = 0; inst < instances.size(); inst++)
+                beagleRebalanceInstance(instances[inst]);
+        }
+
+        // the data and model set below fill the instance again
+        if (resetInstances && i > 0) {
+            for (size_t inst = 0; inst < instances.size(); inst++)
+                beagleResetInstance(instances[inst]);
+        }
+
         if (newDataPerRep) {
             for(int ii=0; ii<ntaxa; ii++)
             {
                 if (compactTipCount == 0 || (ii >= (compactTipCount-1) && ii != (ntaxa-1))) {
                     double* tmpPartials = getRandomTipPartials(nsites, stateCount);
+                    if (gaps)
+                        addRandomTipGaps(tmpPartials, nsites, stateCount);
                     beagleSetTipPartials(instances[0], ii, tmpPartials);
                     free(tmpPartials);
                 } else {
                     int* tmpStates = getRandomTipStates(nsites, stateCount);
+                    if (gaps)
+                        addRandomTipGaps(tmpStates, nsites, stateCount);
                     beagleSetTipStates(instances[0], ii, tmpStates);
                     free(tmpStates);                
                 }
@@ -2484,6 +2839,9 @@ void runBeagle(int resource,
     else
         fprintf(stdout, "logL = %.5f d1 = %.5f d2 = %.5f\n", logL, deriv1, deriv2);
 
+    if (outLogL != NULL)
+        *outLogL = logL;
+
     if (partitionCount > 1) {
         fprintf(stdout, " (");
         for (int p=0; p < partitionCount; p++) {
@@ -2549,6 +2907,224 @@ void runBeagle(int resource,
         free(siteLogLs);
     }
 
+    if ((siteRepeats || packedTips || powerOfTwoScaling || lazyScaling || patternTiling ||
+         interleavedPatterns || gapSkipping) && !setmatrix) {
+        // the last replicate again with the modes that should not change the likelihood turned
+        // off, rescaling every pattern
+        for (size_t inst = 0; inst < instances.size(); inst++) {
+            int instance = instances[inst];
+            if ((siteRepeats && beagleSetSiteRepeats(instance, 0) != BEAGLE_SUCCESS) ||
+                (gapSkipping && beagleSetGapPatternSkipping(instance, 0) != BEAGLE_SUCCESS) ||
+                (packedTips && beagleSetTipStatesPacking(instance, 0) != BEAGLE_SUCCESS) ||
+                (powerOfTwoScaling && beagleSetPowerOfTwoScaling(instance, 0) != BEAGLE_SUCCESS) ||
+                (lazyScaling && beagleSetScalingThreshold(instance, 0.0) != BEAGLE_SUCCESS) ||
+                (patternTiling && beagleSetCPUPatternTiling(instance, 0) != BEAGLE_SUCCESS) ||
+                (interleavedPatterns && beagleSetCPUInterleavedPatterns(instance, 0) != BEAGLE_SUCCESS))
+                abort("could not turn off the modes for the reference likelihood");
+        }
+        if (manualScaling) {
+            for (int j = 0; j < operationCount; j++) {
+                operations[beagleOpCount*j+1] = j / partitionCount;
+                operations[beagleOpCount*j+2] = BEAGLE_OP_NONE;
+            }
+        }
+        double savedDeriv1 = deriv1, savedDeriv2 = deriv2;
+        double referenceLogL = 0.0;
+        if (clientThreadingEnabled) {
+            for (int j = 0; j < instanceCount; j++) {
+                double instLogL = 0.0;
+                computeLikelihood(0, &instLogL, 1, &instances[j], &instanceSitesCount[j]);
+                referenceLogL += instLogL;
+            }
+        } else {
+            computeLikelihood(0, &referenceLogL, instanceCount, &instances[0], &instanceSitesCount[0]);
+        }
+        deriv1 = savedDeriv1;
+        deriv2 = savedDeriv2;
+        double maxDiff = std::abs(logL - referenceLogL) / (1.0 + std::abs(referenceLogL));
+        fprintf(stdout, "reference logL = %.5f, max relative difference = %.3g\n", referenceLogL, maxDiff);
+        if (!(maxDiff < (requireDoublePrecision ? 1e-8 : 1e-4)))
+            abort("likelihood differs from the run with the modes turned off");
+    }
+
+    if (edgeTrials) {
+        // the matrices of every edge as trials for the last tip edge, batched and one by one
+        std::vector<int> trialIndices(edgeCount), trialIndicesD1(edgeCount), trialIndicesD2(edgeCount);
+        for (int t = 0; t < edgeCount; t++) {
+            trialIndices[t] = t;
+            trialIndicesD1[t] = t + edgeCount * modelCount;
+            trialIndicesD2[t] = t + 2 * edgeCount * modelCount;
+        }
+        std::vector<double> trialLogL(edgeCount), trialD1(edgeCount), trialD2(edgeCount);
+        beagleCalculateEdgeLogLikelihoodsForMatrices(instances[0], rootIndices[0], lastTipIndices[0],
+                                                     &trialIndices[0], &trialIndicesD1[0],
+                                                     &trialIndicesD2[0], categoryWeightsIndices[0],
+                                                     stateFrequencyIndices[0],
+                                                     cumulativeScalingFactorIndices[0], edgeCount,
+                                                     &trialLogL[0], &trialD1[0], &trialD2[0]);
+        double maxDiff = 0.0;
+        for (int t = 0; t < edgeCount; t++) {
+            double singleLogL, singleD1, singleD2;
+            beagleCalculateEdgeLogLikelihoods(instances[0], rootIndices, lastTipIndices,
+                                              &trialIndices[t], &trialIndicesD1[t], &trialIndicesD2[t],
+                                              categoryWeightsIndices, stateFrequencyIndices,
+                                              cumulativeScalingFactorIndices, 1,
+                                              &singleLogL, &singleD1, &singleD2);
+            // relative, as single precision sums of many patterns round differently
+            maxDiff = std::max(maxDiff, std::abs(trialLogL[t] - singleLogL) / (1.0 + std::abs(singleLogL)));
+            maxDiff = std::max(maxDiff, std::abs(trialD1[t] - singleD1) / (1.0 + std::abs(singleD1)));
+            maxDiff = std::max(maxDiff, std::abs(trialD2[t] - singleD2) / (1.0 + std::abs(singleD2)));
+        }
+
+        // the site results of every trial in one call, against reading them back after each
+        std::vector<int> trialParents(edgeCount, rootIndices[0]), trialChildren(edgeCount, lastTipIndices[0]);
+        std::vector<int> trialWeights(edgeCount, categoryWeightsIndices[0]);
+        std::vector<int> trialFrequencies(edgeCount, stateFrequencyIndices[0]);
+        std::vector<int> trialScales(edgeCount, cumulativeScalingFactorIndices[0]);
+        std::vector<double> trialSites((size_t) edgeCount * nsites), trialSitesD1(trialSites.size()),
+                            trialSitesD2(trialSites.size());
+        beagleCalculateEdgeSiteLogLikelihoods(instances[0], &trialParents[0], &trialChildren[0],
+                                              &trialIndices[0], &trialIndicesD1[0], &trialIndicesD2[0],
+                                              &trialWeights[0], &trialFrequencies[0], &trialScales[0],
+                                              edgeCount, &trialSites[0], &trialSitesD1[0],
+                                              &trialSitesD2[0]);
+        std::vector<double> singleSites(nsites), singleSitesD1(nsites), singleSitesD2(nsites);
+        for (int t = 0; t < edgeCount; t++) {
+            double singleLogL, singleD1, singleD2;
+            beagleCalculateEdgeLogLikelihoods(instances[0], rootIndices, lastTipIndices,
+                                              &trialIndices[t], &trialIndicesD1[t], &trialIndicesD2[t],
+                                              categoryWeightsIndices, stateFrequencyIndices,
+                                              cumulativeScalingFactorIndices, 1,
+                                              &singleLogL, &singleD1, &singleD2);
+            beagleGetSiteLogLikelihoods(instances[0], &singleSites[0]);
+            beagleGetSiteDerivatives(instances[0], &singleSitesD1[0], &singleSitesD2[0]);
+            for (int k = 0; k < nsites; k++) {
+                const size_t row = (size_t) t * nsites + k;
+                maxDiff = std::max(maxDiff, std::abs(trialSites[row] - singleSites[k]) / (1.0 + std::abs(singleSites[k])));
+                maxDiff = std::max(maxDiff, std::abs(trialSitesD1[row] - singleSitesD1[k]) / (1.0 + std::abs(singleSitesD1[k])));
+                maxDiff = std::max(maxDiff, std::abs(trialSitesD2[row] - singleSitesD2[k]) / (1.0 + std::abs(singleSitesD2[k])));
+            }
+        }
+        fprintf(stdout, "edge trials = %d, max relative difference = %.3g\n", edgeCount, maxDiff);
+        if (!(maxDiff < 1e-4))
+            abort("batched edge trials differ from single edge likelihoods");
+    }
+
+    if (saveState) {
+        // the state of the last evaluation is saved, the partials, tips and weights are
+        // cleared, and the root likelihood must be found unchanged once the state is loaded
+        const char* stateFile = "synthetictest.state";
+        double savedLogL, loadedLogL;
+        beagleCalculateRootLogLikelihoods(instances[0], rootIndices, categoryWeightsIndices,
+                                          stateFrequencyIndices, cumulativeScalingFactorIndices,
+                                          eigenCount, &savedLogL);
+        if (beagleSaveInstanceState(instances[0], stateFile) != BEAGLE_SUCCESS)
+            abort("could not save instance state");
+        std::vector<double> zeroPartials((size_t) rateCategoryCount * nsites * stateCount, 0.0);
+        for (int i = ntaxa; i < partialCount + compactTipCount; i++)
+            beagleSetPartials(instances[0], i, &zeroPartials[0]);
+        beagleResetInstance(instances[0]);
+        int loadCode = beagleLoadInstanceState(instances[0], stateFile);
+        remove(stateFile);
+        if (loadCode != BEAGLE_SUCCESS)
+            abort("could not load instance state");
+        beagleCalculateRootLogLikelihoods(instances[0], rootIndices, categoryWeightsIndices,
+                                          stateFrequencyIndices, cumulativeScalingFactorIndices,
+                                          eigenCount, &loadedLogL);
+        fprintf(stdout, "saved state logL = %.5f, loaded state logL = %.5f\n", savedLogL, loadedLogL);
+        if (!(std::abs(savedLogL - loadedLogL) <= 1e-10 * std::abs(savedLogL)))
+            abort("likelihood of loaded instance state differs from saved");
+    }
+
+    if (bootstrapWeights) {
+        // pattern weights of replicates resampled from the sites, evaluated in one call and
+        // compared with setting each as the pattern weights
+        const int replicateCount = 100;
+        int siteCount = 0;
+        for (int i = 0; i < nsites; i++)
+            siteCount += (int) patternWeights[i];
+        std::vector<double> cumulativeWeights(nsites);
+        double cumulative = 0.0;
+        for (int i = 0; i < nsites; i++) {
+            cumulative += patternWeights[i];
+            cumulativeWeights[i] = cumulative;
+        }
+        std::vector<double> replicateWeights((size_t) replicateCount * nsites, 0.0);
+        for (int r = 0; r < replicateCount; r++) {
+            for (int s = 0; s < siteCount; s++) {
+                double u = (gt_rand() % siteCount) + 0.5;
+                int k = (int) (std::lower_bound(cumulativeWeights.begin(), cumulativeWeights.end(), u) -
+                               cumulativeWeights.begin());
+                replicateWeights[(size_t) r * nsites + k] += 1.0;
+            }
+        }
+        std::vector<double> replicateLogLs(replicateCount);
+        beagleCalculateRootLogLikelihoodsWithPatternWeights(instances[0], rootIndices,
+                                                            categoryWeightsIndices,
+                                                            stateFrequencyIndices,
+                                                            cumulativeScalingFactorIndices,
+                                                            eigenCount, &replicateWeights[0],
+                                                            replicateCount, &replicateLogLs[0]);
+        double maxDiff = 0.0;
+        for (int r = 0; r < replicateCount; r++) {
+            double singleLogL;
+            beagleSetPatternWeights(instances[0], &replicateWeights[(size_t) r * nsites]);
+            beagleCalculateRootLogLikelihoods(instances[0], rootIndices, categoryWeightsIndices,
+                                              stateFrequencyIndices, cumulativeScalingFactorIndices,
+                                              eigenCount, &singleLogL);
+            maxDiff = std::max(maxDiff, std::abs(replicateLogLs[r] - singleLogL) / (1.0 + std::abs(singleLogL)));
+        }
+        beagleSetPatternWeights(instances[0], patternWeights);
+        fprintf(stdout, "bootstrap replicates = %d, max relative difference = %.3g\n",
+                replicateCount, maxDiff);
+        if (!(maxDiff < 1e-4))
+            abort("pattern weight replicates differ from single root likelihoods");
+    }
+
+    if (replicateCount > 1) {
+        // the rate categories as replicates with edge lengths of their own, evaluated in one
+        // pass and compared with one pass per replicate with the other categories weighted out
+        const int replicateCategoryCount = rateCategoryCount / replicateCount;
+        std::vector<double> replicateLengths((size_t) edgeCount * replicateCount);
+        for (size_t i = 0; i < replicateLengths.size(); i++)
+            replicateLengths[i] = gt_rand() / (double) GT_RAND_MAX;
+        std::vector<int> replicateEigenIndices(replicateCount, 0);
+        std::vector<int> replicateFrequencyIndices(replicateCount, stateFrequencyIndices[0]);
+        std::vector<double> blockWeights(rateCategoryCount, 1.0 / replicateCategoryCount);
+        const int noScaling = BEAGLE_OP_NONE;
+
+        beagleSetCategoryWeights(instances[0], categoryWeightsIndices[0], &blockWeights[0]);
+        beagleUpdateTransitionMatricesForReplicates(instances[0], &replicateEigenIndices[0], edgeIndices,
+                                                    &replicateLengths[0], edgeCount, replicateCount);
+        beagleUpdatePartials(instances[0], (BeagleOperation*) operations, internalCount, BEAGLE_OP_NONE);
+        std::vector<double> replicateLogLs(replicateCount);
+        beagleCalculateRootLogLikelihoodsForReplicates(instances[0], rootIndices[0],
+                                                       categoryWeightsIndices[0],
+                                                       &replicateFrequencyIndices[0], BEAGLE_OP_NONE,
+                                                       replicateCount, &replicateLogLs[0]);
+
+        double maxDiff = 0.0;
+        std::vector<double> singleLengths(edgeCount);
+        for (int r = 0; r < replicateCount; r++) {
+            for (int e = 0; e < edgeCount; e++)
+                singleLengths[e] = replicateLengths[(size_t) e * replicateCount + r];
+            std::vector<double> maskedWeights(rateCategoryCount, 0.0);
+            for (int l = r * replicateCategoryCount; l < (r + 1) * replicateCategoryCount; l++)
+                maskedWeights[l] = blockWeights[l];
+            beagleSetCategoryWeights(instances[0], categoryWeightsIndices[0], &maskedWeights[0]);
+            beagleUpdateTransitionMatrices(instances[0], 0, edgeIndices, NULL, NULL,
+                                           &singleLengths[0], edgeCount);
+            beagleUpdatePartials(instances[0], (BeagleOperation*) operations, internalCount, BEAGLE_OP_NONE);
+            double singleLogL;
+            beagleCalculateRootLogLikelihoods(instances[0], rootIndices, categoryWeightsIndices,
+                                              stateFrequencyIndices, &noScaling, 1, &singleLogL);
+            maxDiff = std::max(maxDiff, std::abs(replicateLogLs[r] - singleLogL) / (1.0 + std::abs(singleLogL)));
+        }
+        fprintf(stdout, "replicates = %d, max relative difference = %.3g\n", replicateCount, maxDiff);
+        if (!(maxDiff < 1e-4))
+            abort("replicate root likelihoods differ from one replicate at a time");
+    }
+
     if (partitionCount > 1) {
         free(patternPartitions);
     }
@@ -2590,6 +3166,28 @@ void runBeagle(int resource,
     }
     std::cout << "\n";
     
+    if (printStatistics) {
+        const char* callNames[BEAGLE_CALL_COUNT] = {"setTipStates", "setTipPartials", "setPartials",
+            "getPartials", "setEigen", "setMatrices", "updateMatrices", "updatePartials",
+            "scaleFactors", "rootLnL", "edgeLnL", "getSiteResults"};
+        for(int inst=0; inst<instanceCount; inst++) {
+            BeagleStatistics statistics;
+            if (beagleGetInstanceStatistics(instances[inst], &statistics) != BEAGLE_SUCCESS)
+                continue;
+            fprintf(stdout, "Statistics of instance %d:\n", inst);
+            for (int i = 0; i < BEAGLE_CALL_COUNT; i++) {
+                if (statistics.callCount[i] > 0)
+                    fprintf(stdout, "\t%-15s %8lld calls %12.3f ms\n", callNames[i],
+                            statistics.callCount[i], statistics.callSeconds[i] * 1000.0);
+            }
+            fprintf(stdout, "\toperations %lld, scaling %lld\n", statistics.operationCount,
+                    statistics.scalingCount);
+            fprintf(stdout, "\thost to device %lld bytes, device to host %lld bytes, device %.3f ms\n\n",
+                    statistics.hostToDeviceBytes, statistics.deviceToHostBytes,
+                    statistics.deviceSeconds * 1000.0);
+        }
+    }
+
     for(int inst=0; inst<instanceCount; inst++) {
         beagleFinalizeInstance(instances[inst]);
     }
@@ -2866,7 +3464,7 @@ void printResourceList() {
 
 void helpMessage() {
     std::cerr << "Usage:\n\n";
-    std::cerr << "synthetictest [--help] [--resourcelist] [--benchmarklist] [--states <integer>] [--taxa <integer>] [--sites <integer>] [--rates <integer>] [--manualscale] [--autoscale] [--dynamicscale] [--rsrc <integer>] [--reps <integer>] [--doubleprecision] [--disablevector] [--enablethreads] [--compacttips <integer>] [--seed <integer>] [--rescalefrequency <integer>] [--fulltiming] [--unrooted] [--calcderivs] [--logscalers] [--eigencount <integer>] [--eigencomplex] [--ievectrans] [--setmatrix] [--opencl] [--partitions <integer>] [--sitelikes] [--newdata] [--randomtree] [--reroot] [--stdrand] [--pectinate] [--multirsrc] [--postorder] [--newtree] [--newparameters] [--threadcount] [--clientthreads]";
+    std::cerr << "synthetictest [--help] [--resourcelist] [--benchmarklist] [--states <integer>] [--taxa <integer>] [--sites <integer>] [--rates <integer>] [--manualscale] [--autoscale] [--dynamicscale] [--rsrc <integer>] [--reps <integer>] [--doubleprecision] [--disablevector] [--enablethreads] [--openmp] [--compacttips <integer>] [--seed <integer>] [--rescalefrequency <integer>] [--fulltiming] [--unrooted] [--calcderivs] [--logscalers] [--eigencount <integer>] [--eigencomplex] [--ievectrans] [--setmatrix] [--opencl] [--partitions <integer>] [--sitelikes] [--newdata] [--randomtree] [--reroot] [--stdrand] [--pectinate] [--multirsrc] [--postorder] [--newtree] [--newparameters] [--threadcount] [--clientthreads] [--sharedthreads <integer>] [--calibratethreads] [--numa] [--threadspin <integer>] [--paralleloperations] [--avx512] [--sse] [--sharded] [--matrixcache] [--versioning] [--siterepeats] [--packedtips] [--edgetrials] [--powertwoscaling] [--lazyscaling] [--multicall] [--arena] [--lazybuffers] [--checkpointing] [--scratchfile] [--tiling] [--interleaved] [--fusedroot] [--gaps] [--gapskipping] [--statistics] [--benchmarkcache] [--tunecpu] [--hybrid] [--distributed] [--reset] [--grow] [--savestate] [--estimate] [--newpartitions] [--ratematrix] [--bootstrapweights] [--replicates <integer>] [--mixedprecision]";
 #ifdef HAVE_PLL
     std::cerr << " [--plltest]";
     std::cerr << " [--pllonly]";
@@ -2898,6 +3496,7 @@ void interpretCommandLineParameters(int argc, const char* argv[],
                                     bool* requireDoublePrecision,
                                     bool* disableVector,
                                     bool* enableThreads,
+                                    bool* enableOpenMP,
                                     int* compactTipCount,
                                     int* randomSeed,
                                     int* rescaleFrequency,
@@ -2927,7 +3526,46 @@ void interpretCommandLineParameters(int argc, const char* argv[],
                                     char** alignmentdna,
                                     bool* compress,
                                     char** treenewick,
-                                    bool* clientThreadingEnabled)    {
+                                    bool* clientThreadingEnabled,
+                                    int* sharedThreadCount,
+                                    bool* calibrateThreads,
+                                    bool* numaPlacement,
+                                    int* threadSpin,
+                                    bool* parallelOperations,
+                                    bool* avx512,
+                                    bool* sse,
+                                    bool* sharded,
+                                    bool* matrixCache,
+                                    bool* bufferVersioning,
+                                    bool* siteRepeats,
+                                    bool* packedTips,
+                                    bool* edgeTrials,
+                                    bool* powerOfTwoScaling,
+                                    bool* lazyScaling,
+                                    bool* multiCall,
+                                    bool* bufferArena,
+                                    bool* lazyBuffers,
+                                    bool* checkpointing,
+                                    bool* scratchFile,
+                                    bool* patternTiling,
+                                    bool* interleavedPatterns,
+                                    bool* fusedRoot,
+                                    bool* gaps,
+                                    bool* gapSkipping,
+                                    bool* printStatistics,
+                                    bool* benchmarkCache,
+                                    bool* tuneCPU,
+                                    bool* hybrid,
+                                    bool* distributed,
+                                    bool* resetInstances,
+                                    bool* growInstances,
+                                    bool* saveState,
+                                    bool* estimateUsage,
+                                    bool* newPartitionsPerRep,
+                                    bool* useRateMatrix,
+                                    bool* bootstrapWeights,
+                                    int* replicateCount,
+                                    bool* mixedPrecision)    {
     bool expecting_stateCount = false;
     bool expecting_ntaxa = false;
     bool expecting_nsites = false;
@@ -2940,6 +3578,9 @@ void interpretCommandLineParameters(int argc, const char* argv[],
     bool expecting_eigenCount = false;
     bool expecting_partitions = false;
     bool expecting_threads = false;
+    bool expecting_sharedthreads = false;
+    bool expecting_threadspin = false;
+    bool expecting_replicates = false;
     bool expecting_alignmentdna = false;
     bool expecting_treenewick = false;
     
@@ -2988,6 +3629,15 @@ void interpretCommandLineParameters(int argc, const char* argv[],
         } else if (expecting_threads) {
             *threadCount = (unsigned)atoi(option.c_str());
             expecting_threads = false;
+        } else if (expecting_sharedthreads) {
+            *sharedThreadCount = (unsigned)atoi(option.c_str());
+            expecting_sharedthreads = false;
+        } else if (expecting_threadspin) {
+            *threadSpin = (unsigned)atoi(option.c_str());
+            expecting_threadspin = false;
+        } else if (expecting_replicates) {
+            *replicateCount = (unsigned)atoi(option.c_str());
+            expecting_replicates = false;
         } else if (expecting_alignmentdna) {
             *alignmentdna = (char*) malloc(sizeof(char) * sizeof(option.c_str()));
             strcpy(*alignmentdna, option.c_str());
@@ -3034,6 +3684,8 @@ void interpretCommandLineParameters(int argc, const char* argv[],
             *disableVector = true;
         } else if (option == "--enablethreads") {
             *enableThreads = true;
+        } else if (option == "--openmp") {
+            *enableOpenMP = true;
         } else if (option == "--unrooted") {
             *unrooted = true;
         } else if (option == "--calcderivs") {
@@ -3083,11 +3735,96 @@ void interpretCommandLineParameters(int argc, const char* argv[],
             *newParametersPerRep = true;
         } else if (option == "--threadcount") {
             expecting_threads = true;
+        } else if (option == "--sharedthreads") {
+            expecting_sharedthreads = true;
+        } else if (option == "--calibratethreads") {
+            *calibrateThreads = true;
+        } else if (option == "--numa") {
+            *numaPlacement = true;
+        } else if (option == "--threadspin") {
+            expecting_threadspin = true;
+        } else if (option == "--paralleloperations") {
+            *parallelOperations = true;
+        } else if (option == "--avx512") {
+            *avx512 = true;
+        } else if (option == "--sse") {
+            *sse = true;
+        } else if (option == "--sharded") {
+            *sharded = true;
+        } else if (option == "--matrixcache") {
+            *matrixCache = true;
+        } else if (option == "--versioning") {
+            *bufferVersioning = true;
+        } else if (option == "--siterepeats") {
+            *siteRepeats = true;
+        } else if (option == "--packedtips") {
+            *packedTips = true;
+        } else if (option == "--edgetrials") {
+            *edgeTrials = true;
+        } else if (option == "--powertwoscaling") {
+            *powerOfTwoScaling = true;
+        } else if (option == "--lazyscaling") {
+            *lazyScaling = true;
+        } else if (option == "--multicall") {
+            *multiCall = true;
+        } else if (option == "--arena") {
+            *bufferArena = true;
+        } else if (option == "--lazybuffers") {
+            *lazyBuffers = true;
+        } else if (option == "--checkpointing") {
+            *checkpointing = true;
+        } else if (option == "--scratchfile") {
+            *scratchFile = true;
+        } else if (option == "--tiling") {
+            *patternTiling = true;
+        } else if (option == "--interleaved") {
+            *interleavedPatterns = true;
+        } else if (option == "--fusedroot") {
+            *fusedRoot = true;
+        } else if (option == "--gaps") {
+            *gaps = true;
+        } else if (option == "--gapskipping") {
+            *gapSkipping = true;
+        } else if (option == "--statistics") {
+            *printStatistics = true;
+        } else if (option == "--benchmarkcache") {
+            *benchmarkCache = true;
+        } else if (option == "--tunecpu") {
+            *tuneCPU = true;
+        } else if (option == "--hybrid") {
+            *hybrid = true;
+            *sharded = true;
+        } else if (option == "--distributed") {
+#ifndef HAVE_MPI
+            abort("distributed instances require building with MPI");
+#endif
+            *distributed = true;
+            *sharded = true;
+        } else if (option == "--reset") {
+            *resetInstances = true;
+            *newDataPerRep = true;
+            *newParametersPerRep = true;
+        } else if (option == "--grow") {
+            *growInstances = true;
+        } else if (option == "--savestate") {
+            *saveState = true;
+        } else if (option == "--estimate") {
+            *estimateUsage = true;
+        } else if (option == "--newpartitions") {
+            *newPartitionsPerRep = true;
+        } else if (option == "--ratematrix") {
+            *useRateMatrix = true;
+        } else if (option == "--bootstrapweights") {
+            *bootstrapWeights = true;
+        } else if (option == "--replicates") {
+            expecting_replicates = true;
+        } else if (option == "--mixedprecision") {
+            *mixedPrecision = true;
+        } else if (option == "--compress") {
+            *compress = true;
 #ifdef HAVE_NCL
         } else if (option == "--alignmentdna") {
             expecting_alignmentdna = true;
-        } else if (option == "--compress") {
-            *compress = true;
         } else if (option == "--tree") {
             expecting_treenewick = true;
 #endif // HAVE_NCL
@@ -3133,6 +3870,15 @@ void interpretCommandLineParameters(int argc, const char* argv[],
     if (expecting_partitions)
         abort("read last command line option without finding value associated with --partitions");
 
+    if (expecting_sharedthreads)
+        abort("read last command line option without finding value associated with --sharedthreads");
+
+    if (expecting_threadspin)
+        abort("read last command line option without finding value associated with --threadspin");
+
+    if (expecting_replicates)
+        abort("read last command line option without finding value associated with --replicates");
+
     if (*stateCount < 2)
         abort("invalid number of states supplied on the command line");
         
@@ -3159,7 +3905,20 @@ void interpretCommandLineParameters(int argc, const char* argv[],
     
     if (*calcderivs && !(*unrooted))
         abort("calcderivs option requires unrooted tree option");
+
+    if (*edgeTrials && (!(*calcderivs) || *partitions > 1 || *eigenCount > 1))
+        abort("edgetrials option requires calcderivs option with one partition and eigencount");
     
+    if (*bootstrapWeights && (*unrooted || *partitions > 1 || *multiRsrc || *fusedRoot))
+        abort("bootstrapweights option requires a rooted tree with one partition and instance, without fusedroot");
+
+    if (*replicateCount < 1 || *rateCategoryCount % *replicateCount != 0)
+        abort("invalid number for replicates supplied on the command line");
+
+    if (*replicateCount > 1 && (*unrooted || *partitions > 1 || *multiRsrc || *fusedRoot ||
+                                *eigenCount > 1 || *manualScaling || *autoScaling || *dynamicScaling))
+        abort("replicates option requires a rooted tree with one partition, instance and eigencount, without scaling or fusedroot");
+
     if (*eigenCount < 1)
         abort("invalid number for eigencount supplied on the command line");
     
@@ -3201,6 +3960,18 @@ void interpretCommandLineParameters(int argc, const char* argv[],
 
     if (*clientThreadingEnabled && *multiRsrc==false)
         abort("client-side threading requires 'multirsrc' setting to be enabled");
+
+    if (*sharded && *multiRsrc)
+        abort("sharded instances cannot be combined with 'multirsrc'");
+
+    if (*sharded && rsrc->size() < 2)
+        abort("sharded instances require a resource list given with 'rsrc'");
+
+    if (*checkpointing && *partitions > 1)
+        abort("partials checkpointing cannot be used with partitioning");
+
+    if (*mixedPrecision && *requireDoublePrecision)
+        abort("mixedprecision option compares single against double precision and cannot be combined with doubleprecision");
 }
 
 int main( int argc, const char* argv[] )
@@ -3215,6 +3986,7 @@ int main( int argc, const char* argv[] )
     bool requireDoublePrecision = false;
     bool disableVector = false;
     bool enableThreads = false;
+    bool enableOpenMP = false;
     bool unrooted = false;
     bool calcderivs = false;
     int compactTipCount = 0;
@@ -3247,6 +4019,45 @@ int main( int argc, const char* argv[] )
     bool compress = false;
     char* treenewick = NULL;
     bool clientThreadingEnabled = false;
+    int sharedThreadCount = 0;
+    bool calibrateThreads = false;
+    bool numaPlacement = false;
+    int threadSpin = 0;
+    bool parallelOperations = false;
+    bool avx512 = false;
+    bool sse = false;
+    bool sharded = false;
+    bool matrixCache = false;
+    bool bufferVersioning = false;
+    bool siteRepeats = false;
+    bool packedTips = false;
+    bool edgeTrials = false;
+    bool powerOfTwoScaling = false;
+    bool lazyScaling = false;
+    bool multiCall = false;
+    bool bufferArena = false;
+    bool lazyBuffers = false;
+    bool checkpointing = false;
+    bool scratchFile = false;
+    bool patternTiling = false;
+    bool interleavedPatterns = false;
+    bool fusedRoot = false;
+    bool gaps = false;
+    bool gapSkipping = false;
+    bool printStatistics = false;
+    bool benchmarkCache = false;
+    bool tuneCPU = false;
+    bool hybrid = false;
+    bool distributed = false;
+    bool resetInstances = false;
+    bool growInstances = false;
+    bool saveState = false;
+    bool estimateUsage = false;
+    bool newPartitionsPerRep = false;
+    bool useRateMatrix = false;
+    bool bootstrapWeights = false;
+    int replicateCount = 1;
+    bool mixedPrecision = false;
 
     std::vector<int> rsrc;
     rsrc.push_back(-1);
@@ -3261,13 +4072,19 @@ int main( int argc, const char* argv[] )
     
     interpretCommandLineParameters(argc, argv, &stateCount, &ntaxa, &nsites, &manualScaling, &autoScaling,
                                    &dynamicScaling, &rateCategoryCount, &rsrc, &nreps, &fullTiming,
-                                   &requireDoublePrecision, &disableVector, &enableThreads, &compactTipCount, &randomSeed,
+                                   &requireDoublePrecision, &disableVector, &enableThreads, &enableOpenMP, &compactTipCount, &randomSeed,
                                    &rescaleFrequency, &unrooted, &calcderivs, &logscalers,
                                    &eigenCount, &eigencomplex, &ievectrans, &setmatrix, &opencl,
                                    &partitions, &sitelikes, &newDataPerRep, &randomTree, &rerootTrees, &pectinate, &benchmarklist, &pllTest, &pllSiteRepeats, &pllOnly, &multiRsrc,
                                    &postorderTraversal, &newTreePerRep, &newParametersPerRep,
                                    &threadCount, &alignmentdna, &compress, &treenewick,
-                                   &clientThreadingEnabled);
+                                   &clientThreadingEnabled, &sharedThreadCount,
+                                   &calibrateThreads, &numaPlacement, &threadSpin, &parallelOperations, &avx512, &sse, &sharded, &matrixCache, &bufferVersioning, &siteRepeats, &packedTips, &edgeTrials, &powerOfTwoScaling, &lazyScaling, &multiCall, &bufferArena, &lazyBuffers, &checkpointing, &scratchFile, &patternTiling, &interleavedPatterns, &fusedRoot, &gaps, &gapSkipping, &printStatistics, &benchmarkCache, &tuneCPU, &hybrid, &distributed, &resetInstances, &growInstances, &saveState, &estimateUsage, &newPartitionsPerRep, &useRateMatrix, &bootstrapWeights, &replicateCount, &mixedPrecision);
+
+#ifdef HAVE_MPI
+    if (distributed)
+        MPI_Init(NULL, NULL);
+#endif
 
     if (alignmentdna == NULL) {
         std::cout << "\nSimulating genomic ";
@@ -3280,11 +4097,18 @@ int main( int argc, const char* argv[] )
         } else {
             std::cout << " with " << ntaxa << " taxa and " << nsites << " site patterns";
         }
+        if (compress) {
+            gt_srand(randomSeed);
+            simulateAlignment(ntaxa, nsites, stateCount, gaps);
+            compressAlignment(ntaxa, &nsites, threadCount);
+            compactTipCount = ntaxa;
+            alignmentFromFile = true;
+        }
     }
 #ifdef HAVE_NCL
     else {
         stateCount = 4;
-        ncl_readAlignmentDNA(alignmentdna, &ntaxa, &nsites, compress);
+        ncl_readAlignmentDNA(alignmentdna, &ntaxa, &nsites, compress, threadCount);
         compactTipCount = ntaxa;
         alignmentFromFile = true;
         free(alignmentdna);
@@ -3301,7 +4125,7 @@ int main( int argc, const char* argv[] )
 
     std::cout << "\n\n";
 
-    if (benchmarklist || multiRsrc) {
+    if (benchmarklist || multiRsrc || sharded) {
         rsrcCount =  rsrc.size() - 1;
         if (rsrcCount == 0) {
             rsrcList = NULL;
@@ -3310,60 +4134,156 @@ int main( int argc, const char* argv[] )
         }
     }
 
+    if (sharedThreadCount > 0)
+        beagleSetSharedCPUThreadCount(sharedThreadCount);
+
     BeagleResourceList* rl = beagleGetResourceList();
+    bool resourceFound = false;
 
     if(rl != NULL){
         for(int i=0; i<rl->length; i++){
             if (rsrc.size() == 1 || std::find(rsrc.begin(), rsrc.end(), i)!=rsrc.end()) {
-                runBeagle(i,
-                          stateCount,
-                          ntaxa,
-                          nsites,
-                          manualScaling,
-                          autoScaling,
-                          dynamicScaling,
-                          rateCategoryCount,
-                          nreps,
-                          fullTiming,
-                          requireDoublePrecision,
-                          disableVector,
-                          enableThreads,
-                          compactTipCount,
-                          randomSeed,
-                          rescaleFrequency,
-                          unrooted,
-                          calcderivs,
-                          logscalers,
-                          eigenCount,
-                          eigencomplex,
-                          ievectrans,
-                          setmatrix,
-                          opencl,
-                          partitions,
-                          sitelikes,
-                          newDataPerRep,
-                          randomTree,
-                          rerootTrees,
-                          pectinate,
-                          benchmarklist,
-                          pllTest,
-                          pllSiteRepeats,
-                          pllOnly,
-                          multiRsrc,
-                          postorderTraversal,
-                          newTreePerRep,
-                          newParametersPerRep,
-                          threadCount,
-                          rsrcList,
-                          rsrcCount,
-                          alignmentFromFile,
-                          treenewick,
-                          clientThreadingEnabled);
+                // the plain path has the modes that should not change the likelihood turned off
+                auto run = [&] (bool doublePrecision, bool mixed, bool plain, double* outLogL) {
+                    std::vector<double> compressedWeights;
+                    if (plain && compress) {
+                        alignmentStates.swap(uncompressedStates);
+                        compressedWeights.swap(alignmentWeights);
+                        alignmentWeights.assign(uncompressedSiteCount, 1.0);
+                    }
+                    runBeagle(i,
+                              stateCount,
+                              ntaxa,
+                              (plain && compress ? uncompressedSiteCount : nsites),
+                              manualScaling,
+                              autoScaling,
+                              dynamicScaling,
+                              rateCategoryCount,
+                              nreps,
+                              fullTiming,
+                              doublePrecision,
+                              disableVector && !plain,
+                              enableThreads,
+                              enableOpenMP && !plain,
+                              compactTipCount,
+                              randomSeed,
+                              rescaleFrequency,
+                              unrooted,
+                              calcderivs,
+                              logscalers,
+                              eigenCount,
+                              eigencomplex,
+                              ievectrans,
+                              setmatrix,
+                              opencl,
+                              partitions,
+                              sitelikes,
+                              newDataPerRep,
+                              randomTree,
+                              rerootTrees,
+                              pectinate,
+                              benchmarklist,
+                              pllTest,
+                              pllSiteRepeats,
+                              pllOnly,
+                              multiRsrc && !plain,
+                              postorderTraversal,
+                              newTreePerRep,
+                              newParametersPerRep,
+                              threadCount,
+                              rsrcList,
+                              rsrcCount,
+                              alignmentFromFile,
+                              treenewick,
+                              clientThreadingEnabled && !plain,
+                              calibrateThreads,
+                              numaPlacement,
+                              (plain ? 0 : threadSpin),
+                              parallelOperations,
+                              avx512,
+                              sse,
+                              sharded && !plain,
+                              matrixCache && !plain,
+                              bufferVersioning && !plain,
+                              siteRepeats,
+                              packedTips,
+                              edgeTrials,
+                              powerOfTwoScaling,
+                              lazyScaling,
+                              multiCall && !plain,
+                              bufferArena && !plain,
+                              lazyBuffers && !plain,
+                              checkpointing && !plain,
+                              scratchFile && !plain,
+                              patternTiling,
+                              interleavedPatterns,
+                              fusedRoot && !plain,
+                              gaps,
+                              gapSkipping,
+                              printStatistics,
+                              benchmarkCache,
+                              tuneCPU,
+                              hybrid && !plain,
+                              distributed,
+                              resetInstances && !plain,
+                              growInstances && !plain,
+                              saveState && !plain,
+                              estimateUsage && !plain,
+                              newPartitionsPerRep && !plain,
+                              useRateMatrix && !plain,
+                              bootstrapWeights && !plain,
+                              (plain ? 1 : replicateCount),
+                              mixed,
+                              outLogL);
+                    if (plain && compress) {
+                        alignmentStates.swap(uncompressedStates);
+                        alignmentWeights.swap(compressedWeights);
+                    }
+                };
+
+                if (mixedPrecision) {
+                    // single precision, with and without mixed precision, against double precision
+                    double referenceLogL, singleLogL, mixedLogL;
+                    run(true, false, false, &referenceLogL);
+                    run(false, false, false, &singleLogL);
+                    run(false, true, false, &mixedLogL);
+                    double singleDiff = std::abs(singleLogL - referenceLogL) / (1.0 + std::abs(referenceLogL));
+                    double mixedDiff = std::abs(mixedLogL - referenceLogL) / (1.0 + std::abs(referenceLogL));
+                    fprintf(stdout, "double logL = %.5f, relative difference of single = %.3g, of mixed = %.3g\n",
+                            referenceLogL, singleDiff, mixedDiff);
+                    if (!(mixedDiff <= singleDiff && mixedDiff < 1e-6))
+                        abort("mixed precision likelihood is not closer to double precision than single");
+                } else if (sharded || matrixCache || bufferVersioning || multiCall || bufferArena ||
+                           lazyBuffers || checkpointing || scratchFile || fusedRoot || hybrid ||
+                           resetInstances || growInstances || saveState || estimateUsage ||
+                           newPartitionsPerRep || useRateMatrix || bootstrapWeights ||
+                           replicateCount > 1 || threadSpin > 0 || enableOpenMP || compress ||
+                           disableVector) {
+                    // the modes against a reference run on the plain path
+                    double referenceLogL, modesLogL;
+                    run(requireDoublePrecision, false, true, &referenceLogL);
+                    run(requireDoublePrecision, false, false, &modesLogL);
+                    double maxDiff = std::abs(modesLogL - referenceLogL) / (1.0 + std::abs(referenceLogL));
+                    fprintf(stdout, "plain path logL = %.5f, relative difference = %.3g\n",
+                            referenceLogL, maxDiff);
+                    if (!(maxDiff < (requireDoublePrecision ? 1e-8 : 1e-4)))
+                        abort("likelihood differs from the run on the plain path");
+                } else {
+                    run(requireDoublePrecision, false, false, NULL);
+                }
+                resourceFound = true;
             }
         }
     } else {
         abort("no BEAGLE resources found");
     }
+    if (!resourceFound)
+        abort("requested BEAGLE resource not found");
+
+#ifdef HAVE_MPI
+    if (distributed)
+        MPI_Finalize();
+#endif
 
 //#ifdef _WIN32
 //    std::cout << "\nPress ENTER to exit...\n";
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <iostream>
 
 #ifdef _WIN32
@@ -108,6 +109,7 @@ void printFlags(long inFlags) {
     if (inFlags & BEAGLE_FLAG_VECTOR_NONE)        fprintf(stdout, " VECTOR_NONE");
     if (inFlags & BEAGLE_FLAG_VECTOR_SSE)         fprintf(stdout, " VECTOR_SSE");
     if (inFlags & BEAGLE_FLAG_VECTOR_AVX)         fprintf(stdout, " VECTOR_AVX");
+    if (inFlags & BEAGLE_FLAG_VECTOR_AVX512)      fprintf(stdout, " VECTOR_AVX512");
     if (inFlags & BEAGLE_FLAG_THREADING_NONE)     fprintf(stdout, " THREADING_NONE");
     if (inFlags & BEAGLE_FLAG_THREADING_OPENMP)   fprintf(stdout, " THREADING_OPENMP");
     if (inFlags & BEAGLE_FLAG_FRAMEWORK_CPU)      fprintf(stdout, " FRAMEWORK_CPU");
@@ -115,6 +117,78 @@ void printFlags(long inFlags) {
     if (inFlags & BEAGLE_FLAG_FRAMEWORK_OPENCL)   fprintf(stdout, " FRAMEWORK_OPENCL");
 }
 
+// root log likelihood of a cherry of tips 0 and 1 under JC69
+double cherryLogL(int instance) {
+	int nodeIndices[2] = { 0, 1 };
+	double edgeLengths[2] = { 0.1, 0.1 };
+	beagleUpdateTransitionMatrices(instance, 0, nodeIndices, NULL, NULL, edgeLengths, 2);
+
+	BeagleOperation operation = { 2, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 1, 1 };
+	beagleUpdatePartials(instance, &operation, 1, BEAGLE_OP_NONE);
+
+	int rootIndex = 2;
+	int weightsIndex = 0;
+	int frequenciesIndex = 0;
+	int scalingIndex = BEAGLE_OP_NONE;
+	double logL = 0.0;
+	beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex, &frequenciesIndex,
+	                                  &scalingIndex, 1, &logL);
+	return logL;
+}
+
+// Partials set with beagleSetPartials on a tip have to replace the partials set before with
+// beagleSetTipPartials, also when those were one-hot and kept as compact states; returns false
+// if they do not
+bool checkSetPartialsAfterTipPartials() {
+	BeagleInstanceDetails instDetails;
+	int instance = beagleCreateInstance(2, 3, 2, 4, 1, 1, 2, 1, 0, NULL, 0,
+	                                    BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_PROCESSOR_CPU, 0,
+	                                    &instDetails);
+	if (instance < 0) {
+	    fprintf(stderr, "Failed to obtain BEAGLE instance\n\n");
+	    return false;
+	}
+
+	double evec[4 * 4] = {
+        1.0,  2.0,  0.0,  0.5,
+        1.0,  -2.0,  0.5,  0.0,
+        1.0,  2.0, 0.0,  -0.5,
+        1.0,  -2.0,  -0.5,  0.0
+	};
+	double ivec[4 * 4] = {
+        0.25,  0.25,  0.25,  0.25,
+        0.125,  -0.125,  0.125,  -0.125,
+        0.0,  1.0,  0.0,  -1.0,
+        1.0,  0.0,  -1.0,  0.0
+	};
+	double eval[4] = { 0.0, -1.3333333333333333, -1.3333333333333333, -1.3333333333333333 };
+	double freqs[4] = { 0.25, 0.25, 0.25, 0.25 };
+	double weight = 1.0;
+	double rate = 1.0;
+	double patternWeight = 1.0;
+	beagleSetEigenDecomposition(instance, 0, evec, ivec, eval);
+	beagleSetStateFrequencies(instance, 0, freqs);
+	beagleSetCategoryWeights(instance, 0, &weight);
+	beagleSetCategoryRates(instance, &rate);
+	beagleSetPatternWeights(instance, &patternWeight);
+
+	double oneHot[4] = { 1.0, 0.0, 0.0, 0.0 };
+	double ambiguous[4] = { 0.5, 0.5, 0.5, 0.5 };
+	beagleSetTipPartials(instance, 1, oneHot);
+
+	beagleSetTipPartials(instance, 0, oneHot);
+	beagleSetPartials(instance, 0, ambiguous);
+	double logL = cherryLogL(instance);
+
+	beagleSetTipPartials(instance, 0, ambiguous);
+	double expectedLogL = cherryLogL(instance);
+
+	beagleFinalizeInstance(instance);
+
+	fprintf(stdout, "setPartials after setTipPartials: logL = %.5f (expected %.5f)\n\n",
+	        logL, expectedLogL);
+	return fabs(logL - expectedLogL) < 1E-10;
+}
 
 int main( int argc, const char* argv[] )
 {
@@ -130,6 +204,11 @@ int main( int argc, const char* argv[] )
         fprintf(stdout, "\n");
     }    
     fprintf(stdout, "\n");    
+
+    if (!checkSetPartialsAfterTipPartials()) {
+        fprintf(stderr, "Failed: partials set on a tip were not used\n\n");
+        exit(1);
+    }
     
     bool manualScaling = false;
     bool autoScaling = false;
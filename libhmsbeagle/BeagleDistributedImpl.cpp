@@ -0,0 +1,102 @@
+/*
+ *  BeagleDistributedImpl.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/BeagleDistributedImpl.h"
+
+namespace beagle {
+
+BeagleDistributedImpl::BeagleDistributedImpl(const std::vector<BeagleImpl*>& inShards,
+                                             const std::vector<int>& inShardPatternCounts,
+                                             const std::vector<int>& inProcessPatternCounts,
+                                             MPI_Comm inCommunicator,
+                                             int stateCount,
+                                             int categoryCount,
+                                             int matrixBufferCount,
+                                             const ShardFactory& inShardFactory) :
+    BeagleShardedImpl(inShards, inShardPatternCounts, stateCount, categoryCount,
+                      matrixBufferCount, inShardFactory),
+    processPatternCounts(inProcessPatternCounts),
+    kTotalPatternCount(0) {
+
+    MPI_Comm_dup(inCommunicator, &communicator);
+    int rank;
+    MPI_Comm_rank(communicator, &rank);
+
+    for (size_t p = 0; p < processPatternCounts.size(); p++) {
+        processPatternOffsets.push_back(kTotalPatternCount);
+        kTotalPatternCount += processPatternCounts[p];
+    }
+
+    setProcessPatterns(processPatternOffsets[rank], kTotalPatternCount);
+}
+
+BeagleDistributedImpl::~BeagleDistributedImpl() {
+    MPI_Comm_free(&communicator);
+}
+
+std::vector<int> BeagleDistributedImpl::splitProcessPatterns(int patternCount,
+                                                            MPI_Comm communicator) {
+    int processCount;
+    MPI_Comm_size(communicator, &processCount);
+    return splitPatterns(patternCount, std::vector<double>(processCount, 1.0));
+}
+
+void BeagleDistributedImpl::combineSums(double* values,
+                                        int length) {
+    MPI_Allreduce(MPI_IN_PLACE, values, length, MPI_DOUBLE, MPI_SUM, communicator);
+}
+
+void BeagleDistributedImpl::combinePatterns(double* values,
+                                            int vectorCount,
+                                            int elementSize) {
+    const int processCount = processPatternCounts.size();
+    gatherCounts.resize(processCount);
+    gatherOffsets.resize(processCount);
+    for (int p = 0; p < processCount; p++) {
+        gatherCounts[p] = processPatternCounts[p] * elementSize;
+        gatherOffsets[p] = processPatternOffsets[p] * elementSize;
+    }
+
+    // each vector in turn, as the ranges of the processes are only contiguous within one
+    const size_t vectorSize = (size_t) kTotalPatternCount * elementSize;
+    for (int v = 0; v < vectorCount; v++)
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                       values + v * vectorSize, &gatherCounts[0], &gatherOffsets[0], MPI_DOUBLE,
+                       communicator);
+}
+
+int BeagleDistributedImpl::combineReturnCode(int returnCode) {
+    // error codes are negative, so the lowest code is an error if any process has one
+    int combinedCode;
+    MPI_Allreduce(&returnCode, &combinedCode, 1, MPI_INT, MPI_MIN, communicator);
+    return combinedCode;
+}
+
+} // end namespace beagle
@@ -0,0 +1,91 @@
+/*
+ *  BeagleDistributedImpl.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleDistributedImpl__
+#define __BeagleDistributedImpl__
+
+#include "libhmsbeagle/BeagleShardedImpl.h"
+
+#include <mpi.h>
+
+#include <vector>
+
+namespace beagle {
+
+/*
+ * One process's part of an instance whose site patterns are split over the processes of an
+ * MPI communicator. Every process makes the same calls with arguments for all patterns; its
+ * shards take the patterns of its own range. Summed results are added up over the processes
+ * with MPI_Allreduce and per-pattern results are gathered with MPI_Allgatherv, so that every
+ * process gets the results of the whole instance.
+ */
+class BeagleDistributedImpl : public BeagleShardedImpl
+{
+public:
+    // the shards of this process hold processPatternCounts[rank] patterns between them;
+    // the communicator is duplicated
+    BeagleDistributedImpl(const std::vector<BeagleImpl*>& shards,
+                          const std::vector<int>& shardPatternCounts,
+                          const std::vector<int>& processPatternCounts,
+                          MPI_Comm communicator,
+                          int stateCount,
+                          int categoryCount,
+                          int matrixBufferCount = 0,
+                          const ShardFactory& shardFactory = ShardFactory());
+
+    virtual ~BeagleDistributedImpl();
+
+    // splits patternCount patterns evenly over the processes of communicator
+    static std::vector<int> splitProcessPatterns(int patternCount,
+                                                 MPI_Comm communicator);
+
+    // the pattern ranges of the processes are fixed when the instance is created
+    virtual int grow(int tipCount,
+                     int partialsBufferCount,
+                     int compactBufferCount,
+                     int patternCount,
+                     int matrixBufferCount,
+                     int scaleBufferCount) { return BEAGLE_ERROR_NO_IMPLEMENTATION; }
+
+protected:
+    virtual void combineSums(double* values,
+                             int length);
+
+    virtual void combinePatterns(double* values,
+                                 int vectorCount,
+                                 int elementSize);
+
+    virtual int combineReturnCode(int returnCode);
+
+private:
+    MPI_Comm communicator;
+    std::vector<int> processPatternCounts;
+    std::vector<int> processPatternOffsets;
+    int kTotalPatternCount;
+    std::vector<int> gatherCounts;
+    std::vector<int> gatherOffsets;
+};
+
+} // end namespace beagle
+
+#endif // __BeagleDistributedImpl__
@@ -30,6 +30,9 @@
 
 #include "libhmsbeagle/beagle.h"
 
+#include <memory>
+#include <vector>
+
 #ifdef DOUBLE_PRECISION
 #define REAL    double
 #else
@@ -38,6 +41,12 @@
 
 namespace beagle {
 
+namespace cpu {
+class ThreadPool;
+}
+
+class TraceRecorder;
+
 class BeagleImpl
 {
 public:
@@ -61,9 +70,98 @@ public:
     
     virtual int setCPUThreadCount(int threadCount) = 0;
 
+    // only native CPU implementations run on a shared host thread pool
+    virtual int setCPUThreadPool(std::shared_ptr<cpu::ThreadPool> threadPool) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    // records the host threads and device work of the instance, or stops with NULL
+    virtual void setTrace(TraceRecorder* trace) {}
+
+    virtual int calibrateCPUThreadCount() {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int setCPUNumaPlacement(bool enable) {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int setCPUThreadSpin(int spinMicroseconds) {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int setCPUBufferArena(bool enable,
+                                  long hugePageSize) {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int setCPUScratchFile(const char* directory,
+                                  int prefetchDistance) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setLazyBufferAllocation(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setCPUPatternTiling(int patternBlockSize) {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int setCPUInterleavedPatterns(bool enable) {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int setPartialsCheckpointing(int maxResidentBuffers) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setCPUParallelOperations(bool enable) {
+        return BEAGLE_SUCCESS;
+    }
+
+    // called around each call that beagleGetInstanceStatistics counts, so that an
+    // implementation can time the work the call queues
+    virtual void beginCallStatistics() {}
+
+    virtual void endCallStatistics() {}
+
+    // adds the counters that only the implementation keeps, those of transfers and device time
+    virtual int getStatistics(BeagleStatistics* outStatistics) {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int resetStatistics() {
+        return BEAGLE_SUCCESS;
+    }
+
+    virtual int setTransitionMatrixCache(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setBufferVersioning(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setPowerOfTwoScaling(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setScalingThreshold(double threshold) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setMixedPrecision(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
     virtual int setTipStates(int tipIndex,
                              const int* inStates) = 0;
 
+    virtual int setTipStatesPacking(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
     virtual int setTipPartials(int tipIndex,
                                const double* inPartials) = 0;
     
@@ -87,6 +185,14 @@ public:
     
     virtual int setPatternWeights(const double* inPatternWeights) = 0;
 
+    virtual int setSiteRepeats(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setGapPatternSkipping(bool enable) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
     virtual int setPatternPartitions(int partitionCount,
                                      const int* inPatternPartitions) = 0;
     
@@ -116,6 +222,14 @@ public:
 	                                         const int* resultIndices,
 	                                         int matrixCount) = 0;
 
+    virtual int convolveTransitionMatrixChains(const int* chainIndices,
+                                               const int* chainLengths,
+                                               const int* scratchIndices,
+                                               const int* resultIndices,
+                                               int chainCount) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
     virtual int updateTransitionMatrices(int eigenIndex,
                                          const int* probabilityIndices,
                                          const int* firstDerivativeIndices,
@@ -137,6 +251,29 @@ public:
                                                            const int* secondDerivativeIndices,
                                                            const double* edgeLengths,
                                                            int count) = 0;
+
+    virtual int updateTransitionMatricesWithRateMatrix(const double* inRateMatrix,
+                                                       const int* probabilityIndices,
+                                                       const double* edgeLengths,
+                                                       int count) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int updateTransitionMatrixDerivativesWithRateMatrix(const double* inRateMatrix,
+                                                                const double* inRateMatrixDerivative,
+                                                                const int* derivativeIndices,
+                                                                const double* edgeLengths,
+                                                                int count) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                                      const int* probabilityIndices,
+                                                      const double* edgeLengths,
+                                                      int count,
+                                                      int replicateCount) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
     
     virtual int updatePartials(const int* operations,
                                int operationCount,
@@ -144,6 +281,18 @@ public:
 
     virtual int updatePartialsByPartition(const int* operations,
                                           int operationCount) = 0;
+
+    virtual int setRootPrePartials(const int* bufferIndices,
+                                   const int* stateFrequenciesIndices,
+                                   int count) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int updatePrePartials(const int* operations,
+                                  int operationCount,
+                                  int cumulativeScalingIndex) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
     
     virtual int waitForPartials(const int* destinationPartials,
                                 int destinationPartialsCount) = 0;
@@ -184,6 +333,26 @@ public:
                                             int count,
                                             double* outSumLogLikelihood) = 0;
 
+    virtual int calculateRootLogLikelihoodsWithPatternWeights(const int* bufferIndices,
+                                                              const int* categoryWeightsIndices,
+                                                              const int* stateFrequenciesIndices,
+                                                              const int* cumulativeScaleIndices,
+                                                              int count,
+                                                              const double* inPatternWeights,
+                                                              int weightVectorCount,
+                                                              double* outSumLogLikelihoods) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int calculateRootLogLikelihoodsForReplicates(int bufferIndex,
+                                                         int categoryWeightsIndex,
+                                                         const int* stateFrequenciesIndices,
+                                                         int cumulativeScaleIndex,
+                                                         int replicateCount,
+                                                         double* outSumLogLikelihoods) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
     virtual int calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
                                                        const int* categoryWeightsIndices,
                                                        const int* stateFrequenciesIndices,
@@ -224,6 +393,112 @@ public:
                                                        double* outSumFirstDerivative,
                                                        double* outSumSecondDerivativeByPartition,
                                                        double* outSumSecondDerivative) = 0;
+
+    virtual int calculateEdgeSiteLogLikelihoods(const int* parentBufferIndices,
+                                                const int* childBufferIndices,
+                                                const int* probabilityIndices,
+                                                const int* firstDerivativeIndices,
+                                                const int* secondDerivativeIndices,
+                                                const int* categoryWeightsIndices,
+                                                const int* stateFrequenciesIndices,
+                                                const int* cumulativeScaleIndices,
+                                                int count,
+                                                double* outSiteLogLikelihoods,
+                                                double* outSiteFirstDerivatives,
+                                                double* outSiteSecondDerivatives) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    // the operations followed by the root likelihood, for implementations without a fused version
+    virtual int updatePartialsAndCalculateRootLogLikelihood(const int* operations,
+                                                            int operationCount,
+                                                            int cumulativeScaleIndex,
+                                                            int categoryWeightsIndex,
+                                                            int stateFrequenciesIndex,
+                                                            bool writeRootPartials,
+                                                            double* outSumLogLikelihood) {
+        if (operationCount < 1)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        int returnCode = updatePartials(operations, operationCount, cumulativeScaleIndex);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+        const int rootIndex = operations[(operationCount - 1) * BEAGLE_OP_COUNT];
+        return calculateRootLogLikelihoods(&rootIndex, &categoryWeightsIndex,
+                                           &stateFrequenciesIndex, &cumulativeScaleIndex, 1,
+                                           outSumLogLikelihood);
+    }
+
+    virtual int calculateEdgeDerivatives(const int* postBufferIndices,
+                                         const int* preBufferIndices,
+                                         const int* probabilityIndices,
+                                         const int* firstDerivativeIndices,
+                                         const int* categoryWeightsIndices,
+                                         int count,
+                                         double* outDerivatives,
+                                         double* outSumDerivatives) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    // one edge derivative call per parameter, for implementations without a batched version
+    virtual int calculateParameterDerivatives(const int* postBufferIndices,
+                                              const int* preBufferIndices,
+                                              const int* probabilityIndices,
+                                              const int* derivativeIndices,
+                                              const int* categoryWeightsIndices,
+                                              int count,
+                                              int parameterCount,
+                                              double* outSumDerivatives) {
+        if (parameterCount < 1)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        std::vector<double> edgeDerivatives(count);
+        for (int p = 0; p < parameterCount; p++) {
+            int returnCode = calculateEdgeDerivatives(postBufferIndices, preBufferIndices,
+                                                      probabilityIndices,
+                                                      derivativeIndices + p * count,
+                                                      categoryWeightsIndices, count, NULL,
+                                                      &edgeDerivatives[0]);
+            if (returnCode != BEAGLE_SUCCESS)
+                return returnCode;
+            outSumDerivatives[p] = 0.0;
+            for (int i = 0; i < count; i++)
+                outSumDerivatives[p] += edgeDerivatives[i];
+        }
+        return BEAGLE_SUCCESS;
+    }
+
+    // one edge likelihood per matrix, for implementations without a batched version
+    virtual int calculateEdgeLogLikelihoodsForMatrices(int parentBufferIndex,
+                                                       int childBufferIndex,
+                                                       const int* probabilityIndices,
+                                                       const int* firstDerivativeIndices,
+                                                       const int* secondDerivativeIndices,
+                                                       int categoryWeightsIndex,
+                                                       int stateFrequenciesIndex,
+                                                       int cumulativeScaleIndex,
+                                                       int matrixCount,
+                                                       double* outSumLogLikelihoods,
+                                                       double* outSumFirstDerivatives,
+                                                       double* outSumSecondDerivatives) {
+        for (int t = 0; t < matrixCount; t++) {
+            int returnCode = calculateEdgeLogLikelihoods(&parentBufferIndex, &childBufferIndex,
+                                                         &probabilityIndices[t],
+                                                         (firstDerivativeIndices ?
+                                                          &firstDerivativeIndices[t] : NULL),
+                                                         (secondDerivativeIndices ?
+                                                          &secondDerivativeIndices[t] : NULL),
+                                                         &categoryWeightsIndex,
+                                                         &stateFrequenciesIndex,
+                                                         &cumulativeScaleIndex, 1,
+                                                         &outSumLogLikelihoods[t],
+                                                         (outSumFirstDerivatives ?
+                                                          &outSumFirstDerivatives[t] : NULL),
+                                                         (outSumSecondDerivatives ?
+                                                          &outSumSecondDerivatives[t] : NULL));
+            if (returnCode != BEAGLE_SUCCESS)
+                return returnCode;
+        }
+        return BEAGLE_SUCCESS;
+    }
     
     virtual int getLogLikelihood(double* outSumLogLikelihood) = 0;
 
@@ -234,7 +509,122 @@ public:
     
     virtual int getSiteDerivatives(double* outFirstDerivatives,
                                    double* outSecondDerivatives) = 0;
+
+    // only instances split across several implementations can move patterns between them
+    virtual int rebalance() {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    // clears the data and model contents, keeping the buffers, threads and settings
+    virtual int reset() {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    // raises the dimensions the instance was created with to these, keeping the contents of
+    // every buffer and pattern; new patterns follow the existing ones
+    virtual int grow(int tipCount,
+                     int partialsBufferCount,
+                     int compactBufferCount,
+                     int patternCount,
+                     int matrixBufferCount,
+                     int scaleBufferCount) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int saveState(const char* fileName) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int loadState(const char* fileName) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
 //protected:
+    // integrates once and reduces the site log likelihoods against each set of patternCount
+    // weights, for implementations whose site log likelihoods are read back on the host
+    int sumSiteLogLikelihoodsWithPatternWeights(int patternCount,
+                                                const int* bufferIndices,
+                                                const int* categoryWeightsIndices,
+                                                const int* stateFrequenciesIndices,
+                                                const int* cumulativeScaleIndices,
+                                                int count,
+                                                const double* inPatternWeights,
+                                                int weightVectorCount,
+                                                double* outSumLogLikelihoods) {
+        if (weightVectorCount < 1)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        double unused;
+        int returnCode = calculateRootLogLikelihoods(bufferIndices, categoryWeightsIndices,
+                                                     stateFrequenciesIndices,
+                                                     cumulativeScaleIndices, count, &unused);
+        if (returnCode != BEAGLE_SUCCESS && returnCode != BEAGLE_ERROR_FLOATING_POINT)
+            return returnCode;
+        std::vector<double> siteLogLikelihoods(patternCount);
+        returnCode = getSiteLogLikelihoods(&siteLogLikelihoods[0]);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+
+        returnCode = BEAGLE_SUCCESS;
+        for (int r = 0; r < weightVectorCount; r++) {
+            const double* weights = inPatternWeights + (size_t) r * patternCount;
+            double sum = 0.0;
+            for (int k = 0; k < patternCount; k++) {
+                if (weights[k] != 0.0)
+                    sum += weights[k] * siteLogLikelihoods[k];
+            }
+            outSumLogLikelihoods[r] = sum;
+            if (sum - sum != 0.0)
+                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+        }
+        return returnCode;
+    }
+
+    // integrates one edge at a time and copies its site results into row e of each output,
+    // for implementations whose site results are already on the host
+    int collectEdgeSiteLogLikelihoods(int patternCount,
+                                      const int* parentBufferIndices,
+                                      const int* childBufferIndices,
+                                      const int* probabilityIndices,
+                                      const int* firstDerivativeIndices,
+                                      const int* secondDerivativeIndices,
+                                      const int* categoryWeightsIndices,
+                                      const int* stateFrequenciesIndices,
+                                      const int* cumulativeScaleIndices,
+                                      int count,
+                                      double* outSiteLogLikelihoods,
+                                      double* outSiteFirstDerivatives,
+                                      double* outSiteSecondDerivatives) {
+        if (count < 1 || (secondDerivativeIndices != NULL && firstDerivativeIndices == NULL))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        int returnCode = BEAGLE_SUCCESS;
+        for (int e = 0; e < count; e++) {
+            double logL, firstDerivative, secondDerivative;
+            int edgeCode = calculateEdgeLogLikelihoods(&parentBufferIndices[e], &childBufferIndices[e],
+                                                       &probabilityIndices[e],
+                                                       (firstDerivativeIndices ?
+                                                        &firstDerivativeIndices[e] : NULL),
+                                                       (secondDerivativeIndices ?
+                                                        &secondDerivativeIndices[e] : NULL),
+                                                       &categoryWeightsIndices[e],
+                                                       &stateFrequenciesIndices[e],
+                                                       &cumulativeScaleIndices[e], 1,
+                                                       &logL, &firstDerivative, &secondDerivative);
+            if (edgeCode == BEAGLE_ERROR_FLOATING_POINT)
+                returnCode = edgeCode;
+            else if (edgeCode != BEAGLE_SUCCESS)
+                return edgeCode;
+
+            const size_t offset = (size_t) e * patternCount;
+            edgeCode = getSiteLogLikelihoods(outSiteLogLikelihoods + offset);
+            if (edgeCode == BEAGLE_SUCCESS && firstDerivativeIndices != NULL)
+                edgeCode = getSiteDerivatives(outSiteFirstDerivatives + offset,
+                                              (secondDerivativeIndices ?
+                                               outSiteSecondDerivatives + offset : NULL));
+            if (edgeCode != BEAGLE_SUCCESS)
+                return edgeCode;
+        }
+        return returnCode;
+    }
+
     int resourceNumber;
 };
 
@@ -258,6 +648,24 @@ public:
     virtual const char* getName() = 0; // pure virtual
     
     virtual const long getFlags() = 0; // pure virtual
+
+    // Projected bytes of host and device memory an instance created by
+    // createImpl with these arguments would allocate, without allocating it
+    virtual int estimateMemory(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long long* outHostBytes,
+                               long long* outDeviceBytes) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
 };
 
 } // end namespace beagle
@@ -0,0 +1,1214 @@
+/*
+ *  BeagleShardedImpl.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/BeagleShardedImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUThreadPool.h"
+
+namespace beagle {
+
+BeagleShardedImpl::BeagleShardedImpl(const std::vector<BeagleImpl*>& inShards,
+                                     const std::vector<int>& inShardPatternCounts,
+                                     int stateCount,
+                                     int categoryCount,
+                                     int matrixBufferCount,
+                                     const ShardFactory& inShardFactory) :
+    shards(inShards),
+    shardPatternCounts(inShardPatternCounts),
+    kShardCount(inShards.size()),
+    kPatternCount(0),
+    kPatternOffset(0),
+    kStateCount(stateCount),
+    kCategoryCount(categoryCount),
+    kMatrixBufferCount(matrixBufferCount),
+    kEigenValueCount(stateCount),
+    shardFactory(inShardFactory),
+    trace(NULL),
+    kSetterCount(0),
+    replayingSetters(false) {
+
+    setShardOffsets();
+    kPatternCount = shardPatternOffsets[kShardCount - 1] + shardPatternCounts[kShardCount - 1];
+
+    resourceNumber = shards[0]->resourceNumber;
+
+    BeagleInstanceDetails details;
+    if (shards[0]->getInstanceDetails(&details) == BEAGLE_SUCCESS &&
+        (details.flags & BEAGLE_FLAG_EIGEN_COMPLEX))
+        kEigenValueCount = 2 * stateCount;
+
+    shardSeconds.assign(kShardCount, 0.0);
+
+    // the calling thread drives the first shard
+    if (kShardCount > 1)
+        shardWorkers.reset(new cpu::ThreadPool(kShardCount - 1));
+}
+
+BeagleShardedImpl::~BeagleShardedImpl() {
+    shardWorkers.reset();
+    for (int i = 0; i < kShardCount; i++)
+        delete shards[i];
+}
+
+std::vector<int> BeagleShardedImpl::splitPatterns(int patternCount,
+                                                  const std::vector<double>& weights) {
+    const int shardCount = weights.size();
+    double totalWeight = 0.0;
+    for (int i = 0; i < shardCount; i++)
+        totalWeight += weights[i];
+
+    // every shard takes one pattern, the rest are shared out by weight and the patterns left
+    // over by rounding down go to the largest remainders, earlier shards first
+    std::vector<int> counts(shardCount, 1);
+    std::vector<double> remainders(shardCount, 0.0);
+    int remaining = patternCount - shardCount;
+    int leftOver = remaining;
+    for (int i = 0; i < shardCount; i++) {
+        double share = (totalWeight > 0.0 ? remaining * weights[i] / totalWeight
+                                          : (double) remaining / shardCount);
+        counts[i] += (int) floor(share);
+        remainders[i] = share - floor(share);
+        leftOver -= (int) floor(share);
+    }
+    for (; leftOver > 0; leftOver--) {
+        int largest = 0;
+        for (int i = 1; i < shardCount; i++) {
+            if (remainders[i] > remainders[largest])
+                largest = i;
+        }
+        counts[largest]++;
+        remainders[largest] = -1.0;
+    }
+
+    return counts;
+}
+
+void BeagleShardedImpl::setProcessPatterns(int patternOffset,
+                                           int totalPatternCount) {
+    kPatternOffset = patternOffset;
+    kPatternCount = totalPatternCount;
+    setShardOffsets();
+}
+
+void BeagleShardedImpl::setShardOffsets() {
+    shardPatternOffsets.clear();
+    int offset = kPatternOffset;
+    for (int i = 0; i < kShardCount; i++) {
+        shardPatternOffsets.push_back(offset);
+        offset += shardPatternCounts[i];
+    }
+}
+
+void BeagleShardedImpl::keepSetter(const std::string& key,
+                                   const std::function<int()>& setter) {
+    if (shardFactory && !replayingSetters)
+        keptSetters[key] = std::make_pair(kSetterCount++, setter);
+}
+
+int BeagleShardedImpl::forEachShard(const std::function<int(int)>& call) {
+    std::vector<int> returnCodes(kShardCount, BEAGLE_SUCCESS);
+
+    // each shard adds to its own time
+    std::function<void(int)> timedCall = [&] (int i) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        returnCodes[i] = call(i);
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        shardSeconds[i] += seconds.count();
+    };
+
+    cpu::ThreadPoolTaskGroup group;
+    for (int i = 1; i < kShardCount; i++)
+        shardWorkers->submit(group, [&timedCall, i] () { timedCall(i); }, i - 1);
+
+    timedCall(0);
+
+    if (kShardCount > 1)
+        group.wait();
+
+    for (int i = 0; i < kShardCount; i++) {
+        if (returnCodes[i] != BEAGLE_SUCCESS)
+            return returnCodes[i];
+    }
+    return BEAGLE_SUCCESS;
+}
+
+void BeagleShardedImpl::sumShards(const std::vector<double>& shardValues,
+                                  int length,
+                                  double* out) {
+    if (out == NULL)
+        return;
+
+    for (int j = 0; j < length; j++) {
+        double sum = 0.0;
+        for (int i = 0; i < kShardCount; i++)
+            sum += shardValues[i * length + j];
+        out[j] = sum;
+    }
+    combineSums(out, length);
+}
+
+int BeagleShardedImpl::createInstance(int tipCount,
+                                      int partialsBufferCount,
+                                      int compactBufferCount,
+                                      int stateCount,
+                                      int patternCount,
+                                      int eigenBufferCount,
+                                      int matrixBufferCount,
+                                      int categoryCount,
+                                      int scaleBufferCount,
+                                      int resourceNumber,
+                                      int pluginResourceNumber,
+                                      long preferenceFlags,
+                                      long requirementFlags) {
+    return BEAGLE_ERROR_GENERAL;
+}
+
+int BeagleShardedImpl::getInstanceDetails(BeagleInstanceDetails* returnInfo) {
+    return shards[0]->getInstanceDetails(returnInfo);
+}
+
+int BeagleShardedImpl::setCPUThreadCount(int threadCount) {
+    keepSetter("setCPUThreadCount", [this, threadCount] () { return setCPUThreadCount(threadCount); });
+    return forEachShard([&] (int i) { return shards[i]->setCPUThreadCount(threadCount); });
+}
+
+int BeagleShardedImpl::setCPUThreadPool(std::shared_ptr<cpu::ThreadPool> threadPool) {
+    keepSetter("setCPUThreadPool", [this, threadPool] () { return setCPUThreadPool(threadPool); });
+    return forEachShard([&] (int i) { return shards[i]->setCPUThreadPool(threadPool); });
+}
+
+void BeagleShardedImpl::setTrace(TraceRecorder* inTrace) {
+    trace = inTrace;
+    for (int i = 0; i < kShardCount; i++)
+        shards[i]->setTrace(trace);
+}
+
+int BeagleShardedImpl::calibrateCPUThreadCount() {
+    return forEachShard([&] (int i) { return shards[i]->calibrateCPUThreadCount(); });
+}
+
+int BeagleShardedImpl::setCPUNumaPlacement(bool enable) {
+    keepSetter("setCPUNumaPlacement", [this, enable] () { return setCPUNumaPlacement(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setCPUNumaPlacement(enable); });
+}
+
+int BeagleShardedImpl::setCPUThreadSpin(int spinMicroseconds) {
+    if (spinMicroseconds < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    keepSetter("setCPUThreadSpin", [this, spinMicroseconds] () { return setCPUThreadSpin(spinMicroseconds); });
+    // the workers driving the shards dispatch once per call as well
+    if (shardWorkers)
+        shardWorkers->setSpinTime(spinMicroseconds);
+    return forEachShard([&] (int i) { return shards[i]->setCPUThreadSpin(spinMicroseconds); });
+}
+
+int BeagleShardedImpl::setCPUBufferArena(bool enable,
+                                         long hugePageSize) {
+    keepSetter("setCPUBufferArena", [this, enable, hugePageSize] () {
+        return setCPUBufferArena(enable, hugePageSize);
+    });
+    return forEachShard([&] (int i) { return shards[i]->setCPUBufferArena(enable, hugePageSize); });
+}
+
+int BeagleShardedImpl::setCPUScratchFile(const char* directory,
+                                         int prefetchDistance) {
+    std::string directoryName = (directory != NULL ? directory : "");
+    bool hasDirectory = (directory != NULL);
+    keepSetter("setCPUScratchFile", [this, directoryName, hasDirectory, prefetchDistance] () {
+        return setCPUScratchFile(hasDirectory ? directoryName.c_str() : NULL, prefetchDistance);
+    });
+    return forEachShard([&] (int i) { return shards[i]->setCPUScratchFile(directory, prefetchDistance); });
+}
+
+int BeagleShardedImpl::setLazyBufferAllocation(bool enable) {
+    keepSetter("setLazyBufferAllocation", [this, enable] () { return setLazyBufferAllocation(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setLazyBufferAllocation(enable); });
+}
+
+int BeagleShardedImpl::setCPUPatternTiling(int patternBlockSize) {
+    keepSetter("setCPUPatternTiling", [this, patternBlockSize] () { return setCPUPatternTiling(patternBlockSize); });
+    return forEachShard([&] (int i) { return shards[i]->setCPUPatternTiling(patternBlockSize); });
+}
+
+int BeagleShardedImpl::setCPUInterleavedPatterns(bool enable) {
+    keepSetter("setCPUInterleavedPatterns", [this, enable] () { return setCPUInterleavedPatterns(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setCPUInterleavedPatterns(enable); });
+}
+
+int BeagleShardedImpl::setPartialsCheckpointing(int maxResidentBuffers) {
+    keepSetter("setPartialsCheckpointing", [this, maxResidentBuffers] () {
+        return setPartialsCheckpointing(maxResidentBuffers);
+    });
+    return forEachShard([&] (int i) { return shards[i]->setPartialsCheckpointing(maxResidentBuffers); });
+}
+
+int BeagleShardedImpl::setCPUParallelOperations(bool enable) {
+    keepSetter("setCPUParallelOperations", [this, enable] () { return setCPUParallelOperations(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setCPUParallelOperations(enable); });
+}
+
+void BeagleShardedImpl::beginCallStatistics() {
+    for (size_t i = 0; i < shards.size(); i++)
+        shards[i]->beginCallStatistics();
+}
+
+void BeagleShardedImpl::endCallStatistics() {
+    for (size_t i = 0; i < shards.size(); i++)
+        shards[i]->endCallStatistics();
+}
+
+// the counters of the shards are added together, one shard after another
+int BeagleShardedImpl::getStatistics(BeagleStatistics* outStatistics) {
+    for (size_t i = 0; i < shards.size(); i++) {
+        int returnCode = shards[i]->getStatistics(outStatistics);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+    return BEAGLE_SUCCESS;
+}
+
+int BeagleShardedImpl::resetStatistics() {
+    return forEachShard([&] (int i) { return shards[i]->resetStatistics(); });
+}
+
+int BeagleShardedImpl::setTransitionMatrixCache(bool enable) {
+    keepSetter("setTransitionMatrixCache", [this, enable] () { return setTransitionMatrixCache(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setTransitionMatrixCache(enable); });
+}
+
+int BeagleShardedImpl::setBufferVersioning(bool enable) {
+    keepSetter("setBufferVersioning", [this, enable] () { return setBufferVersioning(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setBufferVersioning(enable); });
+}
+
+int BeagleShardedImpl::setPowerOfTwoScaling(bool enable) {
+    keepSetter("setPowerOfTwoScaling", [this, enable] () { return setPowerOfTwoScaling(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setPowerOfTwoScaling(enable); });
+}
+
+int BeagleShardedImpl::setScalingThreshold(double threshold) {
+    keepSetter("setScalingThreshold", [this, threshold] () { return setScalingThreshold(threshold); });
+    return forEachShard([&] (int i) { return shards[i]->setScalingThreshold(threshold); });
+}
+
+int BeagleShardedImpl::setMixedPrecision(bool enable) {
+    keepSetter("setMixedPrecision", [this, enable] () { return setMixedPrecision(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setMixedPrecision(enable); });
+}
+
+int BeagleShardedImpl::setTipStates(int tipIndex,
+                                    const int* inStates) {
+    std::vector<int> states(inStates, inStates + kPatternCount);
+    keepSetter("setTipStates " + std::to_string(tipIndex), [this, tipIndex, states] () {
+        return setTipStates(tipIndex, &states[0]);
+    });
+    return forEachShard([&] (int i) {
+        return shards[i]->setTipStates(tipIndex, inStates + shardPatternOffsets[i]);
+    });
+}
+
+int BeagleShardedImpl::setTipStatesPacking(bool enable) {
+    keepSetter("setTipStatesPacking", [this, enable] () { return setTipStatesPacking(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setTipStatesPacking(enable); });
+}
+
+int BeagleShardedImpl::setTipPartials(int tipIndex,
+                                      const double* inPartials) {
+    std::vector<double> partials(inPartials, inPartials + kPatternCount * kStateCount);
+    keepSetter("setTipPartials " + std::to_string(tipIndex), [this, tipIndex, partials] () {
+        return setTipPartials(tipIndex, &partials[0]);
+    });
+    return forEachShard([&] (int i) {
+        return shards[i]->setTipPartials(tipIndex, inPartials + shardPatternOffsets[i] * kStateCount);
+    });
+}
+
+int BeagleShardedImpl::setPartials(int bufferIndex,
+                                   const double* inPartials) {
+    std::vector<double> partials(inPartials, inPartials + kPatternCount * kStateCount * kCategoryCount);
+    keepSetter("setPartials " + std::to_string(bufferIndex), [this, bufferIndex, partials] () {
+        return setPartials(bufferIndex, &partials[0]);
+    });
+    // partials are ordered by category, then pattern, then state
+    return forEachShard([&] (int i) {
+        const int shardSize = shardPatternCounts[i] * kStateCount;
+        std::vector<double> shardPartials(shardSize * kCategoryCount);
+        for (int l = 0; l < kCategoryCount; l++)
+            memcpy(&shardPartials[l * shardSize],
+                   inPartials + (l * kPatternCount + shardPatternOffsets[i]) * kStateCount,
+                   sizeof(double) * shardSize);
+        return shards[i]->setPartials(bufferIndex, &shardPartials[0]);
+    });
+}
+
+int BeagleShardedImpl::getPartials(int bufferIndex,
+                                   int scaleIndex,
+                                   double* outPartials) {
+    int returnCode = forEachShard([&] (int i) {
+        const int shardSize = shardPatternCounts[i] * kStateCount;
+        std::vector<double> shardPartials(shardSize * kCategoryCount);
+        int returnCode = shards[i]->getPartials(bufferIndex, scaleIndex, &shardPartials[0]);
+        for (int l = 0; l < kCategoryCount; l++)
+            memcpy(outPartials + (l * kPatternCount + shardPatternOffsets[i]) * kStateCount,
+                   &shardPartials[l * shardSize],
+                   sizeof(double) * shardSize);
+        return returnCode;
+    });
+    combinePatterns(outPartials, kCategoryCount, kStateCount);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::setEigenDecomposition(int eigenIndex,
+                                             const double* inEigenVectors,
+                                             const double* inInverseEigenVectors,
+                                             const double* inEigenValues) {
+    std::vector<double> vectors(inEigenVectors, inEigenVectors + kStateCount * kStateCount);
+    std::vector<double> inverseVectors(inInverseEigenVectors,
+                                       inInverseEigenVectors + kStateCount * kStateCount);
+    std::vector<double> values(inEigenValues, inEigenValues + kEigenValueCount);
+    keepSetter("setEigenDecomposition " + std::to_string(eigenIndex),
+               [this, eigenIndex, vectors, inverseVectors, values] () {
+        return setEigenDecomposition(eigenIndex, &vectors[0], &inverseVectors[0], &values[0]);
+    });
+    return forEachShard([&] (int i) {
+        return shards[i]->setEigenDecomposition(eigenIndex, inEigenVectors,
+                                                inInverseEigenVectors, inEigenValues);
+    });
+}
+
+int BeagleShardedImpl::setStateFrequencies(int stateFrequenciesIndex,
+                                           const double* inStateFrequencies) {
+    std::vector<double> frequencies(inStateFrequencies, inStateFrequencies + kStateCount);
+    keepSetter("setStateFrequencies " + std::to_string(stateFrequenciesIndex),
+               [this, stateFrequenciesIndex, frequencies] () {
+        return setStateFrequencies(stateFrequenciesIndex, &frequencies[0]);
+    });
+    return forEachShard([&] (int i) {
+        return shards[i]->setStateFrequencies(stateFrequenciesIndex, inStateFrequencies);
+    });
+}
+
+int BeagleShardedImpl::setCategoryWeights(int categoryWeightsIndex,
+                                          const double* inCategoryWeights) {
+    std::vector<double> weights(inCategoryWeights, inCategoryWeights + kCategoryCount);
+    keepSetter("setCategoryWeights " + std::to_string(categoryWeightsIndex),
+               [this, categoryWeightsIndex, weights] () {
+        return setCategoryWeights(categoryWeightsIndex, &weights[0]);
+    });
+    return forEachShard([&] (int i) {
+        return shards[i]->setCategoryWeights(categoryWeightsIndex, inCategoryWeights);
+    });
+}
+
+int BeagleShardedImpl::setPatternWeights(const double* inPatternWeights) {
+    std::vector<double> weights(inPatternWeights, inPatternWeights + kPatternCount);
+    keepSetter("setPatternWeights", [this, weights] () { return setPatternWeights(&weights[0]); });
+    return forEachShard([&] (int i) {
+        return shards[i]->setPatternWeights(inPatternWeights + shardPatternOffsets[i]);
+    });
+}
+
+int BeagleShardedImpl::setSiteRepeats(bool enable) {
+    keepSetter("setSiteRepeats", [this, enable] () { return setSiteRepeats(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setSiteRepeats(enable); });
+}
+
+int BeagleShardedImpl::setGapPatternSkipping(bool enable) {
+    keepSetter("setGapPatternSkipping", [this, enable] () { return setGapPatternSkipping(enable); });
+    return forEachShard([&] (int i) { return shards[i]->setGapPatternSkipping(enable); });
+}
+
+int BeagleShardedImpl::setPatternPartitions(int partitionCount,
+                                            const int* inPatternPartitions) {
+    std::vector<int> partitions(inPatternPartitions, inPatternPartitions + kPatternCount);
+    keepSetter("setPatternPartitions", [this, partitionCount, partitions] () {
+        return setPatternPartitions(partitionCount, &partitions[0]);
+    });
+    return forEachShard([&] (int i) {
+        return shards[i]->setPatternPartitions(partitionCount,
+                                               inPatternPartitions + shardPatternOffsets[i]);
+    });
+}
+
+int BeagleShardedImpl::setCategoryRates(const double* inCategoryRates) {
+    std::vector<double> rates(inCategoryRates, inCategoryRates + kCategoryCount);
+    keepSetter("setCategoryRatesWithIndex 0", [this, rates] () { return setCategoryRates(&rates[0]); });
+    return forEachShard([&] (int i) { return shards[i]->setCategoryRates(inCategoryRates); });
+}
+
+int BeagleShardedImpl::setCategoryRatesWithIndex(int categoryRatesIndex,
+                                                 const double* inCategoryRates) {
+    std::vector<double> rates(inCategoryRates, inCategoryRates + kCategoryCount);
+    keepSetter("setCategoryRatesWithIndex " + std::to_string(categoryRatesIndex),
+               [this, categoryRatesIndex, rates] () {
+        return setCategoryRatesWithIndex(categoryRatesIndex, &rates[0]);
+    });
+    return forEachShard([&] (int i) {
+        return shards[i]->setCategoryRatesWithIndex(categoryRatesIndex, inCategoryRates);
+    });
+}
+
+int BeagleShardedImpl::setTransitionMatrix(int matrixIndex,
+                                           const double* inMatrix,
+                                           double paddedValue) {
+    return forEachShard([&] (int i) {
+        return shards[i]->setTransitionMatrix(matrixIndex, inMatrix, paddedValue);
+    });
+}
+
+int BeagleShardedImpl::setTransitionMatrices(const int* matrixIndices,
+                                             const double* inMatrices,
+                                             const double* paddedValues,
+                                             int count) {
+    return forEachShard([&] (int i) {
+        return shards[i]->setTransitionMatrices(matrixIndices, inMatrices, paddedValues, count);
+    });
+}
+
+int BeagleShardedImpl::getTransitionMatrix(int matrixIndex,
+                                           double* outMatrix) {
+    // every shard holds the same matrices
+    return shards[0]->getTransitionMatrix(matrixIndex, outMatrix);
+}
+
+int BeagleShardedImpl::convolveTransitionMatrices(const int* firstIndices,
+                                                  const int* secondIndices,
+                                                  const int* resultIndices,
+                                                  int matrixCount) {
+    return forEachShard([&] (int i) {
+        return shards[i]->convolveTransitionMatrices(firstIndices, secondIndices,
+                                                     resultIndices, matrixCount);
+    });
+}
+
+int BeagleShardedImpl::convolveTransitionMatrixChains(const int* chainIndices,
+                                                      const int* chainLengths,
+                                                      const int* scratchIndices,
+                                                      const int* resultIndices,
+                                                      int chainCount) {
+    return forEachShard([&] (int i) {
+        return shards[i]->convolveTransitionMatrixChains(chainIndices, chainLengths, scratchIndices,
+                                                         resultIndices, chainCount);
+    });
+}
+
+int BeagleShardedImpl::updateTransitionMatrices(int eigenIndex,
+                                                const int* probabilityIndices,
+                                                const int* firstDerivativeIndices,
+                                                const int* secondDerivativeIndices,
+                                                const double* edgeLengths,
+                                                int count) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updateTransitionMatrices(eigenIndex, probabilityIndices,
+                                                   firstDerivativeIndices, secondDerivativeIndices,
+                                                   edgeLengths, count);
+    });
+}
+
+int BeagleShardedImpl::updateTransitionMatricesWithModelCategories(int* eigenIndices,
+                                                                   const int* probabilityIndices,
+                                                                   const int* firstDerivativeIndices,
+                                                                   const int* secondDerivativeIndices,
+                                                                   const double* edgeLengths,
+                                                                   int count) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updateTransitionMatricesWithModelCategories(eigenIndices, probabilityIndices,
+                                                                      firstDerivativeIndices,
+                                                                      secondDerivativeIndices,
+                                                                      edgeLengths, count);
+    });
+}
+
+int BeagleShardedImpl::updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                                                  const int* categoryRateIndices,
+                                                                  const int* probabilityIndices,
+                                                                  const int* firstDerivativeIndices,
+                                                                  const int* secondDerivativeIndices,
+                                                                  const double* edgeLengths,
+                                                                  int count) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updateTransitionMatricesWithMultipleModels(eigenIndices, categoryRateIndices,
+                                                                     probabilityIndices,
+                                                                     firstDerivativeIndices,
+                                                                     secondDerivativeIndices,
+                                                                     edgeLengths, count);
+    });
+}
+
+int BeagleShardedImpl::updateTransitionMatricesWithRateMatrix(const double* inRateMatrix,
+                                                              const int* probabilityIndices,
+                                                              const double* edgeLengths,
+                                                              int count) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updateTransitionMatricesWithRateMatrix(inRateMatrix, probabilityIndices,
+                                                                 edgeLengths, count);
+    });
+}
+
+int BeagleShardedImpl::updateTransitionMatrixDerivativesWithRateMatrix(const double* inRateMatrix,
+                                                                       const double* inRateMatrixDerivative,
+                                                                       const int* derivativeIndices,
+                                                                       const double* edgeLengths,
+                                                                       int count) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updateTransitionMatrixDerivativesWithRateMatrix(inRateMatrix,
+                                                                          inRateMatrixDerivative,
+                                                                          derivativeIndices,
+                                                                          edgeLengths, count);
+    });
+}
+
+int BeagleShardedImpl::updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                                             const int* probabilityIndices,
+                                                             const double* edgeLengths,
+                                                             int count,
+                                                             int replicateCount) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updateTransitionMatricesForReplicates(eigenIndices, probabilityIndices,
+                                                                edgeLengths, count, replicateCount);
+    });
+}
+
+int BeagleShardedImpl::updatePartials(const int* operations,
+                                      int operationCount,
+                                      int cumulativeScalingIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updatePartials(operations, operationCount, cumulativeScalingIndex);
+    });
+}
+
+int BeagleShardedImpl::updatePartialsByPartition(const int* operations,
+                                                 int operationCount) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updatePartialsByPartition(operations, operationCount);
+    });
+}
+
+int BeagleShardedImpl::setRootPrePartials(const int* bufferIndices,
+                                          const int* stateFrequenciesIndices,
+                                          int count) {
+    return forEachShard([&] (int i) {
+        return shards[i]->setRootPrePartials(bufferIndices, stateFrequenciesIndices, count);
+    });
+}
+
+int BeagleShardedImpl::updatePrePartials(const int* operations,
+                                         int operationCount,
+                                         int cumulativeScalingIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->updatePrePartials(operations, operationCount, cumulativeScalingIndex);
+    });
+}
+
+int BeagleShardedImpl::waitForPartials(const int* destinationPartials,
+                                       int destinationPartialsCount) {
+    return forEachShard([&] (int i) {
+        return shards[i]->waitForPartials(destinationPartials, destinationPartialsCount);
+    });
+}
+
+int BeagleShardedImpl::accumulateScaleFactors(const int* scalingIndices,
+                                              int count,
+                                              int cumulativeScalingIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->accumulateScaleFactors(scalingIndices, count, cumulativeScalingIndex);
+    });
+}
+
+int BeagleShardedImpl::accumulateScaleFactorsByPartition(const int* scaleIndices,
+                                                         int count,
+                                                         int cumulativeScaleIndex,
+                                                         int partitionIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->accumulateScaleFactorsByPartition(scaleIndices, count,
+                                                            cumulativeScaleIndex, partitionIndex);
+    });
+}
+
+int BeagleShardedImpl::removeScaleFactors(const int* scalingIndices,
+                                          int count,
+                                          int cumulativeScalingIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->removeScaleFactors(scalingIndices, count, cumulativeScalingIndex);
+    });
+}
+
+int BeagleShardedImpl::removeScaleFactorsByPartition(const int* scaleIndices,
+                                                     int count,
+                                                     int cumulativeScaleIndex,
+                                                     int partitionIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->removeScaleFactorsByPartition(scaleIndices, count,
+                                                        cumulativeScaleIndex, partitionIndex);
+    });
+}
+
+int BeagleShardedImpl::resetScaleFactors(int cumulativeScalingIndex) {
+    return forEachShard([&] (int i) { return shards[i]->resetScaleFactors(cumulativeScalingIndex); });
+}
+
+int BeagleShardedImpl::resetScaleFactorsByPartition(int cumulativeScaleIndex,
+                                                    int partitionIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->resetScaleFactorsByPartition(cumulativeScaleIndex, partitionIndex);
+    });
+}
+
+int BeagleShardedImpl::copyScaleFactors(int destScalingIndex,
+                                        int srcScalingIndex) {
+    return forEachShard([&] (int i) {
+        return shards[i]->copyScaleFactors(destScalingIndex, srcScalingIndex);
+    });
+}
+
+int BeagleShardedImpl::getScaleFactors(int srcScalingIndex,
+                                       double* scaleFactors) {
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->getScaleFactors(srcScalingIndex, scaleFactors + shardPatternOffsets[i]);
+    });
+    combinePatterns(scaleFactors, 1, 1);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateRootLogLikelihoods(const int* bufferIndices,
+                                                   const int* categoryWeightsIndices,
+                                                   const int* stateFrequenciesIndices,
+                                                   const int* scalingFactorsIndices,
+                                                   int count,
+                                                   double* outSumLogLikelihood) {
+    std::vector<double> shardLogL(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->calculateRootLogLikelihoods(bufferIndices, categoryWeightsIndices,
+                                                      stateFrequenciesIndices, scalingFactorsIndices,
+                                                      count, &shardLogL[i]);
+    });
+    sumShards(shardLogL, 1, outSumLogLikelihood);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::updatePartialsAndCalculateRootLogLikelihood(const int* operations,
+                                                                   int operationCount,
+                                                                   int cumulativeScaleIndex,
+                                                                   int categoryWeightsIndex,
+                                                                   int stateFrequenciesIndex,
+                                                                   bool writeRootPartials,
+                                                                   double* outSumLogLikelihood) {
+    std::vector<double> shardLogL(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->updatePartialsAndCalculateRootLogLikelihood(operations, operationCount,
+                                                                      cumulativeScaleIndex,
+                                                                      categoryWeightsIndex,
+                                                                      stateFrequenciesIndex,
+                                                                      writeRootPartials,
+                                                                      &shardLogL[i]);
+    });
+    sumShards(shardLogL, 1, outSumLogLikelihood);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateRootLogLikelihoodsWithPatternWeights(const int* bufferIndices,
+                                                                   const int* categoryWeightsIndices,
+                                                                   const int* stateFrequenciesIndices,
+                                                                   const int* cumulativeScaleIndices,
+                                                                   int count,
+                                                                   const double* inPatternWeights,
+                                                                   int weightVectorCount,
+                                                                   double* outSumLogLikelihoods) {
+    return sumSiteLogLikelihoodsWithPatternWeights(kPatternCount, bufferIndices, categoryWeightsIndices,
+                                                   stateFrequenciesIndices, cumulativeScaleIndices,
+                                                   count, inPatternWeights, weightVectorCount,
+                                                   outSumLogLikelihoods);
+}
+
+int BeagleShardedImpl::calculateRootLogLikelihoodsForReplicates(int bufferIndex,
+                                                               int categoryWeightsIndex,
+                                                               const int* stateFrequenciesIndices,
+                                                               int cumulativeScaleIndex,
+                                                               int replicateCount,
+                                                               double* outSumLogLikelihoods) {
+    if (replicateCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    std::vector<double> shardLogL(kShardCount * replicateCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->calculateRootLogLikelihoodsForReplicates(bufferIndex, categoryWeightsIndex,
+                                                                   stateFrequenciesIndices,
+                                                                   cumulativeScaleIndex,
+                                                                   replicateCount,
+                                                                   &shardLogL[i * replicateCount]);
+    });
+    sumShards(shardLogL, replicateCount, outSumLogLikelihoods);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
+                                                              const int* categoryWeightsIndices,
+                                                              const int* stateFrequenciesIndices,
+                                                              const int* cumulativeScaleIndices,
+                                                              const int* partitionIndices,
+                                                              int partitionCount,
+                                                              int count,
+                                                              double* outSumLogLikelihoodByPartition,
+                                                              double* outSumLogLikelihood) {
+    std::vector<double> shardLogLByPartition(kShardCount * partitionCount);
+    std::vector<double> shardLogL(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->calculateRootLogLikelihoodsByPartition(bufferIndices, categoryWeightsIndices,
+                                                                 stateFrequenciesIndices,
+                                                                 cumulativeScaleIndices,
+                                                                 partitionIndices, partitionCount,
+                                                                 count,
+                                                                 &shardLogLByPartition[i * partitionCount],
+                                                                 &shardLogL[i]);
+    });
+    sumShards(shardLogLByPartition, partitionCount, outSumLogLikelihoodByPartition);
+    sumShards(shardLogL, 1, outSumLogLikelihood);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateEdgeLogLikelihoods(const int* parentBufferIndices,
+                                                   const int* childBufferIndices,
+                                                   const int* probabilityIndices,
+                                                   const int* firstDerivativeIndices,
+                                                   const int* secondDerivativeIndices,
+                                                   const int* categoryWeightsIndices,
+                                                   const int* stateFrequenciesIndices,
+                                                   const int* scalingFactorsIndices,
+                                                   int count,
+                                                   double* outSumLogLikelihood,
+                                                   double* outSumFirstDerivative,
+                                                   double* outSumSecondDerivative) {
+    std::vector<double> shardLogL(kShardCount);
+    std::vector<double> shardD1(kShardCount);
+    std::vector<double> shardD2(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->calculateEdgeLogLikelihoods(parentBufferIndices, childBufferIndices,
+                                                      probabilityIndices,
+                                                      firstDerivativeIndices, secondDerivativeIndices,
+                                                      categoryWeightsIndices, stateFrequenciesIndices,
+                                                      scalingFactorsIndices, count,
+                                                      &shardLogL[i],
+                                                      (outSumFirstDerivative ? &shardD1[i] : NULL),
+                                                      (outSumSecondDerivative ? &shardD2[i] : NULL));
+    });
+    sumShards(shardLogL, 1, outSumLogLikelihood);
+    sumShards(shardD1, 1, outSumFirstDerivative);
+    sumShards(shardD2, 1, outSumSecondDerivative);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateEdgeSiteLogLikelihoods(const int* parentBufferIndices,
+                                                       const int* childBufferIndices,
+                                                       const int* probabilityIndices,
+                                                       const int* firstDerivativeIndices,
+                                                       const int* secondDerivativeIndices,
+                                                       const int* categoryWeightsIndices,
+                                                       const int* stateFrequenciesIndices,
+                                                       const int* cumulativeScaleIndices,
+                                                       int count,
+                                                       double* outSiteLogLikelihoods,
+                                                       double* outSiteFirstDerivatives,
+                                                       double* outSiteSecondDerivatives) {
+    if (count < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // each shard fills rows of its own patterns, which are then placed at its offset
+    std::vector<std::vector<double> > shardSites(kShardCount), shardD1(kShardCount), shardD2(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        const size_t size = (size_t) count * shardPatternCounts[i];
+        shardSites[i].resize(size);
+        shardD1[i].resize(firstDerivativeIndices ? size : 0);
+        shardD2[i].resize(secondDerivativeIndices ? size : 0);
+        return shards[i]->calculateEdgeSiteLogLikelihoods(parentBufferIndices, childBufferIndices,
+                                                          probabilityIndices, firstDerivativeIndices,
+                                                          secondDerivativeIndices, categoryWeightsIndices,
+                                                          stateFrequenciesIndices, cumulativeScaleIndices,
+                                                          count, shardSites[i].data(),
+                                                          shardD1[i].data(), shardD2[i].data());
+    });
+    returnCode = combineReturnCode(returnCode);
+    if (returnCode != BEAGLE_SUCCESS && returnCode != BEAGLE_ERROR_FLOATING_POINT)
+        return returnCode;
+
+    for (int i = 0; i < kShardCount; i++) {
+        const int shardPatternCount = shardPatternCounts[i];
+        for (int e = 0; e < count; e++) {
+            const size_t from = (size_t) e * shardPatternCount;
+            const size_t to = (size_t) e * kPatternCount + shardPatternOffsets[i];
+            std::copy(shardSites[i].begin() + from, shardSites[i].begin() + from + shardPatternCount,
+                      outSiteLogLikelihoods + to);
+            if (firstDerivativeIndices != NULL)
+                std::copy(shardD1[i].begin() + from, shardD1[i].begin() + from + shardPatternCount,
+                          outSiteFirstDerivatives + to);
+            if (secondDerivativeIndices != NULL)
+                std::copy(shardD2[i].begin() + from, shardD2[i].begin() + from + shardPatternCount,
+                          outSiteSecondDerivatives + to);
+        }
+    }
+    combinePatterns(outSiteLogLikelihoods, count, 1);
+    if (firstDerivativeIndices != NULL)
+        combinePatterns(outSiteFirstDerivatives, count, 1);
+    if (secondDerivativeIndices != NULL)
+        combinePatterns(outSiteSecondDerivatives, count, 1);
+    return returnCode;
+}
+
+int BeagleShardedImpl::calculateEdgeLogLikelihoodsByPartition(const int* parentBufferIndices,
+                                                              const int* childBufferIndices,
+                                                              const int* probabilityIndices,
+                                                              const int* firstDerivativeIndices,
+                                                              const int* secondDerivativeIndices,
+                                                              const int* categoryWeightsIndices,
+                                                              const int* stateFrequenciesIndices,
+                                                              const int* cumulativeScaleIndices,
+                                                              const int* partitionIndices,
+                                                              int partitionCount,
+                                                              int count,
+                                                              double* outSumLogLikelihoodByPartition,
+                                                              double* outSumLogLikelihood,
+                                                              double* outSumFirstDerivativeByPartition,
+                                                              double* outSumFirstDerivative,
+                                                              double* outSumSecondDerivativeByPartition,
+                                                              double* outSumSecondDerivative) {
+    std::vector<double> shardLogLByPartition(kShardCount * partitionCount);
+    std::vector<double> shardD1ByPartition(kShardCount * partitionCount);
+    std::vector<double> shardD2ByPartition(kShardCount * partitionCount);
+    std::vector<double> shardLogL(kShardCount);
+    std::vector<double> shardD1(kShardCount);
+    std::vector<double> shardD2(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->calculateEdgeLogLikelihoodsByPartition(parentBufferIndices, childBufferIndices,
+                                                                 probabilityIndices,
+                                                                 firstDerivativeIndices,
+                                                                 secondDerivativeIndices,
+                                                                 categoryWeightsIndices,
+                                                                 stateFrequenciesIndices,
+                                                                 cumulativeScaleIndices,
+                                                                 partitionIndices, partitionCount,
+                                                                 count,
+                                                                 &shardLogLByPartition[i * partitionCount],
+                                                                 &shardLogL[i],
+                                                                 (outSumFirstDerivativeByPartition ?
+                                                                  &shardD1ByPartition[i * partitionCount] : NULL),
+                                                                 (outSumFirstDerivative ? &shardD1[i] : NULL),
+                                                                 (outSumSecondDerivativeByPartition ?
+                                                                  &shardD2ByPartition[i * partitionCount] : NULL),
+                                                                 (outSumSecondDerivative ? &shardD2[i] : NULL));
+    });
+    sumShards(shardLogLByPartition, partitionCount, outSumLogLikelihoodByPartition);
+    sumShards(shardLogL, 1, outSumLogLikelihood);
+    sumShards(shardD1ByPartition, partitionCount, outSumFirstDerivativeByPartition);
+    sumShards(shardD1, 1, outSumFirstDerivative);
+    sumShards(shardD2ByPartition, partitionCount, outSumSecondDerivativeByPartition);
+    sumShards(shardD2, 1, outSumSecondDerivative);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateParameterDerivatives(const int* postBufferIndices,
+                                                     const int* preBufferIndices,
+                                                     const int* probabilityIndices,
+                                                     const int* derivativeIndices,
+                                                     const int* categoryWeightsIndices,
+                                                     int count,
+                                                     int parameterCount,
+                                                     double* outSumDerivatives) {
+    if (parameterCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    std::vector<double> shardSums(kShardCount * parameterCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->calculateParameterDerivatives(postBufferIndices, preBufferIndices,
+                                                        probabilityIndices, derivativeIndices,
+                                                        categoryWeightsIndices, count,
+                                                        parameterCount,
+                                                        &shardSums[i * parameterCount]);
+    });
+    sumShards(shardSums, parameterCount, outSumDerivatives);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateEdgeDerivatives(const int* postBufferIndices,
+                                                const int* preBufferIndices,
+                                                const int* probabilityIndices,
+                                                const int* firstDerivativeIndices,
+                                                const int* categoryWeightsIndices,
+                                                int count,
+                                                double* outDerivatives,
+                                                double* outSumDerivatives) {
+    std::vector<double> shardSums(kShardCount * count);
+    std::vector<std::vector<double> > shardDerivatives(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        if (outDerivatives != NULL)
+            shardDerivatives[i].resize(count * shardPatternCounts[i]);
+        return shards[i]->calculateEdgeDerivatives(postBufferIndices, preBufferIndices,
+                                                   probabilityIndices, firstDerivativeIndices,
+                                                   categoryWeightsIndices, count,
+                                                   (outDerivatives ? shardDerivatives[i].data() : NULL),
+                                                   &shardSums[i * count]);
+    });
+    sumShards(shardSums, count, outSumDerivatives);
+    if (outDerivatives != NULL) {
+        for (int i = 0; i < kShardCount; i++) {
+            for (int j = 0; j < count; j++) {
+                memcpy(outDerivatives + j * kPatternCount + shardPatternOffsets[i],
+                       shardDerivatives[i].data() + j * shardPatternCounts[i],
+                       sizeof(double) * shardPatternCounts[i]);
+            }
+        }
+        combinePatterns(outDerivatives, count, 1);
+    }
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::calculateEdgeLogLikelihoodsForMatrices(int parentBufferIndex,
+                                                              int childBufferIndex,
+                                                              const int* probabilityIndices,
+                                                              const int* firstDerivativeIndices,
+                                                              const int* secondDerivativeIndices,
+                                                              int categoryWeightsIndex,
+                                                              int stateFrequenciesIndex,
+                                                              int cumulativeScaleIndex,
+                                                              int matrixCount,
+                                                              double* outSumLogLikelihoods,
+                                                              double* outSumFirstDerivatives,
+                                                              double* outSumSecondDerivatives) {
+    std::vector<double> shardLogL(kShardCount * matrixCount);
+    std::vector<double> shardD1(kShardCount * matrixCount);
+    std::vector<double> shardD2(kShardCount * matrixCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->calculateEdgeLogLikelihoodsForMatrices(parentBufferIndex, childBufferIndex,
+                                                                 probabilityIndices,
+                                                                 firstDerivativeIndices,
+                                                                 secondDerivativeIndices,
+                                                                 categoryWeightsIndex,
+                                                                 stateFrequenciesIndex,
+                                                                 cumulativeScaleIndex, matrixCount,
+                                                                 &shardLogL[i * matrixCount],
+                                                                 (outSumFirstDerivatives ?
+                                                                  &shardD1[i * matrixCount] : NULL),
+                                                                 (outSumSecondDerivatives ?
+                                                                  &shardD2[i * matrixCount] : NULL));
+    });
+    sumShards(shardLogL, matrixCount, outSumLogLikelihoods);
+    sumShards(shardD1, matrixCount, outSumFirstDerivatives);
+    sumShards(shardD2, matrixCount, outSumSecondDerivatives);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::getLogLikelihood(double* outSumLogLikelihood) {
+    std::vector<double> shardLogL(kShardCount);
+    int returnCode = forEachShard([&] (int i) { return shards[i]->getLogLikelihood(&shardLogL[i]); });
+    sumShards(shardLogL, 1, outSumLogLikelihood);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::getDerivatives(double* outSumFirstDerivative,
+                                      double* outSumSecondDerivative) {
+    std::vector<double> shardD1(kShardCount);
+    std::vector<double> shardD2(kShardCount);
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->getDerivatives(&shardD1[i], (outSumSecondDerivative ? &shardD2[i] : NULL));
+    });
+    sumShards(shardD1, 1, outSumFirstDerivative);
+    sumShards(shardD2, 1, outSumSecondDerivative);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::getSiteLogLikelihoods(double* outLogLikelihoods) {
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->getSiteLogLikelihoods(outLogLikelihoods + shardPatternOffsets[i]);
+    });
+    combinePatterns(outLogLikelihoods, 1, 1);
+    return combineReturnCode(returnCode);
+}
+
+int BeagleShardedImpl::getSiteDerivatives(double* outFirstDerivatives,
+                                          double* outSecondDerivatives) {
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->getSiteDerivatives(outFirstDerivatives + shardPatternOffsets[i],
+                                             (outSecondDerivatives ?
+                                              outSecondDerivatives + shardPatternOffsets[i] : NULL));
+    });
+    combinePatterns(outFirstDerivatives, 1, 1);
+    if (outSecondDerivatives != NULL)
+        combinePatterns(outSecondDerivatives, 1, 1);
+    return combineReturnCode(returnCode);
+}
+
+void BeagleShardedImpl::forgetDataSetters() {
+    static const char* dataSetters[] = { "setTipStates ", "setTipPartials ", "setPartials ",
+                                         "setEigenDecomposition ", "setStateFrequencies ",
+                                         "setCategoryWeights ", "setCategoryRatesWithIndex ",
+                                         "setPatternWeights" };
+    for (std::map<std::string, std::pair<long, std::function<int()> > >::iterator it =
+         keptSetters.begin(); it != keptSetters.end(); ) {
+        bool dataSetter = false;
+        for (size_t j = 0; j < sizeof(dataSetters) / sizeof(dataSetters[0]) && !dataSetter; j++)
+            dataSetter = (it->first.compare(0, strlen(dataSetters[j]), dataSetters[j]) == 0);
+        if (dataSetter)
+            keptSetters.erase(it++);
+        else
+            it++;
+    }
+}
+
+int BeagleShardedImpl::reset() {
+    forgetDataSetters();
+
+    return forEachShard([&] (int i) { return shards[i]->reset(); });
+}
+
+int BeagleShardedImpl::grow(int tipCount,
+                            int partialsBufferCount,
+                            int compactBufferCount,
+                            int patternCount,
+                            int matrixBufferCount,
+                            int scaleBufferCount) {
+    if (patternCount < kPatternCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // the last shard takes the new patterns
+    std::vector<int> newPatternCounts(shardPatternCounts);
+    newPatternCounts[kShardCount - 1] += patternCount - kPatternCount;
+    int returnCode = forEachShard([&] (int i) {
+        return shards[i]->grow(tipCount, partialsBufferCount, compactBufferCount,
+                               newPatternCounts[i], matrixBufferCount, scaleBufferCount); });
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    shardPatternCounts = newPatternCounts;
+    kPatternCount = patternCount;
+    kMatrixBufferCount = matrixBufferCount;
+    setShardOffsets();
+    forgetDataSetters();
+
+    // shards made by rebalance() start at the grown buffer counts
+    if (shardFactory) {
+        ShardFactory createShard = shardFactory;
+        shardFactory = [=] (int shard, int shardPatternCount, int* errorCode) -> BeagleImpl* {
+            BeagleImpl* impl = createShard(shard, shardPatternCount, errorCode);
+            if (impl != NULL) {
+                *errorCode = impl->grow(tipCount, partialsBufferCount, compactBufferCount,
+                                        shardPatternCount, matrixBufferCount, scaleBufferCount);
+                if (*errorCode != BEAGLE_SUCCESS) {
+                    delete impl;
+                    impl = NULL;
+                }
+            }
+            return impl;
+        };
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+int BeagleShardedImpl::rebalance() {
+    if (!shardFactory)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    // patterns per second of each shard; a shard not yet timed keeps its share
+    std::vector<double> rates(kShardCount);
+    for (int i = 0; i < kShardCount; i++) {
+        if (shardSeconds[i] <= 0.0)
+            return BEAGLE_SUCCESS;
+        rates[i] = shardPatternCounts[i] / shardSeconds[i];
+    }
+    // only the patterns of this process move between its shards
+    int localPatternCount = 0;
+    for (int i = 0; i < kShardCount; i++)
+        localPatternCount += shardPatternCounts[i];
+    std::vector<int> newPatternCounts = splitPatterns(localPatternCount, rates);
+
+    // moving fewer patterns than this is not worth the new shards
+    const int minMovedPatterns = localPatternCount / 20 + 1;
+    int movedPatterns = 0;
+    for (int i = 0; i < kShardCount; i++)
+        movedPatterns += abs(newPatternCounts[i] - shardPatternCounts[i]);
+    if (movedPatterns / 2 < minMovedPatterns)
+        return BEAGLE_SUCCESS;
+
+    // every shard holds the same matrices
+    const int matrixSize = kStateCount * kStateCount * kCategoryCount;
+    std::vector<double> matrices((size_t) matrixSize * kMatrixBufferCount);
+    for (int m = 0; m < kMatrixBufferCount; m++) {
+        int returnCode = shards[0]->getTransitionMatrix(m, &matrices[(size_t) m * matrixSize]);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+
+    std::vector<BeagleImpl*> newShards;
+    for (int i = 0; i < kShardCount; i++) {
+        int errorCode = BEAGLE_SUCCESS;
+        BeagleImpl* shard = shardFactory(i, newPatternCounts[i], &errorCode);
+        if (shard == NULL) {
+            for (size_t j = 0; j < newShards.size(); j++)
+                delete newShards[j];
+            return (errorCode != BEAGLE_SUCCESS ? errorCode : BEAGLE_ERROR_GENERAL);
+        }
+        newShards.push_back(shard);
+    }
+
+    for (int i = 0; i < kShardCount; i++) {
+        delete shards[i];
+        shards[i] = newShards[i];
+        shards[i]->setTrace(trace);
+    }
+    shardPatternCounts = newPatternCounts;
+    setShardOffsets();
+
+    // the setters again, in the order they were last called in
+    std::map<long, std::function<int()> > setters;
+    for (std::map<std::string, std::pair<long, std::function<int()> > >::iterator it =
+         keptSetters.begin(); it != keptSetters.end(); it++)
+        setters[it->second.first] = it->second.second;
+
+    replayingSetters = true;
+    int returnCode = BEAGLE_SUCCESS;
+    for (std::map<long, std::function<int()> >::iterator it = setters.begin();
+         it != setters.end() && returnCode == BEAGLE_SUCCESS; it++) {
+        returnCode = it->second();
+        // options a resource does not offer were refused by it the first time as well
+        if (returnCode == BEAGLE_ERROR_NO_IMPLEMENTATION)
+            returnCode = BEAGLE_SUCCESS;
+    }
+    replayingSetters = false;
+
+    for (int m = 0; m < kMatrixBufferCount && returnCode == BEAGLE_SUCCESS; m++)
+        returnCode = setTransitionMatrix(m, &matrices[(size_t) m * matrixSize], 1.0);
+
+    shardSeconds.assign(kShardCount, 0.0);
+
+    return returnCode;
+}
+
+} // end namespace beagle
@@ -0,0 +1,493 @@
+/*
+ *  BeagleShardedImpl.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleShardedImpl__
+#define __BeagleShardedImpl__
+
+#include "libhmsbeagle/BeagleImpl.h"
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <string>
+
+namespace beagle {
+
+/*
+ * An instance whose site patterns are split into contiguous shards, each held by its own
+ * implementation (typically one per device). Calls are issued to all shards concurrently;
+ * pattern-indexed buffers are split or gathered and log likelihoods are summed.
+ *
+ * The time each shard spends in its calls is measured, and rebalance() moves patterns from
+ * slower shards to faster ones by creating the shards again with the shardFactory. The data
+ * set through the setters are kept for this, so that they can be set again on the new shards.
+ */
+class BeagleShardedImpl : public BeagleImpl
+{
+public:
+    // returns the implementation of shard number shard holding patternCount patterns, or NULL
+    // with the reason in errorCode
+    typedef std::function<BeagleImpl*(int shard, int patternCount, int* errorCode)> ShardFactory;
+
+    // takes ownership of the shards; shard i holds shardPatternCounts[i] patterns. Without a
+    // shardFactory, the instance cannot be rebalanced.
+    BeagleShardedImpl(const std::vector<BeagleImpl*>& shards,
+                      const std::vector<int>& shardPatternCounts,
+                      int stateCount,
+                      int categoryCount,
+                      int matrixBufferCount = 0,
+                      const ShardFactory& shardFactory = ShardFactory());
+
+    // splits patternCount patterns into shares proportional to weights, of at least one
+    // pattern each
+    static std::vector<int> splitPatterns(int patternCount,
+                                          const std::vector<double>& weights);
+
+    virtual ~BeagleShardedImpl();
+
+    // the shards are created by beagleCreateShardedInstance
+    virtual int createInstance(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               int resourceNumber,
+                               int pluginResourceNumber,
+                               long preferenceFlags,
+                               long requirementFlags);
+
+    virtual int getInstanceDetails(BeagleInstanceDetails* returnInfo);
+
+    virtual int setCPUThreadCount(int threadCount);
+
+    virtual int setCPUThreadPool(std::shared_ptr<cpu::ThreadPool> threadPool);
+
+    virtual void setTrace(TraceRecorder* trace);
+
+    virtual int calibrateCPUThreadCount();
+
+    virtual int setCPUNumaPlacement(bool enable);
+
+    virtual int setCPUThreadSpin(int spinMicroseconds);
+
+    virtual int setCPUBufferArena(bool enable,
+                                  long hugePageSize);
+
+    virtual int setCPUScratchFile(const char* directory,
+                                  int prefetchDistance);
+
+    virtual int setLazyBufferAllocation(bool enable);
+
+    virtual int setCPUPatternTiling(int patternBlockSize);
+
+    virtual int setCPUInterleavedPatterns(bool enable);
+
+    virtual int setPartialsCheckpointing(int maxResidentBuffers);
+
+    virtual int setCPUParallelOperations(bool enable);
+
+    virtual void beginCallStatistics();
+
+    virtual void endCallStatistics();
+
+    virtual int getStatistics(BeagleStatistics* outStatistics);
+
+    virtual int resetStatistics();
+
+    virtual int setTransitionMatrixCache(bool enable);
+
+    virtual int setBufferVersioning(bool enable);
+
+    virtual int setPowerOfTwoScaling(bool enable);
+
+    virtual int setScalingThreshold(double threshold);
+
+    virtual int setMixedPrecision(bool enable);
+
+    virtual int setTipStates(int tipIndex,
+                             const int* inStates);
+
+    virtual int setTipStatesPacking(bool enable);
+
+    virtual int setTipPartials(int tipIndex,
+                               const double* inPartials);
+
+    virtual int setPartials(int bufferIndex,
+                            const double* inPartials);
+
+    virtual int getPartials(int bufferIndex,
+                            int scaleIndex,
+                            double* outPartials);
+
+    virtual int setEigenDecomposition(int eigenIndex,
+                                      const double* inEigenVectors,
+                                      const double* inInverseEigenVectors,
+                                      const double* inEigenValues);
+
+    virtual int setStateFrequencies(int stateFrequenciesIndex,
+                                    const double* inStateFrequencies);
+
+    virtual int setCategoryWeights(int categoryWeightsIndex,
+                                   const double* inCategoryWeights);
+
+    virtual int setPatternWeights(const double* inPatternWeights);
+
+    virtual int setSiteRepeats(bool enable);
+
+    virtual int setGapPatternSkipping(bool enable);
+
+    virtual int setPatternPartitions(int partitionCount,
+                                     const int* inPatternPartitions);
+
+    virtual int setCategoryRates(const double* inCategoryRates);
+
+    virtual int setCategoryRatesWithIndex(int categoryRatesIndex,
+                                          const double* inCategoryRates);
+
+    virtual int setTransitionMatrix(int matrixIndex,
+                                    const double* inMatrix,
+                                    double paddedValue);
+
+    virtual int setTransitionMatrices(const int* matrixIndices,
+                                      const double* inMatrices,
+                                      const double* paddedValues,
+                                      int count);
+
+    virtual int getTransitionMatrix(int matrixIndex,
+                                    double* outMatrix);
+
+    virtual int convolveTransitionMatrices(const int* firstIndices,
+                                           const int* secondIndices,
+                                           const int* resultIndices,
+                                           int matrixCount);
+
+    virtual int convolveTransitionMatrixChains(const int* chainIndices,
+                                               const int* chainLengths,
+                                               const int* scratchIndices,
+                                               const int* resultIndices,
+                                               int chainCount);
+
+    virtual int updateTransitionMatrices(int eigenIndex,
+                                         const int* probabilityIndices,
+                                         const int* firstDerivativeIndices,
+                                         const int* secondDerivativeIndices,
+                                         const double* edgeLengths,
+                                         int count);
+
+    virtual int updateTransitionMatricesWithModelCategories(int* eigenIndices,
+                                                            const int* probabilityIndices,
+                                                            const int* firstDerivativeIndices,
+                                                            const int* secondDerivativeIndices,
+                                                            const double* edgeLengths,
+                                                            int count);
+
+    virtual int updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                                           const int* categoryRateIndices,
+                                                           const int* probabilityIndices,
+                                                           const int* firstDerivativeIndices,
+                                                           const int* secondDerivativeIndices,
+                                                           const double* edgeLengths,
+                                                           int count);
+
+    virtual int updateTransitionMatricesWithRateMatrix(const double* inRateMatrix,
+                                                       const int* probabilityIndices,
+                                                       const double* edgeLengths,
+                                                       int count);
+
+    virtual int updateTransitionMatrixDerivativesWithRateMatrix(const double* inRateMatrix,
+                                                                const double* inRateMatrixDerivative,
+                                                                const int* derivativeIndices,
+                                                                const double* edgeLengths,
+                                                                int count);
+
+    virtual int updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                                      const int* probabilityIndices,
+                                                      const double* edgeLengths,
+                                                      int count,
+                                                      int replicateCount);
+
+    virtual int updatePartials(const int* operations,
+                               int operationCount,
+                               int cumulativeScalingIndex);
+
+    virtual int updatePartialsByPartition(const int* operations,
+                                          int operationCount);
+
+    virtual int setRootPrePartials(const int* bufferIndices,
+                                   const int* stateFrequenciesIndices,
+                                   int count);
+
+    virtual int updatePrePartials(const int* operations,
+                                  int operationCount,
+                                  int cumulativeScalingIndex);
+
+    virtual int waitForPartials(const int* destinationPartials,
+                                int destinationPartialsCount);
+
+    virtual int accumulateScaleFactors(const int* scalingIndices,
+                                       int count,
+                                       int cumulativeScalingIndex);
+
+    virtual int accumulateScaleFactorsByPartition(const int* scaleIndices,
+                                                  int count,
+                                                  int cumulativeScaleIndex,
+                                                  int partitionIndex);
+
+    virtual int removeScaleFactors(const int* scalingIndices,
+                                   int count,
+                                   int cumulativeScalingIndex);
+
+    virtual int removeScaleFactorsByPartition(const int* scaleIndices,
+                                              int count,
+                                              int cumulativeScaleIndex,
+                                              int partitionIndex);
+
+    virtual int resetScaleFactors(int cumulativeScalingIndex);
+
+    virtual int resetScaleFactorsByPartition(int cumulativeScaleIndex,
+                                             int partitionIndex);
+
+    virtual int copyScaleFactors(int destScalingIndex,
+                                 int srcScalingIndex);
+
+    virtual int getScaleFactors(int srcScalingIndex,
+                                double* scaleFactors);
+
+    virtual int calculateRootLogLikelihoods(const int* bufferIndices,
+                                            const int* categoryWeightsIndices,
+                                            const int* stateFrequenciesIndices,
+                                            const int* scalingFactorsIndices,
+                                            int count,
+                                            double* outSumLogLikelihood);
+
+    virtual int calculateRootLogLikelihoodsWithPatternWeights(const int* bufferIndices,
+                                                              const int* categoryWeightsIndices,
+                                                              const int* stateFrequenciesIndices,
+                                                              const int* cumulativeScaleIndices,
+                                                              int count,
+                                                              const double* inPatternWeights,
+                                                              int weightVectorCount,
+                                                              double* outSumLogLikelihoods);
+
+    virtual int calculateRootLogLikelihoodsForReplicates(int bufferIndex,
+                                                         int categoryWeightsIndex,
+                                                         const int* stateFrequenciesIndices,
+                                                         int cumulativeScaleIndex,
+                                                         int replicateCount,
+                                                         double* outSumLogLikelihoods);
+
+    virtual int calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
+                                                       const int* categoryWeightsIndices,
+                                                       const int* stateFrequenciesIndices,
+                                                       const int* cumulativeScaleIndices,
+                                                       const int* partitionIndices,
+                                                       int partitionCount,
+                                                       int count,
+                                                       double* outSumLogLikelihoodByPartition,
+                                                       double* outSumLogLikelihood);
+
+    virtual int updatePartialsAndCalculateRootLogLikelihood(const int* operations,
+                                                            int operationCount,
+                                                            int cumulativeScaleIndex,
+                                                            int categoryWeightsIndex,
+                                                            int stateFrequenciesIndex,
+                                                            bool writeRootPartials,
+                                                            double* outSumLogLikelihood);
+
+    virtual int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
+                                            const int* childBufferIndices,
+                                            const int* probabilityIndices,
+                                            const int* firstDerivativeIndices,
+                                            const int* secondDerivativeIndices,
+                                            const int* categoryWeightsIndices,
+                                            const int* stateFrequenciesIndices,
+                                            const int* scalingFactorsIndices,
+                                            int count,
+                                            double* outSumLogLikelihood,
+                                            double* outSumFirstDerivative,
+                                            double* outSumSecondDerivative);
+
+    virtual int calculateEdgeSiteLogLikelihoods(const int* parentBufferIndices,
+                                                const int* childBufferIndices,
+                                                const int* probabilityIndices,
+                                                const int* firstDerivativeIndices,
+                                                const int* secondDerivativeIndices,
+                                                const int* categoryWeightsIndices,
+                                                const int* stateFrequenciesIndices,
+                                                const int* cumulativeScaleIndices,
+                                                int count,
+                                                double* outSiteLogLikelihoods,
+                                                double* outSiteFirstDerivatives,
+                                                double* outSiteSecondDerivatives);
+
+    virtual int calculateEdgeLogLikelihoodsByPartition(const int* parentBufferIndices,
+                                                       const int* childBufferIndices,
+                                                       const int* probabilityIndices,
+                                                       const int* firstDerivativeIndices,
+                                                       const int* secondDerivativeIndices,
+                                                       const int* categoryWeightsIndices,
+                                                       const int* stateFrequenciesIndices,
+                                                       const int* cumulativeScaleIndices,
+                                                       const int* partitionIndices,
+                                                       int partitionCount,
+                                                       int count,
+                                                       double* outSumLogLikelihoodByPartition,
+                                                       double* outSumLogLikelihood,
+                                                       double* outSumFirstDerivativeByPartition,
+                                                       double* outSumFirstDerivative,
+                                                       double* outSumSecondDerivativeByPartition,
+                                                       double* outSumSecondDerivative);
+
+    virtual int calculateParameterDerivatives(const int* postBufferIndices,
+                                              const int* preBufferIndices,
+                                              const int* probabilityIndices,
+                                              const int* derivativeIndices,
+                                              const int* categoryWeightsIndices,
+                                              int count,
+                                              int parameterCount,
+                                              double* outSumDerivatives);
+
+    virtual int calculateEdgeDerivatives(const int* postBufferIndices,
+                                         const int* preBufferIndices,
+                                         const int* probabilityIndices,
+                                         const int* firstDerivativeIndices,
+                                         const int* categoryWeightsIndices,
+                                         int count,
+                                         double* outDerivatives,
+                                         double* outSumDerivatives);
+
+    virtual int calculateEdgeLogLikelihoodsForMatrices(int parentBufferIndex,
+                                                       int childBufferIndex,
+                                                       const int* probabilityIndices,
+                                                       const int* firstDerivativeIndices,
+                                                       const int* secondDerivativeIndices,
+                                                       int categoryWeightsIndex,
+                                                       int stateFrequenciesIndex,
+                                                       int cumulativeScaleIndex,
+                                                       int matrixCount,
+                                                       double* outSumLogLikelihoods,
+                                                       double* outSumFirstDerivatives,
+                                                       double* outSumSecondDerivatives);
+
+    virtual int getLogLikelihood(double* outSumLogLikelihood);
+
+    virtual int getDerivatives(double* outSumFirstDerivative,
+                               double* outSumSecondDerivative);
+
+    virtual int getSiteLogLikelihoods(double* outLogLikelihoods);
+
+    virtual int getSiteDerivatives(double* outFirstDerivatives,
+                                   double* outSecondDerivatives);
+
+    // splits the patterns again in proportion to the patterns per second each shard achieved
+    // since the instance was created or last rebalanced. Transition matrices and the data
+    // set through the setters carry over to the new shards; partials and scale factors that
+    // were computed do not, and events recorded before are forgotten.
+    virtual int rebalance();
+
+    // resets every shard and forgets the data and model setters kept for rebalance()
+    virtual int reset();
+
+    // grows every shard, the last one taking the new patterns, and forgets the data setters
+    // kept for rebalance()
+    virtual int grow(int tipCount,
+                     int partialsBufferCount,
+                     int compactBufferCount,
+                     int patternCount,
+                     int matrixBufferCount,
+                     int scaleBufferCount);
+
+protected:
+    // For an instance distributed over processes, each with the shards of one contiguous range
+    // of the patterns (see BeagleDistributedImpl): pattern-indexed arguments span all
+    // totalPatternCount patterns and the shards of this process start at patternOffset.
+    void setProcessPatterns(int patternOffset,
+                            int totalPatternCount);
+
+    // adds the values of the other processes to values[0, length)
+    virtual void combineSums(double* values,
+                             int length) {}
+
+    // fills in the patterns held by other processes, in vectorCount vectors that each hold
+    // elementSize values for every pattern
+    virtual void combinePatterns(double* values,
+                                 int vectorCount,
+                                 int elementSize) {}
+
+    // the return code of a call with results combined over processes, the same in all of them
+    virtual int combineReturnCode(int returnCode) { return returnCode; }
+
+private:
+    // runs call(shard) for every shard, the first on the calling thread and the others on
+    // the shard workers; returns the first error code in shard order
+    int forEachShard(const std::function<int(int)>& call);
+
+    // sums the per-shard values in shardValues[shard * length + j] into out[j], skipped for
+    // a NULL out
+    void sumShards(const std::vector<double>& shardValues,
+                   int length,
+                   double* out);
+
+    // keeps a setter call for rebalance() to make again on new shards, replacing the one kept
+    // under the same key
+    void keepSetter(const std::string& key,
+                    const std::function<int()>& setter);
+
+    void setShardOffsets();
+
+    // forgets the kept setters of data sized by the patterns or tips
+    void forgetDataSetters();
+
+    std::vector<BeagleImpl*> shards;
+    std::vector<int> shardPatternCounts;
+    std::vector<int> shardPatternOffsets;
+    int kShardCount;
+    int kPatternCount;
+    int kPatternOffset;
+    int kStateCount;
+    int kCategoryCount;
+
+    std::unique_ptr<cpu::ThreadPool> shardWorkers;
+
+    // seconds spent by each shard in its calls since the last rebalancing
+    std::vector<double> shardSeconds;
+
+    int kMatrixBufferCount;
+    int kEigenValueCount;
+    ShardFactory shardFactory;
+    TraceRecorder* trace;
+
+    // setter calls by key, with the order in which they were made
+    std::map<std::string, std::pair<long, std::function<int()> > > keptSetters;
+    long kSetterCount;
+    bool replayingSetters;
+};
+
+} // end namespace beagle
+
+#endif // __BeagleShardedImpl__
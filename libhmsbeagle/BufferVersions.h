@@ -0,0 +1,182 @@
+/*
+ *  BufferVersions.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BufferVersions__
+#define __BufferVersions__
+
+#include <vector>
+
+namespace beagle {
+
+/*
+ * Gives the partials (tip and internal), transition matrix and scale buffers a new version
+ * each time they are written, and remembers the operation and input versions that each
+ * partials buffer was last computed from, so that an operation that would compute the
+ * contents its destination already holds can be skipped. The owner touches a buffer when it
+ * is written by any means other than a partials operation.
+ */
+class BufferVersions {
+public:
+    BufferVersions(int partialsBufferCount,
+                   int matrixBufferCount,
+                   int scaleBufferCount) : clock(0),
+                                           partials(partialsBufferCount, 0),
+                                           matrices(matrixBufferCount, 0),
+                                           scales(scaleBufferCount, 0),
+                                           records(partialsBufferCount) {}
+
+    void touchPartials(int index) {
+        partials[index] = ++clock;
+    }
+
+    void touchMatrix(int index) {
+        matrices[index] = ++clock;
+    }
+
+    // indices outside the scale buffers, as in the automatic scaling modes, are ignored
+    void touchScaleBuffer(int index) {
+        if (index >= 0 && index < (int) scales.size())
+            scales[index] = ++clock;
+    }
+
+    // Touches every buffer, for writes that may change any of them
+    void touchAll() {
+        for (int i = 0; i < (int) partials.size(); i++)
+            touchPartials(i);
+        for (int i = 0; i < (int) matrices.size(); i++)
+            touchMatrix(i);
+        for (int i = 0; i < (int) scales.size(); i++)
+            touchScaleBuffer(i);
+    }
+
+    // Returns true if operation, laid out as in beagleUpdatePartials, would compute the
+    // contents its destination and write scale buffer already hold; otherwise gives these
+    // new versions and remembers what they were computed from
+    bool skipOperation(const int* operation) {
+        Record current(operation, *this);
+        Record& last = records[operation[0]];
+        if (last.valid && last == current)
+            return true;
+
+        touchOutputs(operation);
+        current.destinationVersion = partials[operation[0]];
+        current.writeScaleVersion = version(scales, operation[1]);
+        current.valid = true;
+        last = current;
+        return false;
+    }
+
+    // Gives the outputs of an operation that is run without being checked new versions;
+    // the leading integers of a partitioned operation are laid out the same
+    void touchOperation(const int* operation) {
+        touchOutputs(operation);
+        records[operation[0]].valid = false;
+    }
+
+    // Gives the outputs of an operation that is run without being checked new versions, and
+    // remembers what its destination was computed from
+    void recordOperation(const int* operation) {
+        Record current(operation, *this);
+        touchOutputs(operation);
+        current.destinationVersion = partials[operation[0]];
+        current.writeScaleVersion = version(scales, operation[1]);
+        current.valid = true;
+        records[operation[0]] = current;
+    }
+
+    // Returns the operation that last computed partials buffer index if neither the buffer
+    // nor anything the operation read or wrote has been written since, and NULL otherwise
+    const int* reproducibleOperation(int index) const {
+        const Record& last = records[index];
+        if (!last.valid || !(Record(last.indices, *this) == last))
+            return NULL;
+        return last.indices;
+    }
+
+private:
+    typedef unsigned long long Version;
+
+    static Version version(const std::vector<Version>& versions,
+                           int index) {
+        return (index < 0 || index >= (int) versions.size() ? 0 : versions[index]);
+    }
+
+    void touchOutputs(const int* operation) {
+        touchPartials(operation[0]);
+        touchScaleBuffer(operation[1]);
+    }
+
+    struct Record {
+        Record() : valid(false) {}
+
+        // the operation with the current versions of the buffers it reads and writes
+        Record(const int* operation,
+               const BufferVersions& owner) : valid(false) {
+            for (int i = 0; i < 7; i++)
+                indices[i] = operation[i];
+            child1Version = version(owner.partials, operation[3]);
+            matrix1Version = version(owner.matrices, operation[4]);
+            child2Version = version(owner.partials, operation[5]);
+            matrix2Version = version(owner.matrices, operation[6]);
+            readScaleVersion = version(owner.scales, operation[2]);
+            destinationVersion = owner.partials[operation[0]];
+            writeScaleVersion = version(owner.scales, operation[1]);
+        }
+
+        bool operator==(const Record& other) const {
+            for (int i = 0; i < 7; i++) {
+                if (indices[i] != other.indices[i])
+                    return false;
+            }
+            return (child1Version == other.child1Version &&
+                    matrix1Version == other.matrix1Version &&
+                    child2Version == other.child2Version &&
+                    matrix2Version == other.matrix2Version &&
+                    readScaleVersion == other.readScaleVersion &&
+                    destinationVersion == other.destinationVersion &&
+                    writeScaleVersion == other.writeScaleVersion);
+        }
+
+        int indices[7];
+        Version child1Version;
+        Version matrix1Version;
+        Version child2Version;
+        Version matrix2Version;
+        Version readScaleVersion;
+        Version destinationVersion;
+        Version writeScaleVersion;
+        bool valid;
+    };
+
+    Version clock;
+    std::vector<Version> partials;
+    std::vector<Version> matrices;
+    std::vector<Version> scales;
+
+    // what each partials buffer was last computed from
+    std::vector<Record> records;
+};
+
+} // end namespace beagle
+
+#endif // __BufferVersions__
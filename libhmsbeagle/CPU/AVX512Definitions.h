@@ -0,0 +1,137 @@
+/*
+ *  AVX512Definitions.h
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * @author Marc Suchard
+ */
+
+#ifndef __AVX512Definitions__
+#define __AVX512Definitions__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#define USE_AVX512
+
+#if defined(USE_AVX512)
+#	include <immintrin.h>
+#endif
+
+#ifdef HAVE_CPUID_H
+#	if !defined(DLS_MACOS)
+#		include <cpuid.h>
+#	endif
+#endif
+
+typedef double VecEl_t;
+
+#ifdef __GNUC__
+#define ALIGN32 __attribute__((aligned(32)))
+#define ALIGN64 __attribute__((aligned(64)))
+#else
+#define ALIGN32 __declspec(align(32))
+#define ALIGN64 __declspec(align(64))
+#endif
+
+#define USE_DOUBLE_PREC
+#if defined(USE_DOUBLE_PREC)
+	typedef double RealType;
+	typedef __m512d	V_Real;
+	typedef __m256d	V_Half;
+#	define REALS_PER_VEC	8	/* number of elements per vector */
+#	define VEC_LOAD(a)			_mm512_loadu_pd(a)
+#	define VEC_MASK_LOAD(m, a)	_mm512_maskz_loadu_pd((m), (a))
+#	define VEC_STORE(a, b)		_mm512_storeu_pd((a), (b))
+#	define VEC_MASK_STORE(a, m, b)	_mm512_mask_storeu_pd((a), (m), (b))
+#	define VEC_MULT(a, b)		_mm512_mul_pd((a), (b))
+#	define VEC_DIV(a, b)		_mm512_div_pd((a), (b))
+#	define VEC_MADD(a, b, c)	_mm512_fmadd_pd((a), (b), (c))
+#	define VEC_SPLAT(a)			_mm512_set1_pd(a)
+#	define VEC_ADD(a, b)		_mm512_add_pd(a, b)
+# 	define VEC_SETZERO()		_mm512_setzero_pd()
+/* Broadcasts element i of each 256-bit half across that half */
+#	define VEC_SPLAT_HALF(a, i)	_mm512_permutex_pd((a), _MM_SHUFFLE(i, i, i, i))
+/* Joins two 256-bit vectors into the low and high half */
+#	define VEC_SET_HALVES(a, b)	_mm512_insertf64x4(_mm512_castpd256_pd512(a), (b), 1)
+#	define VEC_DUP_HALF(a)		_mm512_broadcast_f64x4(a)
+#	define HALF_LOAD(a)			_mm256_load_pd(a)
+#	define HALF_SPLAT(a)		_mm256_set1_pd(a)
+#endif
+
+/*
+ * Kernels between BEAGLE_AVX512_TARGET_BEGIN and BEAGLE_AVX512_TARGET_END are
+ * compiled for AVX-512 even when the translation unit is not, so that the
+ * templates shared with the baseline implementations keep baseline code.
+ */
+#if defined(__AVX512F__)
+#	define BEAGLE_AVX512_TARGET_BEGIN
+#	define BEAGLE_AVX512_TARGET_END
+#elif defined(__clang__)
+#	define BEAGLE_AVX512_TARGET_BEGIN	_Pragma("clang attribute push (__attribute__((target(\"avx512f\"))), apply_to = function)")
+#	define BEAGLE_AVX512_TARGET_END	_Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+#	define BEAGLE_AVX512_TARGET_BEGIN	_Pragma("GCC push_options") _Pragma("GCC target(\"avx512f\")")
+#	define BEAGLE_AVX512_TARGET_END	_Pragma("GCC pop_options")
+#else
+#	define BEAGLE_AVX512_TARGET_BEGIN
+#	define BEAGLE_AVX512_TARGET_END
+#endif
+
+/* Masks of the lanes of partial vectors */
+#define VEC_MASK_ALL	((__mmask8) 0xFF)
+#define VEC_MASK_LOW	((__mmask8) 0x0F)
+#define VEC_MASK_FIRST(n)	((__mmask8) ((n) >= REALS_PER_VEC ? 0xFF : (1 << (n)) - 1))
+
+/*
+ * The plugin may be loaded on hosts without AVX-512, so the instructions
+ * and the operating system support for the 512-bit register state are
+ * checked at run time.
+ */
+inline int CPUSupportsAVX512() {
+#if defined(__GNUC__) && defined(HAVE_CPUID_H) && !defined(DLS_MACOS)
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+
+    // OSXSAVE, i.e. XGETBV is available
+    if (!(ecx & (1 << 27)))
+        return 0;
+
+    // XMM, YMM, opmask and both halves of the ZMM state enabled by the OS
+    unsigned int xcr0, xcr0High;
+    __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0High) : "c" (0));
+    if ((xcr0 & 0xE6) != 0xE6)
+        return 0;
+
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+
+    // AVX512F
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 16)) != 0;
+#else
+    return 0;
+#endif
+}
+
+#endif // __AVX512Definitions__
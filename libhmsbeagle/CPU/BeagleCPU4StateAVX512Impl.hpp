@@ -0,0 +1,584 @@
+/*
+ *  BeagleCPU4StateAVX512Impl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * @author Marc Suchard
+ */
+
+#ifndef BEAGLE_CPU_4STATE_AVX512_IMPL_HPP
+#define BEAGLE_CPU_4STATE_AVX512_IMPL_HPP
+
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateAVX512Impl.h"
+#include "libhmsbeagle/CPU/AVX512Definitions.h"
+
+/* Loads the columns of a finite-time transition matrix, dest_m[j] holds the
+   transition probabilities from each parent state into child state j */
+#define AVX512_PREFETCH_MATRIX(src_m, dest_m) \
+	for (int i = 0; i < OFFSET; i++) { \
+		dest_m[i][0] = (src_m)[0*OFFSET + i]; \
+		dest_m[i][1] = (src_m)[1*OFFSET + i]; \
+		dest_m[i][2] = (src_m)[2*OFFSET + i]; \
+		dest_m[i][3] = (src_m)[3*OFFSET + i]; \
+	}
+
+/* Copies the columns of the observed child states into both halves of a vector */
+#define AVX512_EXPAND_MATRIX(src_m, dest_vm) \
+	dest_vm##0 = VEC_DUP_HALF(HALF_LOAD(src_m[0])); \
+	dest_vm##1 = VEC_DUP_HALF(HALF_LOAD(src_m[1])); \
+	dest_vm##2 = VEC_DUP_HALF(HALF_LOAD(src_m[2])); \
+	dest_vm##3 = VEC_DUP_HALF(HALF_LOAD(src_m[3]));
+
+/* Multiplies the partials of two patterns by the transition matrix */
+#define AVX512_INTEGRATE_PARTIALS(dest, vm, vp) \
+	dest = VEC_MULT(VEC_SPLAT_HALF(vp, 0), vm##0); \
+	dest = VEC_MADD(VEC_SPLAT_HALF(vp, 1), vm##1, dest); \
+	dest = VEC_MADD(VEC_SPLAT_HALF(vp, 2), vm##2, dest); \
+	dest = VEC_MADD(VEC_SPLAT_HALF(vp, 3), vm##3, dest);
+
+/* Column of the observed states of two patterns, the second one may be past the end */
+#define AVX512_STATES_COLUMN(src_m, states, k, endPattern) \
+	VEC_SET_HALVES(HALF_LOAD(src_m[states[k]]), \
+	               HALF_LOAD(src_m[states[(k) + 1 < (endPattern) ? (k) + 1 : (k)]]))
+
+/* Reciprocal scale factors of two patterns */
+#define AVX512_SCALE_FACTORS(scaleFactors, k, endPattern) \
+	VEC_SET_HALVES(HALF_SPLAT(1.0/scaleFactors[k]), \
+	               HALF_SPLAT(1.0/scaleFactors[(k) + 1 < (endPattern) ? (k) + 1 : (k)]))
+
+/* Only the low half belongs to the patterns when one is left over */
+#define AVX512_PATTERNS_MASK(k, endPattern) \
+	((k) + 1 < (endPattern) ? VEC_MASK_ALL : VEC_MASK_LOW)
+
+namespace beagle {
+namespace cpu {
+
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPU4StateAVX512Name(){ return "CPU-4State-AVX512-Unknown"; };
+
+template<>
+inline const char* getBeagleCPU4StateAVX512Name<double>(){ return "CPU-4State-AVX512-Double"; };
+
+template<>
+inline const char* getBeagleCPU4StateAVX512Name<float>(){ return "CPU-4State-AVX512-Single"; };
+
+BEAGLE_AVX512_TARGET_BEGIN
+
+/*
+ * Calculates partial likelihoods at a node when both children have states.
+ */
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcStatesStates(double* destP,
+                                                                             const int* states_q,
+                                                                             const double* matrices_q,
+                                                                             const int* states_r,
+                                                                             const double* matrices_r,
+                                                                             int startPattern,
+                                                                             int endPattern) {
+
+    ALIGN32 double vu_mq[OFFSET][4], vu_mr[OFFSET][4];
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        AVX512_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vu_mq);
+        AVX512_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vu_mr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k += 2) {
+            const __mmask8 mask = AVX512_PATTERNS_MASK(k, endPattern);
+
+            V_Real vmq = AVX512_STATES_COLUMN(vu_mq, states_q, k, endPattern);
+            V_Real vmr = AVX512_STATES_COLUMN(vu_mr, states_r, k, endPattern);
+
+            VEC_MASK_STORE(destP + v, mask, VEC_MULT(vmq, vmr));
+
+            v += 8;
+        }
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when one child has states and one has partials.
+   AVX-512 version
+ */
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcStatesPartials(double* destP,
+                                                                               const int* states_q,
+                                                                               const double* matrices_q,
+                                                                               const double* partials_r,
+                                                                               const double* matrices_r,
+                                                                               int startPattern,
+                                                                               int endPattern) {
+
+    ALIGN32 double vu_mq[OFFSET][4], vu_mr[OFFSET][4];
+    V_Real vmr0, vmr1, vmr2, vmr3;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        AVX512_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vu_mq);
+        AVX512_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vu_mr);
+        AVX512_EXPAND_MATRIX(vu_mr, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k += 2) {
+            const __mmask8 mask = AVX512_PATTERNS_MASK(k, endPattern);
+
+            V_Real vpr = VEC_MASK_LOAD(mask, partials_r + v);
+            V_Real destr;
+            AVX512_INTEGRATE_PARTIALS(destr, vmr, vpr);
+
+            V_Real vmq = AVX512_STATES_COLUMN(vu_mq, states_q, k, endPattern);
+
+            VEC_MASK_STORE(destP + v, mask, VEC_MULT(vmq, destr));
+
+            v += 8;
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
+                                                                                           const int* states_q,
+                                                                                           const double* __restrict matrices_q,
+                                                                                           const double* __restrict partials_r,
+                                                                                           const double* __restrict matrices_r,
+                                                                                           const double* __restrict scaleFactors,
+                                                                                           int startPattern,
+                                                                                           int endPattern) {
+
+    ALIGN32 double vu_mq[OFFSET][4], vu_mr[OFFSET][4];
+    V_Real vmr0, vmr1, vmr2, vmr3;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        AVX512_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vu_mq);
+        AVX512_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vu_mr);
+        AVX512_EXPAND_MATRIX(vu_mr, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k += 2) {
+            const __mmask8 mask = AVX512_PATTERNS_MASK(k, endPattern);
+
+            const V_Real scaleFactor = AVX512_SCALE_FACTORS(scaleFactors, k, endPattern);
+
+            V_Real vpr = VEC_MASK_LOAD(mask, partials_r + v);
+            V_Real destr;
+            AVX512_INTEGRATE_PARTIALS(destr, vmr, vpr);
+
+            V_Real vmq = AVX512_STATES_COLUMN(vu_mq, states_q, k, endPattern);
+
+            VEC_MASK_STORE(destP + v, mask, VEC_MULT(VEC_MULT(vmq, destr), scaleFactor));
+
+            v += 8;
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcPartialsPartials(double* destP,
+                                                                                 const double*  partials_q,
+                                                                                 const double*  matrices_q,
+                                                                                 const double*  partials_r,
+                                                                                 const double*  matrices_r,
+                                                                                 int startPattern,
+                                                                                 int endPattern) {
+
+    ALIGN32 double vu_mq[OFFSET][4], vu_mr[OFFSET][4];
+    V_Real vmq0, vmq1, vmq2, vmq3;
+    V_Real vmr0, vmr1, vmr2, vmr3;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+		/* Load transition-probability matrices into vectors */
+        AVX512_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vu_mq);
+        AVX512_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vu_mr);
+        AVX512_EXPAND_MATRIX(vu_mq, vmq);
+        AVX512_EXPAND_MATRIX(vu_mr, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const __mmask8 mask = AVX512_PATTERNS_MASK(k, endPattern);
+
+            V_Real vpq = VEC_MASK_LOAD(mask, partials_q + v);
+            V_Real vpr = VEC_MASK_LOAD(mask, partials_r + v);
+
+            V_Real destq, destr;
+            AVX512_INTEGRATE_PARTIALS(destq, vmq, vpq);
+            AVX512_INTEGRATE_PARTIALS(destr, vmr, vpr);
+
+            VEC_MASK_STORE(destP + v, mask, VEC_MULT(destq, destr));
+
+            v += 8;
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcPartialsPartialsFixedScaling(double* destP,
+                                                                                             const double* partials_q,
+                                                                                             const double* matrices_q,
+                                                                                             const double* partials_r,
+                                                                                             const double* matrices_r,
+                                                                                             const double* scaleFactors,
+                                                                                             int startPattern,
+                                                                                             int endPattern) {
+
+    ALIGN32 double vu_mq[OFFSET][4], vu_mr[OFFSET][4];
+    V_Real vmq0, vmq1, vmq2, vmq3;
+    V_Real vmr0, vmr1, vmr2, vmr3;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+		/* Load transition-probability matrices into vectors */
+        AVX512_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vu_mq);
+        AVX512_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vu_mr);
+        AVX512_EXPAND_MATRIX(vu_mq, vmq);
+        AVX512_EXPAND_MATRIX(vu_mr, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const __mmask8 mask = AVX512_PATTERNS_MASK(k, endPattern);
+
+            const V_Real scaleFactor = AVX512_SCALE_FACTORS(scaleFactors, k, endPattern);
+
+            V_Real vpq = VEC_MASK_LOAD(mask, partials_q + v);
+            V_Real vpr = VEC_MASK_LOAD(mask, partials_r + v);
+
+            V_Real destq, destr;
+            AVX512_INTEGRATE_PARTIALS(destq, vmq, vpq);
+            AVX512_INTEGRATE_PARTIALS(destr, vmr, vpr);
+
+            VEC_MASK_STORE(destP + v, mask, VEC_MULT(VEC_MULT(destq, destr), scaleFactor));
+
+            v += 8;
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::integrateEdge(const int parIndex,
+                                                                          const int childIndex,
+                                                                          const int probIndex,
+                                                                          const int categoryWeightsIndex,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+
+    assert(parIndex >= kTipCount);
+
+    const double* cl_r = gPartials[parIndex];
+    double* cl_p = integrationTmp;
+    const double* transMatrix = gTransitionMatrices[probIndex];
+    const double* wt = gCategoryWeights[categoryWeightsIndex];
+
+    memset(&cl_p[startPattern*4], 0, ((endPattern - startPattern) * 4)*sizeof(double));
+
+    ALIGN32 double vu_m[OFFSET][4];
+    V_Real vm0, vm1, vm2, vm3;
+
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+
+        const int* statesChild = getTipStates(childIndex);
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            AVX512_PREFETCH_MATRIX(transMatrix + l*4*OFFSET, vu_m);
+
+            const V_Real vwt = VEC_SPLAT(wt[l]);
+
+            int u = startPattern * 4;
+            int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+            for (int k = startPattern; k < endPattern; k += 2) {
+                const __mmask8 mask = AVX512_PATTERNS_MASK(k, endPattern);
+
+                V_Real wtdPartials = VEC_MULT(VEC_MASK_LOAD(mask, cl_r + v), vwt);
+                V_Real vcl_p = VEC_MASK_LOAD(mask, cl_p + u);
+                vcl_p = VEC_MADD(AVX512_STATES_COLUMN(vu_m, statesChild, k, endPattern), wtdPartials, vcl_p);
+                VEC_MASK_STORE(cl_p + u, mask, vcl_p);
+
+                u += 8;
+                v += 8;
+            }
+        }
+    } else { // Integrate against a partial at the child
+
+        const double* cl_q = gPartials[childIndex];
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            AVX512_PREFETCH_MATRIX(transMatrix + l*4*OFFSET, vu_m);
+            AVX512_EXPAND_MATRIX(vu_m, vm);
+
+            const V_Real vwt = VEC_SPLAT(wt[l]);
+
+            int u = startPattern * 4;
+            int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+            for (int k = startPattern; k < endPattern; k += 2) {
+                const __mmask8 mask = AVX512_PATTERNS_MASK(k, endPattern);
+
+                V_Real vcl_q = VEC_MASK_LOAD(mask, cl_q + v);
+                V_Real vclp;
+                AVX512_INTEGRATE_PARTIALS(vclp, vm, vcl_q);
+                vclp = VEC_MULT(vclp, vwt);
+
+                V_Real vcl_p = VEC_MASK_LOAD(mask, cl_p + u);
+                vcl_p = VEC_MADD(vclp, VEC_MASK_LOAD(mask, cl_r + v), vcl_p);
+                VEC_MASK_STORE(cl_p + u, mask, vcl_p);
+
+                u += 8;
+                v += 8;
+            }
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcEdgeSiteLogLikelihoods(const int stateFrequenciesIndex,
+                                                                                       const int scalingFactorsIndex,
+                                                                                       int startPattern,
+                                                                                       int endPattern) {
+
+    const double* cl_p = integrationTmp;
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    int u = startPattern * 4;
+    for(int k = startPattern; k < endPattern; k++) {
+        double sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * cl_p[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = sumOverI;
+    }
+    vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=startPattern; k < endPattern; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+int BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                                  const int childIndex,
+                                                                                  const int probIndex,
+                                                                                  const int categoryWeightsIndex,
+                                                                                  const int stateFrequenciesIndex,
+                                                                                  const int scalingFactorsIndex,
+                                                                                  double* outSumLogLikelihood) {
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    integrateEdge(parIndex, childIndex, probIndex, categoryWeightsIndex, 0, kPatternCount);
+
+    calcEdgeSiteLogLikelihoods(stateFrequenciesIndex, scalingFactorsIndex, 0, kPatternCount);
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcEdgeLogLikelihoodsByPartition(
+                                                  const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition) {
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        integrateEdge(parentBufferIndices[p], childBufferIndices[p], probabilityIndices[p],
+                      categoryWeightsIndices[p], startPattern, endPattern);
+
+        calcEdgeSiteLogLikelihoods(stateFrequenciesIndices[p], cumulativeScaleIndices[p],
+                                   startPattern, endPattern);
+
+        outSumLogLikelihoodByPartition[p] = 0.0;
+        for (int i = startPattern; i < endPattern; i++) {
+            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+int BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::getPaddedPatternsModulus() {
+	return 1;  // Pairs of patterns are formed within a pattern range, left-over patterns are masked
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+const char* BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::getName() {
+    return  getBeagleCPU4StateAVX512Name<double>();
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+const long BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::getFlags() {
+    return  BEAGLE_FLAG_COMPUTATION_SYNCH |
+            BEAGLE_FLAG_PROCESSOR_CPU |
+            BEAGLE_FLAG_PRECISION_DOUBLE |
+            BEAGLE_FLAG_VECTOR_AVX512 |
+            BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+BEAGLE_AVX512_TARGET_END
+
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPU4StateAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    if (stateCount != 4) {
+        return NULL;
+    }
+
+    if (!CPUSupportsAVX512())
+        return NULL;
+
+    BeagleCPU4StateAVX512Impl<REALTYPE, T_PAD_4_AVX512_DEFAULT, P_PAD_4_AVX512_DEFAULT>* impl =
+    		new BeagleCPU4StateAVX512Impl<REALTYPE, T_PAD_4_AVX512_DEFAULT, P_PAD_4_AVX512_DEFAULT>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPU4StateAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                                 int partialsBufferCount,
+                                                                                 int compactBufferCount,
+                                                                                 int stateCount,
+                                                                                 int patternCount,
+                                                                                 int eigenBufferCount,
+                                                                                 int matrixBufferCount,
+                                                                                 int categoryCount,
+                                                                                 int scaleBufferCount,
+                                                                                 long preferenceFlags,
+                                                                                 long requirementFlags,
+                                                                                 long long* outHostBytes,
+                                                                                 long long* outDeviceBytes) {
+    if (stateCount != 4 || !CPUSupportsAVX512())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    *outHostBytes = BeagleCPU4StateAVX512Impl<REALTYPE, T_PAD_4_AVX512_DEFAULT, P_PAD_4_AVX512_DEFAULT>::getInstanceBytes(
+                        tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                        scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPU4StateAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+	return getBeagleCPU4StateAVX512Name<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+template <>
+const long BeagleCPU4StateAVX512ImplFactory<double>::getFlags() {
+    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+           BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_FLAG_PROCESSOR_CPU |
+           BEAGLE_FLAG_VECTOR_AVX512 |
+           BEAGLE_FLAG_PRECISION_DOUBLE |
+           BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+           BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL|
+           BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+           BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+
+}
+}
+
+#endif //BEAGLE_CPU_4STATE_AVX512_IMPL_HPP
@@ -63,6 +63,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gCategoryWeights;
@@ -144,6 +146,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gCategoryWeights;
@@ -232,6 +236,20 @@ public:
 
     virtual const char* getName();
     virtual const long getFlags();
+
+    virtual int estimateMemory(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long long* outHostBytes,
+                               long long* outDeviceBytes);
 };
 
 }	// namespace cpu
@@ -579,9 +579,9 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(double));
 
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const int* statesChild = getTipStates(childIndex);
 
         int w = 0;
         V_Real *vcl_r = (V_Real *)cl_r;
@@ -660,8 +660,9 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        outLogLikelihoodsTmp[k] = sumOverI;
     }
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
 
 
     if (scalingFactorsIndex != BEAGLE_OP_NONE) {
@@ -775,6 +776,31 @@ BeagleImpl* BeagleCPU4StateAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImp
     return NULL;
 }
 
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPU4StateAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                              int partialsBufferCount,
+                                                                              int compactBufferCount,
+                                                                              int stateCount,
+                                                                              int patternCount,
+                                                                              int eigenBufferCount,
+                                                                              int matrixBufferCount,
+                                                                              int categoryCount,
+                                                                              int scaleBufferCount,
+                                                                              long preferenceFlags,
+                                                                              long requirementFlags,
+                                                                              long long* outHostBytes,
+                                                                              long long* outDeviceBytes) {
+    if (stateCount != 4 || !CPUSupportsAVX())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    *outHostBytes = BeagleCPU4StateAVXImpl<REALTYPE, T_PAD_4_AVX_DEFAULT, P_PAD_4_AVX_DEFAULT>::getInstanceBytes(
+                        tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                        scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 const char* BeagleCPU4StateAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 	return getBeagleCPU4StateAVXName<BEAGLE_CPU_FACTORY_GENERIC>();
@@ -56,12 +56,16 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::hasTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternScaleFactor;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kCategoryCount;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gScaleBuffers;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gStateFrequencies;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gCategoryWeights;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternWeights;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumSiteLogLikelihoods;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::realtypeMin;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::scalingExponentThreshold;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternPartitionsStartPatterns;
@@ -109,6 +113,12 @@ public:
                                                   int partitionCount,
                                                   double* outSumLogLikelihoodByPartition);
     
+    virtual void integrateRootPartials(const REALTYPE* rootPartials,
+                                       const REALTYPE* wt,
+                                       const REALTYPE* freqs,
+                                       int startPattern,
+                                       int endPattern);
+
     virtual int calcRootLogLikelihoodsMulti(const int* bufferIndices,
                                              const int* categoryWeightsIndices,
                                              const int* stateFrequenciesIndices,
@@ -181,16 +191,16 @@ public:
                                                      int partitionCount,
                                                      double* outSumLogLikelihoodByPartition);
 
-    virtual void rescalePartials(REALTYPE *destP,
+    virtual bool rescalePartials(REALTYPE *destP,
     		                     REALTYPE *scaleFactors,
                                  REALTYPE *cumulativeScaleFactors,
                                  const int  fillWithOnes);
 
-    virtual void rescalePartialsByPartition(REALTYPE *destP,
-                                            REALTYPE *scaleFactors,
-                                            REALTYPE *cumulativeScaleFactors,
-                                            const int fillWithOnes,
-                                            const int partitionIndex);
+    virtual void rescalePartialsRange(REALTYPE *destP,
+                                      REALTYPE *scaleFactors,
+                                      REALTYPE *cumulativeScaleFactors,
+                                      int startPattern,
+                                      int endPattern);
 
 
 };
@@ -215,6 +225,20 @@ public:
 
     virtual const char* getName();
     virtual const long getFlags();
+
+    virtual int estimateMemory(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long long* outHostBytes,
+                               long long* outDeviceBytes);
 };
 
 }	// namespace cpu
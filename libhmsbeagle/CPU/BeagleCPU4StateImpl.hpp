@@ -80,26 +80,26 @@
     p##num##2 = partials[v + 2]; \
     p##num##3 = partials[v + 3];
 
-//#define DO_INTEGRATION(num) \
-//    REALTYPE sum##num##0, sum##num##1, sum##num##2, sum##num##3; \
-//    sum##num##0  = m##num##00 * p##num##0; \
-//    sum##num##1  = m##num##10 * p##num##0; \
-//    sum##num##2  = m##num##20 * p##num##0; \
-//    sum##num##3  = m##num##30 * p##num##0; \
-// \
-//    sum##num##0 += m##num##01 * p##num##1; \
-//    sum##num##1 += m##num##11 * p##num##1; \
-//    sum##num##2 += m##num##21 * p##num##1; \
-//    sum##num##3 += m##num##31 * p##num##1; \
-// \
-//    sum##num##0 += m##num##02 * p##num##2; \
-//    sum##num##1 += m##num##12 * p##num##2; \
-//    sum##num##2 += m##num##22 * p##num##2; \
-//    sum##num##3 += m##num##32 * p##num##2; \
-// \
-//    sum##num##0 += m##num##03 * p##num##3; \
-//    sum##num##1 += m##num##13 * p##num##3; \
-//    sum##num##2 += m##num##23 * p##num##3; \
+//#define DO_INTEGRATION(num)
+//    REALTYPE sum##num##0, sum##num##1, sum##num##2, sum##num##3;
+//    sum##num##0  = m##num##00 * p##num##0;
+//    sum##num##1  = m##num##10 * p##num##0;
+//    sum##num##2  = m##num##20 * p##num##0;
+//    sum##num##3  = m##num##30 * p##num##0;
+//
+//    sum##num##0 += m##num##01 * p##num##1;
+//    sum##num##1 += m##num##11 * p##num##1;
+//    sum##num##2 += m##num##21 * p##num##1;
+//    sum##num##3 += m##num##31 * p##num##1;
+//
+//    sum##num##0 += m##num##02 * p##num##2;
+//    sum##num##1 += m##num##12 * p##num##2;
+//    sum##num##2 += m##num##22 * p##num##2;
+//    sum##num##3 += m##num##32 * p##num##2;
+//
+//    sum##num##0 += m##num##03 * p##num##3;
+//    sum##num##1 += m##num##13 * p##num##3;
+//    sum##num##2 += m##num##23 * p##num##3;
 //    sum##num##3 += m##num##33 * p##num##3;
 
 #define DO_INTEGRATION(num) \
@@ -467,20 +467,12 @@ int inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScale(c
         
         u += 4;
                         
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        outLogLikelihoodsTmp[k] = sumOverI;
     }        
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++) {
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-        }
-    }
     
-    *outSumLogLikelihood = 0.0;    
-    for(int k=0; k < kPatternCount; k++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
-    }    
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
     
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
@@ -522,20 +514,13 @@ void inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScaleB
           
           u += 4;
                           
-          outLogLikelihoodsTmp[k] = log(sumOverI);
+          outLogLikelihoodsTmp[k] = sumOverI;
       }        
+      vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
 
-      if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-          const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-          for(int k=startPattern; k < endPattern; k++) {
-              outLogLikelihoodsTmp[k] += scalingFactors[k];
-          }
-      }
          
-      outSumLogLikelihoodByPartition[p] = 0.0;
-      for(int k=startPattern; k < endPattern; k++) {
-          outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[k] * gPatternWeights[k];
-      }
+      outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(scalingFactorsIndex,
+                                                                startPattern, endPattern);
     }
     
 }
@@ -546,13 +531,12 @@ void inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScaleB
  * Re-scales the partial likelihoods such that the largest is one.
  */
 BEAGLE_CPU_TEMPLATE
-void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
+bool BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
 		REALTYPE* scaleFactors,
 		REALTYPE* cumulativeScaleFactors,
         const int  fillWithOnes) {
 
-	bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
-
+    bool rescaled = false;
     for (int k = 0; k < kPatternCount; k++) {
     	REALTYPE max = 0;    	
         const int patternOffset = k * 4;
@@ -577,40 +561,26 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
         if (max == 0)
             max = REALTYPE(1.0);
 
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
+        REALTYPE oneOverMax = setPatternScaleFactor(max, k, scaleFactors, cumulativeScaleFactors);
+        if (oneOverMax == REALTYPE(1.0))
+            continue;
+        rescaled = true;
         for (int l = 0; l < kCategoryCount; l++) {
             int offset = l * kPaddedPatternCount * 4 + patternOffset;
 			#pragma unroll
             for (int i = 0; i < 4; i++)
                 destP[offset++] *= oneOverMax;
         }
-
-        if (useLogScalars) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
     }
+    return rescaled;
 }
 
 BEAGLE_CPU_TEMPLATE
-void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(
-                                                                    REALTYPE* destP,
-                                                                    REALTYPE* scaleFactors,
-                                                                    REALTYPE* cumulativeScaleFactors,
-                                                                    const int fillWithOnes,
-                                                                    const int partitionIndex) {
-
-    bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
-
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
-
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartialsRange(REALTYPE* destP,
+                                                                   REALTYPE* scaleFactors,
+                                                                   REALTYPE* cumulativeScaleFactors,
+                                                                   int startPattern,
+                                                                   int endPattern) {
     for (int k = startPattern; k < endPattern; k++) {
       REALTYPE max = 0;     
         const int patternOffset = k * 4;
@@ -635,24 +605,13 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(
         if (max == 0)
             max = REALTYPE(1.0);
 
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
+        REALTYPE oneOverMax = setPatternScaleFactor(max, k, scaleFactors, cumulativeScaleFactors);
         for (int l = 0; l < kCategoryCount; l++) {
             int offset = l * kPaddedPatternCount * 4 + patternOffset;
       #pragma unroll
             for (int i = 0; i < 4; i++)
                 destP[offset++] *= oneOverMax;
         }
-
-        if (useLogScalars) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
     }
 }
 
@@ -676,9 +635,9 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int pa
     
     memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
     
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
       
-        const int* statesChild = gTipStates[childIndex];    
+        const int* statesChild = getTipStates(childIndex);    
         int v = 0; // Index for parent partials
         int w = 0;
         for(int l = 0; l < kCategoryCount; l++) {
@@ -775,9 +734,9 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
         const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
         const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
         
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
           
-            const int* statesChild = gTipStates[childIndex];    
+            const int* statesChild = getTipStates(childIndex);    
             int v = startPattern * 4; // Index for parent partials
             int w = 0;
             for(int l = 0; l < kCategoryCount; l++) {
@@ -932,6 +891,40 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
     integrateOutStatesAndScaleByPartition(integrationTmp, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateRootPartials(const REALTYPE* rootPartials,
+                                                                    const REALTYPE* wt,
+                                                                    const REALTYPE* freqs,
+                                                                    int startPattern,
+                                                                    int endPattern) {
+
+    const int categoryStride = 4 * (kPatternCount + kExtraPatterns);
+    const REALTYPE freq0 = freqs[0];
+    const REALTYPE freq1 = freqs[1];
+    const REALTYPE freq2 = freqs[2];
+    const REALTYPE freq3 = freqs[3];
+
+    for (int k = startPattern; k < endPattern; k++) {
+        const REALTYPE* partials = &rootPartials[4 * k];
+        const REALTYPE wt0 = wt[0];
+        REALTYPE sum0 = partials[0] * wt0;
+        REALTYPE sum1 = partials[1] * wt0;
+        REALTYPE sum2 = partials[2] * wt0;
+        REALTYPE sum3 = partials[3] * wt0;
+        for (int l = 1; l < kCategoryCount; l++) {
+            partials += categoryStride;
+            const REALTYPE wtl = wt[l];
+            sum0 += partials[0] * wtl;
+            sum1 += partials[1] * wtl;
+            sum2 += partials[2] * wtl;
+            sum3 += partials[3] * wtl;
+        }
+
+        outLogLikelihoodsTmp[k] = freq0 * sum0 + freq1 * sum1 + freq2 * sum2 + freq3 * sum3;
+    }
+    vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bufferIndices,
                                                                 const int* categoryWeightsIndices,
@@ -1028,11 +1021,13 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const i
             } else if (subsetIndex == count - 1) {
                 REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sum;
                 
-                outLogLikelihoodsTmp[k] = log(tmpSum);
+                outLogLikelihoodsTmp[k] = tmpSum;
             } else {
                 outLogLikelihoodsTmp[k] += sum;
             }
         }
+        if (subsetIndex == count - 1)
+            vectorLog(outLogLikelihoodsTmp, kPatternCount);
     }
     
     if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
@@ -1040,10 +1035,7 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const i
             outLogLikelihoodsTmp[i] += maxScaleFactor[i];
     }
     
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    *outSumLogLikelihood = sumSiteLogLikelihoods(BEAGLE_OP_NONE, 0, kPatternCount);
     
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
@@ -1102,6 +1094,31 @@ BeagleImpl* BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(i
     return NULL;
 }
 
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                           int partialsBufferCount,
+                                                                           int compactBufferCount,
+                                                                           int stateCount,
+                                                                           int patternCount,
+                                                                           int eigenBufferCount,
+                                                                           int matrixBufferCount,
+                                                                           int categoryCount,
+                                                                           int scaleBufferCount,
+                                                                           long preferenceFlags,
+                                                                           long requirementFlags,
+                                                                           long long* outHostBytes,
+                                                                           long long* outDeviceBytes) {
+    if (stateCount != 4)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    *outHostBytes = BeagleCPU4StateImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT>::getInstanceBytes(
+                        tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                        scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 const char* BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 	return getBeagleCPU4StateName<BEAGLE_CPU_FACTORY_GENERIC>();
@@ -1111,7 +1128,7 @@ BEAGLE_CPU_FACTORY_TEMPLATE
 const long BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
     long flags =  BEAGLE_FLAG_COMPUTATION_SYNCH |
                   BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-                  BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                  BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_CPU_OPENMP_THREADING_FLAG |
                   BEAGLE_FLAG_PROCESSOR_CPU |
                   BEAGLE_FLAG_VECTOR_NONE |
                   BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
@@ -0,0 +1,542 @@
+/*
+ *  BeagleCPU4StateNEONImpl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * @author Marc Suchard
+ */
+
+#ifndef BEAGLE_CPU_4STATE_NEON_IMPL_HPP
+#define BEAGLE_CPU_4STATE_NEON_IMPL_HPP
+
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateNEONImpl.h"
+#include "libhmsbeagle/CPU/NEONDefinitions.h"
+
+/* Loads the columns of a finite-time transition matrix into NEON vectors,
+   dest_vm[j][0] and dest_vm[j][1] hold the transition probabilities from
+   parent states 0,1 and 2,3 into child state j */
+#define NEON_PREFETCH_MATRIX(src_m, dest_vm) \
+	for (int i = 0; i < OFFSET; i++) { \
+		ALIGN16 double column[4]; \
+		column[0] = (src_m)[0*OFFSET + i]; \
+		column[1] = (src_m)[1*OFFSET + i]; \
+		column[2] = (src_m)[2*OFFSET + i]; \
+		column[3] = (src_m)[3*OFFSET + i]; \
+		dest_vm[i][0] = VEC_LOAD(column + 0); \
+		dest_vm[i][1] = VEC_LOAD(column + 2); \
+	}
+
+/* Multiplies the partials of one pattern by the transition matrix */
+#define NEON_INTEGRATE_PARTIALS(dest, vm, src, v) \
+	{ \
+		const V_Real vp01 = VEC_LOAD(src + v + 0); \
+		const V_Real vp23 = VEC_LOAD(src + v + 2); \
+		dest##01 = VEC_MULT_LANE(vm[0][0], vp01, 0); \
+		dest##01 = VEC_MADD_LANE(vm[1][0], vp01, 1, dest##01); \
+		dest##01 = VEC_MADD_LANE(vm[2][0], vp23, 0, dest##01); \
+		dest##01 = VEC_MADD_LANE(vm[3][0], vp23, 1, dest##01); \
+		dest##23 = VEC_MULT_LANE(vm[0][1], vp01, 0); \
+		dest##23 = VEC_MADD_LANE(vm[1][1], vp01, 1, dest##23); \
+		dest##23 = VEC_MADD_LANE(vm[2][1], vp23, 0, dest##23); \
+		dest##23 = VEC_MADD_LANE(vm[3][1], vp23, 1, dest##23); \
+	}
+
+namespace beagle {
+namespace cpu {
+
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPU4StateNEONName(){ return "CPU-4State-NEON-Unknown"; };
+
+template<>
+inline const char* getBeagleCPU4StateNEONName<double>(){ return "CPU-4State-NEON-Double"; };
+
+template<>
+inline const char* getBeagleCPU4StateNEONName<float>(){ return "CPU-4State-NEON-Single"; };
+
+/*
+ * Calculates partial likelihoods at a node when both children have states.
+ */
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcStatesStates(double* destP,
+                                                                         const int* states_q,
+                                                                         const double* matrices_q,
+                                                                         const int* states_r,
+                                                                         const double* matrices_r,
+                                                                         int startPattern,
+                                                                         int endPattern) {
+
+    V_Real vmq[OFFSET][2], vmr[OFFSET][2];
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        NEON_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vmq);
+        NEON_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const int state_q = states_q[k];
+            const int state_r = states_r[k];
+
+            VEC_STORE(destP + v + 0, VEC_MULT(vmq[state_q][0], vmr[state_r][0]));
+            VEC_STORE(destP + v + 2, VEC_MULT(vmq[state_q][1], vmr[state_r][1]));
+
+            v += 4;
+        }
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when one child has states and one has partials.
+   NEON version
+ */
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcStatesPartials(double* destP,
+                                                                           const int* states_q,
+                                                                           const double* matrices_q,
+                                                                           const double* partials_r,
+                                                                           const double* matrices_r,
+                                                                           int startPattern,
+                                                                           int endPattern) {
+
+    V_Real vmq[OFFSET][2], vmr[OFFSET][2];
+    V_Real destr_01, destr_23;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        NEON_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vmq);
+        NEON_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const int state_q = states_q[k];
+
+            NEON_INTEGRATE_PARTIALS(destr_, vmr, partials_r, v);
+
+            VEC_STORE(destP + v + 0, VEC_MULT(vmq[state_q][0], destr_01));
+            VEC_STORE(destP + v + 2, VEC_MULT(vmq[state_q][1], destr_23));
+
+            v += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
+                                                                                       const int* states_q,
+                                                                                       const double* __restrict matrices_q,
+                                                                                       const double* __restrict partials_r,
+                                                                                       const double* __restrict matrices_r,
+                                                                                       const double* __restrict scaleFactors,
+                                                                                       int startPattern,
+                                                                                       int endPattern) {
+
+    V_Real vmq[OFFSET][2], vmr[OFFSET][2];
+    V_Real destr_01, destr_23;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        NEON_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vmq);
+        NEON_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const V_Real scaleFactor = VEC_SPLAT(1.0/scaleFactors[k]);
+
+            const int state_q = states_q[k];
+
+            NEON_INTEGRATE_PARTIALS(destr_, vmr, partials_r, v);
+
+            VEC_STORE(destP + v + 0, VEC_MULT(VEC_MULT(vmq[state_q][0], destr_01), scaleFactor));
+            VEC_STORE(destP + v + 2, VEC_MULT(VEC_MULT(vmq[state_q][1], destr_23), scaleFactor));
+
+            v += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcPartialsPartials(double* destP,
+                                                                             const double*  partials_q,
+                                                                             const double*  matrices_q,
+                                                                             const double*  partials_r,
+                                                                             const double*  matrices_r,
+                                                                             int startPattern,
+                                                                             int endPattern) {
+
+    V_Real vmq[OFFSET][2], vmr[OFFSET][2];
+    V_Real destq_01, destq_23, destr_01, destr_23;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+		/* Load transition-probability matrices into vectors */
+        NEON_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vmq);
+        NEON_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k++) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            NEON_INTEGRATE_PARTIALS(destq_, vmq, partials_q, v);
+            NEON_INTEGRATE_PARTIALS(destr_, vmr, partials_r, v);
+
+            VEC_STORE(destP + v + 0, VEC_MULT(destq_01, destr_01));
+            VEC_STORE(destP + v + 2, VEC_MULT(destq_23, destr_23));
+
+            v += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcPartialsPartialsFixedScaling(double* destP,
+                                                                                         const double* partials_q,
+                                                                                         const double* matrices_q,
+                                                                                         const double* partials_r,
+                                                                                         const double* matrices_r,
+                                                                                         const double* scaleFactors,
+                                                                                         int startPattern,
+                                                                                         int endPattern) {
+
+    V_Real vmq[OFFSET][2], vmr[OFFSET][2];
+    V_Real destq_01, destq_23, destr_01, destr_23;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+		/* Load transition-probability matrices into vectors */
+        NEON_PREFETCH_MATRIX(matrices_q + l*4*OFFSET, vmq);
+        NEON_PREFETCH_MATRIX(matrices_r + l*4*OFFSET, vmr);
+
+        int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+        for (int k = startPattern; k < endPattern; k++) {
+
+#           if 1 && !defined(_WIN32)
+            __builtin_prefetch (&partials_q[v+64]);
+            __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+            const V_Real scaleFactor = VEC_SPLAT(1.0/scaleFactors[k]);
+
+            NEON_INTEGRATE_PARTIALS(destq_, vmq, partials_q, v);
+            NEON_INTEGRATE_PARTIALS(destr_, vmr, partials_r, v);
+
+            VEC_STORE(destP + v + 0, VEC_MULT(VEC_MULT(destq_01, destr_01), scaleFactor));
+            VEC_STORE(destP + v + 2, VEC_MULT(VEC_MULT(destq_23, destr_23), scaleFactor));
+
+            v += 4;
+        }
+    }
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::integrateEdge(const int parIndex,
+                                                                      const int childIndex,
+                                                                      const int probIndex,
+                                                                      const int categoryWeightsIndex,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+
+    assert(parIndex >= kTipCount);
+
+    const double* cl_r = gPartials[parIndex];
+    double* cl_p = integrationTmp;
+    const double* transMatrix = gTransitionMatrices[probIndex];
+    const double* wt = gCategoryWeights[categoryWeightsIndex];
+
+    memset(&cl_p[startPattern*4], 0, ((endPattern - startPattern) * 4)*sizeof(double));
+
+    V_Real vm[OFFSET][2];
+
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+
+        const int* statesChild = getTipStates(childIndex);
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            NEON_PREFETCH_MATRIX(transMatrix + l*4*OFFSET, vm);
+
+            const V_Real vwt = VEC_SPLAT(wt[l]);
+
+            int u = startPattern * 4;
+            int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+            for (int k = startPattern; k < endPattern; k++) {
+                const int stateChild = statesChild[k];
+
+                V_Real wtdPartials_01 = VEC_MULT(VEC_LOAD(cl_r + v + 0), vwt);
+                V_Real wtdPartials_23 = VEC_MULT(VEC_LOAD(cl_r + v + 2), vwt);
+
+                VEC_STORE(cl_p + u + 0, VEC_MADD(vm[stateChild][0], wtdPartials_01, VEC_LOAD(cl_p + u + 0)));
+                VEC_STORE(cl_p + u + 2, VEC_MADD(vm[stateChild][1], wtdPartials_23, VEC_LOAD(cl_p + u + 2)));
+
+                u += 4;
+                v += 4;
+            }
+        }
+    } else { // Integrate against a partial at the child
+
+        const double* cl_q = gPartials[childIndex];
+        V_Real vclp_01, vclp_23;
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            NEON_PREFETCH_MATRIX(transMatrix + l*4*OFFSET, vm);
+
+            const V_Real vwt = VEC_SPLAT(wt[l]);
+
+            int u = startPattern * 4;
+            int v = (l*kPaddedPatternCount + startPattern) * 4;
+
+            for (int k = startPattern; k < endPattern; k++) {
+                NEON_INTEGRATE_PARTIALS(vclp_, vm, cl_q, v);
+
+                vclp_01 = VEC_MULT(vclp_01, vwt);
+                vclp_23 = VEC_MULT(vclp_23, vwt);
+
+                VEC_STORE(cl_p + u + 0, VEC_MADD(vclp_01, VEC_LOAD(cl_r + v + 0), VEC_LOAD(cl_p + u + 0)));
+                VEC_STORE(cl_p + u + 2, VEC_MADD(vclp_23, VEC_LOAD(cl_r + v + 2), VEC_LOAD(cl_p + u + 2)));
+
+                u += 4;
+                v += 4;
+            }
+        }
+    }
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcEdgeSiteLogLikelihoods(const int stateFrequenciesIndex,
+                                                                                   const int scalingFactorsIndex,
+                                                                                   int startPattern,
+                                                                                   int endPattern) {
+
+    const double* cl_p = integrationTmp;
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    int u = startPattern * 4;
+    for(int k = startPattern; k < endPattern; k++) {
+        double sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * cl_p[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = sumOverI;
+    }
+    vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=startPattern; k < endPattern; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+int BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                              const int childIndex,
+                                                                              const int probIndex,
+                                                                              const int categoryWeightsIndex,
+                                                                              const int stateFrequenciesIndex,
+                                                                              const int scalingFactorsIndex,
+                                                                              double* outSumLogLikelihood) {
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    integrateEdge(parIndex, childIndex, probIndex, categoryWeightsIndex, 0, kPatternCount);
+
+    calcEdgeSiteLogLikelihoods(stateFrequenciesIndex, scalingFactorsIndex, 0, kPatternCount);
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+void BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::calcEdgeLogLikelihoodsByPartition(
+                                                  const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition) {
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        integrateEdge(parentBufferIndices[p], childBufferIndices[p], probabilityIndices[p],
+                      categoryWeightsIndices[p], startPattern, endPattern);
+
+        calcEdgeSiteLogLikelihoods(stateFrequenciesIndices[p], cumulativeScaleIndices[p],
+                                   startPattern, endPattern);
+
+        outSumLogLikelihoodByPartition[p] = 0.0;
+        for (int i = startPattern; i < endPattern; i++) {
+            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        }
+    }
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+int BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::getPaddedPatternsModulus() {
+	return 1;  // We currently do not vectorize across patterns
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+const char* BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::getName() {
+    return  getBeagleCPU4StateNEONName<double>();
+}
+
+BEAGLE_CPU_4_NEON_TEMPLATE
+const long BeagleCPU4StateNEONImpl<BEAGLE_CPU_4_NEON_DOUBLE>::getFlags() {
+    return  BEAGLE_FLAG_COMPUTATION_SYNCH |
+            BEAGLE_FLAG_PROCESSOR_CPU |
+            BEAGLE_FLAG_PRECISION_DOUBLE |
+            BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPU4StateNEONImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    if (stateCount != 4) {
+        return NULL;
+    }
+
+    if (!CPUSupportsNEON())
+        return NULL;
+
+    BeagleCPU4StateNEONImpl<REALTYPE, T_PAD_4_NEON_DEFAULT, P_PAD_4_NEON_DEFAULT>* impl =
+    		new BeagleCPU4StateNEONImpl<REALTYPE, T_PAD_4_NEON_DEFAULT, P_PAD_4_NEON_DEFAULT>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPU4StateNEONImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                               int partialsBufferCount,
+                                                                               int compactBufferCount,
+                                                                               int stateCount,
+                                                                               int patternCount,
+                                                                               int eigenBufferCount,
+                                                                               int matrixBufferCount,
+                                                                               int categoryCount,
+                                                                               int scaleBufferCount,
+                                                                               long preferenceFlags,
+                                                                               long requirementFlags,
+                                                                               long long* outHostBytes,
+                                                                               long long* outDeviceBytes) {
+    if (stateCount != 4 || !CPUSupportsNEON())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    *outHostBytes = BeagleCPU4StateNEONImpl<REALTYPE, T_PAD_4_NEON_DEFAULT, P_PAD_4_NEON_DEFAULT>::getInstanceBytes(
+                        tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                        scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPU4StateNEONImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+	return getBeagleCPU4StateNEONName<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+template <>
+const long BeagleCPU4StateNEONImplFactory<double>::getFlags() {
+    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+           BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_FLAG_PROCESSOR_CPU |
+           BEAGLE_FLAG_PRECISION_DOUBLE |
+           BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+           BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL|
+           BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+           BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+
+}
+}
+
+#endif //BEAGLE_CPU_4STATE_NEON_IMPL_HPP
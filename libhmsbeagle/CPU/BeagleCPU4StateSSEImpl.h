@@ -63,6 +63,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gCategoryWeights;
@@ -155,6 +157,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::hasTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::getTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kCategoryCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gCategoryWeights;
@@ -264,6 +268,20 @@ public:
 
     virtual const char* getName();
     virtual const long getFlags();
+
+    virtual int estimateMemory(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long long* outHostBytes,
+                               long long* outDeviceBytes);
 };
 
 }	// namespace cpu
@@ -520,9 +520,9 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(double));
 
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const int* statesChild = getTipStates(childIndex);
 
         int w = 0;
         V_Real *vcl_r = (V_Real *)cl_r;
@@ -605,8 +605,9 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        outLogLikelihoodsTmp[k] = sumOverI;
     }
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
 
 
     if (scalingFactorsIndex != BEAGLE_OP_NONE) {
@@ -689,9 +690,9 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
         const double* freqs = gStateFrequencies[stateFrequenciesIndex];
 
 
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
 
-            const int* statesChild = gTipStates[childIndex];
+            const int* statesChild = getTipStates(childIndex);
 
             int w = 0;
             V_Real *vcl_r = (V_Real *) (cl_r + startPattern * 4);
@@ -778,8 +779,9 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
                 u++;
             }
 
-            outLogLikelihoodsTmp[k] = log(sumOverI);
+            outLogLikelihoodsTmp[k] = sumOverI;
         }
+        vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
 
 
         if (scalingFactorsIndex != BEAGLE_OP_NONE) {
@@ -891,6 +893,31 @@ BeagleImpl* BeagleCPU4StateSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImp
     return NULL;
 }
 
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPU4StateSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                              int partialsBufferCount,
+                                                                              int compactBufferCount,
+                                                                              int stateCount,
+                                                                              int patternCount,
+                                                                              int eigenBufferCount,
+                                                                              int matrixBufferCount,
+                                                                              int categoryCount,
+                                                                              int scaleBufferCount,
+                                                                              long preferenceFlags,
+                                                                              long requirementFlags,
+                                                                              long long* outHostBytes,
+                                                                              long long* outDeviceBytes) {
+    if (stateCount != 4 || !CPUSupportsSSE())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    *outHostBytes = BeagleCPU4StateSSEImpl<REALTYPE, T_PAD_4_SSE_DEFAULT, P_PAD_4_SSE_DEFAULT>::getInstanceBytes(
+                        tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                        scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 const char* BeagleCPU4StateSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 	return getBeagleCPU4StateSSEName<BEAGLE_CPU_FACTORY_GENERIC>();
@@ -900,7 +927,7 @@ template <>
 const long BeagleCPU4StateSSEImplFactory<double>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_CPU_OPENMP_THREADING_FLAG |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -914,7 +941,7 @@ template <>
 const long BeagleCPU4StateSSEImplFactory<float>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_CPU_OPENMP_THREADING_FLAG |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_SINGLE |
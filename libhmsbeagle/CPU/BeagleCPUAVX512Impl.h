@@ -0,0 +1,203 @@
+/*
+ *  BeagleCPUAVX512Impl.h
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * @author Marc Suchard
+ */
+
+#ifndef __BeagleCPUAVX512Impl__
+#define __BeagleCPUAVX512Impl__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+
+#include <vector>
+
+#define RESTRICT __restrict		/* may need to define this instead to 'restrict' */
+
+// Pad transition matrix rows with an extra 1.0 for ambiguous characters
+#define T_PAD_AVX512    1
+
+// Partials padding not needed, the last block of states is masked
+#define P_PAD_AVX512    0
+
+#define BEAGLE_CPU_AVX512_DOUBLE	double, T_PAD, P_PAD
+#define BEAGLE_CPU_AVX512_TEMPLATE	template <int T_PAD, int P_PAD>
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_TEMPLATE
+class BeagleCPUAVX512Impl : public BeagleCPUImpl<BEAGLE_CPU_GENERIC> {};
+
+/*
+ * Each 512-bit vector holds eight consecutive states of one pattern; the
+ * transition matrices are transposed per call so that a column becomes a
+ * contiguous vector.
+ */
+BEAGLE_CPU_AVX512_TEMPLATE
+class BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE> : public BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE> {
+
+protected:
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kTipCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gPartials;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::integrationTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gTransitionMatrices;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::hasTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::getTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kCategoryCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gScaleBuffers;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gCategoryWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gStateFrequencies;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kMatrixSize;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kPartialsPaddedStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gPatternWeights;
+
+public:
+    virtual const char* getName();
+
+    virtual const long getFlags();
+
+protected:
+    virtual int getPaddedPatternsModulus();
+
+private:
+    virtual void calcStatesPartials(double* destP,
+                                    const int* states1,
+                                    const double* matrices1,
+                                    const double* partials2,
+                                    const double* matrices2,
+                                    int startPattern,
+                                    int endPattern);
+
+    virtual void calcStatesPartialsFixedScaling(double* destP,
+                                                const int* states1,
+                                                const double* matrices1,
+                                                const double* partials2,
+                                                const double* matrices2,
+                                                const double* scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
+
+    virtual void calcPartialsPartials(double* __restrict destP,
+                                      const double* __restrict partials1,
+                                      const double* __restrict matrices1,
+                                      const double* __restrict partials2,
+                                      const double* __restrict matrices2,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
+                                                  const double* __restrict partials1,
+                                                  const double* __restrict matrices1,
+                                                  const double* __restrict partials2,
+                                                  const double* __restrict matrices2,
+                                                  const double* __restrict scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
+
+    virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
+                                       const int childBufferIndex,
+                                       const int probabilityIndex,
+                                       const int categoryWeightsIndex,
+                                       const int stateFrequenciesIndex,
+                                       const int scalingFactorsIndex,
+                                       double* outSumLogLikelihood);
+
+    // number of doubles in a row of a transposed matrix, a multiple of the vector length
+    int getTransposedRowLength();
+
+    // allocates and fills the transposed matrices of all categories, including
+    // the padded row for ambiguous characters; free with _mm_free
+    double* createTransposedMatrices(const double* matrices);
+
+    // products of the partials of patterns [startPattern, endPattern) with both
+    // transposed matrices, optionally divided by the scale factors
+    void calcPartialsPartialsTransposed(double* __restrict destP,
+                                        const double* __restrict partials1,
+                                        const double* __restrict matrices1,
+                                        const double* __restrict partials2,
+                                        const double* __restrict matrices2,
+                                        const double* __restrict scaleFactors,
+                                        int startPattern,
+                                        int endPattern);
+
+    void calcStatesPartialsTransposed(double* __restrict destP,
+                                      const int* states1,
+                                      const double* __restrict matrices1,
+                                      const double* __restrict partials2,
+                                      const double* __restrict matrices2,
+                                      const double* __restrict scaleFactors,
+                                      int startPattern,
+                                      int endPattern);
+};
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+class BeagleCPUAVX512ImplFactory : public BeagleImplFactory {
+public:
+    virtual BeagleImpl* createImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags,
+                                   int* errorCode);
+
+    virtual const char* getName();
+    virtual const long getFlags();
+
+    virtual int estimateMemory(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long long* outHostBytes,
+                               long long* outDeviceBytes);
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+// now include the file containing template function implementations
+#include "libhmsbeagle/CPU/BeagleCPUAVX512Impl.hpp"
+
+
+#endif // __BeagleCPUAVX512Impl__
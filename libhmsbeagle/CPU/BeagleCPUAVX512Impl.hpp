@@ -0,0 +1,490 @@
+/*
+ *  BeagleCPUAVX512Impl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * @author Marc Suchard
+ */
+
+#ifndef BEAGLE_CPU_AVX512_IMPL_HPP
+#define BEAGLE_CPU_AVX512_IMPL_HPP
+
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUAVX512Impl.h"
+#include "libhmsbeagle/CPU/AVX512Definitions.h"
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPUAVX512Name(){ return "CPU-AVX512-Unknown"; };
+
+template<>
+inline const char* getBeagleCPUAVX512Name<double>(){ return "CPU-AVX512-Double"; };
+
+template<>
+inline const char* getBeagleCPUAVX512Name<float>(){ return "CPU-AVX512-Single"; };
+
+BEAGLE_AVX512_TARGET_BEGIN
+
+BEAGLE_CPU_AVX512_TEMPLATE
+int BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::getTransposedRowLength() {
+    return (kStateCount + REALS_PER_VEC - 1) & ~(REALS_PER_VEC - 1);
+}
+
+/*
+ * Row j of the transposed matrix of a category holds column j of the
+ * transition matrix, i.e. the probabilities of all parent states i given
+ * child state j; row kStateCount holds the padded column of ones.
+ */
+BEAGLE_CPU_AVX512_TEMPLATE
+double* BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::createTransposedMatrices(const double* matrices) {
+
+    const int rowLength = getTransposedRowLength();
+    const int rowCount = kStateCount + T_PAD;
+    const int matrixIncr = kStateCount + T_PAD;
+
+    double* transposed = (double*) _mm_malloc(sizeof(double) * kCategoryCount * rowCount * rowLength, 64);
+    if (transposed == NULL)
+        throw std::bad_alloc();
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const double* matrix = matrices + l * kMatrixSize;
+        double* dest = transposed + l * rowCount * rowLength;
+        for (int j = 0; j < rowCount; j++) {
+            int i = 0;
+            for (; i < kStateCount; i++)
+                dest[i] = matrix[i * matrixIncr + j];
+            for (; i < rowLength; i++)
+                dest[i] = 0.0;
+            dest += rowLength;
+        }
+    }
+
+    return transposed;
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcStatesPartialsTransposed(double* __restrict destP,
+                                                                                 const int* states1,
+                                                                                 const double* __restrict matrices1,
+                                                                                 const double* __restrict partials2,
+                                                                                 const double* __restrict matrices2,
+                                                                                 const double* __restrict scaleFactors,
+                                                                                 int startPattern,
+                                                                                 int endPattern) {
+
+    const int rowLength = getTransposedRowLength();
+    const int matrixLength = (kStateCount + T_PAD) * rowLength;
+    const int stateCountModTwo = (kStateCount / 2) * 2;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const double* mt1 = matrices1 + l * matrixLength;
+        const double* mt2 = matrices2 + l * matrixLength;
+        for (int k = startPattern; k < endPattern; k++) {
+            const double* mtState1 = mt1 + states1[k] * rowLength;
+            const double* partials2Ptr = partials2 + v;
+            const V_Real oneOverScaleFactor = VEC_SPLAT(scaleFactors ? 1.0 / scaleFactors[k] : 1.0);
+
+            for (int i = 0; i < kStateCount; i += REALS_PER_VEC) {
+                V_Real sumA = VEC_SETZERO();
+                V_Real sumB = VEC_SETZERO();
+                const double* mt2Ptr = mt2 + i;
+                int j = 0;
+                for (; j < stateCountModTwo; j += 2) {
+                    sumA = VEC_MADD(VEC_LOAD(mt2Ptr), VEC_SPLAT(partials2Ptr[j]), sumA);
+                    sumB = VEC_MADD(VEC_LOAD(mt2Ptr + rowLength), VEC_SPLAT(partials2Ptr[j + 1]), sumB);
+                    mt2Ptr += 2 * rowLength;
+                }
+                for (; j < kStateCount; j++) {
+                    sumA = VEC_MADD(VEC_LOAD(mt2Ptr), VEC_SPLAT(partials2Ptr[j]), sumA);
+                }
+
+                V_Real dest = VEC_MULT(VEC_MULT(VEC_LOAD(mtState1 + i), VEC_ADD(sumA, sumB)),
+                                       oneOverScaleFactor);
+                VEC_MASK_STORE(destP + v + i, VEC_MASK_FIRST(kStateCount - i), dest);
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcPartialsPartialsTransposed(double* __restrict destP,
+                                                                                   const double* __restrict partials1,
+                                                                                   const double* __restrict matrices1,
+                                                                                   const double* __restrict partials2,
+                                                                                   const double* __restrict matrices2,
+                                                                                   const double* __restrict scaleFactors,
+                                                                                   int startPattern,
+                                                                                   int endPattern) {
+
+    const int rowLength = getTransposedRowLength();
+    const int matrixLength = (kStateCount + T_PAD) * rowLength;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const double* mt1 = matrices1 + l * matrixLength;
+        const double* mt2 = matrices2 + l * matrixLength;
+        for (int k = startPattern; k < endPattern; k++) {
+            const double* partials1Ptr = partials1 + v;
+            const double* partials2Ptr = partials2 + v;
+            const V_Real oneOverScaleFactor = VEC_SPLAT(scaleFactors ? 1.0 / scaleFactors[k] : 1.0);
+
+            for (int i = 0; i < kStateCount; i += REALS_PER_VEC) {
+                V_Real sum1 = VEC_SETZERO();
+                V_Real sum2 = VEC_SETZERO();
+                const double* mt1Ptr = mt1 + i;
+                const double* mt2Ptr = mt2 + i;
+                for (int j = 0; j < kStateCount; j++) {
+                    sum1 = VEC_MADD(VEC_LOAD(mt1Ptr), VEC_SPLAT(partials1Ptr[j]), sum1);
+                    sum2 = VEC_MADD(VEC_LOAD(mt2Ptr), VEC_SPLAT(partials2Ptr[j]), sum2);
+                    mt1Ptr += rowLength;
+                    mt2Ptr += rowLength;
+                }
+
+                V_Real dest = VEC_MULT(VEC_MULT(sum1, sum2), oneOverScaleFactor);
+                VEC_MASK_STORE(destP + v + i, VEC_MASK_FIRST(kStateCount - i), dest);
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when one child has states and one has partials.
+   AVX-512 version
+ */
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcStatesPartials(double* destP,
+                                                                       const int* states1,
+                                                                       const double* matrices1,
+                                                                       const double* partials2,
+                                                                       const double* matrices2,
+                                                                       int startPattern,
+                                                                       int endPattern) {
+
+    double* mt1 = createTransposedMatrices(matrices1);
+    double* mt2 = createTransposedMatrices(matrices2);
+
+    calcStatesPartialsTransposed(destP, states1, mt1, partials2, mt2, NULL, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
+                                                                                   const int* states1,
+                                                                                   const double* matrices1,
+                                                                                   const double* partials2,
+                                                                                   const double* matrices2,
+                                                                                   const double* scaleFactors,
+                                                                                   int startPattern,
+                                                                                   int endPattern) {
+
+    double* mt1 = createTransposedMatrices(matrices1);
+    double* mt2 = createTransposedMatrices(matrices2);
+
+    calcStatesPartialsTransposed(destP, states1, mt1, partials2, mt2, scaleFactors, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+/*
+ * Calculates partial likelihoods at a node when both children have partials.
+   AVX-512 version
+ */
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcPartialsPartials(double* __restrict destP,
+                                                                         const double* __restrict partials1,
+                                                                         const double* __restrict matrices1,
+                                                                         const double* __restrict partials2,
+                                                                         const double* __restrict matrices2,
+                                                                         int startPattern,
+                                                                         int endPattern) {
+
+    double* mt1 = createTransposedMatrices(matrices1);
+    double* mt2 = createTransposedMatrices(matrices2);
+
+    calcPartialsPartialsTransposed(destP, partials1, mt1, partials2, mt2, NULL, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcPartialsPartialsFixedScaling(double* __restrict destP,
+                                                                                     const double* __restrict partials1,
+                                                                                     const double* __restrict matrices1,
+                                                                                     const double* __restrict partials2,
+                                                                                     const double* __restrict matrices2,
+                                                                                     const double* __restrict scaleFactors,
+                                                                                     int startPattern,
+                                                                                     int endPattern) {
+
+    double* mt1 = createTransposedMatrices(matrices1);
+    double* mt2 = createTransposedMatrices(matrices2);
+
+    calcPartialsPartialsTransposed(destP, partials1, mt1, partials2, mt2, scaleFactors, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+int BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                          const int childIndex,
+                                                                          const int probIndex,
+                                                                          const int categoryWeightsIndex,
+                                                                          const int stateFrequenciesIndex,
+                                                                          const int scalingFactorsIndex,
+                                                                          double* outSumLogLikelihood) {
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    assert(parIndex >= kTipCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const double* partialsParent = gPartials[parIndex];
+    const double* wt = gCategoryWeights[categoryWeightsIndex];
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    const int rowLength = getTransposedRowLength();
+    const int matrixLength = (kStateCount + T_PAD) * rowLength;
+
+    double* mt = createTransposedMatrices(gTransitionMatrices[probIndex]);
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(double));
+
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+
+        const int* statesChild = getTipStates(childIndex);
+        int v = 0; // Index for parent partials
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            int u = 0; // Index in resulting product-partials (summed over categories)
+            const V_Real weight = VEC_SPLAT(wt[l]);
+            const double* mtCategory = mt + l * matrixLength;
+            for (int k = 0; k < kPatternCount; k++) {
+                const double* mtState = mtCategory + statesChild[k] * rowLength;
+                for (int i = 0; i < kStateCount; i += REALS_PER_VEC) {
+                    const __mmask8 mask = VEC_MASK_FIRST(kStateCount - i);
+                    V_Real wtdPartials = VEC_MULT(VEC_MASK_LOAD(mask, partialsParent + v + i), weight);
+                    V_Real sum = VEC_MADD(VEC_LOAD(mtState + i), wtdPartials,
+                                          VEC_MASK_LOAD(mask, integrationTmp + u + i));
+                    VEC_MASK_STORE(integrationTmp + u + i, mask, sum);
+                }
+                u += kStateCount;
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const double* partialsChild = gPartials[childIndex];
+        int v = 0;
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            const V_Real weight = VEC_SPLAT(wt[l]);
+            const double* mtCategory = mt + l * matrixLength;
+            for (int k = 0; k < kPatternCount; k++) {
+                const double* partialsChildPtr = partialsChild + v;
+                for (int i = 0; i < kStateCount; i += REALS_PER_VEC) {
+                    const __mmask8 mask = VEC_MASK_FIRST(kStateCount - i);
+                    V_Real sumOverJ = VEC_SETZERO();
+                    const double* mtPtr = mtCategory + i;
+                    for (int j = 0; j < kStateCount; j++) {
+                        sumOverJ = VEC_MADD(VEC_LOAD(mtPtr), VEC_SPLAT(partialsChildPtr[j]), sumOverJ);
+                        mtPtr += rowLength;
+                    }
+                    V_Real wtdPartials = VEC_MULT(VEC_MASK_LOAD(mask, partialsParent + v + i), weight);
+                    V_Real sum = VEC_MADD(sumOverJ, wtdPartials,
+                                          VEC_MASK_LOAD(mask, integrationTmp + u + i));
+                    VEC_MASK_STORE(integrationTmp + u + i, mask, sum);
+                }
+                u += kStateCount;
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+
+    _mm_free(mt);
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        double sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * integrationTmp[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = sumOverI;
+    }
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+int BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::getPaddedPatternsModulus() {
+	return 1;  // We currently do not vectorize across patterns
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+const char* BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::getName() {
+	return getBeagleCPUAVX512Name<double>();
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+const long BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::getFlags() {
+    return  BEAGLE_FLAG_COMPUTATION_SYNCH |
+            BEAGLE_FLAG_PROCESSOR_CPU |
+            BEAGLE_FLAG_PRECISION_DOUBLE |
+            BEAGLE_FLAG_VECTOR_AVX512 |
+            BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+BEAGLE_AVX512_TARGET_END
+
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPUAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    if (!CPUSupportsAVX512())
+        return NULL;
+
+    BeagleCPUAVX512Impl<REALTYPE, T_PAD_AVX512, P_PAD_AVX512>* impl =
+            new BeagleCPUAVX512Impl<REALTYPE, T_PAD_AVX512, P_PAD_AVX512>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPUAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                           int partialsBufferCount,
+                                                                           int compactBufferCount,
+                                                                           int stateCount,
+                                                                           int patternCount,
+                                                                           int eigenBufferCount,
+                                                                           int matrixBufferCount,
+                                                                           int categoryCount,
+                                                                           int scaleBufferCount,
+                                                                           long preferenceFlags,
+                                                                           long requirementFlags,
+                                                                           long long* outHostBytes,
+                                                                           long long* outDeviceBytes) {
+    if (!CPUSupportsAVX512())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    *outHostBytes = BeagleCPUAVX512Impl<REALTYPE, T_PAD_AVX512, P_PAD_AVX512>::getInstanceBytes(
+                        tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                        scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPUAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+	return getBeagleCPUAVX512Name<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+template <>
+const long BeagleCPUAVX512ImplFactory<double>::getFlags() {
+    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+           BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_FLAG_PROCESSOR_CPU |
+           BEAGLE_FLAG_VECTOR_AVX512 |
+           BEAGLE_FLAG_PRECISION_DOUBLE |
+           BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+           BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
+           BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+           BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+}
+}
+
+#endif //BEAGLE_CPU_AVX512_IMPL_HPP
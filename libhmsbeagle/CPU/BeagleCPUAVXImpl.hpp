@@ -617,6 +617,37 @@ BeagleImpl* BeagleCPUAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int
     return NULL;
 }
 
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPUAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                        int partialsBufferCount,
+                                                                        int compactBufferCount,
+                                                                        int stateCount,
+                                                                        int patternCount,
+                                                                        int eigenBufferCount,
+                                                                        int matrixBufferCount,
+                                                                        int categoryCount,
+                                                                        int scaleBufferCount,
+                                                                        long preferenceFlags,
+                                                                        long requirementFlags,
+                                                                        long long* outHostBytes,
+                                                                        long long* outDeviceBytes) {
+    if (!CPUSupportsAVX())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (stateCount & 1)
+        *outHostBytes = BeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_ODD, P_PAD_AVX_ODD>::getInstanceBytes(
+                            tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                            patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                            scaleBufferCount, preferenceFlags, requirementFlags);
+    else
+        *outHostBytes = BeagleCPUAVXImpl<REALTYPE, T_PAD_AVX_EVEN, P_PAD_AVX_EVEN>::getInstanceBytes(
+                            tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                            patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                            scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 const char* BeagleCPUAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 	return getBeagleCPUAVXName<BEAGLE_CPU_FACTORY_GENERIC>();
@@ -0,0 +1,184 @@
+/*
+ *  BeagleCPUBufferArena.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUBufferArena__
+#define __BeagleCPUBufferArena__
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <string>
+
+#if !defined(WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * One contiguous region that buffers are carved from in order, each starting on a
+ * kAlignment-byte boundary. Where the platform allows, the region is mapped from huge pages
+ * of the requested size, falling back to transparent huge pages and then to normal pages.
+ * Alternatively the region is backed by an unlinked scratch file, so that the system can
+ * write its pages out and read them back rather than keep them all in memory. Buffers are
+ * released all at once when the arena is destroyed.
+ */
+class BufferArena {
+public:
+    static const size_t kAlignment = 64;
+
+    // Bytes taken by a buffer of size bytes, padded to keep the next one aligned
+    static size_t paddedSize(size_t size) {
+        return (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    BufferArena(size_t size,
+                size_t hugePageSize) : base(NULL), kSize(paddedSize(size)), kMappedSize(0),
+                                       used(0), kHugePages(false), kFileBacked(false) {
+        if (kSize == 0)
+            kSize = kAlignment;
+#if defined(WIN32)
+        allocation = malloc(kSize + kAlignment);
+        if (allocation == NULL)
+            throw std::bad_alloc();
+        base = (char*) paddedSize((size_t) allocation);
+#else
+        void* region = MAP_FAILED;
+        if (hugePageSize > 0) {
+            kMappedSize = (kSize + hugePageSize - 1) / hugePageSize * hugePageSize;
+#if defined(MAP_HUGETLB)
+            int pageFlags = MAP_HUGETLB;
+#if defined(MAP_HUGE_SHIFT)
+            int pageShift = 0;
+            while (((size_t) 1 << pageShift) < hugePageSize)
+                pageShift++;
+            pageFlags |= (pageShift << MAP_HUGE_SHIFT);
+#endif
+            region = mmap(NULL, kMappedSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | pageFlags, -1, 0);
+            kHugePages = (region != MAP_FAILED);
+#endif
+        } else {
+            kMappedSize = kSize;
+        }
+        if (region == MAP_FAILED) {
+            region = mmap(NULL, kMappedSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED)
+                throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+            if (hugePageSize > 0)
+                madvise(region, kMappedSize, MADV_HUGEPAGE);
+#endif
+        }
+        base = (char*) region;
+#endif
+    }
+
+#if !defined(WIN32)
+    BufferArena(size_t size,
+                const char* directory) : base(NULL), kSize(paddedSize(size)), used(0),
+                                         kHugePages(false), kFileBacked(true) {
+        if (kSize == 0)
+            kSize = kAlignment;
+        const size_t pageSize = sysconf(_SC_PAGESIZE);
+        kMappedSize = (kSize + pageSize - 1) / pageSize * pageSize;
+
+        std::string path = std::string(directory) + "/beagle-partials-XXXXXX";
+        int file = mkstemp(&path[0]);
+        if (file < 0)
+            throw std::bad_alloc();
+        // the file goes away with the mapping
+        unlink(path.c_str());
+        void* region = MAP_FAILED;
+        if (ftruncate(file, kMappedSize) == 0)
+            region = mmap(NULL, kMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        close(file);
+        if (region == MAP_FAILED)
+            throw std::bad_alloc();
+        base = (char*) region;
+    }
+#endif
+
+    ~BufferArena() {
+#if defined(WIN32)
+        free(allocation);
+#else
+        munmap(base, kMappedSize);
+#endif
+    }
+
+    // Returns the next size bytes of the arena, or NULL when it is exhausted
+    void* allocate(size_t size) {
+        size = paddedSize(size);
+        if (size > kSize - used)
+            return NULL;
+        void* buffer = base + used;
+        used += size;
+        return buffer;
+    }
+
+    bool contains(const void* buffer) const {
+        return (const char*) buffer >= base && (const char*) buffer < base + kSize;
+    }
+
+    // Whether the region was mapped from explicit huge pages
+    bool hugePages() const {
+        return kHugePages;
+    }
+
+    bool fileBacked() const {
+        return kFileBacked;
+    }
+
+    // Asks the system to read the pages of a buffer in from the scratch file ahead of use
+    void prefetch(const void* buffer,
+                  size_t size) const {
+#if !defined(WIN32) && defined(MADV_WILLNEED)
+        if (!kFileBacked || !contains(buffer))
+            return;
+        const size_t pageSize = sysconf(_SC_PAGESIZE);
+        const size_t start = ((const char*) buffer - base) / pageSize * pageSize;
+        madvise(base + start, ((const char*) buffer - base) + size - start, MADV_WILLNEED);
+#endif
+    }
+
+private:
+    char* base;
+    size_t kSize;
+    size_t kMappedSize;
+    size_t used;
+    bool kHugePages;
+    bool kFileBacked;
+#if defined(WIN32)
+    void* allocation;
+#endif
+};
+
+}   // namespace cpu
+}   // namespace beagle
+
+#endif // __BeagleCPUBufferArena__
@@ -0,0 +1,192 @@
+/*
+ *  BeagleCPUCalibrationProfile.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUCalibrationProfile__
+#define __BeagleCPUCalibrationProfile__
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * The partition counts found by calibrateCPUThreadCount, kept for the running process.
+ * When BEAGLE_CPU_CALIBRATION_PROFILE names a profile file they are also saved there, so
+ * later runs on the same host skip the measurement. The file holds one line per
+ * calibration, the key and the partition count separated by a tab, in the format of the
+ * benchmark cache. A key names the host, the implementation, the number of threads
+ * available and the size of the instance.
+ */
+class CalibrationProfile {
+public:
+    static std::string makeKey(const char* implName,
+                               int threadCount,
+                               int stateCount,
+                               int categoryCount,
+                               int patternCount) {
+        std::ostringstream key;
+        key << getHostFingerprint() << "|" << implName << "|threads " << threadCount
+            << "|states " << stateCount << "|categories " << categoryCount
+            << "|patterns " << patternCount;
+        return key.str();
+    }
+
+    // Returns the stored partition count for key, or 0 if it was never calibrated
+    static int find(const std::string& key) {
+        std::unique_lock<std::mutex> l(getMutex());
+        std::map<std::string, int>& counts = getCounts();
+        std::map<std::string, int>::iterator it = counts.find(key);
+        if (it != counts.end())
+            return it->second;
+
+        int partitionCount = readProfile(key);
+        if (partitionCount > 0)
+            counts[key] = partitionCount;
+        return partitionCount;
+    }
+
+    static void store(const std::string& key,
+                      int partitionCount) {
+        std::unique_lock<std::mutex> l(getMutex());
+        getCounts()[key] = partitionCount;
+        writeProfile(key, partitionCount);
+    }
+
+private:
+    static std::mutex& getMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::map<std::string, int>& getCounts() {
+        static std::map<std::string, int> counts;
+        return counts;
+    }
+
+    static std::string getFileName() {
+        const char* fileName = getenv("BEAGLE_CPU_CALIBRATION_PROFILE");
+        return (fileName != NULL ? fileName : "");
+    }
+
+    static std::string getHostFingerprint() {
+        std::ostringstream fingerprint;
+        fingerprint << "cores " << std::thread::hardware_concurrency();
+
+#if defined(__linux__)
+        std::ifstream cpuInfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuInfo, line)) {
+            if (line.compare(0, 10, "model name") == 0) {
+                size_t model = line.find_first_not_of(" \t", line.find(':') + 1);
+                if (model != std::string::npos)
+                    fingerprint << " " << line.substr(model);
+                break;
+            }
+        }
+#endif
+
+        return fingerprint.str();
+    }
+
+    static bool hasKey(const std::string& line,
+                       const std::string& key) {
+        return line.size() > key.size() && line.compare(0, key.size(), key) == 0 &&
+               line[key.size()] == '\t';
+    }
+
+    static int readProfile(const std::string& key) {
+        std::string fileName = getFileName();
+        if (fileName.empty())
+            return 0;
+
+        std::ifstream file(fileName.c_str());
+        std::string line;
+        int partitionCount = 0;
+        while (std::getline(file, line)) {
+            if (hasKey(line, key))
+                partitionCount = atoi(line.c_str() + key.size() + 1);
+        }
+        return (partitionCount > 0 ? partitionCount : 0);
+    }
+
+    static void writeProfile(const std::string& key,
+                             int partitionCount) {
+        std::string fileName = getFileName();
+        if (fileName.empty())
+            return;
+
+        // keep the calibrations of other keys
+        std::vector<std::string> lines;
+        {
+            std::ifstream file(fileName.c_str());
+            std::string line;
+            while (std::getline(file, line)) {
+                if (!hasKey(line, key))
+                    lines.push_back(line);
+            }
+        }
+
+        std::ostringstream tmpName;
+        tmpName << fileName << ".tmp" << getpid();
+        {
+            std::ofstream file(tmpName.str().c_str());
+            if (!file)
+                return;
+            for (size_t i = 0; i < lines.size(); i++)
+                file << lines[i] << "\n";
+            file << key << "\t" << partitionCount << "\n";
+            if (!file) {
+                file.close();
+                remove(tmpName.str().c_str());
+                return;
+            }
+        }
+
+#ifdef _WIN32
+        remove(fileName.c_str());
+#endif
+        if (rename(tmpName.str().c_str(), fileName.c_str()) != 0)
+            remove(tmpName.str().c_str());
+    }
+};
+
+}   // namespace cpu
+}   // namespace beagle
+
+#endif // __BeagleCPUCalibrationProfile__
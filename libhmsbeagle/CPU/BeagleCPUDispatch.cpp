@@ -0,0 +1,58 @@
+/*
+ *  BeagleCPUDispatch.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUDispatch.h"
+
+namespace beagle {
+namespace cpu {
+
+static BeagleCPUFeatures detectBeagleCPUFeatures() {
+    BeagleCPUFeatures features;
+    features.sse2 = false;
+    features.avx512 = false;
+    features.neon = false;
+#ifdef BEAGLE_CPU_DISPATCH_SSE
+    features.sse2 = beagleCPUSupportsSSE();
+#endif
+#ifdef BEAGLE_CPU_DISPATCH_AVX512
+    // without a flag bit, as with a 32-bit long, the AVX implementations are used
+    features.avx512 = (BEAGLE_FLAG_VECTOR_AVX512 != 0) && beagleCPUSupportsAVX512();
+#endif
+#ifdef BEAGLE_CPU_DISPATCH_NEON
+    features.neon = beagleCPUSupportsNEON();
+#endif
+    return features;
+}
+
+const BeagleCPUFeatures& getBeagleCPUFeatures() {
+    static const BeagleCPUFeatures features = detectBeagleCPUFeatures();
+    return features;
+}
+
+}	// namespace cpu
+}	// namespace beagle
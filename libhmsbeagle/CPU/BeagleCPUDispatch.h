@@ -0,0 +1,77 @@
+/*
+ *  BeagleCPUDispatch.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUDispatch__
+#define __BeagleCPUDispatch__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <list>
+
+#include "libhmsbeagle/BeagleImpl.h"
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Vector instruction sets that are both compiled into the CPU plugin and
+ * usable on the host.  The host is probed once, the first time this is called.
+ */
+struct BeagleCPUFeatures {
+    bool sse2;
+    bool avx512;
+    bool neon;
+};
+
+const BeagleCPUFeatures& getBeagleCPUFeatures();
+
+/*
+ * Each vector instruction set is compiled in its own translation unit, since
+ * the definitions headers share macro names.  The feature checks report
+ * whether the host can run the kernels, the add functions append the
+ * factories of that instruction set in selection order.
+ */
+#ifdef BEAGLE_CPU_DISPATCH_SSE
+bool beagleCPUSupportsSSE();
+void addBeagleCPUSSEFactories(std::list<beagle::BeagleImplFactory*>& factories);
+// single precision has no 4-state kernel, so it is listed after the baseline 4-state factories
+void addBeagleCPUSSESingleFactories(std::list<beagle::BeagleImplFactory*>& factories);
+#endif
+
+#ifdef BEAGLE_CPU_DISPATCH_AVX512
+bool beagleCPUSupportsAVX512();
+void addBeagleCPUAVX512Factories(std::list<beagle::BeagleImplFactory*>& factories);
+#endif
+
+#ifdef BEAGLE_CPU_DISPATCH_NEON
+bool beagleCPUSupportsNEON();
+void addBeagleCPUNEONFactories(std::list<beagle::BeagleImplFactory*>& factories);
+#endif
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // __BeagleCPUDispatch__
@@ -0,0 +1,139 @@
+/*
+ *  BeagleCPUFixedStateImpl.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUFixedStateImpl__
+#define __BeagleCPUFixedStateImpl__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+
+#define BEAGLE_CPU_FIXED_GENERIC	REALTYPE, T_PAD, P_PAD, STATE_COUNT
+#define BEAGLE_CPU_FIXED_TEMPLATE	template <typename REALTYPE, int T_PAD, int P_PAD, int STATE_COUNT>
+
+// transposed matrix rows are padded to a multiple of this many states
+#define BEAGLE_CPU_FIXED_STATE_ALIGN    8
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Native CPU implementation for a state count known at compile time, picked
+ * by BeagleCPUImplFactory for amino acid (20) and codon (61) models.  The
+ * partials kernels transpose each category's matrices once per call, so that
+ * all outputs of a pattern are accumulated together along contiguous matrix
+ * rows, with loop bounds the compiler can unroll and vectorize without
+ * remainders.  Everything else is inherited from BeagleCPUImpl.
+ */
+BEAGLE_CPU_FIXED_TEMPLATE
+class BeagleCPUFixedStateImpl : public BeagleCPUImpl<BEAGLE_CPU_GENERIC> {
+
+protected:
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kCategoryCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kStateCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kMatrixSize;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::scalingExponentThreshold;
+
+    // matrix rows hold the states plus T_PAD ambiguity columns
+    static const int kTransStates = STATE_COUNT + T_PAD;
+    static const int kPartialsStates = STATE_COUNT + P_PAD;
+    // transposed matrix rows, zero past the last state
+    static const int kAlignedStates = ((STATE_COUNT + BEAGLE_CPU_FIXED_STATE_ALIGN - 1) /
+                                       BEAGLE_CPU_FIXED_STATE_ALIGN) * BEAGLE_CPU_FIXED_STATE_ALIGN;
+
+public:
+    virtual ~BeagleCPUFixedStateImpl();
+
+    virtual const char* getName();
+
+    virtual void calcStatesPartials(REALTYPE* destP,
+                                    const int* states1,
+                                    const REALTYPE* matrices1,
+                                    const REALTYPE* partials2,
+                                    const REALTYPE* matrices2,
+                                    int startPattern,
+                                    int endPattern);
+
+    virtual void calcPartialsPartials(REALTYPE* destP,
+                                      const REALTYPE* partials1,
+                                      const REALTYPE* matrices1,
+                                      const REALTYPE* partials2,
+                                      const REALTYPE* matrices2,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcStatesPartialsFixedScaling(REALTYPE* destP,
+                                                const int* child0States,
+                                                const REALTYPE* child0TransMat,
+                                                const REALTYPE* child1Partials,
+                                                const REALTYPE* child1TransMat,
+                                                const REALTYPE* scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
+
+    virtual void calcPartialsPartialsFixedScaling(REALTYPE* destP,
+                                                  const REALTYPE* child0Partials,
+                                                  const REALTYPE* child0TransMat,
+                                                  const REALTYPE* child1Partials,
+                                                  const REALTYPE* child1TransMat,
+                                                  const REALTYPE* scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
+
+    virtual void calcPartialsPartialsAutoScaling(REALTYPE* destP,
+                                                 const REALTYPE* child0Partials,
+                                                 const REALTYPE* child0TransMat,
+                                                 const REALTYPE* child1Partials,
+                                                 const REALTYPE* child1TransMat,
+                                                 int* activateScaling);
+
+private:
+    // Copies the matrix of one category into kTransStates rows of
+    // kAlignedStates columns, zero past the last state
+    inline void transposeMatrix(const REALTYPE* matrix,
+                                REALTYPE* transposed);
+
+    // Shared body of the partials kernels; with STATES1 the first child is a
+    // tip given by states1, with SCALED every pattern is divided by its factor
+    template <bool STATES1, bool SCALED>
+    void calcPartialsFixed(REALTYPE* destP,
+                           const int* states1,
+                           const REALTYPE* partials1,
+                           const REALTYPE* matrices1,
+                           const REALTYPE* partials2,
+                           const REALTYPE* matrices2,
+                           const REALTYPE* scaleFactors,
+                           int startPattern,
+                           int endPattern);
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+// now include the file containing template function implementations
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.hpp"
+
+#endif // __BeagleCPUFixedStateImpl__
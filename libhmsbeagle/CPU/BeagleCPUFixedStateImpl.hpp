@@ -0,0 +1,236 @@
+/*
+ *  BeagleCPUFixedStateImpl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BEAGLE_CPU_FIXED_STATE_IMPL_HPP
+#define BEAGLE_CPU_FIXED_STATE_IMPL_HPP
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.h"
+
+namespace beagle {
+namespace cpu {
+
+template <typename REALTYPE, int STATE_COUNT>
+inline const char* getBeagleCPUFixedStateName(){ return "CPU-FixedState-Unknown"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateName<double, 20>(){ return "CPU-20State-Double"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateName<float, 20>(){ return "CPU-20State-Single"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateName<double, 61>(){ return "CPU-61State-Double"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateName<float, 61>(){ return "CPU-61State-Single"; };
+
+BEAGLE_CPU_FIXED_TEMPLATE
+BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::~BeagleCPUFixedStateImpl() {
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+const char* BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::getName() {
+    return getBeagleCPUFixedStateName<REALTYPE, STATE_COUNT>();
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesPartials(REALTYPE* destP,
+                                                                           const int* states1,
+                                                                           const REALTYPE* matrices1,
+                                                                           const REALTYPE* partials2,
+                                                                           const REALTYPE* matrices2,
+                                                                           int startPattern,
+                                                                           int endPattern) {
+    calcPartialsFixed<true, false>(destP, states1, NULL, matrices1, partials2, matrices2,
+                                   NULL, startPattern, endPattern);
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartials(REALTYPE* destP,
+                                                                             const REALTYPE* partials1,
+                                                                             const REALTYPE* matrices1,
+                                                                             const REALTYPE* partials2,
+                                                                             const REALTYPE* matrices2,
+                                                                             int startPattern,
+                                                                             int endPattern) {
+    calcPartialsFixed<false, false>(destP, NULL, partials1, matrices1, partials2, matrices2,
+                                    NULL, startPattern, endPattern);
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
+                                                                                       const int* child0States,
+                                                                                       const REALTYPE* child0TransMat,
+                                                                                       const REALTYPE* child1Partials,
+                                                                                       const REALTYPE* child1TransMat,
+                                                                                       const REALTYPE* scaleFactors,
+                                                                                       int startPattern,
+                                                                                       int endPattern) {
+    calcPartialsFixed<true, true>(destP, child0States, NULL, child0TransMat, child1Partials, child1TransMat,
+                                  scaleFactors, startPattern, endPattern);
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartialsFixedScaling(REALTYPE* destP,
+                                                                                         const REALTYPE* child0Partials,
+                                                                                         const REALTYPE* child0TransMat,
+                                                                                         const REALTYPE* child1Partials,
+                                                                                         const REALTYPE* child1TransMat,
+                                                                                         const REALTYPE* scaleFactors,
+                                                                                         int startPattern,
+                                                                                         int endPattern) {
+    calcPartialsFixed<false, true>(destP, NULL, child0Partials, child0TransMat, child1Partials, child1TransMat,
+                                   scaleFactors, startPattern, endPattern);
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartialsAutoScaling(REALTYPE* destP,
+                                                                                        const REALTYPE* child0Partials,
+                                                                                        const REALTYPE* child0TransMat,
+                                                                                        const REALTYPE* child1Partials,
+                                                                                        const REALTYPE* child1TransMat,
+                                                                                        int* activateScaling) {
+    calcPartialsFixed<false, false>(destP, NULL, child0Partials, child0TransMat, child1Partials, child1TransMat,
+                                    NULL, 0, kPatternCount);
+
+    if (*activateScaling != 0)
+        return;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const REALTYPE* destPtr = destP + l * kPartialsStates * kPatternCount;
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < STATE_COUNT; i++) {
+                int expTmp;
+                frexp(destPtr[i], &expTmp);
+                if (abs(expTmp) > scalingExponentThreshold) {
+                    *activateScaling = 1;
+                    return;
+                }
+            }
+            destPtr += kPartialsStates;
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::transposeMatrix(const REALTYPE* matrix,
+                                                                        REALTYPE* transposed) {
+    for (int j = 0; j < kTransStates; j++) {
+        REALTYPE* row = transposed + j * kAlignedStates;
+        for (int i = 0; i < STATE_COUNT; i++)
+            row[i] = matrix[i * kTransStates + j];
+        for (int i = STATE_COUNT; i < kAlignedStates; i++)
+            row[i] = 0.0;
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+template <bool STATES1, bool SCALED>
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsFixed(REALTYPE* destP,
+                                                                          const int* states1,
+                                                                          const REALTYPE* partials1,
+                                                                          const REALTYPE* matrices1,
+                                                                          const REALTYPE* partials2,
+                                                                          const REALTYPE* matrices2,
+                                                                          const REALTYPE* scaleFactors,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+    const int kTransposedSize = kTransStates * kAlignedStates;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        std::vector<REALTYPE> transposed(2 * kTransposedSize);
+        REALTYPE* transposed1 = &transposed[0];
+        REALTYPE* transposed2 = &transposed[kTransposedSize];
+        transposeMatrix(matrices1 + l * kMatrixSize, transposed1);
+        transposeMatrix(matrices2 + l * kMatrixSize, transposed2);
+
+        int v = l * kPartialsStates * kPatternCount + kPartialsStates * startPattern;
+        const REALTYPE* partials1Ptr = (STATES1 ? NULL : &partials1[v]);
+        const REALTYPE* partials2Ptr = &partials2[v];
+        REALTYPE* destPtr = &destP[v];
+
+        for (int k = startPattern; k < endPattern; k++) {
+            // every output of the pattern is accumulated at once, one whole
+            // transposed row per child state, so the inner loop runs over
+            // contiguous memory with a trip count known at compile time
+            REALTYPE sum1[kAlignedStates];
+            REALTYPE sum2[kAlignedStates];
+            for (int i = 0; i < kAlignedStates; i++) {
+                sum1[i] = 0.0;
+                sum2[i] = 0.0;
+            }
+
+            for (int j = 0; j < STATE_COUNT; j++) {
+                const REALTYPE* row2 = transposed2 + j * kAlignedStates;
+                const REALTYPE p2 = partials2Ptr[j];
+                if (STATES1) {
+                    for (int i = 0; i < kAlignedStates; i++)
+                        sum2[i] += row2[i] * p2;
+                } else {
+                    const REALTYPE* row1 = transposed1 + j * kAlignedStates;
+                    const REALTYPE p1 = partials1Ptr[j];
+                    for (int i = 0; i < kAlignedStates; i++) {
+                        sum1[i] += row1[i] * p1;
+                        sum2[i] += row2[i] * p2;
+                    }
+                }
+            }
+
+            // a tip picks one row of the transposed matrix, which holds its
+            // column of transition probabilities; gaps pick the padding column
+            const REALTYPE* product1 = (STATES1 ? transposed1 + states1[k] * kAlignedStates : sum1);
+            if (SCALED) {
+                const REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+                for (int i = 0; i < STATE_COUNT; i++)
+                    destPtr[i] = product1[i] * sum2[i] * oneOverScaleFactor;
+            } else {
+                for (int i = 0; i < STATE_COUNT; i++)
+                    destPtr[i] = product1[i] * sum2[i];
+            }
+
+            for (int pad = 0; pad < P_PAD; pad++)
+                destPtr[STATE_COUNT + pad] = 0.0;
+
+            if (!STATES1)
+                partials1Ptr += kPartialsStates;
+            partials2Ptr += kPartialsStates;
+            destPtr += kPartialsStates;
+        }
+    }
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // BEAGLE_CPU_FIXED_STATE_IMPL_HPP
@@ -35,6 +35,12 @@
 #include "libhmsbeagle/BeagleImpl.h"
 #include "libhmsbeagle/CPU/Precision.h"
 #include "libhmsbeagle/CPU/EigenDecomposition.h"
+#include "libhmsbeagle/CPU/BeagleCPUThreadPool.h"
+#include "libhmsbeagle/CPU/BeagleCPUBufferArena.h"
+#include "libhmsbeagle/CPU/BeagleCPUResidentPartials.h"
+#include "libhmsbeagle/TransitionMatrixCache.h"
+#include "libhmsbeagle/MatrixExponential.h"
+#include "libhmsbeagle/BufferVersions.h"
 
 #include <vector>
 #include <thread>
@@ -43,6 +49,10 @@
 #include <condition_variable>
 #include <mutex>
 #include <functional>
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <cstdio>
 
 #define BEAGLE_CPU_GENERIC	REALTYPE, T_PAD, P_PAD
 #define BEAGLE_CPU_TEMPLATE	template <typename REALTYPE, int T_PAD, int P_PAD>
@@ -54,11 +64,33 @@
 #define T_PAD_DEFAULT   1   // Pad transition matrix rows with an extra 1.0 for ambiguous characters
 #define P_PAD_DEFAULT   0   // No partials padding necessary for non-SSE implementations
 
-//  TODO: assess following cut-offs dynamically
+//  default cut-offs, calibrateCPUThreadCount measures them for the running machine
 #define BEAGLE_CPU_ASYNC_HW_THREAD_COUNT_THRESHOLD     16  // CPU category threshold
 #define BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT_LOW        256  // do not use CPU auto-threading for problems with fewer patterns on CPUs with many cores
 #define BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT_HIGH       768  // do not use CPU auto-threading for problems with fewer patterns on CPUs with few cores
 #define BEAGLE_CPU_ASYNC_LIMIT_PATTERN_COUNT       262144  // do not use all CPU cores for problems with fewer patterns
+#define BEAGLE_CPU_CATEGORY_PARALLEL_MIN_COUNT          8  // do not spread the categories of an operation across threads with fewer categories
+#define BEAGLE_CPU_CATEGORY_PARALLEL_PATTERN_RATIO     32  // spread categories across threads only with fewer patterns per category
+#define BEAGLE_CPU_CATEGORY_PARALLEL_MIN_WORK      262144  // do not spread operations with fewer multiply-adds across threads
+#define BEAGLE_CPU_REORDER_PARALLEL_MIN_WORK       262144  // do not spread the reordering of fewer tip values across threads
+#define BEAGLE_CPU_OPENMP_MIN_WORK                 131072  // do not spread operations with fewer multiply-adds across an OpenMP team
+#define BEAGLE_CPU_OPENMP_BLOCKS_PER_THREAD             4  // pattern blocks per OpenMP thread, so that dynamic schedules can balance
+
+// factories built with OpenMP, as in the OpenMP plugin, offer pattern-level OpenMP threading
+#ifdef _OPENMP
+#define BEAGLE_CPU_OPENMP_THREADING_FLAG    BEAGLE_FLAG_THREADING_OPENMP
+#else
+#define BEAGLE_CPU_OPENMP_THREADING_FLAG    0
+#endif
+
+#define BEAGLE_CPU_SITE_REPEATS_PATTERNS_PER_CLASS      4  // compute partials by site repeats with at least this many patterns per class
+#define BEAGLE_CPU_INTERLEAVED_PATTERNS                 16 // patterns computed side by side by the interleaved partials kernel
+#define BEAGLE_CPU_ROOT_BLOCK_PATTERNS                  256 // patterns of root partials computed and integrated at a time when fused
+
+// instance state files begin with this tag and format version
+#define BEAGLE_CPU_STATE_MAGIC          "BGLSTATE"
+#define BEAGLE_CPU_STATE_VERSION        1
+#define BEAGLE_CPU_STATE_BUFFER_SIZE    (1 << 20) // bytes buffered by the stdio stream of a state file
 
 namespace beagle {
 namespace cpu {
@@ -71,6 +103,7 @@ protected:
     ///   (we don't really need this field)
     int kTipCount; /// after initialize this will be tipStates.size()
     ///   (we don't really need this field, but it is handy)
+    int kCompactBufferCount; /// tips that may be held as compact states
     int kPatternCount; /// the number of data patterns in each partial and tipStates element
     int kPaddedPatternCount; /// the number of data patterns padded to be a multiple of 2 or 4
     int kExtraPatterns; /// kPaddedPatternCount - kPatternCount
@@ -103,9 +136,9 @@ protected:
     double** gCategoryRates; // Kept in double-precision until multiplication by edgelength
     double* gPatternWeights;
 
-    int* gPatternPartitions;
+    int* gPatternPartitions; // partition of each pattern, in the stored order
     int* gPatternPartitionsStartPatterns;
-    int* gPatternsNewOrder;
+    int* gPatternsNewOrder; // stored position of each pattern, once patterns are reordered
     
     REALTYPE** gCategoryWeights;
     REALTYPE** gStateFrequencies;
@@ -115,7 +148,29 @@ protected:
     //      memory management less error prone
     REALTYPE** gPartials;
     int** gTipStates;
+    // the tip states packed kTipStateBits to a byte, low bits first, used in place of
+    // gTipStates while enabled by setTipStatesPacking
+    bool kPackedTipStates;
+    int kTipStateBits;
+    unsigned char** gPackedTipStates;
     REALTYPE** gScaleBuffers;
+    // rescaling by powers of two while enabled by setPowerOfTwoScaling
+    bool kPowerOfTwoScaling;
+    // while enabled by setMixedPrecision, every scale buffer has a double copy in which
+    // cumulative factors are summed, and site log likelihoods are completed in double
+    bool kMixedPrecision;
+    std::vector<std::vector<double> > gMixedScaleBuffers;
+    std::vector<double> gMixedLogLikelihoods;
+    // patterns whose largest partial is at least kScalingThreshold are left unscaled, zero
+    // when disabled; with it, whether each scale buffer holds any factor other than one
+    double kScalingThreshold;
+    // when set by setCPUPatternTiling, serial updates run blocks of this many patterns through
+    // the whole operation list in turn; zero when disabled
+    int kPatternBlockSize;
+    // when set by setCPUInterleavedPatterns, partials are computed BEAGLE_CPU_INTERLEAVED_PATTERNS
+    // patterns at a time from state-major copies of their children, see calcPartialsInterleaved
+    bool kInterleavedPatterns;
+    std::vector<char> gScaleBufferWritten;
     
     signed short** gAutoScaleBuffers;
     
@@ -126,7 +181,57 @@ protected:
     //  into a single array
     REALTYPE** gTransitionMatrices;
 
+    // NULL unless enabled by setCPUBufferArena; then holds the partials, transition matrix
+    // and scale buffers, with a slot kept for each partials buffer not yet allocated. An
+    // arena set up by setCPUScratchFile is file-backed and holds the partials only, and
+    // updates prefetch the buffers of the operations kScratchPrefetchDistance ahead
+    BufferArena* gBufferArena;
+    std::vector<REALTYPE*> gArenaPartials;
+    int kScratchPrefetchDistance;
+
+    // while enabled by setLazyBufferAllocation, the internal partials and scale buffers not
+    // yet written share these zero-filled buffers and get memory of their own when committed
+    bool kLazyBuffers;
+    REALTYPE* gUnwrittenPartials;
+    REALTYPE* gUnwrittenScaleBuffer;
+
+    // while enabled by setPartialsCheckpointing, internal partials buffers beyond
+    // kMaxResidentPartials are evicted back to gUnwrittenPartials, least recently used first,
+    // and recomputed from the operation that last wrote them when they are read again
+    int kMaxResidentPartials;
+    ResidentPartials* gResidentPartials;
+    std::vector<char> gEvictedPartials;
+    REALTYPE* gRecomputeScaleBuffer;
+
+    // NULL unless enabled by setTransitionMatrixCache
+    TransitionMatrixCache* gMatrixCache;
+    std::vector<int> gMatrixCacheMisses;
+
+    // NULL unless enabled by setBufferVersioning
+    BufferVersions* gBufferVersions;
+    std::vector<int> gDirtyOperations;
+
+    // the site repeat class of each pattern of each partials buffer, empty when unknown;
+    // compact tips use their states instead. Kept while enabled by setSiteRepeats, with a
+    // stamp that changes with the classes, and the children and their stamps they were
+    // combined from.
+    bool kSiteRepeats;
+    std::vector<std::vector<int> > gSiteRepeatClasses;
+    std::vector<int> gSiteRepeatClassCounts;
+    std::vector<unsigned long long> gSiteRepeatStamps;
+    std::vector<unsigned long long> gSiteRepeatInputs;
+    unsigned long long kSiteRepeatStamp;
+    std::vector<int> gSiteRepeatPairs;
+
+    // whether each pattern of each partials buffer is missing from every tip below it, empty
+    // when unknown or when no pattern is; kept while enabled by setGapPatternSkipping
+    bool kGapPatternSkipping;
+    std::vector<std::vector<char> > gGapPatterns;
+
     REALTYPE* integrationTmp;
+    // root partials computed by updatePartialsAndCalculateRootLogLikelihood, one block of
+    // patterns at a time; allocated on first use
+    REALTYPE* gRootPartialsScratch;
     REALTYPE* firstDerivTmp;
     REALTYPE* secondDerivTmp;
     
@@ -137,27 +242,37 @@ protected:
     REALTYPE* ones;
     REALTYPE* zeros;
 
-    struct threadData
-    {
-        std::thread t; // The thread object
-        std::queue<std::packaged_task<void()>> jobs; // The job queue
-        std::condition_variable cv; // The condition variable to wait for threads
-        std::mutex m; // Mutex used for avoiding data races
-        bool stop = false; // When set, this flag tells the thread that it should exit
-    };
-
     int kNumThreads;
     bool kThreadingEnabled;
     bool kAutoPartitioningEnabled;
     bool kAutoRootPartitioningEnabled;
 
-    threadData* gThreads;
-    int** gThreadOperations;
-    int* gThreadOpCounts;
+    bool kSharedThreadPool;
+    bool kNumaPlacement;
+    int kThreadSpinMicroseconds;
+    bool kParallelOperations;
+    int kOperationThreadCount;
+    int kOpenMPThreadCount;
+
+    std::shared_ptr<ThreadPool> gThreadPool;
+    TraceRecorder* gTrace;
+    int** gPartitionOperations;
+    int* gPartitionOpCounts;
+
+    // a range of the patterns of one partition and the worker it is queued on
+    struct PartitionPiece {
+        int partition;
+        int startPattern;
+        int endPattern;
+        int worker;
+    };
+    std::vector<PartitionPiece> gPartitionSchedule;
+    int kPartitionScheduleThreads;  // pool size gPartitionSchedule was built for, 0 if none
+    std::vector<int> gOperationLastWriters;
+    std::vector<std::vector<int> > gOperationReaders;
     int* gAutoPartitionOperations;
     int* gAutoPartitionIndices;
     double* gAutoPartitionOutSumLogLikelihoods;
-    std::shared_future<void>* gFutures;
 
 public:
     virtual ~BeagleCPUImpl();
@@ -177,11 +292,61 @@ public:
                        long preferenceFlags,
                        long requirementFlags);
 
+    // Bytes createInstance allocates for these arguments, counting the
+    // partials of tips that are not compact as they are set later
+    static long long getInstanceBytes(int tipCount,
+                                      int partialsBufferCount,
+                                      int compactBufferCount,
+                                      int stateCount,
+                                      int patternCount,
+                                      int eigenDecompositionCount,
+                                      int matrixCount,
+                                      int categoryCount,
+                                      int scaleBufferCount,
+                                      long preferenceFlags,
+                                      long requirementFlags);
+
     // initialization of instance,  returnInfo can be null
     int getInstanceDetails(BeagleInstanceDetails* returnInfo);
 
     int setCPUThreadCount(int threadCount);
 
+    int setCPUThreadPool(std::shared_ptr<ThreadPool> threadPool);
+
+    void setTrace(TraceRecorder* trace);
+
+    int calibrateCPUThreadCount();
+
+    int setCPUNumaPlacement(bool enable);
+
+    int setCPUThreadSpin(int spinMicroseconds);
+
+    int setCPUBufferArena(bool enable,
+                          long hugePageSize);
+
+    int setCPUScratchFile(const char* directory,
+                          int prefetchDistance);
+
+    int setLazyBufferAllocation(bool enable);
+
+    int setCPUPatternTiling(int patternBlockSize);
+
+    int setCPUInterleavedPatterns(bool enable);
+
+    int setPartialsCheckpointing(int maxResidentBuffers);
+
+    int setCPUParallelOperations(bool enable);
+
+    int setTransitionMatrixCache(bool enable);
+
+    int setBufferVersioning(bool enable);
+
+    int setPowerOfTwoScaling(bool enable);
+
+    int setScalingThreshold(double threshold);
+
+    int setMixedPrecision(bool enable);
+
     // set the states for a given tip
     //
     // tipIndex the index of the tip
@@ -189,6 +354,8 @@ public:
     int setTipStates(int tipIndex,
                      const int* inStates);
 
+    int setTipStatesPacking(bool enable);
+
     // set the partials for a given tip
     //
     // tipIndex the index of the tip
@@ -223,6 +390,10 @@ public:
     
     int setPatternWeights(const double* inPatternWeights); 
 
+    int setSiteRepeats(bool enable);
+
+    int setGapPatternSkipping(bool enable);
+
     int setPatternPartitions(int partitionCount,
                              const int* inPatternPartitions);
     
@@ -255,6 +426,13 @@ public:
             const int* resultIndices,
             int count);
 
+    // multiplies each chain of matrices into its result in one pass, across threads if enabled
+    int convolveTransitionMatrixChains(const int* chainIndices,
+                                       const int* chainLengths,
+                                       const int* scratchIndices,
+                                       const int* resultIndices,
+                                       int chainCount);
+
     // calculate a transition probability matrices for a given list of node. This will
     // calculate for all categories (and all matrices if more than one is being used).
     //
@@ -284,6 +462,34 @@ public:
                                                    const double* edgeLengths,
                                                    int count);
 
+    // exponentiates the rate matrix directly for each edge length and category rate
+    int updateTransitionMatricesWithRateMatrix(const double* inRateMatrix,
+                                               const int* probabilityIndices,
+                                               const double* edgeLengths,
+                                               int count);
+
+    int updateTransitionMatrixDerivativesWithRateMatrix(const double* inRateMatrix,
+                                                        const double* inRateMatrixDerivative,
+                                                        const int* derivativeIndices,
+                                                        const double* edgeLengths,
+                                                        int count);
+
+    // sets exp(Q r t), or its derivative for a non-NULL inRateMatrixDerivative, for each edge
+    // length t and category rate r
+    int exponentiateRateMatrix(const double* inRateMatrix,
+                               const double* inRateMatrixDerivative,
+                               const int* matrixIndices,
+                               const double* edgeLengths,
+                               int count);
+
+    // one eigen decomposition and edge length per replicate, each replicate owning an equal
+    // block of the categories
+    int updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                              const int* probabilityIndices,
+                                              const double* edgeLengths,
+                                              int count,
+                                              int replicateCount);
+
     // calculate or queue for calculation partials using an array of operations
     //
     // operations an array of triplets of indices: the two source partials and the destination
@@ -297,6 +503,14 @@ public:
     int updatePartialsByPartition(const int* operations,
                                   int operationCount);
 
+    int setRootPrePartials(const int* bufferIndices,
+                           const int* stateFrequenciesIndices,
+                           int count);
+
+    int updatePrePartials(const int* operations,
+                          int operationCount,
+                          int cumulativeScalingIndex);
+
     // Block until all calculations that write to the specified partials have completed.
     //
     // This function is optional and only has to be called by clients that "recycle" partials.
@@ -353,6 +567,22 @@ public:
                                     int count,
                                     double* outSumLogLikelihood);
 
+    int calculateRootLogLikelihoodsWithPatternWeights(const int* bufferIndices,
+                                                      const int* categoryWeightsIndices,
+                                                      const int* stateFrequenciesIndices,
+                                                      const int* cumulativeScaleIndices,
+                                                      int count,
+                                                      const double* inPatternWeights,
+                                                      int weightVectorCount,
+                                                      double* outSumLogLikelihoods);
+
+    int calculateRootLogLikelihoodsForReplicates(int bufferIndex,
+                                                 int categoryWeightsIndex,
+                                                 const int* stateFrequenciesIndices,
+                                                 int cumulativeScaleIndex,
+                                                 int replicateCount,
+                                                 double* outSumLogLikelihoods);
+
     int calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
                                                const int* categoryWeightsIndices,
                                                const int* stateFrequenciesIndices,
@@ -363,6 +593,14 @@ public:
                                                double* outSumLogLikelihoodByPartition,
                                                double* outSumLogLikelihood);
 
+    int updatePartialsAndCalculateRootLogLikelihood(const int* operations,
+                                                    int operationCount,
+                                                    int cumulativeScaleIndex,
+                                                    int categoryWeightsIndex,
+                                                    int stateFrequenciesIndex,
+                                                    bool writeRootPartials,
+                                                    double* outSumLogLikelihood);
+
     // possible nulls: firstDerivativeIndices, secondDerivativeIndices,
     //                 outFirstDerivatives, outSecondDerivatives
     int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
@@ -378,6 +616,19 @@ public:
                                     double* outSumFirstDerivative,
                                     double* outSumSecondDerivative);
 
+    int calculateEdgeSiteLogLikelihoods(const int* parentBufferIndices,
+                                        const int* childBufferIndices,
+                                        const int* probabilityIndices,
+                                        const int* firstDerivativeIndices,
+                                        const int* secondDerivativeIndices,
+                                        const int* categoryWeightsIndices,
+                                        const int* stateFrequenciesIndices,
+                                        const int* cumulativeScaleIndices,
+                                        int count,
+                                        double* outSiteLogLikelihoods,
+                                        double* outSiteFirstDerivatives,
+                                        double* outSiteSecondDerivatives);
+
     int calculateEdgeLogLikelihoodsByPartition(const int* parentBufferIndices,
                                                const int* childBufferIndices,
                                                const int* probabilityIndices,
@@ -395,6 +646,37 @@ public:
                                                double* outSumFirstDerivative,
                                                double* outSumSecondDerivativeByPartition,
                                                double* outSumSecondDerivative);
+
+    int calculateParameterDerivatives(const int* postBufferIndices,
+                                      const int* preBufferIndices,
+                                      const int* probabilityIndices,
+                                      const int* derivativeIndices,
+                                      const int* categoryWeightsIndices,
+                                      int count,
+                                      int parameterCount,
+                                      double* outSumDerivatives);
+
+    int calculateEdgeDerivatives(const int* postBufferIndices,
+                                 const int* preBufferIndices,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 const int* categoryWeightsIndices,
+                                 int count,
+                                 double* outDerivatives,
+                                 double* outSumDerivatives);
+
+    int calculateEdgeLogLikelihoodsForMatrices(int parentBufferIndex,
+                                               int childBufferIndex,
+                                               const int* probabilityIndices,
+                                               const int* firstDerivativeIndices,
+                                               const int* secondDerivativeIndices,
+                                               int categoryWeightsIndex,
+                                               int stateFrequenciesIndex,
+                                               int cumulativeScaleIndex,
+                                               int matrixCount,
+                                               double* outSumLogLikelihoods,
+                                               double* outSumFirstDerivatives,
+                                               double* outSumSecondDerivatives);
     
     int getLogLikelihood(double* outSumLogLikelihood);
 
@@ -408,6 +690,19 @@ public:
 
     int block(void);
 
+    virtual int reset();
+
+    virtual int grow(int tipCount,
+                     int partialsBufferCount,
+                     int compactBufferCount,
+                     int patternCount,
+                     int matrixBufferCount,
+                     int scaleBufferCount);
+
+    virtual int saveState(const char* fileName);
+
+    virtual int loadState(const char* fileName);
+
 	virtual const char* getName();
 
 	virtual const long getFlags();
@@ -418,6 +713,37 @@ protected:
                            int operationCount,
                            int cumulativeScalingIndex);
 
+    // as upPartials, but only for patterns startPattern to endPattern, and only within the
+    // partition of each operation when byPartition
+    int upPartialsRange(bool byPartition,
+                        const int* operations,
+                        int operationCount,
+                        int cumulativeScalingIndex,
+                        int rangeStartPattern,
+                        int rangeEndPattern);
+
+    // runs the operations one block of kPatternBlockSize patterns at a time
+    int upPartialsTiled(const int* operations,
+                        int operationCount,
+                        int cumulativeScalingIndex);
+
+    bool usePatternTiling();
+
+    // runs each operation with its categories spread across the workers, and rescales after
+    int upPartialsByCategoryAsync(const int* operations,
+                                  int operationCount,
+                                  int cumulativeScalingIndex);
+
+    bool useCategoryParallel();
+
+    // runs every operation inside one OpenMP team, each thread on its own pattern blocks
+    int upPartialsOpenMP(bool byPartition,
+                         const int* operations,
+                         int operationCount,
+                         int cumulativeScalingIndex);
+
+    bool useOpenMPPatterns();
+
     virtual void autoPartitionPartialsOperations(const int* operations,
                                                  int* partitionOperations,
                                                  int count,
@@ -426,6 +752,17 @@ protected:
     virtual int upPartialsByPartitionAsync(const int* operations,
                                            int operationCount);
 
+    // spreads the partitions over threadCount workers by their estimated cost
+    void schedulePartitions(int threadCount);
+
+    virtual int upPartialsByDependencyAsync(bool byPartition,
+                                            const int* operations,
+                                            int operationCount,
+                                            int cumulativeScaleIndex);
+
+    // moves the patterns of the tips and the pattern weights so that each partition is
+    // contiguous, again whenever the partitions change; only the range of patterns that
+    // changes place is moved
     virtual int reorderPatternsByPartition();
 
     virtual void calcStatesStates(REALTYPE* destP,
@@ -453,12 +790,123 @@ protected:
                                       int startPattern,
                                       int endPattern);
 
+    // Computes the same partials as calcStatesPartials or calcPartialsPartials, with states1
+    // NULL for the latter. Each group of BEAGLE_CPU_INTERLEAVED_PATTERNS patterns is copied
+    // state-major so that the innermost loop runs across patterns, and so fills the vector
+    // units whatever the state count; gPartials keeps its usual layout.
+    void calcPartialsInterleaved(REALTYPE* destP,
+                                 const int* states1,
+                                 const REALTYPE* partials1,
+                                 const REALTYPE* matrices1,
+                                 const REALTYPE* partials2,
+                                 const REALTYPE* matrices2,
+                                 int startPattern,
+                                 int endPattern);
+
+    // Computes the patterns in [startPattern, endPattern) that are not gaps, and sets those
+    // that are to one. states1 and states2 are NULL for children with partials.
+    void calcPartialsSkippingGaps(REALTYPE* destP,
+                                  const char* gaps,
+                                  const int* states1,
+                                  const REALTYPE* partials1,
+                                  const REALTYPE* matrices1,
+                                  const int* states2,
+                                  const REALTYPE* partials2,
+                                  const REALTYPE* matrices2,
+                                  int startPattern,
+                                  int endPattern);
+
+    // Computes all patterns of the categories in [startCategory, endCategory). states1 and
+    // states2 are NULL for children with partials.
+    void calcPartialsCategoryRange(REALTYPE* destP,
+                                   const int* states1,
+                                   const REALTYPE* partials1,
+                                   const REALTYPE* matrices1,
+                                   const int* states2,
+                                   const REALTYPE* partials2,
+                                   const REALTYPE* matrices2,
+                                   int startCategory,
+                                   int endCategory);
+
+    // Computes the first pattern of each of the classCount site repeat classes in classes,
+    // and copies it to the other patterns of the class. states1 and states2 are NULL for
+    // children with partials.
+    void calcPartialsSiteRepeats(REALTYPE* destP,
+                                 const int* classes,
+                                 int classCount,
+                                 const int* states1,
+                                 const REALTYPE* partials1,
+                                 const REALTYPE* matrices1,
+                                 const int* states2,
+                                 const REALTYPE* partials2,
+                                 const REALTYPE* matrices2);
+
+    // Computes the pre-order partials of a node from those of its parent, taken through the
+    // transpose of parentMatrices unless it is NULL, and the post-order partials of its
+    // sibling, or its states if siblingPartials is NULL; divides by scaleFactors unless NULL
+    void calcPrePartials(REALTYPE* destP,
+                         const REALTYPE* parentPartials,
+                         const REALTYPE* parentMatrices,
+                         const int* siblingStates,
+                         const REALTYPE* siblingPartials,
+                         const REALTYPE* siblingMatrices,
+                         const REALTYPE* scaleFactors);
+
+    // Computes the site derivatives of the log likelihood along one edge for each of
+    // derivativeCount derivative matrices into outDerivatives, kPatternCount per matrix, and
+    // their sums over the weighted patterns into outSumDerivatives; the likelihood of each
+    // pattern is integrated once for all of them
+    void calcEdgeDerivatives(const int* postStates,
+                             const REALTYPE* postPartials,
+                             const REALTYPE* prePartials,
+                             const REALTYPE* matrices,
+                             const REALTYPE* const* derivativeMatrices,
+                             int derivativeCount,
+                             const REALTYPE* categoryWeights,
+                             double* outDerivatives,
+                             double* outSumDerivatives);
+
+    // Integrates the parent partials against the child states, or the child partials if
+    // childStates is NULL, through each of matrixCount sets of matrices, reading each pattern
+    // of the partials once; derivative lists may be NULL, as may scalingFactorsIndex be
+    // BEAGLE_OP_NONE
+    void calcEdgeLogLikelihoodsForMatrices(const REALTYPE* parentPartials,
+                                           const int* childStates,
+                                           const REALTYPE* childPartials,
+                                           const REALTYPE** matrices,
+                                           const REALTYPE** firstDerivativeMatrices,
+                                           const REALTYPE** secondDerivativeMatrices,
+                                           const REALTYPE* categoryWeights,
+                                           const REALTYPE* stateFrequencies,
+                                           int scalingFactorsIndex,
+                                           int matrixCount,
+                                           double* outSumLogLikelihoods,
+                                           double* outSumFirstDerivatives,
+                                           double* outSumSecondDerivatives);
+
     virtual int calcRootLogLikelihoods(const int bufferIndex,
                                         const int categoryWeightsIndex,
                                         const int stateFrequenciesIndex,
                                         const int scaleBufferIndex,
                                         double* outSumLogLikelihood);
 
+    // Integrates the partials that operation would write at the root, computing them into
+    // gRootPartialsScratch one block of patterns at a time so that each block is still in
+    // cache when it is integrated
+    int calcRootLogLikelihoodsFromChildren(const int* operation,
+                                           const int categoryWeightsIndex,
+                                           const int stateFrequenciesIndex,
+                                           const int scaleBufferIndex,
+                                           double* outSumLogLikelihood);
+
+    // Sets outLogLikelihoodsTmp to the log of the site likelihoods of the patterns from
+    // startPattern to endPattern of rootPartials, before scaling
+    virtual void integrateRootPartials(const REALTYPE* rootPartials,
+                                       const REALTYPE* wt,
+                                       const REALTYPE* freqs,
+                                       int startPattern,
+                                       int endPattern);
+
     virtual void calcRootLogLikelihoodsByPartitionAsync(const int* bufferIndices,
                                                        const int* categoryWeightsIndices,
                                                        const int* stateFrequenciesIndices,
@@ -606,7 +1054,8 @@ protected:
                                                   const REALTYPE* matrices2,
                                                   int* activateScaling);
 
-    virtual void rescalePartials(REALTYPE *destP,
+    // returns whether any pattern was scaled by a factor other than one
+    virtual bool rescalePartials(REALTYPE *destP,
     		                     REALTYPE *scaleFactors,
                                  REALTYPE *cumulativeScaleFactors,
                                  const int  fillWithOnes);
@@ -616,15 +1065,241 @@ protected:
                                             REALTYPE *cumulativeScaleFactors,
                                             const int fillWithOnes,
                                             const int partitionIndex);
+
+    virtual void rescalePartialsRange(REALTYPE *destP,
+                                      REALTYPE *scaleFactors,
+                                      REALTYPE *cumulativeScaleFactors,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void autoRescalePartials(REALTYPE *destP,
     		                     signed short *scaleFactors);
 
+    // Stores the scale factor of pattern k, whose largest partial is max, and returns the
+    // multiplier that rescales its partials
+    REALTYPE setPatternScaleFactor(REALTYPE max,
+                                   int k,
+                                   REALTYPE* scaleFactors,
+                                   REALTYPE* cumulativeScaleFactors);
+
+    // Adds sign times the logs of the raw power-of-two scale factors in scalingIndices to
+    // cumulativeScaleBuffer over [startPattern, endPattern), summing their exponents
+    void accumulateScaleExponents(const int* scalingIndices,
+                                  int count,
+                                  REALTYPE* cumulativeScaleBuffer,
+                                  int sign,
+                                  int startPattern,
+                                  int endPattern);
+
+    // Whether scale buffer scalingIndex may hold a factor other than one, so that
+    // accumulating or removing it is not a no-op
+    bool isScaleBufferWritten(int scalingIndex);
+
+    // Records whether scale buffer scalingIndex holds any factor other than one
+    void setScaleBufferWritten(int scalingIndex,
+                               bool written);
+
+    // Adds sign times the logs of the factors in scale buffer scalingIndex over
+    // [startPattern, endPattern) to the double copy of cumulativeScalingIndex, if mixed
+    // precision is enabled
+    void accumulateMixedScaleFactors(int scalingIndex,
+                                     int cumulativeScalingIndex,
+                                     int sign,
+                                     int startPattern,
+                                     int endPattern);
+
+    // The log likelihood of pattern k given siteLogLikelihood, that of its rescaled partials,
+    // and the cumulative scale buffer scalingFactorsIndex, which may be BEAGLE_OP_NONE; in
+    // REALTYPE unless mixed precision is enabled
+    double completeSiteLogLikelihood(REALTYPE siteLogLikelihood,
+                                     int scalingFactorsIndex,
+                                     int k) {
+        if (scalingFactorsIndex < 0)
+            return siteLogLikelihood;
+        if (kMixedPrecision)
+            return siteLogLikelihood + gMixedScaleBuffers[scalingFactorsIndex][k];
+        return siteLogLikelihood + gScaleBuffers[scalingFactorsIndex][k];
+    }
+
+    // Completes the site log likelihoods of [startPattern, endPattern) left in
+    // outLogLikelihoodsTmp, or in gMixedLogLikelihoods with mixed precision, and returns
+    // their sum over the weighted patterns
+    double sumSiteLogLikelihoods(int scalingFactorsIndex,
+                                 int startPattern,
+                                 int endPattern);
+
     virtual int getPaddedPatternsModulus();
 
     void* mallocAligned(size_t size);
 
-    void threadWaiting(threadData* tData);
+    ThreadPool* getThreadPool();
+
+    bool useParallelOperations();
+
+    // Copies or skips the matrices of an update without derivatives that gMatrixCache holds,
+    // and stores the positions of the other edges in gMatrixCacheMisses. eigenIndices and
+    // categoryRateIndices are per edge, or NULL for eigenIndex and category rates 0.
+    void findCachedMatrices(int eigenIndex,
+                            const int* eigenIndices,
+                            const int* categoryRateIndices,
+                            const int* probabilityIndices,
+                            const double* edgeLengths,
+                            int count);
+
+    // forgets the cached contents of the count buffers in matrixIndices and gives them new
+    // versions, skipped for NULL
+    void matricesChanged(const int* matrixIndices,
+                         int count);
+
+    // Returns operations without those gBufferVersions finds clean, with their new count in
+    // count. Updates that accumulate into cumulativeScaleIndex, or scale automatically, keep
+    // every operation, whose outputs are only given new versions.
+    const int* removeCleanOperations(const int* operations,
+                                     int& count,
+                                     int cumulativeScaleIndex);
+
+    // true if a buffer holds compact tip states, packed or not
+    bool hasTipStates(int bufferIndex);
+
+    // Returns the compact states of a buffer, or NULL for partials. Packed states are unpacked
+    // into one of two per-thread buffers chosen by slot, valid until that slot is reused.
+    const int* getTipStates(int bufferIndex,
+                            int slot = 0);
+
+    // packs count states, and missing states for the padding patterns, into the buffer of a tip
+    void packTipStates(int tipIndex,
+                       const int* inStates,
+                       int count);
+
+    // Finds the compact state of each pattern of tip partials, missing for all ones; false if
+    // some pattern is neither one-hot nor all ones
+    bool findCompactTipStates(const double* inPartials,
+                              int* outStates);
+
+    // frees the compact states of a tip, packed or not
+    void clearTipStates(int tipIndex);
+
+    // sections of an instance state file, each a tag, buffer index, value count and value size
+    // followed by the values
+    enum StateSection {
+        STATE_END = 0,
+        STATE_PATTERN_WEIGHTS,
+        STATE_CATEGORY_RATES,
+        STATE_CATEGORY_WEIGHTS,
+        STATE_STATE_FREQUENCIES,
+        STATE_TIP_STATES,
+        STATE_PARTIALS,
+        STATE_TRANSITION_MATRIX,
+        STATE_SCALE_BUFFER
+    };
+
+    template<typename T>
+    bool writeStateSection(FILE* file,
+                           int tag,
+                           int index,
+                           const T* values,
+                           int count);
+
+    // reads the values of a section of count values into values, converting them from the
+    // precision they were saved in
+    bool readStateValues(FILE* file,
+                         int valueSize,
+                         int count,
+                         std::vector<double>& values);
+
+    // Returns the site repeat classes of a buffer, with their count in classCount, or NULL
+    // when they are unknown; the classes of a packed tip use getTipStates slot
+    const int* getSiteRepeatClasses(int bufferIndex,
+                                    int& classCount,
+                                    int slot);
+
+    // combines the site repeat classes of the children of each operation into those of its
+    // destination, in operation order, unless neither child has changed
+    void updateSiteRepeats(const int* operations,
+                           int count);
+
+    // forgets the site repeat classes of a buffer written by other means
+    void clearSiteRepeats(int bufferIndex);
+
+    // finds the patterns of a tip whose state is missing or whose partials are all one
+    void findTipGapPatterns(int tipIndex);
+
+    // marks the patterns of the destination of each operation that are gaps in both children
+    void updateGapPatterns(const int* operations,
+                           int count);
+
+    int measurePartitionCount(int maxThreadCount);
+
+    void autoPartitionPatterns(int partitionCount);
+
+    void clearAutoPartitions();
+
+    void placeBuffersByPartition();
+
+    template<typename T>
+    T* placeBufferByPartition(T* buffer, int stride, int blockCount, int blockSize, bool aligned);
+
+    // returns storage for partials buffer bufferIndex, its arena slot while there is one
+    REALTYPE* allocatePartials(int bufferIndex);
+
+    // frees a partials, transition matrix or scale buffer unless it lives in the arena
+    void freeBuffer(void* buffer);
+
+    // moves the partials, transition matrix and scale buffers into arena, or onto the heap
+    // if NULL, and makes it the instance's arena; a file-backed arena takes the partials only
+    void relocateBuffers(BufferArena* arena);
+
+    // asks for the partials read and written by count operations to be read in from the
+    // scratch file
+    void prefetchOperations(const int* operations,
+                            int count,
+                            int numOps);
+
+    template<typename T>
+    T* relocateBuffer(T* buffer, BufferArena* arena, size_t size);
+
+    // a copy of a buffer of blockCount blocks of oldPatternCount patterns padded to
+    // oldPaddedPatternCount, elementSize values each, laid out for the current pattern counts;
+    // the first valueCount values of the patterns added are fill, the rest and the padding zero
+    template<typename T>
+    T* growPatterns(const T* buffer,
+                    int blockCount,
+                    int elementSize,
+                    int valueCount,
+                    T fill,
+                    int oldPatternCount,
+                    int oldPaddedPatternCount);
+
+    bool isUnwrittenBuffer(const void* buffer);
+
+    // give an unwritten partials or scale buffer memory of its own, zero-filled
+    void commitPartials(int bufferIndex);
+
+    void commitScaleBuffer(int scalingIndex);
+
+    // commits the destination, write scale and cumulative scale buffers of count operations of
+    // numOps entries each, before they are run
+    void commitOperationBuffers(const int* operations,
+                                int count,
+                                int numOps,
+                                int cumulativeScaleIndex);
+
+    // recomputes those of the partials buffers that are evicted, keeping the others resident
+    // meanwhile; fails if one of them cannot be recomputed
+    int restorePartials(const int* bufferIndices,
+                        int count);
+
+    int restoreEvictedPartials(int bufferIndex);
+
+    // evicts least recently used partials buffers until no more than kMaxResidentPartials are
+    // resident or none of the others can be recomputed
+    void evictPartials();
+
+    int upPartialsCheckpointed(const int* operations,
+                               int count,
+                               int cumulativeScaleIndex);
+
+    void stopThreads();
 
 };
 
@@ -648,14 +1323,34 @@ public:
 
     virtual const char* getName();
     virtual const long getFlags();
+
+    virtual int estimateMemory(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long long* outHostBytes,
+                               long long* outDeviceBytes);
 };
 
 //typedef BeagleCPUImplGeneral<double> BeagleCPUImpl;
 
+// kernels for a state count fixed at compile time, created by BeagleCPUImplFactory
+template <typename REALTYPE, int T_PAD, int P_PAD, int STATE_COUNT>
+class BeagleCPUFixedStateImpl;
+
 }	// namespace cpu
 }	// namespace beagle
 
 // now that the interface is defined, include the implementation of template functions
 #include "libhmsbeagle/CPU/BeagleCPUImpl.hpp"
 
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.h"
+
 #endif // __BeagleCPUImpl__
@@ -79,13 +79,21 @@
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <cfloat>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/CPU/Precision.h"
 #include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUCalibrationProfile.h"
 #include "libhmsbeagle/CPU/EigenDecompositionCube.h"
 #include "libhmsbeagle/CPU/EigenDecompositionSquare.h"
+#include "libhmsbeagle/CPU/VectorMath.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace beagle {
 namespace cpu {
@@ -139,18 +147,21 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
 
     for(unsigned int i=0; i<kMatrixCount; i++) {
         if (gTransitionMatrices[i] != NULL)
-            free(gTransitionMatrices[i]);
+            freeBuffer(gTransitionMatrices[i]);
     }
     free(gTransitionMatrices);
 
     for(unsigned int i=0; i<kBufferCount; i++) {
         if (gPartials[i] != NULL)
-            free(gPartials[i]);
+            freeBuffer(gPartials[i]);
         if (gTipStates[i] != NULL)
             free(gTipStates[i]);
+        if (gPackedTipStates != NULL && gPackedTipStates[i] != NULL)
+            free(gPackedTipStates[i]);
     }
     free(gPartials);
     free(gTipStates);
+    free(gPackedTipStates);
     
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
@@ -165,7 +176,7 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     } else {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
             if (gScaleBuffers[i] != NULL)
-                free(gScaleBuffers[i]);
+                freeBuffer(gScaleBuffers[i]);
         }        
     }
     
@@ -184,6 +195,7 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     }
 
     free(integrationTmp);
+    free(gRootPartialsScratch);
     free(firstDerivTmp);
     free(secondDerivTmp);
 
@@ -196,38 +208,17 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
 
     delete gEigenDecomposition;
 
-    if (kThreadingEnabled) {
-        // Send stop signal to all threads and join them...
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            std::unique_lock<std::mutex> l(td->m);
-            td->stop = true;
-            td->cv.notify_one();
-        }
-
-        // Join all the threads
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            td->t.join();
-        }
-
-        delete[] gThreads;
-        delete[] gFutures;
+    delete gBufferArena;
+    free(gUnwrittenPartials);
+    free(gUnwrittenScaleBuffer);
+    delete gResidentPartials;
+    free(gRecomputeScaleBuffer);
+    delete gMatrixCache;
+    delete gBufferVersions;
 
-        for (int i=0; i<kNumThreads; i++) {
-            free(gThreadOperations[i]);
-        }
-        free(gThreadOperations);
-        free(gThreadOpCounts);
-    }
+    stopThreads();
 
-    if (kAutoPartitioningEnabled) {
-        free(gAutoPartitionOperations);
-        if (kAutoRootPartitioningEnabled) {
-            free(gAutoPartitionIndices);
-            free(gAutoPartitionOutSumLogLikelihoods);
-        }
-    }
+    clearAutoPartitions();
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -257,6 +248,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     kBufferCount = partialsBufferCount + compactBufferCount;
     kTipCount = tipCount;
+    kCompactBufferCount = compactBufferCount;
     assert(kBufferCount > kTipCount);
     kStateCount = stateCount;
     kPatternCount = patternCount;
@@ -291,6 +283,42 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     
     kFlags = 0;
 
+    kThreadingEnabled = false;
+    kSharedThreadPool = false;
+    gTrace = NULL;
+    kNumaPlacement = false;
+    kThreadSpinMicroseconds = 0;
+    kParallelOperations = false;
+    gBufferArena = NULL;
+    kScratchPrefetchDistance = 0;
+    kLazyBuffers = false;
+    gUnwrittenPartials = NULL;
+    gUnwrittenScaleBuffer = NULL;
+    gRootPartialsScratch = NULL;
+    kMaxResidentPartials = 0;
+    gResidentPartials = NULL;
+    gRecomputeScaleBuffer = NULL;
+    gMatrixCache = NULL;
+    gBufferVersions = NULL;
+    kSiteRepeats = false;
+    kGapPatternSkipping = false;
+    kPackedTipStates = false;
+    kTipStateBits = 0;
+    kPowerOfTwoScaling = false;
+    kMixedPrecision = false;
+    kScalingThreshold = 0.0;
+    kPatternBlockSize = 0;
+    kInterleavedPatterns = false;
+    gPackedTipStates = NULL;
+    kOperationThreadCount = std::thread::hardware_concurrency();
+    if (kOperationThreadCount < 1)
+        kOperationThreadCount = 1;
+#ifdef _OPENMP
+    kOpenMPThreadCount = omp_get_max_threads();
+#else
+    kOpenMPThreadCount = 1;
+#endif
+
     if (preferenceFlags & BEAGLE_FLAG_SCALING_AUTO || requirementFlags & BEAGLE_FLAG_SCALING_AUTO) {
         kFlags |= BEAGLE_FLAG_SCALING_AUTO;
         kFlags |= BEAGLE_FLAG_SCALERS_LOG;
@@ -322,6 +350,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     if (requirementFlags & BEAGLE_FLAG_THREADING_CPP || preferenceFlags & BEAGLE_FLAG_THREADING_CPP)
         kFlags |= BEAGLE_FLAG_THREADING_CPP;
+#ifdef _OPENMP
+    else if (requirementFlags & BEAGLE_FLAG_THREADING_OPENMP || preferenceFlags & BEAGLE_FLAG_THREADING_OPENMP)
+        kFlags |= BEAGLE_FLAG_THREADING_OPENMP;
+#endif
     else
         kFlags |= BEAGLE_FLAG_THREADING_NONE;
     
@@ -367,7 +399,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     }
 
     for (int i = kTipCount; i < kBufferCount; i++) {
-        gPartials[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+        gPartials[i] = allocatePartials(i);
         if (gPartials[i] == NULL)
             throw std::bad_alloc();
     }
@@ -434,7 +466,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     }
 
     kThreadingEnabled = false;
+    kPartitionScheduleThreads = 0;
     kAutoPartitioningEnabled = false;
+    kAutoRootPartitioningEnabled = false;
     if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
         int hardwareThreads = std::thread::hardware_concurrency();
         if (kStateCount <= 4) {
@@ -454,28 +488,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
             if (partitionCount > hardwareThreads/2) {
                 partitionCount = hardwareThreads/2;
             } 
-            int* patternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
-            int partitionSize = kPatternCount/partitionCount;
-            for (int i=0; i<kPatternCount; i++) {
-                int sitePartition = i/partitionSize;
-                if (sitePartition > partitionCount - 1)
-                    sitePartition = partitionCount - 1;
-                patternPartitions[i] = sitePartition;
-            }
-            setPatternPartitions(partitionCount, patternPartitions);
-
-            gAutoPartitionOperations = (int*) malloc(sizeof(int) * kBufferCount * kPartitionCount * BEAGLE_PARTITION_OP_COUNT);
-
-            if (kPatternCount >= kMinPatternCount*4) {
-                gAutoPartitionIndices = (int*) malloc(sizeof(int) * partitionCount);
-                for (int i=0; i<partitionCount; i++) {
-                    gAutoPartitionIndices[i] = i;
-                }
-                gAutoPartitionOutSumLogLikelihoods = (double*) malloc(sizeof(double) * partitionCount);
-                kAutoRootPartitioningEnabled = true;
-            }
-
-            kAutoPartitioningEnabled = true;
+            autoPartitionPatterns(partitionCount);
         }
     }
 
@@ -492,6 +505,60 @@ const long BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getFlags() {
     return getBeagleCPUFlags<BEAGLE_CPU_FACTORY_GENERIC>();
 }
 
+BEAGLE_CPU_TEMPLATE
+long long BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getInstanceBytes(int tipCount,
+                                                              int partialsBufferCount,
+                                                              int compactBufferCount,
+                                                              int stateCount,
+                                                              int patternCount,
+                                                              int eigenDecompositionCount,
+                                                              int matrixCount,
+                                                              int categoryCount,
+                                                              int scaleBufferCount,
+                                                              long preferenceFlags,
+                                                              long requirementFlags) {
+    long flags = preferenceFlags | requirementFlags;
+    long long bufferCount = partialsBufferCount + compactBufferCount;
+    long long internalCount = bufferCount - tipCount;
+    long long tipPartialsCount = tipCount - compactBufferCount;
+    if (tipPartialsCount < 0)
+        tipPartialsCount = 0;
+
+    // every pattern modulus is currently 1, so no padded patterns
+    long long partialsSize = (long long) patternCount * (stateCount + P_PAD) * categoryCount;
+    long long matrixSize = (long long) (stateCount + T_PAD) * stateCount * categoryCount;
+
+    long long bytes = 0;
+    bytes += sizeof(REALTYPE) * partialsSize * (internalCount + tipPartialsCount);
+    bytes += sizeof(int) * (long long) patternCount * compactBufferCount;
+    bytes += sizeof(REALTYPE) * matrixSize * matrixCount;
+
+    if (flags & BEAGLE_FLAG_SCALING_AUTO) {
+        bytes += sizeof(signed short) * (long long) patternCount * internalCount;
+        bytes += sizeof(REALTYPE) * patternCount;
+    } else {
+        if (flags & BEAGLE_FLAG_SCALING_ALWAYS)
+            scaleBufferCount = internalCount + 1;
+        bytes += sizeof(REALTYPE) * (long long) patternCount * scaleBufferCount;
+    }
+
+    // EigenDecompositionSquare keeps two matrices, EigenDecompositionCube
+    // the products of both for every state
+    long long eigenSize = (flags & BEAGLE_FLAG_EIGEN_COMPLEX ?
+                           2LL * stateCount * stateCount + 2 * stateCount :
+                           (long long) stateCount * stateCount * stateCount + stateCount);
+    bytes += sizeof(REALTYPE) * eigenSize * eigenDecompositionCount;
+    bytes += (sizeof(double) + sizeof(REALTYPE)) * categoryCount * eigenDecompositionCount;
+    bytes += sizeof(REALTYPE) * stateCount * eigenDecompositionCount;
+    bytes += sizeof(double) * patternCount;
+
+    // integration and derivative temporaries, zeros and ones
+    bytes += 6 * sizeof(REALTYPE) * (long long) patternCount * stateCount;
+    bytes += 2 * sizeof(REALTYPE) * patternCount;
+
+    return bytes;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getInstanceDetails(BeagleInstanceDetails* returnInfo) {
     if (returnInfo != NULL) {
@@ -511,8 +578,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
     if (threadCount < 1)
         return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    kThreadingEnabled = false;
-    kAutoPartitioningEnabled = false;
+    stopThreads();
+    kOperationThreadCount = threadCount;
+    kOpenMPThreadCount = threadCount;
     if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
         int hardwareThreads = std::thread::hardware_concurrency();
         if (kStateCount <= 4) {
@@ -521,8 +589,6 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
                 kMinPatternCount = BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT_HIGH;
             }
         } else {
-            // todo: assess minimum pattern count for efficient auto-threading
-            //       for higher state-count values
             kMinPatternCount = 2;
         }
         if (kPatternCount >= kMinPatternCount && hardwareThreads > 2) {
@@ -530,29 +596,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
             if (partitionCount > threadCount) {
                 partitionCount = threadCount;
             } 
-
-            int* patternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
-            int partitionSize = kPatternCount/partitionCount;
-            for (int i=0; i<kPatternCount; i++) {
-                int sitePartition = i/partitionSize;
-                if (sitePartition > partitionCount - 1)
-                    sitePartition = partitionCount - 1;
-                patternPartitions[i] = sitePartition;
-            }
-            setPatternPartitions(partitionCount, patternPartitions);
-
-            gAutoPartitionOperations = (int*) malloc(sizeof(int) * kBufferCount * kPartitionCount * BEAGLE_PARTITION_OP_COUNT);
-
-            if (kPatternCount >= kMinPatternCount*4) {
-                gAutoPartitionIndices = (int*) malloc(sizeof(int) * partitionCount);
-                for (int i=0; i<partitionCount; i++) {
-                    gAutoPartitionIndices[i] = i;
-                }
-                gAutoPartitionOutSumLogLikelihoods = (double*) malloc(sizeof(double) * partitionCount);
-                kAutoRootPartitioningEnabled = true;
-            }
-
-            kAutoPartitioningEnabled = true;
+            autoPartitionPatterns(partitionCount);
+        } else {
+            clearAutoPartitions();
         }
     }
 
@@ -560,3246 +606,6961 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
-                                const int* inStates) {
-    if (tipIndex < 0 || tipIndex >= kTipCount)
-        return BEAGLE_ERROR_OUT_OF_RANGE;
-    gTipStates[tipIndex] = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
-    // TODO: What if this throws a memory full error?
-    for (int j = 0; j < kPatternCount; j++) {
-        gTipStates[tipIndex][j] = (inStates[j] < kStateCount ? inStates[j] : kStateCount);
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calibrateCPUThreadCount() {
+
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return BEAGLE_SUCCESS;
+
+    int maxThreadCount = std::thread::hardware_concurrency();
+    if (kSharedThreadPool)
+        maxThreadCount = gThreadPool->getThreadCount();
+
+    std::string key = CalibrationProfile::makeKey(getName(), maxThreadCount, kStateCount,
+                                                  kCategoryCount, kPatternCount);
+
+    int partitionCount = CalibrationProfile::find(key);
+    if (partitionCount == 0) {
+        partitionCount = measurePartitionCount(maxThreadCount);
+        CalibrationProfile::store(key, partitionCount);
     }
-    for (int j = kPatternCount; j < kPaddedPatternCount; j++) {
-        gTipStates[tipIndex][j] = kStateCount;
+
+    stopThreads();
+    if (partitionCount > 1) {
+        autoPartitionPatterns(partitionCount);
+    } else {
+        clearAutoPartitions();
     }
 
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
-                                  const double* inPartials) {
-    if (tipIndex < 0 || tipIndex >= kTipCount)
-        return BEAGLE_ERROR_OUT_OF_RANGE;
-    if(gPartials[tipIndex] == NULL) {
-        gPartials[tipIndex] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
-        // TODO: What if this throws a memory full error?
-        if (gPartials[tipIndex] == 0L)
-            return BEAGLE_ERROR_OUT_OF_MEMORY;
-    }
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUNumaPlacement(bool enable) {
 
-    const double* inPartialsOffset;
-    REALTYPE* tmpRealPartialsOffset = gPartials[tipIndex];
-    for (int l = 0; l < kCategoryCount; l++) {
-        inPartialsOffset = inPartials;
-        for (int i = 0; i < kPatternCount; i++) {
-            beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
-            tmpRealPartialsOffset += kStateCount;
-            // Pad extra buffer with zeros
-            for(int k = kStateCount; k < kPartialsPaddedStateCount; k++) {
-                *tmpRealPartialsOffset++ = 0;
-            }
-            inPartialsOffset += kStateCount;
-        }
-        // Pad extra buffer with zeros
-        for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
-            *tmpRealPartialsOffset++ = 0;
-        }
-    }
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return BEAGLE_SUCCESS;
+
+    // the workers of a shared pool are not owned by this instance
+    if (kSharedThreadPool)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (enable == kNumaPlacement)
+        return BEAGLE_SUCCESS;
+
+    // placement moves buffers out to memory of their own
+    if (enable && gBufferArena != NULL)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    kNumaPlacement = enable;
+
+    // restarted on next use with or without pinning
+    gThreadPool.reset();
+
+    if (kNumaPlacement && kThreadingEnabled)
+        placeBuffersByPartition();
 
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
-                               const double* inPartials) {
-    if (bufferIndex < 0 || bufferIndex >= kBufferCount)
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadSpin(int spinMicroseconds) {
+    if (spinMicroseconds < 0)
         return BEAGLE_ERROR_OUT_OF_RANGE;
-    if (gPartials[bufferIndex] == NULL) {
-        gPartials[bufferIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * kPartialsSize);
-        if (gPartials[bufferIndex] == 0L)
-            return BEAGLE_ERROR_OUT_OF_MEMORY;
-    }
-    
-    const double* inPartialsOffset = inPartials;
-    REALTYPE* tmpRealPartialsOffset = gPartials[bufferIndex];
-    for (int l = 0; l < kCategoryCount; l++) {
-        for (int i = 0; i < kPatternCount; i++) {
-            beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
-            tmpRealPartialsOffset += kStateCount;
-            // Pad extra buffer with zeros
-            for(int k = kStateCount; k < kPartialsPaddedStateCount; k++) {
-                *tmpRealPartialsOffset++ = 0;
-            }
-            inPartialsOffset += kStateCount;
-        }
-        // Pad extra buffer with zeros
-        for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
-            *tmpRealPartialsOffset++ = 0;
-        }
-    }
+
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return BEAGLE_SUCCESS;
+
+    kThreadSpinMicroseconds = spinMicroseconds;
+
+    // a shared pool takes the setting for every instance attached to it
+    if (gThreadPool)
+        gThreadPool->setSpinTime(kThreadSpinMicroseconds);
 
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
-                               int cumulativeScaleIndex,
-                               double* outPartials) {
-    
-    // TODO: Test with and without padding
-    if (bufferIndex < 0 || bufferIndex >= kBufferCount)
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUBufferArena(bool enable,
+                                                         long hugePageSize) {
+    if (hugePageSize < 0 || (hugePageSize & (hugePageSize - 1)) != 0)
         return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    if ((kPatternCount == kPaddedPatternCount) && (kStateCount == kPartialsPaddedStateCount)) {
-        beagleMemCpy(outPartials, gPartials[bufferIndex], kPartialsSize);
-    } else if (kStateCount == kPartialsPaddedStateCount) {
-        double *offsetOutPartials = outPartials;
-        REALTYPE* offsetBeaglePartials = gPartials[bufferIndex];
-        for(int l = 0; l < kCategoryCount; l++) {
-            beagleMemCpy(offsetOutPartials, offsetBeaglePartials, kPatternCount * kStateCount);
-            offsetOutPartials += kPatternCount * kStateCount;
-            offsetBeaglePartials += kPaddedPatternCount * kStateCount;
-        }
-    } else {
-        double *offsetOutPartials = outPartials;
-        REALTYPE* offsetBeaglePartials = gPartials[bufferIndex];
-        for(int l = 0; l < kCategoryCount; l++) {
-            for (int i = 0; i < kPatternCount; i++) {
-                beagleMemCpy(offsetOutPartials, offsetBeaglePartials, kStateCount);
-                offsetOutPartials += kStateCount;
-                offsetBeaglePartials += kPartialsPaddedStateCount;
-            }
-            offsetBeaglePartials += (kPaddedPatternCount - kPatternCount) * kPartialsPaddedStateCount;
-        }
-    }
+    if (enable && (kNumaPlacement || gResidentPartials != NULL ||
+                   (gBufferArena != NULL && gBufferArena->fileBacked())))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
 
-    if (cumulativeScaleIndex != BEAGLE_OP_NONE) {
-        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
-        int index = 0;
-        for(int k=0; k<kPatternCount; k++) {
-            REALTYPE scaleFactor = exp(cumulativeScaleBuffer[k]);
-            for(int i=0; i<kStateCount; i++) {
-                outPartials[index] *= scaleFactor;
-                index++;
-            }
-        }
-        // TODO: Do we assume the cumulativeScaleBuffer is on the log-scale?
+    if (!enable) {
+        if (gBufferArena != NULL && !gBufferArena->fileBacked())
+            relocateBuffers(NULL);
+        return BEAGLE_SUCCESS;
     }
 
+    size_t arenaSize = BufferArena::paddedSize(sizeof(REALTYPE) * kPartialsSize) * kBufferCount +
+                       BufferArena::paddedSize(sizeof(REALTYPE) * kMatrixSize * kCategoryCount) * kMatrixCount;
+    if (!(kFlags & BEAGLE_FLAG_SCALING_AUTO))
+        arenaSize += BufferArena::paddedSize(sizeof(REALTYPE) * kPaddedPatternCount) * kScaleBufferCount;
+
+    relocateBuffers(new BufferArena(arenaSize, hugePageSize));
+
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setEigenDecomposition(int eigenIndex,
-                                         const double* inEigenVectors,
-                                         const double* inInverseEigenVectors,
-                                         const double* inEigenValues) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUScratchFile(const char* directory,
+                                                         int prefetchDistance) {
+#if defined(WIN32)
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+#else
+    if (prefetchDistance < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    if (directory == NULL) {
+        if (gBufferArena != NULL && gBufferArena->fileBacked())
+            relocateBuffers(NULL);
+        kScratchPrefetchDistance = 0;
+        return BEAGLE_SUCCESS;
+    }
+
+    if (kNumaPlacement || gResidentPartials != NULL ||
+        (gBufferArena != NULL && !gBufferArena->fileBacked()))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    // a file already in use is replaced by a new one
+    size_t fileSize = BufferArena::paddedSize(sizeof(REALTYPE) * kPartialsSize) * kBufferCount;
+    relocateBuffers(new BufferArena(fileSize, directory));
+    kScratchPrefetchDistance = prefetchDistance;
 
-    gEigenDecomposition->setEigenDecomposition(eigenIndex, inEigenVectors, inInverseEigenVectors, inEigenValues);
     return BEAGLE_SUCCESS;
+#endif
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRates(const double* inCategoryRates) {
-    int categoryRatesIndex=0;
-    if (gCategoryRates[categoryRatesIndex] == NULL) {
-        gCategoryRates[categoryRatesIndex] = (double*) malloc(sizeof(double) * kCategoryCount);
-        if (gCategoryRates[categoryRatesIndex] == 0L)
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setLazyBufferAllocation(bool enable) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (enable == kLazyBuffers)
+        return BEAGLE_SUCCESS;
+
+    // evicted partials are recomputed from the unwritten state
+    if (!enable && gResidentPartials != NULL)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (enable) {
+        // calloc leaves the pages of large buffers to the system's shared zero page
+        gUnwrittenPartials = (REALTYPE*) calloc(kPartialsSize, sizeof(REALTYPE));
+        gUnwrittenScaleBuffer = (REALTYPE*) calloc(kPaddedPatternCount, sizeof(REALTYPE));
+        if (gUnwrittenPartials == NULL || gUnwrittenScaleBuffer == NULL) {
+            free(gUnwrittenPartials);
+            free(gUnwrittenScaleBuffer);
+            gUnwrittenPartials = NULL;
+            gUnwrittenScaleBuffer = NULL;
             return BEAGLE_ERROR_OUT_OF_MEMORY;
+        }
+
+        for (int i = kTipCount; i < kBufferCount; i++) {
+            freeBuffer(gPartials[i]);
+            gPartials[i] = gUnwrittenPartials;
+            if (kSiteRepeats)
+                clearSiteRepeats(i);
+            if (kGapPatternSkipping)
+                gGapPatterns[i].clear();
+        }
+        for (int i = 0; i < kScaleBufferCount; i++) {
+            freeBuffer(gScaleBuffers[i]);
+            gScaleBuffers[i] = gUnwrittenScaleBuffer;
+        }
+        if (gBufferVersions != NULL)
+            gBufferVersions->touchAll();
+
+        kLazyBuffers = true;
+    } else {
+        for (int i = kTipCount; i < kBufferCount; i++)
+            commitPartials(i);
+        for (int i = 0; i < kScaleBufferCount; i++)
+            commitScaleBuffer(i);
+
+        kLazyBuffers = false;
+        free(gUnwrittenPartials);
+        free(gUnwrittenScaleBuffer);
+        gUnwrittenPartials = NULL;
+        gUnwrittenScaleBuffer = NULL;
     }
-    memcpy(gCategoryRates[categoryRatesIndex], inCategoryRates, sizeof(double) * kCategoryCount);
+
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRatesWithIndex(int categoryRatesIndex,
-                                                                 const double* inCategoryRates) {
-    if (categoryRatesIndex < 0 || categoryRatesIndex >= kEigenDecompCount)
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUPatternTiling(int patternBlockSize) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    if (patternBlockSize < 0)
         return BEAGLE_ERROR_OUT_OF_RANGE;
-    if (gCategoryRates[categoryRatesIndex] == NULL) {
-        gCategoryRates[categoryRatesIndex] = (double*) malloc(sizeof(double) * kCategoryCount);
-        if (gCategoryRates[categoryRatesIndex] == 0L)
-            return BEAGLE_ERROR_OUT_OF_MEMORY;
-    }
-    memcpy(gCategoryRates[categoryRatesIndex], inCategoryRates, sizeof(double) * kCategoryCount);
+
+    kPatternBlockSize = patternBlockSize;
+
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternWeights(const double* inPatternWeights) {
-    assert(inPatternWeights != 0L);
-    memcpy(gPatternWeights, inPatternWeights, sizeof(double) * kPatternCount);
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUInterleavedPatterns(bool enable) {
+    kInterleavedPatterns = enable;
+
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
-                                                            const int* inPatternPartitions) {
-    
-    int returnCode = BEAGLE_SUCCESS;
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartialsCheckpointing(int maxResidentBuffers) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    if (maxResidentBuffers < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    assert(partitionCount > 0);
-    assert(inPatternPartitions != 0L);
+    if (maxResidentBuffers == 0) {
+        if (gResidentPartials == NULL)
+            return BEAGLE_SUCCESS;
+
+        // buffers that can no longer be recomputed are left unwritten
+        kMaxResidentPartials = kBufferCount;
+        for (int i = kTipCount; i < kBufferCount; i++)
+            restorePartials(&i, 1);
+
+        delete gResidentPartials;
+        gResidentPartials = NULL;
+        gEvictedPartials.clear();
+        free(gRecomputeScaleBuffer);
+        gRecomputeScaleBuffer = NULL;
+        kMaxResidentPartials = 0;
+        return BEAGLE_SUCCESS;
+    }
 
-    kPartitionCount = partitionCount;
+    // evicting would not release buffers carved from the arena
+    if (gBufferArena != NULL)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
 
-    if (!kPartitionsInitialised) {
-        gPatternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
-        if (gPatternPartitions == NULL)
-            throw std::bad_alloc();
+    if (gResidentPartials == NULL) {
+        int returnCode = setLazyBufferAllocation(true);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
 
-        if (kAutoPartitioningEnabled) {
-            free(gAutoPartitionOperations);
-            if (kAutoRootPartitioningEnabled) {
-                free(gAutoPartitionIndices);
-                free(gAutoPartitionOutSumLogLikelihoods);
-                kAutoRootPartitioningEnabled = false;
-            }
-            kAutoPartitioningEnabled = false;
+        gRecomputeScaleBuffer = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPaddedPatternCount);
+        if (gRecomputeScaleBuffer == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        if (gBufferVersions == NULL)
+            gBufferVersions = new BufferVersions(kBufferCount, kMatrixCount, kScaleBufferCount);
+
+        gResidentPartials = new ResidentPartials(kBufferCount);
+        gEvictedPartials.assign(kBufferCount, 0);
+        for (int i = kTipCount; i < kBufferCount; i++) {
+            if (gPartials[i] != gUnwrittenPartials)
+                gResidentPartials->use(i);
         }
     }
-    if (!kPartitionsInitialised || partitionCount > kMaxPartitionCount) {
-        if (kPartitionsInitialised) {
-            free(gPatternPartitionsStartPatterns);
-        }
-        gPatternPartitionsStartPatterns = (int*) malloc(sizeof(int) * (partitionCount+1));
-        if (gPatternPartitionsStartPatterns == NULL)
-            throw std::bad_alloc();
 
-        kMaxPartitionCount = partitionCount;
-    }
+    kMaxResidentPartials = maxResidentBuffers;
+    evictPartials();
 
-    if (kThreadingEnabled) {
-        // Send stop signal to all threads and join them...
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            std::unique_lock<std::mutex> l(td->m);
-            td->stop = true;
-            td->cv.notify_one();
-        }
+    return BEAGLE_SUCCESS;
+}
 
-        // Join all the threads
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            td->t.join();
-        }
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUParallelOperations(bool enable) {
 
-        delete[] gThreads;
-        delete[] gFutures;
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return BEAGLE_SUCCESS;
 
-        for (int i=0; i<kNumThreads; i++) {
-            free(gThreadOperations[i]);
-        }
-        free(gThreadOperations);
-        free(gThreadOpCounts);
+    kParallelOperations = enable;
 
-        kThreadingEnabled = false;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrixCache(bool enable) {
+
+    if (!enable) {
+        delete gMatrixCache;
+        gMatrixCache = NULL;
+    } else if (gMatrixCache == NULL) {
+        // matrices computed before now are not known to the cache
+        gMatrixCache = new TransitionMatrixCache(kMatrixCount);
     }
 
-    if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
-        kNumThreads = partitionCount;
+    return BEAGLE_SUCCESS;
+}
 
-        gThreads = new threadData[kNumThreads];
-        for (int i = 0; i < kNumThreads; i++) {
-            gThreads[i].t = std::thread(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting, this, &gThreads[i]);
-        }
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPowerOfTwoScaling(bool enable) {
+    kPowerOfTwoScaling = enable;
+    return BEAGLE_SUCCESS;
+}
 
-        gFutures = new std::shared_future<void>[kNumThreads];
-        if (gFutures == NULL)
-            throw std::bad_alloc();
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setMixedPrecision(bool enable) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
 
-        gThreadOperations = (int**) malloc(sizeof(int*) * kNumThreads);
-        for (int i=0; i<kNumThreads; i++) {
-            gThreadOperations[i] = (int*) malloc(sizeof(int) * BEAGLE_PARTITION_OP_COUNT * kBufferCount * partitionCount);
-        }
+    kMixedPrecision = (enable && sizeof(REALTYPE) != sizeof(double));
+    gMixedScaleBuffers.clear();
+    gMixedLogLikelihoods.clear();
+    if (kMixedPrecision) {
+        // the double copies start from the factors summed so far
+        gMixedScaleBuffers.resize(kScaleBufferCount);
+        for (int i = 0; i < kScaleBufferCount; i++) {
+            if (gScaleBuffers[i] != NULL)
+                gMixedScaleBuffers[i].assign(gScaleBuffers[i], gScaleBuffers[i] + kPaddedPatternCount);
+            else
+                gMixedScaleBuffers[i].assign(kPaddedPatternCount, 0.0);
+        }
+        gMixedLogLikelihoods.assign(outLogLikelihoodsTmp, outLogLikelihoodsTmp + kPatternCount);
+    }
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setScalingThreshold(double threshold) {
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    if (!(threshold >= 0.0 && threshold < 1.0))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-        gThreadOpCounts = (int*) malloc(sizeof(int) * kNumThreads);
+    kScalingThreshold = threshold;
+    gScaleBufferWritten.assign(kScaleBufferCount, 1);
 
-        kThreadingEnabled = true;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setBufferVersioning(bool enable) {
+
+    if (!enable) {
+        // partials checkpointing recomputes evicted partials from the versions
+        if (gResidentPartials != NULL)
+            return BEAGLE_ERROR_NO_IMPLEMENTATION;
+        delete gBufferVersions;
+        gBufferVersions = NULL;
+    } else if (gBufferVersions == NULL) {
+        // buffers written before now have no record, so their first update runs
+        gBufferVersions = new BufferVersions(kBufferCount, kMatrixCount, kScaleBufferCount);
     }
 
+    return BEAGLE_SUCCESS;
+}
 
-    memcpy(gPatternPartitions, inPatternPartitions, sizeof(int) * kPatternCount);
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::measurePartitionCount(int maxThreadCount) {
+
+    const int calibrationReps = 3;
+
+    // bound the work of a single pass, a smaller sample only makes the
+    // calibration more conservative about adding threads
+    long maxSampleWork = 1L << 26;
+    long patternWork = (long) kStateCount * kStateCount * kCategoryCount;
+    int samplePatternCount = kPatternCount;
+    if (samplePatternCount * patternWork > maxSampleWork)
+        samplePatternCount = (int) (maxSampleWork / patternWork);
+    if (samplePatternCount < 1)
+        samplePatternCount = 1;
+
+    REALTYPE* partials1 = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+    REALTYPE* partials2 = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+    REALTYPE* destP = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+    REALTYPE* matrices = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+    if (partials1 == NULL || partials2 == NULL || destP == NULL || matrices == NULL)
+        throw std::bad_alloc();
 
-    bool reorderPatterns = false;
-    int contiguousPartitions = 0;
-    for (int i=0; i<kPatternCount; i++) {
-        if (i > 0 && (gPatternPartitions[i] != gPatternPartitions[i-1])) {
-            contiguousPartitions++;
-        }
-        if (contiguousPartitions != gPatternPartitions[i]) {
-            reorderPatterns = true;
-            break;
-        }
+    // rows that sum to one keep the products away from denormals
+    for (int i = 0; i < kPartialsSize; i++) {
+        partials1[i] = 1.0;
+        partials2[i] = 1.0;
     }
+    for (int i = 0; i < kMatrixSize * kCategoryCount; i++)
+        matrices[i] = REALTYPE(1.0) / kStateCount;
 
-    if (reorderPatterns) {
-        returnCode = reorderPatternsByPartition();
-    } else {
-        int currentPartition = gPatternPartitions[0];
-        gPatternPartitionsStartPatterns[currentPartition] = 0;
-        for (int i=0; i<kPatternCount; i++) {
-            if (gPatternPartitions[i] != currentPartition) {
-                currentPartition = gPatternPartitions[i];
-                gPatternPartitionsStartPatterns[currentPartition] = i;
+    int bestPartitionCount = 1;
+    double bestTime = 0.0;
+
+    for (int partitionCount = 1; partitionCount <= maxThreadCount && partitionCount <= samplePatternCount;
+         partitionCount *= 2) {
+
+        ThreadPool* pool = NULL;
+        if (partitionCount > 1)
+            pool = (kSharedThreadPool ? gThreadPool.get() : new ThreadPool(partitionCount));
+        if (pool != NULL && !kSharedThreadPool)
+            pool->setSpinTime(kThreadSpinMicroseconds);
+
+        double time = 0.0;
+        for (int rep = 0; rep <= calibrationReps; rep++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            if (pool == NULL) {
+                calcPartialsPartials(destP, partials1, matrices, partials2, matrices,
+                                     0, samplePatternCount);
+            } else {
+                ThreadPoolTaskGroup group;
+                for (int p = 0; p < partitionCount; p++) {
+                    int startPattern = (int) ((long) samplePatternCount * p / partitionCount);
+                    int endPattern = (int) ((long) samplePatternCount * (p + 1) / partitionCount);
+                    pool->submit(group,
+                        std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials, this,
+                                  destP, (const REALTYPE*) partials1, (const REALTYPE*) matrices,
+                                  (const REALTYPE*) partials2, (const REALTYPE*) matrices,
+                                  startPattern, endPattern),
+                        p);
+                }
+                group.wait();
             }
+
+            double repTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            // first pass only warms up caches and threads
+            if (rep == 1 || (rep > 1 && repTime < time))
+                time = repTime;
+        }
+
+        if (pool != NULL && !kSharedThreadPool)
+            delete pool;
+
+        // only add threads for a clear gain, they are taken away from other work
+        if (partitionCount == 1 || time < 0.9 * bestTime) {
+            bestTime = time;
+            bestPartitionCount = partitionCount;
         }
-        gPatternPartitionsStartPatterns[currentPartition+1] = kPatternCount;
     }
 
-    kPartitionsInitialised = true;
+    free(partials1);
+    free(partials2);
+    free(destP);
+    free(matrices);
 
-    return returnCode;
+    return bestPartitionCount;
 }
 
 BEAGLE_CPU_TEMPLATE
-    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setStateFrequencies(int stateFrequenciesIndex,
-                                                     const double* inStateFrequencies) {
-    if (stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount)
-        return BEAGLE_ERROR_OUT_OF_RANGE;
-    if (gStateFrequencies[stateFrequenciesIndex] == NULL) {
-        gStateFrequencies[stateFrequenciesIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
-        if (gStateFrequencies[stateFrequenciesIndex] == 0L)
-            return BEAGLE_ERROR_OUT_OF_MEMORY;
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoPartitionPatterns(int partitionCount) {
+
+    clearAutoPartitions();
+
+    int* patternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
+    int partitionSize = kPatternCount/partitionCount;
+    for (int i=0; i<kPatternCount; i++) {
+        int sitePartition = i/partitionSize;
+        if (sitePartition > partitionCount - 1)
+            sitePartition = partitionCount - 1;
+        patternPartitions[i] = sitePartition;
     }
-    beagleMemCpy(gStateFrequencies[stateFrequenciesIndex], inStateFrequencies, kStateCount);
+    setPatternPartitions(partitionCount, patternPartitions);
+    free(patternPartitions);
 
-    return BEAGLE_SUCCESS;
-}
+    gAutoPartitionOperations = (int*) malloc(sizeof(int) * kBufferCount * kPartitionCount * BEAGLE_PARTITION_OP_COUNT);
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryWeights(int categoryWeightsIndex,
-                                                 const double* inCategoryWeights) {
-    if (categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount)
-        return BEAGLE_ERROR_OUT_OF_RANGE;
-    if (gCategoryWeights[categoryWeightsIndex] == NULL) {
-        gCategoryWeights[categoryWeightsIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * kCategoryCount);
-        if (gCategoryWeights[categoryWeightsIndex] == 0L)
-            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    if (kPatternCount >= kMinPatternCount*4) {
+        gAutoPartitionIndices = (int*) malloc(sizeof(int) * partitionCount);
+        for (int i=0; i<partitionCount; i++) {
+            gAutoPartitionIndices[i] = i;
+        }
+        gAutoPartitionOutSumLogLikelihoods = (double*) malloc(sizeof(double) * partitionCount);
+        kAutoRootPartitioningEnabled = true;
     }
-    beagleMemCpy(gCategoryWeights[categoryWeightsIndex], inCategoryWeights, kCategoryCount);
 
-    return BEAGLE_SUCCESS;
+    kAutoPartitioningEnabled = true;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTransitionMatrix(int matrixIndex,
-                                                 double* outMatrix) {
-    // TODO Test with multiple rate categories
-if (T_PAD != 0) {
-    double* offsetOutMatrix = outMatrix;
-    REALTYPE* offsetBeagleMatrix = gTransitionMatrices[matrixIndex];
-    for(int i = 0; i < kCategoryCount; i++) {
-        for(int j = 0; j < kStateCount; j++) {
-            beagleMemCpy(offsetOutMatrix,offsetBeagleMatrix,kStateCount);
-            offsetBeagleMatrix += kTransPaddedStateCount; // Skip padding
-            offsetOutMatrix += kStateCount;
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::clearAutoPartitions() {
+    if (kAutoPartitioningEnabled) {
+        free(gAutoPartitionOperations);
+        if (kAutoRootPartitioningEnabled) {
+            free(gAutoPartitionIndices);
+            free(gAutoPartitionOutSumLogLikelihoods);
+            kAutoRootPartitioningEnabled = false;
         }
+        kAutoPartitioningEnabled = false;
     }
-} else {
-    beagleMemCpy(outMatrix,gTransitionMatrices[matrixIndex],
-            kMatrixSize * kCategoryCount);
-}
-    return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getLogLikelihood(double* outSumLogLikelihood) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadPool(std::shared_ptr<ThreadPool> threadPool) {
 
-    int returnCode = BEAGLE_SUCCESS;
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
 
-    *outSumLogLikelihood = 0.0;    
-    for(int k=0; k < kPatternCount; k++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
-    }    
-    
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    gThreadPool = threadPool;
+    kSharedThreadPool = (threadPool != NULL);
 
-    return returnCode;
+    return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getDerivatives(double* outSumFirstDerivative,
-                                                      double* outSumSecondDerivative) {
-
-    *outSumFirstDerivative = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
-    }
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTrace(TraceRecorder* trace) {
+    // a shared pool is traced by its owner
+    gTrace = trace;
+    if (gThreadPool && !kSharedThreadPool)
+        gThreadPool->setTrace(trace);
+}
 
-    if (outSumSecondDerivative != NULL) {
-        *outSumSecondDerivative = 0.0;
-        for (int i = 0; i < kPatternCount; i++) {
-            *outSumSecondDerivative += outSecondDerivativesTmp[i] * gPatternWeights[i];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
+                                const int* inStates) {
+    if (tipIndex < 0 || tipIndex >= kTipCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (kPackedTipStates) {
+        packTipStates(tipIndex, inStates, kPatternCount);
+    } else {
+        gTipStates[tipIndex] = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
+        // TODO: What if this throws a memory full error?
+        for (int j = 0; j < kPatternCount; j++) {
+            gTipStates[tipIndex][j] = (inStates[j] < kStateCount ? inStates[j] : kStateCount);
+        }
+        for (int j = kPatternCount; j < kPaddedPatternCount; j++) {
+            gTipStates[tipIndex][j] = kStateCount;
         }
     }
 
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchPartials(tipIndex);
+    if (kSiteRepeats)
+        clearSiteRepeats(tipIndex);
+    if (kGapPatternSkipping)
+        findTipGapPatterns(tipIndex);
+
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikelihoods) {
-    if (kPatternsReordered) {
-        REALTYPE* outLogLikelihoodsOriginalOrder = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount);
-        for (int i=0; i < kPatternCount; i++) {
-            outLogLikelihoodsOriginalOrder[i] = outLogLikelihoodsTmp[gPatternsNewOrder[i]];
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStatesPacking(bool enable) {
+    if (enable == kPackedTipStates)
+        return BEAGLE_SUCCESS;
+
+    if (enable) {
+        // states 0 to kStateCount, which is missing
+        if (kStateCount > 255)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        kTipStateBits = (kStateCount < 4 ? 2 : (kStateCount < 16 ? 4 : 8));
+
+        if (gPackedTipStates == NULL) {
+            gPackedTipStates = (unsigned char**) calloc(sizeof(unsigned char*), kBufferCount);
+            if (gPackedTipStates == NULL)
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
         }
-        beagleMemCpy(outLogLikelihoods, outLogLikelihoodsOriginalOrder, kPatternCount);
-        free(outLogLikelihoodsOriginalOrder);
+
+        for (int i = 0; i < kTipCount; i++) {
+            if (gTipStates[i] != NULL) {
+                packTipStates(i, gTipStates[i], kPaddedPatternCount);
+                free(gTipStates[i]);
+                gTipStates[i] = NULL;
+            }
+        }
+        kPackedTipStates = true;
     } else {
-        beagleMemCpy(outLogLikelihoods, outLogLikelihoodsTmp, kPatternCount);
+        for (int i = 0; i < kTipCount; i++) {
+            if (gPackedTipStates[i] != NULL) {
+                int* states = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
+                memcpy(states, getTipStates(i), sizeof(int) * kPaddedPatternCount);
+                free(gPackedTipStates[i]);
+                gPackedTipStates[i] = NULL;
+                gTipStates[i] = states;
+            }
+        }
+        kPackedTipStates = false;
     }
 
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteDerivatives(double* outFirstDerivatives,
-                                                double* outSecondDerivatives) {
-    beagleMemCpy(outFirstDerivatives, outFirstDerivativesTmp, kPatternCount);
-    if (outSecondDerivatives != NULL)
-        beagleMemCpy(outSecondDerivatives, outSecondDerivativesTmp, kPatternCount);
-
-    return BEAGLE_SUCCESS;
-}
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
+                                  const double* inPartials) {
+    if (tipIndex < 0 || tipIndex >= kTipCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
+    // when the instance has compact buffers, unambiguous tips, with or without missing
+    // patterns, are kept as compact states so the states kernels run on them and no
+    // partials buffer is held
+    std::vector<int> states(kPatternCount);
+    clearTipStates(tipIndex);
+    if (kCompactBufferCount > 0 && findCompactTipStates(inPartials, states.data())) {
+        if (gPartials[tipIndex] != NULL) {
+            freeBuffer(gPartials[tipIndex]);
+            gPartials[tipIndex] = NULL;
+        }
+        return setTipStates(tipIndex, states.data());
+    }
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrix(int matrixIndex,
-                                       const double* inMatrix,
-                                       double paddedValue) {
+    bool newBuffer = false;
+    if(gPartials[tipIndex] == NULL) {
+        gPartials[tipIndex] = allocatePartials(tipIndex);
+        // TODO: What if this throws a memory full error?
+        if (gPartials[tipIndex] == 0L)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        newBuffer = true;
+    }
 
-if (T_PAD != 0) {
-    const double* offsetInMatrix = inMatrix;
-    REALTYPE* offsetBeagleMatrix = gTransitionMatrices[matrixIndex];
-    for(int i = 0; i < kCategoryCount; i++) {
-        for(int j = 0; j < kStateCount; j++) {
-            beagleMemCpy(offsetBeagleMatrix, offsetInMatrix, kStateCount);
-            offsetBeagleMatrix[kStateCount] = paddedValue;
-            offsetBeagleMatrix += kTransPaddedStateCount; // Skip padding
-            offsetInMatrix += kStateCount;
+    const double* inPartialsOffset;
+    REALTYPE* tmpRealPartialsOffset = gPartials[tipIndex];
+    for (int l = 0; l < kCategoryCount; l++) {
+        inPartialsOffset = inPartials;
+        for (int i = 0; i < kPatternCount; i++) {
+            beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
+            tmpRealPartialsOffset += kStateCount;
+            // Pad extra buffer with zeros
+            for(int k = kStateCount; k < kPartialsPaddedStateCount; k++) {
+                *tmpRealPartialsOffset++ = 0;
+            }
+            inPartialsOffset += kStateCount;
+        }
+        // Pad extra buffer with zeros
+        for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
+            *tmpRealPartialsOffset++ = 0;
         }
     }
-} else {
-    beagleMemCpy(gTransitionMatrices[matrixIndex], inMatrix,
-                 kMatrixSize * kCategoryCount);
-}
+
+    if (newBuffer && kNumaPlacement && kThreadingEnabled)
+        gPartials[tipIndex] = placeBufferByPartition(gPartials[tipIndex],
+                                                     kPaddedPatternCount * kPartialsPaddedStateCount,
+                                                     kCategoryCount, kPartialsPaddedStateCount, true);
+
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchPartials(tipIndex);
+    if (kSiteRepeats)
+        clearSiteRepeats(tipIndex);
+    if (kGapPatternSkipping)
+        findTipGapPatterns(tipIndex);
+
     return BEAGLE_SUCCESS;
 }
-    
+
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrices(const int* matrixIndices,
-                                                             const double* inMatrices,
-                                                             const double* paddedValues,
-                                                             int count) {
-    for (int k = 0; k < count; k++) {
-        const double* inMatrix = inMatrices + k*kStateCount*kStateCount*kCategoryCount;
-        int matrixIndex = matrixIndices[k];
-        
-if (T_PAD != 0) {
-        const double* offsetInMatrix = inMatrix;
-        REALTYPE* offsetBeagleMatrix = gTransitionMatrices[matrixIndex];
-        for(int i = 0; i < kCategoryCount; i++) {
-            for(int j = 0; j < kStateCount; j++) {
-                beagleMemCpy(offsetBeagleMatrix, offsetInMatrix, kStateCount);
-                offsetBeagleMatrix[kStateCount] = paddedValues[k];
-                offsetBeagleMatrix += kTransPaddedStateCount; // Skip padding
-                offsetInMatrix += kStateCount;
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
+                               const double* inPartials) {
+    if (bufferIndex < 0 || bufferIndex >= kBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    commitPartials(bufferIndex);
+    // the partials replace any compact states of a tip, which the kernels would prefer
+    if (bufferIndex < kTipCount)
+        clearTipStates(bufferIndex);
+    if (gPartials[bufferIndex] == NULL) {
+        gPartials[bufferIndex] = allocatePartials(bufferIndex);
+        if (gPartials[bufferIndex] == 0L)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    
+    const double* inPartialsOffset = inPartials;
+    REALTYPE* tmpRealPartialsOffset = gPartials[bufferIndex];
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int i = 0; i < kPatternCount; i++) {
+            beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
+            tmpRealPartialsOffset += kStateCount;
+            // Pad extra buffer with zeros
+            for(int k = kStateCount; k < kPartialsPaddedStateCount; k++) {
+                *tmpRealPartialsOffset++ = 0;
             }
+            inPartialsOffset += kStateCount;
+        }
+        // Pad extra buffer with zeros
+        for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
+            *tmpRealPartialsOffset++ = 0;
         }
-} else {
-        beagleMemCpy(gTransitionMatrices[matrixIndex], inMatrix,
-                     kMatrixSize * kCategoryCount);
-}
     }
-    
-    return BEAGLE_SUCCESS;
-}
 
-///////////////////////////
-//---TODO: Epoch model---//
-///////////////////////////
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchPartials(bufferIndex);
+    if (kSiteRepeats)
+        clearSiteRepeats(bufferIndex);
+    if (kGapPatternSkipping)
+        gGapPatterns[bufferIndex].clear();
 
-//TODO: move to EigenDecompositionSquare
+    return BEAGLE_SUCCESS;
+}
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* firstIndices,
-        const int* secondIndices,
-        const int* resultIndices,
-        int matrixCount) {
-
-#ifdef BEAGLE_DEBUG_FLOW
-    fprintf(stderr, "\t Entering BeagleCPUImpl::convolveTransitionMatrices \n");
-#endif
-
-    int returnCode = BEAGLE_SUCCESS;
-
-    for (int u = 0; u < matrixCount; u++) {
-
-        if(firstIndices[u] == resultIndices[u] || secondIndices[u] == resultIndices[u]) {
-
-#ifdef BEAGLE_DEBUG_FLOW
-            fprintf(stderr, "In-place convolution is not allowed \n");
-#endif
-
-            returnCode = BEAGLE_ERROR_OUT_OF_RANGE;
-            break;
-
-        }//END: overwrite check
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
+                               int cumulativeScaleIndex,
+                               double* outPartials) {
+    
+    // TODO: Test with and without padding
+    if (bufferIndex < 0 || bufferIndex >= kBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-        REALTYPE* C = gTransitionMatrices[resultIndices[u]];
-        REALTYPE* A = gTransitionMatrices[firstIndices[u]];
-        REALTYPE* B = gTransitionMatrices[secondIndices[u]];
+    int returnCode = restorePartials(&bufferIndex, 1);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
-        int n = 0;
+    if (gPartials[bufferIndex] == NULL && hasTipStates(bufferIndex)) {
+        // a tip set from partials may be held as compact states
+        const int* states = getTipStates(bufferIndex);
+        double* offsetOutPartials = outPartials;
         for (int l = 0; l < kCategoryCount; l++) {
+            for (int k = 0; k < kPatternCount; k++) {
+                for (int i = 0; i < kStateCount; i++)
+                    offsetOutPartials[i] = (states[k] == i || states[k] == kStateCount ? 1.0 : 0.0);
+                offsetOutPartials += kStateCount;
+            }
+        }
+        return BEAGLE_SUCCESS;
+    }
 
-            for (int i = 0; i < kStateCount; i++) {
-                for (int j = 0; j < kStateCount; j++) {
-
-                    REALTYPE sum = 0.0;
-                    for (int k = 0; k < kStateCount; k++) {
-                        sum += A[k + kTransPaddedStateCount * i] * B[j + kTransPaddedStateCount * k];
-                    }
-//                  printf("%.30f %.30f %d: \n", C[n], sum, l);
-                    C[n] = sum;
-                    n++;
-
-                }//END: j loop
-
-                if (T_PAD != 0) {
-
-                    //                      A[n] = 1.0;
-                    //                      B[n] = 1.0;
-                    C[n] = 1.0;
-
-                    n += T_PAD;
-
-                }//END: padding check
-
-            }//END: i loop
-
-            A += kStateCount * kTransPaddedStateCount;
-            B += kStateCount * kTransPaddedStateCount;
-
-
-            ///////////////
-            //      printf("rate category: %d \n", l);
-            //
-            //      printf("A:");
-            //      for (int i = 0; i < kStateCount; i++) {
-            //          printf("| ");
-            //          for (int j = 0; j < kStateCount; j++)
-            //          printf("%f ", A[j + i * kTransPaddedStateCount]);
-            //          printf("|\n");
-            //      }
-            //      printf("\n");
-            //
-            //      printf("A:");
-            //      for (int i = 0; i < kStateCount; i++) {
-            //          printf("| ");
-            //          for (int j = 0; j < kStateCount; j++)
-            //          printf("%f ", B[j + i * kTransPaddedStateCount]);
-            //          printf("|\n");
-            //      }
-            //      printf("\n");
-            //
-//                      printf("C: \n");
-//                      for (int i = 0; i < kStateCount; i++) {
-//                          printf("| ");
-//                          for (int j = 0; j < kTransPaddedStateCount; j++)
-//                          printf("%.20f ", C[j + i * kTransPaddedStateCount]);
-//                          printf("|\n");
-//                      }
-//                      printf("\n");
-            ////////////////
-
-        }//END: rates loop
-
-    }//END: u loop
-
-#ifdef BEAGLE_DEBUG_FLOW
-    fprintf(stderr, "\t Leaving BeagleCPUImpl::convolveTransitionMatrices \n");
-#endif
+    if ((kPatternCount == kPaddedPatternCount) && (kStateCount == kPartialsPaddedStateCount)) {
+        beagleMemCpy(outPartials, gPartials[bufferIndex], kPartialsSize);
+    } else if (kStateCount == kPartialsPaddedStateCount) {
+        double *offsetOutPartials = outPartials;
+        REALTYPE* offsetBeaglePartials = gPartials[bufferIndex];
+        for(int l = 0; l < kCategoryCount; l++) {
+            beagleMemCpy(offsetOutPartials, offsetBeaglePartials, kPatternCount * kStateCount);
+            offsetOutPartials += kPatternCount * kStateCount;
+            offsetBeaglePartials += kPaddedPatternCount * kStateCount;
+        }
+    } else {
+        double *offsetOutPartials = outPartials;
+        REALTYPE* offsetBeaglePartials = gPartials[bufferIndex];
+        for(int l = 0; l < kCategoryCount; l++) {
+            for (int i = 0; i < kPatternCount; i++) {
+                beagleMemCpy(offsetOutPartials, offsetBeaglePartials, kStateCount);
+                offsetOutPartials += kStateCount;
+                offsetBeaglePartials += kPartialsPaddedStateCount;
+            }
+            offsetBeaglePartials += (kPaddedPatternCount - kPatternCount) * kPartialsPaddedStateCount;
+        }
+    }
 
-    return returnCode;
-}//END: convolveTransitionMatrices
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE) {
+        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
+        int index = 0;
+        for(int k=0; k<kPatternCount; k++) {
+            REALTYPE scaleFactor = exp(cumulativeScaleBuffer[k]);
+            for(int i=0; i<kStateCount; i++) {
+                outPartials[index] *= scaleFactor;
+                index++;
+            }
+        }
+        // TODO: Do we assume the cumulativeScaleBuffer is on the log-scale?
+    }
 
+    return BEAGLE_SUCCESS;
+}
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatrices(int eigenIndex,
-                                            const int* probabilityIndices,
-                                            const int* firstDerivativeIndices,
-                                            const int* secondDerivativeIndices,
-                                            const double* edgeLengths,
-                                            int count) {
-    // for (int i = 0; i < count; i++) {
-    //     printf("uTM %d %d %f %d\n", eigenIndex, probabilityIndices[i], edgeLengths[i], 0);
-    // }
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setEigenDecomposition(int eigenIndex,
+                                         const double* inEigenVectors,
+                                         const double* inInverseEigenVectors,
+                                         const double* inEigenValues) {
 
-    gEigenDecomposition->updateTransitionMatrices(eigenIndex,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
-                                                  edgeLengths,gCategoryRates[0],gTransitionMatrices,count);
+    gEigenDecomposition->setEigenDecomposition(eigenIndex, inEigenVectors, inInverseEigenVectors, inEigenValues);
+    if (gMatrixCache != NULL)
+        gMatrixCache->forgetEigenDecomposition(eigenIndex);
     return BEAGLE_SUCCESS;
 }
 
-
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithModelCategories(int* eigenIndices,
-                                            const int* probabilityIndices,
-                                            const int* firstDerivativeIndices,
-                                            const int* secondDerivativeIndices,
-                                            const double* edgeLengths,
-                                            int count) {
-
-    gEigenDecomposition->updateTransitionMatricesWithModelCategories(eigenIndices,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
-                                                  edgeLengths,gTransitionMatrices,count);
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRates(const double* inCategoryRates) {
+    int categoryRatesIndex=0;
+    if (gCategoryRates[categoryRatesIndex] == NULL) {
+        gCategoryRates[categoryRatesIndex] = (double*) malloc(sizeof(double) * kCategoryCount);
+        if (gCategoryRates[categoryRatesIndex] == 0L)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    memcpy(gCategoryRates[categoryRatesIndex], inCategoryRates, sizeof(double) * kCategoryCount);
+    if (gMatrixCache != NULL)
+        gMatrixCache->forgetCategoryRates(categoryRatesIndex);
     return BEAGLE_SUCCESS;
 }
 
-
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
-                                                                                  const int* categoryRateIndices,
-                                                                                  const int* probabilityIndices,
-                                                                                  const int* firstDerivativeIndices,
-                                                                                  const int* secondDerivativeIndices,
-                                                                                  const double* edgeLengths,
-                                                                                  int count) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRatesWithIndex(int categoryRatesIndex,
+                                                                 const double* inCategoryRates) {
+    if (categoryRatesIndex < 0 || categoryRatesIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (gCategoryRates[categoryRatesIndex] == NULL) {
+        gCategoryRates[categoryRatesIndex] = (double*) malloc(sizeof(double) * kCategoryCount);
+        if (gCategoryRates[categoryRatesIndex] == 0L)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    memcpy(gCategoryRates[categoryRatesIndex], inCategoryRates, sizeof(double) * kCategoryCount);
+    if (gMatrixCache != NULL)
+        gMatrixCache->forgetCategoryRates(categoryRatesIndex);
+    return BEAGLE_SUCCESS;
+}
 
-    // TODO: move loop to within gEigenDecomposition
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternWeights(const double* inPatternWeights) {
+    assert(inPatternWeights != 0L);
+    memcpy(gPatternWeights, inPatternWeights, sizeof(double) * kPatternCount);
+    return BEAGLE_SUCCESS;
+}
 
-    for (int i = 0; i < count; i++) {
-        // printf("uTMWMM %d %d %f %d\n", eigenIndices[i], probabilityIndices[i], edgeLengths[i], categoryRateIndices[i]);
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setSiteRepeats(bool enable) {
 
-        const int* firstDeriv  = NULL;
-        const int* secondDeriv = NULL;
-        if (firstDerivativeIndices != NULL && secondDerivativeIndices == NULL) {
-            firstDeriv = &firstDerivativeIndices[i];
-        } else if (firstDerivativeIndices != NULL && secondDerivativeIndices != NULL) {
-            firstDeriv  = &firstDerivativeIndices[i];
-            secondDeriv = &secondDerivativeIndices[i];
-        }
+    kSiteRepeats = enable;
 
-        gEigenDecomposition->updateTransitionMatrices(eigenIndices[i],
-                                                      &probabilityIndices[i],
-                                                      firstDeriv,
-                                                      secondDeriv,
-                                                      &edgeLengths[i],
-                                                      gCategoryRates[categoryRateIndices[i]],
-                                                      gTransitionMatrices,
-                                                      1);
-    }
+    // partials computed before now have no classes
+    int bufferCount = (enable ? kBufferCount : 0);
+    gSiteRepeatClasses.assign(bufferCount, std::vector<int>());
+    gSiteRepeatClassCounts.assign(bufferCount, 0);
+    gSiteRepeatStamps.assign(bufferCount, 0);
+    gSiteRepeatInputs.assign(bufferCount * 4, 0);
+    kSiteRepeatStamp = 0;
 
     return BEAGLE_SUCCESS;
 }
 
-
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
-                                                      int count,
-                                                      int cumulativeScaleIndex) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setGapPatternSkipping(bool enable) {
 
-    int returnCode = BEAGLE_ERROR_GENERAL;
+    kGapPatternSkipping = enable;
 
-    if (kAutoPartitioningEnabled) {
-        autoPartitionPartialsOperations(operations,
-                                        gAutoPartitionOperations,
-                                        count,
-                                        cumulativeScaleIndex);
-        count *= kPartitionCount;
-        returnCode = upPartialsByPartitionAsync((const int*) gAutoPartitionOperations,
-                                                count); 
-    } else {
-        bool byPartition = false;
-        returnCode = upPartials(byPartition,
-                                operations,
-                                count,
-                                cumulativeScaleIndex);
+    // tips set before now are searched, partials computed before now have no gaps known
+    gGapPatterns.assign((enable ? kBufferCount : 0), std::vector<char>());
+    if (enable) {
+        for (int i = 0; i < kTipCount; i++)
+            findTipGapPatterns(i);
     }
 
-    return returnCode;
+    return BEAGLE_SUCCESS;
 }
 
-
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* operations,
-                                                                 int count) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
+                                                            const int* inPatternPartitions) {
     
-    int returnCode = BEAGLE_ERROR_GENERAL;
+    int returnCode = BEAGLE_SUCCESS;
 
-    if (kThreadingEnabled) {
-        returnCode = upPartialsByPartitionAsync(operations,
-                                                count);            
-    } else {
-        bool byPartition = true;
-        returnCode = upPartials(byPartition,
-                                operations,
-                                count,
-                                BEAGLE_OP_NONE);
+    assert(partitionCount > 0);
+    assert(inPatternPartitions != 0L);
+
+    // buffers of the running threads are sized by the previous partition count
+    stopThreads();
+
+    kPartitionCount = partitionCount;
+
+    if (!kPartitionsInitialised) {
+        gPatternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
+        if (gPatternPartitions == NULL)
+            throw std::bad_alloc();
+
+        clearAutoPartitions();
     }
+    if (!kPartitionsInitialised || partitionCount > kMaxPartitionCount) {
+        if (kPartitionsInitialised) {
+            free(gPatternPartitionsStartPatterns);
+        }
+        gPatternPartitionsStartPatterns = (int*) malloc(sizeof(int) * (partitionCount+1));
+        if (gPatternPartitionsStartPatterns == NULL)
+            throw std::bad_alloc();
 
-    return returnCode;
-}
+        kMaxPartitionCount = partitionCount;
+    }
 
-BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoPartitionPartialsOperations(const int* operations,
-                                                                        int* partitionOperations,
-                                                                        int count,
-                                                                        int cumulativeScaleIndex) {
+    // the partition boundaries change the costs the schedule was built from
+    kPartitionScheduleThreads = 0;
 
-    int numOps  = BEAGLE_OP_COUNT;
-    int numOpsP = BEAGLE_PARTITION_OP_COUNT;
+    if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
+        // the partitions are spread over the workers by schedulePartitions, so
+        // more workers than partitions would mostly split partitions finely;
+        // beyond the hardware thread count, workers would only take turns
+        kNumThreads = partitionCount;
+        int hardwareThreads = std::thread::hardware_concurrency();
+        if (hardwareThreads > 0 && kNumThreads > hardwareThreads)
+            kNumThreads = hardwareThreads;
 
-    for (int i=0; i<count; i++) {
-        for (int j=0; j<kPartitionCount; j++) {
-            for (int k=0; k<numOps; k++) {
-                partitionOperations[i*kPartitionCount*numOpsP + j*numOpsP + k] = operations[i*numOps + k];
-            }    
-                partitionOperations[i*kPartitionCount*numOpsP + j*numOpsP + numOps    ] = j;
-                partitionOperations[i*kPartitionCount*numOpsP + j*numOpsP + numOps + 1] = cumulativeScaleIndex;
+        gPartitionOperations = (int**) malloc(sizeof(int*) * partitionCount);
+        if (gPartitionOperations == NULL)
+            throw std::bad_alloc();
+        for (int i=0; i<partitionCount; i++) {
+            gPartitionOperations[i] = (int*) malloc(sizeof(int) * BEAGLE_PARTITION_OP_COUNT * kBufferCount * partitionCount);
+            if (gPartitionOperations[i] == NULL)
+                throw std::bad_alloc();
         }
+
+        gPartitionOpCounts = (int*) malloc(sizeof(int) * partitionCount);
+        if (gPartitionOpCounts == NULL)
+            throw std::bad_alloc();
+
+        kThreadingEnabled = true;
     }
-}
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByPartitionAsync(const int* operations,
-                                                                  int count) {
 
-    int numOps = BEAGLE_PARTITION_OP_COUNT;
+    // the partitions are given in the original pattern order, and kept in the stored order
+    if (kPatternsReordered) {
+        for (int i=0; i<kPatternCount; i++)
+            gPatternPartitions[gPatternsNewOrder[i]] = inPatternPartitions[i];
+    } else {
+        memcpy(gPatternPartitions, inPatternPartitions, sizeof(int) * kPatternCount);
+    }
 
-    memset(gThreadOpCounts, 0, sizeof(int) * kNumThreads);
+    bool reorderPatterns = false;
+    int contiguousPartitions = 0;
+    for (int i=0; i<kPatternCount; i++) {
+        if (i > 0 && (gPatternPartitions[i] != gPatternPartitions[i-1])) {
+            contiguousPartitions++;
+        }
+        if (contiguousPartitions != gPatternPartitions[i]) {
+            reorderPatterns = true;
+            break;
+        }
+    }
 
-    for (int i=0; i<count; i++) {
-        int t = operations[i * numOps + 7] % kNumThreads;
-        for (int j=0; j<numOps; j++) {
-            gThreadOperations[t][gThreadOpCounts[t]*numOps + j] = operations[i*numOps + j];
+    if (reorderPatterns) {
+        returnCode = reorderPatternsByPartition();
+        if (gBufferVersions != NULL)
+            gBufferVersions->touchAll();
+        // compact tips are reordered with their states, other partials are recomputed
+        for (int i = 0; i < (int) gSiteRepeatClasses.size(); i++)
+            clearSiteRepeats(i);
+        for (int i = 0; i < (int) gGapPatterns.size(); i++) {
+            if (i < kTipCount)
+                findTipGapPatterns(i);
+            else
+                gGapPatterns[i].clear();
+        }
+    } else {
+        int currentPartition = gPatternPartitions[0];
+        gPatternPartitionsStartPatterns[currentPartition] = 0;
+        for (int i=0; i<kPatternCount; i++) {
+            if (gPatternPartitions[i] != currentPartition) {
+                currentPartition = gPatternPartitions[i];
+                gPatternPartitionsStartPatterns[currentPartition] = i;
+            }
         }
-        gThreadOpCounts[t]++;
+        gPatternPartitionsStartPatterns[currentPartition+1] = kPatternCount;
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials, this,
-                      true,
-                      (const int*) gThreadOperations[i],
-                      gThreadOpCounts[i],
-                      BEAGLE_OP_NONE));
+    kPartitionsInitialised = true;
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+    if (kNumaPlacement && kThreadingEnabled)
+        placeBuffersByPartition();
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+    return returnCode;
+}
 
-        gThreads[i].cv.notify_one();
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setStateFrequencies(int stateFrequenciesIndex,
+                                                     const double* inStateFrequencies) {
+    if (stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (gStateFrequencies[stateFrequenciesIndex] == NULL) {
+        gStateFrequencies[stateFrequenciesIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
+        if (gStateFrequencies[stateFrequenciesIndex] == 0L)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
+    beagleMemCpy(gStateFrequencies[stateFrequenciesIndex], inStateFrequencies, kStateCount);
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryWeights(int categoryWeightsIndex,
+                                                 const double* inCategoryWeights) {
+    if (categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (gCategoryWeights[categoryWeightsIndex] == NULL) {
+        gCategoryWeights[categoryWeightsIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * kCategoryCount);
+        if (gCategoryWeights[categoryWeightsIndex] == 0L)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
+    beagleMemCpy(gCategoryWeights[categoryWeightsIndex], inCategoryWeights, kCategoryCount);
 
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
-                                                  const int* operations,
-                                                  int count,
-                                                  int cumulativeScaleIndex) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTransitionMatrix(int matrixIndex,
+                                                 double* outMatrix) {
+    // TODO Test with multiple rate categories
+if (T_PAD != 0) {
+    double* offsetOutMatrix = outMatrix;
+    REALTYPE* offsetBeagleMatrix = gTransitionMatrices[matrixIndex];
+    for(int i = 0; i < kCategoryCount; i++) {
+        for(int j = 0; j < kStateCount; j++) {
+            beagleMemCpy(offsetOutMatrix,offsetBeagleMatrix,kStateCount);
+            offsetBeagleMatrix += kTransPaddedStateCount; // Skip padding
+            offsetOutMatrix += kStateCount;
+        }
+    }
+} else {
+    beagleMemCpy(outMatrix,gTransitionMatrices[matrixIndex],
+            kMatrixSize * kCategoryCount);
+}
+    return BEAGLE_SUCCESS;
+}
 
-    REALTYPE* cumulativeScaleBuffer = NULL;
-    if (cumulativeScaleIndex != BEAGLE_OP_NONE)
-        cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getLogLikelihood(double* outSumLogLikelihood) {
 
-    for (int op = 0; op < count; op++) {
+    int returnCode = BEAGLE_SUCCESS;
 
-        int numOps = BEAGLE_OP_COUNT;
-        if (byPartition)
-            numOps = BEAGLE_PARTITION_OP_COUNT;
+    *outSumLogLikelihood = 0.0;    
+    for(int k=0; k < kPatternCount; k++) {
+        if (kMixedPrecision)
+            *outSumLogLikelihood += gMixedLogLikelihoods[k] * gPatternWeights[k];
+        else
+            *outSumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
+    }    
+    
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
 
-        if (DEBUGGING_OUTPUT) {
-            fprintf(stderr, "op[%d] = ", op);
-            for (int j = 0; j < numOps; j++) {
-                std::cerr << operations[op*numOps+j] << " ";
-            }
-            fprintf(stderr, "\n");
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getDerivatives(double* outSumFirstDerivative,
+                                                      double* outSumSecondDerivative) {
+
+    *outSumFirstDerivative = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
+    }
+
+    if (outSumSecondDerivative != NULL) {
+        *outSumSecondDerivative = 0.0;
+        for (int i = 0; i < kPatternCount; i++) {
+            *outSumSecondDerivative += outSecondDerivativesTmp[i] * gPatternWeights[i];
         }
+    }
 
-        const int parIndex = operations[op * numOps];
-        const int writeScalingIndex = operations[op * numOps + 1];
-        const int readScalingIndex = operations[op * numOps + 2];
-        const int child1Index = operations[op * numOps + 3];
-        const int child1TransMatIndex = operations[op * numOps + 4];
-        const int child2Index = operations[op * numOps + 5];
-        const int child2TransMatIndex = operations[op * numOps + 6];
-        int currentPartition = 0;
-        if (byPartition) {
-            currentPartition = operations[op * numOps + 7];
-            cumulativeScaleIndex = operations[op * numOps + 8];
-            if (cumulativeScaleIndex != BEAGLE_OP_NONE)
-                cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
-            else
-                cumulativeScaleBuffer = NULL;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikelihoods) {
+    if (kMixedPrecision) {
+        for (int i = 0; i < kPatternCount; i++)
+            outLogLikelihoods[i] = gMixedLogLikelihoods[kPatternsReordered ? gPatternsNewOrder[i] : i];
+    } else if (kPatternsReordered) {
+        REALTYPE* outLogLikelihoodsOriginalOrder = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount);
+        for (int i=0; i < kPatternCount; i++) {
+            outLogLikelihoodsOriginalOrder[i] = outLogLikelihoodsTmp[gPatternsNewOrder[i]];
         }
+        beagleMemCpy(outLogLikelihoods, outLogLikelihoodsOriginalOrder, kPatternCount);
+        free(outLogLikelihoodsOriginalOrder);
+    } else {
+        beagleMemCpy(outLogLikelihoods, outLogLikelihoodsTmp, kPatternCount);
+    }
 
-        const REALTYPE* partials1 = gPartials[child1Index];
-        const REALTYPE* partials2 = gPartials[child2Index];
+    return BEAGLE_SUCCESS;
+}
 
-        const int* tipStates1 = gTipStates[child1Index];
-        const int* tipStates2 = gTipStates[child2Index];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteDerivatives(double* outFirstDerivatives,
+                                                double* outSecondDerivatives) {
+    beagleMemCpy(outFirstDerivatives, outFirstDerivativesTmp, kPatternCount);
+    if (outSecondDerivatives != NULL)
+        beagleMemCpy(outSecondDerivatives, outSecondDerivativesTmp, kPatternCount);
 
-        const REALTYPE* matrices1 = gTransitionMatrices[child1TransMatIndex];
-        const REALTYPE* matrices2 = gTransitionMatrices[child2TransMatIndex];
+    return BEAGLE_SUCCESS;
+}
 
-        REALTYPE* destPartials = gPartials[parIndex];
 
-        int startPattern = 0;
-        int endPattern = kPatternCount;
-        if (byPartition) {
-            startPattern = gPatternPartitionsStartPatterns[currentPartition];
-            endPattern = gPatternPartitionsStartPatterns[currentPartition + 1];
-        }
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrix(int matrixIndex,
+                                       const double* inMatrix,
+                                       double paddedValue) {
 
-        int rescale = BEAGLE_OP_NONE;
-        REALTYPE* scalingFactors = NULL;
-        
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-            gActiveScalingFactors[parIndex - kTipCount] = 0;
-            if (tipStates1 == 0 && tipStates2 == 0)
-                rescale = 2;
-        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            rescale = 1;
-            scalingFactors = gScaleBuffers[parIndex - kTipCount];
-        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
-            if (tipStates1 == 0 && tipStates2 == 0) {
-                rescale = 1;
-                removeScaleFactors(&readScalingIndex, 1, cumulativeScaleIndex);
-                scalingFactors = gScaleBuffers[writeScalingIndex];
-            }
-        } else if (writeScalingIndex >= 0) {
-            rescale = 1;
-            scalingFactors = gScaleBuffers[writeScalingIndex];
-        } else if (readScalingIndex >= 0) {
-            rescale = 0;
-            scalingFactors = gScaleBuffers[readScalingIndex];
-        }
+    matricesChanged(&matrixIndex, 1);
 
-        if (DEBUGGING_OUTPUT) {
-            std::cerr << "Rescale= " << rescale << " writeIndex= " << writeScalingIndex
-                     << " readIndex = " << readScalingIndex << "\n";
+if (T_PAD != 0) {
+    const double* offsetInMatrix = inMatrix;
+    REALTYPE* offsetBeagleMatrix = gTransitionMatrices[matrixIndex];
+    for(int i = 0; i < kCategoryCount; i++) {
+        for(int j = 0; j < kStateCount; j++) {
+            beagleMemCpy(offsetBeagleMatrix, offsetInMatrix, kStateCount);
+            offsetBeagleMatrix[kStateCount] = paddedValue;
+            offsetBeagleMatrix += kTransPaddedStateCount; // Skip padding
+            offsetInMatrix += kStateCount;
         }
+    }
+} else {
+    beagleMemCpy(gTransitionMatrices[matrixIndex], inMatrix,
+                 kMatrixSize * kCategoryCount);
+}
+    return BEAGLE_SUCCESS;
+}
+    
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrices(const int* matrixIndices,
+                                                             const double* inMatrices,
+                                                             const double* paddedValues,
+                                                             int count) {
+    matricesChanged(matrixIndices, count);
 
-        if (tipStates1 != NULL) {
-            if (tipStates2 != NULL ) {
-                if (rescale == 0) { // Use fixed scaleFactors
-                    calcStatesStatesFixedScaling(destPartials, tipStates1, matrices1, tipStates2,
-                                                 matrices2, scalingFactors, startPattern, endPattern);
-                } else {
-                    // First compute without any scaling
-                    calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
-                                     startPattern, endPattern);
-                    if (rescale == 1) { // Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
-                }
-            } else {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2,
-                                                   matrices2, scalingFactors, startPattern, endPattern);
-                } else {
-                    calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
-                                       startPattern, endPattern);
-                    if (rescale == 1) { // Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
-                }
-            }
-        } else {
-            if (tipStates2 != NULL) {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
-                                                   scalingFactors, startPattern, endPattern);
-                } else {
-                    calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
-                                       startPattern, endPattern);
-                    if (rescale == 1) {// Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
-                }
-            } else {
-                if (rescale == 2) {
-                    int sIndex = parIndex - kTipCount;
-                    calcPartialsPartialsAutoScaling(destPartials,partials1,matrices1,partials2,matrices2,
-                                                     &gActiveScalingFactors[sIndex]);
-                    if (gActiveScalingFactors[sIndex])
-                        autoRescalePartials(destPartials, gAutoScaleBuffers[sIndex]);
-
-                } else if (rescale == 0) {
-                    calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,
-                                                     matrices2,scalingFactors,startPattern,endPattern);
-                } else {
-                    calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
-                                         startPattern, endPattern);
-                    if (rescale == 1) {// Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
-                }
-            }
-        }
-        
-        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            int parScalingIndex = parIndex - kTipCount;
-            int child1ScalingIndex = child1Index - kTipCount;
-            int child2ScalingIndex = child2Index - kTipCount;
-            if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
-                int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 2, parScalingIndex);
-            } else if (child1ScalingIndex >= 0) {
-                int scalingIndices[1] = {child1ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
-            } else if (child2ScalingIndex >= 0) {
-                int scalingIndices[1] = {child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
-            }
-        }
+    for (int k = 0; k < count; k++) {
+        const double* inMatrix = inMatrices + k*kStateCount*kStateCount*kCategoryCount;
+        int matrixIndex = matrixIndices[k];
         
-        if (DEBUGGING_OUTPUT) {
-            if (scalingFactors != NULL && rescale == 0) {
-                for(int i=0; i<kPatternCount; i++)
-                    fprintf(stderr,"old scaleFactor[%d] = %.5f\n",i,scalingFactors[i]);
+if (T_PAD != 0) {
+        const double* offsetInMatrix = inMatrix;
+        REALTYPE* offsetBeagleMatrix = gTransitionMatrices[matrixIndex];
+        for(int i = 0; i < kCategoryCount; i++) {
+            for(int j = 0; j < kStateCount; j++) {
+                beagleMemCpy(offsetBeagleMatrix, offsetInMatrix, kStateCount);
+                offsetBeagleMatrix[kStateCount] = paddedValues[k];
+                offsetBeagleMatrix += kTransPaddedStateCount; // Skip padding
+                offsetInMatrix += kStateCount;
             }
-            fprintf(stderr,"Result partials:\n");
-            for(int i = 0; i < kPartialsSize; i++)
-                fprintf(stderr,"destP[%d] = %.5f\n",i,destPartials[i]);
         }
+} else {
+        beagleMemCpy(gTransitionMatrices[matrixIndex], inMatrix,
+                     kMatrixSize * kCategoryCount);
+}
     }
-
+    
     return BEAGLE_SUCCESS;
 }
 
+///////////////////////////
+//---TODO: Epoch model---//
+///////////////////////////
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::waitForPartials(const int* destinationPartials,
-                                   int destinationPartialsCount) {
-    return BEAGLE_SUCCESS;
-}
-
+//TODO: move to EigenDecompositionSquare
 
 BEAGLE_CPU_TEMPLATE
-    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoods(const int* bufferIndices,
-                                                             const int* categoryWeightsIndices,
-                                                             const int* stateFrequenciesIndices,
-                                                             const int* cumulativeScaleIndices,
-                                                             int count,
-                                                             double* outSumLogLikelihood) {
-
-    if (count == 1) {
-        // We treat this as a special case so that we don't have convoluted logic
-        //      at the end of the loop over patterns
-        int cumulativeScalingFactorIndex;
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-            cumulativeScalingFactorIndex = 0;
-        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            cumulativeScalingFactorIndex = bufferIndices[0] - kTipCount; 
-        } else {
-            cumulativeScalingFactorIndex = cumulativeScaleIndices[0];
-        }
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* firstIndices,
+        const int* secondIndices,
+        const int* resultIndices,
+        int matrixCount) {
 
-        if (kAutoRootPartitioningEnabled) {
-            calcRootLogLikelihoodsByAutoPartitionAsync(bufferIndices,
-                                                       categoryWeightsIndices,
-                                                       stateFrequenciesIndices,
-                                                       cumulativeScaleIndices,
-                                                       gAutoPartitionIndices,
-                                                       gAutoPartitionOutSumLogLikelihoods);
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t Entering BeagleCPUImpl::convolveTransitionMatrices \n");
+#endif
 
-            *outSumLogLikelihood = 0.0;
+    int returnCode = BEAGLE_SUCCESS;
 
-            for (int i = 0; i < kPartitionCount; i++) {
-                *outSumLogLikelihood += gAutoPartitionOutSumLogLikelihoods[i];
-            }
+    matricesChanged(resultIndices, matrixCount);
 
-            if (*outSumLogLikelihood != *outSumLogLikelihood) {
-                return BEAGLE_ERROR_FLOATING_POINT;
-            } else {
-                return BEAGLE_SUCCESS;
-            }
-        } else {
-            return calcRootLogLikelihoods(bufferIndices[0], categoryWeightsIndices[0], stateFrequenciesIndices[0],
-                                   cumulativeScalingFactorIndex, outSumLogLikelihood);
-        }
-    }
-    else
-    {
-        return calcRootLogLikelihoodsMulti(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices,
-                                    cumulativeScaleIndices, count, outSumLogLikelihood);
-    }
-}
+    for (int u = 0; u < matrixCount; u++) {
 
-BEAGLE_CPU_TEMPLATE
-    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsByPartition(
-                                                                  const int* bufferIndices,
-                                                                  const int* categoryWeightsIndices,
-                                                                  const int* stateFrequenciesIndices,
-                                                                  const int* cumulativeScaleIndices,
-                                                                  const int* partitionIndices,
-                                                                  int partitionCount,
-                                                                  int count,
-                                                                  double* outSumLogLikelihoodByPartition,
-                                                                  double* outSumLogLikelihood) {
+        if(firstIndices[u] == resultIndices[u] || secondIndices[u] == resultIndices[u]) {
 
-    int returnCode = BEAGLE_SUCCESS;
+#ifdef BEAGLE_DEBUG_FLOW
+            fprintf(stderr, "In-place convolution is not allowed \n");
+#endif
 
-    if (count == 1) {
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-            returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
-        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
-        } else {
-            if (kThreadingEnabled) {
-                calcRootLogLikelihoodsByPartitionAsync(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);                
-            } else {
-                calcRootLogLikelihoodsByPartition(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);
-            }
+            returnCode = BEAGLE_ERROR_OUT_OF_RANGE;
+            break;
 
-            *outSumLogLikelihood = 0.0;
+        }//END: overwrite check
 
-            for (int i = 0; i < partitionCount; i++) {
-                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
-            }
+        REALTYPE* C = gTransitionMatrices[resultIndices[u]];
+        REALTYPE* A = gTransitionMatrices[firstIndices[u]];
+        REALTYPE* B = gTransitionMatrices[secondIndices[u]];
 
-            if (*outSumLogLikelihood != *outSumLogLikelihood) 
-                returnCode = BEAGLE_ERROR_FLOATING_POINT;
-        }
-    } else {
-        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
-    }
+        int n = 0;
+        for (int l = 0; l < kCategoryCount; l++) {
 
-    return returnCode;
-}
+            for (int i = 0; i < kStateCount; i++) {
+                for (int j = 0; j < kStateCount; j++) {
 
-BEAGLE_CPU_TEMPLATE
-    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartitionAsync(
-                                                        const int* bufferIndices,
-                                                        const int* categoryWeightsIndices,
-                                                        const int* stateFrequenciesIndices,
-                                                        const int* cumulativeScaleIndices,
-                                                        const int* partitionIndices,
-                                                        int partitionCount,
-                                                        double* outSumLogLikelihoodByPartition) {
+                    REALTYPE sum = 0.0;
+                    for (int k = 0; k < kStateCount; k++) {
+                        sum += A[k + kTransPaddedStateCount * i] * B[j + kTransPaddedStateCount * k];
+                    }
+//                  printf("%.30f %.30f %d: \n", C[n], sum, l);
+                    C[n] = sum;
+                    n++;
 
+                }//END: j loop
 
-    int partitionsPerThreadFloor = partitionCount / kNumThreads;
-    int partitionsRemainder = partitionCount % kNumThreads;
-    int currentPartitionIndex = 0;
-    int threadsUsed = (partitionCount < kNumThreads ? partitionCount : kNumThreads);
-    for (int i=0; i<threadsUsed; i++) {
-        int partitionCountThread = partitionsPerThreadFloor;
-        if (partitionsRemainder) {
-            partitionCountThread++;
-            partitionsRemainder--;
-        }
+                if (T_PAD != 0) {
 
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition, this,
-                      &bufferIndices[currentPartitionIndex], &categoryWeightsIndices[currentPartitionIndex],
-                      &stateFrequenciesIndices[currentPartitionIndex], &cumulativeScaleIndices[currentPartitionIndex],
-                      &partitionIndices[currentPartitionIndex], partitionCountThread,
-                      &outSumLogLikelihoodByPartition[currentPartitionIndex]));
+                    //                      A[n] = 1.0;
+                    //                      B[n] = 1.0;
+                    C[n] = 1.0;
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+                    n += T_PAD;
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+                }//END: padding check
 
-        gThreads[i].cv.notify_one();
+            }//END: i loop
 
-        currentPartitionIndex += partitionCountThread;
-    }
+            A += kStateCount * kTransPaddedStateCount;
+            B += kStateCount * kTransPaddedStateCount;
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
 
-}
+            ///////////////
+            //      printf("rate category: %d \n", l);
+            //
+            //      printf("A:");
+            //      for (int i = 0; i < kStateCount; i++) {
+            //          printf("| ");
+            //          for (int j = 0; j < kStateCount; j++)
+            //          printf("%f ", A[j + i * kTransPaddedStateCount]);
+            //          printf("|\n");
+            //      }
+            //      printf("\n");
+            //
+            //      printf("A:");
+            //      for (int i = 0; i < kStateCount; i++) {
+            //          printf("| ");
+            //          for (int j = 0; j < kStateCount; j++)
+            //          printf("%f ", B[j + i * kTransPaddedStateCount]);
+            //          printf("|\n");
+            //      }
+            //      printf("\n");
+            //
+//                      printf("C: \n");
+//                      for (int i = 0; i < kStateCount; i++) {
+//                          printf("| ");
+//                          for (int j = 0; j < kTransPaddedStateCount; j++)
+//                          printf("%.20f ", C[j + i * kTransPaddedStateCount]);
+//                          printf("|\n");
+//                      }
+//                      printf("\n");
+            ////////////////
 
-BEAGLE_CPU_TEMPLATE
-    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByAutoPartitionAsync(
-                                                        const int* bufferIndices,
-                                                        const int* categoryWeightsIndices,
-                                                        const int* stateFrequenciesIndices,
-                                                        const int* cumulativeScaleIndices,
-                                                        const int* partitionIndices,
-                                                        double* outSumLogLikelihoodByPartition) {
+        }//END: rates loop
 
-    for (int i=0; i<kNumThreads; i++) {
+    }//END: u loop
 
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition, this,
-                      bufferIndices, categoryWeightsIndices,
-                      stateFrequenciesIndices, cumulativeScaleIndices,
-                      &partitionIndices[i], 1,
-                      &outSumLogLikelihoodByPartition[i]));
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t Leaving BeagleCPUImpl::convolveTransitionMatrices \n");
+#endif
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+    return returnCode;
+}//END: convolveTransitionMatrices
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrixChains(const int* chainIndices,
+                                                                      const int* chainLengths,
+                                                                      const int* scratchIndices,
+                                                                      const int* resultIndices,
+                                                                      int chainCount) {
 
-        gThreads[i].cv.notify_one();
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t Entering BeagleCPUImpl::convolveTransitionMatrixChains \n");
+#endif
 
+    // intermediate products stay in per-job buffers, so scratch matrices are not needed here
+    std::vector<int> chainOffsets(chainCount + 1, 0);
+    double work = 0.0;
+    for (int c = 0; c < chainCount; c++) {
+        if (chainLengths[c] < 1)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        chainOffsets[c + 1] = chainOffsets[c] + chainLengths[c];
+        for (int j = chainOffsets[c]; j < chainOffsets[c + 1]; j++) {
+            if (chainIndices[j] == resultIndices[c])
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+        }
+        work += (double) (chainLengths[c] - 1) * kCategoryCount * kStateCount * kStateCount * kStateCount;
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
+    matricesChanged(resultIndices, chainCount);
+
+    // unit u is category u % kCategoryCount of chain u / kCategoryCount
+    auto convolveRange = [=] (int begin, int end) {
+        std::vector<REALTYPE> products(2 * kMatrixSize);
+        for (int u = begin; u < end; u++) {
+            const int c = u / kCategoryCount;
+            const int categoryOffset = (u % kCategoryCount) * kMatrixSize;
+            const int* chain = chainIndices + chainOffsets[c];
+
+            REALTYPE* product = &products[0];
+            REALTYPE* next = &products[kMatrixSize];
+            memcpy(product, gTransitionMatrices[chain[0]] + categoryOffset, sizeof(REALTYPE) * kMatrixSize);
+            for (int m = 1; m < chainLengths[c]; m++) {
+                const REALTYPE* B = gTransitionMatrices[chain[m]] + categoryOffset;
+                int n = 0;
+                for (int i = 0; i < kStateCount; i++) {
+                    for (int j = 0; j < kStateCount; j++) {
+                        REALTYPE sum = 0.0;
+                        for (int k = 0; k < kStateCount; k++)
+                            sum += product[k + kTransPaddedStateCount * i] * B[j + kTransPaddedStateCount * k];
+                        next[n++] = sum;
+                    }
+                    if (T_PAD != 0) {
+                        next[n] = 1.0;
+                        n += T_PAD;
+                    }
+                }
+                std::swap(product, next);
+            }
+            memcpy(gTransitionMatrices[resultIndices[c]] + categoryOffset, product,
+                   sizeof(REALTYPE) * kMatrixSize);
+        }
+    };
+
+    int unitCount = chainCount * kCategoryCount;
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP) || unitCount < 2 || work < BEAGLE_CPU_EIGEN_MIN_PARALLEL_WORK) {
+        convolveRange(0, unitCount);
+    } else {
+        ThreadPool* pool = getThreadPool();
+        int jobCount = pool->getThreadCount();
+        if (jobCount > unitCount)
+            jobCount = unitCount;
+
+        ThreadPoolTaskGroup group;
+        for (int j = 0; j < jobCount; j++) {
+            int begin = (int) (((long) unitCount * j) / jobCount);
+            int end = (int) (((long) unitCount * (j + 1)) / jobCount);
+            pool->submit(group, [=] () { convolveRange(begin, end); }, j);
+        }
+        group.wait();
     }
 
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t Leaving BeagleCPUImpl::convolveTransitionMatrixChains \n");
+#endif
+
+    return BEAGLE_SUCCESS;
 }
 
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bufferIndices,
-                                                         const int* categoryWeightsIndices,
-                                                         const int* stateFrequenciesIndices,
-                                                         const int* scaleBufferIndices,
-                                                         int count,
-                                                         double* outSumLogLikelihood) {
-    // Here we do the 3 similar operations:
-    //              1. to set the lnL to the contribution of the first subset,
-    //              2. to add the lnL for other subsets up to the penultimate
-    //              3. to add the final subset and take the lnL
-    //      This form of the calc would not work when count == 1 because
-    //              we need operation 1 and 3 in the preceding list.  This is not
-    //              a problem, though as we deal with count == 1 in the previous
-    //              branch.
-
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
-
-    int returnCode = BEAGLE_SUCCESS;
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatrices(int eigenIndex,
+                                            const int* probabilityIndices,
+                                            const int* firstDerivativeIndices,
+                                            const int* secondDerivativeIndices,
+                                            const double* edgeLengths,
+                                            int count) {
+    // for (int i = 0; i < count; i++) {
+    //     printf("uTM %d %d %f %d\n", eigenIndex, probabilityIndices[i], edgeLengths[i], 0);
+    // }
 
-    for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
-        const int rootPartialIndex = bufferIndices[subsetIndex];
-        const REALTYPE* rootPartials = gPartials[rootPartialIndex];
-        const REALTYPE* frequencies = gStateFrequencies[stateFrequenciesIndices[subsetIndex]];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[subsetIndex]];
-        int u = 0;
-        int v = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            for (int i = 0; i < kStateCount; i++) {
-                integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
-                u++;
-                v++;
-            }
-            v += P_PAD;
-        }
-        for (int l = 1; l < kCategoryCount; l++) {
-            u = 0;
-            for (int k = 0; k < kPatternCount; k++) {
-                for (int i = 0; i < kStateCount; i++) {
-                    integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
-                    u++;
-                    v++;
-                }
-                v += P_PAD;
-            }
+    std::vector<int> missIndices;
+    std::vector<double> missLengths;
+    if (gMatrixCache != NULL && firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
+        // only the matrices the cache does not hold are computed
+        findCachedMatrices(eigenIndex, NULL, NULL, probabilityIndices, edgeLengths, count);
+        for (int i = 0; i < (int) gMatrixCacheMisses.size(); i++) {
+            missIndices.push_back(probabilityIndices[gMatrixCacheMisses[i]]);
+            missLengths.push_back(edgeLengths[gMatrixCacheMisses[i]]);
         }
-        u = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            REALTYPE sum = 0.0;
-            for (int i = 0; i < kStateCount; i++) {
-                sum += ((REALTYPE)frequencies[i]) * integrationTmp[u];
-                u++;
-            }
+        count = missIndices.size();
+        probabilityIndices = missIndices.data();
+        edgeLengths = missLengths.data();
+    } else {
+        matricesChanged(probabilityIndices, count);
+        matricesChanged(firstDerivativeIndices, count);
+        matricesChanged(secondDerivativeIndices, count);
+    }
 
-            // TODO: allow only some subsets to have scale indices
-            if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-                int cumulativeScalingFactorIndex;
-                if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-                    cumulativeScalingFactorIndex = rootPartialIndex - kTipCount; 
-                else
-                    cumulativeScalingFactorIndex = scaleBufferIndices[subsetIndex];
-                
-                const REALTYPE* cumulativeScaleFactors = gScaleBuffers[cumulativeScalingFactorIndex];
+    // threaded instances spread large updates across their workers
+    gEigenDecomposition->setThreadPool((kFlags & BEAGLE_FLAG_THREADING_CPP) ? getThreadPool() : NULL);
+    gEigenDecomposition->updateTransitionMatrices(eigenIndex,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
+                                                  edgeLengths,gCategoryRates[0],gTransitionMatrices,count);
 
-                if (subsetIndex == 0) {
-                    indexMaxScale[k] = 0;
-                    maxScaleFactor[k] = cumulativeScaleFactors[k];
-                    for (int j = 1; j < count; j++) {
-                        REALTYPE tmpScaleFactor;
-                        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-                            tmpScaleFactor = gScaleBuffers[bufferIndices[j] - kTipCount][k]; 
-                        else
-                            tmpScaleFactor = gScaleBuffers[scaleBufferIndices[j]][k];
+    if (!missIndices.empty()) {
+        for (int i = 0; i < count; i++)
+            gMatrixCache->set(probabilityIndices[i], eigenIndex, 0, edgeLengths[i]);
+    }
 
-                        if (tmpScaleFactor > maxScaleFactor[k]) {
-                            indexMaxScale[k] = j;
-                            maxScaleFactor[k] = tmpScaleFactor;
-                        }
-                    }
-                }
+    return BEAGLE_SUCCESS;
+}
 
-                if (subsetIndex != indexMaxScale[k])
-                    sum *= exp((REALTYPE)(cumulativeScaleFactors[k] - maxScaleFactor[k]));
-            }
 
-            if (subsetIndex == 0) {
-                outLogLikelihoodsTmp[k] = sum;
-            } else if (subsetIndex == count - 1) {
-                REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sum;
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithModelCategories(int* eigenIndices,
+                                            const int* probabilityIndices,
+                                            const int* firstDerivativeIndices,
+                                            const int* secondDerivativeIndices,
+                                            const double* edgeLengths,
+                                            int count) {
 
-                outLogLikelihoodsTmp[k] = log(tmpSum);
-            } else {
-                outLogLikelihoodsTmp[k] += sum;
-            }
-        }
-    }
+    matricesChanged(probabilityIndices, count);
+    matricesChanged(firstDerivativeIndices, count);
+    matricesChanged(secondDerivativeIndices, count);
 
-    if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-        for(int i=0; i<kPatternCount; i++)
-            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
-    }
+    gEigenDecomposition->setThreadPool((kFlags & BEAGLE_FLAG_THREADING_CPP) ? getThreadPool() : NULL);
+    gEigenDecomposition->updateTransitionMatricesWithModelCategories(eigenIndices,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
+                                                  edgeLengths,gTransitionMatrices,count);
+    return BEAGLE_SUCCESS;
+}
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                                                             const int* probabilityIndices,
+                                                                             const double* edgeLengths,
+                                                                             int count,
+                                                                             int replicateCount) {
+    if (replicateCount < 1 || kCategoryCount % replicateCount != 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int r = 0; r < replicateCount; r++) {
+        if (eigenIndices[r] < 0 || eigenIndices[r] >= kEigenDecompCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
     }
 
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
+    matricesChanged(probabilityIndices, count);
 
+    gEigenDecomposition->setThreadPool((kFlags & BEAGLE_FLAG_THREADING_CPP) ? getThreadPool() : NULL);
+    gEigenDecomposition->updateTransitionMatricesForReplicates(eigenIndices, gCategoryRates[0],
+                                                               probabilityIndices, edgeLengths,
+                                                               replicateCount, gTransitionMatrices,
+                                                               count);
+    return BEAGLE_SUCCESS;
 }
 
+
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
-                            const int categoryWeightsIndex,
-                            const int stateFrequenciesIndex,
-                            const int scalingFactorsIndex,
-                            double* outSumLogLikelihood) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                                                                  const int* categoryRateIndices,
+                                                                                  const int* probabilityIndices,
+                                                                                  const int* firstDerivativeIndices,
+                                                                                  const int* secondDerivativeIndices,
+                                                                                  const double* edgeLengths,
+                                                                                  int count) {
 
-    int returnCode = BEAGLE_SUCCESS;
+    // TODO: move loop to within gEigenDecomposition
 
-    const REALTYPE* rootPartials = gPartials[bufferIndex];
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
-    int u = 0;
-    int v = 0;
-    for (int k = 0; k < kPatternCount; k++) {
-        for (int i = 0; i < kStateCount; i++) {
-            integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
-            u++;
-            v++;
-        }
-        v += P_PAD;
-    }
-    for (int l = 1; l < kCategoryCount; l++) {
-        u = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            for (int i = 0; i < kStateCount; i++) {
-                integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
-                u++;
-                v++;
-            }
-            v += P_PAD;
-        }
-    }
-    u = 0;
-    for (int k = 0; k < kPatternCount; k++) {
-        REALTYPE sum = 0.0;
-        for (int i = 0; i < kStateCount; i++) {
-            sum += freqs[i] * integrationTmp[u];
-            u++;
+    if (gMatrixCache != NULL && firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
+        findCachedMatrices(0, eigenIndices, categoryRateIndices, probabilityIndices, edgeLengths, count);
+
+        gEigenDecomposition->setThreadPool((kFlags & BEAGLE_FLAG_THREADING_CPP) ? getThreadPool() : NULL);
+        for (int k = 0; k < (int) gMatrixCacheMisses.size(); k++) {
+            int i = gMatrixCacheMisses[k];
+            gEigenDecomposition->updateTransitionMatrices(eigenIndices[i],
+                                                          &probabilityIndices[i],
+                                                          NULL,
+                                                          NULL,
+                                                          &edgeLengths[i],
+                                                          gCategoryRates[categoryRateIndices[i]],
+                                                          gTransitionMatrices,
+                                                          1);
+            gMatrixCache->set(probabilityIndices[i], eigenIndices[i], categoryRateIndices[i], edgeLengths[i]);
         }
 
-        outLogLikelihoodsTmp[k] = log(sum);
+        return BEAGLE_SUCCESS;
     }
 
-    if (scalingFactorsIndex >= 0) {
-        const REALTYPE* cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int i=0; i<kPatternCount; i++) {
-            outLogLikelihoodsTmp[i] += cumulativeScaleFactors[i];
-        }
-    }
+    matricesChanged(probabilityIndices, count);
+    matricesChanged(firstDerivativeIndices, count);
+    matricesChanged(secondDerivativeIndices, count);
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    gEigenDecomposition->setThreadPool((kFlags & BEAGLE_FLAG_THREADING_CPP) ? getThreadPool() : NULL);
+    for (int i = 0; i < count; i++) {
+        // printf("uTMWMM %d %d %f %d\n", eigenIndices[i], probabilityIndices[i], edgeLengths[i], categoryRateIndices[i]);
 
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    // TODO: merge the three kPatternCount loops above into one
+        const int* firstDeriv  = NULL;
+        const int* secondDeriv = NULL;
+        if (firstDerivativeIndices != NULL && secondDerivativeIndices == NULL) {
+            firstDeriv = &firstDerivativeIndices[i];
+        } else if (firstDerivativeIndices != NULL && secondDerivativeIndices != NULL) {
+            firstDeriv  = &firstDerivativeIndices[i];
+            secondDeriv = &secondDerivativeIndices[i];
+        }
 
-    return returnCode;
+        gEigenDecomposition->updateTransitionMatrices(eigenIndices[i],
+                                                      &probabilityIndices[i],
+                                                      firstDeriv,
+                                                      secondDeriv,
+                                                      &edgeLengths[i],
+                                                      gCategoryRates[categoryRateIndices[i]],
+                                                      gTransitionMatrices,
+                                                      1);
+    }
+
+    return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
-                                                         const int* bufferIndices,
-                                                         const int* categoryWeightsIndices,
-                                                         const int* stateFrequenciesIndices,
-                                                         const int* cumulativeScaleIndices,
-                                                         const int* partitionIndices,
-                                                         int partitionCount,
-                                                         double* outSumLogLikelihoodByPartition) {
-
-    for (int p = 0; p < partitionCount; p++) {
-        int pIndex = partitionIndices[p];
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithRateMatrix(const double* inRateMatrix,
+                                                                              const int* probabilityIndices,
+                                                                              const double* edgeLengths,
+                                                                              int count) {
+    return exponentiateRateMatrix(inRateMatrix, NULL, probabilityIndices, edgeLengths, count);
+}
 
-        int startPattern = gPatternPartitionsStartPatterns[pIndex];
-        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatrixDerivativesWithRateMatrix(const double* inRateMatrix,
+                                                                                       const double* inRateMatrixDerivative,
+                                                                                       const int* derivativeIndices,
+                                                                                       const double* edgeLengths,
+                                                                                       int count) {
+    return exponentiateRateMatrix(inRateMatrix, inRateMatrixDerivative, derivativeIndices,
+                                  edgeLengths, count);
+}
 
-        const REALTYPE* rootPartials = gPartials[bufferIndices[p]];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[p]];
-        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[p]];
-        const int scalingFactorsIndex = cumulativeScaleIndices[p];
-        int u = startPattern * kStateCount;
-        int v = startPattern * kPartialsPaddedStateCount;
-        for (int k = startPattern; k < endPattern; k++) {
-            for (int i = 0; i < kStateCount; i++) {
-                integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
-                u++;
-                v++;
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::exponentiateRateMatrix(const double* inRateMatrix,
+                                                              const double* inRateMatrixDerivative,
+                                                              const int* matrixIndices,
+                                                              const double* edgeLengths,
+                                                              int count) {
+    if (count <= 0)
+        return BEAGLE_SUCCESS;
+
+    const int matrixCount = count * kCategoryCount;
+    const int matrixSize = kStateCount * kStateCount;
+    const double* categoryRates = gCategoryRates[0];
+    std::vector<double> matrices((size_t) matrixCount * matrixSize);
+    double* outMatrices = &matrices[0];
+
+    // matrix k is edge k / kCategoryCount under category k % kCategoryCount, the order
+    // setTransitionMatrices expects
+    auto computeRange = [=] (int begin, int end) {
+        if (inRateMatrixDerivative == NULL) {
+            MatrixExponential exponential(kStateCount);
+            for (int k = begin; k < end; k++) {
+                exponential.compute(inRateMatrix,
+                                    edgeLengths[k / kCategoryCount] * categoryRates[k % kCategoryCount],
+                                    outMatrices + (size_t) k * matrixSize);
             }
-            v += P_PAD;
-        }
-        for (int l = 1; l < kCategoryCount; l++) {
-            u = startPattern * kStateCount;
-            v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
-            for (int k = startPattern; k < endPattern; k++) {
-                for (int i = 0; i < kStateCount; i++) {
-                    integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
-                    u++;
-                    v++;
-                }
-                v += P_PAD;
+        } else {
+            MatrixExponential exponential(2 * kStateCount);
+            for (int k = begin; k < end; k++) {
+                exponential.computeDerivative(inRateMatrix, inRateMatrixDerivative,
+                                              edgeLengths[k / kCategoryCount] * categoryRates[k % kCategoryCount],
+                                              outMatrices + (size_t) k * matrixSize);
             }
         }
-        u = startPattern * kStateCount;
-        for (int k = startPattern; k < endPattern; k++) {
-            REALTYPE sum = 0.0;
-            for (int i = 0; i < kStateCount; i++) {
-                sum += freqs[i] * integrationTmp[u];
-                u++;
-            }
+    };
 
-            outLogLikelihoodsTmp[k] = log(sum);
+    // each exponential takes several dense products, so the eigen update threshold is conservative
+    double work = (double) matrixCount * matrixSize * kStateCount;
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP) || matrixCount < 2 || work < BEAGLE_CPU_EIGEN_MIN_PARALLEL_WORK) {
+        computeRange(0, matrixCount);
+    } else {
+        ThreadPool* pool = getThreadPool();
+        int jobCount = pool->getThreadCount();
+        if (jobCount > matrixCount)
+            jobCount = matrixCount;
+
+        ThreadPoolTaskGroup group;
+        for (int j = 0; j < jobCount; j++) {
+            int begin = (int) (((long) matrixCount * j) / jobCount);
+            int end = (int) (((long) matrixCount * (j + 1)) / jobCount);
+            pool->submit(group, [=] () { computeRange(begin, end); }, j);
         }
+        group.wait();
+    }
 
-        if (scalingFactorsIndex >= 0) {
-            const REALTYPE* cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
-            for(int i=startPattern; i<endPattern; i++) {
-                outLogLikelihoodsTmp[i] += cumulativeScaleFactors[i];
-            }
-        }
+    // derivative matrices are padded with zeros, as those of updateTransitionMatrices
+    std::vector<double> paddedValues(count, (inRateMatrixDerivative == NULL ? 1.0 : 0.0));
+    return setTransitionMatrices(matrixIndices, outMatrices, &paddedValues[0], count);
+}
 
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        for (int i = startPattern; i < endPattern; i++) {
-            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-        }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
+                                                      int count,
+                                                      int cumulativeScaleIndex) {
+
+    int returnCode = BEAGLE_ERROR_GENERAL;
+
+    if (kSiteRepeats)
+        updateSiteRepeats(operations, count);
+    if (kGapPatternSkipping)
+        updateGapPatterns(operations, count);
+
+    operations = removeCleanOperations(operations, count, cumulativeScaleIndex);
+    if (count == 0)
+        return BEAGLE_SUCCESS;
+
+    if (gResidentPartials != NULL)
+        return upPartialsCheckpointed(operations, count, cumulativeScaleIndex);
+
+    if (kLazyBuffers)
+        commitOperationBuffers(operations, count, BEAGLE_OP_COUNT, cumulativeScaleIndex);
+    if (kScratchPrefetchDistance > 0)
+        prefetchOperations(operations, std::min(count, kScratchPrefetchDistance), BEAGLE_OP_COUNT);
+
+    if (useOpenMPPatterns()) {
+        returnCode = upPartialsOpenMP(false,
+                                      operations,
+                                      count,
+                                      cumulativeScaleIndex);
+    } else if (useCategoryParallel()) {
+        returnCode = upPartialsByCategoryAsync(operations,
+                                               count,
+                                               cumulativeScaleIndex);
+    } else if (kAutoPartitioningEnabled) {
+        autoPartitionPartialsOperations(operations,
+                                        gAutoPartitionOperations,
+                                        count,
+                                        cumulativeScaleIndex);
+        count *= kPartitionCount;
+        if (useParallelOperations()) {
+            returnCode = upPartialsByDependencyAsync(true,
+                                                     (const int*) gAutoPartitionOperations,
+                                                     count,
+                                                     BEAGLE_OP_NONE);
+        } else {
+            returnCode = upPartialsByPartitionAsync((const int*) gAutoPartitionOperations,
+                                                    count); 
+        }
+    } else if (useParallelOperations()) {
+        returnCode = upPartialsByDependencyAsync(false,
+                                                 operations,
+                                                 count,
+                                                 cumulativeScaleIndex);
+    } else if (usePatternTiling()) {
+        returnCode = upPartialsTiled(operations,
+                                     count,
+                                     cumulativeScaleIndex);
+    } else {
+        bool byPartition = false;
+        returnCode = upPartials(byPartition,
+                                operations,
+                                count,
+                                cumulativeScaleIndex);
     }
 
+    return returnCode;
 }
 
+
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactors(const int* scalingIndices,
-                                                int  count,
-                                                int  cumulativeScalingIndex) {
-    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[0];
-        for(int j=0; j<kPatternCount; j++)
-            cumulativeScaleBuffer[j] =  0;
-        for(int i=0; i<count; i++) {
-            int sIndex = scalingIndices[i] - kTipCount;
-            if (gActiveScalingFactors[sIndex]) {
-                const signed short* scaleBuffer = gAutoScaleBuffers[sIndex];
-                for(int j=0; j<kPatternCount; j++) {
-                    cumulativeScaleBuffer[j] += M_LN2 * scaleBuffer[j];
-                }
-            }
-        }
-                
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* operations,
+                                                                 int count) {
+    
+    int returnCode = BEAGLE_ERROR_GENERAL;
+
+    // a partially computed buffer could not be evicted and recomputed
+    if (gResidentPartials != NULL)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    // each operation computes only part of its destination, so none is skipped
+    if (gBufferVersions != NULL) {
+        for (int op = 0; op < count; op++)
+            gBufferVersions->touchOperation(operations + op * BEAGLE_PARTITION_OP_COUNT);
+    }
+    if (kSiteRepeats) {
+        for (int op = 0; op < count; op++)
+            clearSiteRepeats(operations[op * BEAGLE_PARTITION_OP_COUNT]);
+    }
+    if (kGapPatternSkipping) {
+        for (int op = 0; op < count; op++)
+            gGapPatterns[operations[op * BEAGLE_PARTITION_OP_COUNT]].clear();
+    }
+    if (kLazyBuffers)
+        commitOperationBuffers(operations, count, BEAGLE_PARTITION_OP_COUNT, BEAGLE_OP_NONE);
+    if (kScratchPrefetchDistance > 0)
+        prefetchOperations(operations, std::min(count, kScratchPrefetchDistance),
+                           BEAGLE_PARTITION_OP_COUNT);
+
+    if (useOpenMPPatterns()) {
+        returnCode = upPartialsOpenMP(true,
+                                      operations,
+                                      count,
+                                      BEAGLE_OP_NONE);
+    } else if (useParallelOperations()) {
+        returnCode = upPartialsByDependencyAsync(true,
+                                                 operations,
+                                                 count,
+                                                 BEAGLE_OP_NONE);
+    } else if (kThreadingEnabled) {
+        returnCode = upPartialsByPartitionAsync(operations,
+                                                count);            
     } else {
-        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-        for(int i=0; i<count; i++) {
-            const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-            for(int j=0; j<kPatternCount; j++) {
-                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                    cumulativeScaleBuffer[j] += scaleBuffer[j];
-                else
-                    cumulativeScaleBuffer[j] += log(scaleBuffer[j]);
-            }
+        bool byPartition = true;
+        returnCode = upPartials(byPartition,
+                                operations,
+                                count,
+                                BEAGLE_OP_NONE);
+    }
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setRootPrePartials(const int* bufferIndices,
+                                                          const int* stateFrequenciesIndices,
+                                                          int count) {
+    for (int i = 0; i < count; i++) {
+        const int bufferIndex = bufferIndices[i];
+        const int frequenciesIndex = stateFrequenciesIndices[i];
+        if (bufferIndex < 0 || bufferIndex >= kBufferCount ||
+            frequenciesIndex < 0 || frequenciesIndex >= kEigenDecompCount ||
+            gStateFrequencies[frequenciesIndex] == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        commitPartials(bufferIndex);
+        if (gPartials[bufferIndex] == NULL) {
+            gPartials[bufferIndex] = allocatePartials(bufferIndex);
+            if (gPartials[bufferIndex] == 0L)
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
         }
 
-        if (DEBUGGING_OUTPUT) {
-            fprintf(stderr,"Accumulating %d scale buffers into #%d\n",count,cumulativeScalingIndex);
-            for(int j=0; j<kPatternCount; j++) {
-                fprintf(stderr,"cumulativeScaleBuffer[%d] = %2.5e\n",j,cumulativeScaleBuffer[j]);
+        const REALTYPE* frequencies = gStateFrequencies[frequenciesIndex];
+        REALTYPE* destPtr = gPartials[bufferIndex];
+        for (int l = 0; l < kCategoryCount; l++) {
+            for (int k = 0; k < kPaddedPatternCount; k++) {
+                // zero for the padding patterns
+                const bool padding = (k >= kPatternCount);
+                for (int j = 0; j < kStateCount; j++)
+                    *(destPtr++) = (padding ? 0.0 : frequencies[j]);
+                for (int j = kStateCount; j < kPartialsPaddedStateCount; j++)
+                    *(destPtr++) = 0.0;
             }
         }
+
+        if (gBufferVersions != NULL)
+            gBufferVersions->touchPartials(bufferIndex);
+        if (kSiteRepeats)
+            clearSiteRepeats(bufferIndex);
+        if (kGapPatternSkipping)
+            gGapPatterns[bufferIndex].clear();
     }
-    
+
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactorsByPartition(const int* scalingIndices,
-                                                                         int count,
-                                                                         int cumulativeScalingIndex,
-                                                                         int partitionIndex) {
-    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-        return BEAGLE_ERROR_NO_IMPLEMENTATION;        
-    } else {
-
-        int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-        int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePrePartials(const int* operations,
+                                                         int count,
+                                                         int cumulativeScaleIndex) {
+    REALTYPE* cumulativeScaleBuffer = NULL;
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE)
+        cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
 
-        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-        for(int i=0; i<count; i++) {
-            const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-            for(int j=startPattern; j<endPattern; j++) {
-                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                    cumulativeScaleBuffer[j] += scaleBuffer[j];
-                else
-                    cumulativeScaleBuffer[j] += log(scaleBuffer[j]);
+    const bool manualScaling = !(kFlags & (BEAGLE_FLAG_SCALING_AUTO |
+                                           BEAGLE_FLAG_SCALING_ALWAYS |
+                                           BEAGLE_FLAG_SCALING_DYNAMIC));
+
+    if (gResidentPartials != NULL) {
+        // inputs written by an earlier operation of the same call are resident already
+        std::vector<int> inputs;
+        std::vector<char> written(kBufferCount, 0);
+        for (int op = 0; op < count; op++) {
+            const int* operation = operations + op * BEAGLE_OP_COUNT;
+            for (int i = 3; i <= 5; i += 2) {
+                if (operation[i] >= 0 && operation[i] < kBufferCount && !written[operation[i]])
+                    inputs.push_back(operation[i]);
             }
+            if (operation[0] >= 0 && operation[0] < kBufferCount)
+                written[operation[0]] = 1;
         }
+        int returnCode = restorePartials(inputs.data(), (int) inputs.size());
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
 
+    if (kLazyBuffers) {
+        commitOperationBuffers(operations, count, BEAGLE_OP_COUNT, cumulativeScaleIndex);
+        if (cumulativeScaleIndex != BEAGLE_OP_NONE)
+            cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
     }
-    
-    return BEAGLE_SUCCESS;
-}
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactors(const int* scalingIndices,
-                                            int  count,
-                                            int  cumulativeScalingIndex) {
-    REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-    for(int i=0; i<count; i++) {
-        const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-        for(int j=0; j<kPatternCount; j++) {
-            if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                cumulativeScaleBuffer[j] -= scaleBuffer[j];
-            else
-                cumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * BEAGLE_OP_COUNT;
+        const int destIndex = operation[0];
+        const int writeScalingIndex = operation[1];
+        const int readScalingIndex = operation[2];
+        const int parentIndex = operation[3];
+        const int parentMatrixIndex = operation[4];
+        const int siblingIndex = operation[5];
+        const int siblingMatrixIndex = operation[6];
+
+        if (destIndex < kTipCount || destIndex >= kBufferCount ||
+            parentIndex < 0 || parentIndex >= kBufferCount || gPartials[parentIndex] == NULL ||
+            siblingIndex < 0 || siblingIndex >= kBufferCount ||
+            (parentMatrixIndex != BEAGLE_OP_NONE &&
+             (parentMatrixIndex < 0 || parentMatrixIndex >= kMatrixCount)) ||
+            siblingMatrixIndex < 0 || siblingMatrixIndex >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        const int* siblingStates = getTipStates(siblingIndex);
+        const REALTYPE* siblingPartials = (siblingStates == NULL ? gPartials[siblingIndex] : NULL);
+        if (siblingStates == NULL && siblingPartials == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        const REALTYPE* fixedScaleFactors = NULL;
+        if (manualScaling && writeScalingIndex < 0 && readScalingIndex >= 0)
+            fixedScaleFactors = gScaleBuffers[readScalingIndex];
+
+        REALTYPE* destPartials = gPartials[destIndex];
+        calcPrePartials(destPartials,
+                        gPartials[parentIndex],
+                        (parentMatrixIndex == BEAGLE_OP_NONE ?
+                         NULL : gTransitionMatrices[parentMatrixIndex]),
+                        siblingStates, siblingPartials,
+                        gTransitionMatrices[siblingMatrixIndex],
+                        fixedScaleFactors);
+
+        if (manualScaling && writeScalingIndex >= 0) {
+            setScaleBufferWritten(writeScalingIndex,
+                                  rescalePartials(destPartials, gScaleBuffers[writeScalingIndex],
+                                                  cumulativeScaleBuffer, 0));
+            accumulateMixedScaleFactors(writeScalingIndex, cumulativeScaleIndex, 1, 0, kPatternCount);
         }
+
+        if (gBufferVersions != NULL)
+            gBufferVersions->touchOperation(operation);
+        if (kSiteRepeats)
+            clearSiteRepeats(destIndex);
+        if (kGapPatternSkipping)
+            gGapPatterns[destIndex].clear();
     }
 
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactorsByPartition(const int* scalingIndices,
-                                                                     int count,
-                                                                     int cumulativeScalingIndex,
-                                                                     int partitionIndex) {
-    
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoPartitionPartialsOperations(const int* operations,
+                                                                        int* partitionOperations,
+                                                                        int count,
+                                                                        int cumulativeScaleIndex) {
 
-    REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-    for(int i=0; i<count; i++) {
-        const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-        for(int j=startPattern; j<endPattern; j++) {
-            if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                cumulativeScaleBuffer[j] -= scaleBuffer[j];
-            else
-                cumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
+    int numOps  = BEAGLE_OP_COUNT;
+    int numOpsP = BEAGLE_PARTITION_OP_COUNT;
+
+    for (int i=0; i<count; i++) {
+        for (int j=0; j<kPartitionCount; j++) {
+            for (int k=0; k<numOps; k++) {
+                partitionOperations[i*kPartitionCount*numOpsP + j*numOpsP + k] = operations[i*numOps + k];
+            }    
+                partitionOperations[i*kPartitionCount*numOpsP + j*numOpsP + numOps    ] = j;
+                partitionOperations[i*kPartitionCount*numOpsP + j*numOpsP + numOps + 1] = cumulativeScaleIndex;
         }
     }
-
-    return BEAGLE_SUCCESS;
 }
 
-
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactors(int cumulativeScalingIndex) {
-    //memcpy(gScaleBuffers[cumulativeScalingIndex],zeros,sizeof(double) * kPatternCount);
-    
-     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-         memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(signed short) * kPaddedPatternCount);
-     } else {           
-         memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(REALTYPE) * kPaddedPatternCount);
-     }
-    return BEAGLE_SUCCESS;
-}
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByPartitionAsync(const int* operations,
+                                                                  int count) {
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactorsByPartition(int cumulativeScalingIndex,
-                                                                    int partitionIndex) {
-    
-     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-        return BEAGLE_ERROR_NO_IMPLEMENTATION;
-     } else {
-        int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-        int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+    int numOps = BEAGLE_PARTITION_OP_COUNT;
 
-        REALTYPE* cumulativeBuffer = gScaleBuffers[cumulativeScalingIndex]; 
+    memset(gPartitionOpCounts, 0, sizeof(int) * kPartitionCount);
+
+    // operations on distinct partitions touch disjoint pattern ranges, so only
+    // the order within a partition has to be preserved
+    for (int i=0; i<count; i++) {
+        int p = operations[i * numOps + 7];
+        for (int j=0; j<numOps; j++) {
+            gPartitionOperations[p][gPartitionOpCounts[p]*numOps + j] = operations[i*numOps + j];
+        }
+        gPartitionOpCounts[p]++;
+    }
+
+    ThreadPool* pool = getThreadPool();
+    if (kPartitionScheduleThreads != pool->getThreadCount())
+        schedulePartitions(pool->getThreadCount());
+
+    // each piece is queued on the worker the schedule assigned it to; a pinned pool
+    // runs it there, otherwise idle workers may still steal it
+    ThreadPoolTaskGroup group;
+    for (size_t i=0; i<gPartitionSchedule.size(); i++) {
+        const PartitionPiece& piece = gPartitionSchedule[i];
+        if (gPartitionOpCounts[piece.partition] == 0)
+            continue;
+
+        pool->submit(group,
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsRange, this,
+                      true,
+                      (const int*) gPartitionOperations[piece.partition],
+                      gPartitionOpCounts[piece.partition],
+                      BEAGLE_OP_NONE,
+                      piece.startPattern,
+                      piece.endPattern),
+            piece.worker);
+    }
+
+    group.wait();
 
-        memset(&cumulativeBuffer[startPattern], 0, sizeof(REALTYPE) * (endPattern - startPattern));
-     }
     return BEAGLE_SUCCESS;
 }
-    
+
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::copyScaleFactors(int destScalingIndex,
-                                                        int srcScalingIndex) {
-    memcpy(gScaleBuffers[destScalingIndex],gScaleBuffers[srcScalingIndex],sizeof(REALTYPE) * kPatternCount);
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::schedulePartitions(int threadCount) {
+
+    gPartitionSchedule.clear();
+
+    // scaling that rescales or accumulates whole buffers needs each partition in one piece
+    if (!(kFlags & (BEAGLE_FLAG_SCALING_AUTO |
+                    BEAGLE_FLAG_SCALING_ALWAYS |
+                    BEAGLE_FLAG_SCALING_DYNAMIC))) {
+        // every pattern of one instance costs the same, so worker w runs the w-th of
+        // threadCount equal ranges of patterns, cut where partitions begin and end
+        for (int w=0; w<threadCount; w++) {
+            const int shareStart = (int) ((long) kPatternCount * w / threadCount);
+            const int shareEnd = (int) ((long) kPatternCount * (w + 1) / threadCount);
+            for (int p=0; p<kPartitionCount; p++) {
+                PartitionPiece piece = { p,
+                                         std::max(shareStart, gPatternPartitionsStartPatterns[p]),
+                                         std::min(shareEnd, gPatternPartitionsStartPatterns[p + 1]),
+                                         w };
+                if (piece.startPattern < piece.endPattern)
+                    gPartitionSchedule.push_back(piece);
+            }
+        }
+    } else {
+        // a partition costs about patterns x categories x states^2 per operation; longest
+        // processing time first, the costliest remaining partition goes to the least
+        // loaded worker, with ties broken by index so the schedule is deterministic
+        const double patternCost = (double) kCategoryCount * kStateCount * kStateCount;
+        for (int p=0; p<kPartitionCount; p++) {
+            PartitionPiece piece = { p, gPatternPartitionsStartPatterns[p],
+                                     gPatternPartitionsStartPatterns[p + 1], 0 };
+            gPartitionSchedule.push_back(piece);
+        }
+        std::stable_sort(gPartitionSchedule.begin(), gPartitionSchedule.end(),
+                         [] (const PartitionPiece& a, const PartitionPiece& b) {
+                             return (a.endPattern - a.startPattern) >
+                                    (b.endPattern - b.startPattern);
+                         });
+        std::vector<double> workerCosts(threadCount, 0.0);
+        for (size_t i=0; i<gPartitionSchedule.size(); i++) {
+            PartitionPiece& piece = gPartitionSchedule[i];
+            piece.worker = (int) (std::min_element(workerCosts.begin(), workerCosts.end()) -
+                                  workerCosts.begin());
+            workerCosts[piece.worker] += patternCost * (piece.endPattern - piece.startPattern);
+        }
+    }
 
-    return BEAGLE_SUCCESS;
+    kPartitionScheduleThreads = threadCount;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getScaleFactors(int srcScalingIndex,
-                                                       double* scaleFactors) {
-    // Do nothing                                                      
-    return BEAGLE_SUCCESS;                                                     
-}                                                      
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByDependencyAsync(bool byPartition,
+                                                                   const int* operations,
+                                                                   int count,
+                                                                   int cumulativeScaleIndex) {
+
+    int numOps = BEAGLE_OP_COUNT;
+    if (byPartition)
+        numOps = BEAGLE_PARTITION_OP_COUNT;
+
+    // an operation reads its child partials (and fixed scale factors) and writes
+    // its destination partials, scale factors and the cumulative scale buffer;
+    // buffers are tracked per partition since partitions touch disjoint patterns
+    int resourceCount = kBufferCount + kScaleBufferCount;
+    int trackedCount = resourceCount * (byPartition ? kPartitionCount : 1);
+    if ((int) gOperationLastWriters.size() < trackedCount) {
+        gOperationLastWriters.resize(trackedCount, -1);
+        gOperationReaders.resize(trackedCount);
+    }
 
-BEAGLE_CPU_TEMPLATE
-    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoods(const int* parentBufferIndices,
-                                                             const int* childBufferIndices,
-                                                             const int* probabilityIndices,
-                                                             const int* firstDerivativeIndices,
-                                                             const int* secondDerivativeIndices,
-                                                             const int* categoryWeightsIndices,
-                                                             const int* stateFrequenciesIndices,
-                                                             const int* cumulativeScaleIndices,
-                                                             int count,
-                                                             double* outSumLogLikelihood,
-                                                             double* outSumFirstDerivative,
-                                                             double* outSumSecondDerivative) {
-    // TODO: implement for count > 1
+    std::vector<std::vector<int> > dependents(count);
+    std::vector<std::atomic<int> > remaining(count);
+    std::vector<int> touched;
+    std::vector<int> dependencies;
 
-    if (count == 1) {
-        int cumulativeScalingFactorIndex;
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-            cumulativeScalingFactorIndex = 0;
-        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            cumulativeScalingFactorIndex = kInternalPartialsBufferCount;
-            int child1ScalingIndex = parentBufferIndices[0] - kTipCount;
-            int child2ScalingIndex = childBufferIndices[0] - kTipCount;
-            resetScaleFactors(cumulativeScalingFactorIndex);
-            if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
-                int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 2, cumulativeScalingFactorIndex);
-            } else if (child1ScalingIndex >= 0) {
-                int scalingIndices[1] = {child1ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, cumulativeScalingFactorIndex);
-            } else if (child2ScalingIndex >= 0) {
-                int scalingIndices[1] = {child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, cumulativeScalingFactorIndex);
-            }
-        } else {
-            cumulativeScalingFactorIndex = cumulativeScaleIndices[0];
+    for (int op = 0; op < count; op++) {
+        const int* tuple = operations + op * numOps;
+        const int writeScalingIndex = tuple[1];
+        const int readScalingIndex = tuple[2];
+        int offset = 0;
+        int cumulativeIndex = cumulativeScaleIndex;
+        if (byPartition) {
+            offset = tuple[7] * resourceCount;
+            cumulativeIndex = tuple[8];
         }
-        if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL)
 
-            if (kAutoRootPartitioningEnabled) {
-                calcEdgeLogLikelihoodsByAutoPartitionAsync(parentBufferIndices,
-                                                           childBufferIndices,
-                                                           probabilityIndices,
-                                                           categoryWeightsIndices,
-                                                           stateFrequenciesIndices,
-                                                           cumulativeScaleIndices,
-                                                           gAutoPartitionIndices,
-                                                           gAutoPartitionOutSumLogLikelihoods);                
+        int reads[3];
+        int readCount = 0;
+        reads[readCount++] = offset + tuple[3];
+        reads[readCount++] = offset + tuple[5];
+        if (writeScalingIndex < 0 && readScalingIndex >= 0)
+            reads[readCount++] = offset + kBufferCount + readScalingIndex;
+
+        int writes[3];
+        int writeCount = 0;
+        writes[writeCount++] = offset + tuple[0];
+        if (writeScalingIndex >= 0) {
+            writes[writeCount++] = offset + kBufferCount + writeScalingIndex;
+            // accumulation into the cumulative buffer keeps the list order, so
+            // that the summation order and hence the result is reproducible
+            if (cumulativeIndex != BEAGLE_OP_NONE)
+                writes[writeCount++] = offset + kBufferCount + cumulativeIndex;
+        }
 
-                *outSumLogLikelihood = 0.0;
+        dependencies.clear();
+        for (int i = 0; i < readCount; i++) {
+            if (gOperationLastWriters[reads[i]] >= 0)
+                dependencies.push_back(gOperationLastWriters[reads[i]]);
+        }
+        for (int i = 0; i < writeCount; i++) {
+            if (gOperationLastWriters[writes[i]] >= 0)
+                dependencies.push_back(gOperationLastWriters[writes[i]]);
+            std::vector<int>& readers = gOperationReaders[writes[i]];
+            dependencies.insert(dependencies.end(), readers.begin(), readers.end());
+        }
+        std::sort(dependencies.begin(), dependencies.end());
+        dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
 
-                for (int i = 0; i < kPartitionCount; i++) {
-                    *outSumLogLikelihood += gAutoPartitionOutSumLogLikelihoods[i];
-                }
+        for (size_t i = 0; i < dependencies.size(); i++)
+            dependents[dependencies[i]].push_back(op);
+        remaining[op].store((int) dependencies.size());
 
-                if (*outSumLogLikelihood != *outSumLogLikelihood) {
-                    return BEAGLE_ERROR_FLOATING_POINT;
-                } else {
-                    return BEAGLE_SUCCESS;
-                }
-            } else {
-                return calcEdgeLogLikelihoods(parentBufferIndices[0], childBufferIndices[0], probabilityIndices[0],
-                                       categoryWeightsIndices[0], stateFrequenciesIndices[0], cumulativeScalingFactorIndex,
-                                       outSumLogLikelihood);
-            }
-        else if (secondDerivativeIndices == NULL)
-            return calcEdgeLogLikelihoodsFirstDeriv(parentBufferIndices[0], childBufferIndices[0], probabilityIndices[0],
-                                             firstDerivativeIndices[0], categoryWeightsIndices[0], stateFrequenciesIndices[0],
-                                             cumulativeScalingFactorIndex, outSumLogLikelihood, outSumFirstDerivative);
-        else
-            return calcEdgeLogLikelihoodsSecondDeriv(parentBufferIndices[0], childBufferIndices[0], probabilityIndices[0],
-                                              firstDerivativeIndices[0], secondDerivativeIndices[0], categoryWeightsIndices[0],
-                                              stateFrequenciesIndices[0], cumulativeScalingFactorIndex, outSumLogLikelihood,
-                                              outSumFirstDerivative, outSumSecondDerivative);
-    } else {
-        if ((kFlags & BEAGLE_FLAG_SCALING_AUTO) || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-            fprintf(stderr,"BeagleCPUImpl::calculateEdgeLogLikelihoods not yet implemented for count > 1 and auto/always scaling\n");
+        for (int i = 0; i < readCount; i++) {
+            gOperationReaders[reads[i]].push_back(op);
+            touched.push_back(reads[i]);
+        }
+        for (int i = 0; i < writeCount; i++) {
+            gOperationLastWriters[writes[i]] = op;
+            gOperationReaders[writes[i]].clear();
+            touched.push_back(writes[i]);
         }
-        
-        if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
-            return calcEdgeLogLikelihoodsMulti(parentBufferIndices, childBufferIndices, probabilityIndices,
-                                          categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices, count,
-                                          outSumLogLikelihood);
-        } else {
-            fprintf(stderr,"BeagleCPUImpl::calculateEdgeLogLikelihoods not yet implemented for count > 1 and derivatives\n");
-        }            
     }
-    return BEAGLE_SUCCESS;
-}
 
-BEAGLE_CPU_TEMPLATE
-    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
-                                                    const int* parentBufferIndices,
-                                                    const int* childBufferIndices,
-                                                    const int* probabilityIndices,
-                                                    const int* firstDerivativeIndices,
-                                                    const int* secondDerivativeIndices,
-                                                    const int* categoryWeightsIndices,
-                                                    const int* stateFrequenciesIndices,
-                                                    const int* cumulativeScaleIndices,
-                                                    const int* partitionIndices,
-                                                    int partitionCount,
-                                                    int count,
-                                                    double* outSumLogLikelihoodByPartition,
-                                                    double* outSumLogLikelihood,
-                                                    double* outSumFirstDerivativeByPartition,
-                                                    double* outSumFirstDerivative,
-                                                    double* outSumSecondDerivativeByPartition,
-                                                    double* outSumSecondDerivative) {
+    for (size_t i = 0; i < touched.size(); i++) {
+        gOperationLastWriters[touched[i]] = -1;
+        gOperationReaders[touched[i]].clear();
+    }
 
-    int returnCode = BEAGLE_SUCCESS;
+    // collected before any job runs, a finished job submits the operations
+    // it was the last dependency of
+    std::vector<int> ready;
+    for (int op = 0; op < count; op++) {
+        if (remaining[op].load() == 0)
+            ready.push_back(op);
+    }
 
-    if (count == 1) {
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-            returnCode =  BEAGLE_ERROR_NO_IMPLEMENTATION;
-        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
-        } else {
+    ThreadPool* pool = getThreadPool();
+    ThreadPoolTaskGroup group;
 
-            if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
+    std::function<void(int)> run = [&] (int op) {
+        upPartials(byPartition, operations + op * numOps, 1, cumulativeScaleIndex);
+        for (size_t i = 0; i < dependents[op].size(); i++) {
+            int next = dependents[op][i];
+            if (--remaining[next] == 0)
+                pool->submit(group, [&run, next] () { run(next); },
+                             (byPartition ? operations[next * numOps + 7] : next));
+        }
+    };
 
-                if (kThreadingEnabled) {
-                    calcEdgeLogLikelihoodsByPartitionAsync(parentBufferIndices,
-                                                           childBufferIndices,
-                                                           probabilityIndices,
-                                                           categoryWeightsIndices,
-                                                           stateFrequenciesIndices,
-                                                           cumulativeScaleIndices,
-                                                           partitionIndices,
-                                                           partitionCount,
-                                                           outSumLogLikelihoodByPartition);                
-                } else {
-                    calcEdgeLogLikelihoodsByPartition(parentBufferIndices,
-                                                      childBufferIndices,
-                                                      probabilityIndices,
-                                                      categoryWeightsIndices,
-                                                      stateFrequenciesIndices,
-                                                      cumulativeScaleIndices,
-                                                      partitionIndices,
-                                                      partitionCount,
-                                                      outSumLogLikelihoodByPartition);
-                }
+    for (size_t i = 0; i < ready.size(); i++) {
+        int op = ready[i];
+        pool->submit(group, [&run, op] () { run(op); },
+                     (byPartition ? operations[op * numOps + 7] : op));
+    }
 
+    group.wait();
 
-            } else if (secondDerivativeIndices == NULL) {
-                return BEAGLE_ERROR_NO_IMPLEMENTATION;
-            } else {
+    return BEAGLE_SUCCESS;
+}
 
-                calcEdgeLogLikelihoodsSecondDerivByPartition(
-                                                parentBufferIndices,
-                                                childBufferIndices,
-                                                probabilityIndices,
-                                                firstDerivativeIndices,
-                                                secondDerivativeIndices,
-                                                categoryWeightsIndices,
-                                                stateFrequenciesIndices,
-                                                cumulativeScaleIndices,
-                                                partitionIndices,
-                                                partitionCount,
-                                                outSumLogLikelihoodByPartition,
-                                                outSumFirstDerivativeByPartition,
-                                                outSumSecondDerivativeByPartition);
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
+                                                  const int* operations,
+                                                  int count,
+                                                  int cumulativeScaleIndex) {
+    return upPartialsRange(byPartition, operations, count, cumulativeScaleIndex, 0, kPatternCount);
+}
 
-                *outSumFirstDerivative  = 0.0;
-                *outSumSecondDerivative = 0.0;
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::usePatternTiling() {
+    // site repeats run whole buffers, and the scaling threshold decides per buffer
+    return (kPatternBlockSize > 0 && kPatternBlockSize < kPatternCount &&
+            !kSiteRepeats && kScalingThreshold == 0.0);
+}
 
-                for (int i = 0; i < partitionCount; i++) {
-                    *outSumFirstDerivative  += outSumFirstDerivativeByPartition[i];
-                    *outSumSecondDerivative += outSumSecondDerivativeByPartition[i];
-                }
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsTiled(const int* operations,
+                                                       int count,
+                                                       int cumulativeScaleIndex) {
+    // the partials a block writes are read by later operations on the same block while
+    // still in cache, instead of after every other pattern has gone through
+    for (int startPattern = 0; startPattern < kPatternCount; startPattern += kPatternBlockSize) {
+        const int endPattern = std::min(startPattern + kPatternBlockSize, kPatternCount);
+        int returnCode = upPartialsRange(false, operations, count, cumulativeScaleIndex,
+                                         startPattern, endPattern);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
 
-                if (*outSumFirstDerivative  != *outSumFirstDerivative ||
-                    *outSumSecondDerivative != *outSumSecondDerivative) {
-                    returnCode = BEAGLE_ERROR_FLOATING_POINT;
-                }
-            }
+    return BEAGLE_SUCCESS;
+}
 
-            *outSumLogLikelihood = 0.0;
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::useOpenMPPatterns() {
+    // as with pattern tiling, site repeats and the scaling threshold work on whole buffers;
+    // the scaling modes that update shared scale buffers keep the serial loop too
+    return ((kFlags & BEAGLE_FLAG_THREADING_OPENMP) &&
+            kOpenMPThreadCount > 1 &&
+            (double) kCategoryCount * kPatternCount * kStateCount * kStateCount >=
+                BEAGLE_CPU_OPENMP_MIN_WORK &&
+            !kSiteRepeats && kScalingThreshold == 0.0 && kScratchPrefetchDistance == 0 &&
+            !(kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC)));
+}
 
-            for (int i = 0; i < partitionCount; i++) {
-                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
-            }
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsOpenMP(bool byPartition,
+                                                        const int* operations,
+                                                        int count,
+                                                        int cumulativeScaleIndex) {
+    // patterns are independent through the whole traversal, so each thread runs every
+    // operation on its blocks and the team meets once per call instead of once per
+    // kernel; the schedule of the blocks is taken from OMP_SCHEDULE
+    const int blockCount = std::min(kOpenMPThreadCount * BEAGLE_CPU_OPENMP_BLOCKS_PER_THREAD,
+                                    kPatternCount);
+    int returnCode = BEAGLE_SUCCESS;
 
-            if (*outSumLogLikelihood != *outSumLogLikelihood) {
-                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+#pragma omp parallel num_threads(kOpenMPThreadCount)
+    {
+#pragma omp for schedule(runtime)
+        for (int b = 0; b < blockCount; b++) {
+            const int startPattern = (int) ((long) kPatternCount * b / blockCount);
+            const int endPattern = (int) ((long) kPatternCount * (b + 1) / blockCount);
+            int blockCode = upPartialsRange(byPartition, operations, count, cumulativeScaleIndex,
+                                            startPattern, endPattern);
+            if (blockCode != BEAGLE_SUCCESS) {
+#pragma omp critical
+                returnCode = blockCode;
             }
-
         }
-    } else {
-        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
     }
 
     return returnCode;
 }
 
 BEAGLE_CPU_TEMPLATE
-    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartitionAsync(
-                                                        const int* parentBufferIndices,
-                                                        const int* childBufferIndices,
-                                                        const int* probabilityIndices,
-                                                        const int* categoryWeightsIndices,
-                                                        const int* stateFrequenciesIndices,
-                                                        const int* cumulativeScaleIndices,
-                                                        const int* partitionIndices,
-                                                        int partitionCount,
-                                                        double* outSumLogLikelihoodByPartition) {
-
-    int partitionsPerThreadFloor = partitionCount / kNumThreads;
-    int partitionsRemainder = partitionCount % kNumThreads;
-    int currentPartitionIndex = 0;
-    int threadsUsed = (partitionCount < kNumThreads ? partitionCount : kNumThreads);
-    for (int i=0; i<threadsUsed; i++) {
-        int partitionCountThread = partitionsPerThreadFloor;
-        if (partitionsRemainder) {
-            partitionCountThread++;
-            partitionsRemainder--;
-        }
-
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition, this,
-                      &parentBufferIndices[currentPartitionIndex],
-                      &childBufferIndices[currentPartitionIndex],
-                      &probabilityIndices[currentPartitionIndex],
-                      &categoryWeightsIndices[currentPartitionIndex],
-                      &stateFrequenciesIndices[currentPartitionIndex],
-                      &cumulativeScaleIndices[currentPartitionIndex],
-                      &partitionIndices[currentPartitionIndex],
-                      partitionCountThread,
-                      &outSumLogLikelihoodByPartition[currentPartitionIndex]));
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::useCategoryParallel() {
+    // with many categories and few patterns, pattern blocks leave workers short of work
+    // while each category is a block of its own; the scaling modes that update shared scale
+    // buffers and the features that compute parts of a buffer keep the pattern blocks
+    return ((kFlags & BEAGLE_FLAG_THREADING_CPP) &&
+            kCategoryCount >= BEAGLE_CPU_CATEGORY_PARALLEL_MIN_COUNT &&
+            kPatternCount < kCategoryCount * BEAGLE_CPU_CATEGORY_PARALLEL_PATTERN_RATIO &&
+            (double) kCategoryCount * kPatternCount * kStateCount * kStateCount >=
+                BEAGLE_CPU_CATEGORY_PARALLEL_MIN_WORK &&
+            !kSiteRepeats && !kGapPatternSkipping && !kInterleavedPatterns &&
+            !(kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC)) &&
+            getThreadPool()->getThreadCount() > 1);
+}
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByCategoryAsync(const int* operations,
+                                                                 int count,
+                                                                 int cumulativeScaleIndex) {
+    REALTYPE* cumulativeScaleBuffer = NULL;
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE)
+        cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+    ThreadPool* pool = getThreadPool();
+    int jobCount = std::min(pool->getThreadCount(), kCategoryCount);
 
-        gThreads[i].cv.notify_one();
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * BEAGLE_OP_COUNT;
+        const int parIndex = operation[0];
+        const int writeScalingIndex = operation[1];
+        const int readScalingIndex = operation[2];
+
+        // fixed scaling divides each pattern as it goes
+        if (writeScalingIndex < 0 && readScalingIndex >= 0) {
+            int returnCode = upPartialsRange(false, operation, 1, cumulativeScaleIndex, 0, kPatternCount);
+            if (returnCode != BEAGLE_SUCCESS)
+                return returnCode;
+            continue;
+        }
 
-        currentPartitionIndex += partitionCountThread;
-    }
+        const int* tipStates1 = getTipStates(operation[3], 0);
+        const int* tipStates2 = getTipStates(operation[5], 1);
+        const REALTYPE* partials1 = gPartials[operation[3]];
+        const REALTYPE* partials2 = gPartials[operation[5]];
+        const REALTYPE* matrices1 = gTransitionMatrices[operation[4]];
+        const REALTYPE* matrices2 = gTransitionMatrices[operation[6]];
+        REALTYPE* destPartials = gPartials[parIndex];
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
+        ThreadPoolTaskGroup group;
+        for (int j = 0; j < jobCount; j++) {
+            int startCategory = (kCategoryCount * j) / jobCount;
+            int endCategory = (kCategoryCount * (j + 1)) / jobCount;
+            pool->submit(group, [=] () {
+                calcPartialsCategoryRange(destPartials, tipStates1, partials1, matrices1,
+                                          tipStates2, partials2, matrices2,
+                                          startCategory, endCategory);
+            }, j);
+        }
+        group.wait();
+
+        // the scale factor of a pattern is taken over all categories, so it waits for every one
+        if (writeScalingIndex >= 0) {
+            bool rescaled = rescalePartials(destPartials, gScaleBuffers[writeScalingIndex],
+                                            cumulativeScaleBuffer, 0);
+            setScaleBufferWritten(writeScalingIndex, rescaled);
+            accumulateMixedScaleFactors(writeScalingIndex, cumulativeScaleIndex, 1, 0, kPatternCount);
+        }
     }
 
+    return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
-    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByAutoPartitionAsync(
-                                                        const int* parentBufferIndices,
-                                                        const int* childBufferIndices,
-                                                        const int* probabilityIndices,
-                                                        const int* categoryWeightsIndices,
-                                                        const int* stateFrequenciesIndices,
-                                                        const int* cumulativeScaleIndices,
-                                                        const int* partitionIndices,
-                                                        double* outSumLogLikelihoodByPartition) {
-
-    for (int i=0; i<kNumThreads; i++) {
-
-        std::packaged_task<void()> threadTask(
-            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition, this,
-                      parentBufferIndices,
-                      childBufferIndices,
-                      probabilityIndices,
-                      categoryWeightsIndices,
-                      stateFrequenciesIndices,
-                      cumulativeScaleIndices,
-                      &partitionIndices[i],
-                      1,
-                      &outSumLogLikelihoodByPartition[i]));
-
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsRange(bool byPartition,
+                                                       const int* operations,
+                                                       int count,
+                                                       int cumulativeScaleIndex,
+                                                       int rangeStartPattern,
+                                                       int rangeEndPattern) {
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+    REALTYPE* cumulativeScaleBuffer = NULL;
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE)
+        cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
 
-        gThreads[i].cv.notify_one();
-    }
+    for (int op = 0; op < count; op++) {
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
+        int numOps = BEAGLE_OP_COUNT;
+        if (byPartition)
+            numOps = BEAGLE_PARTITION_OP_COUNT;
 
-}
+        // the first operations were prefetched before the call
+        if (kScratchPrefetchDistance > 0 && op + kScratchPrefetchDistance < count)
+            prefetchOperations(operations + (op + kScratchPrefetchDistance) * numOps, 1, numOps);
 
+        if (DEBUGGING_OUTPUT) {
+            fprintf(stderr, "op[%d] = ", op);
+            for (int j = 0; j < numOps; j++) {
+                std::cerr << operations[op*numOps+j] << " ";
+            }
+            fprintf(stderr, "\n");
+        }
 
+        const int parIndex = operations[op * numOps];
+        const int writeScalingIndex = operations[op * numOps + 1];
+        const int readScalingIndex = operations[op * numOps + 2];
+        const int child1Index = operations[op * numOps + 3];
+        const int child1TransMatIndex = operations[op * numOps + 4];
+        const int child2Index = operations[op * numOps + 5];
+        const int child2TransMatIndex = operations[op * numOps + 6];
+        int currentPartition = 0;
+        if (byPartition) {
+            currentPartition = operations[op * numOps + 7];
+            cumulativeScaleIndex = operations[op * numOps + 8];
+            if (cumulativeScaleIndex != BEAGLE_OP_NONE)
+                cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
+            else
+                cumulativeScaleBuffer = NULL;
+        }
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex,
-                                                     const int childIndex,
-                                                     const int probIndex,
-                                                     const int categoryWeightsIndex,
-                                                     const int stateFrequenciesIndex,
-                                                     const int scalingFactorsIndex,
-                                                     double* outSumLogLikelihood) {
-
-    assert(parIndex >= kTipCount);
-
-    int returnCode = BEAGLE_SUCCESS;
-
-    const REALTYPE* partialsParent = gPartials[parIndex];
-    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
-
-    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+        const REALTYPE* partials1 = gPartials[child1Index];
+        const REALTYPE* partials2 = gPartials[child2Index];
 
-    
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+        const int* tipStates1 = getTipStates(child1Index, 0);
+        const int* tipStates2 = getTipStates(child2Index, 1);
 
-        const int* statesChild = gTipStates[childIndex];
-        int v = 0; // Index for parent partials
+        const REALTYPE* matrices1 = gTransitionMatrices[child1TransMatIndex];
+        const REALTYPE* matrices2 = gTransitionMatrices[child2TransMatIndex];
 
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0; // Index in resulting product-partials (summed over categories)
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
+        REALTYPE* destPartials = gPartials[parIndex];
 
-                const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-                // so we can interchange the patterCount and categoryCount loop order?
-                int w =  l * kMatrixSize;
-                for(int i = 0; i < kStateCount; i++) {
-                    integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                    u++;
+        int startPattern = rangeStartPattern;
+        int endPattern = rangeEndPattern;
+        bool wholePartition = true;
+        if (byPartition) {
+            // a partition split across workers runs only the patterns of its piece
+            startPattern = std::max(gPatternPartitionsStartPatterns[currentPartition],
+                                    rangeStartPattern);
+            endPattern = std::min(gPatternPartitionsStartPatterns[currentPartition + 1],
+                                  rangeEndPattern);
+            wholePartition = (startPattern == gPatternPartitionsStartPatterns[currentPartition] &&
+                              endPattern == gPatternPartitionsStartPatterns[currentPartition + 1]);
+        }
 
-                    w += kTransPaddedStateCount;
-                }
-                v += kPartialsPaddedStateCount;
+        int rescale = BEAGLE_OP_NONE;
+        REALTYPE* scalingFactors = NULL;
+        bool rescaled = true;
+        
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+            gActiveScalingFactors[parIndex - kTipCount] = 0;
+            if (tipStates1 == 0 && tipStates2 == 0)
+                rescale = 2;
+        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            rescale = 1;
+            scalingFactors = gScaleBuffers[parIndex - kTipCount];
+        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
+            if (tipStates1 == 0 && tipStates2 == 0) {
+                rescale = 1;
+                removeScaleFactors(&readScalingIndex, 1, cumulativeScaleIndex);
+                scalingFactors = gScaleBuffers[writeScalingIndex];
             }
+        } else if (writeScalingIndex >= 0) {
+            rescale = 1;
+            scalingFactors = gScaleBuffers[writeScalingIndex];
+        } else if (readScalingIndex >= 0) {
+            rescale = 0;
+            scalingFactors = gScaleBuffers[readScalingIndex];
         }
 
-    } else { // Integrate against a partial at the child
+        if (DEBUGGING_OUTPUT) {
+            std::cerr << "Rescale= " << rescale << " writeIndex= " << writeScalingIndex
+                     << " readIndex = " << readScalingIndex << "\n";
+        }
 
-        const REALTYPE* partialsChild = gPartials[childIndex];
-        int v = 0;
-        int stateCountModFour = (kStateCount / 4) * 4;
-        
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0;
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
-                int w = l * kMatrixSize;
-                const REALTYPE* partialsChildPtr = &partialsChild[v];
-                for(int i = 0; i < kStateCount; i++) {
-                    double sumOverJA = 0.0, sumOverJB = 0.0;
-                    int j = 0;
-                    const REALTYPE* transMatrixPtr = &transMatrix[w];
-                    for (; j < stateCountModFour; j += 4) {
-                        sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
-                        sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
-                        sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
-                        sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
-                        
+        int repeatClassCount = 0;
+        const int* repeatClasses = NULL;
+        // two compact tips are combined by lookups, which repeats do not shorten
+        if (kSiteRepeats && !byPartition && rescale != 0 && rescale != 2 &&
+            (tipStates1 == NULL || tipStates2 == NULL))
+            repeatClasses = getSiteRepeatClasses(parIndex, repeatClassCount, 0);
+
+        // patterns missing from every tip below are one, which fixed and automatic scaling
+        // would change
+        const char* gapPatterns = NULL;
+        if (kGapPatternSkipping && !byPartition && rescale != 0 && rescale != 2 &&
+            !gGapPatterns[parIndex].empty())
+            gapPatterns = gGapPatterns[parIndex].data();
+
+        if (repeatClasses != NULL &&
+            repeatClassCount * BEAGLE_CPU_SITE_REPEATS_PATTERNS_PER_CLASS <= kPatternCount) {
+            calcPartialsSiteRepeats(destPartials, repeatClasses, repeatClassCount,
+                                    tipStates1, partials1, matrices1, tipStates2, partials2, matrices2);
+            if (rescale == 1)
+                rescaled = rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+        } else if (gapPatterns != NULL) {
+            calcPartialsSkippingGaps(destPartials, gapPatterns, tipStates1, partials1, matrices1,
+                                     tipStates2, partials2, matrices2, startPattern, endPattern);
+            if (rescale == 1) {
+                if (endPattern - startPattern < kPatternCount) {
+                    rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                         startPattern, endPattern);
+                } else {
+                    rescaled = rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+                }
+            }
+        } else if (tipStates1 != NULL) {
+            if (tipStates2 != NULL ) {
+                if (rescale == 0) { // Use fixed scaleFactors
+                    calcStatesStatesFixedScaling(destPartials, tipStates1, matrices1, tipStates2,
+                                                 matrices2, scalingFactors, startPattern, endPattern);
+                } else {
+                    // First compute without any scaling
+                    calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
+                                     startPattern, endPattern);
+                    if (rescale == 1) { // Recompute scaleFactors
+                        if (byPartition && wholePartition) {
+                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
+                        } else if (endPattern - startPattern < kPatternCount) {
+                            rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                 startPattern, endPattern);
+                        } else {
+                            rescaled = rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+                        }
                     }
-                    for (; j < kStateCount; j++) {
-                        sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
+                }
+            } else {
+                if (rescale == 0) {
+                    calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2,
+                                                   matrices2, scalingFactors, startPattern, endPattern);
+                } else {
+                    if (kInterleavedPatterns)
+                        calcPartialsInterleaved(destPartials, tipStates1, NULL, matrices1, partials2,
+                                                matrices2, startPattern, endPattern);
+                    else
+                        calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
+                                           startPattern, endPattern);
+                    if (rescale == 1) { // Recompute scaleFactors
+                        if (byPartition && wholePartition) {
+                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
+                        } else if (endPattern - startPattern < kPatternCount) {
+                            rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                 startPattern, endPattern);
+                        } else {
+                            rescaled = rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+                        }
                     }
-                    //                        for(int j = 0; j < kStateCount; j++) {
-                    //                            sumOverJ += transMatrix[w] * partialsChild[v + j];
-                    //                            w++;
-                    //                        }
-                    integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
-                    u++;
-                    
-                    w += kStateCount;
+                }
+            }
+        } else {
+            if (tipStates2 != NULL) {
+                if (rescale == 0) {
+                    calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
+                                                   scalingFactors, startPattern, endPattern);
+                } else {
+                    if (kInterleavedPatterns)
+                        calcPartialsInterleaved(destPartials, tipStates2, NULL, matrices2, partials1,
+                                                matrices1, startPattern, endPattern);
+                    else
+                        calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
+                                           startPattern, endPattern);
+                    if (rescale == 1) {// Recompute scaleFactors
+                        if (byPartition && wholePartition) {
+                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
+                        } else if (endPattern - startPattern < kPatternCount) {
+                            rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                 startPattern, endPattern);
+                        } else {
+                            rescaled = rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+                        }
+                    }
+                }
+            } else {
+                if (rescale == 2) {
+                    int sIndex = parIndex - kTipCount;
+                    calcPartialsPartialsAutoScaling(destPartials,partials1,matrices1,partials2,matrices2,
+                                                     &gActiveScalingFactors[sIndex]);
+                    if (gActiveScalingFactors[sIndex])
+                        autoRescalePartials(destPartials, gAutoScaleBuffers[sIndex]);
 
-                    // increment for the extra column at the end
-                    w += T_PAD;
+                } else if (rescale == 0) {
+                    calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,
+                                                     matrices2,scalingFactors,startPattern,endPattern);
+                } else {
+                    if (kInterleavedPatterns)
+                        calcPartialsInterleaved(destPartials, NULL, partials1, matrices1, partials2,
+                                                matrices2, startPattern, endPattern);
+                    else
+                        calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                             startPattern, endPattern);
+                    if (rescale == 1) {// Recompute scaleFactors
+                        if (byPartition && wholePartition) {
+                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
+                        } else if (endPattern - startPattern < kPatternCount) {
+                            rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                                 startPattern, endPattern);
+                        } else {
+                            rescaled = rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
+                        }
+                    }
                 }
-                v += kPartialsPaddedStateCount;
             }
         }
-    }
-    
-    int u = 0;
-    for(int k = 0; k < kPatternCount; k++) {
-        REALTYPE sumOverI = 0.0;
-        for(int i = 0; i < kStateCount; i++) {
-            sumOverI += freqs[i] * integrationTmp[u];
-            u++;
-        }
-
-        outLogLikelihoodsTmp[k] = log(sumOverI);
-    }
-
-
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-    }
+        
+        if (rescale == 1 && writeScalingIndex >= 0)
+            setScaleBufferWritten(writeScalingIndex, rescaled);
+        if (rescale == 1 && cumulativeScaleBuffer != NULL)
+            accumulateMixedScaleFactors(writeScalingIndex, cumulativeScaleIndex, 1,
+                                        startPattern, endPattern);
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            int parScalingIndex = parIndex - kTipCount;
+            int child1ScalingIndex = child1Index - kTipCount;
+            int child2ScalingIndex = child2Index - kTipCount;
+            if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
+                int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
+                accumulateScaleFactors(scalingIndices, 2, parScalingIndex);
+            } else if (child1ScalingIndex >= 0) {
+                int scalingIndices[1] = {child1ScalingIndex};
+                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
+            } else if (child2ScalingIndex >= 0) {
+                int scalingIndices[1] = {child2ScalingIndex};
+                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
+            }
+        }
+        
+        if (DEBUGGING_OUTPUT) {
+            if (scalingFactors != NULL && rescale == 0) {
+                for(int i=0; i<kPatternCount; i++)
+                    fprintf(stderr,"old scaleFactor[%d] = %.5f\n",i,scalingFactors[i]);
+            }
+            fprintf(stderr,"Result partials:\n");
+            for(int i = 0; i < kPartialsSize; i++)
+                fprintf(stderr,"destP[%d] = %.5f\n",i,destPartials[i]);
+        }
     }
 
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
+    return BEAGLE_SUCCESS;
 }
 
+
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
-                                                  const int* parentBufferIndices,
-                                                  const int* childBufferIndices,
-                                                  const int* probabilityIndices,
-                                                  const int* categoryWeightsIndices,
-                                                  const int* stateFrequenciesIndices,
-                                                  const int* cumulativeScaleIndices,
-                                                  const int* partitionIndices,
-                                                  int partitionCount,
-                                                  double* outSumLogLikelihoodByPartition) {
-    
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::waitForPartials(const int* destinationPartials,
+                                   int destinationPartialsCount) {
+    return BEAGLE_SUCCESS;
+}
 
-    for (int p = 0; p < partitionCount; p++) {
-        int pIndex = partitionIndices[p];
 
-        int startPattern = gPatternPartitionsStartPatterns[pIndex];
-        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoods(const int* bufferIndices,
+                                                             const int* categoryWeightsIndices,
+                                                             const int* stateFrequenciesIndices,
+                                                             const int* cumulativeScaleIndices,
+                                                             int count,
+                                                             double* outSumLogLikelihood) {
 
-        memset(&integrationTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
+    int returnCode = restorePartials(bufferIndices, count);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
-        const int parIndex = parentBufferIndices[p];
-        const int childIndex = childBufferIndices[p];
-        const int probIndex = probabilityIndices[p];
-        const int categoryWeightsIndex = categoryWeightsIndices[p];
-        const int stateFrequenciesIndex = stateFrequenciesIndices[p];
-        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+    if (count == 1) {
+        // We treat this as a special case so that we don't have convoluted logic
+        //      at the end of the loop over patterns
+        int cumulativeScalingFactorIndex;
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+            cumulativeScalingFactorIndex = 0;
+        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            cumulativeScalingFactorIndex = bufferIndices[0] - kTipCount; 
+        } else {
+            cumulativeScalingFactorIndex = cumulativeScaleIndices[0];
+        }
 
-        assert(parIndex >= kTipCount);
+        if (kAutoRootPartitioningEnabled) {
+            calcRootLogLikelihoodsByAutoPartitionAsync(bufferIndices,
+                                                       categoryWeightsIndices,
+                                                       stateFrequenciesIndices,
+                                                       cumulativeScaleIndices,
+                                                       gAutoPartitionIndices,
+                                                       gAutoPartitionOutSumLogLikelihoods);
 
-        const REALTYPE* partialsParent = gPartials[parIndex];
-        const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+            *outSumLogLikelihood = 0.0;
 
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-            const int* statesChild = gTipStates[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
+            for (int i = 0; i < kPartitionCount; i++) {
+                *outSumLogLikelihood += gAutoPartitionOutSumLogLikelihoods[i];
+            }
 
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = startPattern * kStateCount; // Index in resulting product-partials (summed over categories)
-                const REALTYPE weight = wt[l];
-                for(int k = startPattern; k < endPattern; k++) {
+            if (*outSumLogLikelihood != *outSumLogLikelihood) {
+                return BEAGLE_ERROR_FLOATING_POINT;
+            } else {
+                return BEAGLE_SUCCESS;
+            }
+        } else {
+            return calcRootLogLikelihoods(bufferIndices[0], categoryWeightsIndices[0], stateFrequenciesIndices[0],
+                                   cumulativeScalingFactorIndex, outSumLogLikelihood);
+        }
+    }
+    else
+    {
+        return calcRootLogLikelihoodsMulti(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices,
+                                    cumulativeScaleIndices, count, outSumLogLikelihood);
+    }
+}
 
-                    const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-                    // so we can interchange the patterCount and categoryCount loop order?
-                    int w =  l * kMatrixSize;
-                    for(int i = 0; i < kStateCount; i++) {
-                        integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                        u++;
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsAndCalculateRootLogLikelihood(const int* operations,
+                                                                                   int operationCount,
+                                                                                   int cumulativeScaleIndex,
+                                                                                   int categoryWeightsIndex,
+                                                                                   int stateFrequenciesIndex,
+                                                                                   bool writeRootPartials,
+                                                                                   double* outSumLogLikelihood) {
+    if (operationCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-                        w += kTransPaddedStateCount;
-                    }
-                    v += kPartialsPaddedStateCount;
-                }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
-            }
+    const int* rootOperation = operations + (operationCount - 1) * BEAGLE_OP_COUNT;
+
+    // root partials that are kept or scaled, and updates split across threads, go through
+    // the separate calls
+    if (writeRootPartials ||
+        (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC)) ||
+        rootOperation[1] != BEAGLE_OP_NONE || rootOperation[2] != BEAGLE_OP_NONE ||
+        kAutoPartitioningEnabled)
+        return BeagleImpl::updatePartialsAndCalculateRootLogLikelihood(operations, operationCount,
+                                                                       cumulativeScaleIndex,
+                                                                       categoryWeightsIndex,
+                                                                       stateFrequenciesIndex,
+                                                                       writeRootPartials,
+                                                                       outSumLogLikelihood);
+
+    const int child1Index = rootOperation[3];
+    const int child2Index = rootOperation[5];
+    if (child1Index < 0 || child1Index >= kBufferCount ||
+        child2Index < 0 || child2Index >= kBufferCount ||
+        rootOperation[4] < 0 || rootOperation[4] >= kMatrixCount ||
+        rootOperation[6] < 0 || rootOperation[6] >= kMatrixCount ||
+        categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount ||
+        stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount ||
+        cumulativeScaleIndex >= kScaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-        } else { // Integrate against a partial at the child
-            const REALTYPE* partialsChild = gPartials[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount;
-            int stateCountModFour = (kStateCount / 4) * 4;
-            
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = startPattern * kStateCount;
-                const REALTYPE weight = wt[l];
-                for(int k = startPattern; k < endPattern; k++) {
-                    int w = l * kMatrixSize;
-                    const REALTYPE* partialsChildPtr = &partialsChild[v];
-                    for(int i = 0; i < kStateCount; i++) {
-                        double sumOverJA = 0.0, sumOverJB = 0.0;
-                        int j = 0;
-                        const REALTYPE* transMatrixPtr = &transMatrix[w];
-                        for (; j < stateCountModFour; j += 4) {
-                            sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
-                            sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
-                            sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
-                            sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
-                            
-                        }
-                        for (; j < kStateCount; j++) {
-                            sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
-                        }
-                        //                        for(int j = 0; j < kStateCount; j++) {
-                        //                            sumOverJ += transMatrix[w] * partialsChild[v + j];
-                        //                            w++;
-                        //                        }
-                        integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
-                        u++;
-                        
-                        w += kStateCount;
+    int returnCode = BEAGLE_SUCCESS;
+    if (operationCount > 1)
+        returnCode = updatePartials(operations, operationCount - 1, cumulativeScaleIndex);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    const int childIndices[2] = {child1Index, child2Index};
+    returnCode = restorePartials(childIndices, 2);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    return calcRootLogLikelihoodsFromChildren(rootOperation, categoryWeightsIndex,
+                                              stateFrequenciesIndex, cumulativeScaleIndex,
+                                              outSumLogLikelihood);
+}
 
-                        // increment for the extra column at the end
-                        w += T_PAD;
-                    }
-                    v += kPartialsPaddedStateCount;
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsWithPatternWeights(const int* bufferIndices,
+                                                                                   const int* categoryWeightsIndices,
+                                                                                   const int* stateFrequenciesIndices,
+                                                                                   const int* cumulativeScaleIndices,
+                                                                                   int count,
+                                                                                   const double* inPatternWeights,
+                                                                                   int weightVectorCount,
+                                                                                   double* outSumLogLikelihoods) {
+    return sumSiteLogLikelihoodsWithPatternWeights(kPatternCount, bufferIndices, categoryWeightsIndices,
+                                                   stateFrequenciesIndices, cumulativeScaleIndices,
+                                                   count, inPatternWeights, weightVectorCount,
+                                                   outSumLogLikelihoods);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsForReplicates(int bufferIndex,
+                                                                                int categoryWeightsIndex,
+                                                                                const int* stateFrequenciesIndices,
+                                                                                int cumulativeScaleIndex,
+                                                                                int replicateCount,
+                                                                                double* outSumLogLikelihoods) {
+    if (replicateCount < 1 || kCategoryCount % replicateCount != 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    int returnCode = restorePartials(&bufferIndex, 1);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        cumulativeScaleIndex = 0;
+    else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
+        cumulativeScaleIndex = bufferIndex - kTipCount;
+
+    // the scale factors are shared by all categories, so each replicate's likelihood is
+    // integrated over its own block of categories as in calcRootLogLikelihoods
+    const int replicateCategoryCount = kCategoryCount / replicateCount;
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    for (int r = 0; r < replicateCount; r++) {
+        const REALTYPE* rootPartials = gPartials[bufferIndex] +
+                                       (size_t) r * replicateCategoryCount * kPaddedPatternCount * kPartialsPaddedStateCount;
+        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[r]];
+        const REALTYPE* categoryWeights = wt + r * replicateCategoryCount;
+
+        int u = 0;
+        int v = 0;
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i++) {
+                integrationTmp[u] = rootPartials[v] * (REALTYPE) categoryWeights[0];
+                u++;
+                v++;
+            }
+            v += P_PAD;
+        }
+        for (int l = 1; l < replicateCategoryCount; l++) {
+            u = 0;
+            v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            for (int k = 0; k < kPatternCount; k++) {
+                for (int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += rootPartials[v] * (REALTYPE) categoryWeights[l];
+                    u++;
+                    v++;
                 }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+                v += P_PAD;
             }
         }
-        
-        int u = startPattern * kStateCount;
-        for(int k = startPattern; k < endPattern; k++) {
-            REALTYPE sumOverI = 0.0;
-            for(int i = 0; i < kStateCount; i++) {
-                sumOverI += freqs[i] * integrationTmp[u];
+
+        double sumLogLikelihood = 0.0;
+        u = 0;
+        for (int k = 0; k < kPatternCount; k++) {
+            REALTYPE sum = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                sum += freqs[i] * integrationTmp[u];
                 u++;
             }
-
-            outLogLikelihoodsTmp[k] = log(sumOverI);
+            REALTYPE siteLogLikelihood = log(sum);
+            sumLogLikelihood += completeSiteLogLikelihood(siteLogLikelihood, cumulativeScaleIndex, k) *
+                                gPatternWeights[k];
         }
 
+        outSumLogLikelihoods[r] = sumLogLikelihood;
+        if (sumLogLikelihood != sumLogLikelihood)
+            returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    }
 
-        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-            const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-            for(int k=startPattern; k < endPattern; k++)
-                outLogLikelihoodsTmp[k] += scalingFactors[k];
-        }
+    return returnCode;
+}
 
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        for (int i = startPattern; i < endPattern; i++) {
-            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-        }
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsByPartition(
+                                                                  const int* bufferIndices,
+                                                                  const int* categoryWeightsIndices,
+                                                                  const int* stateFrequenciesIndices,
+                                                                  const int* cumulativeScaleIndices,
+                                                                  const int* partitionIndices,
+                                                                  int partitionCount,
+                                                                  int count,
+                                                                  double* outSumLogLikelihoodByPartition,
+                                                                  double* outSumLogLikelihood) {
+
+    int returnCode = restorePartials(bufferIndices, partitionCount * count);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    if (count == 1) {
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+            returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+        } else {
+            if (kThreadingEnabled) {
+                calcRootLogLikelihoodsByPartitionAsync(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);                
+            } else {
+                calcRootLogLikelihoodsByPartition(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);
+            }
+
+            *outSumLogLikelihood = 0.0;
 
+            for (int i = 0; i < partitionCount; i++) {
+                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
+            }
+
+            if (*outSumLogLikelihood != *outSumLogLikelihood) 
+                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+        }
+    } else {
+        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
     }
+
+    return returnCode;
 }
 
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDerivByPartition(
-                                                  const int* parentBufferIndices,
-                                                  const int* childBufferIndices,
-                                                  const int* probabilityIndices,
-                                                  const int* firstDerivativeIndices,
-                                                  const int* secondDerivativeIndices,
-                                                  const int* categoryWeightsIndices,
-                                                  const int* stateFrequenciesIndices,
-                                                  const int* cumulativeScaleIndices,
-                                                  const int* partitionIndices,
-                                                  int partitionCount,
-                                                  double* outSumLogLikelihoodByPartition,
-                                                  double* outSumFirstDerivativeByPartition,
-                                                  double* outSumSecondDerivativeByPartition) {
-    
-
-    for (int p = 0; p < partitionCount; p++) {
-        int pIndex = partitionIndices[p];
+    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartitionAsync(
+                                                        const int* bufferIndices,
+                                                        const int* categoryWeightsIndices,
+                                                        const int* stateFrequenciesIndices,
+                                                        const int* cumulativeScaleIndices,
+                                                        const int* partitionIndices,
+                                                        int partitionCount,
+                                                        double* outSumLogLikelihoodByPartition) {
 
-        int startPattern = gPatternPartitionsStartPatterns[pIndex];
-        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+    ThreadPoolTaskGroup group;
+    for (int i=0; i<partitionCount; i++) {
+        getThreadPool()->submit(group,
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition, this,
+                      &bufferIndices[i], &categoryWeightsIndices[i],
+                      &stateFrequenciesIndices[i], &cumulativeScaleIndices[i],
+                      &partitionIndices[i], 1,
+                      &outSumLogLikelihoodByPartition[i]),
+            partitionIndices[i]);
+    }
 
-        memset(&integrationTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
-        memset(&firstDerivTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
-        memset(&secondDerivTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
+    group.wait();
 
-        const int parIndex = parentBufferIndices[p];
-        const int childIndex = childBufferIndices[p];
-        const int probIndex = probabilityIndices[p];
-        const int firstDerivativeIndex = firstDerivativeIndices[p];
-        const int secondDerivativeIndex = secondDerivativeIndices[p];
-        const int categoryWeightsIndex = categoryWeightsIndices[p];
-        const int stateFrequenciesIndex = stateFrequenciesIndices[p];
-        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+}
 
-        assert(parIndex >= kTipCount);
+BEAGLE_CPU_TEMPLATE
+    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByAutoPartitionAsync(
+                                                        const int* bufferIndices,
+                                                        const int* categoryWeightsIndices,
+                                                        const int* stateFrequenciesIndices,
+                                                        const int* cumulativeScaleIndices,
+                                                        const int* partitionIndices,
+                                                        double* outSumLogLikelihoodByPartition) {
 
-        const REALTYPE* partialsParent = gPartials[parIndex];
-        const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
-        const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
-        const REALTYPE* secondDerivMatrix = gTransitionMatrices[secondDerivativeIndex];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    ThreadPoolTaskGroup group;
+    for (int i=0; i<kPartitionCount; i++) {
+        getThreadPool()->submit(group,
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition, this,
+                      bufferIndices, categoryWeightsIndices,
+                      stateFrequenciesIndices, cumulativeScaleIndices,
+                      &partitionIndices[i], 1,
+                      &outSumLogLikelihoodByPartition[i]),
+            i);
+    }
 
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    group.wait();
 
-            const int* statesChild = gTipStates[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
+}
 
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = startPattern * kStateCount; // Index in resulting product-partials (summed over categories)
-                const REALTYPE weight = wt[l];
-                for(int k = startPattern; k < endPattern; k++) {
 
-                    const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-                    // so we can interchange the patterCount and categoryCount loop order?
-                    int w =  l * kMatrixSize;
-                    for(int i = 0; i < kStateCount; i++) {
-                        integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                        firstDerivTmp[u] += firstDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                        secondDerivTmp[u] += secondDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                        u++;
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bufferIndices,
+                                                         const int* categoryWeightsIndices,
+                                                         const int* stateFrequenciesIndices,
+                                                         const int* scaleBufferIndices,
+                                                         int count,
+                                                         double* outSumLogLikelihood) {
+    // Here we do the 3 similar operations:
+    //              1. to set the lnL to the contribution of the first subset,
+    //              2. to add the lnL for other subsets up to the penultimate
+    //              3. to add the final subset and take the lnL
+    //      This form of the calc would not work when count == 1 because
+    //              we need operation 1 and 3 in the preceding list.  This is not
+    //              a problem, though as we deal with count == 1 in the previous
+    //              branch.
 
-                        w += kTransPaddedStateCount;
-                    }
-                    v += kPartialsPaddedStateCount;
+    std::vector<int> indexMaxScale(kPatternCount);
+    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
+        const int rootPartialIndex = bufferIndices[subsetIndex];
+        const REALTYPE* rootPartials = gPartials[rootPartialIndex];
+        const REALTYPE* frequencies = gStateFrequencies[stateFrequenciesIndices[subsetIndex]];
+        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[subsetIndex]];
+        int u = 0;
+        int v = 0;
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i++) {
+                integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
+                u++;
+                v++;
+            }
+            v += P_PAD;
+        }
+        for (int l = 1; l < kCategoryCount; l++) {
+            u = 0;
+            for (int k = 0; k < kPatternCount; k++) {
+                for (int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
+                    u++;
+                    v++;
                 }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+                v += P_PAD;
+            }
+        }
+        u = 0;
+        for (int k = 0; k < kPatternCount; k++) {
+            REALTYPE sum = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                sum += ((REALTYPE)frequencies[i]) * integrationTmp[u];
+                u++;
             }
 
-        } else { // Integrate against a partial at the child
+            // TODO: allow only some subsets to have scale indices
+            if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
+                int cumulativeScalingFactorIndex;
+                if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
+                    cumulativeScalingFactorIndex = rootPartialIndex - kTipCount; 
+                else
+                    cumulativeScalingFactorIndex = scaleBufferIndices[subsetIndex];
+                
+                const REALTYPE* cumulativeScaleFactors = gScaleBuffers[cumulativeScalingFactorIndex];
 
-            const REALTYPE* partialsChild = gPartials[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount;
+                if (subsetIndex == 0) {
+                    indexMaxScale[k] = 0;
+                    maxScaleFactor[k] = cumulativeScaleFactors[k];
+                    for (int j = 1; j < count; j++) {
+                        REALTYPE tmpScaleFactor;
+                        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
+                            tmpScaleFactor = gScaleBuffers[bufferIndices[j] - kTipCount][k]; 
+                        else
+                            tmpScaleFactor = gScaleBuffers[scaleBufferIndices[j]][k];
 
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = startPattern * kStateCount;
-                const REALTYPE weight = wt[l];
-                for(int k = startPattern; k < endPattern; k++) {
-                    int w = l * kMatrixSize;
-                    for(int i = 0; i < kStateCount; i++) {
-                        double sumOverJ = 0.0;
-                        double sumOverJD1 = 0.0;
-                        double sumOverJD2 = 0.0;
-                        for(int j = 0; j < kStateCount; j++) {
-                            sumOverJ += transMatrix[w] * partialsChild[v + j];
-                            sumOverJD1 += firstDerivMatrix[w] * partialsChild[v + j];
-                            sumOverJD2 += secondDerivMatrix[w] * partialsChild[v + j];
-                            w++;
+                        if (tmpScaleFactor > maxScaleFactor[k]) {
+                            indexMaxScale[k] = j;
+                            maxScaleFactor[k] = tmpScaleFactor;
                         }
-
-                        // increment for the extra column at the end
-                        w += T_PAD;
-
-                        integrationTmp[u] += sumOverJ * partialsParent[v + i] * weight;
-                        firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
-                        secondDerivTmp[u] += sumOverJD2 * partialsParent[v + i] * weight;
-                        u++;
                     }
-                    v += kPartialsPaddedStateCount;
                 }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
-            }
-        }
 
-        int u = startPattern * kStateCount;
-        for(int k = startPattern; k < endPattern; k++) {
-            REALTYPE sumOverI = 0.0;
-            REALTYPE sumOverID1 = 0.0;
-            REALTYPE sumOverID2 = 0.0;
-            for(int i = 0; i < kStateCount; i++) {
-                sumOverI += freqs[i] * integrationTmp[u];
-                sumOverID1 += freqs[i] * firstDerivTmp[u];
-                sumOverID2 += freqs[i] * secondDerivTmp[u];
-                u++;
+                if (subsetIndex != indexMaxScale[k])
+                    sum *= exp((REALTYPE)(cumulativeScaleFactors[k] - maxScaleFactor[k]));
             }
 
-            outLogLikelihoodsTmp[k] = log(sumOverI);
-            outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
-            outSecondDerivativesTmp[k] = sumOverID2 / sumOverI - outFirstDerivativesTmp[k] * outFirstDerivativesTmp[k];
+            if (subsetIndex == 0) {
+                outLogLikelihoodsTmp[k] = sum;
+            } else if (subsetIndex == count - 1) {
+                REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sum;
+
+                outLogLikelihoodsTmp[k] = tmpSum;
+            } else {
+                outLogLikelihoodsTmp[k] += sum;
+            }
         }
+        if (subsetIndex == count - 1)
+            vectorLog(outLogLikelihoodsTmp, kPatternCount);
+    }
 
+    if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
+        for(int i=0; i<kPatternCount; i++)
+            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
+    }
 
-        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-            const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-            for(int k=startPattern; k < endPattern; k++)
-                outLogLikelihoodsTmp[k] += scalingFactors[k];
-        }
+    *outSumLogLikelihood = sumSiteLogLikelihoods(BEAGLE_OP_NONE, 0, kPatternCount);
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    
+    return returnCode;
 
+}
 
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        outSumFirstDerivativeByPartition[p] = 0.0;
-        outSumSecondDerivativeByPartition[p] = 0.0;
-        for (int i = startPattern; i < endPattern; i++) {
-            outSumLogLikelihoodByPartition[p]    += outLogLikelihoodsTmp[i]    * gPatternWeights[i];
-            outSumFirstDerivativeByPartition[p]  += outFirstDerivativesTmp[i]  * gPatternWeights[i];
-            outSumSecondDerivativeByPartition[p] += outSecondDerivativesTmp[i] * gPatternWeights[i];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
+                            const int categoryWeightsIndex,
+                            const int stateFrequenciesIndex,
+                            const int scalingFactorsIndex,
+                            double* outSumLogLikelihood) {
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const REALTYPE* rootPartials = gPartials[bufferIndex];
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    int u = 0;
+    int v = 0;
+    for (int k = 0; k < kPatternCount; k++) {
+        for (int i = 0; i < kStateCount; i++) {
+            integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
+            u++;
+            v++;
+        }
+        v += P_PAD;
+    }
+    for (int l = 1; l < kCategoryCount; l++) {
+        u = 0;
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i++) {
+                integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
+                u++;
+                v++;
+            }
+            v += P_PAD;
+        }
+    }
+    u = 0;
+    for (int k = 0; k < kPatternCount; k++) {
+        REALTYPE sum = 0.0;
+        for (int i = 0; i < kStateCount; i++) {
+            sum += freqs[i] * integrationTmp[u];
+            u++;
         }
 
+        outLogLikelihoodsTmp[k] = sum;
     }
-}
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
 
 
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    
+    // TODO: merge the three kPatternCount loops above into one
+
+    return returnCode;
+}
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* parentBufferIndices,
-                                                                   const int* childBufferIndices,
-                                                                   const int* probabilityIndices,
-                                                                   const int* categoryWeightsIndices,
-                                                                   const int* stateFrequenciesIndices,
-                                                                   const int* scalingFactorsIndices,
-                                                                   int count,
-                                                                   double* outSumLogLikelihood) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsFromChildren(const int* operation,
+                                                                          const int categoryWeightsIndex,
+                                                                          const int stateFrequenciesIndex,
+                                                                          const int scalingFactorsIndex,
+                                                                          double* outSumLogLikelihood) {
 
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
-    
     int returnCode = BEAGLE_SUCCESS;
-    
-    for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
-        const REALTYPE* partialsParent = gPartials[parentBufferIndices[subsetIndex]];
-        const REALTYPE* transMatrix = gTransitionMatrices[probabilityIndices[subsetIndex]];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[subsetIndex]];
-        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[subsetIndex]];
-        int childIndex = childBufferIndices[subsetIndex];
 
-        memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-        
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-            
-            const int* statesChild = gTipStates[childIndex];
-            int v = 0; // Index for parent partials
-            
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = 0; // Index in resulting product-partials (summed over categories)
-                const REALTYPE weight = wt[l];
-                for(int k = 0; k < kPatternCount; k++) {
-                    
-                    const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-                    // so we can interchange the patterCount and categoryCount loop order?
-                    int w =  l * kMatrixSize;
-                    for(int i = 0; i < kStateCount; i++) {
-                        integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                        u++;
-                        
-                        w += kTransPaddedStateCount;
-                    }
-                    v += kPartialsPaddedStateCount;
-                }
-            }                
+    if (gRootPartialsScratch == NULL) {
+        gRootPartialsScratch = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+        if (gRootPartialsScratch == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+
+    const int* states1 = getTipStates(operation[3], 0);
+    const int* states2 = getTipStates(operation[5], 1);
+    const REALTYPE* partials1 = gPartials[operation[3]];
+    const REALTYPE* partials2 = gPartials[operation[5]];
+    const REALTYPE* matrices1 = gTransitionMatrices[operation[4]];
+    const REALTYPE* matrices2 = gTransitionMatrices[operation[6]];
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    for (int startPattern = 0; startPattern < kPatternCount;
+         startPattern += BEAGLE_CPU_ROOT_BLOCK_PATTERNS) {
+        const int endPattern = std::min(startPattern + BEAGLE_CPU_ROOT_BLOCK_PATTERNS,
+                                        kPatternCount);
+
+        if (states1 != NULL && states2 != NULL) {
+            calcStatesStates(gRootPartialsScratch, states1, matrices1, states2, matrices2,
+                             startPattern, endPattern);
+        } else if (states1 != NULL || states2 != NULL) {
+            if (states1 == NULL) {
+                std::swap(states1, states2);
+                std::swap(partials1, partials2);
+                std::swap(matrices1, matrices2);
+            }
+            if (kInterleavedPatterns)
+                calcPartialsInterleaved(gRootPartialsScratch, states1, NULL, matrices1, partials2,
+                                        matrices2, startPattern, endPattern);
+            else
+                calcStatesPartials(gRootPartialsScratch, states1, matrices1, partials2, matrices2,
+                                   startPattern, endPattern);
         } else {
-            const REALTYPE* partialsChild = gPartials[childIndex];
-            int v = 0;
-            int stateCountModFour = (kStateCount / 4) * 4;
-            
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = 0;
-                const REALTYPE weight = wt[l];
-                for(int k = 0; k < kPatternCount; k++) {
-                    int w = l * kMatrixSize;
-                    const REALTYPE* partialsChildPtr = &partialsChild[v];
-                    for(int i = 0; i < kStateCount; i++) {
-                        double sumOverJA = 0.0, sumOverJB = 0.0;
-                        int j = 0;
-                        const REALTYPE* transMatrixPtr = &transMatrix[w];
-                        for (; j < stateCountModFour; j += 4) {
-                            sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
-                            sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
-                            sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
-                            sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
-                            
-                        }
-                        for (; j < kStateCount; j++) {
-                            sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
-                        }
-//                        for(int j = 0; j < kStateCount; j++) {
-//                            sumOverJ += transMatrix[w] * partialsChild[v + j];
-//                            w++;
-//                        }
-                        integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
-                        u++;
-                        
-                        w += kStateCount;
+            if (kInterleavedPatterns)
+                calcPartialsInterleaved(gRootPartialsScratch, NULL, partials1, matrices1, partials2,
+                                        matrices2, startPattern, endPattern);
+            else
+                calcPartialsPartials(gRootPartialsScratch, partials1, matrices1, partials2, matrices2,
+                                     startPattern, endPattern);
+        }
 
-                        // increment for the extra column at the end
-                        w += T_PAD;
-                    }
-                    v += kPartialsPaddedStateCount;
+        integrateRootPartials(gRootPartialsScratch, wt, freqs, startPattern, endPattern);
+    }
+
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateRootPartials(const REALTYPE* rootPartials,
+                                                              const REALTYPE* wt,
+                                                              const REALTYPE* freqs,
+                                                              int startPattern,
+                                                              int endPattern) {
+    const int categoryStride = kPartialsPaddedStateCount * kPatternCount;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        REALTYPE* sums = &integrationTmp[k * kStateCount];
+        const REALTYPE* partials = &rootPartials[k * kPartialsPaddedStateCount];
+        for (int i = 0; i < kStateCount; i++)
+            sums[i] = partials[i] * (REALTYPE) wt[0];
+        for (int l = 1; l < kCategoryCount; l++) {
+            partials += categoryStride;
+            for (int i = 0; i < kStateCount; i++)
+                sums[i] += partials[i] * (REALTYPE) wt[l];
+        }
+
+        REALTYPE sum = 0.0;
+        for (int i = 0; i < kStateCount; i++)
+            sum += freqs[i] * sums[i];
+
+        outLogLikelihoodsTmp[k] = sum;
+    }
+    vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
+                                                         const int* bufferIndices,
+                                                         const int* categoryWeightsIndices,
+                                                         const int* stateFrequenciesIndices,
+                                                         const int* cumulativeScaleIndices,
+                                                         const int* partitionIndices,
+                                                         int partitionCount,
+                                                         double* outSumLogLikelihoodByPartition) {
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        const REALTYPE* rootPartials = gPartials[bufferIndices[p]];
+        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[p]];
+        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[p]];
+        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+        int u = startPattern * kStateCount;
+        int v = startPattern * kPartialsPaddedStateCount;
+        for (int k = startPattern; k < endPattern; k++) {
+            for (int i = 0; i < kStateCount; i++) {
+                integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
+                u++;
+                v++;
+            }
+            v += P_PAD;
+        }
+        for (int l = 1; l < kCategoryCount; l++) {
+            u = startPattern * kStateCount;
+            v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+            for (int k = startPattern; k < endPattern; k++) {
+                for (int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
+                    u++;
+                    v++;
                 }
+                v += P_PAD;
             }
-                            
         }
-        int u = 0;
-        for(int k = 0; k < kPatternCount; k++) {
-            REALTYPE sumOverI = 0.0;
-            for(int i = 0; i < kStateCount; i++) {
-                sumOverI += freqs[i] * integrationTmp[u];
+        u = startPattern * kStateCount;
+        for (int k = startPattern; k < endPattern; k++) {
+            REALTYPE sum = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                sum += freqs[i] * integrationTmp[u];
                 u++;
-            }            
-            
-            if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
-                int cumulativeScalingFactorIndex;
-                cumulativeScalingFactorIndex = scalingFactorsIndices[subsetIndex];
-                
-                const REALTYPE* cumulativeScaleFactors = gScaleBuffers[cumulativeScalingFactorIndex];
-                
-                if (subsetIndex == 0) {
-                    indexMaxScale[k] = 0;
-                    maxScaleFactor[k] = cumulativeScaleFactors[k];
-                    for (int j = 1; j < count; j++) {
-                        REALTYPE tmpScaleFactor;
-                        tmpScaleFactor = gScaleBuffers[scalingFactorsIndices[j]][k];
-                        
-                        if (tmpScaleFactor > maxScaleFactor[k]) {
-                            indexMaxScale[k] = j;
-                            maxScaleFactor[k] = tmpScaleFactor;
-                        }
-                    }
+            }
+
+            outLogLikelihoodsTmp[k] = sum;
+        }
+        vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
+
+
+        outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(scalingFactorsIndex,
+                                                                  startPattern, endPattern);
+
+    }
+
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactors(const int* scalingIndices,
+                                                int  count,
+                                                int  cumulativeScalingIndex) {
+    if (kLazyBuffers)
+        commitScaleBuffer(cumulativeScalingIndex);
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[0];
+        for(int j=0; j<kPatternCount; j++)
+            cumulativeScaleBuffer[j] =  0;
+        for(int i=0; i<count; i++) {
+            int sIndex = scalingIndices[i] - kTipCount;
+            if (gActiveScalingFactors[sIndex]) {
+                const signed short* scaleBuffer = gAutoScaleBuffers[sIndex];
+                for(int j=0; j<kPatternCount; j++) {
+                    cumulativeScaleBuffer[j] += M_LN2 * scaleBuffer[j];
                 }
+            }
+        }
                 
-                if (subsetIndex != indexMaxScale[k])
-                    sumOverI *= exp((REALTYPE)(cumulativeScaleFactors[k] - maxScaleFactor[k]));
+    } else {
+        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
+        if (kPowerOfTwoScaling && !(kFlags & BEAGLE_FLAG_SCALERS_LOG)) {
+            accumulateScaleExponents(scalingIndices, count, cumulativeScaleBuffer, 1, 0, kPatternCount);
+        } else {
+            for(int i=0; i<count; i++) {
+                if (!isScaleBufferWritten(scalingIndices[i]))
+                    continue;
+                const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
+                if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+                    for(int j=0; j<kPatternCount; j++)
+                        cumulativeScaleBuffer[j] += scaleBuffer[j];
+                } else {
+                    vectorAddLogs(cumulativeScaleBuffer, scaleBuffer, kPatternCount, 1.0);
+                }
+            }
+        }
+        for (int i = 0; i < count; i++)
+            accumulateMixedScaleFactors(scalingIndices[i], cumulativeScalingIndex, 1, 0, kPatternCount);
+
+        if (DEBUGGING_OUTPUT) {
+            fprintf(stderr,"Accumulating %d scale buffers into #%d\n",count,cumulativeScalingIndex);
+            for(int j=0; j<kPatternCount; j++) {
+                fprintf(stderr,"cumulativeScaleBuffer[%d] = %2.5e\n",j,cumulativeScaleBuffer[j]);
+            }
+        }
+    }
+    
+    setScaleBufferWritten(cumulativeScalingIndex, true);
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchScaleBuffer(cumulativeScalingIndex);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactorsByPartition(const int* scalingIndices,
+                                                                         int count,
+                                                                         int cumulativeScalingIndex,
+                                                                         int partitionIndex) {
+    if (kLazyBuffers)
+        commitScaleBuffer(cumulativeScalingIndex);
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;        
+    } else {
+
+        int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
+        int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+
+        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
+        if (kPowerOfTwoScaling && !(kFlags & BEAGLE_FLAG_SCALERS_LOG)) {
+            accumulateScaleExponents(scalingIndices, count, cumulativeScaleBuffer, 1,
+                                     startPattern, endPattern);
+        } else {
+            for(int i=0; i<count; i++) {
+                if (!isScaleBufferWritten(scalingIndices[i]))
+                    continue;
+                const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
+                if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+                    for(int j=startPattern; j<endPattern; j++)
+                        cumulativeScaleBuffer[j] += scaleBuffer[j];
+                } else {
+                    vectorAddLogs(cumulativeScaleBuffer + startPattern, scaleBuffer + startPattern, endPattern - startPattern, 1.0);
+                }
+            }
+        }
+        for (int i = 0; i < count; i++)
+            accumulateMixedScaleFactors(scalingIndices[i], cumulativeScalingIndex, 1,
+                                        startPattern, endPattern);
+
+    }
+    
+    setScaleBufferWritten(cumulativeScalingIndex, true);
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchScaleBuffer(cumulativeScalingIndex);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactors(const int* scalingIndices,
+                                            int  count,
+                                            int  cumulativeScalingIndex) {
+    if (kLazyBuffers)
+        commitScaleBuffer(cumulativeScalingIndex);
+    REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
+    if (kPowerOfTwoScaling && !(kFlags & BEAGLE_FLAG_SCALERS_LOG)) {
+        accumulateScaleExponents(scalingIndices, count, cumulativeScaleBuffer, -1, 0, kPatternCount);
+    } else {
+        for(int i=0; i<count; i++) {
+            if (!isScaleBufferWritten(scalingIndices[i]))
+                continue;
+            const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
+            if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+                for(int j=0; j<kPatternCount; j++)
+                    cumulativeScaleBuffer[j] -= scaleBuffer[j];
+            } else {
+                vectorAddLogs(cumulativeScaleBuffer, scaleBuffer, kPatternCount, -1.0);
+            }
+        }
+    }
+    for (int i = 0; i < count; i++)
+        accumulateMixedScaleFactors(scalingIndices[i], cumulativeScalingIndex, -1, 0, kPatternCount);
+
+    setScaleBufferWritten(cumulativeScalingIndex, true);
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchScaleBuffer(cumulativeScalingIndex);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactorsByPartition(const int* scalingIndices,
+                                                                     int count,
+                                                                     int cumulativeScalingIndex,
+                                                                     int partitionIndex) {
+    if (kLazyBuffers)
+        commitScaleBuffer(cumulativeScalingIndex);
+    
+    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
+    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+
+    REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
+    if (kPowerOfTwoScaling && !(kFlags & BEAGLE_FLAG_SCALERS_LOG)) {
+        accumulateScaleExponents(scalingIndices, count, cumulativeScaleBuffer, -1,
+                                 startPattern, endPattern);
+    } else {
+        for(int i=0; i<count; i++) {
+            if (!isScaleBufferWritten(scalingIndices[i]))
+                continue;
+            const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
+            if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+                for(int j=startPattern; j<endPattern; j++)
+                    cumulativeScaleBuffer[j] -= scaleBuffer[j];
+            } else {
+                vectorAddLogs(cumulativeScaleBuffer + startPattern, scaleBuffer + startPattern, endPattern - startPattern, -1.0);
             }
+        }
+    }
+    for (int i = 0; i < count; i++)
+        accumulateMixedScaleFactors(scalingIndices[i], cumulativeScalingIndex, -1,
+                                    startPattern, endPattern);
+
+    setScaleBufferWritten(cumulativeScalingIndex, true);
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchScaleBuffer(cumulativeScalingIndex);
+
+    return BEAGLE_SUCCESS;
+}
+
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactors(int cumulativeScalingIndex) {
+    if (kLazyBuffers)
+        commitScaleBuffer(cumulativeScalingIndex);
+    //memcpy(gScaleBuffers[cumulativeScalingIndex],zeros,sizeof(double) * kPatternCount);
+    
+     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+         memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(signed short) * kPaddedPatternCount);
+     } else {           
+         memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(REALTYPE) * kPaddedPatternCount);
+     }
+    if (kMixedPrecision)
+        gMixedScaleBuffers[cumulativeScalingIndex].assign(kPaddedPatternCount, 0.0);
+    setScaleBufferWritten(cumulativeScalingIndex, true);
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchScaleBuffer(cumulativeScalingIndex);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactorsByPartition(int cumulativeScalingIndex,
+                                                                    int partitionIndex) {
+    if (kLazyBuffers)
+        commitScaleBuffer(cumulativeScalingIndex);
+    
+     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+     } else {
+        int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
+        int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+
+        REALTYPE* cumulativeBuffer = gScaleBuffers[cumulativeScalingIndex]; 
+
+        memset(&cumulativeBuffer[startPattern], 0, sizeof(REALTYPE) * (endPattern - startPattern));
+        if (kMixedPrecision)
+            std::fill(gMixedScaleBuffers[cumulativeScalingIndex].begin() + startPattern,
+                      gMixedScaleBuffers[cumulativeScalingIndex].begin() + endPattern, 0.0);
+     }
+    setScaleBufferWritten(cumulativeScalingIndex, true);
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchScaleBuffer(cumulativeScalingIndex);
+
+    return BEAGLE_SUCCESS;
+}
+    
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::copyScaleFactors(int destScalingIndex,
+                                                        int srcScalingIndex) {
+    if (kLazyBuffers)
+        commitScaleBuffer(destScalingIndex);
+    memcpy(gScaleBuffers[destScalingIndex],gScaleBuffers[srcScalingIndex],sizeof(REALTYPE) * kPatternCount);
+    if (kMixedPrecision)
+        gMixedScaleBuffers[destScalingIndex] = gMixedScaleBuffers[srcScalingIndex];
+    setScaleBufferWritten(destScalingIndex, isScaleBufferWritten(srcScalingIndex));
+
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchScaleBuffer(destScalingIndex);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getScaleFactors(int srcScalingIndex,
+                                                       double* scaleFactors) {
+    // Do nothing                                                      
+    return BEAGLE_SUCCESS;                                                     
+}                                                      
+
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoods(const int* parentBufferIndices,
+                                                             const int* childBufferIndices,
+                                                             const int* probabilityIndices,
+                                                             const int* firstDerivativeIndices,
+                                                             const int* secondDerivativeIndices,
+                                                             const int* categoryWeightsIndices,
+                                                             const int* stateFrequenciesIndices,
+                                                             const int* cumulativeScaleIndices,
+                                                             int count,
+                                                             double* outSumLogLikelihood,
+                                                             double* outSumFirstDerivative,
+                                                             double* outSumSecondDerivative) {
+    int restoreCode = restorePartials(parentBufferIndices, count);
+    if (restoreCode == BEAGLE_SUCCESS)
+        restoreCode = restorePartials(childBufferIndices, count);
+    if (restoreCode != BEAGLE_SUCCESS)
+        return restoreCode;
+
+    // TODO: implement for count > 1
+
+    if (count == 1) {
+        int cumulativeScalingFactorIndex;
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+            cumulativeScalingFactorIndex = 0;
+        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            cumulativeScalingFactorIndex = kInternalPartialsBufferCount;
+            int child1ScalingIndex = parentBufferIndices[0] - kTipCount;
+            int child2ScalingIndex = childBufferIndices[0] - kTipCount;
+            resetScaleFactors(cumulativeScalingFactorIndex);
+            if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
+                int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
+                accumulateScaleFactors(scalingIndices, 2, cumulativeScalingFactorIndex);
+            } else if (child1ScalingIndex >= 0) {
+                int scalingIndices[1] = {child1ScalingIndex};
+                accumulateScaleFactors(scalingIndices, 1, cumulativeScalingFactorIndex);
+            } else if (child2ScalingIndex >= 0) {
+                int scalingIndices[1] = {child2ScalingIndex};
+                accumulateScaleFactors(scalingIndices, 1, cumulativeScalingFactorIndex);
+            }
+        } else {
+            cumulativeScalingFactorIndex = cumulativeScaleIndices[0];
+        }
+        if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL)
+
+            if (kAutoRootPartitioningEnabled) {
+                calcEdgeLogLikelihoodsByAutoPartitionAsync(parentBufferIndices,
+                                                           childBufferIndices,
+                                                           probabilityIndices,
+                                                           categoryWeightsIndices,
+                                                           stateFrequenciesIndices,
+                                                           cumulativeScaleIndices,
+                                                           gAutoPartitionIndices,
+                                                           gAutoPartitionOutSumLogLikelihoods);                
+
+                *outSumLogLikelihood = 0.0;
+
+                for (int i = 0; i < kPartitionCount; i++) {
+                    *outSumLogLikelihood += gAutoPartitionOutSumLogLikelihoods[i];
+                }
+
+                if (*outSumLogLikelihood != *outSumLogLikelihood) {
+                    return BEAGLE_ERROR_FLOATING_POINT;
+                } else {
+                    return BEAGLE_SUCCESS;
+                }
+            } else {
+                return calcEdgeLogLikelihoods(parentBufferIndices[0], childBufferIndices[0], probabilityIndices[0],
+                                       categoryWeightsIndices[0], stateFrequenciesIndices[0], cumulativeScalingFactorIndex,
+                                       outSumLogLikelihood);
+            }
+        else if (secondDerivativeIndices == NULL)
+            return calcEdgeLogLikelihoodsFirstDeriv(parentBufferIndices[0], childBufferIndices[0], probabilityIndices[0],
+                                             firstDerivativeIndices[0], categoryWeightsIndices[0], stateFrequenciesIndices[0],
+                                             cumulativeScalingFactorIndex, outSumLogLikelihood, outSumFirstDerivative);
+        else
+            return calcEdgeLogLikelihoodsSecondDeriv(parentBufferIndices[0], childBufferIndices[0], probabilityIndices[0],
+                                              firstDerivativeIndices[0], secondDerivativeIndices[0], categoryWeightsIndices[0],
+                                              stateFrequenciesIndices[0], cumulativeScalingFactorIndex, outSumLogLikelihood,
+                                              outSumFirstDerivative, outSumSecondDerivative);
+    } else {
+        if ((kFlags & BEAGLE_FLAG_SCALING_AUTO) || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
+            fprintf(stderr,"BeagleCPUImpl::calculateEdgeLogLikelihoods not yet implemented for count > 1 and auto/always scaling\n");
+        }
+        
+        if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
+            return calcEdgeLogLikelihoodsMulti(parentBufferIndices, childBufferIndices, probabilityIndices,
+                                          categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices, count,
+                                          outSumLogLikelihood);
+        } else {
+            fprintf(stderr,"BeagleCPUImpl::calculateEdgeLogLikelihoods not yet implemented for count > 1 and derivatives\n");
+        }            
+    }
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeSiteLogLikelihoods(const int* parentBufferIndices,
+                                                                       const int* childBufferIndices,
+                                                                       const int* probabilityIndices,
+                                                                       const int* firstDerivativeIndices,
+                                                                       const int* secondDerivativeIndices,
+                                                                       const int* categoryWeightsIndices,
+                                                                       const int* stateFrequenciesIndices,
+                                                                       const int* cumulativeScaleIndices,
+                                                                       int count,
+                                                                       double* outSiteLogLikelihoods,
+                                                                       double* outSiteFirstDerivatives,
+                                                                       double* outSiteSecondDerivatives) {
+    return collectEdgeSiteLogLikelihoods(kPatternCount, parentBufferIndices, childBufferIndices,
+                                         probabilityIndices, firstDerivativeIndices,
+                                         secondDerivativeIndices, categoryWeightsIndices,
+                                         stateFrequenciesIndices, cumulativeScaleIndices, count,
+                                         outSiteLogLikelihoods, outSiteFirstDerivatives,
+                                         outSiteSecondDerivatives);
+}
+
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
+                                                    const int* parentBufferIndices,
+                                                    const int* childBufferIndices,
+                                                    const int* probabilityIndices,
+                                                    const int* firstDerivativeIndices,
+                                                    const int* secondDerivativeIndices,
+                                                    const int* categoryWeightsIndices,
+                                                    const int* stateFrequenciesIndices,
+                                                    const int* cumulativeScaleIndices,
+                                                    const int* partitionIndices,
+                                                    int partitionCount,
+                                                    int count,
+                                                    double* outSumLogLikelihoodByPartition,
+                                                    double* outSumLogLikelihood,
+                                                    double* outSumFirstDerivativeByPartition,
+                                                    double* outSumFirstDerivative,
+                                                    double* outSumSecondDerivativeByPartition,
+                                                    double* outSumSecondDerivative) {
+
+    int returnCode = restorePartials(parentBufferIndices, partitionCount * count);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = restorePartials(childBufferIndices, partitionCount * count);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    if (count == 1) {
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+            returnCode =  BEAGLE_ERROR_NO_IMPLEMENTATION;
+        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+        } else {
+
+            if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
+
+                if (kThreadingEnabled) {
+                    calcEdgeLogLikelihoodsByPartitionAsync(parentBufferIndices,
+                                                           childBufferIndices,
+                                                           probabilityIndices,
+                                                           categoryWeightsIndices,
+                                                           stateFrequenciesIndices,
+                                                           cumulativeScaleIndices,
+                                                           partitionIndices,
+                                                           partitionCount,
+                                                           outSumLogLikelihoodByPartition);                
+                } else {
+                    calcEdgeLogLikelihoodsByPartition(parentBufferIndices,
+                                                      childBufferIndices,
+                                                      probabilityIndices,
+                                                      categoryWeightsIndices,
+                                                      stateFrequenciesIndices,
+                                                      cumulativeScaleIndices,
+                                                      partitionIndices,
+                                                      partitionCount,
+                                                      outSumLogLikelihoodByPartition);
+                }
+
+
+            } else if (secondDerivativeIndices == NULL) {
+                return BEAGLE_ERROR_NO_IMPLEMENTATION;
+            } else {
+
+                calcEdgeLogLikelihoodsSecondDerivByPartition(
+                                                parentBufferIndices,
+                                                childBufferIndices,
+                                                probabilityIndices,
+                                                firstDerivativeIndices,
+                                                secondDerivativeIndices,
+                                                categoryWeightsIndices,
+                                                stateFrequenciesIndices,
+                                                cumulativeScaleIndices,
+                                                partitionIndices,
+                                                partitionCount,
+                                                outSumLogLikelihoodByPartition,
+                                                outSumFirstDerivativeByPartition,
+                                                outSumSecondDerivativeByPartition);
+
+                *outSumFirstDerivative  = 0.0;
+                *outSumSecondDerivative = 0.0;
+
+                for (int i = 0; i < partitionCount; i++) {
+                    *outSumFirstDerivative  += outSumFirstDerivativeByPartition[i];
+                    *outSumSecondDerivative += outSumSecondDerivativeByPartition[i];
+                }
+
+                if (*outSumFirstDerivative  != *outSumFirstDerivative ||
+                    *outSumSecondDerivative != *outSumSecondDerivative) {
+                    returnCode = BEAGLE_ERROR_FLOATING_POINT;
+                }
+            }
+
+            *outSumLogLikelihood = 0.0;
+
+            for (int i = 0; i < partitionCount; i++) {
+                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
+            }
+
+            if (*outSumLogLikelihood != *outSumLogLikelihood) {
+                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+            }
+
+        }
+    } else {
+        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeDerivatives(const int* postBufferIndices,
+                                                                const int* preBufferIndices,
+                                                                const int* probabilityIndices,
+                                                                const int* firstDerivativeIndices,
+                                                                const int* categoryWeightsIndices,
+                                                                int count,
+                                                                double* outDerivatives,
+                                                                double* outSumDerivatives) {
+    int returnCode = restorePartials(postBufferIndices, count);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = restorePartials(preBufferIndices, count);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    std::vector<double> siteDerivatives(kPatternCount);
+
+    for (int edge = 0; edge < count; edge++) {
+        const int postIndex = postBufferIndices[edge];
+        const int preIndex = preBufferIndices[edge];
+        const int matrixIndex = probabilityIndices[edge];
+        const int derivativeIndex = firstDerivativeIndices[edge];
+        const int weightsIndex = categoryWeightsIndices[edge];
+        if (postIndex < 0 || postIndex >= kBufferCount ||
+            preIndex < 0 || preIndex >= kBufferCount || gPartials[preIndex] == NULL ||
+            matrixIndex < 0 || matrixIndex >= kMatrixCount ||
+            derivativeIndex < 0 || derivativeIndex >= kMatrixCount ||
+            weightsIndex < 0 || weightsIndex >= kEigenDecompCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        const int* postStates = getTipStates(postIndex);
+        const REALTYPE* postPartials = (postStates == NULL ? gPartials[postIndex] : NULL);
+        if (postStates == NULL && postPartials == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        const REALTYPE* derivativeMatrix = gTransitionMatrices[derivativeIndex];
+        double sum;
+        calcEdgeDerivatives(postStates, postPartials, gPartials[preIndex],
+                            gTransitionMatrices[matrixIndex], &derivativeMatrix, 1,
+                            gCategoryWeights[weightsIndex], siteDerivatives.data(), &sum);
+        outSumDerivatives[edge] = sum;
+        if (!(sum - sum == 0.0))
+            returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+        if (outDerivatives != NULL) {
+            double* edgeDerivatives = outDerivatives + edge * kPatternCount;
+            for (int k = 0; k < kPatternCount; k++) {
+                const int pattern = (kPatternsReordered ? gPatternsNewOrder[k] : k);
+                edgeDerivatives[k] = siteDerivatives[pattern];
+            }
+        }
+    }
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateParameterDerivatives(const int* postBufferIndices,
+                                                                     const int* preBufferIndices,
+                                                                     const int* probabilityIndices,
+                                                                     const int* derivativeIndices,
+                                                                     const int* categoryWeightsIndices,
+                                                                     int count,
+                                                                     int parameterCount,
+                                                                     double* outSumDerivatives) {
+    if (parameterCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    int returnCode = restorePartials(postBufferIndices, count);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = restorePartials(preBufferIndices, count);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    std::vector<double> siteDerivatives((size_t) parameterCount * kPatternCount);
+    std::vector<double> edgeSums(parameterCount);
+    std::vector<const REALTYPE*> derivativeMatrices(parameterCount);
+    for (int p = 0; p < parameterCount; p++)
+        outSumDerivatives[p] = 0.0;
+
+    for (int edge = 0; edge < count; edge++) {
+        const int postIndex = postBufferIndices[edge];
+        const int preIndex = preBufferIndices[edge];
+        const int matrixIndex = probabilityIndices[edge];
+        const int weightsIndex = categoryWeightsIndices[edge];
+        if (postIndex < 0 || postIndex >= kBufferCount ||
+            preIndex < 0 || preIndex >= kBufferCount || gPartials[preIndex] == NULL ||
+            matrixIndex < 0 || matrixIndex >= kMatrixCount ||
+            weightsIndex < 0 || weightsIndex >= kEigenDecompCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        for (int p = 0; p < parameterCount; p++) {
+            const int derivativeIndex = derivativeIndices[p * count + edge];
+            if (derivativeIndex < 0 || derivativeIndex >= kMatrixCount)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            derivativeMatrices[p] = gTransitionMatrices[derivativeIndex];
+        }
+
+        const int* postStates = getTipStates(postIndex);
+        const REALTYPE* postPartials = (postStates == NULL ? gPartials[postIndex] : NULL);
+        if (postStates == NULL && postPartials == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        calcEdgeDerivatives(postStates, postPartials, gPartials[preIndex],
+                            gTransitionMatrices[matrixIndex], derivativeMatrices.data(),
+                            parameterCount, gCategoryWeights[weightsIndex],
+                            siteDerivatives.data(), edgeSums.data());
+        for (int p = 0; p < parameterCount; p++)
+            outSumDerivatives[p] += edgeSums[p];
+    }
+
+    for (int p = 0; p < parameterCount; p++) {
+        if (!(outSumDerivatives[p] - outSumDerivatives[p] == 0.0))
+            returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    }
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsForMatrices(int parentBufferIndex,
+                                                                              int childBufferIndex,
+                                                                              const int* probabilityIndices,
+                                                                              const int* firstDerivativeIndices,
+                                                                              const int* secondDerivativeIndices,
+                                                                              int categoryWeightsIndex,
+                                                                              int stateFrequenciesIndex,
+                                                                              int cumulativeScaleIndex,
+                                                                              int matrixCount,
+                                                                              double* outSumLogLikelihoods,
+                                                                              double* outSumFirstDerivatives,
+                                                                              double* outSumSecondDerivatives) {
+    const int bufferIndices[2] = {parentBufferIndex, childBufferIndex};
+    int returnCode = restorePartials(bufferIndices, 2);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    // the automatic scaling modes and root partitioning accumulate their own factors per call
+    if ((kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS)) ||
+        kAutoRootPartitioningEnabled)
+        return BeagleImpl::calculateEdgeLogLikelihoodsForMatrices(parentBufferIndex, childBufferIndex,
+                                                                  probabilityIndices,
+                                                                  firstDerivativeIndices,
+                                                                  secondDerivativeIndices,
+                                                                  categoryWeightsIndex,
+                                                                  stateFrequenciesIndex,
+                                                                  cumulativeScaleIndex, matrixCount,
+                                                                  outSumLogLikelihoods,
+                                                                  outSumFirstDerivatives,
+                                                                  outSumSecondDerivatives);
+
+    if (parentBufferIndex < kTipCount || parentBufferIndex >= kBufferCount ||
+        gPartials[parentBufferIndex] == NULL ||
+        childBufferIndex < 0 || childBufferIndex >= kBufferCount ||
+        categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount ||
+        stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount ||
+        (cumulativeScaleIndex != BEAGLE_OP_NONE &&
+         (cumulativeScaleIndex < 0 || cumulativeScaleIndex >= kScaleBufferCount)) ||
+        (secondDerivativeIndices != NULL && firstDerivativeIndices == NULL))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    const int* childStates = getTipStates(childBufferIndex);
+    const REALTYPE* childPartials = (childStates == NULL ? gPartials[childBufferIndex] : NULL);
+    if (childStates == NULL && childPartials == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    std::vector<const REALTYPE*> matrices(matrixCount);
+    std::vector<const REALTYPE*> firstDerivativeMatrices(firstDerivativeIndices ? matrixCount : 0);
+    std::vector<const REALTYPE*> secondDerivativeMatrices(secondDerivativeIndices ? matrixCount : 0);
+    for (int t = 0; t < matrixCount; t++) {
+        if (probabilityIndices[t] < 0 || probabilityIndices[t] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        matrices[t] = gTransitionMatrices[probabilityIndices[t]];
+        if (firstDerivativeIndices != NULL) {
+            if (firstDerivativeIndices[t] < 0 || firstDerivativeIndices[t] >= kMatrixCount)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            firstDerivativeMatrices[t] = gTransitionMatrices[firstDerivativeIndices[t]];
+        }
+        if (secondDerivativeIndices != NULL) {
+            if (secondDerivativeIndices[t] < 0 || secondDerivativeIndices[t] >= kMatrixCount)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            secondDerivativeMatrices[t] = gTransitionMatrices[secondDerivativeIndices[t]];
+        }
+    }
+
+    std::vector<double> sumFirstDerivatives(matrixCount);
+    std::vector<double> sumSecondDerivatives(matrixCount);
+    calcEdgeLogLikelihoodsForMatrices(gPartials[parentBufferIndex], childStates, childPartials,
+                                      matrices.data(),
+                                      (firstDerivativeIndices ? firstDerivativeMatrices.data() : NULL),
+                                      (secondDerivativeIndices ? secondDerivativeMatrices.data() : NULL),
+                                      gCategoryWeights[categoryWeightsIndex],
+                                      gStateFrequencies[stateFrequenciesIndex],
+                                      cumulativeScaleIndex,
+                                      matrixCount, outSumLogLikelihoods,
+                                      sumFirstDerivatives.data(), sumSecondDerivatives.data());
+
+    returnCode = BEAGLE_SUCCESS;
+    for (int t = 0; t < matrixCount; t++) {
+        if (outSumFirstDerivatives != NULL)
+            outSumFirstDerivatives[t] = sumFirstDerivatives[t];
+        if (outSumSecondDerivatives != NULL)
+            outSumSecondDerivatives[t] = sumSecondDerivatives[t];
+        if (outSumLogLikelihoods[t] != outSumLogLikelihoods[t])
+            returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    }
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartitionAsync(
+                                                        const int* parentBufferIndices,
+                                                        const int* childBufferIndices,
+                                                        const int* probabilityIndices,
+                                                        const int* categoryWeightsIndices,
+                                                        const int* stateFrequenciesIndices,
+                                                        const int* cumulativeScaleIndices,
+                                                        const int* partitionIndices,
+                                                        int partitionCount,
+                                                        double* outSumLogLikelihoodByPartition) {
+
+    ThreadPoolTaskGroup group;
+    for (int i=0; i<partitionCount; i++) {
+        getThreadPool()->submit(group,
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition, this,
+                      &parentBufferIndices[i],
+                      &childBufferIndices[i],
+                      &probabilityIndices[i],
+                      &categoryWeightsIndices[i],
+                      &stateFrequenciesIndices[i],
+                      &cumulativeScaleIndices[i],
+                      &partitionIndices[i],
+                      1,
+                      &outSumLogLikelihoodByPartition[i]),
+            partitionIndices[i]);
+    }
+
+    group.wait();
+
+}
+
+BEAGLE_CPU_TEMPLATE
+    void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByAutoPartitionAsync(
+                                                        const int* parentBufferIndices,
+                                                        const int* childBufferIndices,
+                                                        const int* probabilityIndices,
+                                                        const int* categoryWeightsIndices,
+                                                        const int* stateFrequenciesIndices,
+                                                        const int* cumulativeScaleIndices,
+                                                        const int* partitionIndices,
+                                                        double* outSumLogLikelihoodByPartition) {
+
+    ThreadPoolTaskGroup group;
+    for (int i=0; i<kPartitionCount; i++) {
+        getThreadPool()->submit(group,
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition, this,
+                      parentBufferIndices,
+                      childBufferIndices,
+                      probabilityIndices,
+                      categoryWeightsIndices,
+                      stateFrequenciesIndices,
+                      cumulativeScaleIndices,
+                      &partitionIndices[i],
+                      1,
+                      &outSumLogLikelihoodByPartition[i]),
+            i);
+    }
+
+    group.wait();
+
+}
+
+
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex,
+                                                     const int childIndex,
+                                                     const int probIndex,
+                                                     const int categoryWeightsIndex,
+                                                     const int stateFrequenciesIndex,
+                                                     const int scalingFactorsIndex,
+                                                     double* outSumLogLikelihood) {
+
+    assert(parIndex >= kTipCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+
+    
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+
+        const int* statesChild = getTipStates(childIndex);
+        int v = 0; // Index for parent partials
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0; // Index in resulting product-partials (summed over categories)
+            const REALTYPE weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+
+                const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+                // so we can interchange the patterCount and categoryCount loop order?
+                int w =  l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                    u++;
+
+                    w += kTransPaddedStateCount;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const REALTYPE* partialsChild = gPartials[childIndex];
+        int v = 0;
+        int stateCountModFour = (kStateCount / 4) * 4;
+        
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            const REALTYPE weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                int w = l * kMatrixSize;
+                const REALTYPE* partialsChildPtr = &partialsChild[v];
+                for(int i = 0; i < kStateCount; i++) {
+                    double sumOverJA = 0.0, sumOverJB = 0.0;
+                    int j = 0;
+                    const REALTYPE* transMatrixPtr = &transMatrix[w];
+                    for (; j < stateCountModFour; j += 4) {
+                        sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
+                        sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
+                        sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
+                        sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
+                        
+                    }
+                    for (; j < kStateCount; j++) {
+                        sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
+                    }
+                    //                        for(int j = 0; j < kStateCount; j++) {
+                    //                            sumOverJ += transMatrix[w] * partialsChild[v + j];
+                    //                            w++;
+                    //                        }
+                    integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
+                    u++;
+                    
+                    w += kStateCount;
+
+                    // increment for the extra column at the end
+                    w += T_PAD;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+    
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        REALTYPE sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * integrationTmp[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = sumOverI;
+    }
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
+                                                  const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition) {
+    
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        memset(&integrationTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
+
+        const int parIndex = parentBufferIndices[p];
+        const int childIndex = childBufferIndices[p];
+        const int probIndex = probabilityIndices[p];
+        const int categoryWeightsIndex = categoryWeightsIndices[p];
+        const int stateFrequenciesIndex = stateFrequenciesIndices[p];
+        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+
+        assert(parIndex >= kTipCount);
+
+        const REALTYPE* partialsParent = gPartials[parIndex];
+        const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+            const int* statesChild = getTipStates(childIndex);
+            int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
+
+            for(int l = 0; l < kCategoryCount; l++) {
+                int u = startPattern * kStateCount; // Index in resulting product-partials (summed over categories)
+                const REALTYPE weight = wt[l];
+                for(int k = startPattern; k < endPattern; k++) {
+
+                    const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+                    // so we can interchange the patterCount and categoryCount loop order?
+                    int w =  l * kMatrixSize;
+                    for(int i = 0; i < kStateCount; i++) {
+                        integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                        u++;
+
+                        w += kTransPaddedStateCount;
+                    }
+                    v += kPartialsPaddedStateCount;
+                }
+                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+            }
+
+        } else { // Integrate against a partial at the child
+            const REALTYPE* partialsChild = gPartials[childIndex];
+            int v = startPattern * kPartialsPaddedStateCount;
+            int stateCountModFour = (kStateCount / 4) * 4;
+            
+            for(int l = 0; l < kCategoryCount; l++) {
+                int u = startPattern * kStateCount;
+                const REALTYPE weight = wt[l];
+                for(int k = startPattern; k < endPattern; k++) {
+                    int w = l * kMatrixSize;
+                    const REALTYPE* partialsChildPtr = &partialsChild[v];
+                    for(int i = 0; i < kStateCount; i++) {
+                        double sumOverJA = 0.0, sumOverJB = 0.0;
+                        int j = 0;
+                        const REALTYPE* transMatrixPtr = &transMatrix[w];
+                        for (; j < stateCountModFour; j += 4) {
+                            sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
+                            sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
+                            sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
+                            sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
+                            
+                        }
+                        for (; j < kStateCount; j++) {
+                            sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
+                        }
+                        //                        for(int j = 0; j < kStateCount; j++) {
+                        //                            sumOverJ += transMatrix[w] * partialsChild[v + j];
+                        //                            w++;
+                        //                        }
+                        integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
+                        u++;
+                        
+                        w += kStateCount;
+
+                        // increment for the extra column at the end
+                        w += T_PAD;
+                    }
+                    v += kPartialsPaddedStateCount;
+                }
+                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+            }
+        }
+        
+        int u = startPattern * kStateCount;
+        for(int k = startPattern; k < endPattern; k++) {
+            REALTYPE sumOverI = 0.0;
+            for(int i = 0; i < kStateCount; i++) {
+                sumOverI += freqs[i] * integrationTmp[u];
+                u++;
+            }
+
+            outLogLikelihoodsTmp[k] = sumOverI;
+        }
+        vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
+
+        outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(scalingFactorsIndex,
+                                                                  startPattern, endPattern);
+
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDerivByPartition(
+                                                  const int* parentBufferIndices,
+                                                  const int* childBufferIndices,
+                                                  const int* probabilityIndices,
+                                                  const int* firstDerivativeIndices,
+                                                  const int* secondDerivativeIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* stateFrequenciesIndices,
+                                                  const int* cumulativeScaleIndices,
+                                                  const int* partitionIndices,
+                                                  int partitionCount,
+                                                  double* outSumLogLikelihoodByPartition,
+                                                  double* outSumFirstDerivativeByPartition,
+                                                  double* outSumSecondDerivativeByPartition) {
+    
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startPattern = gPatternPartitionsStartPatterns[pIndex];
+        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
+
+        memset(&integrationTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
+        memset(&firstDerivTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
+        memset(&secondDerivTmp[startPattern*kStateCount], 0, ((endPattern - startPattern) * kStateCount)*sizeof(REALTYPE));
+
+        const int parIndex = parentBufferIndices[p];
+        const int childIndex = childBufferIndices[p];
+        const int probIndex = probabilityIndices[p];
+        const int firstDerivativeIndex = firstDerivativeIndices[p];
+        const int secondDerivativeIndex = secondDerivativeIndices[p];
+        const int categoryWeightsIndex = categoryWeightsIndices[p];
+        const int stateFrequenciesIndex = stateFrequenciesIndices[p];
+        const int scalingFactorsIndex = cumulativeScaleIndices[p];
+
+        assert(parIndex >= kTipCount);
+
+        const REALTYPE* partialsParent = gPartials[parIndex];
+        const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+        const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
+        const REALTYPE* secondDerivMatrix = gTransitionMatrices[secondDerivativeIndex];
+        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+
+            const int* statesChild = getTipStates(childIndex);
+            int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
+
+            for(int l = 0; l < kCategoryCount; l++) {
+                int u = startPattern * kStateCount; // Index in resulting product-partials (summed over categories)
+                const REALTYPE weight = wt[l];
+                for(int k = startPattern; k < endPattern; k++) {
+
+                    const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+                    // so we can interchange the patterCount and categoryCount loop order?
+                    int w =  l * kMatrixSize;
+                    for(int i = 0; i < kStateCount; i++) {
+                        integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                        firstDerivTmp[u] += firstDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                        secondDerivTmp[u] += secondDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                        u++;
+
+                        w += kTransPaddedStateCount;
+                    }
+                    v += kPartialsPaddedStateCount;
+                }
+                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+            }
+
+        } else { // Integrate against a partial at the child
+
+            const REALTYPE* partialsChild = gPartials[childIndex];
+            int v = startPattern * kPartialsPaddedStateCount;
+
+            for(int l = 0; l < kCategoryCount; l++) {
+                int u = startPattern * kStateCount;
+                const REALTYPE weight = wt[l];
+                for(int k = startPattern; k < endPattern; k++) {
+                    int w = l * kMatrixSize;
+                    for(int i = 0; i < kStateCount; i++) {
+                        double sumOverJ = 0.0;
+                        double sumOverJD1 = 0.0;
+                        double sumOverJD2 = 0.0;
+                        for(int j = 0; j < kStateCount; j++) {
+                            sumOverJ += transMatrix[w] * partialsChild[v + j];
+                            sumOverJD1 += firstDerivMatrix[w] * partialsChild[v + j];
+                            sumOverJD2 += secondDerivMatrix[w] * partialsChild[v + j];
+                            w++;
+                        }
+
+                        // increment for the extra column at the end
+                        w += T_PAD;
+
+                        integrationTmp[u] += sumOverJ * partialsParent[v + i] * weight;
+                        firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
+                        secondDerivTmp[u] += sumOverJD2 * partialsParent[v + i] * weight;
+                        u++;
+                    }
+                    v += kPartialsPaddedStateCount;
+                }
+                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+            }
+        }
+
+        int u = startPattern * kStateCount;
+        for(int k = startPattern; k < endPattern; k++) {
+            REALTYPE sumOverI = 0.0;
+            REALTYPE sumOverID1 = 0.0;
+            REALTYPE sumOverID2 = 0.0;
+            for(int i = 0; i < kStateCount; i++) {
+                sumOverI += freqs[i] * integrationTmp[u];
+                sumOverID1 += freqs[i] * firstDerivTmp[u];
+                sumOverID2 += freqs[i] * secondDerivTmp[u];
+                u++;
+            }
+
+            outLogLikelihoodsTmp[k] = sumOverI;
+            outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
+            outSecondDerivativesTmp[k] = sumOverID2 / sumOverI - outFirstDerivativesTmp[k] * outFirstDerivativesTmp[k];
+        }
+        vectorLog(outLogLikelihoodsTmp + startPattern, endPattern - startPattern);
+
+        outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(scalingFactorsIndex,
+                                                                  startPattern, endPattern);
+        outSumFirstDerivativeByPartition[p] = 0.0;
+        outSumSecondDerivativeByPartition[p] = 0.0;
+        for (int i = startPattern; i < endPattern; i++) {
+            outSumFirstDerivativeByPartition[p]  += outFirstDerivativesTmp[i]  * gPatternWeights[i];
+            outSumSecondDerivativeByPartition[p] += outSecondDerivativesTmp[i] * gPatternWeights[i];
+        }
+
+    }
+}
+
+
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* parentBufferIndices,
+                                                                   const int* childBufferIndices,
+                                                                   const int* probabilityIndices,
+                                                                   const int* categoryWeightsIndices,
+                                                                   const int* stateFrequenciesIndices,
+                                                                   const int* scalingFactorsIndices,
+                                                                   int count,
+                                                                   double* outSumLogLikelihood) {
+
+    std::vector<int> indexMaxScale(kPatternCount);
+    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
+    
+    int returnCode = BEAGLE_SUCCESS;
+    
+    for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
+        const REALTYPE* partialsParent = gPartials[parentBufferIndices[subsetIndex]];
+        const REALTYPE* transMatrix = gTransitionMatrices[probabilityIndices[subsetIndex]];
+        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[subsetIndex]];
+        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[subsetIndex]];
+        int childIndex = childBufferIndices[subsetIndex];
+
+        memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+        
+        if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+            
+            const int* statesChild = getTipStates(childIndex);
+            int v = 0; // Index for parent partials
+            
+            for(int l = 0; l < kCategoryCount; l++) {
+                int u = 0; // Index in resulting product-partials (summed over categories)
+                const REALTYPE weight = wt[l];
+                for(int k = 0; k < kPatternCount; k++) {
+                    
+                    const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+                    // so we can interchange the patterCount and categoryCount loop order?
+                    int w =  l * kMatrixSize;
+                    for(int i = 0; i < kStateCount; i++) {
+                        integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                        u++;
+                        
+                        w += kTransPaddedStateCount;
+                    }
+                    v += kPartialsPaddedStateCount;
+                }
+            }                
+        } else {
+            const REALTYPE* partialsChild = gPartials[childIndex];
+            int v = 0;
+            int stateCountModFour = (kStateCount / 4) * 4;
+            
+            for(int l = 0; l < kCategoryCount; l++) {
+                int u = 0;
+                const REALTYPE weight = wt[l];
+                for(int k = 0; k < kPatternCount; k++) {
+                    int w = l * kMatrixSize;
+                    const REALTYPE* partialsChildPtr = &partialsChild[v];
+                    for(int i = 0; i < kStateCount; i++) {
+                        double sumOverJA = 0.0, sumOverJB = 0.0;
+                        int j = 0;
+                        const REALTYPE* transMatrixPtr = &transMatrix[w];
+                        for (; j < stateCountModFour; j += 4) {
+                            sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
+                            sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
+                            sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
+                            sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
+                            
+                        }
+                        for (; j < kStateCount; j++) {
+                            sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
+                        }
+//                        for(int j = 0; j < kStateCount; j++) {
+//                            sumOverJ += transMatrix[w] * partialsChild[v + j];
+//                            w++;
+//                        }
+                        integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
+                        u++;
+                        
+                        w += kStateCount;
+
+                        // increment for the extra column at the end
+                        w += T_PAD;
+                    }
+                    v += kPartialsPaddedStateCount;
+                }
+            }
+                            
+        }
+        int u = 0;
+        for(int k = 0; k < kPatternCount; k++) {
+            REALTYPE sumOverI = 0.0;
+            for(int i = 0; i < kStateCount; i++) {
+                sumOverI += freqs[i] * integrationTmp[u];
+                u++;
+            }            
+            
+            if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
+                int cumulativeScalingFactorIndex;
+                cumulativeScalingFactorIndex = scalingFactorsIndices[subsetIndex];
+                
+                const REALTYPE* cumulativeScaleFactors = gScaleBuffers[cumulativeScalingFactorIndex];
+                
+                if (subsetIndex == 0) {
+                    indexMaxScale[k] = 0;
+                    maxScaleFactor[k] = cumulativeScaleFactors[k];
+                    for (int j = 1; j < count; j++) {
+                        REALTYPE tmpScaleFactor;
+                        tmpScaleFactor = gScaleBuffers[scalingFactorsIndices[j]][k];
+                        
+                        if (tmpScaleFactor > maxScaleFactor[k]) {
+                            indexMaxScale[k] = j;
+                            maxScaleFactor[k] = tmpScaleFactor;
+                        }
+                    }
+                }
+                
+                if (subsetIndex != indexMaxScale[k])
+                    sumOverI *= exp((REALTYPE)(cumulativeScaleFactors[k] - maxScaleFactor[k]));
+            }
+
+
+            
+            if (subsetIndex == 0) {
+                outLogLikelihoodsTmp[k] = sumOverI;
+            } else if (subsetIndex == count - 1) {
+                REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sumOverI;
+                
+                outLogLikelihoodsTmp[k] = tmpSum;
+            } else {
+                outLogLikelihoodsTmp[k] += sumOverI;
+            }
+                        
+        }        
+        if (subsetIndex == count - 1)
+            vectorLog(outLogLikelihoodsTmp, kPatternCount);
+        
+    }
+    
+    if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
+        for(int i=0; i<kPatternCount; i++)
+            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
+    }
+    
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(BEAGLE_OP_NONE, 0, kPatternCount);
+    
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    
+    return returnCode;
+}
+
+    
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const int parIndex,
+                                                               const int childIndex,
+                                                               const int probIndex,
+                                                               const int firstDerivativeIndex,
+                                                               const int categoryWeightsIndex,
+                                                               const int stateFrequenciesIndex,
+                                                               const int scalingFactorsIndex,
+                                                               double* outSumLogLikelihood,
+                                                               double* outSumFirstDerivative) {
+
+    assert(parIndex >= kTipCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+    memset(firstDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+
+        const int* statesChild = getTipStates(childIndex);
+        int v = 0; // Index for parent partials
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0; // Index in resulting product-partials (summed over categories)
+            const REALTYPE weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+
+                const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+                // so we can interchange the patterCount and categoryCount loop order?
+                int w =  l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                    firstDerivTmp[u] += firstDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                    u++;
+
+                    w += kTransPaddedStateCount;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const REALTYPE* partialsChild = gPartials[childIndex];
+        int v = 0;
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            const REALTYPE weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                int w = l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    double sumOverJ = 0.0;
+                    double sumOverJD1 = 0.0;
+                    for(int j = 0; j < kStateCount; j++) {
+                        sumOverJ += transMatrix[w] * partialsChild[v + j];
+                        sumOverJD1 += firstDerivMatrix[w] * partialsChild[v + j];
+                        w++;
+                    }
+
+                    // increment for the extra column at the end
+                    w += T_PAD;
+
+                    integrationTmp[u] += sumOverJ * partialsParent[v + i] * weight;
+                    firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
+                    u++;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        REALTYPE sumOverI = 0.0;
+        REALTYPE sumOverID1 = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * integrationTmp[u];
+            sumOverID1 += freqs[i] * firstDerivTmp[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = sumOverI;
+        outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
+    }
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
+    *outSumFirstDerivative = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
+    }
+    
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const int parIndex,
+                                                                const int childIndex,
+                                                                const int probIndex,
+                                                                const int firstDerivativeIndex,
+                                                                const int secondDerivativeIndex,
+                                                                const int categoryWeightsIndex,
+                                                                const int stateFrequenciesIndex,
+                                                                const int scalingFactorsIndex,
+                                                                double* outSumLogLikelihood,
+                                                                double* outSumFirstDerivative,
+                                                                double* outSumSecondDerivative) {
+
+    assert(parIndex >= kTipCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
+    const REALTYPE* secondDerivMatrix = gTransitionMatrices[secondDerivativeIndex];
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+    memset(firstDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+    memset(secondDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+
+    if (childIndex < kTipCount && hasTipStates(childIndex)) { // Integrate against a state at the child
+
+        const int* statesChild = getTipStates(childIndex);
+        int v = 0; // Index for parent partials
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0; // Index in resulting product-partials (summed over categories)
+            const REALTYPE weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+
+                const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+                // so we can interchange the patterCount and categoryCount loop order?
+                int w =  l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                    firstDerivTmp[u] += firstDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                    secondDerivTmp[u] += secondDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
+                    u++;
+
+                    w += kTransPaddedStateCount;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const REALTYPE* partialsChild = gPartials[childIndex];
+        int v = 0;
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            const REALTYPE weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                int w = l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    double sumOverJ = 0.0;
+                    double sumOverJD1 = 0.0;
+                    double sumOverJD2 = 0.0;
+                    for(int j = 0; j < kStateCount; j++) {
+                        sumOverJ += transMatrix[w] * partialsChild[v + j];
+                        sumOverJD1 += firstDerivMatrix[w] * partialsChild[v + j];
+                        sumOverJD2 += secondDerivMatrix[w] * partialsChild[v + j];
+                        w++;
+                    }
+
+                    // increment for the extra column at the end
+                    w += T_PAD;
+
+                    integrationTmp[u] += sumOverJ * partialsParent[v + i] * weight;
+                    firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
+                    secondDerivTmp[u] += sumOverJD2 * partialsParent[v + i] * weight;
+                    u++;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        REALTYPE sumOverI = 0.0;
+        REALTYPE sumOverID1 = 0.0;
+        REALTYPE sumOverID2 = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * integrationTmp[u];
+            sumOverID1 += freqs[i] * firstDerivTmp[u];
+            sumOverID2 += freqs[i] * secondDerivTmp[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = sumOverI;
+        outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
+        outSecondDerivativesTmp[k] = sumOverID2 / sumOverI - outFirstDerivativesTmp[k] * outFirstDerivativesTmp[k];
+    }
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
+    *outSumFirstDerivative = 0.0;
+    *outSumSecondDerivative = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
+
+        *outSumSecondDerivative += outSecondDerivativesTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    
+    return returnCode;
+}
+
+
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsForMatrices(const REALTYPE* parentPartials,
+                                                                          const int* childStates,
+                                                                          const REALTYPE* childPartials,
+                                                                          const REALTYPE** matrices,
+                                                                          const REALTYPE** firstDerivativeMatrices,
+                                                                          const REALTYPE** secondDerivativeMatrices,
+                                                                          const REALTYPE* categoryWeights,
+                                                                          const REALTYPE* stateFrequencies,
+                                                                          int scalingFactorsIndex,
+                                                                          int matrixCount,
+                                                                          double* outSumLogLikelihoods,
+                                                                          double* outSumFirstDerivatives,
+                                                                          double* outSumSecondDerivatives) {
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+
+    // per matrix sums over the categories of the current pattern
+    std::vector<double> siteL(matrixCount);
+    std::vector<double> siteD1(matrixCount);
+    std::vector<double> siteD2(matrixCount);
+    std::vector<double> weightedParent(kStateCount);
+
+    for (int t = 0; t < matrixCount; t++) {
+        outSumLogLikelihoods[t] = 0.0;
+        outSumFirstDerivatives[t] = 0.0;
+        outSumSecondDerivatives[t] = 0.0;
+    }
+
+    for (int k = 0; k < kPatternCount; k++) {
+        for (int t = 0; t < matrixCount; t++)
+            siteL[t] = siteD1[t] = siteD2[t] = 0.0;
+
+        const int stateChild = (childStates != NULL ? childStates[k] : 0);
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int v = l * categoryStride + k * kPartialsPaddedStateCount;
+            const REALTYPE* child = (childPartials != NULL ? childPartials + v : NULL);
+            for (int i = 0; i < kStateCount; i++)
+                weightedParent[i] = stateFrequencies[i] * parentPartials[v + i] * categoryWeights[l];
+
+            for (int t = 0; t < matrixCount; t++) {
+                const REALTYPE* P = matrices[t] + l * kMatrixSize;
+                const REALTYPE* D1 = (firstDerivativeMatrices ? firstDerivativeMatrices[t] + l * kMatrixSize : NULL);
+                const REALTYPE* D2 = (secondDerivativeMatrices ? secondDerivativeMatrices[t] + l * kMatrixSize : NULL);
+                double sumL = 0.0, sumD1 = 0.0, sumD2 = 0.0;
+                int w = 0;
+                for (int i = 0; i < kStateCount; i++) {
+                    double sumOverJ = 0.0, sumOverJD1 = 0.0, sumOverJD2 = 0.0;
+                    if (child == NULL) {
+                        sumOverJ = P[w + stateChild];
+                        if (D1 != NULL)
+                            sumOverJD1 = D1[w + stateChild];
+                        if (D2 != NULL)
+                            sumOverJD2 = D2[w + stateChild];
+                    } else {
+                        for (int j = 0; j < kStateCount; j++)
+                            sumOverJ += P[w + j] * child[j];
+                        if (D1 != NULL) {
+                            for (int j = 0; j < kStateCount; j++)
+                                sumOverJD1 += D1[w + j] * child[j];
+                        }
+                        if (D2 != NULL) {
+                            for (int j = 0; j < kStateCount; j++)
+                                sumOverJD2 += D2[w + j] * child[j];
+                        }
+                    }
+                    sumL += sumOverJ * weightedParent[i];
+                    sumD1 += sumOverJD1 * weightedParent[i];
+                    sumD2 += sumOverJD2 * weightedParent[i];
+                    w += kTransPaddedStateCount;
+                }
+                siteL[t] += sumL;
+                siteD1[t] += sumD1;
+                siteD2[t] += sumD2;
+            }
+        }
+
+        const double patternWeight = gPatternWeights[k];
+        double scale = 0.0;
+        if (scalingFactorsIndex >= 0)
+            scale = (kMixedPrecision ? gMixedScaleBuffers[scalingFactorsIndex][k] :
+                                       gScaleBuffers[scalingFactorsIndex][k]);
+        for (int t = 0; t < matrixCount; t++) {
+            const double d1 = siteD1[t] / siteL[t];
+            outSumLogLikelihoods[t] += (log(siteL[t]) + scale) * patternWeight;
+            outSumFirstDerivatives[t] += d1 * patternWeight;
+            outSumSecondDerivatives[t] += (siteD2[t] / siteL[t] - d1 * d1) * patternWeight;
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::block(void) {
+    // Do nothing.
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reset() {
+    // the tips are unset, so each may be set again as either compact states or partials
+    for (int i = 0; i < kTipCount; i++)
+        clearTipStates(i);
+
+    // what was derived from the old data and model must not be found clean or reused
+    for (int i = 0; i < (int) gSiteRepeatClasses.size(); i++)
+        clearSiteRepeats(i);
+    for (int i = 0; i < (int) gGapPatterns.size(); i++)
+        gGapPatterns[i].clear();
+    if (gMatrixCache != NULL)
+        gMatrixCache->forgetAll();
+    if (gBufferVersions != NULL)
+        gBufferVersions->touchAll();
+
+    for (int i = 0; i < kPatternCount; i++)
+        gPatternWeights[i] = 1.0;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::grow(int tipCount,
+                                            int partialsBufferCount,
+                                            int compactBufferCount,
+                                            int patternCount,
+                                            int matrixBufferCount,
+                                            int scaleBufferCount) {
+    const int bufferCount = partialsBufferCount + compactBufferCount;
+    const bool internalScaleBuffers = (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS));
+    if (tipCount < kTipCount || bufferCount < kBufferCount || tipCount >= bufferCount ||
+        patternCount < kPatternCount || matrixBufferCount < kMatrixCount ||
+        (!internalScaleBuffers && scaleBufferCount < kScaleBufferCount))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // buffers in an arena or placed by partition, evicted partials, reordered patterns and
+    // scale buffers tied to the buffer index of their partials keep the old layout
+    if (gBufferArena != NULL || kNumaPlacement || gResidentPartials != NULL ||
+        kPatternsReordered || (kFlags & BEAGLE_FLAG_SCALING_AUTO) ||
+        ((kFlags & BEAGLE_FLAG_SCALING_ALWAYS) && tipCount != kTipCount))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    // the workers and partitions are sized for the old dimensions; automatic partitions are
+    // made again at the end, others must be set again
+    const bool autoPartitioned = kAutoPartitioningEnabled;
+    const int autoPartitionCount = kPartitionCount;
+    stopThreads();
+    clearAutoPartitions();
+    if (kPartitionsInitialised) {
+        free(gPatternPartitions);
+        free(gPatternPartitionsStartPatterns);
+        kPartitionsInitialised = false;
+    }
+    kPartitionCount = 1;
+    kMaxPartitionCount = 1;
+    kPartitionScheduleThreads = 0;
+
+    // packed states are unpacked while the old pattern counts hold
+    std::vector<std::vector<int> > packedStates(kPackedTipStates ? kTipCount : 0);
+    for (int i = 0; i < (int) packedStates.size(); i++) {
+        if (gPackedTipStates[i] != NULL) {
+            const int* states = getTipStates(i);
+            packedStates[i].assign(states, states + kPatternCount);
+            free(gPackedTipStates[i]);
+            gPackedTipStates[i] = NULL;
+        }
+    }
+
+    const int oldTipCount = kTipCount;
+    const int oldBufferCount = kBufferCount;
+    const int oldPatternCount = kPatternCount;
+    const int oldPaddedPatternCount = kPaddedPatternCount;
+    const int oldMatrixCount = kMatrixCount;
+    const int oldScaleBufferCount = kScaleBufferCount;
+
+    kTipCount = tipCount;
+    kBufferCount = bufferCount;
+    kInternalPartialsBufferCount = kBufferCount - kTipCount;
+    kPatternCount = patternCount;
+    int modulus = getPaddedPatternsModulus();
+    kPaddedPatternCount = kPatternCount;
+    int remainder = kPatternCount % modulus;
+    if (remainder != 0)
+        kPaddedPatternCount += modulus - remainder;
+    kExtraPatterns = kPaddedPatternCount - kPatternCount;
+    kPartialsSize = kPaddedPatternCount * kPartialsPaddedStateCount * kCategoryCount;
+    kMatrixCount = matrixBufferCount;
+    kScaleBufferCount = ((kFlags & BEAGLE_FLAG_SCALING_ALWAYS) ? kInternalPartialsBufferCount + 1 :
+                         scaleBufferCount);
+
+    REALTYPE* oldUnwrittenPartials = gUnwrittenPartials;
+    REALTYPE* oldUnwrittenScaleBuffer = gUnwrittenScaleBuffer;
+    if (kLazyBuffers) {
+        gUnwrittenPartials = (REALTYPE*) calloc(kPartialsSize, sizeof(REALTYPE));
+        gUnwrittenScaleBuffer = (REALTYPE*) calloc(kPaddedPatternCount, sizeof(REALTYPE));
+        if (gUnwrittenPartials == NULL || gUnwrittenScaleBuffer == NULL)
+            throw std::bad_alloc();
+    }
+
+    gPartials = (REALTYPE**) realloc(gPartials, sizeof(REALTYPE*) * kBufferCount);
+    gTipStates = (int**) realloc(gTipStates, sizeof(int*) * kBufferCount);
+    if (gPartials == NULL || gTipStates == NULL)
+        throw std::bad_alloc();
+    if (gPackedTipStates != NULL) {
+        gPackedTipStates = (unsigned char**) realloc(gPackedTipStates, sizeof(unsigned char*) * kBufferCount);
+        if (gPackedTipStates == NULL)
+            throw std::bad_alloc();
+    }
+    for (int i = oldBufferCount; i < kBufferCount; i++) {
+        gPartials[i] = NULL;
+        gTipStates[i] = NULL;
+        if (gPackedTipStates != NULL)
+            gPackedTipStates[i] = NULL;
+    }
+
+    // the patterns added to tips are missing, those of internal partials are computed later;
+    // buffers that were internal and are now tips are left unset
+    for (int i = 0; i < oldBufferCount; i++) {
+        REALTYPE* partials = gPartials[i];
+        if (partials == NULL)
+            continue;
+        if (i >= oldTipCount && i < kTipCount) {
+            gPartials[i] = NULL;
+        } else if (partials == oldUnwrittenPartials) {
+            gPartials[i] = gUnwrittenPartials;
+            continue;
+        } else {
+            gPartials[i] = growPatterns(partials, kCategoryCount, kPartialsPaddedStateCount,
+                                        kStateCount, (REALTYPE) (i < kTipCount ? 1.0 : 0.0),
+                                        oldPatternCount, oldPaddedPatternCount);
+        }
+        if (partials != oldUnwrittenPartials)
+            free(partials);
+    }
+    for (int i = (oldBufferCount > kTipCount ? oldBufferCount : kTipCount); i < kBufferCount; i++) {
+        gPartials[i] = (kLazyBuffers ? gUnwrittenPartials : allocatePartials(i));
+        if (gPartials[i] == NULL)
+            throw std::bad_alloc();
+    }
+
+    for (int i = 0; i < oldTipCount; i++) {
+        if (gTipStates[i] != NULL) {
+            int* states = growPatterns(gTipStates[i], 1, 1, 1, kStateCount,
+                                       oldPatternCount, oldPaddedPatternCount);
+            for (int k = kPatternCount; k < kPaddedPatternCount; k++)
+                states[k] = kStateCount;
+            free(gTipStates[i]);
+            gTipStates[i] = states;
+        }
+    }
+    for (int i = 0; i < (int) packedStates.size(); i++) {
+        if (!packedStates[i].empty())
+            packTipStates(i, &packedStates[i][0], oldPatternCount);
+    }
+
+    // the patterns added to scale buffers are left without factors
+    const REALTYPE noFactor = ((kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) ? 1.0 : 0.0);
+    gScaleBuffers = (REALTYPE**) realloc(gScaleBuffers, sizeof(REALTYPE*) * kScaleBufferCount);
+    if (gScaleBuffers == NULL)
+        throw std::bad_alloc();
+    for (int i = 0; i < kScaleBufferCount; i++) {
+        REALTYPE* scaleBuffer = (i < oldScaleBufferCount ? gScaleBuffers[i] : NULL);
+        if (kLazyBuffers && (scaleBuffer == NULL || scaleBuffer == oldUnwrittenScaleBuffer)) {
+            gScaleBuffers[i] = gUnwrittenScaleBuffer;
+        } else if (scaleBuffer != NULL) {
+            gScaleBuffers[i] = growPatterns(scaleBuffer, 1, 1, 1, noFactor,
+                                            oldPatternCount, oldPaddedPatternCount);
+            free(scaleBuffer);
+        } else {
+            gScaleBuffers[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPaddedPatternCount);
+            if (gScaleBuffers[i] == NULL)
+                throw std::bad_alloc();
+            for (int k = 0; k < kPaddedPatternCount; k++)
+                gScaleBuffers[i][k] = noFactor;
+        }
+    }
+    if (!gScaleBufferWritten.empty())
+        gScaleBufferWritten.assign(kScaleBufferCount, 1);
+    if (kMixedPrecision) {
+        gMixedScaleBuffers.resize(kScaleBufferCount);
+        for (int i = 0; i < kScaleBufferCount; i++) {
+            gMixedScaleBuffers[i].resize(std::min((int) gMixedScaleBuffers[i].size(), oldPatternCount));
+            gMixedScaleBuffers[i].resize(kPaddedPatternCount, 0.0);
+        }
+        gMixedLogLikelihoods.resize(kPatternCount, 0.0);
+    }
+    if (kLazyBuffers) {
+        free(oldUnwrittenPartials);
+        free(oldUnwrittenScaleBuffer);
+    }
+
+    gTransitionMatrices = (REALTYPE**) realloc(gTransitionMatrices, sizeof(REALTYPE*) * kMatrixCount);
+    if (gTransitionMatrices == NULL)
+        throw std::bad_alloc();
+    for (int i = oldMatrixCount; i < kMatrixCount; i++) {
+        gTransitionMatrices[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+        if (gTransitionMatrices[i] == NULL)
+            throw std::bad_alloc();
+    }
+
+    gPatternWeights = (double*) realloc(gPatternWeights, sizeof(double) * kPatternCount);
+    if (gPatternWeights == NULL)
+        throw std::bad_alloc();
+    for (int k = oldPatternCount; k < kPatternCount; k++)
+        gPatternWeights[k] = 1.0;
+
+    free(integrationTmp);
+    free(firstDerivTmp);
+    free(secondDerivTmp);
+    free(outLogLikelihoodsTmp);
+    free(outFirstDerivativesTmp);
+    free(outSecondDerivativesTmp);
+    free(gRootPartialsScratch);
+    gRootPartialsScratch = NULL;
+    integrationTmp = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPatternCount * kStateCount);
+    firstDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
+    secondDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
+    outLogLikelihoodsTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
+    outFirstDerivativesTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
+    outSecondDerivativesTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
+    if (integrationTmp == NULL || firstDerivTmp == NULL || secondDerivTmp == NULL ||
+        outLogLikelihoodsTmp == NULL || outFirstDerivativesTmp == NULL || outSecondDerivativesTmp == NULL)
+        throw std::bad_alloc();
+
+    free(zeros);
+    free(ones);
+    zeros = (REALTYPE*) malloc(sizeof(REALTYPE) * kPaddedPatternCount);
+    ones = (REALTYPE*) malloc(sizeof(REALTYPE) * kPaddedPatternCount);
+    if (zeros == NULL || ones == NULL)
+        throw std::bad_alloc();
+    for (int i = 0; i < kPaddedPatternCount; i++) {
+        zeros[i] = 0.0;
+        ones[i] = 1.0;
+    }
+
+    // what was derived per buffer is found again, and every buffer is updated the next time
+    setSiteRepeats(kSiteRepeats);
+    setGapPatternSkipping(kGapPatternSkipping);
+    if (gMatrixCache != NULL && kMatrixCount != oldMatrixCount) {
+        delete gMatrixCache;
+        gMatrixCache = new TransitionMatrixCache(kMatrixCount);
+    }
+    if (gBufferVersions != NULL) {
+        delete gBufferVersions;
+        gBufferVersions = new BufferVersions(kBufferCount, kMatrixCount, kScaleBufferCount);
+    }
+
+    if (autoPartitioned)
+        autoPartitionPatterns(autoPartitionCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::saveState(const char* fileName) {
+    // auto scaling keeps its factors as exponents of whole buffers at a time
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL)
+        return BEAGLE_ERROR_GENERAL;
+    setvbuf(file, NULL, _IOFBF, BEAGLE_CPU_STATE_BUFFER_SIZE);
+
+    const int header[] = { BEAGLE_CPU_STATE_VERSION, (int) sizeof(REALTYPE), kTipCount, kBufferCount,
+                           kStateCount, kPatternCount, kCategoryCount, kMatrixCount, kScaleBufferCount,
+                           kEigenDecompCount, (kFlags & BEAGLE_FLAG_SCALERS_LOG ? 1 : 0),
+                           (kPatternsReordered ? 1 : 0) };
+    const int headerLength = sizeof(header) / sizeof(int);
+    bool written = (fwrite(BEAGLE_CPU_STATE_MAGIC, 1, 8, file) == 8 &&
+                    fwrite(header, sizeof(int), headerLength, file) == (size_t) headerLength);
+    if (written && kPatternsReordered)
+        written = (fwrite(gPatternsNewOrder, sizeof(int), kPatternCount, file) == (size_t) kPatternCount);
+
+    written = written && writeStateSection(file, STATE_PATTERN_WEIGHTS, 0, gPatternWeights, kPatternCount);
+    for (int i = 0; i < kEigenDecompCount && written; i++) {
+        if (gCategoryRates[i] != NULL)
+            written = writeStateSection(file, STATE_CATEGORY_RATES, i, gCategoryRates[i], kCategoryCount);
+        if (written && gCategoryWeights[i] != NULL)
+            written = writeStateSection(file, STATE_CATEGORY_WEIGHTS, i, gCategoryWeights[i], kCategoryCount);
+        if (written && gStateFrequencies[i] != NULL)
+            written = writeStateSection(file, STATE_STATE_FREQUENCIES, i, gStateFrequencies[i], kStateCount);
+    }
+
+    // partials and matrices are saved without the padding of this implementation, so that
+    // any other may load them
+    std::vector<REALTYPE> values(std::max(kPartialsSize, kMatrixSize * kCategoryCount) + 1);
+    for (int i = 0; i < kBufferCount && written; i++) {
+        if (i < kTipCount && hasTipStates(i)) {
+            written = writeStateSection(file, STATE_TIP_STATES, i, getTipStates(i), kPatternCount);
+            continue;
+        }
+        if (restorePartials(&i, 1) != BEAGLE_SUCCESS) {
+            written = false;
+            break;
+        }
+        const REALTYPE* partials = gPartials[i];
+        if (partials == NULL || isUnwrittenBuffer(partials))
+            continue;
+        REALTYPE* valuesPtr = &values[0];
+        for (int l = 0; l < kCategoryCount; l++) {
+            for (int k = 0; k < kPatternCount; k++) {
+                memcpy(valuesPtr, partials, sizeof(REALTYPE) * kStateCount);
+                valuesPtr += kStateCount;
+                partials += kPartialsPaddedStateCount;
+            }
+            partials += (kPaddedPatternCount - kPatternCount) * kPartialsPaddedStateCount;
+        }
+        written = writeStateSection(file, STATE_PARTIALS, i, &values[0],
+                                    kCategoryCount * kPatternCount * kStateCount);
+    }
+
+    // the value of the padding column, for ambiguous states, follows each matrix
+    for (int i = 0; i < kMatrixCount && written; i++) {
+        const REALTYPE* matrix = gTransitionMatrices[i];
+        if (matrix == NULL)
+            continue;
+        REALTYPE* valuesPtr = &values[0];
+        for (int j = 0; j < kCategoryCount * kStateCount; j++) {
+            memcpy(valuesPtr, matrix, sizeof(REALTYPE) * kStateCount);
+            valuesPtr += kStateCount;
+            matrix += kTransPaddedStateCount;
+        }
+        *valuesPtr = (T_PAD != 0 ? gTransitionMatrices[i][kStateCount] : REALTYPE(1.0));
+        written = writeStateSection(file, STATE_TRANSITION_MATRIX, i, &values[0],
+                                    kCategoryCount * kStateCount * kStateCount + 1);
+    }
+
+    for (int i = 0; i < kScaleBufferCount && written; i++) {
+        if (gScaleBuffers[i] == NULL || isUnwrittenBuffer(gScaleBuffers[i]) || !isScaleBufferWritten(i))
+            continue;
+        if (kMixedPrecision)
+            written = writeStateSection(file, STATE_SCALE_BUFFER, i, &gMixedScaleBuffers[i][0],
+                                        kPatternCount);
+        else
+            written = writeStateSection(file, STATE_SCALE_BUFFER, i, gScaleBuffers[i], kPatternCount);
+    }
+
+    const int end[] = { STATE_END, 0, 0, 0 };
+    written = written && (fwrite(end, sizeof(int), 4, file) == 4);
+    if (fclose(file) != 0)
+        written = false;
+
+    return (written ? BEAGLE_SUCCESS : BEAGLE_ERROR_GENERAL);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::loadState(const char* fileName) {
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL)
+        return BEAGLE_ERROR_GENERAL;
+    setvbuf(file, NULL, _IOFBF, BEAGLE_CPU_STATE_BUFFER_SIZE);
+
+    char magic[8];
+    int header[12];
+    const int headerLength = sizeof(header) / sizeof(int);
+    if (fread(magic, 1, 8, file) != 8 || memcmp(magic, BEAGLE_CPU_STATE_MAGIC, 8) != 0 ||
+        fread(header, sizeof(int), headerLength, file) != (size_t) headerLength ||
+        header[0] != BEAGLE_CPU_STATE_VERSION) {
+        fclose(file);
+        return BEAGLE_ERROR_GENERAL;
+    }
+
+    // the precision may differ, everything else must be as the instance was created
+    const int dimensions[] = { kTipCount, kBufferCount, kStateCount, kPatternCount, kCategoryCount,
+                               kMatrixCount, kScaleBufferCount, kEigenDecompCount,
+                               (kFlags & BEAGLE_FLAG_SCALERS_LOG ? 1 : 0), (kPatternsReordered ? 1 : 0) };
+    bool matches = true;
+    for (int i = 0; i < headerLength - 2; i++)
+        matches = matches && (header[i + 2] == dimensions[i]);
+    if (matches && kPatternsReordered) {
+        std::vector<int> order(kPatternCount);
+        matches = (fread(&order[0], sizeof(int), kPatternCount, file) == (size_t) kPatternCount &&
+                   memcmp(&order[0], gPatternsNewOrder, sizeof(int) * kPatternCount) == 0);
+    }
+    if (!matches) {
+        fclose(file);
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    int returnCode = BEAGLE_SUCCESS;
+    std::vector<double> values;
+    std::vector<int> states;
+    while (returnCode == BEAGLE_SUCCESS) {
+        int section[4];
+        if (fread(section, sizeof(int), 4, file) != 4) {
+            returnCode = BEAGLE_ERROR_GENERAL;
+            break;
+        }
+        const int tag = section[0];
+        const int index = section[1];
+        const int count = section[2];
+        const int valueSize = section[3];
+        if (tag == STATE_END)
+            break;
+
+        if (tag == STATE_TIP_STATES) {
+            if (index < 0 || index >= kTipCount || count != kPatternCount || valueSize != sizeof(int)) {
+                returnCode = BEAGLE_ERROR_GENERAL;
+                break;
+            }
+            states.resize(count);
+            if (fread(&states[0], sizeof(int), count, file) != (size_t) count) {
+                returnCode = BEAGLE_ERROR_GENERAL;
+                break;
+            }
+            clearTipStates(index);
+            returnCode = setTipStates(index, &states[0]);
+            continue;
+        }
+
+        if (!readStateValues(file, valueSize, count, values)) {
+            returnCode = BEAGLE_ERROR_GENERAL;
+            break;
+        }
+        switch (tag) {
+            case STATE_PATTERN_WEIGHTS:
+                returnCode = (count == kPatternCount ? setPatternWeights(&values[0]) : BEAGLE_ERROR_GENERAL);
+                break;
+            case STATE_CATEGORY_RATES:
+                returnCode = (count == kCategoryCount ?
+                              setCategoryRatesWithIndex(index, &values[0]) : BEAGLE_ERROR_GENERAL);
+                break;
+            case STATE_CATEGORY_WEIGHTS:
+                returnCode = (count == kCategoryCount ?
+                              setCategoryWeights(index, &values[0]) : BEAGLE_ERROR_GENERAL);
+                break;
+            case STATE_STATE_FREQUENCIES:
+                returnCode = (count == kStateCount ?
+                              setStateFrequencies(index, &values[0]) : BEAGLE_ERROR_GENERAL);
+                break;
+            case STATE_PARTIALS:
+                if (count != kCategoryCount * kPatternCount * kStateCount) {
+                    returnCode = BEAGLE_ERROR_GENERAL;
+                    break;
+                }
+                if (index >= 0 && index < kTipCount)
+                    clearTipStates(index);
+                returnCode = setPartials(index, &values[0]);
+                if (returnCode == BEAGLE_SUCCESS && index < kTipCount && kGapPatternSkipping)
+                    findTipGapPatterns(index);
+                break;
+            case STATE_TRANSITION_MATRIX:
+                if (index < 0 || index >= kMatrixCount || count != kCategoryCount * kStateCount * kStateCount + 1) {
+                    returnCode = BEAGLE_ERROR_GENERAL;
+                    break;
+                }
+                returnCode = setTransitionMatrix(index, &values[0], values[count - 1]);
+                break;
+            case STATE_SCALE_BUFFER:
+                if (index < 0 || index >= kScaleBufferCount || count != kPatternCount) {
+                    returnCode = BEAGLE_ERROR_GENERAL;
+                    break;
+                }
+                commitScaleBuffer(index);
+                for (int k = 0; k < kPatternCount; k++)
+                    gScaleBuffers[index][k] = (REALTYPE) values[k];
+                if (kMixedPrecision)
+                    std::copy(values.begin(), values.begin() + kPatternCount,
+                              gMixedScaleBuffers[index].begin());
+                setScaleBufferWritten(index, true);
+                if (gBufferVersions != NULL)
+                    gBufferVersions->touchScaleBuffer(index);
+                break;
+            default:
+                returnCode = BEAGLE_ERROR_GENERAL;
+        }
+    }
+
+    fclose(file);
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+template<typename T>
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::writeStateSection(FILE* file,
+                                                          int tag,
+                                                          int index,
+                                                          const T* values,
+                                                          int count) {
+    const int section[] = { tag, index, count, (int) sizeof(T) };
+    return (fwrite(section, sizeof(int), 4, file) == 4 &&
+            fwrite(values, sizeof(T), count, file) == (size_t) count);
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::readStateValues(FILE* file,
+                                                        int valueSize,
+                                                        int count,
+                                                        std::vector<double>& values) {
+    if (count < 1)
+        return false;
+    values.resize(count);
+    if (valueSize == sizeof(double))
+        return (fread(&values[0], sizeof(double), count, file) == (size_t) count);
+    if (valueSize != sizeof(float))
+        return false;
+
+    // saved by a single precision instance
+    std::vector<float> floatValues(count);
+    if (fread(&floatValues[0], sizeof(float), count, file) != (size_t) count)
+        return false;
+    for (int i = 0; i < count; i++)
+        values[i] = floatValues[i];
+    return true;
+}
+
+/*
+ * Re-scales the partial likelihoods such that the largest is one.
+ */
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
+        REALTYPE* scaleFactors,
+        REALTYPE* cumulativeScaleFactors,
+        const int  fillWithOnes) {
+    if (DEBUGGING_OUTPUT) {
+        std::cerr << "destP (before rescale): \n";// << destP << "\n";
+        for(int i=0; i<kPartialsSize; i++)
+            fprintf(stderr,"destP[%d] = %.5f\n",i,destP[i]);
+    }
+
+    // TODO None of the code below has been optimized.
+    bool rescaled = false;
+    for (int k = 0; k < kPatternCount; k++) {
+        REALTYPE max = 0;
+        const int patternOffset = k * kPartialsPaddedStateCount;
+        for (int l = 0; l < kCategoryCount; l++) {
+            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            for (int i = 0; i < kStateCount; i++) {
+                if(destP[offset] > max)
+                    max = destP[offset];
+                offset++;
+            }
+        }
+        
+        if (max == 0)
+            max = 1.0;
+            
+        REALTYPE oneOverMax = setPatternScaleFactor(max, k, scaleFactors, cumulativeScaleFactors);
+        if (oneOverMax == REALTYPE(1.0))
+            continue;
+        rescaled = true;
+        for (int l = 0; l < kCategoryCount; l++) {
+            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            for (int i = 0; i < kStateCount; i++)
+                destP[offset++] *= oneOverMax;
+        }
+    }
+    if (DEBUGGING_OUTPUT) {
+        for(int i=0; i<kPatternCount; i++)
+            fprintf(stderr,"new scaleFactor[%d] = %.5f\n",i,scaleFactors[i]);
+    }
+    return rescaled;
+}
+    
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(REALTYPE* destP,
+                                                                   REALTYPE* scaleFactors,
+                                                                   REALTYPE* cumulativeScaleFactors,
+                                                                   const int fillWithOnes,
+                                                                   const int partitionIndex) {
+    rescalePartialsRange(destP, scaleFactors, cumulativeScaleFactors,
+                         gPatternPartitionsStartPatterns[partitionIndex],
+                         gPatternPartitionsStartPatterns[partitionIndex + 1]);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartialsRange(REALTYPE* destP,
+                                                             REALTYPE* scaleFactors,
+                                                             REALTYPE* cumulativeScaleFactors,
+                                                             int startPattern,
+                                                             int endPattern) {
+    // TODO None of the code below has been optimized.
+    for (int k = startPattern; k < endPattern; k++) {
+        REALTYPE max = 0;
+        const int patternOffset = k * kPartialsPaddedStateCount;
+        for (int l = 0; l < kCategoryCount; l++) {
+            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            for (int i = 0; i < kStateCount; i++) {
+                if(destP[offset] > max)
+                    max = destP[offset];
+                offset++;
+            }
+        }
+        
+        if (max == 0)
+            max = 1.0;
+            
+        REALTYPE oneOverMax = setPatternScaleFactor(max, k, scaleFactors, cumulativeScaleFactors);
+        for (int l = 0; l < kCategoryCount; l++) {
+            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            for (int i = 0; i < kStateCount; i++)
+                destP[offset++] *= oneOverMax;
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+REALTYPE BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternScaleFactor(REALTYPE max,
+                                                                   int k,
+                                                                   REALTYPE* scaleFactors,
+                                                                   REALTYPE* cumulativeScaleFactors) {
+    if (kScalingThreshold > 0.0 && max >= kScalingThreshold) {
+        scaleFactors[k] = (kFlags & BEAGLE_FLAG_SCALERS_LOG ? 0.0 : 1.0);
+        return REALTYPE(1.0);
+    }
+
+    if (kPowerOfTwoScaling) {
+        // max = m * 2^exponent with m in [0.5, 1); the largest partial becomes 2m
+        int exponent;
+        frexp(max, &exponent);
+        exponent -= 1;
+        if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+            scaleFactors[k] = exponent * M_LN2;
+        else
+            scaleFactors[k] = ldexp(1.0, exponent);
+        if( cumulativeScaleFactors != NULL )
+            cumulativeScaleFactors[k] += exponent * M_LN2;
+        return (REALTYPE) ldexp(1.0, -exponent);
+    }
 
+    if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+        REALTYPE logMax = log(max);
+        scaleFactors[k] = logMax;
+        if( cumulativeScaleFactors != NULL )
+            cumulativeScaleFactors[k] += logMax;
+    } else {
+        scaleFactors[k] = max;
+        if( cumulativeScaleFactors != NULL )
+            cumulativeScaleFactors[k] += log(max);
+    }
+    return REALTYPE(1.0) / max;
+}
 
-            
-            if (subsetIndex == 0) {
-                outLogLikelihoodsTmp[k] = sumOverI;
-            } else if (subsetIndex == count - 1) {
-                REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sumOverI;
-                
-                outLogLikelihoodsTmp[k] = log(tmpSum);
-            } else {
-                outLogLikelihoodsTmp[k] += sumOverI;
-            }
-                        
-        }        
-        
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::isScaleBufferWritten(int scalingIndex) {
+    return kScalingThreshold == 0.0 || gScaleBufferWritten[scalingIndex];
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setScaleBufferWritten(int scalingIndex,
+                                                              bool written) {
+    if (kScalingThreshold > 0.0)
+        gScaleBufferWritten[scalingIndex] = written;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateMixedScaleFactors(int scalingIndex,
+                                                                    int cumulativeScalingIndex,
+                                                                    int sign,
+                                                                    int startPattern,
+                                                                    int endPattern) {
+    if (!kMixedPrecision || cumulativeScalingIndex < 0 || !isScaleBufferWritten(scalingIndex))
+        return;
+    const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndex];
+    double* cumulativeScaleBuffer = &gMixedScaleBuffers[cumulativeScalingIndex][0];
+    for (int j = startPattern; j < endPattern; j++) {
+        if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+            cumulativeScaleBuffer[j] += sign * (double) scaleBuffer[j];
+        else
+            cumulativeScaleBuffer[j] += sign * log((double) scaleBuffer[j]);
     }
-    
-    if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
-        for(int i=0; i<kPatternCount; i++)
-            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
+}
+
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumSiteLogLikelihoods(int scalingFactorsIndex,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+    double sumLogLikelihood = 0.0;
+    for (int k = startPattern; k < endPattern; k++) {
+        double siteLogLikelihood = completeSiteLogLikelihood(outLogLikelihoodsTmp[k],
+                                                             scalingFactorsIndex, k);
+        if (kMixedPrecision)
+            gMixedLogLikelihoods[k] = siteLogLikelihood;
+        else
+            outLogLikelihoodsTmp[k] = siteLogLikelihood;
+        sumLogLikelihood += siteLogLikelihood * gPatternWeights[k];
     }
-    
+    return sumLogLikelihood;
+}
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleExponents(const int* scalingIndices,
+                                                                 int count,
+                                                                 REALTYPE* cumulativeScaleBuffer,
+                                                                 int sign,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+    std::vector<int> exponents(endPattern - startPattern, 0);
+    for (int i = 0; i < count; i++) {
+        if (!isScaleBufferWritten(scalingIndices[i]))
+            continue;
+        const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
+        for (int j = startPattern; j < endPattern; j++)
+            exponents[j - startPattern] += ilogb(scaleBuffer[j]);
     }
+    for (int j = startPattern; j < endPattern; j++)
+        cumulativeScaleBuffer[j] += sign * M_LN2 * exponents[j - startPattern];
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
+                                              signed short* scaleFactors) {
     
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
     
-    return returnCode;
+    for (int k = 0; k < kPatternCount; k++) {
+        REALTYPE max = 0;
+        const int patternOffset = k * kPartialsPaddedStateCount;
+        for (int l = 0; l < kCategoryCount; l++) {
+            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            for (int i = 0; i < kStateCount; i++) {
+                if(destP[offset] > max)
+                    max = destP[offset];
+                offset++;
+            }
+        }
+        
+        int expMax;
+        frexp(max, &expMax);
+        scaleFactors[k] = expMax;
+        
+        if (expMax != 0) {
+            for (int l = 0; l < kCategoryCount; l++) {
+                int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+                for (int i = 0; i < kStateCount; i++)
+                    destP[offset++] *= pow(2.0, -expMax);
+            }
+        }
+    }
 }
 
-    
+///////////////////////////////////////////////////////////////////////////////
+// private methods
+
+
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const int parIndex,
-                                                               const int childIndex,
-                                                               const int probIndex,
-                                                               const int firstDerivativeIndex,
-                                                               const int categoryWeightsIndex,
-                                                               const int stateFrequenciesIndex,
-                                                               const int scalingFactorsIndex,
-                                                               double* outSumLogLikelihood,
-                                                               double* outSumFirstDerivative) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
 
-    assert(parIndex >= kTipCount);
+    if (!kPatternsReordered) {
+        gPatternsNewOrder = (int*) malloc(kPatternCount * sizeof(int));
+        if (gPatternsNewOrder == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        for (int i=0; i < kPatternCount; i++)
+            gPatternsNewOrder[i] = i;
+    }
 
-    int returnCode = BEAGLE_SUCCESS;
+    // the pattern stored at k moves to moves[k], keeping the stored order within each
+    // partition, so that patterns of partitions whose extent is unchanged stay in place
+    std::vector<int> moves(kPatternCount);
+    std::vector<int> partitionSizes(kPartitionCount, 0);
+    for (int k=0; k < kPatternCount; k++)
+        moves[k] = partitionSizes[gPatternPartitions[k]]++;
+
+    gPatternPartitionsStartPatterns[0] = 0;
+    for (int i=0; i < kPartitionCount; i++)
+        gPatternPartitionsStartPatterns[i+1] = gPatternPartitionsStartPatterns[i] + partitionSizes[i];
+
+    int firstMoved = kPatternCount;
+    int lastMoved = -1;
+    for (int k=0; k < kPatternCount; k++) {
+        moves[k] += gPatternPartitionsStartPatterns[gPatternPartitions[k]];
+        if (moves[k] != k) {
+            firstMoved = std::min(firstMoved, k);
+            lastMoved = k;
+        }
+    }
 
-    const REALTYPE* partialsParent = gPartials[parIndex];
-    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
-    const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    int currentPattern = 0;
+    for (int i=0; i < kPartitionCount; i++) {
+        for (int j=0; j < partitionSizes[i]; j++) {
+            gPatternPartitions[currentPattern++] = i;
+        }
+    }
 
+    for (int i=0; i < kPatternCount; i++)
+        gPatternsNewOrder[i] = moves[gPatternsNewOrder[i]];
 
-    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-    memset(firstDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
+    kPatternsReordered = true;
 
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+    // the permutation keeps the patterns outside [firstMoved, lastMoved]
+    if (lastMoved < 0)
+        return BEAGLE_SUCCESS;
+    const int movedCount = lastMoved - firstMoved + 1;
+
+    std::vector<double> sortedPatternWeights(gPatternWeights + firstMoved, gPatternWeights + lastMoved + 1);
+    for (int k=firstMoved; k <= lastMoved; k++)
+        gPatternWeights[moves[k]] = sortedPatternWeights[k - firstMoved];
+
+    // each tip is permuted in place through a copy of its moved range
+    auto reorderTips = [=, &moves] (int beginTip, int endTip) {
+        std::vector<REALTYPE> partials;
+        std::vector<int> states;
+        for (int tip = beginTip; tip < endTip; tip++) {
+            if (!hasTipStates(tip)) {
+                REALTYPE* tipPartials = gPartials[tip];
+                if (tipPartials == NULL)
+                    continue;
+                for (int l=0; l < kCategoryCount; l++) {
+                    REALTYPE* categoryPartials = tipPartials + l*kPaddedPatternCount*kPartialsPaddedStateCount;
+                    partials.assign(categoryPartials + firstMoved*kPartialsPaddedStateCount,
+                                    categoryPartials + (lastMoved+1)*kPartialsPaddedStateCount);
+                    for (int k=firstMoved; k <= lastMoved; k++) {
+                        memcpy(categoryPartials + moves[k]*kPartialsPaddedStateCount,
+                               &partials[(k - firstMoved)*kPartialsPaddedStateCount],
+                               sizeof(REALTYPE) * kPartialsPaddedStateCount);
+                    }
+                }
+            } else if (kPackedTipStates) {
+                const int* tipStates = getTipStates(tip);
+                states.assign(tipStates, tipStates + kPatternCount);
+                for (int k=firstMoved; k <= lastMoved; k++)
+                    states[moves[k]] = tipStates[k];
+                packTipStates(tip, &states[0], kPatternCount);
+            } else {
+                int* tipStates = gTipStates[tip];
+                states.assign(tipStates + firstMoved, tipStates + lastMoved + 1);
+                for (int k=firstMoved; k <= lastMoved; k++)
+                    tipStates[moves[k]] = states[k - firstMoved];
+            }
+        }
+    };
 
-        const int* statesChild = gTipStates[childIndex];
-        int v = 0; // Index for parent partials
+    double work = (double) kTipCount * movedCount * kCategoryCount * kPartialsPaddedStateCount;
+    if (!(kFlags & BEAGLE_FLAG_THREADING_CPP) || kTipCount < 2 || work < BEAGLE_CPU_REORDER_PARALLEL_MIN_WORK) {
+        reorderTips(0, kTipCount);
+    } else {
+        ThreadPool* pool = getThreadPool();
+        int jobCount = pool->getThreadCount();
+        if (jobCount > kTipCount)
+            jobCount = kTipCount;
+
+        ThreadPoolTaskGroup group;
+        for (int j = 0; j < jobCount; j++) {
+            int begin = (kTipCount * j) / jobCount;
+            int end = (kTipCount * (j + 1)) / jobCount;
+            pool->submit(group, [=] () { reorderTips(begin, end); }, j);
+        }
+        group.wait();
+    }
 
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0; // Index in resulting product-partials (summed over categories)
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
+    return BEAGLE_SUCCESS;
+}
 
-                const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-                // so we can interchange the patterCount and categoryCount loop order?
-                int w =  l * kMatrixSize;
-                for(int i = 0; i < kStateCount; i++) {
-                    integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                    firstDerivTmp[u] += firstDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                    u++;
 
-                    w += kTransPaddedStateCount;
+/*
+ * Calculates partial likelihoods at a node when both children have states.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
+                                                         const int* states1,
+                                                         const REALTYPE* matrices1,
+                                                         const int* states2,
+                                                         const REALTYPE* matrices2,
+                                                         int startPattern,
+                                                         int endPattern) {
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        for (int k = startPattern; k < endPattern; k++) {
+            const int state1 = states1[k];
+            const int state2 = states2[k];
+            if (DEBUGGING_OUTPUT) {
+                std::cerr << "calcStatesStates s1 = " << state1 << '\n';
+                std::cerr << "calcStatesStates s2 = " << state2 << '\n';
+            }
+            int w = l * kMatrixSize;
+            for (int i = 0; i < kStateCount; i++) {
+                destP[v] = matrices1[w + state1] * matrices2[w + state2];
+                v++;
+
+                w += kTransPaddedStateCount;
+            }
+            if (P_PAD) {
+                for (int pad = 0; pad < P_PAD; pad++)  {
+                    destP[v] = 0.0;
+                    v++;
                 }
-                v += kPartialsPaddedStateCount;
             }
         }
+    }
+}
 
-    } else { // Integrate against a partial at the child
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
+                                                                     const int* child1States,
+                                                                     const REALTYPE* child1TransMat,
+                                                                     const int* child2States,
+                                                                     const REALTYPE* child2TransMat,
+                                                                     const REALTYPE* scaleFactors,
+                                                                     int startPattern,
+                                                                     int endPattern) {
 
-        const REALTYPE* partialsChild = gPartials[childIndex];
-        int v = 0;
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+    int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        for (int k = startPattern; k < endPattern; k++) {
+            const int state1 = child1States[k];
+            const int state2 = child2States[k];
+            int w = l * kMatrixSize;
+            REALTYPE scaleFactor = scaleFactors[k];
+            for (int i = 0; i < kStateCount; i++) {
+                destP[v] = child1TransMat[w + state1] *
+                           child2TransMat[w + state2] / scaleFactor;
+                v++;
 
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0;
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
-                int w = l * kMatrixSize;
-                for(int i = 0; i < kStateCount; i++) {
-                    double sumOverJ = 0.0;
-                    double sumOverJD1 = 0.0;
-                    for(int j = 0; j < kStateCount; j++) {
-                        sumOverJ += transMatrix[w] * partialsChild[v + j];
-                        sumOverJD1 += firstDerivMatrix[w] * partialsChild[v + j];
-                        w++;
-                    }
+                w += kTransPaddedStateCount;
+            }
+            if (P_PAD) {
+                for (int pad = 0; pad < P_PAD; pad++)  {
+                    destP[v] = 0.0;
+                    v++;
+                }
+            }
+        }
+    }
+}
 
-                    // increment for the extra column at the end
-                    w += T_PAD;
+/*
+ * Calculates partial likelihoods at a node when one child has states and one has partials.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
+                                                           const int* states1,
+                                                           const REALTYPE* matrices1,
+                                                           const REALTYPE* partials2,
+                                                           const REALTYPE* matrices2,
+                                                           int startPattern,
+                                                           int endPattern) {
 
-                    integrationTmp[u] += sumOverJ * partialsParent[v + i] * weight;
-                    firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
-                    u++;
+    int matrixIncr = kStateCount;
+
+    // increment for the extra column at the end
+    matrixIncr += T_PAD;
+
+
+    int stateCountModFour = (kStateCount / 4) * 4;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int matrixOffset = l*kMatrixSize;
+        const REALTYPE* partials2Ptr = &partials2[v];
+        REALTYPE* destPtr = &destP[v];
+        for (int k = startPattern; k < endPattern; k++) {
+            int w = l * kMatrixSize;
+            int state1 = states1[k];
+            for (int i = 0; i < kStateCount; i++) {
+                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+                REALTYPE tmp = matrices1[w + state1];
+                REALTYPE sumA = 0.0;
+                REALTYPE sumB = 0.0;                
+                int j = 0;
+                for (; j < stateCountModFour; j += 4) {
+                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];                  
+                    sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+                    sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];                  
+                    sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                  
                 }
-                v += kPartialsPaddedStateCount;
+                for (; j < kStateCount; j++) {
+                    sumA += matrices2Ptr[j] * partials2Ptr[j];                  
+                }               
+                
+                w += matrixIncr;
+                
+                *(destPtr++) = tmp * (sumA + sumB);
             }
+            if (P_PAD) {
+                for (int pad = 0; pad < P_PAD; pad++)  {
+                    *(destPtr++) = 0.0;
+                }
+            }
+            partials2Ptr += kPartialsPaddedStateCount;
         }
     }
+}
 
-    int u = 0;
-    for(int k = 0; k < kPatternCount; k++) {
-        REALTYPE sumOverI = 0.0;
-        REALTYPE sumOverID1 = 0.0;
-        for(int i = 0; i < kStateCount; i++) {
-            sumOverI += freqs[i] * integrationTmp[u];
-            sumOverID1 += freqs[i] * firstDerivTmp[u];
-            u++;
-        }
-
-        outLogLikelihoodsTmp[k] = log(sumOverI);
-        outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
-    }
-
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsInterleaved(REALTYPE* destP,
+                                                                const int* states1,
+                                                                const REALTYPE* partials1,
+                                                                const REALTYPE* matrices1,
+                                                                const REALTYPE* partials2,
+                                                                const REALTYPE* matrices2,
+                                                                int startPattern,
+                                                                int endPattern) {
+    const int lanes = BEAGLE_CPU_INTERLEAVED_PATTERNS;
+    const int matrixIncr = kStateCount + T_PAD;
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-    }
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        // child partials of the current group, element [j * lanes + p] holding state j of
+        // pattern p, and the sums for each child, element [i * lanes + p] for state i of the
+        // parent; lanes past the end of the range are zero and their results dropped
+        std::vector<REALTYPE> interleaved1(states1 == NULL ? kStateCount * lanes : 0);
+        std::vector<REALTYPE> interleaved2(kStateCount * lanes);
+        std::vector<REALTYPE> sums1(kStateCount * lanes);
+        std::vector<REALTYPE> sums2(kStateCount * lanes);
+        const int v = l*kPartialsPaddedStateCount*kPatternCount;
+        const REALTYPE* categoryMatrices1 = matrices1 + l*kMatrixSize;
+        const REALTYPE* categoryMatrices2 = matrices2 + l*kMatrixSize;
+
+        for (int k = startPattern; k < endPattern; k += lanes) {
+            const int width = std::min(lanes, endPattern - k);
+
+            for (int p = 0; p < lanes; p++) {
+                const int u = v + (k + p)*kPartialsPaddedStateCount;
+                for (int j = 0; j < kStateCount; j++) {
+                    if (states1 == NULL)
+                        interleaved1[j * lanes + p] = (p < width ? partials1[u + j] : 0.0);
+                    interleaved2[j * lanes + p] = (p < width ? partials2[u + j] : 0.0);
+                }
+            }
 
-    *outSumLogLikelihood = 0.0;
-    *outSumFirstDerivative = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+            // The innermost loops run across the lanes with matrix entries held fixed, so
+            // that they vectorize at full width
+            REALTYPE* sums1Ptr = &sums1[0];
+            REALTYPE* sums2Ptr = &sums2[0];
+            const REALTYPE* interleaved1Ptr = &interleaved1[0];
+            const REALTYPE* interleaved2Ptr = &interleaved2[0];
+            std::fill(sums2.begin(), sums2.end(), (REALTYPE) 0.0);
+            if (states1 != NULL) {
+                for (int i = 0; i < kStateCount; i++) {
+                    const REALTYPE* matrices1Ptr = categoryMatrices1 + i * matrixIncr;
+                    const REALTYPE* matrices2Ptr = categoryMatrices2 + i * matrixIncr;
+                    for (int p = 0; p < lanes; p++)
+                        sums1Ptr[i * lanes + p] = matrices1Ptr[p < width ? states1[k + p] : 0];
+                    int j = 0;
+                    for (; j < kStateCount - 1; j += 2) {
+                        const REALTYPE m2A = matrices2Ptr[j];
+                        const REALTYPE m2B = matrices2Ptr[j + 1];
+                        for (int p = 0; p < lanes; p++)
+                            sums2Ptr[i * lanes + p] += m2A * interleaved2Ptr[j * lanes + p] +
+                                                       m2B * interleaved2Ptr[(j + 1) * lanes + p];
+                    }
+                    for (; j < kStateCount; j++) {
+                        const REALTYPE m2 = matrices2Ptr[j];
+                        for (int p = 0; p < lanes; p++)
+                            sums2Ptr[i * lanes + p] += m2 * interleaved2Ptr[j * lanes + p];
+                    }
+                }
+            } else {
+                std::fill(sums1.begin(), sums1.end(), (REALTYPE) 0.0);
+                for (int i = 0; i < kStateCount; i++) {
+                    const REALTYPE* matrices1Ptr = categoryMatrices1 + i * matrixIncr;
+                    const REALTYPE* matrices2Ptr = categoryMatrices2 + i * matrixIncr;
+                    for (int j = 0; j < kStateCount; j++) {
+                        const REALTYPE m1 = matrices1Ptr[j];
+                        const REALTYPE m2 = matrices2Ptr[j];
+                        for (int p = 0; p < lanes; p++) {
+                            sums1Ptr[i * lanes + p] += m1 * interleaved1Ptr[j * lanes + p];
+                            sums2Ptr[i * lanes + p] += m2 * interleaved2Ptr[j * lanes + p];
+                        }
+                    }
+                }
+            }
 
-        *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
+            for (int p = 0; p < width; p++) {
+                REALTYPE* destPtr = destP + v + (k + p)*kPartialsPaddedStateCount;
+                for (int i = 0; i < kStateCount; i++)
+                    destPtr[i] = sums1Ptr[i * lanes + p] * sums2Ptr[i * lanes + p];
+                for (int i = kStateCount; i < kPartialsPaddedStateCount; i++)
+                    destPtr[i] = 0.0;
+            }
+        }
     }
-    
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-
-    return returnCode;
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const int parIndex,
-                                                                const int childIndex,
-                                                                const int probIndex,
-                                                                const int firstDerivativeIndex,
-                                                                const int secondDerivativeIndex,
-                                                                const int categoryWeightsIndex,
-                                                                const int stateFrequenciesIndex,
-                                                                const int scalingFactorsIndex,
-                                                                double* outSumLogLikelihood,
-                                                                double* outSumFirstDerivative,
-                                                                double* outSumSecondDerivative) {
-
-    assert(parIndex >= kTipCount);
-
-    int returnCode = BEAGLE_SUCCESS;
-
-    const REALTYPE* partialsParent = gPartials[parIndex];
-    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
-    const REALTYPE* firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
-    const REALTYPE* secondDerivMatrix = gTransitionMatrices[secondDerivativeIndex];
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
-
-
-    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-    memset(firstDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-    memset(secondDerivTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
+                                                                       const int* states1,
+                                                                       const REALTYPE* matrices1,
+                                                                       const REALTYPE* partials2,
+                                                                       const REALTYPE* matrices2,
+                                                                       const REALTYPE* scaleFactors,
+                                                                       int startPattern,
+                                                                       int endPattern) {
 
-        const int* statesChild = gTipStates[childIndex];
-        int v = 0; // Index for parent partials
+    int matrixIncr = kStateCount;
 
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0; // Index in resulting product-partials (summed over categories)
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
+    // increment for the extra column at the end
+    matrixIncr += T_PAD;
 
-                const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-                // so we can interchange the patterCount and categoryCount loop order?
-                int w =  l * kMatrixSize;
-                for(int i = 0; i < kStateCount; i++) {
-                    integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                    firstDerivTmp[u] += firstDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                    secondDerivTmp[u] += secondDerivMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                    u++;
+    int stateCountModFour = (kStateCount / 4) * 4;
 
-                    w += kTransPaddedStateCount;
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int matrixOffset = l*kMatrixSize;
+        const REALTYPE* partials2Ptr = &partials2[v];
+        REALTYPE* destPtr = &destP[v];
+        for (int k = startPattern; k < endPattern; k++) {
+            int w = l * kMatrixSize;
+            int state1 = states1[k];
+            REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+            for (int i = 0; i < kStateCount; i++) {
+                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+                REALTYPE tmp = matrices1[w + state1];
+                REALTYPE sumA = 0.0;
+                REALTYPE sumB = 0.0;                
+                int j = 0;
+                for (; j < stateCountModFour; j += 4) {
+                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];                  
+                    sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+                    sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];                  
+                    sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                  
+                }
+                for (; j < kStateCount; j++) {
+                    sumA += matrices2Ptr[j] * partials2Ptr[j];                  
+                }               
+                
+                w += matrixIncr;
+                
+                *(destPtr++) = tmp * (sumA + sumB) * oneOverScaleFactor;
+            }
+            if (P_PAD) {
+                for (int pad = 0; pad < P_PAD; pad++)  {
+                    *(destPtr++) = 0.0;
                 }
-                v += kPartialsPaddedStateCount;
             }
+            partials2Ptr += kPartialsPaddedStateCount;
         }
+    }                                            
+}
 
-    } else { // Integrate against a partial at the child
+/*
+ * Calculates partial likelihoods at a node when both children have partials.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
+                                                             const REALTYPE* partials1,
+                                                             const REALTYPE* matrices1,
+                                                             const REALTYPE* partials2,
+                                                             const REALTYPE* matrices2,
+                                                             int startPattern,
+                                                             int endPattern) {
+    int matrixIncr = kStateCount;
 
-        const REALTYPE* partialsChild = gPartials[childIndex];
-        int v = 0;
+    // increment for the extra column at the end
+    matrixIncr += T_PAD;
 
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0;
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
-                int w = l * kMatrixSize;
-                for(int i = 0; i < kStateCount; i++) {
-                    double sumOverJ = 0.0;
-                    double sumOverJD1 = 0.0;
-                    double sumOverJD2 = 0.0;
-                    for(int j = 0; j < kStateCount; j++) {
-                        sumOverJ += transMatrix[w] * partialsChild[v + j];
-                        sumOverJD1 += firstDerivMatrix[w] * partialsChild[v + j];
-                        sumOverJD2 += secondDerivMatrix[w] * partialsChild[v + j];
-                        w++;
-                    }
+    int stateCountModFour = (kStateCount / 4) * 4;
 
-                    // increment for the extra column at the end
-                    w += T_PAD;
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int matrixOffset = l*kMatrixSize;
+        const REALTYPE* partials1Ptr = &partials1[v];
+        const REALTYPE* partials2Ptr = &partials2[v];
+        REALTYPE* destPtr = &destP[v];
+        for (int k = startPattern; k < endPattern; k++) {
 
-                    integrationTmp[u] += sumOverJ * partialsParent[v + i] * weight;
-                    firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
-                    secondDerivTmp[u] += sumOverJD2 * partialsParent[v + i] * weight;
-                    u++;
+            for (int i = 0; i < kStateCount; i++) {
+                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
+                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+                REALTYPE sum1A = 0.0, sum2A = 0.0;
+                REALTYPE sum1B = 0.0, sum2B = 0.0;
+                int j = 0;
+                for (; j < stateCountModFour; j += 4) {
+                    sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
+                    sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+                    
+                    sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
+                    sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+
+                    sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
+                    sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+                    
+                    sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
+                    sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                                     
+                }               
+                
+                for (; j < kStateCount; j++) {
+                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
+                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
                 }
-                v += kPartialsPaddedStateCount;
+
+                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B);
             }
+            destPtr += P_PAD;
+            partials1Ptr += kPartialsPaddedStateCount;
+            partials2Ptr += kPartialsPaddedStateCount;
         }
     }
+}
 
-    int u = 0;
-    for(int k = 0; k < kPatternCount; k++) {
-        REALTYPE sumOverI = 0.0;
-        REALTYPE sumOverID1 = 0.0;
-        REALTYPE sumOverID2 = 0.0;
-        for(int i = 0; i < kStateCount; i++) {
-            sumOverI += freqs[i] * integrationTmp[u];
-            sumOverID1 += freqs[i] * firstDerivTmp[u];
-            sumOverID2 += freqs[i] * secondDerivTmp[u];
-            u++;
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsCategoryRange(REALTYPE* destP,
+                                                                  const int* states1,
+                                                                  const REALTYPE* partials1,
+                                                                  const REALTYPE* matrices1,
+                                                                  const int* states2,
+                                                                  const REALTYPE* partials2,
+                                                                  const REALTYPE* matrices2,
+                                                                  int startCategory,
+                                                                  int endCategory) {
+    // with the matrices of a category transposed, each partial of a child scales a contiguous
+    // column into the sums of all parent states, a loop that vectorizes without reassociation
+    std::vector<REALTYPE> scratch(2 * kStateCount * kStateCount + 2 * kStateCount);
+    REALTYPE* transposed1 = &scratch[0];
+    REALTYPE* transposed2 = transposed1 + kStateCount * kStateCount;
+    REALTYPE* sums1 = transposed2 + kStateCount * kStateCount;
+    REALTYPE* sums2 = sums1 + kStateCount;
+
+    for (int l = startCategory; l < endCategory; l++) {
+        const REALTYPE* categoryMatrices1 = matrices1 + l * kMatrixSize;
+        const REALTYPE* categoryMatrices2 = matrices2 + l * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            for (int j = 0; j < kStateCount; j++) {
+                transposed1[j * kStateCount + i] = categoryMatrices1[i * kTransPaddedStateCount + j];
+                transposed2[j * kStateCount + i] = categoryMatrices2[i * kTransPaddedStateCount + j];
+            }
+        }
+
+        int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i++) {
+                sums1[i] = 0.0;
+                sums2[i] = 0.0;
+            }
+            // the padding column of a row is one, for ambiguous states
+            if (states1 != NULL) {
+                for (int i = 0; i < kStateCount; i++)
+                    sums1[i] = categoryMatrices1[i * kTransPaddedStateCount + states1[k]];
+            } else {
+                for (int j = 0; j < kStateCount; j++) {
+                    const REALTYPE partial = partials1[v + j];
+                    const REALTYPE* column = transposed1 + j * kStateCount;
+                    for (int i = 0; i < kStateCount; i++)
+                        sums1[i] += column[i] * partial;
+                }
+            }
+            if (states2 != NULL) {
+                for (int i = 0; i < kStateCount; i++)
+                    sums2[i] = categoryMatrices2[i * kTransPaddedStateCount + states2[k]];
+            } else {
+                for (int j = 0; j < kStateCount; j++) {
+                    const REALTYPE partial = partials2[v + j];
+                    const REALTYPE* column = transposed2 + j * kStateCount;
+                    for (int i = 0; i < kStateCount; i++)
+                        sums2[i] += column[i] * partial;
+                }
+            }
+            for (int i = 0; i < kStateCount; i++)
+                destP[v + i] = sums1[i] * sums2[i];
+            for (int pad = 0; pad < P_PAD; pad++)
+                destP[v + kStateCount + pad] = 0.0;
+            v += kPartialsPaddedStateCount;
         }
-
-        outLogLikelihoodsTmp[k] = log(sumOverI);
-        outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
-        outSecondDerivativesTmp[k] = sumOverID2 / sumOverI - outFirstDerivativesTmp[k] * outFirstDerivativesTmp[k];
-    }
-
-
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
     }
+}
 
-    *outSumLogLikelihood = 0.0;
-    *outSumFirstDerivative = 0.0;
-    *outSumSecondDerivative = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-
-        *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsSkippingGaps(REALTYPE* destP,
+                                                                 const char* gaps,
+                                                                 const int* states1,
+                                                                 const REALTYPE* partials1,
+                                                                 const REALTYPE* matrices1,
+                                                                 const int* states2,
+                                                                 const REALTYPE* partials2,
+                                                                 const REALTYPE* matrices2,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+    int k = startPattern;
+    while (k < endPattern) {
+        int runEnd = k + 1;
+        while (runEnd < endPattern && gaps[runEnd] == gaps[k])
+            runEnd++;
+
+        if (gaps[k]) {
+            // the rows of the transition matrices sum to one
+            for (int l = 0; l < kCategoryCount; l++) {
+                REALTYPE* destPtr = destP + (l * kPaddedPatternCount + k) * kPartialsPaddedStateCount;
+                for (int pattern = k; pattern < runEnd; pattern++) {
+                    for (int i = 0; i < kStateCount; i++)
+                        *(destPtr++) = 1.0;
+                    for (int i = kStateCount; i < kPartialsPaddedStateCount; i++)
+                        *(destPtr++) = 0.0;
+                }
+            }
+        } else if (states1 != NULL && states2 != NULL) {
+            calcStatesStates(destP, states1, matrices1, states2, matrices2, k, runEnd);
+        } else if (states1 != NULL || states2 != NULL) {
+            const int* states = (states1 != NULL ? states1 : states2);
+            const REALTYPE* statesMatrices = (states1 != NULL ? matrices1 : matrices2);
+            const REALTYPE* partials = (states1 != NULL ? partials2 : partials1);
+            const REALTYPE* partialsMatrices = (states1 != NULL ? matrices2 : matrices1);
+            if (kInterleavedPatterns)
+                calcPartialsInterleaved(destP, states, NULL, statesMatrices, partials,
+                                        partialsMatrices, k, runEnd);
+            else
+                calcStatesPartials(destP, states, statesMatrices, partials, partialsMatrices,
+                                   k, runEnd);
+        } else {
+            if (kInterleavedPatterns)
+                calcPartialsInterleaved(destP, NULL, partials1, matrices1, partials2, matrices2,
+                                        k, runEnd);
+            else
+                calcPartialsPartials(destP, partials1, matrices1, partials2, matrices2, k, runEnd);
+        }
 
-        *outSumSecondDerivative += outSecondDerivativesTmp[i] * gPatternWeights[i];
+        k = runEnd;
     }
-
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsSiteRepeats(REALTYPE* destP,
+                                                                const int* classes,
+                                                                int classCount,
+                                                                const int* states1,
+                                                                const REALTYPE* partials1,
+                                                                const REALTYPE* matrices1,
+                                                                const int* states2,
+                                                                const REALTYPE* partials2,
+                                                                const REALTYPE* matrices2) {
+    int matrixIncr = kStateCount;
 
+    // increment for the extra column at the end
+    matrixIncr += T_PAD;
 
-BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::block(void) {
-    // Do nothing.
-    return BEAGLE_SUCCESS;
-}
+    int categoryIncr = kPaddedPatternCount * kPartialsPaddedStateCount;
 
-/*
- * Re-scales the partial likelihoods such that the largest is one.
- */
-BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
-        REALTYPE* scaleFactors,
-        REALTYPE* cumulativeScaleFactors,
-        const int  fillWithOnes) {
-    if (DEBUGGING_OUTPUT) {
-        std::cerr << "destP (before rescale): \n";// << destP << "\n";
-        for(int i=0; i<kPartialsSize; i++)
-            fprintf(stderr,"destP[%d] = %.5f\n",i,destP[i]);
+    std::vector<int> firstPatterns(classCount, -1);
+    for (int k = 0; k < kPatternCount; k++) {
+        if (firstPatterns[classes[k]] < 0)
+            firstPatterns[classes[k]] = k;
     }
 
-    // TODO None of the code below has been optimized.
-    for (int k = 0; k < kPatternCount; k++) {
-        REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
+    for (int l = 0; l < kCategoryCount; l++) {
+        int matrixOffset = l*kMatrixSize;
+        REALTYPE* destCategory = &destP[l*categoryIncr];
+        for (int k = 0; k < kPatternCount; k++) {
+            REALTYPE* destPtr = &destCategory[k*kPartialsPaddedStateCount];
+            int firstPattern = firstPatterns[classes[k]];
+            if (firstPattern != k) {
+                const REALTYPE* firstPtr = &destCategory[firstPattern*kPartialsPaddedStateCount];
+                for (int i = 0; i < kPartialsPaddedStateCount; i++)
+                    destPtr[i] = firstPtr[i];
+                continue;
             }
-        }
-        
-        if (max == 0)
-            max = 1.0;
-            
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++)
-                destP[offset++] *= oneOverMax;
-        }
 
-        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
+            int v = l*categoryIncr + k*kPartialsPaddedStateCount;
+            for (int i = 0; i < kStateCount; i++) {
+                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
+                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+                REALTYPE sum1 = 0.0;
+                REALTYPE sum2 = 0.0;
+                if (states1 != NULL) {
+                    sum1 = matrices1Ptr[states1[k]];
+                } else {
+                    for (int j = 0; j < kStateCount; j++)
+                        sum1 += matrices1Ptr[j] * partials1[v + j];
+                }
+                if (states2 != NULL) {
+                    sum2 = matrices2Ptr[states2[k]];
+                } else {
+                    for (int j = 0; j < kStateCount; j++)
+                        sum2 += matrices2Ptr[j] * partials2[v + j];
+                }
+                destPtr[i] = sum1 * sum2;
+            }
+            for (int pad = kStateCount; pad < kPartialsPaddedStateCount; pad++)
+                destPtr[pad] = 0.0;
         }
     }
-    if (DEBUGGING_OUTPUT) {
-        for(int i=0; i<kPatternCount; i++)
-            fprintf(stderr,"new scaleFactor[%d] = %.5f\n",i,scaleFactors[i]);
-    }
 }
-    
+
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(REALTYPE* destP,
-                                                                   REALTYPE* scaleFactors,
-                                                                   REALTYPE* cumulativeScaleFactors,
-                                                                   const int fillWithOnes,
-                                                                   const int partitionIndex) {
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYPE* destP,
+                                                                         const REALTYPE* partials1,
+                                                                         const REALTYPE* matrices1,
+                                                                         const REALTYPE* partials2,
+                                                                         const REALTYPE* matrices2,
+                                                                         const REALTYPE* scaleFactors,
+                                                                         int startPattern,
+                                                                         int endPattern) {
 
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+    int matrixIncr = kStateCount;
 
-    // TODO None of the code below has been optimized.
-    for (int k = startPattern; k < endPattern; k++) {
-        REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+    // increment for the extra column at the end
+    matrixIncr += T_PAD;
+
+    int stateCountModFour = (kStateCount / 4) * 4;
+    
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int matrixOffset = l*kMatrixSize;
+        const REALTYPE* partials1Ptr = &partials1[v];
+        const REALTYPE* partials2Ptr = &partials2[v];
+        REALTYPE* destPtr = &destP[v];
+        for (int k = startPattern; k < endPattern; k++) {
+            REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
             for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
-        }
-        
-        if (max == 0)
-            max = 1.0;
-            
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++)
-                destP[offset++] *= oneOverMax;
-        }
+                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
+                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+                REALTYPE sum1A = 0.0, sum2A = 0.0;
+                REALTYPE sum1B = 0.0, sum2B = 0.0;
+                int j = 0;
+                for (; j < stateCountModFour; j += 4) {
+                    sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
+                    sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+                    
+                    sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
+                    sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
 
-        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
+                    sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
+                    sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+                    
+                    sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
+                    sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                                     
+                }               
+                
+                for (; j < kStateCount; j++) {
+                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
+                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
+                }
+
+                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B) * oneOverScaleFactor;
+            }
+            destPtr += P_PAD;
+            partials1Ptr += kPartialsPaddedStateCount;
+            partials2Ptr += kPartialsPaddedStateCount;
         }
     }
 }
-
-BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
-                                              signed short* scaleFactors) {
     
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(REALTYPE* destP,
+                                                               const REALTYPE* partials1,
+                                                               const REALTYPE* matrices1,
+                                                               const REALTYPE* partials2,
+                                                               const REALTYPE* matrices2,
+                                                               int* activateScaling) {
     
-    for (int k = 0; k < kPatternCount; k++) {
-        REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        int u = l*kPartialsPaddedStateCount*kPatternCount;
+        int v = l*kPartialsPaddedStateCount*kPatternCount;
+        for (int k = 0; k < kPatternCount; k++) {
+            int w = l * kMatrixSize;
             for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
-        }
-        
-        int expMax;
-        frexp(max, &expMax);
-        scaleFactors[k] = expMax;
-        
-        if (expMax != 0) {
-            for (int l = 0; l < kCategoryCount; l++) {
-                int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-                for (int i = 0; i < kStateCount; i++)
-                    destP[offset++] *= pow(2.0, -expMax);
+                REALTYPE sum1 = 0.0, sum2 = 0.0;
+                for (int j = 0; j < kStateCount; j++) {
+                    sum1 += matrices1[w] * partials1[v + j];
+                    sum2 += matrices2[w] * partials2[v + j];
+                    w++;
+                }
+
+                // increment for the extra column at the end
+                w += T_PAD;
+
+                destP[u] = sum1 * sum2;
+
+                if (*activateScaling == 0) {
+                    int expTmp;
+                    frexp(destP[u], &expTmp);
+                    if (abs(expTmp) > scalingExponentThreshold) 
+                        *activateScaling = 1;
+                }
+                
+                u++;
             }
+            u += P_PAD;
+            v += kPartialsPaddedStateCount;
         }
     }
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// private methods
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPaddedPatternsModulus() {
+    // Padding only necessary for SSE implementations that vectorize across patterns
+    return 1;  // No padding
+}
+
+BEAGLE_CPU_TEMPLATE
+void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::mallocAligned(size_t size) {
+    void *ptr = (void *) NULL;
+
+#if defined (__APPLE__) || defined(WIN32)
+    /*
+     presumably malloc on OS X always returns
+     a 16-byte aligned pointer
+     */
+    /* Windows malloc() always gives 16-byte alignment */    
+    assert(size > 0);
+    ptr = malloc(size);
+    if(ptr == (void*)NULL) {
+        assert(0);
+    }
+#else
+    #if (T_PAD == 1)    
+        const size_t align = 32;
+    #else // T_PAD == 2
+        const size_t align = 32; // Changed from 16 (under SSE) to ensure AVX alignment
+    #endif
+    int res;
+    res = posix_memalign(&ptr, align, size);
+    if (res != 0) {
+        assert(0);
+    }
+#endif
+
+    return ptr;
+}
+
+BEAGLE_CPU_TEMPLATE
+REALTYPE* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocatePartials(int bufferIndex) {
+    if (gBufferArena != NULL)
+        return gArenaPartials[bufferIndex];
+    return (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+}
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::freeBuffer(void* buffer) {
+    if (isUnwrittenBuffer(buffer))
+        return;
+    if (gBufferArena == NULL || !gBufferArena->contains(buffer))
+        free(buffer);
+}
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
-    
-    if (!kPatternsReordered) {
-        gPatternsNewOrder = (int*) malloc(kPatternCount * sizeof(int));
-    } else {
-        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::isUnwrittenBuffer(const void* buffer) {
+    return kLazyBuffers && (buffer == gUnwrittenPartials || buffer == gUnwrittenScaleBuffer);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::commitPartials(int bufferIndex) {
+    if (!kLazyBuffers || gPartials[bufferIndex] != gUnwrittenPartials)
+        return;
+
+    REALTYPE* partials = allocatePartials(bufferIndex);
+    if (partials == NULL)
+        throw std::bad_alloc();
+    memset(partials, 0, sizeof(REALTYPE) * kPartialsSize);
+    if (kNumaPlacement && kThreadingEnabled)
+        partials = placeBufferByPartition(partials, kPaddedPatternCount * kPartialsPaddedStateCount,
+                                          kCategoryCount, kPartialsPaddedStateCount, true);
+    gPartials[bufferIndex] = partials;
+
+    if (gResidentPartials != NULL) {
+        gEvictedPartials[bufferIndex] = 0;
+        gResidentPartials->use(bufferIndex);
     }
+}
 
-    int* partitionSizes = (int*) malloc(kPartitionCount * sizeof(int));
-    double* sortedPatternWeights = (double*) malloc(sizeof(double) * kPatternCount);
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::commitScaleBuffer(int scalingIndex) {
+    if (!kLazyBuffers || scalingIndex < 0 || scalingIndex >= kScaleBufferCount ||
+        gScaleBuffers[scalingIndex] != gUnwrittenScaleBuffer)
+        return;
 
-    for (int i=0; i < kPartitionCount; i++) {
-        gPatternPartitionsStartPatterns[i] = 0;
-        partitionSizes[i] = 0;
+    REALTYPE* scaleBuffer = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPaddedPatternCount);
+    if (scaleBuffer == NULL)
+        throw std::bad_alloc();
+    memset(scaleBuffer, 0, sizeof(REALTYPE) * kPaddedPatternCount);
+    if (kNumaPlacement && kThreadingEnabled)
+        scaleBuffer = placeBufferByPartition(scaleBuffer, kPaddedPatternCount, 1, 1, false);
+    gScaleBuffers[scalingIndex] = scaleBuffer;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::commitOperationBuffers(const int* operations,
+                                                               int count,
+                                                               int numOps,
+                                                               int cumulativeScaleIndex) {
+    commitScaleBuffer(cumulativeScaleIndex);
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * numOps;
+        if (operation[0] >= 0 && operation[0] < kBufferCount)
+            commitPartials(operation[0]);
+        commitScaleBuffer(operation[1]);
+        if (numOps == BEAGLE_PARTITION_OP_COUNT)
+            commitScaleBuffer(operation[8]);
     }
+}
 
-    for (int i=0; i < kPatternCount; i++) {
-         gPatternsNewOrder[i] = partitionSizes[gPatternPartitions[i]]++;
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::restorePartials(const int* bufferIndices,
+                                                       int count) {
+    if (gResidentPartials == NULL || bufferIndices == NULL)
+        return BEAGLE_SUCCESS;
+
+    for (int i = 0; i < count; i++) {
+        if (bufferIndices[i] >= kTipCount && bufferIndices[i] < kBufferCount)
+            gResidentPartials->pin(bufferIndices[i]);
     }
 
-    for (int i=0; i < kPartitionCount; i++) {
-        for (int j=0; j < i; j++) {
-            gPatternPartitionsStartPatterns[i] += partitionSizes[j];
-        }
+    int returnCode = BEAGLE_SUCCESS;
+    for (int i = 0; i < count && returnCode == BEAGLE_SUCCESS; i++) {
+        const int bufferIndex = bufferIndices[i];
+        if (bufferIndex < kTipCount || bufferIndex >= kBufferCount)
+            continue;
+        if (gEvictedPartials[bufferIndex])
+            returnCode = restoreEvictedPartials(bufferIndex);
+        else if (gResidentPartials->contains(bufferIndex))
+            gResidentPartials->use(bufferIndex);
     }
-    gPatternPartitionsStartPatterns[kPartitionCount] = kPatternCount;
 
-    for (int i=0; i < kPatternCount; i++) {
-        gPatternsNewOrder[i] += gPatternPartitionsStartPatterns[gPatternPartitions[i]];
-        sortedPatternWeights[gPatternsNewOrder[i]] = gPatternWeights[i];
+    // left resident until the next eviction, so that the caller can read them
+    for (int i = 0; i < count; i++) {
+        if (bufferIndices[i] >= kTipCount && bufferIndices[i] < kBufferCount)
+            gResidentPartials->unpin(bufferIndices[i]);
     }
 
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::restoreEvictedPartials(int bufferIndex) {
+    // buffers wait on the stack, with their children pinned, until all of these are resident;
+    // the versions of a buffer's children predate its own, so the chain cannot loop
+    std::vector<int> pending(1, bufferIndex);
+    std::vector<const int*> pendingOperations;
+    int returnCode = BEAGLE_SUCCESS;
 
-    int currentPattern = 0;
-    for (int i=0; i < kPartitionCount; i++) {
-        for (int j=0; j < partitionSizes[i]; j++) {
-            gPatternPartitions[currentPattern++] = i;
+    while (!pending.empty()) {
+        const int index = pending.back();
+        if (pendingOperations.size() < pending.size()) {
+            const int* operation = gBufferVersions->reproducibleOperation(index);
+            if (operation == NULL) {
+                pending.pop_back();
+                returnCode = BEAGLE_ERROR_GENERAL;
+                break;
+            }
+            pendingOperations.push_back(operation);
+            gResidentPartials->pin(operation[3]);
+            gResidentPartials->pin(operation[5]);
+        }
+
+        const int* operation = pendingOperations.back();
+        if (operation[3] >= kTipCount && gEvictedPartials[operation[3]]) {
+            pending.push_back(operation[3]);
+            continue;
+        }
+        if (operation[5] >= kTipCount && gEvictedPartials[operation[5]]) {
+            pending.push_back(operation[5]);
+            continue;
         }
+
+        // recomputing must not change the scale factors the operation wrote, which later
+        // calls may have accumulated; they come out the same, so a scratch buffer takes them
+        commitPartials(index);
+        const int writeScalingIndex = operation[1];
+        if (writeScalingIndex >= 0)
+            std::swap(gScaleBuffers[writeScalingIndex], gRecomputeScaleBuffer);
+        returnCode = upPartials(false, operation, 1, BEAGLE_OP_NONE);
+        if (writeScalingIndex >= 0)
+            std::swap(gScaleBuffers[writeScalingIndex], gRecomputeScaleBuffer);
+
+        gResidentPartials->unpin(operation[3]);
+        gResidentPartials->unpin(operation[5]);
+        pending.pop_back();
+        pendingOperations.pop_back();
+        if (returnCode != BEAGLE_SUCCESS)
+            break;
+
+        gResidentPartials->pin(index);
+        evictPartials();
+        gResidentPartials->unpin(index);
     }
 
-    free(partitionSizes);
-    free(gPatternWeights);
-    gPatternWeights = sortedPatternWeights;
-
-    REALTYPE* sortedPartials = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
-    int* sortedTips = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
-
-    for (int tip=0; tip < kTipCount; tip++) {
-        if (gTipStates[tip] == NULL) {
-            REALTYPE* unsortedPartials = gPartials[tip];
-            for (int l=0; l < kCategoryCount; l++) {
-                for (int i=0; i < kPatternCount; i++) {
-                    for (int j=0; j < kStateCount; j++) {
-                        int sortIndex = l*kStateCount*kPatternCount + gPatternsNewOrder[i]*kStateCount + j;
-                        int pIndex = l*kStateCount*kPatternCount + i*kStateCount + j;
-                        sortedPartials[sortIndex] = unsortedPartials[pIndex];
-                    }
-                }
-            }
-            gPartials[tip] = sortedPartials;
-            sortedPartials = unsortedPartials;
-        } else {
-            int* unsortedTips = gTipStates[tip];
-            for (int i=0; i < kPatternCount; i++) {
-                int sortIndex = gPatternsNewOrder[i];
-                int pIndex = i;
-                sortedTips[sortIndex] = unsortedTips[pIndex];
-            }
-            gTipStates[tip] = sortedTips;
-            sortedTips = unsortedTips;
-        }        
+    for (size_t i = 0; i < pendingOperations.size(); i++) {
+        gResidentPartials->unpin(pendingOperations[i][3]);
+        gResidentPartials->unpin(pendingOperations[i][5]);
     }
 
-    free(sortedPartials);
-    free(sortedTips);
+    return returnCode;
+}
 
-    kPatternsReordered = true;
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::evictPartials() {
+    while (gResidentPartials->size() > kMaxResidentPartials) {
+        const int victim = gResidentPartials->leastRecent([this] (int index) {
+            return gBufferVersions->reproducibleOperation(index) != NULL;
+        });
+        if (victim < 0)
+            break;
 
-    return BEAGLE_SUCCESS;
+        freeBuffer(gPartials[victim]);
+        gPartials[victim] = gUnwrittenPartials;
+        gEvictedPartials[victim] = 1;
+        gResidentPartials->remove(victim);
+    }
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsCheckpointed(const int* operations,
+                                                              int count,
+                                                              int cumulativeScaleIndex) {
+    // one operation at a time, so that only its own buffers need to be resident
+    commitScaleBuffer(cumulativeScaleIndex);
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * BEAGLE_OP_COUNT;
+        const int destIndex = operation[0];
+        if (destIndex < kTipCount || destIndex >= kBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        const int children[2] = {operation[3], operation[5]};
+        int returnCode = restorePartials(children, 2);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+
+        commitPartials(destIndex);
+        gResidentPartials->use(destIndex);
+        commitScaleBuffer(operation[1]);
+
+        returnCode = upPartials(false, operation, 1, cumulativeScaleIndex);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+
+        evictPartials();
+    }
+
+    return BEAGLE_SUCCESS;
+}
 
-/*
- * Calculates partial likelihoods at a node when both children have states.
- */
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
-                                                         const int* states1,
-                                                         const REALTYPE* matrices1,
-                                                         const int* states2,
-                                                         const REALTYPE* matrices2,
-                                                         int startPattern,
-                                                         int endPattern) {
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::relocateBuffers(BufferArena* arena) {
+    const size_t partialsSize = sizeof(REALTYPE) * kPartialsSize;
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        for (int k = startPattern; k < endPattern; k++) {
-            const int state1 = states1[k];
-            const int state2 = states2[k];
-            if (DEBUGGING_OUTPUT) {
-                std::cerr << "calcStatesStates s1 = " << state1 << '\n';
-                std::cerr << "calcStatesStates s2 = " << state2 << '\n';
-            }
-            int w = l * kMatrixSize;
-            for (int i = 0; i < kStateCount; i++) {
-                destP[v] = matrices1[w + state1] * matrices2[w + state2];
-                v++;
+    std::vector<REALTYPE*> arenaPartials(arena != NULL ? kBufferCount : 0, NULL);
+    for (int i = 0; i < kBufferCount; i++) {
+        const bool allocated = (gPartials[i] != NULL && !isUnwrittenBuffer(gPartials[i]));
+        if (allocated)
+            gPartials[i] = relocateBuffer(gPartials[i], arena, partialsSize);
+        if (arena != NULL)
+            arenaPartials[i] = (allocated ? gPartials[i] : (REALTYPE*) arena->allocate(partialsSize));
+    }
 
-                w += kTransPaddedStateCount;
-            }
-            if (P_PAD) {
-                for (int pad = 0; pad < P_PAD; pad++)  {
-                    destP[v] = 0.0;
-                    v++;
-                }
+    const bool partialsOnly = (arena != NULL ? arena->fileBacked() :
+                               gBufferArena != NULL && gBufferArena->fileBacked());
+    if (!partialsOnly) {
+        for (int i = 0; i < kMatrixCount; i++)
+            gTransitionMatrices[i] = relocateBuffer(gTransitionMatrices[i], arena,
+                                                    sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+
+        if (!(kFlags & BEAGLE_FLAG_SCALING_AUTO)) {
+            for (int i = 0; i < kScaleBufferCount; i++) {
+                if (!isUnwrittenBuffer(gScaleBuffers[i]))
+                    gScaleBuffers[i] = relocateBuffer(gScaleBuffers[i], arena,
+                                                      sizeof(REALTYPE) * kPaddedPatternCount);
             }
         }
     }
+
+    delete gBufferArena;
+    gBufferArena = arena;
+    gArenaPartials.swap(arenaPartials);
 }
 
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
-                                                                     const int* child1States,
-                                                                     const REALTYPE* child1TransMat,
-                                                                     const int* child2States,
-                                                                     const REALTYPE* child2TransMat,
-                                                                     const REALTYPE* scaleFactors,
-                                                                     int startPattern,
-                                                                     int endPattern) {
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::prefetchOperations(const int* operations,
+                                                           int count,
+                                                           int numOps) {
+    const size_t partialsSize = sizeof(REALTYPE) * kPartialsSize;
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * numOps;
+        const int bufferIndices[3] = {operation[0], operation[3], operation[5]};
+        for (int i = 0; i < 3; i++) {
+            if (bufferIndices[i] >= 0 && bufferIndices[i] < kBufferCount &&
+                gPartials[bufferIndices[i]] != NULL)
+                gBufferArena->prefetch(gPartials[bufferIndices[i]], partialsSize);
+        }
+    }
+}
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-    int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        for (int k = startPattern; k < endPattern; k++) {
-            const int state1 = child1States[k];
-            const int state2 = child2States[k];
-            int w = l * kMatrixSize;
-            REALTYPE scaleFactor = scaleFactors[k];
-            for (int i = 0; i < kStateCount; i++) {
-                destP[v] = child1TransMat[w + state1] *
-                           child2TransMat[w + state2] / scaleFactor;
-                v++;
+BEAGLE_CPU_TEMPLATE
+template<typename T>
+T* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::relocateBuffer(T* buffer,
+                                                     BufferArena* arena,
+                                                     size_t size) {
+    T* relocated = (T*) (arena != NULL ? arena->allocate(size) : mallocAligned(size));
+    if (relocated == NULL)
+        throw std::bad_alloc();
+    memcpy(relocated, buffer, size);
+    freeBuffer(buffer);
+    return relocated;
+}
 
-                w += kTransPaddedStateCount;
-            }
-            if (P_PAD) {
-                for (int pad = 0; pad < P_PAD; pad++)  {
-                    destP[v] = 0.0;
-                    v++;
-                }
-            }
+BEAGLE_CPU_TEMPLATE
+template<typename T>
+T* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::growPatterns(const T* buffer,
+                                                   int blockCount,
+                                                   int elementSize,
+                                                   int valueCount,
+                                                   T fill,
+                                                   int oldPatternCount,
+                                                   int oldPaddedPatternCount) {
+    T* grown = (T*) mallocAligned(sizeof(T) * (size_t) blockCount * kPaddedPatternCount * elementSize);
+    if (grown == NULL)
+        throw std::bad_alloc();
+
+    for (int b = 0; b < blockCount; b++) {
+        const T* from = buffer + (size_t) b * oldPaddedPatternCount * elementSize;
+        T* to = grown + (size_t) b * kPaddedPatternCount * elementSize;
+        memcpy(to, from, sizeof(T) * oldPatternCount * elementSize);
+        for (int k = oldPatternCount; k < kPaddedPatternCount; k++) {
+            for (int j = 0; j < elementSize; j++)
+                to[k * elementSize + j] = (k < kPatternCount && j < valueCount ? fill : T(0));
         }
     }
+
+    return grown;
 }
 
 /*
- * Calculates partial likelihoods at a node when one child has states and one has partials.
+ * Moves the pattern-indexed buffers to memory first touched by the pinned worker
+ * that owns each partition, so that pages are placed on the NUMA node of that worker.
+ * Transition matrices are read by every partition and are left where they are.
  */
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
-                                                           const int* states1,
-                                                           const REALTYPE* matrices1,
-                                                           const REALTYPE* partials2,
-                                                           const REALTYPE* matrices2,
-                                                           int startPattern,
-                                                           int endPattern) {
-
-    int matrixIncr = kStateCount;
-
-    // increment for the extra column at the end
-    matrixIncr += T_PAD;
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::placeBuffersByPartition() {
 
+    const int partialsStride = kPaddedPatternCount * kPartialsPaddedStateCount;
 
-    int stateCountModFour = (kStateCount / 4) * 4;
+    for (int i = 0; i < kBufferCount; i++) {
+        if (gPartials[i] != NULL && !isUnwrittenBuffer(gPartials[i]))
+            gPartials[i] = placeBufferByPartition(gPartials[i], partialsStride, kCategoryCount,
+                                                  kPartialsPaddedStateCount, true);
+    }
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = startPattern; k < endPattern; k++) {
-            int w = l * kMatrixSize;
-            int state1 = states1[k];
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE tmp = matrices1[w + state1];
-                REALTYPE sumA = 0.0;
-                REALTYPE sumB = 0.0;                
-                int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];                  
-                    sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-                    sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];                  
-                    sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                  
-                }
-                for (; j < kStateCount; j++) {
-                    sumA += matrices2Ptr[j] * partials2Ptr[j];                  
-                }               
-                
-                w += matrixIncr;
-                
-                *(destPtr++) = tmp * (sumA + sumB);
-            }
-            if (P_PAD) {
-                for (int pad = 0; pad < P_PAD; pad++)  {
-                    *(destPtr++) = 0.0;
-                }
-            }
-            partials2Ptr += kPartialsPaddedStateCount;
+    if (!(kFlags & BEAGLE_FLAG_SCALING_AUTO)) {
+        for (int i = 0; i < kScaleBufferCount; i++) {
+            if (gScaleBuffers[i] != NULL && !isUnwrittenBuffer(gScaleBuffers[i]))
+                gScaleBuffers[i] = placeBufferByPartition(gScaleBuffers[i], kPaddedPatternCount, 1,
+                                                          1, false);
         }
     }
 }
 
+/*
+ * Copies a buffer of blockCount blocks (stride elements apart) of patterns with
+ * blockSize elements each into a new allocation, letting the worker of each
+ * partition copy, and therefore first-touch, its own patterns.
+ */
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
-                                                                       const int* states1,
-                                                                       const REALTYPE* matrices1,
-                                                                       const REALTYPE* partials2,
-                                                                       const REALTYPE* matrices2,
-                                                                       const REALTYPE* scaleFactors,
-                                                                       int startPattern,
-                                                                       int endPattern) {
-
-    int matrixIncr = kStateCount;
-
-    // increment for the extra column at the end
-    matrixIncr += T_PAD;
-
-    int stateCountModFour = (kStateCount / 4) * 4;
+template<typename T>
+T* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::placeBufferByPartition(T* buffer,
+                                                             int stride,
+                                                             int blockCount,
+                                                             int blockSize,
+                                                             bool aligned) {
+    size_t size = sizeof(T) * stride * blockCount;
+    T* placed = (T*) (aligned ? mallocAligned(size) : malloc(size));
+    if (placed == NULL)
+        throw std::bad_alloc();
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = startPattern; k < endPattern; k++) {
-            int w = l * kMatrixSize;
-            int state1 = states1[k];
-            REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE tmp = matrices1[w + state1];
-                REALTYPE sumA = 0.0;
-                REALTYPE sumB = 0.0;                
-                int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];                  
-                    sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-                    sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];                  
-                    sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                  
-                }
-                for (; j < kStateCount; j++) {
-                    sumA += matrices2Ptr[j] * partials2Ptr[j];                  
-                }               
-                
-                w += matrixIncr;
-                
-                *(destPtr++) = tmp * (sumA + sumB) * oneOverScaleFactor;
-            }
-            if (P_PAD) {
-                for (int pad = 0; pad < P_PAD; pad++)  {
-                    *(destPtr++) = 0.0;
-                }
+    ThreadPool* pool = getThreadPool();
+    ThreadPoolTaskGroup group;
+    for (int p = 0; p < kPartitionCount; p++) {
+        int startPattern = gPatternPartitionsStartPatterns[p];
+        int endPattern = gPatternPartitionsStartPatterns[p + 1];
+        // padded patterns beyond the last partition go with it
+        if (p == kPartitionCount - 1)
+            endPattern = stride / blockSize;
+        pool->submit(group, [=] () {
+            for (int b = 0; b < blockCount; b++) {
+                size_t offset = (size_t) b * stride + (size_t) startPattern * blockSize;
+                memcpy(placed + offset, buffer + offset,
+                       sizeof(T) * (endPattern - startPattern) * blockSize);
             }
-            partials2Ptr += kPartialsPaddedStateCount;
+        }, p);
+    }
+    group.wait();
+
+    free(buffer);
+
+    return placed;
+}
+
+BEAGLE_CPU_TEMPLATE
+ThreadPool* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getThreadPool() {
+    // workers are started on first use, so that an instance attached to the
+    // shared pool right after creation never starts threads of its own
+    if (!gThreadPool) {
+        gThreadPool = std::make_shared<ThreadPool>((kThreadingEnabled ? kNumThreads : kOperationThreadCount),
+                                                   kNumaPlacement);
+        gThreadPool->setTrace(gTrace);
+        gThreadPool->setSpinTime(kThreadSpinMicroseconds);
+    }
+    return gThreadPool.get();
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::useParallelOperations() {
+    // the automatic, always and dynamic scaling modes update scale buffers shared
+    // across operations and patterns, so their operations keep the list order
+    return (kParallelOperations &&
+            !(kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC)));
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::findCachedMatrices(int eigenIndex,
+                                                           const int* eigenIndices,
+                                                           const int* categoryRateIndices,
+                                                           const int* probabilityIndices,
+                                                           const double* edgeLengths,
+                                                           int count) {
+    gMatrixCacheMisses.clear();
+
+    for (int u = 0; u < count; u++) {
+        int matrixEigenIndex = (eigenIndices == NULL ? eigenIndex : eigenIndices[u]);
+        int categoryRatesIndex = (categoryRateIndices == NULL ? 0 : categoryRateIndices[u]);
+        int matrixIndex = probabilityIndices[u];
+
+        int holder = gMatrixCache->find(matrixEigenIndex, categoryRatesIndex, edgeLengths[u], matrixIndex);
+        if (holder == matrixIndex)
+            continue;
+
+        if (holder >= 0) {
+            memcpy(gTransitionMatrices[matrixIndex], gTransitionMatrices[holder],
+                   sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+            matricesChanged(&matrixIndex, 1);
+            gMatrixCache->set(matrixIndex, matrixEigenIndex, categoryRatesIndex, edgeLengths[u]);
+        } else {
+            // recorded once computed, so that no later edge of the call copies it before then
+            matricesChanged(&matrixIndex, 1);
+            gMatrixCacheMisses.push_back(u);
         }
-    }                                            
+    }
 }
 
-/*
- * Calculates partial likelihoods at a node when both children have partials.
- */
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
-                                                             const REALTYPE* partials1,
-                                                             const REALTYPE* matrices1,
-                                                             const REALTYPE* partials2,
-                                                             const REALTYPE* matrices2,
-                                                             int startPattern,
-                                                             int endPattern) {
-    int matrixIncr = kStateCount;
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::matricesChanged(const int* matrixIndices,
+                                                        int count) {
+    if (matrixIndices == NULL)
+        return;
 
-    // increment for the extra column at the end
-    matrixIncr += T_PAD;
+    for (int i = 0; i < count; i++) {
+        if (gMatrixCache != NULL)
+            gMatrixCache->forget(matrixIndices[i]);
+        if (gBufferVersions != NULL)
+            gBufferVersions->touchMatrix(matrixIndices[i]);
+    }
+}
 
-    int stateCountModFour = (kStateCount / 4) * 4;
+BEAGLE_CPU_TEMPLATE
+const int* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeCleanOperations(const int* operations,
+                                                                    int& count,
+                                                                    int cumulativeScaleIndex) {
+    if (gBufferVersions == NULL)
+        return operations;
+
+    // skipped operations would not add their scale factors again
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE ||
+        (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))) {
+        for (int op = 0; op < count; op++)
+            gBufferVersions->recordOperation(operations + op * BEAGLE_OP_COUNT);
+        return operations;
+    }
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials1Ptr = &partials1[v];
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = startPattern; k < endPattern; k++) {
+    gDirtyOperations.clear();
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * BEAGLE_OP_COUNT;
+        if (!gBufferVersions->skipOperation(operation))
+            gDirtyOperations.insert(gDirtyOperations.end(), operation, operation + BEAGLE_OP_COUNT);
+    }
 
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE sum1A = 0.0, sum2A = 0.0;
-                REALTYPE sum1B = 0.0, sum2B = 0.0;
-                int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
-                    sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
-                    
-                    sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
-                    sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+    count = gDirtyOperations.size() / BEAGLE_OP_COUNT;
+    return gDirtyOperations.data();
+}
 
-                    sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
-                    sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
-                    
-                    sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
-                    sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                                     
-                }               
-                
-                for (; j < kStateCount; j++) {
-                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
-                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
-                }
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::hasTipStates(int bufferIndex) {
+    if (kPackedTipStates)
+        return (gPackedTipStates[bufferIndex] != NULL);
+    return (gTipStates[bufferIndex] != NULL);
+}
 
-                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B);
+BEAGLE_CPU_TEMPLATE
+const int* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTipStates(int bufferIndex,
+                                                           int slot) {
+    if (!kPackedTipStates)
+        return gTipStates[bufferIndex];
+
+    const unsigned char* packed = gPackedTipStates[bufferIndex];
+    if (packed == NULL)
+        return NULL;
+
+    // operations run concurrently on the threads of an instance, and of the instances
+    // sharing a thread pool
+    static thread_local std::vector<int> unpacked[2];
+    std::vector<int>& states = unpacked[slot];
+    if ((int) states.size() < kPaddedPatternCount)
+        states.resize(kPaddedPatternCount);
+
+    const int shift = (kTipStateBits == 2 ? 2 : (kTipStateBits == 4 ? 1 : 0));
+    const int statesPerByte = 1 << shift;
+    const int mask = (1 << kTipStateBits) - 1;
+    for (int j = 0; j < kPaddedPatternCount; j++) {
+        states[j] = (packed[j >> shift] >> ((j & (statesPerByte - 1)) * kTipStateBits)) & mask;
+    }
+
+    return states.data();
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::packTipStates(int tipIndex,
+                                                      const int* inStates,
+                                                      int count) {
+    const int statesPerByte = 8 / kTipStateBits;
+    const int byteCount = (kPaddedPatternCount + statesPerByte - 1) / statesPerByte;
+    if (gPackedTipStates[tipIndex] == NULL) {
+        gPackedTipStates[tipIndex] = (unsigned char*) malloc(byteCount);
+        if (gPackedTipStates[tipIndex] == NULL)
+            throw std::bad_alloc();
+    }
+
+    unsigned char* packed = gPackedTipStates[tipIndex];
+    memset(packed, 0, byteCount);
+    for (int j = 0; j < kPaddedPatternCount; j++) {
+        int state = kStateCount;
+        if (j < count && inStates[j] >= 0 && inStates[j] < kStateCount)
+            state = inStates[j];
+        packed[j / statesPerByte] |= (unsigned char) (state << ((j % statesPerByte) * kTipStateBits));
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::findCompactTipStates(const double* inPartials,
+                                                             int* outStates) {
+    const double* inPartialsOffset = inPartials;
+    for (int k = 0; k < kPatternCount; k++) {
+        int state = kStateCount;
+        int oneCount = 0;
+        for (int i = 0; i < kStateCount; i++) {
+            if (inPartialsOffset[i] == 1.0) {
+                state = i;
+                oneCount++;
+            } else if (inPartialsOffset[i] != 0.0) {
+                return false;
             }
-            destPtr += P_PAD;
-            partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
         }
+        if (oneCount == kStateCount)
+            state = kStateCount;
+        else if (oneCount != 1)
+            return false;
+        outStates[k] = state;
+        inPartialsOffset += kStateCount;
     }
+    return true;
 }
 
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYPE* destP,
-                                                                         const REALTYPE* partials1,
-                                                                         const REALTYPE* matrices1,
-                                                                         const REALTYPE* partials2,
-                                                                         const REALTYPE* matrices2,
-                                                                         const REALTYPE* scaleFactors,
-                                                                         int startPattern,
-                                                                         int endPattern) {
-
-    int matrixIncr = kStateCount;
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::clearTipStates(int tipIndex) {
+    if (gTipStates[tipIndex] != NULL) {
+        free(gTipStates[tipIndex]);
+        gTipStates[tipIndex] = NULL;
+    }
+    if (gPackedTipStates != NULL && gPackedTipStates[tipIndex] != NULL) {
+        free(gPackedTipStates[tipIndex]);
+        gPackedTipStates[tipIndex] = NULL;
+    }
+}
 
-    // increment for the extra column at the end
-    matrixIncr += T_PAD;
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPrePartials(REALTYPE* destP,
+                                                        const REALTYPE* parentPartials,
+                                                        const REALTYPE* parentMatrices,
+                                                        const int* siblingStates,
+                                                        const REALTYPE* siblingPartials,
+                                                        const REALTYPE* siblingMatrices,
+                                                        const REALTYPE* scaleFactors) {
+    const int matrixIncr = kStateCount + T_PAD;
 
-    int stateCountModFour = (kStateCount / 4) * 4;
-    
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials1Ptr = &partials1[v];
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = startPattern; k < endPattern; k++) {
-            REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+        const int matrixOffset = l * kMatrixSize;
+        int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+        for (int k = 0; k < kPatternCount; k++) {
+            const REALTYPE* parentPtr = parentPartials + v;
+            const REALTYPE* siblingPtr = (siblingPartials != NULL ? siblingPartials + v : NULL);
+            REALTYPE* destPtr = destP + v;
+            const REALTYPE oneOverScaleFactor = (scaleFactors != NULL ?
+                                                 REALTYPE(1.0) / scaleFactors[k] : REALTYPE(1.0));
             for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE sum1A = 0.0, sum2A = 0.0;
-                REALTYPE sum1B = 0.0, sum2B = 0.0;
-                int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
-                    sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
-                    
-                    sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
-                    sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+                // the parent end of the edge of the parent, through the column of state i
+                REALTYPE above = parentPtr[i];
+                if (parentMatrices != NULL) {
+                    const REALTYPE* parentMatrixPtr = parentMatrices + matrixOffset + i;
+                    above = 0.0;
+                    for (int j = 0; j < kStateCount; j++)
+                        above += parentMatrixPtr[j * matrixIncr] * parentPtr[j];
+                }
 
-                    sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
-                    sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
-                    
-                    sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
-                    sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];                                     
-                }               
-                
-                for (; j < kStateCount; j++) {
-                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
-                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
+                const REALTYPE* siblingMatrixPtr = siblingMatrices + matrixOffset + i * matrixIncr;
+                REALTYPE side;
+                if (siblingPtr == NULL) {
+                    side = siblingMatrixPtr[siblingStates[k]];
+                } else {
+                    side = 0.0;
+                    for (int j = 0; j < kStateCount; j++)
+                        side += siblingMatrixPtr[j] * siblingPtr[j];
                 }
 
-                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B) * oneOverScaleFactor;
+                destPtr[i] = above * side * oneOverScaleFactor;
             }
-            destPtr += P_PAD;
-            partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
+            for (int i = kStateCount; i < kPartialsPaddedStateCount; i++)
+                destPtr[i] = 0.0;
+            v += kPartialsPaddedStateCount;
         }
     }
 }
-    
+
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(REALTYPE* destP,
-                                                               const REALTYPE* partials1,
-                                                               const REALTYPE* matrices1,
-                                                               const REALTYPE* partials2,
-                                                               const REALTYPE* matrices2,
-                                                               int* activateScaling) {
-    
-#pragma omp parallel for num_threads(kCategoryCount)
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeDerivatives(const int* postStates,
+                                                            const REALTYPE* postPartials,
+                                                            const REALTYPE* prePartials,
+                                                            const REALTYPE* matrices,
+                                                            const REALTYPE* const* derivativeMatrices,
+                                                            int derivativeCount,
+                                                            const REALTYPE* categoryWeights,
+                                                            double* outDerivatives,
+                                                            double* outSumDerivatives) {
+    const int matrixIncr = kStateCount + T_PAD;
+
+    // the likelihood and its derivatives of each pattern, accumulated over the categories
+    std::vector<double> likelihoods(kPatternCount, 0.0);
+    std::vector<double> derivatives((size_t) derivativeCount * kPatternCount, 0.0);
+
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*kPartialsPaddedStateCount*kPatternCount;
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
+        const int matrixOffset = l * kMatrixSize;
+        const double weight = categoryWeights[l];
+        int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
         for (int k = 0; k < kPatternCount; k++) {
-            int w = l * kMatrixSize;
+            const REALTYPE* prePtr = prePartials + v;
+            const REALTYPE* postPtr = (postPartials != NULL ? postPartials + v : NULL);
+            double likelihood = 0.0;
             for (int i = 0; i < kStateCount; i++) {
-                REALTYPE sum1 = 0.0, sum2 = 0.0;
-                for (int j = 0; j < kStateCount; j++) {
-                    sum1 += matrices1[w] * partials1[v + j];
-                    sum2 += matrices2[w] * partials2[v + j];
-                    w++;
+                const int w = matrixOffset + i * matrixIncr;
+                REALTYPE below;
+                if (postStates != NULL) {
+                    below = matrices[w + postStates[k]];
+                } else {
+                    below = 0.0;
+                    for (int j = 0; j < kStateCount; j++)
+                        below += matrices[w + j] * postPtr[j];
                 }
+                likelihood += prePtr[i] * below;
+            }
+            likelihoods[k] += weight * likelihood;
 
-                // increment for the extra column at the end
-                w += T_PAD;
-
-                destP[u] = sum1 * sum2;
-
-                if (*activateScaling == 0) {
-                    int expTmp;
-                    frexp(destP[u], &expTmp);
-                    if (abs(expTmp) > scalingExponentThreshold) 
-                        *activateScaling = 1;
+            for (int d = 0; d < derivativeCount; d++) {
+                const REALTYPE* derivativeMatrix = derivativeMatrices[d];
+                double derivative = 0.0;
+                for (int i = 0; i < kStateCount; i++) {
+                    const int w = matrixOffset + i * matrixIncr;
+                    REALTYPE belowDerivative;
+                    if (postStates != NULL) {
+                        belowDerivative = derivativeMatrix[w + postStates[k]];
+                    } else {
+                        belowDerivative = 0.0;
+                        for (int j = 0; j < kStateCount; j++)
+                            belowDerivative += derivativeMatrix[w + j] * postPtr[j];
+                    }
+                    derivative += prePtr[i] * belowDerivative;
                 }
-                
-                u++;
+                derivatives[(size_t) d * kPatternCount + k] += weight * derivative;
             }
-            u += P_PAD;
             v += kPartialsPaddedStateCount;
         }
     }
+
+    for (int d = 0; d < derivativeCount; d++) {
+        double sum = 0.0;
+        for (int k = 0; k < kPatternCount; k++) {
+            const size_t site = (size_t) d * kPatternCount + k;
+            outDerivatives[site] = derivatives[site] / likelihoods[k];
+            sum += outDerivatives[site] * gPatternWeights[k];
+        }
+        outSumDerivatives[d] = sum;
+    }
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPaddedPatternsModulus() {
-    // Padding only necessary for SSE implementations that vectorize across patterns
-    return 1;  // No padding
+const int* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteRepeatClasses(int bufferIndex,
+                                                                   int& classCount,
+                                                                   int slot) {
+    if (hasTipStates(bufferIndex)) {
+        // including the missing state
+        classCount = kStateCount + 1;
+        return getTipStates(bufferIndex, slot);
+    }
+
+    if (gSiteRepeatClasses[bufferIndex].empty())
+        return NULL;
+
+    classCount = gSiteRepeatClassCounts[bufferIndex];
+    return gSiteRepeatClasses[bufferIndex].data();
 }
 
 BEAGLE_CPU_TEMPLATE
-void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::mallocAligned(size_t size) {
-    void *ptr = (void *) NULL;
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateSiteRepeats(const int* operations,
+                                                          int count) {
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * BEAGLE_OP_COUNT;
+        const int destinationIndex = operation[0];
+        std::vector<int>& classes = gSiteRepeatClasses[destinationIndex];
+
+        unsigned long long* inputs = &gSiteRepeatInputs[destinationIndex * 4];
+        if (gSiteRepeatStamps[destinationIndex] != 0 &&
+            inputs[0] == (unsigned long long) operation[3] &&
+            inputs[1] == gSiteRepeatStamps[operation[3]] &&
+            inputs[2] == (unsigned long long) operation[5] &&
+            inputs[3] == gSiteRepeatStamps[operation[5]])
+            continue;
+        inputs[0] = operation[3];
+        inputs[1] = gSiteRepeatStamps[operation[3]];
+        inputs[2] = operation[5];
+        inputs[3] = gSiteRepeatStamps[operation[5]];
+        gSiteRepeatStamps[destinationIndex] = ++kSiteRepeatStamp;
+
+        int classCount1 = 0;
+        int classCount2 = 0;
+        const int* classes1 = getSiteRepeatClasses(operation[3], classCount1, 0);
+        const int* classes2 = getSiteRepeatClasses(operation[5], classCount2, 1);
+        // a destination has at least as many classes as each child, so its classes would
+        // not be used beyond this
+        if (classes1 == NULL || classes2 == NULL ||
+            classCount1 * BEAGLE_CPU_SITE_REPEATS_PATTERNS_PER_CLASS > kPatternCount ||
+            classCount2 * BEAGLE_CPU_SITE_REPEATS_PATTERNS_PER_CLASS > kPatternCount) {
+            classes.clear();
+            continue;
+        }
 
-#if defined (__APPLE__) || defined(WIN32)
-    /*
-     presumably malloc on OS X always returns
-     a 16-byte aligned pointer
-     */
-    /* Windows malloc() always gives 16-byte alignment */    
-    assert(size > 0);
-    ptr = malloc(size);
-    if(ptr == (void*)NULL) {
-        assert(0);
-    }
-#else
-    #if (T_PAD == 1)    
-        const size_t align = 32;
-    #else // T_PAD == 2
-        const size_t align = 32; // Changed from 16 (under SSE) to ensure AVX alignment
-    #endif
-    int res;
-    res = posix_memalign(&ptr, align, size);
-    if (res != 0) {
-        assert(0);
+        // a class of the destination is a pair of classes of the children
+        classes.resize(kPatternCount);
+        int classCount = 0;
+        if ((long) classCount1 * classCount2 <= 4L * kPatternCount) {
+            gSiteRepeatPairs.assign(classCount1 * classCount2, -1);
+            for (int k = 0; k < kPatternCount; k++) {
+                int& pairClass = gSiteRepeatPairs[classes1[k] * classCount2 + classes2[k]];
+                if (pairClass < 0)
+                    pairClass = classCount++;
+                classes[k] = pairClass;
+            }
+        } else {
+            std::map<std::pair<int, int>, int> pairClasses;
+            for (int k = 0; k < kPatternCount; k++) {
+                std::pair<std::map<std::pair<int, int>, int>::iterator, bool> inserted =
+                    pairClasses.insert(std::make_pair(std::make_pair(classes1[k], classes2[k]), classCount));
+                if (inserted.second)
+                    classCount++;
+                classes[k] = inserted.first->second;
+            }
+        }
+        gSiteRepeatClassCounts[destinationIndex] = classCount;
     }
-#endif
+}
 
-    return ptr;
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::clearSiteRepeats(int bufferIndex) {
+    gSiteRepeatClasses[bufferIndex].clear();
+    gSiteRepeatStamps[bufferIndex] = ++kSiteRepeatStamp;
 }
 
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting(threadData* tData)
-{
-    std::unique_lock<std::mutex> l(tData->m, std::defer_lock);
-    while (true)
-    {
-        l.lock();
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::findTipGapPatterns(int tipIndex) {
+    std::vector<char>& gaps = gGapPatterns[tipIndex];
+    gaps.assign(kPatternCount, 0);
+
+    bool anyGaps = false;
+    if (hasTipStates(tipIndex)) {
+        const int* states = getTipStates(tipIndex, 0);
+        for (int k = 0; k < kPatternCount; k++) {
+            gaps[k] = (states[k] >= kStateCount);
+            anyGaps = anyGaps || gaps[k];
+        }
+    } else if (gPartials[tipIndex] != NULL) {
+        // the partials of a tip are the same in every category
+        const REALTYPE* partials = gPartials[tipIndex];
+        for (int k = 0; k < kPatternCount; k++) {
+            bool gap = true;
+            for (int i = 0; i < kStateCount && gap; i++)
+                gap = (partials[k * kPartialsPaddedStateCount + i] == 1.0);
+            gaps[k] = gap;
+            anyGaps = anyGaps || gap;
+        }
+    }
+
+    if (!anyGaps)
+        gaps.clear();
+}
 
-        // Wait until the queue won't be empty or stop is signaled
-        tData->cv.wait(l, [tData] () {
-            return (tData->stop || !tData->jobs.empty()); 
-            });
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateGapPatterns(const int* operations,
+                                                          int count) {
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * BEAGLE_OP_COUNT;
+        std::vector<char>& gaps = gGapPatterns[operation[0]];
+        const std::vector<char>& gaps1 = gGapPatterns[operation[3]];
+        const std::vector<char>& gaps2 = gGapPatterns[operation[5]];
+        if (gaps1.empty() || gaps2.empty()) {
+            gaps.clear();
+            continue;
+        }
 
-        // Stop was signaled, let's exit the thread
-        if (tData->stop) { return; }
+        gaps.resize(kPatternCount);
+        bool anyGaps = false;
+        for (int k = 0; k < kPatternCount; k++) {
+            gaps[k] = (gaps1[k] && gaps2[k]);
+            anyGaps = anyGaps || gaps[k];
+        }
+        if (!anyGaps)
+            gaps.clear();
+    }
+}
 
-        // Pop one task from the queue...
-        std::packaged_task<void()> j = std::move(tData->jobs.front());
-        tData->jobs.pop();
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::stopThreads() {
+    // joins all the workers once their queued jobs are done
+    if (!kSharedThreadPool)
+        gThreadPool.reset();
 
-        l.unlock();
+    if (kThreadingEnabled) {
+        for (int i=0; i<kPartitionCount; i++) {
+            free(gPartitionOperations[i]);
+        }
+        free(gPartitionOperations);
+        free(gPartitionOpCounts);
 
-        // Execute the task!
-        j();
+        kThreadingEnabled = false;
     }
 }
 
@@ -3821,7 +7582,16 @@ BeagleImpl* BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tip
                                              long requirementFlags,
                                              int* errorCode) {
 
-    BeagleImpl* impl = new BeagleCPUImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT>();
+    BeagleImpl* impl;
+    // amino acid and codon models get kernels compiled for their state count; in single
+    // precision these would round differently from the generic kernels, so only double
+    // precision uses them
+    if (DOUBLE_PRECISION && stateCount == 20)
+        impl = new BeagleCPUFixedStateImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT, 20>();
+    else if (DOUBLE_PRECISION && stateCount == 61)
+        impl = new BeagleCPUFixedStateImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT, 61>();
+    else
+        impl = new BeagleCPUImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT>();
 
     try {
         *errorCode =
@@ -3849,6 +7619,28 @@ BeagleImpl* BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tip
 }
 
 
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                     int partialsBufferCount,
+                                                                     int compactBufferCount,
+                                                                     int stateCount,
+                                                                     int patternCount,
+                                                                     int eigenBufferCount,
+                                                                     int matrixBufferCount,
+                                                                     int categoryCount,
+                                                                     int scaleBufferCount,
+                                                                     long preferenceFlags,
+                                                                     long requirementFlags,
+                                                                     long long* outHostBytes,
+                                                                     long long* outDeviceBytes) {
+    *outHostBytes = BeagleCPUImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT>::getInstanceBytes(
+                        tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                        scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 const char* BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
     return getBeagleCPUName<BEAGLE_CPU_FACTORY_GENERIC>();
@@ -3858,7 +7650,7 @@ BEAGLE_CPU_FACTORY_TEMPLATE
 const long BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
     long flags = BEAGLE_FLAG_COMPUTATION_SYNCH |
                  BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC |
-                 BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                 BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_CPU_OPENMP_THREADING_FLAG |
                  BEAGLE_FLAG_PROCESSOR_CPU |
                  BEAGLE_FLAG_VECTOR_NONE |
                  BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
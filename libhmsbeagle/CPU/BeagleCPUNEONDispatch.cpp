@@ -0,0 +1,46 @@
+/*
+ *  BeagleCPUNEONDispatch.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUDispatch.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateNEONImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUNEONImpl.h"
+
+namespace beagle {
+namespace cpu {
+
+bool beagleCPUSupportsNEON() {
+    return CPUSupportsNEON() != 0;
+}
+
+void addBeagleCPUNEONFactories(std::list<beagle::BeagleImplFactory*>& factories) {
+    factories.push_back(new beagle::cpu::BeagleCPU4StateNEONImplFactory<double>());
+    factories.push_back(new beagle::cpu::BeagleCPUNEONImplFactory<double>());
+}
+
+}	// namespace cpu
+}	// namespace beagle
@@ -44,7 +44,7 @@ Plugin("CPU-SSE-OpenMP", "CPU-SSE-OpenMP")
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<float>());
 
-	// FIXME: the SSE plugin currently assumes all hardware is compatible
+	// The SSE factories decline to create instances on hosts without SSE2
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<double>());
 //	implFactory->push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<float>()); // TODO Not yet written
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<double>()); // TODO In process of writing
@@ -8,6 +8,7 @@
 #include "libhmsbeagle/CPU/BeagleCPUPlugin.h"
 #include "libhmsbeagle/CPU/BeagleCPU4StateImpl.h"
 #include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUDispatch.h"
 #include <iostream>
 
 namespace beagle {
@@ -29,15 +30,40 @@ Plugin("CPU", "CPU")
                                          BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
                                          BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
                                          BEAGLE_FLAG_FRAMEWORK_CPU;
+        const BeagleCPUFeatures& features = getBeagleCPUFeatures();
+        if (features.sse2)
+            resource.supportFlags |= BEAGLE_FLAG_VECTOR_SSE;
+        if (features.avx512)
+            resource.supportFlags |= BEAGLE_FLAG_VECTOR_AVX512;
         resource.requiredFlags = BEAGLE_FLAG_FRAMEWORK_CPU;
 	beagleResources.push_back(resource);
 
-	// Optional for plugins: check if the hardware is compatible and only populate
-	// list with compatible factories
+	// Only factories for instruction sets the host supports are listed.  The
+	// vector factories come first where they did as separate plugins, so
+	// they still win ties in the flag scoring.
+#ifdef BEAGLE_CPU_DISPATCH_SSE
+	if (features.sse2)
+		addBeagleCPUSSEFactories(beagleFactories);
+#endif
+#ifdef BEAGLE_CPU_DISPATCH_NEON
+	if (features.neon)
+		addBeagleCPUNEONFactories(beagleFactories);
+#endif
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateImplFactory<float>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<float>());
+	// The single-precision SSE kernels round differently from the scalar ones,
+	// so they follow them and are chosen only when BEAGLE_FLAG_VECTOR_SSE is
+	// asked for.
+#ifdef BEAGLE_CPU_DISPATCH_SSE
+	if (features.sse2)
+		addBeagleCPUSSESingleFactories(beagleFactories);
+#endif
+#ifdef BEAGLE_CPU_DISPATCH_AVX512
+	if (features.avx512)
+		addBeagleCPUAVX512Factories(beagleFactories);
+#endif
 }
 
 }	// namespace cpu
@@ -0,0 +1,99 @@
+/*
+ *  BeagleCPUResidentPartials.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUResidentPartials__
+#define __BeagleCPUResidentPartials__
+
+#include <list>
+#include <vector>
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * The partials buffers that hold memory of their own while partials checkpointing is
+ * enabled, from the most to the least recently used, together with the buffers that must
+ * stay resident for now because a computation in progress reads them.
+ */
+class ResidentPartials {
+public:
+    ResidentPartials(int bufferCount) : positions(bufferCount),
+                                        resident(bufferCount, 0),
+                                        pins(bufferCount, 0) {}
+
+    // Makes index the most recently used buffer, adding it if it was not resident
+    void use(int index) {
+        if (resident[index])
+            order.erase(positions[index]);
+        order.push_front(index);
+        positions[index] = order.begin();
+        resident[index] = 1;
+    }
+
+    void remove(int index) {
+        if (!resident[index])
+            return;
+        order.erase(positions[index]);
+        resident[index] = 0;
+    }
+
+    bool contains(int index) const {
+        return resident[index] != 0;
+    }
+
+    int size() const {
+        return (int) order.size();
+    }
+
+    void pin(int index) {
+        pins[index]++;
+    }
+
+    void unpin(int index) {
+        if (pins[index] > 0)
+            pins[index]--;
+    }
+
+    // Returns the least recently used buffer that is not pinned and for which evictable
+    // holds, or -1 if there is none
+    template <typename Predicate>
+    int leastRecent(Predicate evictable) const {
+        for (std::list<int>::const_reverse_iterator it = order.rbegin(); it != order.rend(); ++it) {
+            if (pins[*it] == 0 && evictable(*it))
+                return *it;
+        }
+        return -1;
+    }
+
+private:
+    std::list<int> order;
+    std::vector<std::list<int>::iterator> positions;
+    std::vector<char> resident;
+    std::vector<int> pins;
+};
+
+}   // namespace cpu
+}   // namespace beagle
+
+#endif // __BeagleCPUResidentPartials__
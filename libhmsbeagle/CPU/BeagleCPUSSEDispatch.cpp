@@ -0,0 +1,50 @@
+/*
+ *  BeagleCPUSSEDispatch.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUDispatch.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateSSEImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUSSEImpl.h"
+
+namespace beagle {
+namespace cpu {
+
+bool beagleCPUSupportsSSE() {
+    return CPUSupportsSSE() != 0;
+}
+
+void addBeagleCPUSSEFactories(std::list<beagle::BeagleImplFactory*>& factories) {
+    factories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<double>());
+    factories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<double>());
+}
+
+void addBeagleCPUSSESingleFactories(std::list<beagle::BeagleImplFactory*>& factories) {
+    factories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<float>());
+}
+
+}	// namespace cpu
+}	// namespace beagle
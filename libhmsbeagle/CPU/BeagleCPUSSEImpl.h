@@ -68,6 +68,11 @@ class BeagleCPUSSEImpl : public BeagleCPUImpl<BEAGLE_CPU_GENERIC> {
 
 };
 
+/*
+ * Each 128-bit vector holds four consecutive states of one pattern; the
+ * transition matrices are transposed per call so that a column becomes a
+ * contiguous vector.
+ */
 BEAGLE_CPU_SSE_TEMPLATE
 class BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT> : public BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT> {
 
@@ -81,6 +86,8 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::hasTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::getTipStates;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kCategoryCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gScaleBuffers;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gCategoryWeights;
@@ -88,6 +95,10 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::realtypeMin;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kMatrixSize;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kPartialsPaddedStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::sumSiteLogLikelihoods;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gPatternWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::scalingExponentThreshold;
 
 public:
     virtual const char* getName();
@@ -98,30 +109,39 @@ protected:
     virtual int getPaddedPatternsModulus();
 
 private:
-	virtual void calcStatesStates(float* destP,
-                                     const int* states1,
-                                     const float* matrices1,
-                                     const int* states2,
-                                     const float* matrices2);
-
     virtual void calcStatesPartials(float* destP,
                                     const int* states1,
                                     const float* matrices1,
                                     const float* partials2,
-                                    const float* matrices2);
+                                    const float* matrices2,
+                                    int startPattern,
+                                    int endPattern);
+
+    virtual void calcStatesPartialsFixedScaling(float* destP,
+                                                const int* states1,
+                                                const float* matrices1,
+                                                const float* partials2,
+                                                const float* matrices2,
+                                                const float* scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
 
     virtual void calcPartialsPartials(float* __restrict destP,
-                                      const float* __restrict partials1,
-                                      const float* __restrict matrices1,
-                                      const float* __restrict partials2,
-                                      const float* __restrict matrices2);
-    
-    virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
                                       const float* __restrict matrices2,
-                                      const float* __restrict scaleFactors);
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
+                                                  const float* __restrict partials1,
+                                                  const float* __restrict matrices1,
+                                                  const float* __restrict partials2,
+                                                  const float* __restrict matrices2,
+                                                  const float* __restrict scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
 
     virtual void calcPartialsPartialsAutoScaling(float* __restrict destP,
                                                  const float* __restrict partials1,
@@ -130,14 +150,49 @@ private:
                                                  const float* __restrict matrices2,
                                                  int* activateScaling);
 
+    virtual int calcRootLogLikelihoods(const int bufferIndex,
+                                       const int categoryWeightsIndex,
+                                       const int stateFrequenciesIndex,
+                                       const int scalingFactorsIndex,
+                                       double* outSumLogLikelihood);
+
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
-                                        const int childBufferIndex,
-                                        const int probabilityIndex,
-                                        const int categoryWeightsIndex,
-                                        const int stateFrequenciesIndex,
-                                        const int scalingFactorsIndex,
-                                        double* outSumLogLikelihood);
+                                       const int childBufferIndex,
+                                       const int probabilityIndex,
+                                       const int categoryWeightsIndex,
+                                       const int stateFrequenciesIndex,
+                                       const int scalingFactorsIndex,
+                                       double* outSumLogLikelihood);
+
+    // number of floats in a row of a transposed matrix, a multiple of the vector length
+    int getTransposedRowLength();
+
+    // allocates and fills the transposed matrices of all categories, including
+    // the padded row for ambiguous characters; free with _mm_free
+    float* createTransposedMatrices(const float* matrices);
+
+    // products of the partials of patterns [startPattern, endPattern) with both
+    // transposed matrices, optionally divided by the scale factors
+    void calcPartialsPartialsTransposed(float* __restrict destP,
+                                        const float* __restrict partials1,
+                                        const float* __restrict matrices1,
+                                        const float* __restrict partials2,
+                                        const float* __restrict matrices2,
+                                        const float* __restrict scaleFactors,
+                                        int startPattern,
+                                        int endPattern);
+
+    void calcStatesPartialsTransposed(float* __restrict destP,
+                                      const int* states1,
+                                      const float* __restrict matrices1,
+                                      const float* __restrict partials2,
+                                      const float* __restrict matrices2,
+                                      const float* __restrict scaleFactors,
+                                      int startPattern,
+                                      int endPattern);
 
+    // site log likelihoods, before scaling, from the category-integrated partials in integrationTmp
+    void calcSiteLogLikelihoods(const float* freqs);
 
 };
 
@@ -155,6 +210,8 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::hasTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::getTipStates;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kCategoryCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::gScaleBuffers;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::gCategoryWeights;
@@ -242,6 +299,20 @@ public:
 
     virtual const char* getName();
     virtual const long getFlags();
+
+    virtual int estimateMemory(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long long* outHostBytes,
+                               long long* outDeviceBytes);
 };
 
 }	// namespace cpu
@@ -537,6 +537,392 @@ int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
 }
     
+///////////////////////////////////////////////////////////////////////////////
+// Single precision
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getTransposedRowLength() {
+    return (kStateCount + FLOATS_PER_VEC - 1) & ~(FLOATS_PER_VEC - 1);
+}
+
+/*
+ * Row j of the transposed matrix of a category holds column j of the
+ * transition matrix, i.e. the probabilities of all parent states i given
+ * child state j; row kStateCount holds the padded column of ones.
+ */
+BEAGLE_CPU_SSE_TEMPLATE
+float* BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::createTransposedMatrices(const float* matrices) {
+
+    const int rowLength = getTransposedRowLength();
+    const int rowCount = kStateCount + T_PAD;
+    const int matrixIncr = kStateCount + T_PAD;
+
+    float* transposed = (float*) _mm_malloc(sizeof(float) * kCategoryCount * rowCount * rowLength, 16);
+    if (transposed == NULL)
+        throw std::bad_alloc();
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const float* matrix = matrices + l * kMatrixSize;
+        float* dest = transposed + l * rowCount * rowLength;
+        for (int j = 0; j < rowCount; j++) {
+            int i = 0;
+            for (; i < kStateCount; i++)
+                dest[i] = matrix[i * matrixIncr + j];
+            for (; i < rowLength; i++)
+                dest[i] = 0.0f;
+            dest += rowLength;
+        }
+    }
+
+    return transposed;
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesPartialsTransposed(float* __restrict destP,
+                                                                          const int* states1,
+                                                                          const float* __restrict matrices1,
+                                                                          const float* __restrict partials2,
+                                                                          const float* __restrict matrices2,
+                                                                          const float* __restrict scaleFactors,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+
+    const int rowLength = getTransposedRowLength();
+    const int matrixLength = (kStateCount + T_PAD) * rowLength;
+    const int stateCountModTwo = (kStateCount / 2) * 2;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const float* mt1 = matrices1 + l * matrixLength;
+        const float* mt2 = matrices2 + l * matrixLength;
+        for (int k = startPattern; k < endPattern; k++) {
+            const float* mtState1 = mt1 + states1[k] * rowLength;
+            const float* partials2Ptr = partials2 + v;
+            const V_Float oneOverScaleFactor = FVEC_SPLAT(scaleFactors ? 1.0f / scaleFactors[k] : 1.0f);
+
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                V_Float sumA = FVEC_SETZERO();
+                V_Float sumB = FVEC_SETZERO();
+                const float* mt2Ptr = mt2 + i;
+                int j = 0;
+                for (; j < stateCountModTwo; j += 2) {
+                    sumA = FVEC_MADD(FVEC_LOAD(mt2Ptr), FVEC_SPLAT(partials2Ptr[j]), sumA);
+                    sumB = FVEC_MADD(FVEC_LOAD(mt2Ptr + rowLength), FVEC_SPLAT(partials2Ptr[j + 1]), sumB);
+                    mt2Ptr += 2 * rowLength;
+                }
+                for (; j < kStateCount; j++) {
+                    sumA = FVEC_MADD(FVEC_LOAD(mt2Ptr), FVEC_SPLAT(partials2Ptr[j]), sumA);
+                }
+
+                V_Float dest = FVEC_MULT(FVEC_MULT(FVEC_LOAD(mtState1 + i), FVEC_ADD(sumA, sumB)),
+                                         oneOverScaleFactor);
+                if (i + FLOATS_PER_VEC <= kStateCount)
+                    FVEC_STOREU(destP + v + i, dest);
+                else
+                    FVEC_STORE_FIRST(destP + v + i, kStateCount - i, dest);
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsTransposed(float* __restrict destP,
+                                                                            const float* __restrict partials1,
+                                                                            const float* __restrict matrices1,
+                                                                            const float* __restrict partials2,
+                                                                            const float* __restrict matrices2,
+                                                                            const float* __restrict scaleFactors,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+
+    const int rowLength = getTransposedRowLength();
+    const int matrixLength = (kStateCount + T_PAD) * rowLength;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        const float* mt1 = matrices1 + l * matrixLength;
+        const float* mt2 = matrices2 + l * matrixLength;
+        for (int k = startPattern; k < endPattern; k++) {
+            const float* partials1Ptr = partials1 + v;
+            const float* partials2Ptr = partials2 + v;
+            const V_Float oneOverScaleFactor = FVEC_SPLAT(scaleFactors ? 1.0f / scaleFactors[k] : 1.0f);
+
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                V_Float sum1 = FVEC_SETZERO();
+                V_Float sum2 = FVEC_SETZERO();
+                const float* mt1Ptr = mt1 + i;
+                const float* mt2Ptr = mt2 + i;
+                for (int j = 0; j < kStateCount; j++) {
+                    sum1 = FVEC_MADD(FVEC_LOAD(mt1Ptr), FVEC_SPLAT(partials1Ptr[j]), sum1);
+                    sum2 = FVEC_MADD(FVEC_LOAD(mt2Ptr), FVEC_SPLAT(partials2Ptr[j]), sum2);
+                    mt1Ptr += rowLength;
+                    mt2Ptr += rowLength;
+                }
+
+                V_Float dest = FVEC_MULT(FVEC_MULT(sum1, sum2), oneOverScaleFactor);
+                if (i + FLOATS_PER_VEC <= kStateCount)
+                    FVEC_STOREU(destP + v + i, dest);
+                else
+                    FVEC_STORE_FIRST(destP + v + i, kStateCount - i, dest);
+            }
+            v += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesPartials(float* destP,
+                                                                const int* states1,
+                                                                const float* matrices1,
+                                                                const float* partials2,
+                                                                const float* matrices2,
+                                                                int startPattern,
+                                                                int endPattern) {
+
+    float* mt1 = createTransposedMatrices(matrices1);
+    float* mt2 = createTransposedMatrices(matrices2);
+
+    calcStatesPartialsTransposed(destP, states1, mt1, partials2, mt2, NULL, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
+                                                                            const int* states1,
+                                                                            const float* matrices1,
+                                                                            const float* partials2,
+                                                                            const float* matrices2,
+                                                                            const float* scaleFactors,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+
+    float* mt1 = createTransposedMatrices(matrices1);
+    float* mt2 = createTransposedMatrices(matrices2);
+
+    calcStatesPartialsTransposed(destP, states1, mt1, partials2, mt2, scaleFactors, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartials(float* __restrict destP,
+                                                                  const float* __restrict partials1,
+                                                                  const float* __restrict matrices1,
+                                                                  const float* __restrict partials2,
+                                                                  const float* __restrict matrices2,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+
+    float* mt1 = createTransposedMatrices(matrices1);
+    float* mt2 = createTransposedMatrices(matrices2);
+
+    calcPartialsPartialsTransposed(destP, partials1, mt1, partials2, mt2, NULL, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsFixedScaling(float* __restrict destP,
+                                                                              const float* __restrict partials1,
+                                                                              const float* __restrict matrices1,
+                                                                              const float* __restrict partials2,
+                                                                              const float* __restrict matrices2,
+                                                                              const float* __restrict scaleFactors,
+                                                                              int startPattern,
+                                                                              int endPattern) {
+
+    float* mt1 = createTransposedMatrices(matrices1);
+    float* mt2 = createTransposedMatrices(matrices2);
+
+    calcPartialsPartialsTransposed(destP, partials1, mt1, partials2, mt2, scaleFactors, startPattern, endPattern);
+
+    _mm_free(mt2);
+    _mm_free(mt1);
+}
+
+/*
+ * The exponent test of the scalar version, |exponent| > scalingExponentThreshold,
+ * expressed as bounds on the partials.
+ */
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsAutoScaling(float* __restrict destP,
+                                                                             const float* __restrict partials1,
+                                                                             const float* __restrict matrices1,
+                                                                             const float* __restrict partials2,
+                                                                             const float* __restrict matrices2,
+                                                                             int* activateScaling) {
+
+    calcPartialsPartials(destP, partials1, matrices1, partials2, matrices2, 0, kPatternCount);
+
+    if (*activateScaling != 0)
+        return;
+
+    const float upper = ldexpf(1.0f, scalingExponentThreshold);
+    const float lower = ldexpf(1.0f, -scalingExponentThreshold - 1);
+    for (int l = 0; l < kCategoryCount; l++) {
+        int u = l*kPartialsPaddedStateCount*kPatternCount;
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i++) {
+                const float x = fabsf(destP[u + i]);
+                if (x >= upper || (x < lower && x != 0.0f)) {
+                    *activateScaling = 1;
+                    return;
+                }
+            }
+            u += kPartialsPaddedStateCount;
+        }
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcSiteLogLikelihoods(const float* freqs) {
+
+    const int stateCountModFour = (kStateCount / FLOATS_PER_VEC) * FLOATS_PER_VEC;
+    int u = 0;
+    for (int k = 0; k < kPatternCount; k++) {
+        V_Float sumOverI = FVEC_SETZERO();
+        int i = 0;
+        for (; i < stateCountModFour; i += FLOATS_PER_VEC)
+            sumOverI = FVEC_MADD(FVEC_LOADU(freqs + i), FVEC_LOADU(integrationTmp + u + i), sumOverI);
+        if (i < kStateCount)
+            sumOverI = FVEC_MADD(FVEC_LOAD_FIRST(freqs + i, kStateCount - i),
+                                 FVEC_LOAD_FIRST(integrationTmp + u + i, kStateCount - i), sumOverI);
+
+        outLogLikelihoodsTmp[k] = FVEC_SUM(sumOverI);
+        u += kStateCount;
+    }
+    vectorLog(outLogLikelihoodsTmp, kPatternCount);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcRootLogLikelihoods(const int bufferIndex,
+                                                                   const int categoryWeightsIndex,
+                                                                   const int stateFrequenciesIndex,
+                                                                   const int scalingFactorsIndex,
+                                                                   double* outSumLogLikelihood) {
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const float* rootPartials = gPartials[bufferIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const int stateCountModFour = (kStateCount / FLOATS_PER_VEC) * FLOATS_PER_VEC;
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    int v = 0;
+    for (int l = 0; l < kCategoryCount; l++) {
+        int u = 0;
+        const V_Float weight = FVEC_SPLAT(wt[l]);
+        for (int k = 0; k < kPatternCount; k++) {
+            int i = 0;
+            for (; i < stateCountModFour; i += FLOATS_PER_VEC)
+                FVEC_STOREU(integrationTmp + u + i,
+                            FVEC_MADD(FVEC_LOADU(rootPartials + v + i), weight,
+                                      FVEC_LOADU(integrationTmp + u + i)));
+            for (; i < kStateCount; i++)
+                integrationTmp[u + i] += rootPartials[v + i] * wt[l];
+            u += kStateCount;
+            v += kPartialsPaddedStateCount;
+        }
+    }
+
+    calcSiteLogLikelihoods(freqs);
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                   const int childIndex,
+                                                                   const int probIndex,
+                                                                   const int categoryWeightsIndex,
+                                                                   const int stateFrequenciesIndex,
+                                                                   const int scalingFactorsIndex,
+                                                                   double* outSumLogLikelihood) {
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    assert(parIndex >= kTipCount);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    const float* partialsParent = gPartials[parIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    const int rowLength = getTransposedRowLength();
+    const int matrixLength = (kStateCount + T_PAD) * rowLength;
+
+    float* mt = createTransposedMatrices(gTransitionMatrices[probIndex]);
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    const bool stateChild = (childIndex < kTipCount && hasTipStates(childIndex));
+    const int* statesChild = stateChild ? getTipStates(childIndex) : NULL;
+    const float* partialsChild = stateChild ? NULL : gPartials[childIndex];
+
+    int v = 0; // Index for parent partials
+    for (int l = 0; l < kCategoryCount; l++) {
+        int u = 0; // Index in resulting product-partials (summed over categories)
+        const V_Float weight = FVEC_SPLAT(wt[l]);
+        const float* mtCategory = mt + l * matrixLength;
+        for (int k = 0; k < kPatternCount; k++) {
+            for (int i = 0; i < kStateCount; i += FLOATS_PER_VEC) {
+                V_Float sumOverJ;
+                if (stateChild) { // Integrate against a state at the child
+                    sumOverJ = FVEC_LOAD(mtCategory + statesChild[k] * rowLength + i);
+                } else { // Integrate against a partial at the child
+                    const float* partialsChildPtr = partialsChild + v;
+                    const float* mtPtr = mtCategory + i;
+                    sumOverJ = FVEC_SETZERO();
+                    for (int j = 0; j < kStateCount; j++) {
+                        sumOverJ = FVEC_MADD(FVEC_LOAD(mtPtr), FVEC_SPLAT(partialsChildPtr[j]), sumOverJ);
+                        mtPtr += rowLength;
+                    }
+                }
+                if (i + FLOATS_PER_VEC <= kStateCount) {
+                    V_Float wtdPartials = FVEC_MULT(FVEC_LOADU(partialsParent + v + i), weight);
+                    FVEC_STOREU(integrationTmp + u + i,
+                                FVEC_MADD(sumOverJ, wtdPartials, FVEC_LOADU(integrationTmp + u + i)));
+                } else {
+                    const int n = kStateCount - i;
+                    V_Float wtdPartials = FVEC_MULT(FVEC_LOAD_FIRST(partialsParent + v + i, n), weight);
+                    FVEC_STORE_FIRST(integrationTmp + u + i, n,
+                                     FVEC_MADD(sumOverJ, wtdPartials, FVEC_LOAD_FIRST(integrationTmp + u + i, n)));
+                }
+            }
+            u += kStateCount;
+            v += kPartialsPaddedStateCount;
+        }
+    }
+
+    _mm_free(mt);
+
+    calcSiteLogLikelihoods(freqs);
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(scalingFactorsIndex, 0, kPatternCount);
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getPaddedPatternsModulus() {
+	return 1;  // We currently do not vectorize across patterns
+}
+
 BEAGLE_CPU_SSE_TEMPLATE
 const char* BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getName() {
 	return  getBeagleCPUSSEName<float>();
@@ -635,6 +1021,37 @@ BeagleImpl* BeagleCPUSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int
     return NULL;
 }
 
+BEAGLE_CPU_FACTORY_TEMPLATE
+int BeagleCPUSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::estimateMemory(int tipCount,
+                                                                        int partialsBufferCount,
+                                                                        int compactBufferCount,
+                                                                        int stateCount,
+                                                                        int patternCount,
+                                                                        int eigenBufferCount,
+                                                                        int matrixBufferCount,
+                                                                        int categoryCount,
+                                                                        int scaleBufferCount,
+                                                                        long preferenceFlags,
+                                                                        long requirementFlags,
+                                                                        long long* outHostBytes,
+                                                                        long long* outDeviceBytes) {
+    if (!CPUSupportsSSE())
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (stateCount & 1)
+        *outHostBytes = BeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_ODD, P_PAD_SSE_ODD>::getInstanceBytes(
+                            tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                            patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                            scaleBufferCount, preferenceFlags, requirementFlags);
+    else
+        *outHostBytes = BeagleCPUSSEImpl<REALTYPE, T_PAD_SSE_EVEN, P_PAD_SSE_EVEN>::getInstanceBytes(
+                            tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                            patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                            scaleBufferCount, preferenceFlags, requirementFlags);
+    *outDeviceBytes = 0;
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_FACTORY_TEMPLATE
 const char* BeagleCPUSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 	return getBeagleCPUSSEName<BEAGLE_CPU_FACTORY_GENERIC>();
@@ -644,7 +1061,7 @@ template <>
 const long BeagleCPUSSEImplFactory<double>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_CPU_OPENMP_THREADING_FLAG |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -658,7 +1075,7 @@ template <>
 const long BeagleCPUSSEImplFactory<float>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_CPU_OPENMP_THREADING_FLAG |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_SINGLE |
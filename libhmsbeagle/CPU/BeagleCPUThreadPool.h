@@ -0,0 +1,364 @@
+/*
+ *  BeagleCPUThreadPool.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BeagleCPUThreadPool__
+#define __BeagleCPUThreadPool__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <exception>
+
+#include "libhmsbeagle/TraceRecorder.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define BEAGLE_CPU_SPIN_PAUSE() _mm_pause()
+#elif defined(__aarch64__)
+#define BEAGLE_CPU_SPIN_PAUSE() __asm__ __volatile__("yield")
+#else
+#define BEAGLE_CPU_SPIN_PAUSE() std::this_thread::yield()
+#endif
+
+// pause instructions issued while spinning before the thread starts yielding
+#define BEAGLE_CPU_SPIN_PAUSE_ROUNDS 1024
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Spins until ready() holds or spinMicroseconds have passed, first with pause
+ * instructions and then by yielding the processor; returns ready().
+ */
+template <typename Predicate>
+inline bool spinUntil(int spinMicroseconds,
+                      Predicate ready) {
+    if (spinMicroseconds <= 0)
+        return ready();
+
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::microseconds(spinMicroseconds);
+    for (int round = 0; ; round++) {
+        if (ready())
+            return true;
+        if (round < BEAGLE_CPU_SPIN_PAUSE_ROUNDS) {
+            BEAGLE_CPU_SPIN_PAUSE();
+        } else {
+            std::this_thread::yield();
+        }
+        if ((round & 63) == 63 && std::chrono::steady_clock::now() >= deadline)
+            return ready();
+    }
+}
+
+/*
+ * Tracks completion of a set of jobs submitted to a ThreadPool.
+ *
+ * The pending count and a flag telling that the waiter sleeps share one
+ * atomic word: jobs finishing while the waiter spins only decrement it, and
+ * the mutex and condition variable are used once the waiter has gone to sleep.
+ */
+class ThreadPoolTaskGroup {
+public:
+    ThreadPoolTaskGroup() : state(0), spinMicroseconds(0), error(nullptr) {}
+
+    // Blocks until every job of the group has run; rethrows the first
+    // exception raised by a job, if any
+    void wait() {
+        if (!spinUntil(spinMicroseconds, [this] () { return state.load() == 0; })) {
+            std::unique_lock<std::mutex> l(m);
+            int s = state.load();
+            while (s != 0 && !state.compare_exchange_weak(s, s | kSleeping)) {}
+            if (s != 0) {
+                cv.wait(l, [this] () { return state.load() == kSleeping; });
+                state.store(0);
+            }
+        }
+
+        std::unique_lock<std::mutex> l(m);
+        if (error) {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+private:
+    friend class ThreadPool;
+
+    static const int kSleeping = 1 << 30;
+
+    void add() {
+        state++;
+    }
+
+    // The group may be destroyed as soon as the count reaches zero, so
+    // nothing here touches it after the final decrement
+    void done(std::exception_ptr e) {
+        if (e) {
+            std::unique_lock<std::mutex> l(m);
+            if (!error)
+                error = e;
+        }
+
+        int s = state.load();
+        while (true) {
+            if (s & kSleeping) {
+                std::unique_lock<std::mutex> l(m);
+                if (--state == kSleeping)
+                    cv.notify_all();
+                return;
+            }
+            if (state.compare_exchange_weak(s, s - 1))
+                return;
+        }
+    }
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::atomic<int> state;
+    int spinMicroseconds;
+    std::exception_ptr error;
+};
+
+/*
+ * Work-stealing pool: each worker owns a deque of jobs and takes work from
+ * its front; a worker whose deque is empty steals from the back of the
+ * other workers' deques before going to sleep.
+ *
+ * A pinned pool binds worker i to the i-th processor the process may run on
+ * and never steals, so a job always runs on the worker it was queued on and
+ * touches memory on that worker's NUMA node.
+ *
+ * With a spin time set, an idle worker and a thread waiting on a task group
+ * spin for that long before blocking, so that the short parallel sections
+ * issued back to back by a likelihood evaluation do not pay for a sleep and
+ * wakeup each; submitting only takes the sleep mutex when a worker sleeps.
+ */
+class ThreadPool {
+public:
+    ThreadPool(int threadCount,
+               bool pinThreads = false) : kThreadCount(threadCount), kPinned(pinThreads),
+                                          trace(NULL), spinMicroseconds(0), queuedJobs(0),
+                                          sleepingWorkers(0), stop(false) {
+        if (kThreadCount < 1)
+            kThreadCount = 1;
+
+        workers = new workerData[kThreadCount];
+        for (int i = 0; i < kThreadCount; i++) {
+            workers[i].t = std::thread(&ThreadPool::workerLoop, this, i);
+        }
+
+        if (kPinned)
+            pinWorkers();
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> l(sleepMutex);
+            stop = true;
+        }
+        sleepCv.notify_all();
+
+        for (int i = 0; i < kThreadCount; i++) {
+            workers[i].t.join();
+        }
+
+        delete[] workers;
+    }
+
+    int getThreadCount() const { return kThreadCount; }
+
+    bool isPinned() const { return kPinned; }
+
+    // Records each job run from now on as a span of its worker, or stops with NULL
+    void setTrace(TraceRecorder* recorder) { trace = recorder; }
+
+    // Sets how long idle workers and waiting threads spin before blocking
+    void setSpinTime(int microseconds) { spinMicroseconds = (microseconds > 0 ? microseconds : 0); }
+
+    int getSpinTime() const { return spinMicroseconds; }
+
+    // Queues a job on the deque of worker (preferredWorker % threadCount);
+    // idle workers are free to steal it
+    void submit(ThreadPoolTaskGroup& group,
+                std::function<void()> job,
+                int preferredWorker) {
+        group.add();
+        group.spinMicroseconds = spinMicroseconds;
+
+        workerData* w = &workers[preferredWorker % kThreadCount];
+        {
+            std::unique_lock<std::mutex> l(w->m);
+            w->jobs.push_back(jobData(&group, std::move(job)));
+        }
+        queuedJobs++;
+        w->queuedJobs++;
+        if (sleepingWorkers.load() == 0)
+            return;
+
+        // a worker between its last look at the queues and its wait holds
+        // sleepMutex, so taking it here orders the wakeup after that wait
+        {
+            std::unique_lock<std::mutex> l(sleepMutex);
+        }
+        // a pinned pool cannot hand the job to whichever worker wakes up
+        if (kPinned)
+            sleepCv.notify_all();
+        else
+            sleepCv.notify_one();
+    }
+
+private:
+    struct jobData {
+        jobData() : group(NULL) {}
+        jobData(ThreadPoolTaskGroup* g, std::function<void()>&& f) : group(g), fn(std::move(f)) {}
+        ThreadPoolTaskGroup* group;
+        std::function<void()> fn;
+    };
+
+    struct workerData {
+        workerData() : queuedJobs(0) {}
+        std::thread t;
+        std::deque<jobData> jobs;
+        std::mutex m;
+        std::atomic<int> queuedJobs;
+    };
+
+    bool popLocal(int index, jobData& job) {
+        workerData* w = &workers[index];
+        std::unique_lock<std::mutex> l(w->m);
+        if (w->jobs.empty())
+            return false;
+        job = std::move(w->jobs.front());
+        w->jobs.pop_front();
+        w->queuedJobs--;
+        return true;
+    }
+
+    bool steal(int thief, jobData& job) {
+        if (kPinned)
+            return false;
+        for (int i = 1; i < kThreadCount; i++) {
+            workerData* w = &workers[(thief + i) % kThreadCount];
+            std::unique_lock<std::mutex> l(w->m, std::try_to_lock);
+            if (l.owns_lock() && !w->jobs.empty()) {
+                job = std::move(w->jobs.back());
+                w->jobs.pop_back();
+                w->queuedJobs--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int index) {
+        jobData job;
+        while (true) {
+            if (popLocal(index, job) || steal(index, job)) {
+                queuedJobs--;
+
+                std::exception_ptr e = nullptr;
+                try {
+                    TraceScope span(trace, "task", "cpu");
+                    job.fn();
+                } catch (...) {
+                    e = std::current_exception();
+                }
+                job.fn = nullptr;
+                job.group->done(e);
+                continue;
+            }
+
+            std::atomic<int>& waitingJobs = (kPinned ? workers[index].queuedJobs : queuedJobs);
+            if (spinUntil(spinMicroseconds, [this, &waitingJobs] () { return stop || waitingJobs > 0; })) {
+                if (stop && waitingJobs <= 0)
+                    return;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> l(sleepMutex);
+            sleepingWorkers++;
+            sleepCv.wait(l, [this, &waitingJobs] () { return stop || waitingJobs > 0; });
+            sleepingWorkers--;
+            if (stop && waitingJobs <= 0)
+                return;
+        }
+    }
+
+    void pinWorkers() {
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0)
+            return;
+
+        std::vector<int> cpus;
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed))
+                cpus.push_back(c);
+        }
+        if (cpus.empty())
+            return;
+
+        for (int i = 0; i < kThreadCount; i++) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpus[i % cpus.size()], &cpuset);
+            pthread_setaffinity_np(workers[i].t.native_handle(), sizeof(cpu_set_t), &cpuset);
+        }
+#endif
+    }
+
+    int kThreadCount;
+    bool kPinned;
+    workerData* workers;
+    std::atomic<TraceRecorder*> trace;
+
+    std::atomic<int> spinMicroseconds;
+
+    // a submitter increments queuedJobs before reading sleepingWorkers and a
+    // worker increments sleepingWorkers before reading queuedJobs, so at
+    // least one of them sees the other and no submission is missed
+    std::atomic<int> queuedJobs;
+    std::atomic<int> sleepingWorkers;
+    std::atomic<bool> stop;
+    std::mutex sleepMutex;
+    std::condition_variable sleepCv;
+};
+
+}   // namespace cpu
+}   // namespace beagle
+
+#endif // __BeagleCPUThreadPool__
@@ -16,6 +16,8 @@
 #include <cassert>
 #include <vector>
 
+#include "libhmsbeagle/CPU/BeagleCPUThreadPool.h"
+
 #define BEAGLE_CPU_EIGEN_GENERIC	REALTYPE, T_PAD
 #define BEAGLE_CPU_EIGEN_TEMPLATE	template <typename REALTYPE, int T_PAD>
 
@@ -34,6 +36,7 @@ protected:
     REALTYPE* matrixTmp;
     REALTYPE* firstDerivTmp;
     REALTYPE* secondDerivTmp;
+    ThreadPool* gThreadPool;
     
 public:
 	EigenDecomposition(int decompositionCount,
@@ -46,9 +49,14 @@ public:
 					   		kStateCount = stateCount;
 					   		kCategoryCount = categoryCount;
                             kFlags = flags;
+                            gThreadPool = NULL;
 					   	};
 	
 	virtual ~EigenDecomposition() {};
+
+    // sets the pool whose workers may share the work of the following updates; NULL keeps
+    // them on the calling thread
+    void setThreadPool(ThreadPool* pool) { gThreadPool = pool; }
 	
     // sets the Eigen decomposition for a given matrix
     //
@@ -84,6 +92,18 @@ public:
                                  REALTYPE** transitionMatrices,
                                  int count) = 0;
 
+    // calculates the matrices of replicateCount replicates, each owning an equal block of the
+    // categories: category l belongs to replicate r = l / (kCategoryCount / replicateCount), is
+    // computed from the decomposition eigenIndices[r] scaled by categoryRates[l], and edge u of
+    // it has length edgeLengths[u * replicateCount + r]
+    virtual void updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                 const double* categoryRates,
+                                 const int* probabilityIndices,
+                                 const double* edgeLengths,
+                                 int replicateCount,
+                                 REALTYPE** transitionMatrices,
+                                 int count) = 0;
+
 
 };
 
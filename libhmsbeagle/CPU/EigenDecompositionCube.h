@@ -10,6 +10,12 @@
 
 #include "libhmsbeagle/CPU/EigenDecomposition.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define BEAGLE_CPU_EIGEN_MIN_PARALLEL_WORK     262144  // do not spread transition matrix updates with fewer multiply-adds across threads
+
 namespace beagle {
 namespace cpu {
 
@@ -24,9 +30,11 @@ class EigenDecompositionCube : public EigenDecomposition<BEAGLE_CPU_EIGEN_GENERI
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::firstDerivTmp;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::secondDerivTmp;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kFlags;
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::gThreadPool;
 
 protected:
     REALTYPE** gCMatrices;
+    double* exponentTmp;
 
 public:
 	EigenDecompositionCube(int decompositionCount, 
@@ -57,6 +65,79 @@ public:
                                  const double* edgeLengths,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual void updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                 const double* categoryRates,
+                                 const int* probabilityIndices,
+                                 const double* edgeLengths,
+                                 int replicateCount,
+                                 REALTYPE** transitionMatrices,
+                                 int count);
+
+private:
+    // computes the matrices of count edges, category l from the decomposition eigenIndices[l]
+    // (eigenIndex for NULL eigenIndices) with its eigenvalues scaled by categoryRates[l] (1 for
+    // NULL categoryRates); each edge has replicateCount lengths, one per equal block of the
+    // categories. Spread across the workers of gThreadPool for large counts
+    void updateMatrices(int eigenIndex,
+                        const int* eigenIndices,
+                        const double* categoryRates,
+                        const int* probabilityIndices,
+                        const int* firstDerivativeIndices,
+                        const int* secondDerivativeIndices,
+                        const double* edgeLengths,
+                        int replicateCount,
+                        REALTYPE** transitionMatrices,
+                        int count);
+
+    // computes the matrices begin to end - 1 of updateMatrices, matrix m being category
+    // m % kCategoryCount of edge m / kCategoryCount; each scratch array holds kStateCount values
+    void updateMatricesRange(int eigenIndex,
+                             const int* eigenIndices,
+                             const double* categoryRates,
+                             const int* probabilityIndices,
+                             const int* firstDerivativeIndices,
+                             const int* secondDerivativeIndices,
+                             const double* edgeLengths,
+                             int replicateCount,
+                             REALTYPE** transitionMatrices,
+                             int begin,
+                             int end,
+                             double* exponentTmp,
+                             REALTYPE* expTmp,
+                             REALTYPE* firstDerivExpTmp,
+                             REALTYPE* secondDerivExpTmp);
+
+    // sums x[k] * y[k] for k < n
+    static inline double sumProducts(const double* x,
+                                     const double* y,
+                                     int n) {
+        int k = 0;
+        double sum = 0.0;
+#if defined(__SSE2__)
+        __m128d sum0 = _mm_setzero_pd();
+        __m128d sum1 = _mm_setzero_pd();
+        for (; k + 4 <= n; k += 4) {
+            sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(x + k), _mm_loadu_pd(y + k)));
+            sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(x + k + 2), _mm_loadu_pd(y + k + 2)));
+        }
+        double partialSums[2];
+        _mm_storeu_pd(partialSums, _mm_add_pd(sum0, sum1));
+        sum = partialSums[0] + partialSums[1];
+#endif
+        for (; k < n; k++)
+            sum += x[k] * y[k];
+        return sum;
+    }
+
+    static inline float sumProducts(const float* x,
+                                    const float* y,
+                                    int n) {
+        float sum = 0.0;
+        for (int k = 0; k < n; k++)
+            sum += x[k] * y[k];
+        return sum;
+    }
 };
 
 }
@@ -8,6 +8,7 @@
 #define _EigenDecompositionCube_hpp_
 
 #include "libhmsbeagle/CPU/EigenDecompositionCube.h"
+#include "libhmsbeagle/CPU/VectorMath.h"
 
 
 namespace beagle {
@@ -49,6 +50,7 @@ EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::EigenDecompositionCube(int dec
     matrixTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
     firstDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
     secondDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
+    exponentTmp = (double*) malloc(sizeof(double) * kStateCount);
 }
 
 BEAGLE_CPU_EIGEN_TEMPLATE
@@ -63,6 +65,7 @@ EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::~EigenDecompositionCube() {
 	free(matrixTmp);
 	free(firstDerivTmp);
 	free(secondDerivTmp);
+	free(exponentTmp);
 }
 
 BEAGLE_CPU_EIGEN_TEMPLATE
@@ -99,8 +102,6 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(int
 
 }
     
-#define UNROLL
-
 BEAGLE_CPU_EIGEN_TEMPLATE
 void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(int eigenIndex,
                                                       const int* probabilityIndices,
@@ -110,146 +111,8 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(
                                                       const double* categoryRates,
                                                       REALTYPE** transitionMatrices,
                                                       int count) {
-#ifdef UNROLL													  
-	int stateCountModFour = (kStateCount / 4) * 4;
-#endif
-													  
-	if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-                for (int i = 0; i < kStateCount; i++) {
-					matrixTmp[i] = exp(gEigenValues[eigenIndex][i] * ((REALTYPE)edgeLengths[u] * categoryRates[l]));
-                }
-				
-                REALTYPE* tmpCMatrices = gCMatrices[eigenIndex];
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-#ifdef UNROLL						
-						int k = 0;
-						for (; k < stateCountModFour; k += 4) {
-							sum += tmpCMatrices[k + 0] * matrixTmp[k + 0];
-							sum += tmpCMatrices[k + 1] * matrixTmp[k + 1];
-							sum += tmpCMatrices[k + 2] * matrixTmp[k + 2];
-							sum += tmpCMatrices[k + 3] * matrixTmp[k + 3];
-						}
-						for (; k < kStateCount; k++) {
-							sum += tmpCMatrices[k] * matrixTmp[k];
-						}
-						tmpCMatrices += kStateCount;
-#else
-						for (int k = 0; k < kStateCount; k++) {
-							sum += *tmpCMatrices++ * matrixTmp[k];
-						}
-#endif						
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						n++;
-					}
-if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-					n += T_PAD;
-}
-				}
-			}
-			
-			if (DEBUGGING_OUTPUT) {
-                int kMatrixSize = kStateCount * kStateCount;
-				fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u]);
-				for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
-					fprintf(stderr,"transitionMat[%d] = %.5f\n", w, transitionMat[w]);
-			}
-		}
-        
-
-	} else if (secondDerivativeIndices == NULL) {
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			REALTYPE* firstDerivMat = transitionMatrices[firstDerivativeIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-				for (int i = 0; i < kStateCount; i++) {
-					REALTYPE scaledEigenValue = gEigenValues[eigenIndex][i] * ((REALTYPE)categoryRates[l]);
-					matrixTmp[i] = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
-					firstDerivTmp[i] = scaledEigenValue * matrixTmp[i];
-				}
-				
-				int m = 0;
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-						REALTYPE sumD1 = 0.0;
-						for (int k = 0; k < kStateCount; k++) {
-							sum += gCMatrices[eigenIndex][m] * matrixTmp[k];
-							sumD1 += gCMatrices[eigenIndex][m] * firstDerivTmp[k];
-							m++;
-						}
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						firstDerivMat[n] = sumD1;
-						n++;
-					}
-if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-                    firstDerivMat[n] = 0.0;
-					n += T_PAD;
-}
-				}
-			}
-		}
-	} else {		
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			REALTYPE* firstDerivMat = transitionMatrices[firstDerivativeIndices[u]];
-			REALTYPE* secondDerivMat = transitionMatrices[secondDerivativeIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-				for (int i = 0; i < kStateCount; i++) {
-					REALTYPE scaledEigenValue = gEigenValues[eigenIndex][i] * ((REALTYPE)categoryRates[l]);
-					matrixTmp[i] = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
-					firstDerivTmp[i] = scaledEigenValue * matrixTmp[i];
-					secondDerivTmp[i] = scaledEigenValue * firstDerivTmp[i];
-				}
-				
-				int m = 0;
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-						REALTYPE sumD1 = 0.0;
-						REALTYPE sumD2 = 0.0;
-						for (int k = 0; k < kStateCount; k++) {
-							sum += gCMatrices[eigenIndex][m] * matrixTmp[k];
-							sumD1 += gCMatrices[eigenIndex][m] * firstDerivTmp[k];
-							sumD2 += gCMatrices[eigenIndex][m] * secondDerivTmp[k];
-							m++;
-						}
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						firstDerivMat[n] = sumD1;
-						secondDerivMat[n] = sumD2;
-						n++;
-					}
-if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-                    firstDerivMat[n] = 0.0;
-                    secondDerivMat[n] = 0.0;
-					n += T_PAD;
-}
-				}
-			}
-		}
-	}
+    updateMatrices(eigenIndex, NULL, categoryRates, probabilityIndices, firstDerivativeIndices,
+                   secondDerivativeIndices, edgeLengths, 1, transitionMatrices, count);
 }
 
 
@@ -261,146 +124,157 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesW
                                                       const double* edgeLengths,
                                                       REALTYPE** transitionMatrices,
                                                       int count) {
-#ifdef UNROLL													  
-	int stateCountModFour = (kStateCount / 4) * 4;
-#endif
-													  
-	if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-                for (int i = 0; i < kStateCount; i++) {
-					matrixTmp[i] = exp(gEigenValues[eigenIndices[l]][i] * ((REALTYPE)edgeLengths[u]));
-                }
-				
-                REALTYPE* tmpCMatrices = gCMatrices[eigenIndices[l]];
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-#ifdef UNROLL						
-						int k = 0;
-						for (; k < stateCountModFour; k += 4) {
-							sum += tmpCMatrices[k + 0] * matrixTmp[k + 0];
-							sum += tmpCMatrices[k + 1] * matrixTmp[k + 1];
-							sum += tmpCMatrices[k + 2] * matrixTmp[k + 2];
-							sum += tmpCMatrices[k + 3] * matrixTmp[k + 3];
-						}
-						for (; k < kStateCount; k++) {
-							sum += tmpCMatrices[k] * matrixTmp[k];
-						}
-						tmpCMatrices += kStateCount;
-#else
-						for (int k = 0; k < kStateCount; k++) {
-							sum += *tmpCMatrices++ * matrixTmp[k];
-						}
-#endif						
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						n++;
-					}
-if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-					n += T_PAD;
+    updateMatrices(0, eigenIndices, NULL, probabilityIndices, firstDerivativeIndices,
+                   secondDerivativeIndices, edgeLengths, 1, transitionMatrices, count);
 }
-				}
-			}
-			
-			if (DEBUGGING_OUTPUT) {
-                int kMatrixSize = kStateCount * kStateCount;
-				fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u]);
-				for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
-					fprintf(stderr,"transitionMat[%d] = %.5f\n", w, transitionMat[w]);
-			}
-		}
-        
 
-	} else if (secondDerivativeIndices == NULL) {
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			REALTYPE* firstDerivMat = transitionMatrices[firstDerivativeIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-				for (int i = 0; i < kStateCount; i++) {
-					REALTYPE scaledEigenValue = gEigenValues[eigenIndices[l]][i];
-					matrixTmp[i] = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
-					firstDerivTmp[i] = scaledEigenValue * matrixTmp[i];
-				}
-				
-				int m = 0;
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-						REALTYPE sumD1 = 0.0;
-						for (int k = 0; k < kStateCount; k++) {
-							sum += gCMatrices[eigenIndices[l]][m] * matrixTmp[k];
-							sumD1 += gCMatrices[eigenIndices[l]][m] * firstDerivTmp[k];
-							m++;
-						}
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						firstDerivMat[n] = sumD1;
-						n++;
-					}
-if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-                    firstDerivMat[n] = 0.0;
-					n += T_PAD;
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                                      const double* categoryRates,
+                                                      const int* probabilityIndices,
+                                                      const double* edgeLengths,
+                                                      int replicateCount,
+                                                      REALTYPE** transitionMatrices,
+                                                      int count) {
+    const int replicateCategoryCount = kCategoryCount / replicateCount;
+    std::vector<int> categoryEigenIndices(kCategoryCount);
+    for (int l = 0; l < kCategoryCount; l++)
+        categoryEigenIndices[l] = eigenIndices[l / replicateCategoryCount];
+    updateMatrices(0, &categoryEigenIndices[0], categoryRates, probabilityIndices, NULL, NULL,
+                   edgeLengths, replicateCount, transitionMatrices, count);
 }
-				}
-			}
-		}
-	} else {		
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			REALTYPE* firstDerivMat = transitionMatrices[firstDerivativeIndices[u]];
-			REALTYPE* secondDerivMat = transitionMatrices[secondDerivativeIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-				for (int i = 0; i < kStateCount; i++) {
-					REALTYPE scaledEigenValue = gEigenValues[eigenIndices[l]][i];
-					matrixTmp[i] = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
-					firstDerivTmp[i] = scaledEigenValue * matrixTmp[i];
-					secondDerivTmp[i] = scaledEigenValue * firstDerivTmp[i];
-				}
-				
-				int m = 0;
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-						REALTYPE sumD1 = 0.0;
-						REALTYPE sumD2 = 0.0;
-						for (int k = 0; k < kStateCount; k++) {
-							sum += gCMatrices[eigenIndices[l]][m] * matrixTmp[k];
-							sumD1 += gCMatrices[eigenIndices[l]][m] * firstDerivTmp[k];
-							sumD2 += gCMatrices[eigenIndices[l]][m] * secondDerivTmp[k];
-							m++;
-						}
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						firstDerivMat[n] = sumD1;
-						secondDerivMat[n] = sumD2;
-						n++;
-					}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateMatrices(int eigenIndex,
+                                                      const int* eigenIndices,
+                                                      const double* categoryRates,
+                                                      const int* probabilityIndices,
+                                                      const int* firstDerivativeIndices,
+                                                      const int* secondDerivativeIndices,
+                                                      const double* edgeLengths,
+                                                      int replicateCount,
+                                                      REALTYPE** transitionMatrices,
+                                                      int count) {
+    int matrixCount = count * kCategoryCount;
+    double work = (double) matrixCount * kStateCount * kStateCount * kStateCount;
+
+    if (gThreadPool == NULL || matrixCount < 2 || work < BEAGLE_CPU_EIGEN_MIN_PARALLEL_WORK) {
+        updateMatricesRange(eigenIndex, eigenIndices, categoryRates, probabilityIndices,
+                            firstDerivativeIndices, secondDerivativeIndices, edgeLengths,
+                            replicateCount, transitionMatrices, 0, matrixCount,
+                            exponentTmp, matrixTmp, firstDerivTmp, secondDerivTmp);
+    } else {
+        // every matrix costs the same, so each worker gets one contiguous block of them
+        int jobCount = gThreadPool->getThreadCount();
+        if (jobCount > matrixCount)
+            jobCount = matrixCount;
+
+        ThreadPoolTaskGroup group;
+        for (int j = 0; j < jobCount; j++) {
+            int begin = (int) (((long) matrixCount * j) / jobCount);
+            int end = (int) (((long) matrixCount * (j + 1)) / jobCount);
+            gThreadPool->submit(group, [=] () {
+                std::vector<double> exponents(kStateCount);
+                std::vector<REALTYPE> scratch(3 * kStateCount);
+                updateMatricesRange(eigenIndex, eigenIndices, categoryRates, probabilityIndices,
+                                    firstDerivativeIndices, secondDerivativeIndices, edgeLengths,
+                                    replicateCount, transitionMatrices, begin, end, &exponents[0],
+                                    &scratch[0], &scratch[kStateCount], &scratch[2 * kStateCount]);
+            }, j);
+        }
+        group.wait();
+    }
+
+    if (DEBUGGING_OUTPUT && firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
+        int kMatrixSize = kStateCount * kStateCount;
+        for (int u = 0; u < count; u++) {
+            REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
+            fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u * replicateCount]);
+            for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
+                fprintf(stderr,"transitionMat[%d] = %.5f\n", w, transitionMat[w]);
+        }
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateMatricesRange(int eigenIndex,
+                                                      const int* eigenIndices,
+                                                      const double* categoryRates,
+                                                      const int* probabilityIndices,
+                                                      const int* firstDerivativeIndices,
+                                                      const int* secondDerivativeIndices,
+                                                      const double* edgeLengths,
+                                                      int replicateCount,
+                                                      REALTYPE** transitionMatrices,
+                                                      int begin,
+                                                      int end,
+                                                      double* exponentTmp,
+                                                      REALTYPE* expTmp,
+                                                      REALTYPE* firstDerivExpTmp,
+                                                      REALTYPE* secondDerivExpTmp) {
+    const int categoryMatrixSize = kStateCount * (kStateCount + T_PAD);
+    const int replicateCategoryCount = kCategoryCount / replicateCount;
+
+    for (int m = begin; m < end; m++) {
+        int u = m / kCategoryCount;
+        int l = m % kCategoryCount;
+
+        int decompIndex = (eigenIndices == NULL ? eigenIndex : eigenIndices[l]);
+        double rate = (categoryRates == NULL ? 1.0 : categoryRates[l]);
+        double edgeLength = edgeLengths[u * replicateCount + l / replicateCategoryCount];
+        const REALTYPE* eigenValues = gEigenValues[decompIndex];
+
+        REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]] + l * categoryMatrixSize;
+        REALTYPE* firstDerivMat = NULL;
+        REALTYPE* secondDerivMat = NULL;
+        if (firstDerivativeIndices != NULL)
+            firstDerivMat = transitionMatrices[firstDerivativeIndices[u]] + l * categoryMatrixSize;
+        if (secondDerivativeIndices != NULL)
+            secondDerivMat = transitionMatrices[secondDerivativeIndices[u]] + l * categoryMatrixSize;
+
+        if (firstDerivMat == NULL) {
+            for (int i = 0; i < kStateCount; i++) {
+                exponentTmp[i] = eigenValues[i] * ((REALTYPE) edgeLength * rate);
+            }
+            vectorExp(exponentTmp, expTmp, kStateCount);
+        } else {
+            for (int i = 0; i < kStateCount; i++)
+                expTmp[i] = (eigenValues[i] * (REALTYPE) rate) * (REALTYPE) edgeLength;
+            vectorExp(expTmp, kStateCount);
+            for (int i = 0; i < kStateCount; i++) {
+                REALTYPE scaledEigenValue = eigenValues[i] * (REALTYPE) rate;
+                firstDerivExpTmp[i] = scaledEigenValue * expTmp[i];
+                if (secondDerivMat != NULL)
+                    secondDerivExpTmp[i] = scaledEigenValue * firstDerivExpTmp[i];
+            }
+        }
+
+        const REALTYPE* tmpCMatrices = gCMatrices[decompIndex];
+        int n = 0;
+        for (int i = 0; i < kStateCount; i++) {
+            for (int j = 0; j < kStateCount; j++) {
+                REALTYPE sum = sumProducts(tmpCMatrices, expTmp, kStateCount);
+                if (sum > 0)
+                    transitionMat[n] = sum;
+                else
+                    transitionMat[n] = 0;
+                if (firstDerivMat != NULL)
+                    firstDerivMat[n] = sumProducts(tmpCMatrices, firstDerivExpTmp, kStateCount);
+                if (secondDerivMat != NULL)
+                    secondDerivMat[n] = sumProducts(tmpCMatrices, secondDerivExpTmp, kStateCount);
+                tmpCMatrices += kStateCount;
+                n++;
+            }
 if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-                    firstDerivMat[n] = 0.0;
-                    secondDerivMat[n] = 0.0;
-					n += T_PAD;
+            transitionMat[n] = 1.0;
+            if (firstDerivMat != NULL)
+                firstDerivMat[n] = 0.0;
+            if (secondDerivMat != NULL)
+                secondDerivMat[n] = 0.0;
+            n += T_PAD;
 }
-				}
-			}
-		}
-	}
+        }
+    }
 }
 
 
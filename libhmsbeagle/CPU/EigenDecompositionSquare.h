@@ -58,6 +58,21 @@ public:
                                  const double* edgeLengths,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual void updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                 const double* categoryRates,
+                                 const int* probabilityIndices,
+                                 const double* edgeLengths,
+                                 int replicateCount,
+                                 REALTYPE** transitionMatrices,
+                                 int count);
+
+private:
+    // writes the matrix of one category, exp of the decomposition eigenIndex times distance,
+    // with its padding to transitionMat
+    void updateCategoryMatrix(int eigenIndex,
+                              REALTYPE distance,
+                              REALTYPE* transitionMat);
 };
 
 }
@@ -106,6 +106,64 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(i
         transposeSquareMatrix(gIMatrices[eigenIndex], kStateCount);
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateCategoryMatrix(int eigenIndex,
+                                                        REALTYPE distance,
+                                                        REALTYPE* transitionMat) {
+    const REALTYPE* Ievc = gIMatrices[eigenIndex];
+    const REALTYPE* Evec = gEMatrices[eigenIndex];
+    const REALTYPE* Eval = gEigenValues[eigenIndex];
+    const REALTYPE* EvalImag = Eval + kStateCount;
+    for(int i=0; i<kStateCount; i++) {
+        if (!isComplex || EvalImag[i] == 0) {
+            const REALTYPE tmp = exp(Eval[i] * distance);
+            for(int j=0; j<kStateCount; j++) {
+                matrixTmp[i*kStateCount+j] = Ievc[i*kStateCount+j] * tmp;
+            }
+        } else {
+            // 2 x 2 conjugate block
+            int i2 = i + 1;
+            const REALTYPE b = EvalImag[i];
+            const REALTYPE expat = exp(Eval[i] * distance);
+            const REALTYPE expatcosbt = expat * cos(b * distance);
+            const REALTYPE expatsinbt = expat * sin(b * distance);
+            for(int j=0; j<kStateCount; j++) {
+                matrixTmp[ i*kStateCount+j] = expatcosbt * Ievc[ i*kStateCount+j] +
+                                              expatsinbt * Ievc[i2*kStateCount+j];
+                matrixTmp[i2*kStateCount+j] = expatcosbt * Ievc[i2*kStateCount+j] -
+                                              expatsinbt * Ievc[ i*kStateCount+j];
+            }
+            i++; // processed two conjugate rows
+        }
+    }
+
+#ifdef DEBUG_COMPLEX
+    fprintf(stderr,"[");
+        for(int i=0; i<16; i++)
+            fprintf(stderr," %7.5e,",matrixTmp[i]);
+        fprintf(stderr,"] -- complex debug\n");
+        exit(0);
+#endif
+
+    int n = 0;
+    for (int i = 0; i < kStateCount; i++) {
+        for (int j = 0; j < kStateCount; j++) {
+            REALTYPE sum = 0.0;
+            for (int k = 0; k < kStateCount; k++)
+                sum += Evec[i*kStateCount+k] * matrixTmp[k*kStateCount+j];
+            if (sum > 0)
+                transitionMat[n] = sum;
+            else
+                transitionMat[n] = 0;
+            n++;
+        }
+if (T_PAD != 0) {
+        transitionMat[n] = 1.0;
+        n += T_PAD;
+}
+    }
+}
+
 BEAGLE_CPU_EIGEN_TEMPLATE
 void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(int eigenIndex,
                                                         const int* probabilityIndices,
@@ -115,66 +173,13 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrice
                                                         const double* categoryRates,
                                                         REALTYPE** transitionMatrices,
                                                         int count) {
-
-	const REALTYPE* Ievc = gIMatrices[eigenIndex];
-	const REALTYPE* Evec = gEMatrices[eigenIndex];
-	const REALTYPE* Eval = gEigenValues[eigenIndex];
-	const REALTYPE* EvalImag = Eval + kStateCount;
+    const int categoryMatrixSize = kStateCount * (kStateCount + T_PAD);
     for (int u = 0; u < count; u++) {
         REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
         const double edgeLength = edgeLengths[u];
-        int n = 0;
-        for (int l = 0; l < kCategoryCount; l++) {
-			const REALTYPE distance = categoryRates[l] * edgeLength;
-        	for(int i=0; i<kStateCount; i++) {
-        		if (!isComplex || EvalImag[i] == 0) {
-        			const REALTYPE tmp = exp(Eval[i] * distance);
-        			for(int j=0; j<kStateCount; j++) {
-        				matrixTmp[i*kStateCount+j] = Ievc[i*kStateCount+j] * tmp;
-        			}
-        		} else {
-        			// 2 x 2 conjugate block
-        			int i2 = i + 1;
-        			const REALTYPE b = EvalImag[i];
-        			const REALTYPE expat = exp(Eval[i] * distance);
-        			const REALTYPE expatcosbt = expat * cos(b * distance);
-        			const REALTYPE expatsinbt = expat * sin(b * distance);
-        			for(int j=0; j<kStateCount; j++) {
-        				matrixTmp[ i*kStateCount+j] = expatcosbt * Ievc[ i*kStateCount+j] +
-        						                      expatsinbt * Ievc[i2*kStateCount+j];
-        				matrixTmp[i2*kStateCount+j] = expatcosbt * Ievc[i2*kStateCount+j] -
-												      expatsinbt * Ievc[ i*kStateCount+j];
-        			}
-        			i++; // processed two conjugate rows
-        		}
-        	}
-
-#ifdef DEBUG_COMPLEX
-           	fprintf(stderr,"[");
-            	for(int i=0; i<16; i++)
-            		fprintf(stderr," %7.5e,",matrixTmp[i]);
-            	fprintf(stderr,"] -- complex debug\n");
-            	exit(0);
-#endif
-
-
-            for (int i = 0; i < kStateCount; i++) {
-                for (int j = 0; j < kStateCount; j++) {
-                    REALTYPE sum = 0.0;
-                    for (int k = 0; k < kStateCount; k++)
-                        sum += Evec[i*kStateCount+k] * matrixTmp[k*kStateCount+j];
-                    if (sum > 0)
-                        transitionMat[n] = sum;
-                    else
-                        transitionMat[n] = 0;
-                    n++;
-                }
-if (T_PAD != 0) {
-                transitionMat[n] = 1.0;
-                n += T_PAD;
-}
-            }
-        }
+        for (int l = 0; l < kCategoryCount; l++)
+            updateCategoryMatrix(eigenIndex, categoryRates[l] * edgeLength,
+                                 transitionMat + l * categoryMatrixSize);
 
         if (DEBUGGING_OUTPUT) {
         	int kMatrixSize = kStateCount * kStateCount;
@@ -193,66 +198,13 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrice
                                                         const double* edgeLengths,
                                                         REALTYPE** transitionMatrices,
                                                         int count) {
-
+    const int categoryMatrixSize = kStateCount * (kStateCount + T_PAD);
     for (int u = 0; u < count; u++) {
         REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
         const double edgeLength = edgeLengths[u];
-        int n = 0;
-        for (int l = 0; l < kCategoryCount; l++) {
-            const REALTYPE distance = edgeLength;
-            const REALTYPE* Ievc = gIMatrices[eigenIndices[l]];
-            const REALTYPE* Evec = gEMatrices[eigenIndices[l]];
-            const REALTYPE* Eval = gEigenValues[eigenIndices[l]];
-            const REALTYPE* EvalImag = Eval + kStateCount;
-            for(int i=0; i<kStateCount; i++) {
-                if (!isComplex || EvalImag[i] == 0) {
-                    const REALTYPE tmp = exp(Eval[i] * distance);
-                    for(int j=0; j<kStateCount; j++) {
-                        matrixTmp[i*kStateCount+j] = Ievc[i*kStateCount+j] * tmp;
-                    }
-                } else {
-                    // 2 x 2 conjugate block
-                    int i2 = i + 1;
-                    const REALTYPE b = EvalImag[i];
-                    const REALTYPE expat = exp(Eval[i] * distance);
-                    const REALTYPE expatcosbt = expat * cos(b * distance);
-                    const REALTYPE expatsinbt = expat * sin(b * distance);
-                    for(int j=0; j<kStateCount; j++) {
-                        matrixTmp[ i*kStateCount+j] = expatcosbt * Ievc[ i*kStateCount+j] +
-                                                      expatsinbt * Ievc[i2*kStateCount+j];
-                        matrixTmp[i2*kStateCount+j] = expatcosbt * Ievc[i2*kStateCount+j] -
-                                                      expatsinbt * Ievc[ i*kStateCount+j];
-                    }
-                    i++; // processed two conjugate rows
-                }
-            }
-
-#ifdef DEBUG_COMPLEX
-            fprintf(stderr,"[");
-                for(int i=0; i<16; i++)
-                    fprintf(stderr," %7.5e,",matrixTmp[i]);
-                fprintf(stderr,"] -- complex debug\n");
-                exit(0);
-#endif
-
-
-            for (int i = 0; i < kStateCount; i++) {
-                for (int j = 0; j < kStateCount; j++) {
-                    REALTYPE sum = 0.0;
-                    for (int k = 0; k < kStateCount; k++)
-                        sum += Evec[i*kStateCount+k] * matrixTmp[k*kStateCount+j];
-                    if (sum > 0)
-                        transitionMat[n] = sum;
-                    else
-                        transitionMat[n] = 0;
-                    n++;
-                }
-if (T_PAD != 0) {
-                transitionMat[n] = 1.0;
-                n += T_PAD;
-}
-            }
-        }
+        for (int l = 0; l < kCategoryCount; l++)
+            updateCategoryMatrix(eigenIndices[l], edgeLength,
+                                 transitionMat + l * categoryMatrixSize);
 
         if (DEBUGGING_OUTPUT) {
             int kMatrixSize = kStateCount * kStateCount;
@@ -263,6 +215,26 @@ if (T_PAD != 0) {
     }
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesForReplicates(const int* eigenIndices,
+                                                        const double* categoryRates,
+                                                        const int* probabilityIndices,
+                                                        const double* edgeLengths,
+                                                        int replicateCount,
+                                                        REALTYPE** transitionMatrices,
+                                                        int count) {
+    const int categoryMatrixSize = kStateCount * (kStateCount + T_PAD);
+    const int replicateCategoryCount = kCategoryCount / replicateCount;
+    for (int u = 0; u < count; u++) {
+        REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int r = l / replicateCategoryCount;
+            updateCategoryMatrix(eigenIndices[r], categoryRates[l] * edgeLengths[u * replicateCount + r],
+                                 transitionMat + l * categoryMatrixSize);
+        }
+    }
+}
+
 }
 }
 
@@ -0,0 +1,88 @@
+/*
+ *  NEONDefinitions.h
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * @author Marc Suchard
+ */
+
+#ifndef __NEONDefinitions__
+#define __NEONDefinitions__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#define USE_NEON
+
+#if defined(USE_NEON)
+#	include <arm_neon.h>
+#endif
+
+#if defined(__linux__) && defined(__aarch64__)
+#	include <sys/auxv.h>
+#	include <asm/hwcap.h>
+#endif
+
+typedef double VecEl_t;
+
+#ifdef __GNUC__
+#define ALIGN16 __attribute__((aligned(16)))
+#else
+#define ALIGN16 __declspec(align(16))
+#endif
+
+/* Double precision vectors require AArch64 (ARMv7 NEON has no float64x2_t) */
+#define USE_DOUBLE_PREC
+#if defined(USE_DOUBLE_PREC)
+	typedef double RealType;
+	typedef float64x2_t	V_Real;
+#	define REALS_PER_VEC	2	/* number of elements per vector */
+#	define VEC_LOAD(a)			vld1q_f64(a)
+#	define VEC_STORE(a, b)		vst1q_f64((a), (b))
+#	define VEC_STORE_SCALAR(a, b)	vst1q_lane_f64((a), (b), 0)
+#	define VEC_MULT(a, b)		vmulq_f64((a), (b))
+#	define VEC_DIV(a, b)		vdivq_f64((a), (b))
+#	define VEC_MADD(a, b, c)	vfmaq_f64((c), (a), (b))
+#	define VEC_SPLAT(a)			vdupq_n_f64(a)
+#	define VEC_ADD(a, b)		vaddq_f64(a, b)
+# 	define VEC_SETZERO()		vdupq_n_f64(0.0)
+/* a times element i of b, optionally accumulated into c */
+#	define VEC_MULT_LANE(a, b, i)		vmulq_laneq_f64((a), (b), (i))
+#	define VEC_MADD_LANE(a, b, i, c)	vfmaq_laneq_f64((c), (a), (b), (i))
+#	define VEC_FIRST(a)			vgetq_lane_f64((a), 0)
+#endif
+
+/*
+ * Advanced SIMD is part of every ARMv8-A core, but is still queried from
+ * the kernel on Linux so that a plugin built for a NEON host is never used
+ * where the operating system reports no support.
+ */
+inline int CPUSupportsNEON() {
+#if defined(__linux__) && defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#elif defined(__ARM_NEON)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#endif // __NEONDefinitions__
@@ -38,6 +38,13 @@
 #	endif
 #	include <xmmintrin.h>
 #endif
+
+#ifdef HAVE_CPUID_H
+#	if !defined(DLS_MACOS)
+#		include <cpuid.h>
+#	endif
+#endif
+
 typedef double VecEl_t;
 
 #ifdef __GNUC__
@@ -74,6 +81,41 @@ typedef double VecEl_t;
 #	define VEC_SPLAT(a)			_mm_set1_ps(a)
 #	define VEC_ADD(a, b)		_mm_add_ps(a, b)
 #endif
+/* Single precision vectors, used alongside the double precision ones above */
+typedef __m128	V_Float;
+#	define FLOATS_PER_VEC	4	/* number of elements per vector */
+#	define FVEC_LOAD(a)			_mm_load_ps(a)
+#	define FVEC_LOADU(a)		_mm_loadu_ps(a)
+#	define FVEC_STORE(a, b)		_mm_store_ps((a), (b))
+#	define FVEC_STOREU(a, b)	_mm_storeu_ps((a), (b))
+#	define FVEC_MULT(a, b)		_mm_mul_ps((a), (b))
+#	define FVEC_MADD(a, b, c)	_mm_add_ps(_mm_mul_ps((a), (b)), (c))
+#	define FVEC_SPLAT(a)		_mm_set1_ps(a)
+#	define FVEC_ADD(a, b)		_mm_add_ps(a, b)
+# 	define FVEC_SETZERO()		_mm_setzero_ps()
+
+/* Loads and stores the first n < FLOATS_PER_VEC elements, other lanes load as zero */
+inline V_Float FVEC_LOAD_FIRST(const float* a, int n) {
+    ALIGN16 float tmp[FLOATS_PER_VEC] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < n; i++)
+        tmp[i] = a[i];
+    return FVEC_LOAD(tmp);
+}
+
+inline void FVEC_STORE_FIRST(float* a, int n, V_Float b) {
+    ALIGN16 float tmp[FLOATS_PER_VEC];
+    FVEC_STORE(tmp, b);
+    for (int i = 0; i < n; i++)
+        a[i] = tmp[i];
+}
+
+/* Sum of the elements of a vector */
+inline float FVEC_SUM(V_Float a) {
+    V_Float t = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(t);
+}
+
 typedef union 			/* for copying individual elements to and from vector floats */
 	{
 	RealType	x[REALS_PER_VEC];
@@ -91,11 +133,18 @@ typedef union 			/* for copying individual elements to and from vector floats */
 
 #endif
 
-int CPUSupportsSSE() {
-    //int a,b,c,d;
-    //cpuid(0,a,b,c,d);
-    //fprintf(stderr,"a = %d\nb = %d\nc = %d\nd = %d\n",a,b,c,d);
+/* SSE2 is checked at run time since these kernels share a plugin with the baseline ones */
+inline int CPUSupportsSSE() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return 1; // part of the x86-64 baseline
+#elif defined(__GNUC__) && defined(HAVE_CPUID_H) && !defined(DLS_MACOS)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (edx & (1 << 26)) != 0;
+#else
     return 1;
+#endif
 }
 
 #endif // __SSEDefinitions__
@@ -0,0 +1,313 @@
+/*
+ *  VectorMath.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VectorMath__
+#define __VectorMath__
+
+#include <cmath>
+#include <cfloat>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Natural logarithms and exponentials of arrays of doubles, a vector at a time, for the log of
+ * site likelihoods and scale factors and the exp of scaled eigenvalues. The argument reductions
+ * and polynomials are those of fdlibm's log and exp, within one ulp like the C library. Log of
+ * zero, negative, subnormal or non-finite values, and exp beyond +-708, take the C library
+ * path. The widest vectors the including translation unit is compiled for are used, AVX2 or
+ * SSE2, and the C library otherwise. Arrays of floats, from single-precision instances, take the
+ * C library's double functions and round each result to float.
+ */
+
+namespace vectormath {
+
+static const double kLg1 = 6.666666666666735130e-01;
+static const double kLg2 = 3.999999999940941908e-01;
+static const double kLg3 = 2.857142874366239149e-01;
+static const double kLg4 = 2.222219843214978396e-01;
+static const double kLg5 = 1.818357216161805012e-01;
+static const double kLg6 = 1.531383769920937332e-01;
+static const double kLg7 = 1.479819860511658591e-01;
+
+static const double kP1 =  1.66666666666666019037e-01;
+static const double kP2 = -2.77777777770155933842e-03;
+static const double kP3 =  6.61375632143793436117e-05;
+static const double kP4 = -1.65339022054652515390e-06;
+static const double kP5 =  4.13813679705723846039e-08;
+
+static const double kLn2Hi = 6.93147180369123816490e-01;
+static const double kLn2Lo = 1.90821492927058770002e-10;
+static const double kInvLn2 = 1.44269504088896338700e+00;
+static const double kExpLimit = 708.0;
+
+// adding and subtracting 1.5 * 2^52 rounds to the nearest integer, left in the low bits
+static const double kRoundingShift = 6755399441055744.0;
+static const double kTwoTo52 = 4503599627370496.0;
+
+#if defined(__AVX2__)
+
+struct Ops {
+    typedef __m256d V;
+    typedef __m256i I;
+    static const int width = 4;
+
+    static V load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, V x) { _mm256_storeu_pd(p, x); }
+    static V set(double x) { return _mm256_set1_pd(x); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm256_div_pd(a, b); }
+    static I setInt(int64_t x) { return _mm256_set1_epi64x(x); }
+    static I asInt(V x) { return _mm256_castpd_si256(x); }
+    static V asReal(I x) { return _mm256_castsi256_pd(x); }
+    static I addInt(I a, I b) { return _mm256_add_epi64(a, b); }
+    static I subInt(I a, I b) { return _mm256_sub_epi64(a, b); }
+    static I andInt(I a, I b) { return _mm256_and_si256(a, b); }
+    static I orInt(I a, I b) { return _mm256_or_si256(a, b); }
+    static I exponentField(I x) { return _mm256_srli_epi64(x, 52); }
+    static I toExponentField(I x) { return _mm256_slli_epi64(x, 52); }
+    // one bit per lane, set for lanes with low <= x <= high
+    static int inRange(V x, double low, double high) {
+        return _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(x, set(low), _CMP_GE_OQ),
+                                                _mm256_cmp_pd(x, set(high), _CMP_LE_OQ)));
+    }
+};
+
+#define BEAGLE_VECTOR_MATH
+
+#elif defined(__SSE2__)
+
+struct Ops {
+    typedef __m128d V;
+    typedef __m128i I;
+    static const int width = 2;
+
+    static V load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, V x) { _mm_storeu_pd(p, x); }
+    static V set(double x) { return _mm_set1_pd(x); }
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm_div_pd(a, b); }
+    static I setInt(int64_t x) { return _mm_set1_epi64x(x); }
+    static I asInt(V x) { return _mm_castpd_si128(x); }
+    static V asReal(I x) { return _mm_castsi128_pd(x); }
+    static I addInt(I a, I b) { return _mm_add_epi64(a, b); }
+    static I subInt(I a, I b) { return _mm_sub_epi64(a, b); }
+    static I andInt(I a, I b) { return _mm_and_si128(a, b); }
+    static I orInt(I a, I b) { return _mm_or_si128(a, b); }
+    static I exponentField(I x) { return _mm_srli_epi64(x, 52); }
+    static I toExponentField(I x) { return _mm_slli_epi64(x, 52); }
+    static int inRange(V x, double low, double high) {
+        return _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(x, set(low)), _mm_cmple_pd(x, set(high))));
+    }
+};
+
+#define BEAGLE_VECTOR_MATH
+
+#endif
+
+#ifdef BEAGLE_VECTOR_MATH
+
+typedef Ops::V V;
+typedef Ops::I I;
+
+// log x for normal positive x: x = 2^k m with m in [sqrt(2)/2, sqrt(2)), f = m - 1 and
+// log(1 + f) = f - f^2 / 2 + s (f^2 / 2 + R(s^2)) with s = f / (2 + f)
+inline V log(V x) {
+    I ix = Ops::addInt(Ops::asInt(x), Ops::setInt(0x3ff0000000000000LL - 0x3fe6a09e00000000LL));
+    // the biased exponent, converted exactly through the low bits of 2^52
+    V dk = Ops::sub(Ops::asReal(Ops::orInt(Ops::exponentField(ix), Ops::asInt(Ops::set(kTwoTo52)))),
+                    Ops::set(kTwoTo52 + 1023.0));
+    ix = Ops::addInt(Ops::andInt(ix, Ops::setInt(0x000fffffffffffffLL)), Ops::setInt(0x3fe6a09e00000000LL));
+    V f = Ops::sub(Ops::asReal(ix), Ops::set(1.0));
+
+    V hfsq = Ops::mul(Ops::set(0.5), Ops::mul(f, f));
+    V s = Ops::div(f, Ops::add(Ops::set(2.0), f));
+    V z = Ops::mul(s, s);
+    V w = Ops::mul(z, z);
+    V t1 = Ops::mul(w, Ops::add(Ops::set(kLg2), Ops::mul(w, Ops::add(Ops::set(kLg4), Ops::mul(w, Ops::set(kLg6))))));
+    V t2 = Ops::mul(z, Ops::add(Ops::set(kLg1), Ops::mul(w, Ops::add(Ops::set(kLg3),
+                    Ops::mul(w, Ops::add(Ops::set(kLg5), Ops::mul(w, Ops::set(kLg7))))))));
+    V r = Ops::add(t2, t1);
+
+    V y = Ops::add(Ops::mul(s, Ops::add(hfsq, r)), Ops::mul(dk, Ops::set(kLn2Lo)));
+    y = Ops::add(Ops::sub(y, hfsq), f);
+    return Ops::add(y, Ops::mul(dk, Ops::set(kLn2Hi)));
+}
+
+// exp x for |x| <= 708: x = k ln2 + r with |r| <= ln2 / 2, and
+// exp r = 1 + r + r c / (2 - c) with c = r - r^2 P(r^2)
+inline V exp(V x) {
+    V t = Ops::add(Ops::mul(x, Ops::set(kInvLn2)), Ops::set(kRoundingShift));
+    V dk = Ops::sub(t, Ops::set(kRoundingShift));
+    I k = Ops::subInt(Ops::asInt(t), Ops::asInt(Ops::set(kRoundingShift)));
+
+    V hi = Ops::sub(x, Ops::mul(dk, Ops::set(kLn2Hi)));
+    V lo = Ops::mul(dk, Ops::set(kLn2Lo));
+    V r = Ops::sub(hi, lo);
+
+    V rr = Ops::mul(r, r);
+    V p = Ops::add(Ops::set(kP4), Ops::mul(rr, Ops::set(kP5)));
+    p = Ops::add(Ops::set(kP3), Ops::mul(rr, p));
+    p = Ops::add(Ops::set(kP2), Ops::mul(rr, p));
+    p = Ops::add(Ops::set(kP1), Ops::mul(rr, p));
+    V c = Ops::sub(r, Ops::mul(rr, p));
+    V y = Ops::div(Ops::mul(r, c), Ops::sub(Ops::set(2.0), c));
+    y = Ops::add(Ops::set(1.0), Ops::add(Ops::sub(y, lo), hi));
+
+    V scale = Ops::asReal(Ops::toExponentField(Ops::addInt(k, Ops::setInt(1023))));
+    return Ops::mul(y, scale);
+}
+
+// replaces values[0, count) by function(values), with scalarFunction for the values outside
+// [low, high]; the last vector is padded with neutral
+template <typename VectorFunction>
+inline void apply(double* values,
+                  int count,
+                  VectorFunction function,
+                  double (*scalarFunction)(double),
+                  double low,
+                  double high,
+                  double neutral) {
+    const int allLanes = (1 << Ops::width) - 1;
+    for (int i = 0; i < count; i += Ops::width) {
+        const int n = (count - i < Ops::width ? count - i : Ops::width);
+        V x;
+        if (n == Ops::width) {
+            x = Ops::load(values + i);
+        } else {
+            double padded[Ops::width];
+            for (int j = 0; j < Ops::width; j++)
+                padded[j] = (j < n ? values[i + j] : neutral);
+            x = Ops::load(padded);
+        }
+        const int valid = Ops::inRange(x, low, high);
+        if (n == Ops::width && valid == allLanes) {
+            Ops::store(values + i, function(x));
+        } else {
+            double results[Ops::width];
+            Ops::store(results, function(x));
+            for (int j = 0; j < n; j++)
+                values[i + j] = ((valid >> j) & 1 ? results[j] : scalarFunction(values[i + j]));
+        }
+    }
+}
+
+inline double scalarLog(double x) { return std::log(x); }
+inline double scalarExp(double x) { return std::exp(x); }
+
+#endif // BEAGLE_VECTOR_MATH
+
+} // vectormath
+
+// replaces values[0, count) by their natural logarithms
+inline void vectorLog(double* values,
+                      int count) {
+#ifdef BEAGLE_VECTOR_MATH
+    vectormath::apply(values, count, [] (vectormath::V x) { return vectormath::log(x); },
+                      vectormath::scalarLog, DBL_MIN, DBL_MAX, 1.0);
+#else
+    for (int i = 0; i < count; i++)
+        values[i] = std::log(values[i]);
+#endif
+}
+
+// adds factor times the natural logarithms of values[0, count) to sums[0, count)
+inline void vectorAddLogs(double* sums,
+                          const double* values,
+                          int count,
+                          double factor) {
+    double logs[64];
+    for (int i = 0; i < count; i += 64) {
+        const int n = (count - i < 64 ? count - i : 64);
+        for (int j = 0; j < n; j++)
+            logs[j] = values[i + j];
+        vectorLog(logs, n);
+        for (int j = 0; j < n; j++)
+            sums[i + j] += factor * logs[j];
+    }
+}
+
+// replaces values[0, count) by e raised to them
+inline void vectorExp(double* values,
+                      int count) {
+#ifdef BEAGLE_VECTOR_MATH
+    vectormath::apply(values, count, [] (vectormath::V x) { return vectormath::exp(x); },
+                      vectormath::scalarExp, -vectormath::kExpLimit, vectormath::kExpLimit, 0.0);
+#else
+    for (int i = 0; i < count; i++)
+        values[i] = std::exp(values[i]);
+#endif
+}
+
+// sets results[0, count) to e raised to exponents[0, count)
+inline void vectorExp(const double* exponents,
+                      double* results,
+                      int count) {
+    for (int i = 0; i < count; i++)
+        results[i] = exponents[i];
+    vectorExp(results, count);
+}
+
+inline void vectorLog(float* values,
+                      int count) {
+    for (int i = 0; i < count; i++)
+        values[i] = std::log((double) values[i]);
+}
+
+inline void vectorAddLogs(float* sums,
+                          const float* values,
+                          int count,
+                          double factor) {
+    for (int i = 0; i < count; i++)
+        sums[i] += factor * std::log((double) values[i]);
+}
+
+inline void vectorExp(float* values,
+                      int count) {
+    for (int i = 0; i < count; i++)
+        values[i] = std::exp((double) values[i]);
+}
+
+inline void vectorExp(const double* exponents,
+                      float* results,
+                      int count) {
+    for (int i = 0; i < count; i++)
+        results[i] = std::exp(exponents[i]);
+}
+
+} // cpu
+} // beagle
+
+#endif // __VectorMath__
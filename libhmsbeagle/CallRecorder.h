@@ -0,0 +1,295 @@
+/*
+ *  CallRecorder.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CallRecorder__
+#define __CallRecorder__
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace beagle {
+
+/*
+ * A recording is the header kRecordingMagic followed by one record per call. A record holds
+ * the call, the instance, the value the call returned, and then the arguments and outputs of
+ * the call in the order of its parameter list: 32-bit integers, 64-bit integers for flags,
+ * doubles, and arrays of either as a 32-bit length followed by the values, with length -1
+ * for a NULL array. Values are written in the byte order of the recording machine.
+ */
+static const char kRecordingMagic[8] = { 'B', 'G', 'L', 'R', 'E', 'C', '0', '1' };
+
+enum RecordedCalls {
+    RECORDED_CREATE_INSTANCE = 1,               // tipCount ... scaleBufferCount, resourceList,
+                                                // preferenceFlags, requirementFlags, flags
+    RECORDED_FINALIZE_INSTANCE,
+    RECORDED_SET_CPU_THREAD_COUNT,              // threadCount
+    RECORDED_SET_TIP_STATES,                    // tipIndex, states
+    RECORDED_SET_TIP_PARTIALS,                  // tipIndex, partials
+    RECORDED_SET_PARTIALS,                      // bufferIndex, partials
+    RECORDED_SET_EIGEN_DECOMPOSITION,           // eigenIndex, vectors, inverse vectors, values
+    RECORDED_SET_STATE_FREQUENCIES,             // index, frequencies
+    RECORDED_SET_CATEGORY_WEIGHTS,              // index, weights
+    RECORDED_SET_CATEGORY_RATES,                // rates
+    RECORDED_SET_CATEGORY_RATES_WITH_INDEX,     // index, rates
+    RECORDED_SET_PATTERN_WEIGHTS,               // weights
+    RECORDED_SET_PATTERN_PARTITIONS,            // partitionCount, partitions
+    RECORDED_SET_TRANSITION_MATRIX,             // matrixIndex, matrix, paddedValue
+    RECORDED_SET_TRANSITION_MATRICES,           // matrixIndices, matrices, paddedValues
+    RECORDED_UPDATE_TRANSITION_MATRICES,        // eigenIndex, probability, first and second
+                                                // derivative indices, edgeLengths
+    RECORDED_UPDATE_TRANSITION_MATRICES_WITH_MODEL_CATEGORIES, // eigenIndices, probability ...
+    RECORDED_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS,  // eigenIndices,
+                                                // categoryRateIndices, probability ...
+    RECORDED_UPDATE_PARTIALS,                   // operations, cumulativeScaleIndex
+    RECORDED_UPDATE_PARTIALS_BY_PARTITION,      // operations
+    RECORDED_ACCUMULATE_SCALE_FACTORS,          // scaleIndices, cumulativeScaleIndex, partition
+    RECORDED_REMOVE_SCALE_FACTORS,              // scaleIndices, cumulativeScaleIndex, partition
+    RECORDED_RESET_SCALE_FACTORS,               // cumulativeScaleIndex, partition
+    RECORDED_COPY_SCALE_FACTORS,                // destination, source
+    RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS,    // buffers, weights, frequencies, scales,
+                                                // partitions, sums by partition, sum
+    RECORDED_CALCULATE_EDGE_LOG_LIKELIHOODS,    // parents, children, probabilities, first and
+                                                // second derivatives, weights, frequencies,
+                                                // scales, sums of the likelihood and derivatives
+    RECORDED_GET_SITE_LOG_LIKELIHOODS,          // site log likelihoods
+    RECORDED_RESET_INSTANCE,
+    RECORDED_UPDATE_TRANSITION_MATRICES_WITH_RATE_MATRIX, // rate matrix, probability indices,
+                                                          // edge lengths
+    RECORDED_CONVOLVE_TRANSITION_MATRIX_CHAINS, // chain matrices, lengths, scratch, results
+    RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS_WITH_PATTERN_WEIGHTS, // buffers, weights,
+                                                                  // frequencies, scales,
+                                                                  // pattern weights, sums
+    RECORDED_UPDATE_TRANSITION_MATRICES_FOR_REPLICATES, // eigen indices, probability indices,
+                                                        // edge lengths
+    RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS_FOR_REPLICATES, // buffer, weights, frequencies,
+                                                            // scale, sums
+    RECORDED_CALCULATE_EDGE_SITE_LOG_LIKELIHOODS, // parents, children, probabilities, first and
+                                                  // second derivatives, weights, frequencies,
+                                                  // scales, site likelihoods and derivatives
+    RECORDED_GROW_INSTANCE,                     // tipCount, partialsBufferCount,
+                                                // compactBufferCount, patternCount,
+                                                // matrixBufferCount, scaleBufferCount
+    RECORDED_CALL_COUNT
+};
+
+/// a partition index of the calls that take none
+static const int kNoPartition = -1;
+
+/*
+ * Writes the calls into the instances to a recording. Records are written whole, so calls
+ * from several threads may be recorded.
+ */
+class CallRecorder {
+public:
+    /*
+     * One record, written when it goes out of scope; other threads wait until then.
+     */
+    class Record {
+    public:
+        Record(CallRecorder* recorder,
+               int call,
+               int instance,
+               int returnCode) : owner(recorder), lock(recorder->m) {
+            putInt(call);
+            putInt(instance);
+            putInt(returnCode);
+        }
+
+        Record& putInt(int value) {
+            return put(&value, sizeof(int));
+        }
+
+        Record& putLong(long value) {
+            long long wide = value;
+            return put(&wide, sizeof(long long));
+        }
+
+        Record& putDouble(double value) {
+            return put(&value, sizeof(double));
+        }
+
+        Record& putInts(const int* values,
+                        int count) {
+            putInt(values != NULL ? count : -1);
+            return (values != NULL ? put(values, sizeof(int) * count) : *this);
+        }
+
+        Record& putDoubles(const double* values,
+                           int count) {
+            putInt(values != NULL ? count : -1);
+            return (values != NULL ? put(values, sizeof(double) * count) : *this);
+        }
+
+    private:
+        Record& put(const void* data,
+                    size_t size) {
+            fwrite(data, 1, size, owner->file);
+            return *this;
+        }
+
+        CallRecorder* owner;
+        std::unique_lock<std::mutex> lock;
+    };
+
+    /*
+     * The dimensions that give the lengths of the arrays passed to an instance.
+     */
+    struct Shape {
+        int stateCount;
+        int patternCount;
+        int categoryCount;
+        int eigenValueCount;    // twice the state count for complex decompositions
+    };
+
+    CallRecorder(const char* fileName) {
+        file = fopen(fileName, "wb");
+        if (file != NULL)
+            fwrite(kRecordingMagic, 1, sizeof(kRecordingMagic), file);
+    }
+
+    ~CallRecorder() {
+        if (file != NULL)
+            fclose(file);
+    }
+
+    bool isOpen() const { return file != NULL; }
+
+    Record record(int call,
+                  int instance,
+                  int returnCode) {
+        return Record(this, call, instance, returnCode);
+    }
+
+    void setShape(int instance,
+                  const Shape& shape) {
+        std::unique_lock<std::mutex> l(m);
+        shapes[instance] = shape;
+    }
+
+    Shape getShape(int instance) {
+        std::unique_lock<std::mutex> l(m);
+        Shape none = { 0, 0, 0, 0 };
+        std::map<int, Shape>::iterator shape = shapes.find(instance);
+        return (shape != shapes.end() ? shape->second : none);
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> l(m);
+        fflush(file);
+    }
+
+private:
+    FILE* file;
+    std::mutex m;
+    std::map<int, Shape> shapes;
+};
+
+/*
+ * Reads the records of a recording in order.
+ */
+class CallReader {
+public:
+    CallReader(const char* fileName) : failed(false) {
+        file = fopen(fileName, "rb");
+        char magic[sizeof(kRecordingMagic)];
+        if (file != NULL && (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+                             memcmp(magic, kRecordingMagic, sizeof(magic)) != 0)) {
+            fclose(file);
+            file = NULL;
+        }
+    }
+
+    ~CallReader() {
+        if (file != NULL)
+            fclose(file);
+    }
+
+    bool isOpen() const { return file != NULL; }
+
+    /// true if a value could not be read, such as at the end of a cut-off recording
+    bool hasFailed() const { return failed; }
+
+    /// reads the header of the next record; returns false at the end of the recording
+    bool next(int* call,
+              int* instance,
+              int* returnCode) {
+        if (fread(call, sizeof(int), 1, file) != 1)
+            return false;
+        *instance = getInt();
+        *returnCode = getInt();
+        return !failed;
+    }
+
+    int getInt() {
+        int value = 0;
+        get(&value, sizeof(int));
+        return value;
+    }
+
+    long getLong() {
+        long long value = 0;
+        get(&value, sizeof(long long));
+        return (long) value;
+    }
+
+    double getDouble() {
+        double value = 0.0;
+        get(&value, sizeof(double));
+        return value;
+    }
+
+    /// reads an array into values; returns false for a NULL array
+    bool getInts(std::vector<int>& values) {
+        int count = getInt();
+        values.assign(count > 0 ? count : 0, 0);
+        if (count > 0)
+            get(&values[0], sizeof(int) * count);
+        return count >= 0;
+    }
+
+    bool getDoubles(std::vector<double>& values) {
+        int count = getInt();
+        values.assign(count > 0 ? count : 0, 0.0);
+        if (count > 0)
+            get(&values[0], sizeof(double) * count);
+        return count >= 0;
+    }
+
+private:
+    void get(void* data,
+             size_t size) {
+        if (!failed && fread(data, 1, size, file) != size)
+            failed = true;
+    }
+
+    FILE* file;
+    bool failed;
+};
+
+}   // namespace beagle
+
+#endif // __CallRecorder__
@@ -0,0 +1,220 @@
+/*
+ *  MatrixExponential.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MatrixExponential__
+#define __MatrixExponential__
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace beagle {
+
+/*
+ * Computes exp(Q t) of a real square matrix by scaling and squaring with a diagonal
+ * (6, 6) Pade approximant, as in Expokit's DGPADM: Q t is halved until its infinity norm is
+ * at most 1/2, the approximant is evaluated there, and the result squared back. No eigen
+ * decomposition is needed, so non-reversible and defective rate matrices take the same path
+ * as reversible ones. Matrices are dense and row-major. Each object holds its own scratch
+ * space, so concurrent computations need one object each.
+ *
+ * The derivative of exp(Q t) with respect to a parameter of Q is the upper right block of the
+ * exponential of the block matrix [Q dQ; 0 Q] t (Van Loan, 1978), so an object made for twice
+ * the state count also computes those through computeDerivative.
+ */
+class MatrixExponential {
+public:
+    MatrixExponential(int stateCount) : n(stateCount), scratch(6 * stateCount * stateCount) {}
+
+    /// writes exp(rateMatrix * t) to outMatrix, with entries below zero from rounding set to 0
+    void compute(const double* rateMatrix,
+                 double t,
+                 double* outMatrix) {
+        const double* result = exponentiate(rateMatrix, t);
+        for (int k = 0; k < n * n; k++)
+            outMatrix[k] = (result[k] > 0.0 ? result[k] : 0.0);
+    }
+
+    /// writes the derivative of exp(rateMatrix * t) to outMatrix, for a parameter whose
+    /// derivative of the rate matrix is rateMatrixDerivative; rateMatrix, its derivative and
+    /// outMatrix have half the state count of this object
+    void computeDerivative(const double* rateMatrix,
+                           const double* rateMatrixDerivative,
+                           double t,
+                           double* outMatrix) {
+        const int h = n / 2;
+        block.assign(n * n, 0.0);
+        for (int i = 0; i < h; i++) {
+            for (int j = 0; j < h; j++) {
+                block[i * n + j] = rateMatrix[i * h + j];
+                block[i * n + h + j] = rateMatrixDerivative[i * h + j];
+                block[(h + i) * n + h + j] = rateMatrix[i * h + j];
+            }
+        }
+        const double* result = exponentiate(&block[0], t);
+        for (int i = 0; i < h; i++) {
+            for (int j = 0; j < h; j++)
+                outMatrix[i * h + j] = result[i * n + h + j];
+        }
+    }
+
+private:
+    /// exp(m * t), returned in the scratch space
+    const double* exponentiate(const double* m,
+                               double t) {
+        const int size = n * n;
+        double* a  = &scratch[0];
+        double* a2 = &scratch[size];
+        double* u  = &scratch[2 * size];
+        double* v  = &scratch[3 * size];
+        double* t1 = &scratch[4 * size];
+        double* t2 = &scratch[5 * size];
+
+        double norm = 0.0;
+        for (int i = 0; i < n; i++) {
+            double rowSum = 0.0;
+            for (int j = 0; j < n; j++)
+                rowSum += std::fabs(m[i * n + j] * t);
+            norm = (rowSum > norm ? rowSum : norm);
+        }
+
+        int squarings = 0;
+        if (norm > 0.5)
+            squarings = (int) std::ceil(std::log(norm / 0.5) / std::log(2.0));
+        const double scale = t * std::ldexp(1.0, -squarings);
+        for (int k = 0; k < size; k++)
+            a[k] = m[k] * scale;
+
+        // c_k = c_{k-1} (p + 1 - k) / (k (2p + 1 - k)) for p = 6
+        double c[7];
+        c[0] = 1.0;
+        for (int k = 1; k <= 6; k++)
+            c[k] = c[k - 1] * (7 - k) / (k * (13.0 - k));
+
+        // even and odd parts: v = c0 I + a2 (c2 I + a2 (c4 I + c6 a2)),
+        //                     u = a (c1 I + a2 (c3 I + c5 a2))
+        multiply(a, a, a2);
+        combine(a2, c[6], c[4], t1);
+        multiply(a2, t1, t2);
+        addIdentity(t2, c[2]);
+        multiply(a2, t2, v);
+        addIdentity(v, c[0]);
+
+        combine(a2, c[5], c[3], t1);
+        multiply(a2, t1, t2);
+        addIdentity(t2, c[1]);
+        multiply(a, t2, u);
+
+        // exp(a) ~ (v - u)^-1 (v + u)
+        for (int k = 0; k < size; k++) {
+            t1[k] = v[k] - u[k];
+            t2[k] = v[k] + u[k];
+        }
+        solve(t1, t2);
+
+        for (int s = 0; s < squarings; s++) {
+            multiply(t2, t2, t1);
+            std::swap(t1, t2);
+        }
+        return t2;
+    }
+
+    /// c = a b
+    void multiply(const double* a,
+                  const double* b,
+                  double* c) const {
+        for (int i = 0; i < n; i++) {
+            double* row = c + i * n;
+            for (int j = 0; j < n; j++)
+                row[j] = 0.0;
+            for (int k = 0; k < n; k++) {
+                const double aik = a[i * n + k];
+                const double* bRow = b + k * n;
+                for (int j = 0; j < n; j++)
+                    row[j] += aik * bRow[j];
+            }
+        }
+    }
+
+    /// out = x m + y I
+    void combine(const double* m,
+                 double x,
+                 double y,
+                 double* out) const {
+        for (int k = 0; k < n * n; k++)
+            out[k] = x * m[k];
+        addIdentity(out, y);
+    }
+
+    void addIdentity(double* m,
+                     double y) const {
+        for (int i = 0; i < n; i++)
+            m[i * n + i] += y;
+    }
+
+    /// b = a^-1 b by LU decomposition of a with partial pivoting; a is overwritten
+    void solve(double* a,
+               double* b) const {
+        for (int k = 0; k < n; k++) {
+            int pivot = k;
+            for (int i = k + 1; i < n; i++) {
+                if (std::fabs(a[i * n + k]) > std::fabs(a[pivot * n + k]))
+                    pivot = i;
+            }
+            if (pivot != k) {
+                for (int j = 0; j < n; j++) {
+                    std::swap(a[k * n + j], a[pivot * n + j]);
+                    std::swap(b[k * n + j], b[pivot * n + j]);
+                }
+            }
+            const double diagonal = a[k * n + k];
+            for (int i = k + 1; i < n; i++) {
+                const double factor = a[i * n + k] / diagonal;
+                if (factor == 0.0)
+                    continue;
+                for (int j = k + 1; j < n; j++)
+                    a[i * n + j] -= factor * a[k * n + j];
+                for (int j = 0; j < n; j++)
+                    b[i * n + j] -= factor * b[k * n + j];
+            }
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            for (int k = i + 1; k < n; k++) {
+                const double aik = a[i * n + k];
+                for (int j = 0; j < n; j++)
+                    b[i * n + j] -= aik * b[k * n + j];
+            }
+            const double diagonal = a[i * n + i];
+            for (int j = 0; j < n; j++)
+                b[i * n + j] /= diagonal;
+        }
+    }
+
+    int n;
+    std::vector<double> scratch;
+    std::vector<double> block;
+};
+
+}   // namespace beagle
+
+#endif // __MatrixExponential__
@@ -0,0 +1,204 @@
+/*
+ *  PatternCompression.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PatternCompression__
+#define __PatternCompression__
+
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace beagle {
+
+/*
+ * Finds the unique columns of an alignment given as one row of states per taxon. The sites
+ * are split into contiguous blocks, one per thread. Each thread hashes the columns of its
+ * block, reading the rows in order, and keeps the first site of each distinct column; the
+ * representatives of the blocks are then merged in block order, so patterns are numbered by
+ * their first site, as a serial scan would number them. Columns are compared in full
+ * whenever their hashes agree.
+ */
+class PatternCompressor {
+public:
+    // a thread is only worth starting for this many sites
+    static const int kMinSitesPerThread = 16384;
+
+    PatternCompressor(int inTaxonCount,
+                      int inSiteCount,
+                      const int* inSiteStates,
+                      int threadCount)
+        : taxonCount(inTaxonCount), siteCount(inSiteCount), siteStates(inSiteStates) {
+        if (threadCount <= 0)
+            threadCount = std::thread::hardware_concurrency();
+        int maxThreadCount = (siteCount + kMinSitesPerThread - 1) / kMinSitesPerThread;
+        blockCount = (threadCount < maxThreadCount ? threadCount : maxThreadCount);
+        if (blockCount < 1)
+            blockCount = 1;
+    }
+
+    // Numbers the patterns; returns their count
+    int compress() {
+        hashes.resize(siteCount);
+        sitePatterns.resize(siteCount);
+        std::vector<std::vector<int> > blockRepresentatives(blockCount);
+
+        forEachBlock([this, &blockRepresentatives] (int block, int start, int end) {
+            hashColumns(start, end);
+            findRepresentatives(start, end, blockRepresentatives[block]);
+        });
+
+        // the representatives of a block were numbered from 0, which become global numbers
+        std::vector<std::vector<int> > blockPatterns(blockCount);
+        Index index(this);
+        for (int block = 0; block < blockCount; block++) {
+            const std::vector<int>& candidates = blockRepresentatives[block];
+            blockPatterns[block].resize(candidates.size());
+            for (size_t i = 0; i < candidates.size(); i++)
+                blockPatterns[block][i] = index.findOrAdd(candidates[i], representatives);
+        }
+
+        forEachBlock([this, &blockPatterns] (int block, int start, int end) {
+            const std::vector<int>& patterns = blockPatterns[block];
+            for (int site = start; site < end; site++)
+                sitePatterns[site] = patterns[sitePatterns[site]];
+        });
+
+        std::vector<unsigned long long>().swap(hashes);
+        return (int) representatives.size();
+    }
+
+    // The pattern of each site
+    const std::vector<int>& getSitePatterns() const { return sitePatterns; }
+
+    // Writes the states of the patterns, one row of getPatternCount() per taxon
+    void getPatternStates(int* outPatternStates) const {
+        int patternCount = (int) representatives.size();
+        forEachBlock([this, outPatternStates, patternCount] (int block, int start, int end) {
+            for (int taxon = 0; taxon < taxonCount; taxon++) {
+                const int* row = siteStates + (size_t) taxon * siteCount;
+                int* patternRow = outPatternStates + (size_t) taxon * patternCount;
+                for (int site = start; site < end; site++) {
+                    if (representatives[sitePatterns[site]] == site)
+                        patternRow[sitePatterns[site]] = row[site];
+                }
+            }
+        });
+    }
+
+    // Sums the weights of the sites of each pattern, in site order; NULL weighs sites as 1
+    void getPatternWeights(const double* inSiteWeights,
+                           double* outPatternWeights) const {
+        for (size_t pattern = 0; pattern < representatives.size(); pattern++)
+            outPatternWeights[pattern] = 0.0;
+        for (int site = 0; site < siteCount; site++)
+            outPatternWeights[sitePatterns[site]] += (inSiteWeights != NULL ? inSiteWeights[site] : 1.0);
+    }
+
+private:
+    // Chains the representatives sharing a hash, for a block or for the whole alignment
+    class Index {
+    public:
+        Index(const PatternCompressor* inOwner) : owner(inOwner) {}
+
+        // Returns the position in representatives of the column of site, added if new
+        int findOrAdd(int site,
+                      std::vector<int>& representatives) {
+            unsigned long long hash = owner->hashes[site];
+            std::unordered_map<unsigned long long, int>::iterator it = heads.find(hash);
+            int candidate = (it == heads.end() ? -1 : it->second);
+            while (candidate != -1) {
+                if (owner->sameColumns(representatives[candidate], site))
+                    return candidate;
+                candidate = next[candidate];
+            }
+            int pattern = (int) representatives.size();
+            representatives.push_back(site);
+            next.push_back(it == heads.end() ? -1 : it->second);
+            heads[hash] = pattern;
+            return pattern;
+        }
+
+    private:
+        const PatternCompressor* owner;
+        std::unordered_map<unsigned long long, int> heads;
+        std::vector<int> next;
+    };
+
+    template <typename F>
+    void forEachBlock(F blockFunction) const {
+        std::vector<std::thread> threads;
+        for (int block = 1; block < blockCount; block++)
+            threads.push_back(std::thread(blockFunction, block,
+                                          blockStart(block), blockStart(block + 1)));
+        blockFunction(0, 0, blockStart(1));
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+    }
+
+    int blockStart(int block) const {
+        return (int) (((long long) siteCount * block) / blockCount);
+    }
+
+    // FNV-1a over the states of each column, one row at a time
+    void hashColumns(int start,
+                     int end) {
+        for (int site = start; site < end; site++)
+            hashes[site] = 14695981039346656037ULL;
+        for (int taxon = 0; taxon < taxonCount; taxon++) {
+            const int* row = siteStates + (size_t) taxon * siteCount;
+            for (int site = start; site < end; site++)
+                hashes[site] = (hashes[site] ^ (unsigned int) row[site]) * 1099511628211ULL;
+        }
+    }
+
+    // Numbers the distinct columns of the block in sitePatterns and lists their first sites
+    void findRepresentatives(int start,
+                             int end,
+                             std::vector<int>& blockRepresentatives) {
+        Index index(this);
+        for (int site = start; site < end; site++)
+            sitePatterns[site] = index.findOrAdd(site, blockRepresentatives);
+    }
+
+    bool sameColumns(int site1,
+                     int site2) const {
+        const int* column = siteStates;
+        for (int taxon = 0; taxon < taxonCount; taxon++, column += siteCount) {
+            if (column[site1] != column[site2])
+                return false;
+        }
+        return true;
+    }
+
+    int taxonCount;
+    int siteCount;
+    const int* siteStates;
+    int blockCount;
+    std::vector<unsigned long long> hashes;
+    std::vector<int> sitePatterns;
+    std::vector<int> representatives;    // first site of each pattern
+};
+
+}   // namespace beagle
+
+#endif // __PatternCompression__
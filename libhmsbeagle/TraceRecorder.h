@@ -0,0 +1,143 @@
+/*
+ *  TraceRecorder.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TraceRecorder__
+#define __TraceRecorder__
+
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace beagle {
+
+/*
+ * Collects timed spans of work from any thread and appends them to a file in the Chrome
+ * trace event format, which chrome://tracing and Perfetto open. Spans are written in
+ * batches, so a long run does not hold its whole timeline in memory; the format allows
+ * the closing bracket to be missing from a run that never finalizes the library.
+ *
+ * Names and categories are kept as pointers until their batch is written, so they must
+ * be string literals of the library or of a plugin that is still loaded.
+ */
+class TraceRecorder {
+public:
+    TraceRecorder(const char* fileName) : origin(std::chrono::steady_clock::now()) {
+        file = fopen(fileName, "w");
+        if (file != NULL)
+            fprintf(file, "[\n");
+    }
+
+    ~TraceRecorder() {
+        if (file != NULL) {
+            std::unique_lock<std::mutex> l(m);
+            flush();
+            fprintf(file, "{}]\n");
+            fclose(file);
+        }
+    }
+
+    bool isOpen() const { return file != NULL; }
+
+    /// microseconds since the recorder was created
+    double now() const {
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - origin;
+        return elapsed.count();
+    }
+
+    /// records a span of the calling thread from start to end, both taken from now()
+    void addSpan(const char* name,
+                 const char* category,
+                 double start,
+                 double end) {
+        std::unique_lock<std::mutex> l(m);
+
+        // threads are numbered in order of their first span
+        std::thread::id id = std::this_thread::get_id();
+        std::unordered_map<std::thread::id, int>::iterator thread = threadNumbers.find(id);
+        if (thread == threadNumbers.end())
+            thread = threadNumbers.insert(std::make_pair(id, (int) threadNumbers.size() + 1)).first;
+
+        spans.push_back(Span{name, category, start, end - start, thread->second});
+        if (spans.size() >= kBatchSize)
+            flush();
+    }
+
+private:
+    struct Span {
+        const char* name;
+        const char* category;
+        double start;
+        double duration;
+        int thread;
+    };
+
+    static const size_t kBatchSize = 4096;
+
+    void flush() {
+        for (size_t i = 0; i < spans.size(); i++) {
+            const Span& s = spans[i];
+            fprintf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                          "\"pid\":1,\"tid\":%d},\n",
+                    s.name, s.category, s.start, s.duration, s.thread);
+        }
+        spans.clear();
+        fflush(file);
+    }
+
+    FILE* file;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex m;
+    std::vector<Span> spans;
+    std::unordered_map<std::thread::id, int> threadNumbers;
+};
+
+/*
+ * Records the lifetime of the scope as a span, or nothing without a recorder.
+ */
+class TraceScope {
+public:
+    TraceScope(TraceRecorder* recorder,
+               const char* spanName,
+               const char* spanCategory) : trace(recorder), name(spanName), category(spanCategory),
+                                           start(recorder != NULL ? recorder->now() : 0.0) {}
+
+    ~TraceScope() {
+        if (trace != NULL)
+            trace->addSpan(name, category, start, trace->now());
+    }
+
+    bool isActive() const { return trace != NULL; }
+
+private:
+    TraceRecorder* trace;
+    const char* name;
+    const char* category;
+    double start;
+};
+
+}   // namespace beagle
+
+#endif // __TraceRecorder__
@@ -0,0 +1,144 @@
+/*
+ *  TransitionMatrixCache.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TransitionMatrixCache__
+#define __TransitionMatrixCache__
+
+#include <vector>
+#include <map>
+
+namespace beagle {
+
+/*
+ * Remembers the eigen decomposition, category rates and edge length that each transition
+ * matrix buffer was last computed from, so that a repeated request can be skipped, or served
+ * by copying another buffer, instead of being recomputed. The owner forgets a buffer when
+ * it is written by any other means, and forgets the matrices of a decomposition or of a set
+ * of category rates when these are set again.
+ */
+class TransitionMatrixCache {
+public:
+    TransitionMatrixCache(int matrixBufferCount) : entries(matrixBufferCount) {}
+
+    // Returns matrixIndex if that buffer holds the matrix of (eigenIndex, categoryRatesIndex,
+    // edgeLength), else the index of another buffer holding it, else -1
+    int find(int eigenIndex,
+             int categoryRatesIndex,
+             double edgeLength,
+             int matrixIndex) const {
+        // NaN lengths are never cached
+        if (edgeLength != edgeLength)
+            return -1;
+        Key key(eigenIndex, categoryRatesIndex, edgeLength);
+        if (entries[matrixIndex].valid && entries[matrixIndex].key == key)
+            return matrixIndex;
+        std::map<Key, int>::const_iterator it = holders.find(key);
+        return (it == holders.end() ? -1 : it->second);
+    }
+
+    // Records that buffer matrixIndex now holds the matrix of (eigenIndex, categoryRatesIndex,
+    // edgeLength)
+    void set(int matrixIndex,
+             int eigenIndex,
+             int categoryRatesIndex,
+             double edgeLength) {
+        forget(matrixIndex);
+        if (edgeLength != edgeLength)
+            return;
+        Entry& entry = entries[matrixIndex];
+        entry.key = Key(eigenIndex, categoryRatesIndex, edgeLength);
+        entry.valid = true;
+        if (holders.count(entry.key) == 0)
+            holders[entry.key] = matrixIndex;
+    }
+
+    void forget(int matrixIndex) {
+        Entry& entry = entries[matrixIndex];
+        if (!entry.valid)
+            return;
+        entry.valid = false;
+        std::map<Key, int>::iterator it = holders.find(entry.key);
+        if (it != holders.end() && it->second == matrixIndex)
+            holders.erase(it);
+    }
+
+    void forgetEigenDecomposition(int eigenIndex) {
+        for (int i = 0; i < (int) entries.size(); i++) {
+            if (entries[i].valid && entries[i].key.eigenIndex == eigenIndex)
+                forget(i);
+        }
+    }
+
+    void forgetCategoryRates(int categoryRatesIndex) {
+        for (int i = 0; i < (int) entries.size(); i++) {
+            if (entries[i].valid && entries[i].key.categoryRatesIndex == categoryRatesIndex)
+                forget(i);
+        }
+    }
+
+    void forgetAll() {
+        for (int i = 0; i < (int) entries.size(); i++)
+            entries[i].valid = false;
+        holders.clear();
+    }
+
+private:
+    struct Key {
+        Key() : eigenIndex(-1), categoryRatesIndex(-1), edgeLength(0.0) {}
+        Key(int e, int r, double t) : eigenIndex(e), categoryRatesIndex(r), edgeLength(t) {}
+
+        // edge lengths match only when they are equal, so a hit returns the same matrix
+        bool operator==(const Key& other) const {
+            return (eigenIndex == other.eigenIndex &&
+                    categoryRatesIndex == other.categoryRatesIndex &&
+                    edgeLength == other.edgeLength);
+        }
+
+        bool operator<(const Key& other) const {
+            if (eigenIndex != other.eigenIndex)
+                return eigenIndex < other.eigenIndex;
+            if (categoryRatesIndex != other.categoryRatesIndex)
+                return categoryRatesIndex < other.categoryRatesIndex;
+            return edgeLength < other.edgeLength;
+        }
+
+        int eigenIndex;
+        int categoryRatesIndex;
+        double edgeLength;
+    };
+
+    struct Entry {
+        Entry() : valid(false) {}
+        Key key;
+        bool valid;
+    };
+
+    std::vector<Entry> entries;
+
+    // one buffer holding each cached matrix
+    std::map<Key, int> holders;
+};
+
+} // end namespace beagle
+
+#endif // __TransitionMatrixCache__
@@ -40,13 +40,31 @@
 #include <exception>    // for exception, bad_exception
 #include <stdexcept>    // for std exception hierarchy
 #include <list>
+#include <string>
+#include <sstream>
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/BeagleImpl.h"
+#include "libhmsbeagle/BeagleShardedImpl.h"
+#ifdef HAVE_MPI
+#include "libhmsbeagle/BeagleDistributedImpl.h"
+#endif
+#include "libhmsbeagle/CallRecorder.h"
+#include "libhmsbeagle/CPU/BeagleCPUThreadPool.h"
+#include "libhmsbeagle/TraceRecorder.h"
+#include "libhmsbeagle/PatternCompression.h"
 #include "libhmsbeagle/benchmark/BeagleBenchmark.h"
+#include "libhmsbeagle/benchmark/BenchmarkCache.h"
 
 #include "libhmsbeagle/plugin/Plugin.h"
 
@@ -88,8 +106,122 @@ double debugGetTime() {
 int debugPatternCount;
 #endif
 
-//@CHANGED make this a std::vector<BeagleImpl *> and use at to reference.
-std::vector<beagle::BeagleImpl*> *instances = NULL;
+/// guards creating instances, loading plugins, building the resource lists and the other
+/// library-wide state set up on first use; recursive since the benchmarks create instances
+std::recursive_mutex setupMutex;
+
+/// guards creating the workers of the *Multi calls
+std::mutex multiInstanceMutex;
+
+namespace beagle {
+
+/*
+ * The instances and their call counters by instance identifier. The slots are held in chunks
+ * that never move once allocated, so looking an instance up takes no lock while other threads
+ * add or finalize instances; adding is serialized. Identifiers are not reused. Zero-initialized
+ * static storage is an empty table, so it is usable before any constructor has run.
+ */
+class InstanceTable {
+public:
+    /// adds an instance and its counters, returns its identifier
+    int add(BeagleImpl* impl,
+            BeagleStatistics* statistics) {
+        std::lock_guard<std::mutex> lock(growth);
+        int index = count.load(std::memory_order_relaxed);
+        if (index >= kChunkSize * kMaxChunks)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        Slot* chunk = chunks[index / kChunkSize].load(std::memory_order_relaxed);
+        if (chunk == NULL) {
+            chunk = new Slot[kChunkSize]();
+            chunks[index / kChunkSize].store(chunk, std::memory_order_release);
+        }
+        Slot& slot = chunk[index % kChunkSize];
+        slot.statistics.store(statistics, std::memory_order_relaxed);
+        slot.impl.store(impl, std::memory_order_release);
+        count.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    /// returns the instance or NULL if the identifier refers to none
+    BeagleImpl* get(int index) {
+        Slot* slot = find(index);
+        return (slot != NULL ? slot->impl.load(std::memory_order_acquire) : NULL);
+    }
+
+    BeagleStatistics* getStatistics(int index) {
+        Slot* slot = find(index);
+        return (slot != NULL ? slot->statistics.load(std::memory_order_acquire) : NULL);
+    }
+
+    /// takes an instance and its counters out of the table; returns NULL if there is none,
+    /// including when another thread took it first
+    BeagleImpl* remove(int index,
+                       BeagleStatistics** statistics) {
+        Slot* slot = find(index);
+        if (slot == NULL)
+            return NULL;
+        BeagleImpl* impl = slot->impl.exchange(NULL, std::memory_order_acq_rel);
+        if (impl != NULL)
+            *statistics = slot->statistics.exchange(NULL, std::memory_order_acq_rel);
+        return impl;
+    }
+
+    int size() {
+        return count.load(std::memory_order_acquire);
+    }
+
+    /// frees the table and the counters; the instances are left to their plugins
+    void clear() {
+        std::lock_guard<std::mutex> lock(growth);
+        for (int i = 0; i < kMaxChunks; i++) {
+            Slot* chunk = chunks[i].exchange(NULL);
+            if (chunk == NULL)
+                continue;
+            for (int j = 0; j < kChunkSize; j++)
+                delete chunk[j].statistics.load();
+            delete[] chunk;
+        }
+        count.store(0);
+    }
+
+private:
+    static const int kChunkSize = 1024;
+    static const int kMaxChunks = 1024;
+
+    struct Slot {
+        std::atomic<BeagleImpl*> impl;
+        std::atomic<BeagleStatistics*> statistics;
+    };
+
+    Slot* find(int index) {
+        if (index < 0 || index >= count.load(std::memory_order_acquire))
+            return NULL;
+        return &chunks[index / kChunkSize].load(std::memory_order_acquire)[index % kChunkSize];
+    }
+
+    std::atomic<Slot*> chunks[kMaxChunks];
+    std::atomic<int> count;
+    std::mutex growth;
+};
+
+}   // namespace beagle
+
+beagle::InstanceTable instances;
+
+/// worker threads shared by native CPU instances, see beagleSetSharedCPUThreadCount
+std::shared_ptr<beagle::cpu::ThreadPool> sharedThreadPool;
+
+/// worker threads driving the instances of the *Multi calls, created on first use
+std::unique_ptr<beagle::cpu::ThreadPool> multiInstanceWorkers;
+
+/// timeline of the calls and host tasks of all instances, written to the file
+/// named by the BEAGLE_TRACE_FILE environment variable when the first instance is created
+std::unique_ptr<beagle::TraceRecorder> traceRecorder;
+
+/// calls into the instances and their results, written to the file named by the
+/// BEAGLE_RECORD_FILE environment variable from the first instance created on; see
+/// examples/replay
+std::unique_ptr<beagle::CallRecorder> callRecorder;
 
 /// returns an initialized instance or NULL if the index refers to an invalid instance
 namespace beagle {
@@ -97,9 +229,102 @@ BeagleImpl* getBeagleInstance(int instanceIndex);
 
 
 BeagleImpl* getBeagleInstance(int instanceIndex) {
-    if (instanceIndex > instances->size())
-        return NULL;
-    return (*instances)[instanceIndex];
+    return instances.get(instanceIndex);
+}
+
+/// trace span names of the kinds of calls, see BeagleCalls
+const char* callTraceNames[BEAGLE_CALL_COUNT] = {
+    "setTipStates", "setTipPartials", "setPartials", "getPartials",
+    "setEigenDecomposition", "setTransitionMatrices", "updateTransitionMatrices",
+    "updatePartials", "scaleFactors", "rootLogLikelihoods", "edgeLogLikelihoods",
+    "getSiteResults"
+};
+
+/// counts a call of kind call into an instance, and adds its host time when it goes out of
+/// scope; the implementation may time the work the call queues in between
+class CallStatistics {
+public:
+    CallStatistics(int instanceIndex,
+                   BeagleImpl* beagleInstance,
+                   int call) : impl(beagleInstance), kind(call),
+                               statistics(instances.getStatistics(instanceIndex)),
+                               startTime(std::chrono::steady_clock::now()),
+                               span(traceRecorder.get(), callTraceNames[call], "api") {
+        impl->beginCallStatistics();
+    }
+
+    ~CallStatistics() {
+        impl->endCallStatistics();
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - startTime;
+        statistics->callCount[kind]++;
+        statistics->callSeconds[kind] += seconds.count();
+    }
+
+    /// counts operations of opSize integers each, and those that write scale factors
+    void addOperations(const int* operations,
+                       int count,
+                       int opSize) {
+        statistics->operationCount += count;
+        for (int op = 0; op < count; op++) {
+            if (operations[op * opSize + 1] != BEAGLE_OP_NONE)
+                statistics->scalingCount++;
+        }
+    }
+
+private:
+    BeagleImpl* impl;
+    int kind;
+    BeagleStatistics* statistics;
+    std::chrono::steady_clock::time_point startTime;
+    TraceScope span;
+};
+
+/// calls call(i, instance) for each of the distinct instances concurrently, the calling
+/// thread driving the first; returns the first error code in instance order
+int forEachInstance(const int* instanceIndices,
+                    int instanceCount,
+                    const std::function<int(int, BeagleImpl*)>& call) {
+    if (instanceCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    std::vector<BeagleImpl*> multiInstances(instanceCount);
+    for (int i = 0; i < instanceCount; i++) {
+        multiInstances[i] = getBeagleInstance(instanceIndices[i]);
+        if (multiInstances[i] == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        for (int j = 0; j < i; j++) {
+            if (multiInstances[j] == multiInstances[i])
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+        }
+    }
+
+    std::unique_lock<std::mutex> workersLock(multiInstanceMutex);
+    if (instanceCount > 1 && !multiInstanceWorkers) {
+        int workerCount = std::thread::hardware_concurrency() - 1;
+        multiInstanceWorkers.reset(new cpu::ThreadPool(workerCount < 1 ? 1 : workerCount));
+        multiInstanceWorkers->setTrace(traceRecorder.get());
+    }
+    workersLock.unlock();
+
+    std::vector<int> returnCodes(instanceCount, BEAGLE_SUCCESS);
+
+    cpu::ThreadPoolTaskGroup group;
+    for (int i = 1; i < instanceCount; i++)
+        multiInstanceWorkers->submit(group, [&call, &returnCodes, &multiInstances, i] () {
+            returnCodes[i] = call(i, multiInstances[i]);
+        }, i - 1);
+
+    if (instanceCount > 0)
+        returnCodes[0] = call(0, multiInstances[0]);
+
+    if (instanceCount > 1)
+        group.wait();
+
+    for (int i = 0; i < instanceCount; i++) {
+        if (returnCodes[i] != BEAGLE_SUCCESS)
+            return returnCodes[i];
+    }
+    return BEAGLE_SUCCESS;
 }
 
 }   // end namespace beagle
@@ -124,6 +349,72 @@ std::list<beagle::BeagleImplFactory*>* implFactory = NULL;
 
 BeagleResourceList* rsrcList = NULL;
 BeagleBenchmarkedResourceList* rsrcBenchList = NULL;
+BeagleResourceEstimateList* rsrcEstimateList = NULL;
+
+/// implementation names of benchmarks read from the cache, kept for the returned lists
+std::list<std::string> cachedImplNames;
+
+/// identifies the resources, drivers, library version and arguments of a benchmark
+std::string benchmarkCacheKey(RsrcBenchPairList* benchList,
+                              int tipCount,
+                              int compactBufferCount,
+                              int stateCount,
+                              int patternCount,
+                              int categoryCount,
+                              long preferenceFlags,
+                              long requirementFlags,
+                              int eigenModelCount,
+                              int partitionCount,
+                              int calculateDerivatives,
+                              long benchmarkFlags) {
+    std::ostringstream text;
+    text << BEAGLE_VERSION << "|" << beagle::benchmark::getHostFingerprint();
+    for (int i = 0; i < rsrcList->length; i++) {
+        text << "|" << rsrcList->list[i].name << ";" << rsrcList->list[i].description
+             << ";" << rsrcList->list[i].supportFlags;
+    }
+    for (RsrcBenchPairList::iterator it = benchList->begin(); it != benchList->end(); ++it)
+        text << "|" << (*it).number;
+    text << "|" << tipCount << " " << compactBufferCount << " " << stateCount << " "
+         << patternCount << " " << categoryCount << " " << preferenceFlags << " "
+         << requirementFlags << " " << eigenModelCount << " " << partitionCount << " "
+         << calculateDerivatives << " " << (benchmarkFlags & ~BEAGLE_BENCHFLAG_CACHE);
+
+    return beagle::benchmark::hashKey(text.str());
+}
+
+/// fills the benchmarks of benchList from results cached in the same order; returns false
+/// if they do not match
+bool useCachedBenchmarks(const std::vector<beagle::benchmark::CachedBenchmark>& cached,
+                         RsrcBenchPairList* benchList) {
+    if (cached.size() != benchList->size())
+        return false;
+
+    size_t i = 0;
+    for (RsrcBenchPairList::iterator it = benchList->begin(); it != benchList->end(); ++it, ++i) {
+        if (cached[i].number != (*it).number)
+            return false;
+    }
+
+    i = 0;
+    for (RsrcBenchPairList::iterator it = benchList->begin(); it != benchList->end(); ++it, ++i) {
+        std::list<std::string>::iterator name = cachedImplNames.begin();
+        while (name != cachedImplNames.end() && *name != cached[i].implName)
+            ++name;
+        if (name == cachedImplNames.end())
+            name = cachedImplNames.insert(cachedImplNames.end(), cached[i].implName);
+
+        (*it).returnCode       = cached[i].returnCode;
+        (*it).implName         = (char*) name->c_str();
+        (*it).benchedFlags     = cached[i].benchedFlags;
+        (*it).benchmarkResult  = cached[i].benchmarkResult;
+        (*it).performanceRatio = cached[i].performanceRatio;
+        (*it).threadCount      = cached[i].threadCount;
+    }
+
+    return true;
+}
+
 std::map<int, int> ResourceMap;
 
 int loaded = 0; // Indicates is the initial library constructors have been run
@@ -132,51 +423,78 @@ int loaded = 0; // Indicates is the initial library constructors have been run
 /** The list of plugins that provide implementations of likelihood calculators */
 std::list<beagle::plugin::Plugin*>* plugins;
 
-void beagleLoadPlugins(void) {
+/** Groups of plugins, each loaded on first need */
+enum PluginGroups {
+    PLUGINS_CPU = 1 << 0,   // plugins of the "CPU" resource, always resource 0
+    PLUGINS_GPU = 1 << 1,   // CUDA and OpenCL plugins, whose loading initializes the drivers
+    PLUGINS_ALL = PLUGINS_CPU | PLUGINS_GPU
+};
+
+int loadedPluginGroups = 0;
+
+void loadPlugin(beagle::plugin::PluginManager& pm,
+                const char* name) {
+    try{
+        beagle::plugin::Plugin* plug = pm.findPlugin(name);
+        plugins->push_back(plug);
+    }catch(beagle::plugin::SharedLibraryException sle){
+        // this one should always work
+        if (strcmp(name, "hmsbeagle-cpu") == 0) {
+            std::cerr << "Unable to load CPU plugin!\n";
+            std::cerr << "Please check for proper libhmsbeagle installation.\n";
+        }
+    }
+}
+
+/// loads the plugins of groups not loaded yet; the resource and factory lists are rebuilt
+/// over the new plugins on next use
+void loadPluginGroups(int groups) {
     if(plugins==NULL){
         plugins = new std::list<beagle::plugin::Plugin*>();
     }
 
-    beagle::plugin::PluginManager& pm = beagle::plugin::PluginManager::instance();
+    groups &= ~loadedPluginGroups;
+    if (groups == 0)
+        return;
 
-    try{
-        beagle::plugin::Plugin* sseplug = pm.findPlugin("hmsbeagle-cpu-sse");
-        plugins->push_back(sseplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
+    beagle::plugin::PluginManager& pm = beagle::plugin::PluginManager::instance();
 
-    try{
-        beagle::plugin::Plugin* cpuplug = pm.findPlugin("hmsbeagle-cpu");
-        plugins->push_back(cpuplug);
-    }catch(beagle::plugin::SharedLibraryException sle){
-        // this one should always work
-        std::cerr << "Unable to load CPU plugin!\n";
-        std::cerr << "Please check for proper libhmsbeagle installation.\n";
+    // the CPU plugins all add to resource 0, so the GPU resources are numbered as if
+    // every plugin had been loaded at once
+    if (groups & PLUGINS_CPU) {
+        // The CPU plugin selects its vector kernels at run time; only the
+        // Windows and Xcode projects still build SSE as a separate plugin
+#if defined(_WIN32) || defined(__APPLE__)
+        loadPlugin(pm, "hmsbeagle-cpu-sse");
+#endif
+        loadPlugin(pm, "hmsbeagle-cpu");
+        loadPlugin(pm, "hmsbeagle-cpu-avx");
+        loadPlugin(pm, "hmsbeagle-cpu-openmp");
     }
 
-    try{
-        beagle::plugin::Plugin* cudaplug = pm.findPlugin("hmsbeagle-cuda");
-        plugins->push_back(cudaplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
+    if (groups & PLUGINS_GPU) {
+        loadPlugin(pm, "hmsbeagle-cuda");
+        loadPlugin(pm, "hmsbeagle-opencl");
+        loadPlugin(pm, "hmsbeagle-opencl-altera");
+    }
 
-    try{
-        beagle::plugin::Plugin* openclplug = pm.findPlugin("hmsbeagle-opencl");
-        plugins->push_back(openclplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
+    loadedPluginGroups |= groups;
 
-    try{
-        beagle::plugin::Plugin* openclalteraplug = pm.findPlugin("hmsbeagle-opencl-altera");
-        plugins->push_back(openclalteraplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
-    
-    try{
-        beagle::plugin::Plugin* avxplug = pm.findPlugin("hmsbeagle-cpu-avx");
-        plugins->push_back(avxplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}    
+    // the resources and factories belong to the plugins, only the lists are freed
+    if (rsrcList != NULL) {
+        free(rsrcList->list);
+        free(rsrcList);
+        rsrcList = NULL;
+    }
+    if (implFactory != NULL) {
+        delete implFactory;
+        implFactory = NULL;
+    }
+}
 
-    try{
-        beagle::plugin::Plugin* openmpplug = pm.findPlugin("hmsbeagle-cpu-openmp");
-        plugins->push_back(openmpplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
+void beagleLoadPlugins(void) {
+    std::lock_guard<std::recursive_mutex> setupLock(setupMutex);
+    loadPluginGroups(PLUGINS_ALL);
 }
 
 std::list<beagle::BeagleImplFactory*>* beagleGetFactoryList(void) {
@@ -199,6 +517,20 @@ void beagle_library_initialize(void) {
 
 void beagle_library_finalize(void) {
   DEBUG_FINALIZE_TIME();
+    // spans name string literals of the plugins, so the trace is written before these unload
+    if (sharedThreadPool)
+        sharedThreadPool->setTrace(NULL);
+    if (multiInstanceWorkers)
+        multiInstanceWorkers->setTrace(NULL);
+    if (loaded) {
+        for (int i = 0; i < instances.size(); i++) {
+            if (instances.get(i) != NULL)
+                instances.get(i)->setTrace(NULL);
+        }
+    }
+    traceRecorder.reset();
+    callRecorder.reset();
+
     // FIXME: need to destroy each plugin
     // the following code segfaults
 /*  std::list<beagle::plugin::Plugin*>::iterator plugin_iter = plugins.begin();
@@ -233,11 +565,19 @@ void beagle_library_finalize(void) {
         free(rsrcBenchList);
     }
 
+    if (rsrcEstimateList && loaded) {
+        free(rsrcEstimateList->list);
+        free(rsrcEstimateList);
+        rsrcEstimateList = NULL;
+    }
+
 
     // Destroy instances
-    if (instances && loaded) {
-        delete instances;
-    }
+    if (loaded)
+        instances.clear();
+
+    sharedThreadPool.reset();
+    multiInstanceWorkers.reset();
     loaded = 0;
 }
 
@@ -278,11 +618,8 @@ const char* beagleGetCitation() {
     return BEAGLE_CITATION;
 }
 
-BeagleResourceList* beagleGetResourceList() {
-    // plugins must be loaded before resources
-    if (plugins==NULL)
-        beagleLoadPlugins();
-
+/// lists the resources of the plugins loaded so far
+BeagleResourceList* buildResourceList() {
     if (rsrcList == NULL) {
         // count the total resources across plugins
         rsrcList = (BeagleResourceList*) malloc(sizeof(BeagleResourceList));
@@ -323,10 +660,53 @@ BeagleResourceList* beagleGetResourceList() {
     return rsrcList;
 }
 
+BeagleResourceList* beagleGetResourceList() {
+    std::lock_guard<std::recursive_mutex> setupLock(setupMutex);
+    // the list returned to the caller must not be rebuilt later, so every plugin is loaded
+    loadPluginGroups(PLUGINS_ALL);
+
+    return buildResourceList();
+}
+
+/// the plugin groups that can provide an implementation for the resources and requirements;
+/// a CPU requirement or a list of only resource 0 leaves the GPU drivers alone
+int neededPluginGroups(const int* resourceList,
+                       int resourceCount,
+                       long requirementFlags) {
+    if (resourceList != NULL && resourceCount > 0) {
+        for (int i = 0; i < resourceCount; i++) {
+            if (resourceList[i] != 0)
+                return PLUGINS_ALL;
+        }
+        return PLUGINS_CPU;
+    }
+
+    const long gpuFlags = BEAGLE_FLAG_PROCESSOR_GPU | BEAGLE_FLAG_FRAMEWORK_CUDA |
+                          BEAGLE_FLAG_FRAMEWORK_OPENCL;
+    if ((requirementFlags & (BEAGLE_FLAG_PROCESSOR_CPU | BEAGLE_FLAG_FRAMEWORK_CPU)) &&
+        !(requirementFlags & gpuFlags))
+        return PLUGINS_CPU;
+
+    return PLUGINS_ALL;
+}
+
+/// loads the needed plugins and lists their resources and factories
+void loadResources(const int* resourceList,
+                   int resourceCount,
+                   long requirementFlags) {
+    loadPluginGroups(neededPluginGroups(resourceList, resourceCount, requirementFlags));
+
+    if (rsrcList == NULL)
+        buildResourceList();
+
+    if (implFactory == NULL)
+        beagleGetFactoryList();
+}
+
 int scoreFlags(long flags1, long flags2) {
     int score = 0;
-    int trait = 1;
-    for(int bits=0; bits<32; bits++) {
+    unsigned long trait = 1;
+    for(int bits=0; bits<(int) (8 * sizeof(long)); bits++) {
         if ( (flags1 & trait) &&
              (flags2 & trait) )
             score++;
@@ -359,7 +739,7 @@ int filterResources(int* resourceList,
             it != possibleResources->end(); ++it) {
             int resource = (*it).second;
             long resourceFlag = rsrcList->list[resource].supportFlags;
-            if ( (resourceFlag & requirementFlags) < requirementFlags) {
+            if ( (resourceFlag & requirementFlags) != requirementFlags) {
                 if(it==possibleResources->begin()){
                     possibleResources->remove(*(it));
                     it=possibleResources->begin();
@@ -403,9 +783,9 @@ int rankResourceImplementationPairs(long preferenceFlags,
 #ifdef BEAGLE_DEBUG_FLOW
             fprintf(stderr,"\tExamining implementation: %s\n",(*factory)->getName());
 #endif
-            if ( ((requirementFlags & factoryFlags) >= requirementFlags) // Factory meets requirementFlags
-                && ((resourceRequiredFlags & factoryFlags) >= resourceRequiredFlags) // Factory meets resourceFlags
-                && ((requirementFlags & resourceSupportedFlags) >= requirementFlags) // Resource meets requirementFlags
+            if ( ((requirementFlags & factoryFlags) == requirementFlags) // Factory meets requirementFlags
+                && ((resourceRequiredFlags & factoryFlags) == resourceRequiredFlags) // Factory meets resourceFlags
+                && ((requirementFlags & resourceSupportedFlags) == requirementFlags) // Resource meets requirementFlags
                 ) {
                 int implementationScore = scoreFlags(preferenceFlags,factoryFlags);
                 int totalScore = resourceScore + implementationScore;
@@ -462,11 +842,9 @@ BeagleBenchmarkedResourceList* beagleGetBenchmarkedResourceList(int tipCount,
     debugPatternCount = patternCount;
 #endif
 
-    if (rsrcList == NULL)
-        beagleGetResourceList();
+    std::unique_lock<std::recursive_mutex> setupLock(setupMutex);
 
-    if (implFactory == NULL)
-        beagleGetFactoryList();
+    loadResources(resourceList, resourceCount, requirementFlags);
 
     int errorCode = BEAGLE_SUCCESS;
 
@@ -500,86 +878,209 @@ BeagleBenchmarkedResourceList* beagleGetBenchmarkedResourceList(int tipCount,
 
     delete possibleResources;
 
-    bool manualScaling = (benchmarkFlags & BEAGLE_BENCHFLAG_SCALING_NONE ? false : true);
-    int benchmarkReplicates = BENCHMARK_REPLICATES;
-    int rescaleFrequency =
-        (benchmarkFlags & BEAGLE_BENCHFLAG_SCALING_ALWAYS ? 1 : BENCHMARK_REPLICATES*2);
+    std::string cacheFileName;
+    std::string cacheKey;
+    bool cached = false;
+    if (benchmarkFlags & BEAGLE_BENCHFLAG_CACHE) {
+        cacheFileName = beagle::benchmark::getBenchmarkCacheFileName();
+        cacheKey = benchmarkCacheKey(filteredRsrcBenchList, tipCount, compactBufferCount,
+                                     stateCount, patternCount, categoryCount, preferenceFlags,
+                                     requirementFlags, eigenModelCount, partitionCount,
+                                     calculateDerivatives, benchmarkFlags);
+        std::vector<beagle::benchmark::CachedBenchmark> cachedBenchmarks;
+        cached = (!cacheFileName.empty() &&
+                  beagle::benchmark::readBenchmarkCache(cacheFileName, cacheKey, cachedBenchmarks) &&
+                  useCachedBenchmarks(cachedBenchmarks, filteredRsrcBenchList));
+    }
 
-    int resourceNumber;
-    char* implName;
-    long benchedFlags;
-    double benchmarkResultCPU;
+    if (!cached) {
+        bool manualScaling = (benchmarkFlags & BEAGLE_BENCHFLAG_SCALING_NONE ? false : true);
+        int benchmarkReplicates = BENCHMARK_REPLICATES;
+        int rescaleFrequency =
+            (benchmarkFlags & BEAGLE_BENCHFLAG_SCALING_ALWAYS ? 1 : BENCHMARK_REPLICATES*2);
+
+        int resourceNumber;
+        char* implName;
+        long benchedFlags;
+        double benchmarkResultCPU;
+
+        // the benchmarks create their instances under the lock, from several threads
+        setupLock.unlock();
+
+        errorCode = beagle::benchmark::benchmarkResource(0,
+                                      stateCount,
+                                      tipCount,
+                                      patternCount,
+                                      manualScaling,
+                                      categoryCount,
+                                      benchmarkReplicates,
+                                      compactBufferCount,
+                                      rescaleFrequency,
+                                      (calculateDerivatives ? true : false),
+                                      calculateDerivatives,
+                                      eigenModelCount,
+                                      partitionCount,
+                                      preferenceFlags | requirementFlags,
+                                      0,
+                                      &resourceNumber,
+                                      &implName,
+                                      &benchedFlags,
+                                      &benchmarkResultCPU,
+                                      false,
+                                      0);
 
-    bool instOnly = false;
-    
-    errorCode = beagle::benchmark::benchmarkResource(0,
-                                  stateCount,
-                                  tipCount,
-                                  patternCount,
-                                  manualScaling,
-                                  categoryCount,
-                                  benchmarkReplicates,
-                                  compactBufferCount,
-                                  rescaleFrequency,
-                                  (calculateDerivatives ? true : false),
-                                  calculateDerivatives,
-                                  eigenModelCount,
-                                  partitionCount,
-                                  preferenceFlags | requirementFlags,
-                                  0,
-                                  &resourceNumber,
-                                  &implName,
-                                  &benchedFlags,
-                                  &benchmarkResultCPU,
-                                  instOnly);
+        if (errorCode != BEAGLE_SUCCESS) {
+            delete filteredRsrcBenchList;
+            return NULL;
+        }
 
-    if (errorCode != BEAGLE_SUCCESS) {
-        return NULL;
-    }
+        // times one listed resource at the given preferences, requirements and thread count
+        auto benchmarkListed = [&] (BeagleBenchmarkedResource& listed,
+                                    long configPreferenceFlags,
+                                    long configRequirementFlags,
+                                    int threadCount,
+                                    bool instOnly,
+                                    double* result) {
+            int number;
+            char* name;
+            long flags;
+            int returnCode = beagle::benchmark::benchmarkResource(listed.number,
+                                                         stateCount,
+                                                         tipCount,
+                                                         patternCount,
+                                                         manualScaling,
+                                                         categoryCount,
+                                                         benchmarkReplicates,
+                                                         compactBufferCount,
+                                                         rescaleFrequency,
+                                                         (calculateDerivatives ? true : false),
+                                                         calculateDerivatives,
+                                                         eigenModelCount,
+                                                         partitionCount,
+                                                         configPreferenceFlags,
+                                                         configRequirementFlags,
+                                                         &number,
+                                                         &name,
+                                                         &flags,
+                                                         result,
+                                                         instOnly,
+                                                         threadCount);
+            if (returnCode == BEAGLE_SUCCESS) {
+                listed.number       = number;
+                listed.benchedFlags = flags;
+                listed.implName     = name;
+            }
+            return returnCode;
+        };
+
+        // the default configuration, or with BEAGLE_BENCHFLAG_TUNE_CPU the fastest of every
+        // vector extension and thread count of a CPU resource
+        auto benchmarkConfigurations = [&] (BeagleBenchmarkedResource& listed) {
+            listed.threadCount = 0;
+
+            if (!(benchmarkFlags & BEAGLE_BENCHFLAG_TUNE_CPU) ||
+                !(listed.requiredFlags & BEAGLE_FLAG_FRAMEWORK_CPU)) {
+                double result;
+                listed.returnCode = benchmarkListed(listed, preferenceFlags, requirementFlags, 0,
+                                                    listed.number == 0, &result);
+                if (listed.number == 0) {
+                    listed.benchmarkResult = benchmarkResultCPU;
+                    listed.performanceRatio = 1.0;
+                } else {
+                    listed.benchmarkResult = result;
+                    listed.performanceRatio = benchmarkResultCPU / listed.benchmarkResult;
+                }
+                return;
+            }
 
-    for(RsrcBenchPairList::iterator it = filteredRsrcBenchList->begin();
-        it != filteredRsrcBenchList->end(); ++it) {
+            const long vectorFlags[] = {BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_VECTOR_SSE,
+                                        BEAGLE_FLAG_VECTOR_AVX, BEAGLE_FLAG_VECTOR_AVX512};
+            long requiredVector = requirementFlags & (BEAGLE_FLAG_VECTOR_NONE | BEAGLE_FLAG_VECTOR_SSE |
+                                                      BEAGLE_FLAG_VECTOR_AVX | BEAGLE_FLAG_VECTOR_AVX512);
+            std::vector<long> vectors;
+            for (int v = 0; v < 4; v++) {
+                if ((listed.supportFlags & vectorFlags[v]) &&
+                    (requiredVector == 0 || requiredVector == vectorFlags[v]))
+                    vectors.push_back(vectorFlags[v]);
+            }
+            if (vectors.empty())
+                vectors.push_back(0);
+
+            int hardwareThreads = std::thread::hardware_concurrency();
+            std::vector<int> threadCounts;
+            for (int t = 1; t < hardwareThreads; t *= 2)
+                threadCounts.push_back(t);
+            threadCounts.push_back(hardwareThreads > 1 ? hardwareThreads : 1);
+
+            long threadingFlags = BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                                  BEAGLE_FLAG_THREADING_OPENMP;
+            long threadedPreference = (preferenceFlags & BEAGLE_FLAG_THREADING_OPENMP ?
+                                       BEAGLE_FLAG_THREADING_OPENMP : BEAGLE_FLAG_THREADING_CPP);
+
+            BeagleBenchmarkedResource best = listed;
+            best.returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+            for (size_t v = 0; v < vectors.size(); v++) {
+                for (size_t t = 0; t < threadCounts.size(); t++) {
+                    BeagleBenchmarkedResource config = listed;
+                    long configPreferenceFlags = (preferenceFlags & ~threadingFlags) |
+                        (threadCounts[t] > 1 ? (int) threadedPreference :
+                                               (int) BEAGLE_FLAG_THREADING_NONE);
+                    double result;
+                    config.returnCode = benchmarkListed(config, configPreferenceFlags,
+                                                        requirementFlags | vectors[v],
+                                                        threadCounts[t], false, &result);
+                    if (config.returnCode == BEAGLE_SUCCESS &&
+                        (best.returnCode != BEAGLE_SUCCESS || result < best.benchmarkResult)) {
+                        config.benchmarkResult = result;
+                        config.threadCount = threadCounts[t];
+                        best = config;
+                    }
+                }
+            }
+
+            listed = best;
+            if (listed.returnCode == BEAGLE_SUCCESS)
+                listed.performanceRatio = benchmarkResultCPU / listed.benchmarkResult;
+        };
+
+        // devices run their benchmarks at the same time, each from its own thread; resources
+        // on the host processors follow one at a time, so as not to compete for them
+        std::vector<std::thread> deviceBenchmarks;
+        for(RsrcBenchPairList::iterator it = filteredRsrcBenchList->begin();
+            it != filteredRsrcBenchList->end(); ++it) {
+            if ((*it).number != 0 && !((*it).supportFlags & BEAGLE_FLAG_PROCESSOR_CPU))
+                deviceBenchmarks.push_back(std::thread(benchmarkConfigurations, std::ref(*it)));
+        }
+        for (size_t i = 0; i < deviceBenchmarks.size(); i++)
+            deviceBenchmarks[i].join();
 
-        if ((*it).number == 0) {
-            instOnly = true;
-        } else {
-            instOnly = false;
+        for(RsrcBenchPairList::iterator it = filteredRsrcBenchList->begin();
+            it != filteredRsrcBenchList->end(); ++it) {
+            if ((*it).number == 0 || ((*it).supportFlags & BEAGLE_FLAG_PROCESSOR_CPU))
+                benchmarkConfigurations(*it);
         }
 
-        double itBenchmarkResult;
-
-        (*it).returnCode = beagle::benchmark::benchmarkResource((*it).number,
-                                                     stateCount,
-                                                     tipCount,
-                                                     patternCount,
-                                                     manualScaling,
-                                                     categoryCount,
-                                                     benchmarkReplicates,
-                                                     compactBufferCount,
-                                                     rescaleFrequency,
-                                                     (calculateDerivatives ? true : false),
-                                                     calculateDerivatives,
-                                                     eigenModelCount,
-                                                     partitionCount,
-                                                     preferenceFlags,
-                                                     requirementFlags,
-                                                     &resourceNumber,
-                                                     &implName,
-                                                     &benchedFlags,
-                                                     &itBenchmarkResult,
-                                                     instOnly);
-
-        (*it).number         = resourceNumber;
-        (*it).benchedFlags   = benchedFlags;
-        (*it).implName       = implName;
-
-        if ((*it).number == 0) {
-            (*it).benchmarkResult = benchmarkResultCPU;
-            (*it).performanceRatio = 1.0;
-        } else {
-            (*it).benchmarkResult = itBenchmarkResult;
-            (*it).performanceRatio = benchmarkResultCPU / (*it).benchmarkResult;
+        setupLock.lock();
+
+        // a failed benchmark may succeed on another day
+        bool allSucceeded = true;
+        std::vector<beagle::benchmark::CachedBenchmark> newBenchmarks;
+        for(RsrcBenchPairList::iterator it = filteredRsrcBenchList->begin();
+            it != filteredRsrcBenchList->end(); ++it) {
+            beagle::benchmark::CachedBenchmark result;
+            result.number           = (*it).number;
+            result.returnCode       = (*it).returnCode;
+            result.benchedFlags     = (*it).benchedFlags;
+            result.benchmarkResult  = (*it).benchmarkResult;
+            result.performanceRatio = (*it).performanceRatio;
+            result.implName         = ((*it).implName != NULL ? (*it).implName : "");
+            result.threadCount      = (*it).threadCount;
+            newBenchmarks.push_back(result);
+            if ((*it).returnCode != BEAGLE_SUCCESS)
+                allSucceeded = false;
         }
+        if (!cacheFileName.empty() && allSucceeded)
+            beagle::benchmark::writeBenchmarkCache(cacheFileName, cacheKey, newBenchmarks);
     }
 
     filteredRsrcBenchList->sort(compareBenchmarkResult); // order from fastest to slowest
@@ -606,6 +1107,7 @@ BeagleBenchmarkedResourceList* beagleGetBenchmarkedResourceList(int tipCount,
         rsrcBenchList->list[i].benchedFlags     = (*it).benchedFlags;
         rsrcBenchList->list[i].benchmarkResult  = (*it).benchmarkResult;
         rsrcBenchList->list[i].performanceRatio = (*it).performanceRatio;
+        rsrcBenchList->list[i].threadCount      = (*it).threadCount;
         i++;
     }
 
@@ -614,6 +1116,237 @@ BeagleBenchmarkedResourceList* beagleGetBenchmarkedResourceList(int tipCount,
     return rsrcBenchList;
 }
 
+BeagleResourceEstimateList* beagleEstimateResourceUsage(int tipCount,
+                                                        int partialsBufferCount,
+                                                        int compactBufferCount,
+                                                        int stateCount,
+                                                        int patternCount,
+                                                        int eigenBufferCount,
+                                                        int matrixBufferCount,
+                                                        int categoryCount,
+                                                        int scaleBufferCount,
+                                                        int* resourceList,
+                                                        int resourceCount,
+                                                        long preferenceFlags,
+                                                        long requirementFlags) {
+    std::lock_guard<std::recursive_mutex> setupLock(setupMutex);
+
+    loadResources(resourceList, resourceCount, requirementFlags);
+
+    PairedList* possibleResources = new PairedList;
+
+    int errorCode = filterResources(resourceList,
+                                    resourceCount,
+                                    preferenceFlags,
+                                    requirementFlags,
+                                    possibleResources);
+
+    if (errorCode != BEAGLE_SUCCESS) {
+        delete possibleResources;
+        return NULL;
+    }
+
+    // the resources in the order beagleGetBenchmarkedResourceList keys its cache with
+    RsrcBenchPairList* filteredRsrcBenchList = new RsrcBenchPairList;
+    for(PairedList::iterator it = possibleResources->begin(); it != possibleResources->end(); ++it) {
+        BeagleBenchmarkedResource itResource;
+        itResource.number = (*it).second;
+        filteredRsrcBenchList->push_back(itResource);
+    }
+
+    RsrcImplList* possibleResourceImplementations = new RsrcImplList;
+
+    rankResourceImplementationPairs(preferenceFlags,
+                                    requirementFlags,
+                                    possibleResources,
+                                    possibleResourceImplementations);
+
+    delete possibleResources;
+
+    // benchmarks of one eigen model and partition without derivatives, with any scaling
+    std::vector<beagle::benchmark::CachedBenchmark> cachedBenchmarks;
+    std::string cacheFileName = beagle::benchmark::getBenchmarkCacheFileName();
+    const long benchmarkScalings[] = {BEAGLE_BENCHFLAG_SCALING_NONE,
+                                      BEAGLE_BENCHFLAG_SCALING_ALWAYS,
+                                      BEAGLE_BENCHFLAG_SCALING_DYNAMIC};
+    for (int i = 0; i < 3 && !cacheFileName.empty(); i++) {
+        std::string cacheKey = benchmarkCacheKey(filteredRsrcBenchList, tipCount,
+                                                 compactBufferCount, stateCount, patternCount,
+                                                 categoryCount, preferenceFlags, requirementFlags,
+                                                 1, 1, 0, benchmarkScalings[i]);
+        if (beagle::benchmark::readBenchmarkCache(cacheFileName, cacheKey, cachedBenchmarks) &&
+            cachedBenchmarks.size() == filteredRsrcBenchList->size())
+            break;
+        cachedBenchmarks.clear();
+    }
+
+    if (rsrcEstimateList != NULL) {
+        free(rsrcEstimateList->list);
+        free(rsrcEstimateList);
+    }
+
+    rsrcEstimateList = (BeagleResourceEstimateList*) malloc(sizeof(BeagleResourceEstimateList));
+    rsrcEstimateList->length = filteredRsrcBenchList->size();
+    rsrcEstimateList->list = (BeagleResourceEstimate*) malloc(sizeof(BeagleResourceEstimate) * rsrcEstimateList->length);
+
+    int i = 0;
+    for(RsrcBenchPairList::iterator it = filteredRsrcBenchList->begin();
+        it != filteredRsrcBenchList->end(); ++it, ++i) {
+        int resource = (*it).number;
+        BeagleResourceEstimate* estimate = &rsrcEstimateList->list[i];
+        estimate->number           = resource;
+        estimate->name             = rsrcList->list[resource].name;
+        estimate->returnCode       = BEAGLE_ERROR_NO_IMPLEMENTATION;
+        estimate->implName         = NULL;
+        estimate->implFlags        = 0;
+        estimate->hostBytes        = 0;
+        estimate->deviceBytes      = 0;
+        estimate->benchmarkResult  = -1.0;
+        estimate->performanceRatio = 0.0;
+
+        // the first implementation beagleCreateInstance would try that can size itself
+        for(RsrcImplList::iterator impl = possibleResourceImplementations->begin();
+            impl != possibleResourceImplementations->end(); ++impl) {
+            if ((*impl).second.first != resource)
+                continue;
+            beagle::BeagleImplFactory* factory = (*impl).second.second;
+            if (factory->estimateMemory(tipCount, partialsBufferCount, compactBufferCount,
+                                        stateCount, patternCount, eigenBufferCount,
+                                        matrixBufferCount, categoryCount, scaleBufferCount,
+                                        preferenceFlags, requirementFlags,
+                                        &estimate->hostBytes,
+                                        &estimate->deviceBytes) == BEAGLE_SUCCESS) {
+                estimate->returnCode = BEAGLE_SUCCESS;
+                estimate->implName   = (char*) factory->getName();
+                estimate->implFlags  = factory->getFlags();
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < cachedBenchmarks.size(); j++) {
+            if (cachedBenchmarks[j].number == resource &&
+                cachedBenchmarks[j].returnCode == BEAGLE_SUCCESS) {
+                estimate->benchmarkResult  = cachedBenchmarks[j].benchmarkResult;
+                estimate->performanceRatio = cachedBenchmarks[j].performanceRatio;
+            }
+        }
+    }
+
+    delete possibleResourceImplementations;
+    delete filteredRsrcBenchList;
+
+    return rsrcEstimateList;
+}
+
+/// creates an implementation on the best ranked pair of resource and factory, or returns
+/// NULL and sets errorCode
+beagle::BeagleImpl* createBestImplementation(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int* resourceList,
+                                             int resourceCount,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+    PairedList* possibleResources = new PairedList;
+
+    *errorCode = filterResources(resourceList,
+                                 resourceCount,
+                                 preferenceFlags,
+                                 requirementFlags,
+                                 possibleResources);
+
+    if (*errorCode != BEAGLE_SUCCESS) {
+        delete possibleResources;
+        return NULL;
+    }
+
+    RsrcImplList* possibleResourceImplementations = new RsrcImplList;
+
+    *errorCode = rankResourceImplementationPairs(preferenceFlags,
+                                                 requirementFlags,
+                                                 possibleResources,
+                                                 possibleResourceImplementations);
+
+    delete possibleResources;
+
+    if (*errorCode != BEAGLE_SUCCESS) {
+        delete possibleResourceImplementations;
+        return NULL;
+    }
+
+    beagle::BeagleImpl* bestBeagle = NULL;
+    *errorCode = BEAGLE_ERROR_NO_RESOURCE;
+
+    for(RsrcImplList::iterator it = possibleResourceImplementations->begin(); it != possibleResourceImplementations->end(); ++it) {
+        int resource = (*it).second.first;
+        beagle::BeagleImplFactory* factory = (*it).second.second;
+
+        bestBeagle = factory->createImpl(tipCount, partialsBufferCount,
+                                                            compactBufferCount, stateCount,
+                                                            patternCount, eigenBufferCount,
+                                                            matrixBufferCount, categoryCount,
+                                                            scaleBufferCount,
+                                                            resource,
+                                                            ResourceMap[resource],
+                                                            preferenceFlags,
+                                                            requirementFlags,
+                                                            errorCode);
+
+        if (bestBeagle != NULL) {
+            *errorCode = BEAGLE_SUCCESS;
+            break;
+        }
+    }
+
+    delete possibleResourceImplementations;
+
+    return bestBeagle;
+}
+
+/// appends an implementation to the instance list, returns the new instance identifier
+int addInstance(beagle::BeagleImpl* beagleInstance,
+                BeagleInstanceDetails* returnInfo) {
+    if (sharedThreadPool)
+        beagleInstance->setCPUThreadPool(sharedThreadPool);
+
+    const char* traceFile = getenv("BEAGLE_TRACE_FILE");
+    if (!traceRecorder && traceFile != NULL && traceFile[0] != '\0') {
+        traceRecorder.reset(new beagle::TraceRecorder(traceFile));
+        if (!traceRecorder->isOpen())
+            traceRecorder.reset();
+        else if (sharedThreadPool)
+            sharedThreadPool->setTrace(traceRecorder.get());
+    }
+    if (traceRecorder)
+        beagleInstance->setTrace(traceRecorder.get());
+
+    BeagleStatistics* statistics = new BeagleStatistics;
+    memset(statistics, 0, sizeof(BeagleStatistics));
+    int instance = instances.add(beagleInstance, statistics);
+    if (instance < 0) {
+        delete statistics;
+        delete beagleInstance;
+        return instance;
+    }
+
+    int returnValue = beagleInstance->getInstanceDetails(returnInfo);
+    if (returnValue == BEAGLE_SUCCESS) {
+        returnInfo->resourceName = rsrcList->list[returnInfo->resourceNumber].name;
+        // TODO: move implDescription to inside the implementation
+        returnInfo->implDescription = (char*) "none";
+
+        returnValue = instance;
+    }
+    return returnValue;
+}
+
 int beagleCreateInstance(int tipCount,
                          int partialsBufferCount,
                          int compactBufferCount,
@@ -630,87 +1363,853 @@ int beagleCreateInstance(int tipCount,
                          BeagleInstanceDetails* returnInfo) {
     DEBUG_CREATE_TIME();
     try {
-        if (instances == NULL)
-            instances = new std::vector<beagle::BeagleImpl*>;
+        std::lock_guard<std::recursive_mutex> setupLock(setupMutex);
 
-        if (rsrcList == NULL)
-            beagleGetResourceList();
-        
-        if (implFactory == NULL)
-            beagleGetFactoryList();
+        loadResources(resourceList, resourceCount, requirementFlags);
         
         loaded = 1;
         
         int errorCode = BEAGLE_SUCCESS;
 
-        PairedList* possibleResources = new PairedList;
+        beagle::BeagleImpl* bestBeagle = createBestImplementation(tipCount, partialsBufferCount,
+                                                                  compactBufferCount, stateCount,
+                                                                  patternCount, eigenBufferCount,
+                                                                  matrixBufferCount, categoryCount,
+                                                                  scaleBufferCount,
+                                                                  resourceList, resourceCount,
+                                                                  preferenceFlags,
+                                                                  requirementFlags,
+                                                                  &errorCode);
+        
+        int returnValue = errorCode;
+        if (bestBeagle != NULL)
+            returnValue = addInstance(bestBeagle, returnInfo);
+
+        const char* recordFile = getenv("BEAGLE_RECORD_FILE");
+        if (!callRecorder && recordFile != NULL && recordFile[0] != '\0') {
+            callRecorder.reset(new beagle::CallRecorder(recordFile));
+            if (!callRecorder->isOpen())
+                callRecorder.reset();
+        }
+        if (callRecorder) {
+            long flags = (bestBeagle != NULL ? returnInfo->flags : 0);
+            beagle::CallRecorder::Shape shape = { stateCount, patternCount, categoryCount,
+                (flags & BEAGLE_FLAG_EIGEN_COMPLEX ? 2 * stateCount : stateCount) };
+            callRecorder->setShape(returnValue, shape);
+            callRecorder->record(beagle::RECORDED_CREATE_INSTANCE, returnValue, returnValue)
+                .putInt(tipCount).putInt(partialsBufferCount).putInt(compactBufferCount)
+                .putInt(stateCount).putInt(patternCount).putInt(eigenBufferCount)
+                .putInt(matrixBufferCount).putInt(categoryCount).putInt(scaleBufferCount)
+                .putInts(resourceList, resourceCount).putLong(preferenceFlags)
+                .putLong(requirementFlags).putLong(flags);
+        }
+
+        // No implementations found or appropriate, return last error code
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+    loaded = 1;
 
-        errorCode = filterResources(resourceList,
-                                    resourceCount,
-                                    preferenceFlags,
-                                    requirementFlags,
-                                    possibleResources);
+}
 
-        if (errorCode != BEAGLE_SUCCESS) {
-            delete possibleResources;
-            return errorCode;
-        }
+/// makes the instance owning the shards, when it is not a beagle::BeagleShardedImpl
+typedef std::function<beagle::BeagleImpl*(const std::vector<beagle::BeagleImpl*>& shards,
+                                          const beagle::BeagleShardedImpl::ShardFactory& shardFactory)>
+    ShardedInstanceMaker;
+
+/// creates one implementation per resource, holding shardPatternCounts[i] patterns each, and
+/// adds them as a single instance; agreeOnErrorCode, if given, turns the outcome of creating
+/// the shards into the outcome shared with the other processes of a distributed instance
+int createShardedInstance(int tipCount,
+                          int partialsBufferCount,
+                          int compactBufferCount,
+                          int stateCount,
+                          const std::vector<int>& shardPatternCounts,
+                          int eigenBufferCount,
+                          int matrixBufferCount,
+                          int categoryCount,
+                          int scaleBufferCount,
+                          const int* resourceList,
+                          long preferenceFlags,
+                          long requirementFlags,
+                          BeagleInstanceDetails* returnInfo,
+                          const ShardedInstanceMaker& makeInstance = ShardedInstanceMaker(),
+                          const std::function<int(int)>& agreeOnErrorCode = std::function<int(int)>()) {
+    std::vector<int> resources(resourceList, resourceList + shardPatternCounts.size());
+
+    // makes the shards, again on rebalancing
+    beagle::BeagleShardedImpl::ShardFactory shardFactory =
+        [=] (int shard, int shardPatternCount, int* errorCode) {
+            int resource = resources[shard];
+            std::lock_guard<std::recursive_mutex> setupLock(setupMutex);
+            return createBestImplementation(tipCount, partialsBufferCount,
+                                            compactBufferCount, stateCount,
+                                            shardPatternCount, eigenBufferCount,
+                                            matrixBufferCount, categoryCount,
+                                            scaleBufferCount,
+                                            &resource, 1,
+                                            preferenceFlags,
+                                            requirementFlags,
+                                            errorCode);
+        };
+
+    std::vector<beagle::BeagleImpl*> shards;
+    try {
+        std::lock_guard<std::recursive_mutex> setupLock(setupMutex);
 
-        RsrcImplList* possibleResourceImplementations = new RsrcImplList;
+        loadResources(resourceList, (int) resources.size(), requirementFlags);
 
-        errorCode = rankResourceImplementationPairs(preferenceFlags,
-                                                    requirementFlags,
-                                                    possibleResources,
-                                                    possibleResourceImplementations);
+        loaded = 1;
 
-        delete possibleResources;
+        int errorCode = BEAGLE_SUCCESS;
 
+        for (size_t i = 0; i < resources.size() && errorCode == BEAGLE_SUCCESS; i++) {
+            beagle::BeagleImpl* shard = shardFactory(i, shardPatternCounts[i], &errorCode);
+            if (shard == NULL) {
+                if (errorCode == BEAGLE_SUCCESS)
+                    errorCode = BEAGLE_ERROR_GENERAL;
+            } else {
+                shards.push_back(shard);
+            }
+        }
+        if (agreeOnErrorCode)
+            errorCode = agreeOnErrorCode(errorCode);
         if (errorCode != BEAGLE_SUCCESS) {
-            delete possibleResourceImplementations;
+            for (size_t j = 0; j < shards.size(); j++)
+                delete shards[j];
             return errorCode;
         }
 
-        beagle::BeagleImpl* bestBeagle = NULL;
-        errorCode = BEAGLE_ERROR_NO_RESOURCE;
-
-        for(RsrcImplList::iterator it = possibleResourceImplementations->begin(); it != possibleResourceImplementations->end(); ++it) {
-            int resource = (*it).second.first;
-            beagle::BeagleImplFactory* factory = (*it).second.second;
-            
-            bestBeagle = factory->createImpl(tipCount, partialsBufferCount,
-                                                                compactBufferCount, stateCount,
-                                                                patternCount, eigenBufferCount,
-                                                                matrixBufferCount, categoryCount,
-                                                                scaleBufferCount,
-                                                                resource,
-                                                                ResourceMap[resource],
-                                                                preferenceFlags,
-                                                                requirementFlags,
-                                                                &errorCode);
-            
-            if (bestBeagle != NULL)
-                break; 
-        }
-        
-        delete possibleResourceImplementations;
-        
-        if (bestBeagle != NULL) {
-            int instance = instances->size();
-            instances->push_back(bestBeagle);
-            
-            int returnValue = bestBeagle->getInstanceDetails(returnInfo);
-            if (returnValue == BEAGLE_SUCCESS) {
-                returnInfo->resourceName = rsrcList->list[returnInfo->resourceNumber].name;
-                // TODO: move implDescription to inside the implementation
-                returnInfo->implDescription = (char*) "none";
-                
-                returnValue = instance;
+        // the sharded instance owns the shards from here on
+        beagle::BeagleImpl* beagleInstance =
+            (makeInstance ? makeInstance(shards, shardFactory) :
+                            new beagle::BeagleShardedImpl(shards, shardPatternCounts,
+                                                          stateCount, categoryCount,
+                                                          matrixBufferCount,
+                                                          shardFactory));
+        shards.clear();
+
+        return addInstance(beagleInstance, returnInfo);
+    }
+    catch (std::bad_alloc &) {
+        for (size_t j = 0; j < shards.size(); j++)
+            delete shards[j];
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        for (size_t j = 0; j < shards.size(); j++)
+            delete shards[j];
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleCreateShardedInstance(int tipCount,
+                                int partialsBufferCount,
+                                int compactBufferCount,
+                                int stateCount,
+                                int patternCount,
+                                int eigenBufferCount,
+                                int matrixBufferCount,
+                                int categoryCount,
+                                int scaleBufferCount,
+                                int* resourceList,
+                                int resourceCount,
+                                long preferenceFlags,
+                                long requirementFlags,
+                                BeagleInstanceDetails* returnInfo) {
+    DEBUG_CREATE_TIME();
+    if (resourceList == NULL || resourceCount < 1 || resourceCount > patternCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // equal shares
+    std::vector<int> shardPatternCounts =
+        beagle::BeagleShardedImpl::splitPatterns(patternCount, std::vector<double>(resourceCount, 1.0));
+
+    return createShardedInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 shardPatternCounts, eigenBufferCount, matrixBufferCount,
+                                 categoryCount, scaleBufferCount, resourceList, preferenceFlags,
+                                 requirementFlags, returnInfo);
+}
+
+int beagleCreateDistributedInstance(int tipCount,
+                                    int partialsBufferCount,
+                                    int compactBufferCount,
+                                    int stateCount,
+                                    int patternCount,
+                                    int eigenBufferCount,
+                                    int matrixBufferCount,
+                                    int categoryCount,
+                                    int scaleBufferCount,
+                                    int* resourceList,
+                                    int resourceCount,
+                                    long preferenceFlags,
+                                    long requirementFlags,
+                                    void* communicator,
+                                    BeagleInstanceDetails* returnInfo) {
+    DEBUG_CREATE_TIME();
+#ifdef HAVE_MPI
+    MPI_Comm processes = (communicator != NULL ? *(MPI_Comm*) communicator : MPI_COMM_WORLD);
+    int rank;
+    MPI_Comm_rank(processes, &rank);
+
+    std::vector<int> processPatternCounts;
+    int errorCode = BEAGLE_SUCCESS;
+    if (resourceList == NULL || resourceCount < 1) {
+        errorCode = BEAGLE_ERROR_OUT_OF_RANGE;
+    } else {
+        int processCount;
+        MPI_Comm_size(processes, &processCount);
+        if (processCount > patternCount)
+            errorCode = BEAGLE_ERROR_OUT_OF_RANGE;
+        else
+            processPatternCounts = beagle::BeagleDistributedImpl::splitProcessPatterns(patternCount,
+                                                                                       processes);
+        if (errorCode == BEAGLE_SUCCESS && resourceCount > processPatternCounts[rank])
+            errorCode = BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    // all processes create their part or none does, as the calls that follow are collective
+    std::function<int(int)> agreeOnErrorCode = [processes] (int localCode) {
+        int code;
+        MPI_Allreduce(&localCode, &code, 1, MPI_INT, MPI_MIN, processes);
+        return code;
+    };
+    if (agreeOnErrorCode(errorCode) != BEAGLE_SUCCESS)
+        return (errorCode != BEAGLE_SUCCESS ? errorCode : BEAGLE_ERROR_GENERAL);
+
+    std::vector<int> shardPatternCounts =
+        beagle::BeagleShardedImpl::splitPatterns(processPatternCounts[rank],
+                                                 std::vector<double>(resourceCount, 1.0));
+
+    ShardedInstanceMaker makeInstance =
+        [&] (const std::vector<beagle::BeagleImpl*>& shards,
+             const beagle::BeagleShardedImpl::ShardFactory& shardFactory) {
+            return new beagle::BeagleDistributedImpl(shards, shardPatternCounts,
+                                                     processPatternCounts, processes,
+                                                     stateCount, categoryCount,
+                                                     matrixBufferCount, shardFactory);
+        };
+
+    return createShardedInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 shardPatternCounts, eigenBufferCount, matrixBufferCount,
+                                 categoryCount, scaleBufferCount, resourceList, preferenceFlags,
+                                 requirementFlags, returnInfo, makeInstance, agreeOnErrorCode);
+#else
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+#endif
+}
+
+int beagleCreateHybridInstance(int tipCount,
+                               int partialsBufferCount,
+                               int compactBufferCount,
+                               int stateCount,
+                               int patternCount,
+                               int eigenBufferCount,
+                               int matrixBufferCount,
+                               int categoryCount,
+                               int scaleBufferCount,
+                               int* resourceList,
+                               int resourceCount,
+                               long preferenceFlags,
+                               long requirementFlags,
+                               long benchmarkFlags,
+                               BeagleInstanceDetails* returnInfo) {
+    DEBUG_CREATE_TIME();
+    if (resourceList == NULL || resourceCount < 1 || resourceCount > patternCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    try {
+        // shares in proportion to the speed of each resource on this problem
+        BeagleBenchmarkedResourceList* benchmarks =
+            beagleGetBenchmarkedResourceList(tipCount, compactBufferCount, stateCount,
+                                             patternCount, categoryCount, resourceList,
+                                             resourceCount, preferenceFlags, requirementFlags,
+                                             eigenBufferCount, 1, 0, benchmarkFlags);
+        if (benchmarks == NULL)
+            return BEAGLE_ERROR_NO_RESOURCE;
+
+        std::vector<double> speeds(resourceCount, 0.0);
+        for (int i = 0; i < resourceCount; i++) {
+            for (int j = 0; j < benchmarks->length; j++) {
+                const BeagleBenchmarkedResource& benchmark = benchmarks->list[j];
+                if (benchmark.number == resourceList[i] && benchmark.returnCode == BEAGLE_SUCCESS &&
+                    benchmark.benchmarkResult > 0.0)
+                    speeds[i] = 1.0 / benchmark.benchmarkResult;
             }
-            return returnValue;
-        }   
-        
-        // No implementations found or appropriate, return last error code
-        return errorCode;
+            if (speeds[i] == 0.0)
+                return BEAGLE_ERROR_NO_RESOURCE;
+        }
+
+        // a resource listed more than once shares its speed
+        std::vector<double> weights(speeds);
+        for (int i = 0; i < resourceCount; i++) {
+            int listed = 0;
+            for (int j = 0; j < resourceCount; j++)
+                listed += (resourceList[j] == resourceList[i] ? 1 : 0);
+            weights[i] /= listed;
+        }
+
+        std::vector<int> shardPatternCounts =
+            beagle::BeagleShardedImpl::splitPatterns(patternCount, weights);
+
+        return createShardedInstance(tipCount, partialsBufferCount, compactBufferCount,
+                                     stateCount, shardPatternCounts, eigenBufferCount,
+                                     matrixBufferCount, categoryCount, scaleBufferCount,
+                                     resourceList, preferenceFlags, requirementFlags,
+                                     returnInfo);
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleRebalanceInstance(int instance) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->rebalance();
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleResetInstance(int instance) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->reset();
+        if (callRecorder)
+            callRecorder->record(beagle::RECORDED_RESET_INSTANCE, instance, returnValue);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleGrowInstance(int instance,
+                       int tipCount,
+                       int partialsBufferCount,
+                       int compactBufferCount,
+                       int patternCount,
+                       int matrixBufferCount,
+                       int scaleBufferCount) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->grow(tipCount, partialsBufferCount, compactBufferCount,
+                                               patternCount, matrixBufferCount, scaleBufferCount);
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            if (returnValue == BEAGLE_SUCCESS && shape.patternCount > 0) {
+                shape.patternCount = patternCount;
+                callRecorder->setShape(instance, shape);
+            }
+            callRecorder->record(beagle::RECORDED_GROW_INSTANCE, instance, returnValue)
+                .putInt(tipCount).putInt(partialsBufferCount).putInt(compactBufferCount)
+                .putInt(patternCount).putInt(matrixBufferCount).putInt(scaleBufferCount);
+        }
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSaveInstanceState(int instance,
+                            const char* fileName) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        if (fileName == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        int returnValue = beagleInstance->saveState(fileName);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleLoadInstanceState(int instance,
+                            const char* fileName) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        if (fileName == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        int returnValue = beagleInstance->loadState(fileName);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleFinalizeInstance(int instance) {
+    DEBUG_FINALIZE_TIME();
+    try {
+        BeagleStatistics* statistics = NULL;
+        beagle::BeagleImpl* beagleInstance = instances.remove(instance, &statistics);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        delete beagleInstance;
+        delete statistics;
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_FINALIZE_INSTANCE, instance, BEAGLE_SUCCESS);
+            callRecorder->flush();
+        }
+        return BEAGLE_SUCCESS;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleGetInstanceStatistics(int instance,
+                                BeagleStatistics* outStatistics) {
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        *outStatistics = *instances.getStatistics(instance);
+        return beagleInstance->getStatistics(outStatistics);
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleResetInstanceStatistics(int instance) {
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        memset(instances.getStatistics(instance), 0, sizeof(BeagleStatistics));
+        return beagleInstance->resetStatistics();
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUThreadCount(int instance,
+                            int threadCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setCPUThreadCount(threadCount);
+    DEBUG_END_TIME();
+    if (callRecorder) {
+        callRecorder->record(beagle::RECORDED_SET_CPU_THREAD_COUNT, instance, returnValue)
+            .putInt(threadCount);
+    }
+    return returnValue;
+}
+
+int beagleSetSharedCPUThreadCount(int threadCount) {
+    if (threadCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    try {
+        std::lock_guard<std::recursive_mutex> setupLock(setupMutex);
+        // instances already attached hold their own reference to the old pool
+        if (threadCount == 0)
+            sharedThreadPool.reset();
+        else {
+            sharedThreadPool = std::make_shared<beagle::cpu::ThreadPool>(threadCount);
+            sharedThreadPool->setTrace(traceRecorder.get());
+        }
+        return BEAGLE_SUCCESS;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleCalibrateCPUThreadCount(int instance) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->calibrateCPUThreadCount();
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUThreadSpin(int instance,
+                           int spinMicroseconds) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUThreadSpin(spinMicroseconds);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUNumaPlacement(int instance,
+                              int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUNumaPlacement(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUBufferArena(int instance,
+                            int enable,
+                            long hugePageSize) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUBufferArena(enable != 0, hugePageSize);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUScratchFile(int instance,
+                            const char* directory,
+                            int prefetchDistance) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUScratchFile(directory, prefetchDistance);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetLazyBufferAllocation(int instance,
+                                  int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setLazyBufferAllocation(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUPatternTiling(int instance,
+                              int patternBlockSize) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUPatternTiling(patternBlockSize);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUInterleavedPatterns(int instance,
+                                    int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUInterleavedPatterns(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetPartialsCheckpointing(int instance,
+                                   int maxResidentBuffers) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setPartialsCheckpointing(maxResidentBuffers);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCPUParallelOperations(int instance,
+                                   int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setCPUParallelOperations(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetTransitionMatrixCache(int instance,
+                                   int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setTransitionMatrixCache(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetBufferVersioning(int instance,
+                              int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setBufferVersioning(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetPowerOfTwoScaling(int instance,
+                               int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setPowerOfTwoScaling(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetScalingThreshold(int instance,
+                              double threshold) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setScalingThreshold(threshold);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetMixedPrecision(int instance,
+                            int enable) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setMixedPrecision(enable != 0);
+        DEBUG_END_TIME();
+        return returnValue;
     }
     catch (std::bad_alloc &) {
         return BEAGLE_ERROR_OUT_OF_MEMORY;
@@ -721,19 +2220,25 @@ int beagleCreateInstance(int tipCount,
     catch (...) {
         return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
     }
-    loaded = 1;
-
 }
 
-int beagleFinalizeInstance(int instance) {
-    DEBUG_FINALIZE_TIME();
+int beagleSetTipStates(int instance,
+                 int tipIndex,
+                 const int* inStates) {
+    DEBUG_START_TIME();
     try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
-        delete beagleInstance;
-        (*instances)[instance] = NULL;
-        return BEAGLE_SUCCESS;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SET_TIP_STATES);
+        int returnValue = beagleInstance->setTipStates(tipIndex, inStates);
+        DEBUG_END_TIME();
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            callRecorder->record(beagle::RECORDED_SET_TIP_STATES, instance, returnValue)
+                .putInt(tipIndex).putInts(inStates, shape.patternCount);
+        }
+        return returnValue;
     }
     catch (std::bad_alloc &) {
         return BEAGLE_ERROR_OUT_OF_MEMORY;
@@ -746,26 +2251,14 @@ int beagleFinalizeInstance(int instance) {
     }
 }
 
-int beagleSetCPUThreadCount(int instance,
-                            int threadCount) {
-    DEBUG_START_TIME();
-    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
-    if (beagleInstance == NULL)
-        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
-    int returnValue = beagleInstance->setCPUThreadCount(threadCount);
-    DEBUG_END_TIME();
-    return returnValue;
-}
-
-int beagleSetTipStates(int instance,
-                 int tipIndex,
-                 const int* inStates) {
+int beagleSetTipStatesPacking(int instance,
+                              int enable) {
     DEBUG_START_TIME();
     try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
-        int returnValue = beagleInstance->setTipStates(tipIndex, inStates);
+        int returnValue = beagleInstance->setTipStatesPacking(enable != 0);
         DEBUG_END_TIME();
         return returnValue;
     }
@@ -788,8 +2281,14 @@ int beagleSetTipPartials(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SET_TIP_PARTIALS);
         int returnValue = beagleInstance->setTipPartials(tipIndex, inPartials);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            callRecorder->record(beagle::RECORDED_SET_TIP_PARTIALS, instance, returnValue)
+                .putInt(tipIndex).putDoubles(inPartials, shape.patternCount * shape.stateCount);
+        }
         return returnValue;
     }
     catch (std::bad_alloc &) {
@@ -811,8 +2310,15 @@ int beagleSetPartials(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SET_PARTIALS);
         int returnValue = beagleInstance->setPartials(bufferIndex, inPartials);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            callRecorder->record(beagle::RECORDED_SET_PARTIALS, instance, returnValue)
+                .putInt(bufferIndex)
+                .putDoubles(inPartials, shape.patternCount * shape.stateCount * shape.categoryCount);
+        }
         return returnValue;
     }
     catch (std::bad_alloc &) {
@@ -832,6 +2338,7 @@ int beagleGetPartials(int instance, int bufferIndex, int scaleIndex, double* out
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_GET_PARTIALS);
         int returnValue = beagleInstance->getPartials(bufferIndex, scaleIndex, outPartials);
         DEBUG_END_TIME();
         return returnValue;
@@ -857,9 +2364,18 @@ int beagleSetEigenDecomposition(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SET_EIGEN_DECOMPOSITION);
         int returnValue = beagleInstance->setEigenDecomposition(eigenIndex, inEigenVectors,
                                                      inInverseEigenVectors, inEigenValues);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            callRecorder->record(beagle::RECORDED_SET_EIGEN_DECOMPOSITION, instance, returnValue)
+                .putInt(eigenIndex)
+                .putDoubles(inEigenVectors, shape.stateCount * shape.stateCount)
+                .putDoubles(inInverseEigenVectors, shape.stateCount * shape.stateCount)
+                .putDoubles(inEigenValues, shape.eigenValueCount);
+        }
         return returnValue;
     }
     catch (std::bad_alloc &) {
@@ -882,6 +2398,11 @@ int beagleSetStateFrequencies(int instance,
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setStateFrequencies(stateFrequenciesIndex, inStateFrequencies);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_SET_STATE_FREQUENCIES, instance, returnValue)
+            .putInt(stateFrequenciesIndex).putDoubles(inStateFrequencies, shape.stateCount);
+    }
     return returnValue;
 }
 
@@ -894,6 +2415,11 @@ int beagleSetCategoryWeights(int instance,
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setCategoryWeights(categoryWeightsIndex, inCategoryWeights);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_SET_CATEGORY_WEIGHTS, instance, returnValue)
+            .putInt(categoryWeightsIndex).putDoubles(inCategoryWeights, shape.categoryCount);
+    }
     return returnValue;
 }
 
@@ -905,6 +2431,85 @@ int beagleSetPatternWeights(int instance,
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setPatternWeights(inPatternWeights);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_SET_PATTERN_WEIGHTS, instance, returnValue)
+            .putDoubles(inPatternWeights, shape.patternCount);
+    }
+    return returnValue;
+}
+
+int beagleCompressSitePatterns(int taxonCount,
+                               int siteCount,
+                               const int* inSiteStates,
+                               const double* inSiteWeights,
+                               int threadCount,
+                               int* outPatternCount,
+                               int* outPatternStates,
+                               double* outPatternWeights,
+                               int* outSitePatterns) {
+    DEBUG_START_TIME();
+    if (taxonCount < 1 || siteCount < 1 || inSiteStates == NULL || outPatternCount == NULL ||
+        outPatternStates == NULL || outPatternWeights == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    try {
+        beagle::PatternCompressor compressor(taxonCount, siteCount, inSiteStates, threadCount);
+        int patternCount = compressor.compress();
+        compressor.getPatternStates(outPatternStates);
+        compressor.getPatternWeights(inSiteWeights, outPatternWeights);
+        if (outSitePatterns != NULL) {
+            const std::vector<int>& sitePatterns = compressor.getSitePatterns();
+            std::copy(sitePatterns.begin(), sitePatterns.end(), outSitePatterns);
+        }
+        *outPatternCount = patternCount;
+        DEBUG_END_TIME();
+        return BEAGLE_SUCCESS;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetCompressedSitePatterns(int instance,
+                                    int taxonCount,
+                                    int patternCount,
+                                    const int* inPatternStates,
+                                    const double* inPatternWeights) {
+    if (taxonCount < 0 || patternCount < 1 || inPatternStates == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int taxon = 0; taxon < taxonCount; taxon++) {
+        int returnValue = beagleSetTipStates(instance, taxon,
+                                             inPatternStates + (size_t) taxon * patternCount);
+        if (returnValue != BEAGLE_SUCCESS)
+            return returnValue;
+    }
+    if (inPatternWeights != NULL)
+        return beagleSetPatternWeights(instance, inPatternWeights);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleSetSiteRepeats(int instance,
+                         int enable) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setSiteRepeats(enable != 0);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetGapPatternSkipping(int instance,
+                                int enable) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setGapPatternSkipping(enable != 0);
+    DEBUG_END_TIME();
     return returnValue;
 }
 
@@ -917,6 +2522,11 @@ int beagleSetPatternPartitions(int instance,
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setPatternPartitions(partitionCount, inPatternPartitions);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_SET_PATTERN_PARTITIONS, instance, returnValue)
+            .putInt(partitionCount).putInts(inPatternPartitions, shape.patternCount);
+    }
     return returnValue;
 }
 
@@ -929,6 +2539,11 @@ int beagleSetCategoryRates(int instance,
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->setCategoryRates(inCategoryRates);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            callRecorder->record(beagle::RECORDED_SET_CATEGORY_RATES, instance, returnValue)
+                .putDoubles(inCategoryRates, shape.categoryCount);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -951,6 +2566,11 @@ int beagleSetCategoryRatesWithIndex(int instance,
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setCategoryRatesWithIndex(categoryRatesIndex, inCategoryRates);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_SET_CATEGORY_RATES_WITH_INDEX, instance, returnValue)
+            .putInt(categoryRatesIndex).putDoubles(inCategoryRates, shape.categoryCount);
+    }
     return returnValue;
 }
 
@@ -963,8 +2583,16 @@ int beagleSetTransitionMatrix(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SET_TRANSITION_MATRICES);
         int returnValue = beagleInstance->setTransitionMatrix(matrixIndex, inMatrix, paddedValue);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            callRecorder->record(beagle::RECORDED_SET_TRANSITION_MATRIX, instance, returnValue)
+                .putInt(matrixIndex)
+                .putDoubles(inMatrix, shape.stateCount * shape.stateCount * shape.categoryCount)
+                .putDouble(paddedValue);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -988,8 +2616,16 @@ int beagleSetTransitionMatrices(int instance,
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SET_TRANSITION_MATRICES);
     int returnValue = beagleInstance->setTransitionMatrices(matrixIndices, inMatrices, paddedValues, count);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_SET_TRANSITION_MATRICES, instance, returnValue)
+            .putInts(matrixIndices, count)
+            .putDoubles(inMatrices, count * shape.stateCount * shape.stateCount * shape.categoryCount)
+            .putDoubles(paddedValues, count);
+    }
     return returnValue;
     //    }
     //    catch (std::bad_alloc &) {
@@ -1030,6 +2666,7 @@ int beagleConvolveTransitionMatrices(int instance,
     if (beagleInstance == NULL) {
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     } else {
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
         int returnValue = beagleInstance->convolveTransitionMatrices(firstIndices,
                                            secondIndices, resultIndices, matrixCount);
         DEBUG_END_TIME();
@@ -1038,6 +2675,32 @@ int beagleConvolveTransitionMatrices(int instance,
 
 }//END: beagleConvolveTransitionMatrices
 
+int beagleConvolveTransitionMatrixChains(int instance,
+                                         const int* chainIndices,
+                                         const int* chainLengths,
+                                         const int* scratchIndices,
+                                         const int* resultIndices,
+                                         int chainCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
+    int returnValue = beagleInstance->convolveTransitionMatrixChains(chainIndices, chainLengths,
+                                                                     scratchIndices, resultIndices,
+                                                                     chainCount);
+    DEBUG_END_TIME();
+    if (callRecorder) {
+        int totalLength = 0;
+        for (int i = 0; i < chainCount; i++)
+            totalLength += chainLengths[i];
+        callRecorder->record(beagle::RECORDED_CONVOLVE_TRANSITION_MATRIX_CHAINS, instance, returnValue)
+            .putInts(chainIndices, totalLength).putInts(chainLengths, chainCount)
+            .putInts(scratchIndices, chainCount).putInts(resultIndices, chainCount);
+    }
+    return returnValue;
+}
+
 int beagleUpdateTransitionMatrices(int instance,
                              int eigenIndex,
                              const int* probabilityIndices,
@@ -1050,10 +2713,17 @@ int beagleUpdateTransitionMatrices(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
         int returnValue = beagleInstance->updateTransitionMatrices(eigenIndex, probabilityIndices,
                                                         firstDerivativeIndices,
                                                         secondDerivativeIndices, edgeLengths, count);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_UPDATE_TRANSITION_MATRICES, instance, returnValue)
+                .putInt(eigenIndex).putInts(probabilityIndices, count)
+                .putInts(firstDerivativeIndices, count).putInts(secondDerivativeIndices, count)
+                .putDoubles(edgeLengths, count);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1079,10 +2749,19 @@ int beagleUpdateTransitionMatricesWithModelCategories(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
         int returnValue = beagleInstance->updateTransitionMatricesWithModelCategories(eigenIndices, probabilityIndices,
                                                         firstDerivativeIndices,
                                                         secondDerivativeIndices, edgeLengths, count);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+            callRecorder->record(beagle::RECORDED_UPDATE_TRANSITION_MATRICES_WITH_MODEL_CATEGORIES, instance,
+                                 returnValue)
+                .putInts(eigenIndices, shape.categoryCount).putInts(probabilityIndices, count)
+                .putInts(firstDerivativeIndices, count).putInts(secondDerivativeIndices, count)
+                .putDoubles(edgeLengths, count);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1109,10 +2788,85 @@ int beagleUpdateTransitionMatricesWithMultipleModels(int instance,
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
     int returnValue = beagleInstance->updateTransitionMatricesWithMultipleModels(eigenIndices, categoryRateIndices,
                                                                                  probabilityIndices, firstDerivativeIndices,
                                                                                  secondDerivativeIndices, edgeLengths, count);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        callRecorder->record(beagle::RECORDED_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS, instance,
+                             returnValue)
+            .putInts(eigenIndices, count).putInts(categoryRateIndices, count)
+            .putInts(probabilityIndices, count).putInts(firstDerivativeIndices, count)
+            .putInts(secondDerivativeIndices, count).putDoubles(edgeLengths, count);
+    }
+    return returnValue;
+}
+
+
+int beagleUpdateTransitionMatricesWithRateMatrix(int instance,
+                                                 const double* inRateMatrix,
+                                                 const int* probabilityIndices,
+                                                 const double* edgeLengths,
+                                                 int count) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
+    int returnValue = beagleInstance->updateTransitionMatricesWithRateMatrix(inRateMatrix, probabilityIndices,
+                                                                             edgeLengths, count);
+    DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_UPDATE_TRANSITION_MATRICES_WITH_RATE_MATRIX, instance,
+                             returnValue)
+            .putDoubles(inRateMatrix, shape.stateCount * shape.stateCount)
+            .putInts(probabilityIndices, count).putDoubles(edgeLengths, count);
+    }
+    return returnValue;
+}
+
+int beagleUpdateTransitionMatrixDerivativesWithRateMatrix(int instance,
+                                                          const double* inRateMatrix,
+                                                          const double* inRateMatrixDerivative,
+                                                          const int* derivativeIndices,
+                                                          const double* edgeLengths,
+                                                          int count) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
+    int returnValue = beagleInstance->updateTransitionMatrixDerivativesWithRateMatrix(inRateMatrix,
+                                                                                      inRateMatrixDerivative,
+                                                                                      derivativeIndices,
+                                                                                      edgeLengths, count);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleUpdateTransitionMatricesForReplicates(int instance,
+                                                const int* eigenIndices,
+                                                const int* probabilityIndices,
+                                                const double* edgeLengths,
+                                                int count,
+                                                int replicateCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_TRANSITION_MATRICES);
+    int returnValue = beagleInstance->updateTransitionMatricesForReplicates(eigenIndices, probabilityIndices,
+                                                                            edgeLengths, count,
+                                                                            replicateCount);
+    DEBUG_END_TIME();
+    if (callRecorder) {
+        callRecorder->record(beagle::RECORDED_UPDATE_TRANSITION_MATRICES_FOR_REPLICATES, instance,
+                             returnValue)
+            .putInts(eigenIndices, replicateCount).putInts(probabilityIndices, count)
+            .putDoubles(edgeLengths, count * replicateCount);
+    }
     return returnValue;
 }
 
@@ -1126,8 +2880,15 @@ int beagleUpdatePartials(const int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_PARTIALS);
+        callStatistics.addOperations((const int*)operations, operationCount, BEAGLE_OP_COUNT);
         int returnValue = beagleInstance->updatePartials((const int*)operations, operationCount, cumulativeScalingIndex);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_UPDATE_PARTIALS, instance, returnValue)
+                .putInts((const int*)operations, operationCount * BEAGLE_OP_COUNT)
+                .putInt(cumulativeScalingIndex);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1141,6 +2902,34 @@ int beagleUpdatePartials(const int instance,
 //    }
 }
 
+int beagleUpdatePartialsMulti(const int* instances,
+                              int instanceCount,
+                              const BeagleOperation* const* operations,
+                              const int* operationCounts,
+                              const int* cumulativeScaleIndices) {
+    DEBUG_START_TIME();
+    try {
+        int returnValue = beagle::forEachInstance(instances, instanceCount,
+                                                  [&] (int i, beagle::BeagleImpl* beagleInstance) {
+            beagle::CallStatistics callStatistics(instances[i], beagleInstance, BEAGLE_CALL_UPDATE_PARTIALS);
+            callStatistics.addOperations((const int*)operations[i], operationCounts[i], BEAGLE_OP_COUNT);
+            return beagleInstance->updatePartials((const int*)operations[i], operationCounts[i],
+                                                  cumulativeScaleIndices[i]);
+        });
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleUpdatePartialsByPartition(const int instance,
                                     const BeagleOperationByPartition* operations,
                                     int operationCount) {
@@ -1148,8 +2937,55 @@ int beagleUpdatePartialsByPartition(const int instance,
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_PARTIALS);
+    callStatistics.addOperations((const int*)operations, operationCount, BEAGLE_PARTITION_OP_COUNT);
     int returnValue = beagleInstance->updatePartialsByPartition((const int*)operations, operationCount);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        callRecorder->record(beagle::RECORDED_UPDATE_PARTIALS_BY_PARTITION, instance, returnValue)
+            .putInts((const int*)operations, operationCount * BEAGLE_PARTITION_OP_COUNT);
+    }
+    return returnValue;
+}
+
+int beagleSetRootPrePartials(int instance,
+                             const int* bufferIndices,
+                             const int* stateFrequenciesIndices,
+                             int count) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setRootPrePartials(bufferIndices, stateFrequenciesIndices,
+                                                             count);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleUpdatePrePartials(const int instance,
+                            const BeagleOperation* operations,
+                            int operationCount,
+                            int cumulativeScaleIndex) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_UPDATE_PARTIALS);
+    callStatistics.addOperations((const int*)operations, operationCount, BEAGLE_OP_COUNT);
+    int returnValue = beagleInstance->updatePrePartials((const int*)operations, operationCount,
+                                                        cumulativeScaleIndex);
+    DEBUG_END_TIME();
     return returnValue;
 }
 
@@ -1186,8 +3022,13 @@ int beagleAccumulateScaleFactors(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
          return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SCALE_FACTORS);
         int returnValue = beagleInstance->accumulateScaleFactors(scalingIndices, count, cumulativeScalingIndex);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_ACCUMULATE_SCALE_FACTORS, instance, returnValue)
+                .putInts(scalingIndices, count).putInt(cumulativeScalingIndex).putInt(beagle::kNoPartition);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1211,8 +3052,13 @@ int beagleAccumulateScaleFactorsByPartition(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
          return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SCALE_FACTORS);
         int returnValue = beagleInstance->accumulateScaleFactorsByPartition(scalingIndices, count, cumulativeScalingIndex, partitionIndex);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_ACCUMULATE_SCALE_FACTORS, instance, returnValue)
+                .putInts(scalingIndices, count).putInt(cumulativeScalingIndex).putInt(partitionIndex);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1235,8 +3081,13 @@ int beagleRemoveScaleFactors(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SCALE_FACTORS);
         int returnValue = beagleInstance->removeScaleFactors(scalingIndices, count, cumulativeScalingIndex);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_REMOVE_SCALE_FACTORS, instance, returnValue)
+                .putInts(scalingIndices, count).putInt(cumulativeScalingIndex).putInt(beagle::kNoPartition);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1260,8 +3111,13 @@ int beagleRemoveScaleFactorsByPartition(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SCALE_FACTORS);
         int returnValue = beagleInstance->removeScaleFactorsByPartition(scalingIndices, count, cumulativeScalingIndex, partitionIndex);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_REMOVE_SCALE_FACTORS, instance, returnValue)
+                .putInts(scalingIndices, count).putInt(cumulativeScalingIndex).putInt(partitionIndex);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1282,8 +3138,13 @@ int beagleResetScaleFactors(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SCALE_FACTORS);
         int returnValue = beagleInstance->resetScaleFactors(cumulativeScalingIndex);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_RESET_SCALE_FACTORS, instance, returnValue)
+                .putInt(cumulativeScalingIndex).putInt(beagle::kNoPartition);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1305,8 +3166,13 @@ int beagleResetScaleFactorsByPartition(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SCALE_FACTORS);
         int returnValue = beagleInstance->resetScaleFactorsByPartition(cumulativeScalingIndex, partitionIndex);
         DEBUG_END_TIME();
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_RESET_SCALE_FACTORS, instance, returnValue)
+                .putInt(cumulativeScalingIndex).putInt(partitionIndex);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1328,8 +3194,13 @@ int beagleCopyScaleFactors(int instance,
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_SCALE_FACTORS);
     int returnValue = beagleInstance->copyScaleFactors(destScalingIndex, srcScalingIndex);
     DEBUG_END_TIME();
+    if (callRecorder) {
+        callRecorder->record(beagle::RECORDED_COPY_SCALE_FACTORS, instance, returnValue)
+            .putInt(destScalingIndex).putInt(srcScalingIndex);
+    }
     return returnValue;
     //    }
     //    catch (std::bad_alloc &) {
@@ -1378,6 +3249,7 @@ int beagleCalculateRootLogLikelihoods(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_ROOT_LOG_LIKELIHOODS);
         int returnValue = beagleInstance->calculateRootLogLikelihoods(bufferIndices, categoryWeightsIndices,
                                                            stateFrequenciesIndices,
                                                            cumulativeScaleIndices,
@@ -1392,6 +3264,13 @@ int beagleCalculateRootLogLikelihoods(int instance,
         *outSumLogLikelihood = dfp.f;
 #endif
 
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS, instance, returnValue)
+                .putInts(bufferIndices, count).putInts(categoryWeightsIndices, count)
+                .putInts(stateFrequenciesIndices, count).putInts(cumulativeScaleIndices, count)
+                .putInts(NULL, 0).putInt(0)
+                .putDoubles(NULL, 0).putDouble(*outSumLogLikelihood);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1407,6 +3286,105 @@ int beagleCalculateRootLogLikelihoods(int instance,
 
 }
 
+int beagleCalculateRootLogLikelihoodsWithPatternWeights(int instance,
+                                                        const int* bufferIndices,
+                                                        const int* categoryWeightsIndices,
+                                                        const int* stateFrequenciesIndices,
+                                                        const int* cumulativeScaleIndices,
+                                                        int count,
+                                                        const double* inPatternWeights,
+                                                        int weightVectorCount,
+                                                        double* outSumLogLikelihoods) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_ROOT_LOG_LIKELIHOODS);
+    int returnValue = beagleInstance->calculateRootLogLikelihoodsWithPatternWeights(bufferIndices,
+                                                                   categoryWeightsIndices,
+                                                                   stateFrequenciesIndices,
+                                                                   cumulativeScaleIndices,
+                                                                   count, inPatternWeights,
+                                                                   weightVectorCount,
+                                                                   outSumLogLikelihoods);
+    DEBUG_END_TIME();
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        int sumCount = (returnValue == BEAGLE_SUCCESS ? weightVectorCount : 0);
+        callRecorder->record(beagle::RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS_WITH_PATTERN_WEIGHTS,
+                             instance, returnValue)
+            .putInts(bufferIndices, count).putInts(categoryWeightsIndices, count)
+            .putInts(stateFrequenciesIndices, count).putInts(cumulativeScaleIndices, count)
+            .putDoubles(inPatternWeights, shape.patternCount * weightVectorCount)
+            .putDoubles(outSumLogLikelihoods, sumCount);
+    }
+    return returnValue;
+}
+
+int beagleCalculateRootLogLikelihoodsForReplicates(int instance,
+                                                  int bufferIndex,
+                                                  int categoryWeightsIndex,
+                                                  const int* stateFrequenciesIndices,
+                                                  int cumulativeScaleIndex,
+                                                  int replicateCount,
+                                                  double* outSumLogLikelihoods) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_ROOT_LOG_LIKELIHOODS);
+    int returnValue = beagleInstance->calculateRootLogLikelihoodsForReplicates(bufferIndex,
+                                                                               categoryWeightsIndex,
+                                                                               stateFrequenciesIndices,
+                                                                               cumulativeScaleIndex,
+                                                                               replicateCount,
+                                                                               outSumLogLikelihoods);
+    DEBUG_END_TIME();
+    if (callRecorder) {
+        int sumCount = (returnValue == BEAGLE_SUCCESS ? replicateCount : 0);
+        callRecorder->record(beagle::RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS_FOR_REPLICATES,
+                             instance, returnValue)
+            .putInt(bufferIndex).putInt(categoryWeightsIndex)
+            .putInts(stateFrequenciesIndices, replicateCount).putInt(cumulativeScaleIndex)
+            .putDoubles(outSumLogLikelihoods, sumCount);
+    }
+    return returnValue;
+}
+
+int beagleCalculateRootLogLikelihoodsMulti(const int* instances,
+                                           int instanceCount,
+                                           const int* bufferIndices,
+                                           const int* categoryWeightsIndices,
+                                           const int* stateFrequenciesIndices,
+                                           const int* cumulativeScaleIndices,
+                                           int count,
+                                           double* outSumLogLikelihoods) {
+    DEBUG_START_TIME();
+    try {
+        int returnValue = beagle::forEachInstance(instances, instanceCount,
+                                                  [&] (int i, beagle::BeagleImpl* beagleInstance) {
+            beagle::CallStatistics callStatistics(instances[i], beagleInstance, BEAGLE_CALL_ROOT_LOG_LIKELIHOODS);
+            return beagleInstance->calculateRootLogLikelihoods(bufferIndices + i * count,
+                                                               categoryWeightsIndices + i * count,
+                                                               stateFrequenciesIndices + i * count,
+                                                               cumulativeScaleIndices + i * count,
+                                                               count,
+                                                               outSumLogLikelihoods + i);
+        });
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleCalculateRootLogLikelihoodsByPartition(int instance,
                                                  const int* bufferIndices,
                                                  const int* categoryWeightsIndices,
@@ -1422,6 +3400,7 @@ int beagleCalculateRootLogLikelihoodsByPartition(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_ROOT_LOG_LIKELIHOODS);
         int returnValue = beagleInstance->calculateRootLogLikelihoodsByPartition(bufferIndices,
                                                                                  categoryWeightsIndices,
                                                                                  stateFrequenciesIndices,
@@ -1445,6 +3424,17 @@ int beagleCalculateRootLogLikelihoodsByPartition(int instance,
         *outSumLogLikelihood = dfp.f;
 #endif
 
+        if (callRecorder) {
+            // the lists hold count sets of partitionCount entries
+            int listLength = count * partitionCount;
+            callRecorder->record(beagle::RECORDED_CALCULATE_ROOT_LOG_LIKELIHOODS, instance, returnValue)
+                .putInts(bufferIndices, listLength).putInts(categoryWeightsIndices, listLength)
+                .putInts(stateFrequenciesIndices, listLength)
+                .putInts(cumulativeScaleIndices, listLength)
+                .putInts(partitionIndices, listLength).putInt(partitionCount)
+                .putDoubles(outSumLogLikelihoodByPartition, partitionCount)
+                .putDouble(*outSumLogLikelihood);
+        }
         return returnValue;
 
 //    }
@@ -1479,6 +3469,7 @@ int beagleCalculateEdgeLogLikelihoods(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_EDGE_LOG_LIKELIHOODS);
         int returnValue = beagleInstance->calculateEdgeLogLikelihoods(parentBufferIndices, childBufferIndices,
                                                            probabilityIndices,
                                                            firstDerivativeIndices,
@@ -1502,6 +3493,15 @@ int beagleCalculateEdgeLogLikelihoods(int instance,
         *outSumSecondDerivative = dfp.f;
 #endif
 
+        if (callRecorder) {
+            callRecorder->record(beagle::RECORDED_CALCULATE_EDGE_LOG_LIKELIHOODS, instance, returnValue)
+                .putInts(parentBufferIndices, count).putInts(childBufferIndices, count)
+                .putInts(probabilityIndices, count).putInts(firstDerivativeIndices, count)
+                .putInts(secondDerivativeIndices, count).putInts(categoryWeightsIndices, count)
+                .putInts(stateFrequenciesIndices, count).putInts(cumulativeScaleIndices, count)
+                .putDoubles(outSumLogLikelihood, 1).putDoubles(outSumFirstDerivative, 1)
+                .putDoubles(outSumSecondDerivative, 1);
+        }
         return returnValue;
 //    }
 //    catch (std::bad_alloc &) {
@@ -1515,6 +3515,50 @@ int beagleCalculateEdgeLogLikelihoods(int instance,
 //    }
 }
 
+int beagleCalculateEdgeSiteLogLikelihoods(int instance,
+                                          const int* parentBufferIndices,
+                                          const int* childBufferIndices,
+                                          const int* probabilityIndices,
+                                          const int* firstDerivativeIndices,
+                                          const int* secondDerivativeIndices,
+                                          const int* categoryWeightsIndices,
+                                          const int* stateFrequenciesIndices,
+                                          const int* cumulativeScaleIndices,
+                                          int count,
+                                          double* outSiteLogLikelihoods,
+                                          double* outSiteFirstDerivatives,
+                                          double* outSiteSecondDerivatives) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_EDGE_LOG_LIKELIHOODS);
+    int returnValue = beagleInstance->calculateEdgeSiteLogLikelihoods(parentBufferIndices, childBufferIndices,
+                                                                      probabilityIndices,
+                                                                      firstDerivativeIndices,
+                                                                      secondDerivativeIndices,
+                                                                      categoryWeightsIndices,
+                                                                      stateFrequenciesIndices,
+                                                                      cumulativeScaleIndices, count,
+                                                                      outSiteLogLikelihoods,
+                                                                      outSiteFirstDerivatives,
+                                                                      outSiteSecondDerivatives);
+    DEBUG_END_TIME();
+
+    if (callRecorder) {
+        const int siteCount = count * callRecorder->getShape(instance).patternCount;
+        callRecorder->record(beagle::RECORDED_CALCULATE_EDGE_SITE_LOG_LIKELIHOODS, instance, returnValue)
+            .putInts(parentBufferIndices, count).putInts(childBufferIndices, count)
+            .putInts(probabilityIndices, count).putInts(firstDerivativeIndices, count)
+            .putInts(secondDerivativeIndices, count).putInts(categoryWeightsIndices, count)
+            .putInts(stateFrequenciesIndices, count).putInts(cumulativeScaleIndices, count)
+            .putDoubles(outSiteLogLikelihoods, siteCount)
+            .putDoubles(firstDerivativeIndices ? outSiteFirstDerivatives : NULL, siteCount)
+            .putDoubles(secondDerivativeIndices ? outSiteSecondDerivatives : NULL, siteCount);
+    }
+    return returnValue;
+}
+
 int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
                                                  const int* parentBufferIndices,
                                                  const int* childBufferIndices,
@@ -1538,6 +3582,7 @@ int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_EDGE_LOG_LIKELIHOODS);
         int returnValue = beagleInstance->calculateEdgeLogLikelihoodsByPartition(
                                                         parentBufferIndices,
                                                         childBufferIndices,
@@ -1590,6 +3635,112 @@ int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
 //    }
 }
 
+int beagleCalculateEdgeDerivatives(int instance,
+                                   const int* postBufferIndices,
+                                   const int* preBufferIndices,
+                                   const int* probabilityIndices,
+                                   const int* firstDerivativeIndices,
+                                   const int* categoryWeightsIndices,
+                                   int count,
+                                   double* outDerivatives,
+                                   double* outSumDerivatives) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_EDGE_LOG_LIKELIHOODS);
+    int returnValue = beagleInstance->calculateEdgeDerivatives(postBufferIndices, preBufferIndices,
+                                                               probabilityIndices,
+                                                               firstDerivativeIndices,
+                                                               categoryWeightsIndices, count,
+                                                               outDerivatives, outSumDerivatives);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleCalculateParameterDerivatives(int instance,
+                                        const int* postBufferIndices,
+                                        const int* preBufferIndices,
+                                        const int* probabilityIndices,
+                                        const int* derivativeIndices,
+                                        const int* categoryWeightsIndices,
+                                        int count,
+                                        int parameterCount,
+                                        double* outSumDerivatives) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_EDGE_LOG_LIKELIHOODS);
+    int returnValue = beagleInstance->calculateParameterDerivatives(postBufferIndices, preBufferIndices,
+                                                                    probabilityIndices,
+                                                                    derivativeIndices,
+                                                                    categoryWeightsIndices, count,
+                                                                    parameterCount,
+                                                                    outSumDerivatives);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleCalculateEdgeLogLikelihoodsForMatrices(int instance,
+                                                 int parentBufferIndex,
+                                                 int childBufferIndex,
+                                                 const int* probabilityIndices,
+                                                 const int* firstDerivativeIndices,
+                                                 const int* secondDerivativeIndices,
+                                                 int categoryWeightsIndex,
+                                                 int stateFrequenciesIndex,
+                                                 int cumulativeScaleIndex,
+                                                 int matrixCount,
+                                                 double* outSumLogLikelihoods,
+                                                 double* outSumFirstDerivatives,
+                                                 double* outSumSecondDerivatives) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_EDGE_LOG_LIKELIHOODS);
+    int returnValue = beagleInstance->calculateEdgeLogLikelihoodsForMatrices(parentBufferIndex,
+                                                                             childBufferIndex,
+                                                                             probabilityIndices,
+                                                                             firstDerivativeIndices,
+                                                                             secondDerivativeIndices,
+                                                                             categoryWeightsIndex,
+                                                                             stateFrequenciesIndex,
+                                                                             cumulativeScaleIndex,
+                                                                             matrixCount,
+                                                                             outSumLogLikelihoods,
+                                                                             outSumFirstDerivatives,
+                                                                             outSumSecondDerivatives);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleUpdatePartialsAndCalculateRootLogLikelihood(int instance,
+                                                      const BeagleOperation* operations,
+                                                      int operationCount,
+                                                      int cumulativeScaleIndex,
+                                                      int categoryWeightsIndex,
+                                                      int stateFrequenciesIndex,
+                                                      int writeRootPartials,
+                                                      double* outSumLogLikelihood) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_ROOT_LOG_LIKELIHOODS);
+    callStatistics.addOperations((const int*)operations, operationCount, BEAGLE_OP_COUNT);
+    int returnValue = beagleInstance->updatePartialsAndCalculateRootLogLikelihood((const int*)operations,
+                                                                                  operationCount,
+                                                                                  cumulativeScaleIndex,
+                                                                                  categoryWeightsIndex,
+                                                                                  stateFrequenciesIndex,
+                                                                                  writeRootPartials != 0,
+                                                                                  outSumLogLikelihood);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleGetLogLikelihood(int instance,
                             double* outSumLogLikelihood) {
     DEBUG_START_TIME();
@@ -1639,6 +3790,7 @@ int beagleGetSiteLogLikelihoods(int instance,
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_GET_SITE_RESULTS);
     int returnValue = beagleInstance->getSiteLogLikelihoods(outLogLikelihoods);
     DEBUG_END_TIME();
 
@@ -1651,6 +3803,11 @@ int beagleGetSiteLogLikelihoods(int instance,
         }
 #endif
 
+    if (callRecorder) {
+        beagle::CallRecorder::Shape shape = callRecorder->getShape(instance);
+        callRecorder->record(beagle::RECORDED_GET_SITE_LOG_LIKELIHOODS, instance, returnValue)
+            .putDoubles(outLogLikelihoods, shape.patternCount);
+    }
     return returnValue;
 }
 
@@ -1661,6 +3818,7 @@ int beagleGetSiteDerivatives(int instance,
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CallStatistics callStatistics(instance, beagleInstance, BEAGLE_CALL_GET_SITE_RESULTS);
     int returnValue = beagleInstance->getSiteDerivatives(outFirstDerivatives, outSecondDerivatives);
     DEBUG_END_TIME();
 
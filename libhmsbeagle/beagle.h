@@ -87,6 +87,18 @@
  * recomputing the entire likelihood every time a new phylogenetic model is
  * evaluated.
  *
+ * THREAD SAFETY
+ *
+ * Distinct instances may be used from different client threads at the same
+ * time, and instances may be created and finalized while other threads call
+ * into theirs. Looking up an instance takes no lock; creating instances,
+ * loading plugins, listing or benchmarking resources and
+ * beagleSetSharedCPUThreadCount are serialized by a library-wide lock. The
+ * calls into a single instance, including beagleFinalizeInstance, must not
+ * overlap, and no instance may be passed to a *Multi call while another
+ * thread uses it. beagleFinalize must not run concurrently with any other
+ * call.
+ *
  * @author Likelihood API Working Group
  *
  * @author Daniel Ayres
@@ -108,6 +120,8 @@
 #ifndef __beagle__
 #define __beagle__
 
+#include <limits.h>
+
 #include "libhmsbeagle/platform.h"
 
 /**
@@ -183,6 +197,19 @@ enum BeagleFlags {
     BEAGLE_FLAG_PARALLELOPS_GRID    = 1 << 29    /**< Operations in updatePartials may be folded into single kernel launch (necessary for partitions; typically performs better for problems with fewer pattern sites) */
 };
 
+/**
+ * AVX-512 computation. Bits 0 to 30 are taken by BeagleFlags and bit 31 is the sign bit of a
+ * 32-bit long, so this is bit 32, defined outside BeagleFlags because an enumerator must fit
+ * in an int. It is only available where long has 64 bits (e.g. Linux and macOS), and passes
+ * through the JNI wrapper to the Java long unchanged. Where long has 32 bits (Windows) it is
+ * zero: AVX-512 can be neither requested nor reported there, and AVX is used instead.
+ */
+#if LONG_MAX > 0x7fffffffL
+#define BEAGLE_FLAG_VECTOR_AVX512 (1L << 32)
+#else
+#define BEAGLE_FLAG_VECTOR_AVX512 0L
+#endif
+
 
 /**
  * @anchor BEAGLE_BENCHFLAGS
@@ -196,6 +223,8 @@ enum BeagleBenchmarkFlags {
     BEAGLE_BENCHFLAG_SCALING_NONE        = 1 << 0,    /**< No scaling */
     BEAGLE_BENCHFLAG_SCALING_ALWAYS      = 1 << 1,    /**< Scale at every iteration */
     BEAGLE_BENCHFLAG_SCALING_DYNAMIC     = 1 << 2,    /**< Scale every fixed number of iterations or when a numerical error occurs, and re-use scale factors for subsequent iterations */
+    BEAGLE_BENCHFLAG_CACHE               = 1 << 3,    /**< Reuse results stored on disk by an earlier call with the same hardware, library version and arguments, and store new results */
+    BEAGLE_BENCHFLAG_TUNE_CPU            = 1 << 4,    /**< Benchmark CPU resources at each supported vector extension and at thread counts from one to the hardware threads, and report the fastest configuration */
 };
 
 /**
@@ -211,6 +240,30 @@ enum BeagleOpCodes {
     BEAGLE_OP_NONE               = -1 /**< Specify no use for indexed buffer */
 };
 
+/**
+ * @anchor BEAGLE_CALLS
+ *
+ * @brief Kinds of calls counted in BeagleStatistics
+ *
+ * This enumerates the groups of library functions whose calls are counted and timed for each
+ * instance. Functions not listed are not counted.
+ */
+enum BeagleCalls {
+    BEAGLE_CALL_SET_TIP_STATES             = 0,  /**< beagleSetTipStates */
+    BEAGLE_CALL_SET_TIP_PARTIALS           = 1,  /**< beagleSetTipPartials */
+    BEAGLE_CALL_SET_PARTIALS               = 2,  /**< beagleSetPartials */
+    BEAGLE_CALL_GET_PARTIALS               = 3,  /**< beagleGetPartials */
+    BEAGLE_CALL_SET_EIGEN_DECOMPOSITION    = 4,  /**< beagleSetEigenDecomposition */
+    BEAGLE_CALL_SET_TRANSITION_MATRICES    = 5,  /**< beagleSetTransitionMatrix and beagleSetTransitionMatrices */
+    BEAGLE_CALL_UPDATE_TRANSITION_MATRICES = 6,  /**< beagleUpdateTransitionMatrices, its variants and beagleConvolveTransitionMatrices */
+    BEAGLE_CALL_UPDATE_PARTIALS            = 7,  /**< beagleUpdatePartials, its variants and beagleUpdatePrePartials */
+    BEAGLE_CALL_SCALE_FACTORS              = 8,  /**< beagleAccumulateScaleFactors, beagleRemoveScaleFactors, beagleResetScaleFactors, their variants and beagleCopyScaleFactors */
+    BEAGLE_CALL_ROOT_LOG_LIKELIHOODS       = 9,  /**< beagleCalculateRootLogLikelihoods, its variants and beagleUpdatePartialsAndCalculateRootLogLikelihood */
+    BEAGLE_CALL_EDGE_LOG_LIKELIHOODS       = 10, /**< beagleCalculateEdgeLogLikelihoods, its variants and beagleCalculateEdgeDerivatives */
+    BEAGLE_CALL_GET_SITE_RESULTS           = 11, /**< beagleGetSiteLogLikelihoods and beagleGetSiteDerivatives */
+    BEAGLE_CALL_COUNT                      = 12  /**< Number of kinds of calls */
+};
+
 /**
  * @brief Information about a specific instance
  */
@@ -258,6 +311,8 @@ typedef struct {
                          *   capabilities of the resource and implementation for this benchmark */
     double benchmarkResult; /**< Benchmark result in milliseconds */
     double performanceRatio; /**< Performance ratio relative to default CPU resource */
+    int   threadCount;  /**< Threads to set with beagleSetCPUThreadCount for the benchmarked
+                         *   configuration, 0 for the default */
 
 } BeagleBenchmarkedResource;
 
@@ -269,6 +324,44 @@ typedef struct {
     int length;     /**< Length of list */
 } BeagleBenchmarkedResourceList;
 
+/**
+ * @brief Projected memory use and speed of an instance on a hardware resource
+ */
+typedef struct {
+    int   number;           /**< Resource number */
+    char* name;             /**< Name of resource as a NULL-terminated character string */
+    int   returnCode;       /**< Return code of the estimate (see BeagleReturnCodes) */
+    char* implName;         /**< Name of implementation the estimate is for */
+    long  implFlags;        /**< Bit-flags of capabilities of the implementation */
+    long long hostBytes;    /**< Projected bytes of host memory */
+    long long deviceBytes;  /**< Projected bytes of device memory, 0 for CPU resources */
+    double benchmarkResult; /**< Cached benchmark result in milliseconds, -1 if none is cached */
+    double performanceRatio;/**< Cached performance ratio relative to default CPU resource,
+                             *   0 if none is cached */
+} BeagleResourceEstimate;
+
+/**
+ * @brief List of resource estimates, in the order of the resources
+ */
+typedef struct {
+    BeagleResourceEstimate* list; /**< Pointer to list of resource estimates */
+    int length;     /**< Length of list */
+} BeagleResourceEstimateList;
+
+/**
+ * @brief Performance counters of an instance
+ */
+typedef struct {
+    long long callCount[BEAGLE_CALL_COUNT];   /**< Calls of each kind, see @ref BEAGLE_CALLS */
+    double    callSeconds[BEAGLE_CALL_COUNT]; /**< Host time spent in calls of each kind, in seconds */
+    long long operationCount;                 /**< Partials operations passed to update calls */
+    long long scalingCount;                   /**< Partials operations that wrote scale factors */
+    long long hostToDeviceBytes;              /**< Bytes transferred from host to device memory */
+    long long deviceToHostBytes;              /**< Bytes transferred from device to host memory */
+    double    deviceSeconds;                  /**< Time from the device starting the work of a counted
+                                               *   call to completing it, summed over calls, in seconds */
+} BeagleStatistics;
+
 
 /* using C calling conventions so that C programs can successfully link the beagle library
  * (brace is closed at the end of this file)
@@ -315,7 +408,21 @@ BEAGLE_DLLEXPORT BeagleResourceList* beagleGetResourceList(void);
  * benchmark times and CPU performance ratios for each resource. Resources are benchmarked
  * with the given analysis parameters and the array is ordered from fastest to slowest.
  * If there is an error the function returns NULL.
- * 
+ *
+ * With BEAGLE_BENCHFLAG_CACHE, results are stored in the file named by the
+ * BEAGLE_BENCHMARK_CACHE environment variable, or in .beagle_benchmark_cache in the home
+ * directory, and returned without benchmarking by later calls on the same resources and
+ * library version with the same arguments. Driver updates are not detected, so remove the
+ * file after one.
+ *
+ * Resources other than CPUs are benchmarked at the same time, each from its own thread;
+ * CPU resources are benchmarked after them, one at a time. With BEAGLE_BENCHFLAG_TUNE_CPU,
+ * each CPU resource is benchmarked with every vector extension it supports that meets
+ * requirementFlags and with threading at one, two, four and so on up to all hardware
+ * threads. The fastest configuration is reported, with its flags in benchedFlags and its
+ * thread count in threadCount; the performance ratios stay relative to the default CPU
+ * configuration.
+ *
  * @param tipCount              Number of tip data elements (input)
  * @param compactBufferCount    Number of compact state representation tips (input)
  * @param stateCount            Number of states in the continuous-time Markov chain (input)
@@ -351,6 +458,55 @@ BEAGLE_DLLEXPORT BeagleBenchmarkedResourceList* beagleGetBenchmarkedResourceList
                                                     int calculateDerivatives,
                                                     long benchmarkFlags);
 
+/**
+ * @brief Estimate memory use and speed of an instance on each hardware resource
+ *
+ * This function returns a pointer to a BeagleResourceEstimateList struct, which holds for
+ * every resource that meets requirementFlags the host and device memory that
+ * beagleCreateInstance would allocate with the same arguments, without allocating it or
+ * creating an instance. Each estimate is for the best ranked implementation on the resource
+ * that can size itself; resources without one, currently all but the CPU, have returnCode
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * The speed is the result cached by beagleGetBenchmarkedResourceList with
+ * BEAGLE_BENCHFLAG_CACHE for the same resources, tipCount, compactBufferCount, stateCount,
+ * patternCount, categoryCount and flags, one eigen model, one partition and no derivatives;
+ * no benchmark is run. If there is an error the function returns NULL.
+ *
+ * @param tipCount              Number of tip data elements (input)
+ * @param partialsBufferCount   Number of partials buffers to create (input)
+ * @param compactBufferCount    Number of compact state representation buffers to create (input)
+ * @param stateCount            Number of states in the continuous-time Markov chain (input)
+ * @param patternCount          Number of site patterns to be handled by the instance (input)
+ * @param eigenBufferCount      Number of rate matrix eigen-decomposition, category weight,
+ *                               category rates, and state frequency buffers to allocate (input)
+ * @param matrixBufferCount     Number of transition probability matrix buffers (input)
+ * @param categoryCount         Number of rate categories (input)
+ * @param scaleBufferCount      Number of scale buffers to create (input)
+ * @param resourceList          List of resources to be estimated, NULL implies no restriction
+ *                               (input)
+ * @param resourceCount         Length of resourceList list (input)
+ * @param preferenceFlags       Bit-flags indicating preferred implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param requirementFlags      Bit-flags indicating required implementation characteristics,
+ *                               see BeagleFlags (input)
+ *
+ * @return A list of estimates as a BeagleResourceEstimateList, valid until the next call
+ */
+BEAGLE_DLLEXPORT BeagleResourceEstimateList* beagleEstimateResourceUsage(int tipCount,
+                                                    int partialsBufferCount,
+                                                    int compactBufferCount,
+                                                    int stateCount,
+                                                    int patternCount,
+                                                    int eigenBufferCount,
+                                                    int matrixBufferCount,
+                                                    int categoryCount,
+                                                    int scaleBufferCount,
+                                                    int* resourceList,
+                                                    int resourceCount,
+                                                    long preferenceFlags,
+                                                    long requirementFlags);
+
 /**
  * @brief Create a single instance
  *
@@ -358,6 +514,16 @@ BEAGLE_DLLEXPORT BeagleBenchmarkedResourceList* beagleGetBenchmarkedResourceList
  * multiple times to create multiple data partition instances each returning a unique
  * identifier.
  *
+ * The GPU plugins, whose loading initializes the GPU drivers, are not loaded while
+ * resourceList holds only resource 0, or is NULL and requirementFlags include
+ * BEAGLE_FLAG_PROCESSOR_CPU or BEAGLE_FLAG_FRAMEWORK_CPU without a GPU flag;
+ * beagleGetResourceList loads them all.
+ *
+ * If the BEAGLE_RECORD_FILE environment variable names a file when the first instance is
+ * created, the calls that create, fill and evaluate instances made by this function are
+ * recorded to it together with their results, for the beaglereplay example to run again
+ * on another resource.
+ *
  * @param tipCount              Number of tip data elements (input)
  * @param partialsBufferCount   Number of partials buffers to create (input)
  * @param compactBufferCount    Number of compact state representation buffers to create (input)
@@ -397,6 +563,271 @@ BEAGLE_DLLEXPORT int beagleCreateInstance(int tipCount,
                          long requirementFlags,
                          BeagleInstanceDetails* returnInfo);
 
+/**
+ * @brief Create a single instance whose patterns are split across several resources
+ *
+ * This function creates one implementation per entry of resourceList, each holding a
+ * contiguous and near-equal share of the patternCount site patterns, and returns them as a
+ * single instance. Pattern-indexed data (tip states and partials, partials, pattern weights
+ * and partitions, scale factors and site likelihoods) are split or gathered in pattern order,
+ * all other calls are issued to every resource concurrently, and log likelihoods and
+ * derivatives are summed. A resource may appear more than once in resourceList. The
+ * returned details are those of the implementation on the first resource.
+ *
+ * @param tipCount              Number of tip data elements (input)
+ * @param partialsBufferCount   Number of partials buffers to create (input)
+ * @param compactBufferCount    Number of compact state representation buffers to create (input)
+ * @param stateCount            Number of states in the continuous-time Markov chain (input)
+ * @param patternCount          Number of site patterns to be handled by the instance (input)
+ * @param eigenBufferCount      Number of rate matrix eigen-decomposition, category weight,
+ *                               category rates, and state frequency buffers to allocate (input)
+ * @param matrixBufferCount     Number of transition probability matrix buffers (input)
+ * @param categoryCount         Number of rate categories (input)
+ * @param scaleBufferCount      Number of scale buffers to create, ignored for auto scale or always scale (input)
+ * @param resourceList          List of resources, one per share of the patterns (input)
+ * @param resourceCount         Length of resourceList list, at most patternCount (input)
+ * @param preferenceFlags       Bit-flags indicating preferred implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param requirementFlags      Bit-flags indicating required implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param returnInfo            Pointer to return implementation and resource details
+ *
+ * @return the unique instance identifier (<0 if failed, see @ref BEAGLE_RETURN_CODES
+ * "BeagleReturnCodes")
+ */
+BEAGLE_DLLEXPORT int beagleCreateShardedInstance(int tipCount,
+                                                 int partialsBufferCount,
+                                                 int compactBufferCount,
+                                                 int stateCount,
+                                                 int patternCount,
+                                                 int eigenBufferCount,
+                                                 int matrixBufferCount,
+                                                 int categoryCount,
+                                                 int scaleBufferCount,
+                                                 int* resourceList,
+                                                 int resourceCount,
+                                                 long preferenceFlags,
+                                                 long requirementFlags,
+                                                 BeagleInstanceDetails* returnInfo);
+
+/**
+ * @brief Create a single instance whose patterns are split across resources by their speed
+ *
+ * This function creates an instance like beagleCreateShardedInstance, such as one spanning a
+ * GPU and the CPU, but the share of the patterns held by each resource is proportional to its
+ * speed on this problem, as measured by beagleGetBenchmarkedResourceList with benchmarkFlags.
+ * A resource listed more than once divides its share equally. Call beagleRebalanceInstance
+ * to correct the shares from the timings observed during the analysis.
+ *
+ * @param tipCount              Number of tip data elements (input)
+ * @param partialsBufferCount   Number of partials buffers to create (input)
+ * @param compactBufferCount    Number of compact state representation buffers to create (input)
+ * @param stateCount            Number of states in the continuous-time Markov chain (input)
+ * @param patternCount          Number of site patterns to be handled by the instance (input)
+ * @param eigenBufferCount      Number of rate matrix eigen-decomposition, category weight,
+ *                               category rates, and state frequency buffers to allocate (input)
+ * @param matrixBufferCount     Number of transition probability matrix buffers (input)
+ * @param categoryCount         Number of rate categories (input)
+ * @param scaleBufferCount      Number of scale buffers to create, ignored for auto scale or always scale (input)
+ * @param resourceList          List of resources, one per share of the patterns (input)
+ * @param resourceCount         Length of resourceList list, at most patternCount (input)
+ * @param preferenceFlags       Bit-flags indicating preferred implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param requirementFlags      Bit-flags indicating required implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param benchmarkFlags        Bit-flags indicating benchmarking preferences, see
+ *                               BeagleBenchmarkFlags (input)
+ * @param returnInfo            Pointer to return implementation and resource details
+ *
+ * @return the unique instance identifier (<0 if failed, see @ref BEAGLE_RETURN_CODES
+ * "BeagleReturnCodes")
+ */
+BEAGLE_DLLEXPORT int beagleCreateHybridInstance(int tipCount,
+                                                int partialsBufferCount,
+                                                int compactBufferCount,
+                                                int stateCount,
+                                                int patternCount,
+                                                int eigenBufferCount,
+                                                int matrixBufferCount,
+                                                int categoryCount,
+                                                int scaleBufferCount,
+                                                int* resourceList,
+                                                int resourceCount,
+                                                long preferenceFlags,
+                                                long requirementFlags,
+                                                long benchmarkFlags,
+                                                BeagleInstanceDetails* returnInfo);
+
+/**
+ * @brief Create a single instance whose patterns are split across the processes of MPI
+ *
+ * This function is called by every process of an MPI communicator, collectively and with
+ * the same arguments apart from resourceList. The patternCount site patterns are split into
+ * contiguous and near-equal shares in rank order, and each process creates an instance like
+ * beagleCreateShardedInstance over its own resourceList for its share. All processes then
+ * make the same calls on the instance with arguments for all patterns, as with any other
+ * instance, and each takes the data of its own patterns. Log likelihoods and derivatives
+ * are summed over the processes with MPI_Allreduce, so an evaluation moves only these sums
+ * between them; per-pattern results such as site likelihoods and partials are gathered with
+ * MPI_Allgatherv, so that every process receives the same results. Calls returning results
+ * return the same code on all processes. beagleRebalanceInstance moves patterns between the
+ * resources of each process only.
+ *
+ * MPI must be initialized by the application, and the library must be built with MPI
+ * (configure --with-mpi).
+ *
+ * @param tipCount              Number of tip data elements (input)
+ * @param partialsBufferCount   Number of partials buffers to create (input)
+ * @param compactBufferCount    Number of compact state representation buffers to create (input)
+ * @param stateCount            Number of states in the continuous-time Markov chain (input)
+ * @param patternCount          Number of site patterns of all processes together (input)
+ * @param eigenBufferCount      Number of rate matrix eigen-decomposition, category weight,
+ *                               category rates, and state frequency buffers to allocate (input)
+ * @param matrixBufferCount     Number of transition probability matrix buffers (input)
+ * @param categoryCount         Number of rate categories (input)
+ * @param scaleBufferCount      Number of scale buffers to create, ignored for auto scale or always scale (input)
+ * @param resourceList          Resources of this process, one per share of its patterns (input)
+ * @param resourceCount         Length of resourceList list (input)
+ * @param preferenceFlags       Bit-flags indicating preferred implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param requirementFlags      Bit-flags indicating required implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param communicator          Pointer to the MPI_Comm of the processes, or NULL for
+ *                               MPI_COMM_WORLD (input)
+ * @param returnInfo            Pointer to return implementation and resource details
+ *
+ * @return the unique instance identifier (<0 if failed, see @ref BEAGLE_RETURN_CODES
+ * "BeagleReturnCodes"), BEAGLE_ERROR_NO_IMPLEMENTATION without MPI
+ */
+BEAGLE_DLLEXPORT int beagleCreateDistributedInstance(int tipCount,
+                                                     int partialsBufferCount,
+                                                     int compactBufferCount,
+                                                     int stateCount,
+                                                     int patternCount,
+                                                     int eigenBufferCount,
+                                                     int matrixBufferCount,
+                                                     int categoryCount,
+                                                     int scaleBufferCount,
+                                                     int* resourceList,
+                                                     int resourceCount,
+                                                     long preferenceFlags,
+                                                     long requirementFlags,
+                                                     void* communicator,
+                                                     BeagleInstanceDetails* returnInfo);
+
+/**
+ * @brief Move patterns between the resources of an instance according to their speed
+ *
+ * For an instance created by beagleCreateShardedInstance or beagleCreateHybridInstance, this
+ * function measures the patterns per second each resource processed in the calls since the
+ * instance was created or last rebalanced, and splits the patterns again in proportion to
+ * them when that moves more than one in twenty patterns. The data set on the instance and its
+ * transition matrices carry over, but partials and scale factors computed by the instance do
+ * not: call this function before an evaluation that updates all partials, such as one
+ * following a change of the model parameters. Events recorded before are forgotten.
+ *
+ * @param instance  Instance number (input)
+ *
+ * @return error code, BEAGLE_ERROR_NO_IMPLEMENTATION for instances on a single resource
+ */
+BEAGLE_DLLEXPORT int beagleRebalanceInstance(int instance);
+
+/**
+ * @brief Clear the data and model of an instance for reuse
+ *
+ * This function readies an instance to evaluate another data set or model of the same
+ * dimensions, without the resource selection and allocation of finalizing it and creating
+ * another. Buffers, threads and settings such as the thread count, pattern partitions and
+ * scaling options are kept, and so are computed partials and scale factors, which are
+ * overwritten when computed again. Caches of computed transition matrices and partials are
+ * cleared; tip data, eigen-decompositions, state frequencies, category rates and weights, and
+ * pattern weights must be set again before they are used. The tips are unset and may be set
+ * again as either compact states or partials, and pattern weights return to one.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance  Instance number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleResetInstance(int instance);
+
+/**
+ * @brief Add patterns and buffers to an instance
+ *
+ * This function raises the dimensions of an instance to those given, which are the totals
+ * it would be created with and none of which may be lower than before, without finalizing
+ * it and creating another. The contents of every buffer are kept for the existing patterns,
+ * and the new patterns follow them: they are missing at tips set before, have weight one,
+ * and carry no scale factors. Partials of internal buffers are not defined for the new
+ * patterns until computed, for which updating over a pattern partition holding only the
+ * new patterns suffices. Buffers from the old tip count up to the new one become tips and
+ * are left unset, so internal buffers are best numbered from the end. Pattern partitions
+ * must be set again afterwards. Every call reallocates the pattern-indexed buffers, so
+ * patterns are best added in blocks.
+ *
+ * Implemented on the CPU, and for sharded instances, whose last shard takes the new
+ * patterns. Instances with auto scaling, a buffer arena or scratch file, NUMA placement,
+ * partials checkpointing or reordered patterns, and instances with always scaling that add
+ * tips, return BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance              Instance number (input)
+ * @param tipCount              Number of tip data elements (input)
+ * @param partialsBufferCount   Number of partials buffers to create (input)
+ * @param compactBufferCount    Number of compact state representation buffers to create (input)
+ * @param patternCount          Number of site patterns to be handled by the instance (input)
+ * @param matrixBufferCount     Number of transition probability matrix buffers (input)
+ * @param scaleBufferCount      Number of scale buffers to create, ignored for auto scale or always scale (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleGrowInstance(int instance,
+                                        int tipCount,
+                                        int partialsBufferCount,
+                                        int compactBufferCount,
+                                        int patternCount,
+                                        int matrixBufferCount,
+                                        int scaleBufferCount);
+
+/**
+ * @brief Save the state of an instance to a file
+ *
+ * This function writes the contents of every buffer that has been set or computed, with the
+ * tip data, state frequencies, category rates and weights, and pattern weights, to a binary
+ * file, from which beagleLoadInstanceState restores them in another instance created with
+ * the same dimensions, so that a run may resume without computing its partials again.
+ * Eigen-decompositions are not saved and must be set again before transition matrices are
+ * updated; pattern partitions must be set as before loading.
+ *
+ * Values are saved in the precision of the instance, unpadded, and can be loaded by any
+ * implementation of either precision. Implemented on the CPU; instances with auto scaling,
+ * and other instances, return BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance  Instance number (input)
+ * @param fileName  Path of the file to write (input)
+ *
+ * @return error code, BEAGLE_ERROR_GENERAL if the file cannot be written
+ */
+BEAGLE_DLLEXPORT int beagleSaveInstanceState(int instance,
+                                             const char* fileName);
+
+/**
+ * @brief Load the state of an instance from a file
+ *
+ * This function restores the buffers and model state saved by beagleSaveInstanceState.
+ * The instance must have the tip, buffer, state, pattern, category, matrix, scale buffer and
+ * eigen-decomposition counts, the scaler representation and the pattern order of the saved
+ * instance, or BEAGLE_ERROR_OUT_OF_RANGE is returned. Buffers not in the file keep their
+ * contents.
+ *
+ * @param instance  Instance number (input)
+ * @param fileName  Path of the file to read (input)
+ *
+ * @return error code, BEAGLE_ERROR_GENERAL if the file cannot be read or is not a state file
+ */
+BEAGLE_DLLEXPORT int beagleLoadInstanceState(int instance,
+                                             const char* fileName);
+
 /**
  * @brief Finalize this instance
  *
@@ -408,11 +839,42 @@ BEAGLE_DLLEXPORT int beagleCreateInstance(int tipCount,
  */
 BEAGLE_DLLEXPORT int beagleFinalizeInstance(int instance);
 
+/**
+ * @brief Get the performance counters of an instance
+ *
+ * This function returns the counters accumulated since the instance was created or since
+ * the last call to beagleResetInstanceStatistics. Calls are counted and timed on the host for
+ * all implementations, at the cost of two clock readings per call. Transfers and device time
+ * are left at zero by implementations that do not count them, which currently is all of them.
+ *
+ * For a timeline rather than totals, set the BEAGLE_TRACE_FILE environment variable to a file
+ * name before creating the first instance. The calls of all instances and the tasks of the
+ * CPU worker threads are then written to it in the Chrome trace event format, which
+ * chrome://tracing and Perfetto open, and completed by beagleFinalize.
+ *
+ * @param instance          Instance number (input)
+ * @param outStatistics     Pointer to the counters (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleGetInstanceStatistics(int instance,
+                                                 BeagleStatistics* outStatistics);
+
+/**
+ * @brief Reset the performance counters of an instance to zero
+ *
+ * @param instance          Instance number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleResetInstanceStatistics(int instance);
+
 /**
  * @brief Finalize the library
  *
  * This function finalizes the library and releases all allocated memory.
  * This function is automatically called under GNU C via __attribute__ ((destructor)).
+ * No other call may run concurrently with it.
  *
  * @return error code
  */
@@ -428,6 +890,12 @@ BEAGLE_DLLEXPORT int beagleFinalize(void);
  * If BEAGLE_FLAG_THREADING_CPP is set and this function is not called BEAGLE will use 
  * a heuristic to set an appropriate number of threads.
  *
+ * With the BEAGLE_FLAG_THREADING_OPENMP flag, offered by CPU implementations built with
+ * OpenMP, each beagleUpdatePartials call runs all of its operations in one OpenMP team,
+ * with the patterns split into blocks across its threads; this function sets the size of
+ * the team, which otherwise follows OMP_NUM_THREADS, and the schedule of the blocks
+ * follows OMP_SCHEDULE.
+ *
  * @param instance             Instance number (input)
  * @param threadCount          Number of threads (input)
  *
@@ -436,6 +904,356 @@ BEAGLE_DLLEXPORT int beagleFinalize(void);
 BEAGLE_DLLEXPORT int beagleSetCPUThreadCount(int instance,
                                              int threadCount);
 
+/**
+ * @brief Set number of threads in a thread pool shared across native CPU instances
+ *
+ * This function creates a library-wide pool of threadCount worker threads. Native CPU
+ * instances subsequently created with the BEAGLE_FLAG_THREADING_CPP flag queue their
+ * work on this pool instead of starting their own threads, so that the total number of
+ * threads is bounded when many instances live in the same process. Instances created
+ * earlier keep the threads they already use. A threadCount of zero releases the shared
+ * pool, and instances created afterwards start their own threads again.
+ *
+ * @param threadCount          Number of threads in the shared pool, or 0 (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetSharedCPUThreadCount(int threadCount);
+
+/**
+ * @brief Calibrate number of threads for native CPU implementation
+ *
+ * This function times the partials kernel of the instance over its pattern count with
+ * increasing numbers of threads and sets the number of worker threads (and automatic
+ * pattern partitions) to the fastest choice found. Results are kept per host,
+ * implementation, available thread count, state count, category count and pattern count,
+ * so calibrating further instances of the same size is cheap. If the
+ * BEAGLE_CPU_CALIBRATION_PROFILE environment variable names a profile file, they are also
+ * saved there and reused by later runs. Like beagleSetCPUThreadCount, it should only be
+ * called after beagleCreateInstance, requires the BEAGLE_FLAG_THREADING_CPP flag to be
+ * set and has no effect on GPU-based implementations.
+ *
+ * @param instance             Instance number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalibrateCPUThreadCount(int instance);
+
+/**
+ * @brief Enable NUMA-aware placement for native CPU implementation
+ *
+ * When enabled, the worker threads of the instance are pinned to processors and each
+ * pattern partition is always computed by the same worker. The partials and scale
+ * buffers of each partition are moved to memory first touched by that worker, which
+ * places them on its NUMA node. Buffers set up later with beagleSetTipPartials are
+ * placed the same way. Requires the BEAGLE_FLAG_THREADING_CPP flag; it has no effect
+ * on GPU-based implementations and is not available for instances using the shared
+ * pool of beagleSetSharedCPUThreadCount. Thread pinning is only supported on Linux.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUNumaPlacement(int instance,
+                                               int enable);
+
+/**
+ * @brief Let the worker threads of a native CPU implementation spin before blocking
+ *
+ * Sets how long, in microseconds, an idle worker thread keeps polling for new jobs, and
+ * the calling thread keeps polling for the jobs it handed out to finish, before going to
+ * sleep. Spinning spends processor time to save the wakeup latency of each parallel
+ * section, which pays off when many short calls are issued back to back (e.g. small
+ * pattern counts or many partitions). Zero, the default, blocks at once. Requires the
+ * BEAGLE_FLAG_THREADING_CPP flag and has no effect on GPU-based implementations. For an
+ * instance using the shared pool of beagleSetSharedCPUThreadCount, the setting applies to
+ * the shared pool.
+ *
+ * @param instance             Instance number (input)
+ * @param spinMicroseconds     Time to spin before blocking, in microseconds (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUThreadSpin(int instance,
+                                            int spinMicroseconds);
+
+/**
+ * @brief Keep the buffers of a native CPU implementation in a single arena
+ *
+ * When enabled, the partials, transition matrix and scale buffers of the instance are moved
+ * into one contiguous region, each starting on a 64-byte boundary, and partials buffers set
+ * up later with beagleSetTipPartials or beagleSetPartials take their place in it. This
+ * replaces one allocation per buffer by a single one and cuts TLB misses on instances with
+ * many buffers. If hugePageSize is non-zero, the region is mapped from huge pages of that
+ * many bytes (e.g. 2 MB or 1 GB) where the system has them reserved, and otherwise from
+ * transparent huge pages where supported. Disabling moves the buffers back to separate
+ * allocations. Not available together with beagleSetCPUNumaPlacement. Has no effect on
+ * GPU-based implementations.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ * @param hugePageSize         Huge page size in bytes, a power of two, or zero for normal
+ *                              pages (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUBufferArena(int instance,
+                                             int enable,
+                                             long hugePageSize);
+
+/**
+ * @brief Keep the partials of a native CPU implementation in a memory-mapped scratch file
+ *
+ * When enabled, the partials buffers of the instance are moved into a file created, and at
+ * once unlinked, in directory and mapped into memory. The system then writes pages of
+ * partials out to the file and reads them back as needed rather than keeping them all in
+ * memory, so alignments whose partials exceed the available memory can still be analysed
+ * from fast local storage. Each update asks for the partials read and written by the
+ * operation prefetchDistance places ahead in its list to be read in early; with operations
+ * in the order of a post-order traversal, only the buffers near the active frontier need to
+ * be resident. Transition matrices and scale buffers stay in memory. Calling again with
+ * another directory moves the partials to a new file, and a NULL directory moves them back
+ * to memory. Not available together with beagleSetCPUBufferArena, beagleSetCPUNumaPlacement
+ * or beagleSetPartialsCheckpointing, nor on Windows or GPU-based implementations.
+ *
+ * @param instance             Instance number (input)
+ * @param directory            Directory to create the scratch file in, or NULL to disable
+ *                              (input)
+ * @param prefetchDistance     Number of operations to prefetch ahead, or zero to leave
+ *                              paging to the system (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUScratchFile(int instance,
+                                             const char* directory,
+                                             int prefetchDistance);
+
+/**
+ * @brief Allocate internal partials and scale buffers on first write
+ *
+ * When enabled, the memory of the internal partials buffers and the scale buffers of the
+ * instance is released and each buffer gets memory of its own again only when it is first
+ * written, by an update operation, a scale factor call or beagleSetPartials. Buffers that
+ * are never written share one zero-filled buffer, so instances created with more buffers
+ * than a traversal uses only pay for those it touches. The current contents of these
+ * buffers are discarded on enabling. Disabling allocates all remaining buffers. Only
+ * available with manual scaling on native CPU implementations.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetLazyBufferAllocation(int instance,
+                                                   int enable);
+
+/**
+ * @brief Run partials operations block by block of patterns for native CPU implementation
+ *
+ * When enabled, beagleUpdatePartials runs the first patternBlockSize patterns through its
+ * whole list of operations, then the next block, and so on, instead of running each
+ * operation across all patterns in turn. The partials a block writes are then still in cache
+ * when later operations read them, which helps when patterns are many enough for a single
+ * partials buffer to exceed the cache. Applies to updates run on the calling thread; updates
+ * split across threads by pattern or by operation, and instances using site repeats or a
+ * scaling threshold, run as before. Root and edge likelihoods are integrated in separate
+ * calls and are not tiled. Only available with manual scaling and has no effect on GPU-based
+ * implementations.
+ *
+ * @param instance             Instance number (input)
+ * @param patternBlockSize     Number of patterns per block, or zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUPatternTiling(int instance,
+                                               int patternBlockSize);
+
+/**
+ * @brief Compute partials several patterns at a time for native CPU implementation
+ *
+ * When enabled, beagleUpdatePartials computes partials for groups of adjacent patterns side
+ * by side, copying each group's child partials so that states vary slowest and patterns
+ * fastest. Vector instructions then work across patterns and are used at full width whatever
+ * the state count, which helps state counts such as 20 or 61 that do not fill whole vectors.
+ * The layout of partials buffers, as seen by beagleSetPartials and beagleGetPartials, is
+ * unchanged. Applies to updates of partials from states or partials that are not computed
+ * with fixed or automatic scale factors or by site repeats. Results may differ from the
+ * default kernels in the last bits because sums are accumulated in a different order. Has no
+ * effect on GPU-based implementations.
+ *
+ * @param instance  Instance number (input)
+ * @param enable    Whether partials are computed several patterns at a time (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUInterleavedPatterns(int instance,
+                                                     int enable);
+
+/**
+ * @brief Bound the number of internal partials buffers that hold memory
+ *
+ * When enabled, at most maxResidentBuffers internal partials buffers of the instance hold
+ * memory at a time, so that trees with more internal nodes than fit in memory can still be
+ * evaluated. Beyond that, the least recently used buffers are released and the operation
+ * that last computed each of them is remembered. When a later call reads a released buffer,
+ * it is recomputed from that operation first, recursively recomputing released buffers the
+ * operation reads. A released buffer can be recomputed only as long as neither it nor any
+ * buffer or matrix the operation read has been written since; otherwise calls reading it
+ * return BEAGLE_ERROR_GENERAL. Buffers that have no such operation, such as those set by
+ * beagleSetPartials or computed by beagleUpdatePrePartials, are never released, so the
+ * bound may be exceeded. beagleUpdatePartials runs its operations one at a time while
+ * enabled, and beagleUpdatePartialsByPartition is not available.
+ *
+ * Enabling also enables beagleSetLazyBufferAllocation and beagleSetBufferVersioning, and
+ * neither may be disabled while checkpointing is. Only available with manual scaling on
+ * native CPU implementations, and not together with beagleSetCPUBufferArena.
+ *
+ * @param instance             Instance number (input)
+ * @param maxResidentBuffers   Number of internal partials buffers that may hold memory, or
+ *                              zero to disable, recomputing released buffers where possible
+ *                              (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetPartialsCheckpointing(int instance,
+                                                    int maxResidentBuffers);
+
+/**
+ * @brief Enable dependency-aware traversal of partials operations for native CPU implementation
+ *
+ * When enabled, beagleUpdatePartials and beagleUpdatePartialsByPartition build the
+ * dependency graph of the operation list from its destination, child and scale buffer
+ * indices and run independent operations (e.g. the nodes of disjoint subtrees) on the
+ * worker threads at the same time. With pattern partitions, each operation is split by
+ * partition as well, so tree-level and pattern-level parallelism are combined. Results
+ * do not depend on the order in which independent operations complete. Requires the
+ * BEAGLE_FLAG_THREADING_CPP flag; the number of worker threads used without pattern
+ * partitions is limited by beagleSetCPUThreadCount. Operation lists are still run in
+ * order under BEAGLE_FLAG_SCALING_AUTO, BEAGLE_FLAG_SCALING_ALWAYS and
+ * BEAGLE_FLAG_SCALING_DYNAMIC. Has no effect on GPU-based implementations.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUParallelOperations(int instance,
+                                                    int enable);
+
+/**
+ * @brief Enable reuse of previously computed transition matrices
+ *
+ * When enabled, the instance remembers the eigen decomposition, category rates and edge
+ * length each transition probability matrix was computed from. beagleUpdateTransitionMatrices
+ * and beagleUpdateTransitionMatricesWithMultipleModels then skip a matrix whose destination
+ * buffer already holds it (e.g. after a rejected proposal) and copy a matrix held by another
+ * buffer (e.g. when partitions share a model) instead of recomputing it. Edge lengths must be
+ * identical to match. Setting an eigen decomposition or category rates forgets the matrices
+ * computed from them; setting or convolving matrices and the calls that compute derivative
+ * matrices forget the buffers they write. Disabled by default.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTransitionMatrixCache(int instance,
+                                                    int enable);
+
+/**
+ * @brief Enable skipping of partials operations whose inputs are unchanged
+ *
+ * When enabled, the instance gives tip, partials, transition matrix and scale buffers a new
+ * version each time they are written. beagleUpdatePartials then skips an operation whose child
+ * partials, transition matrices and read scale buffer are unchanged since the same operation
+ * last computed its destination partials and write scale buffer, and neither of these has
+ * been written since. A change of topology or edge lengths then only recomputes the partials
+ * on the path to the root, even if every operation of the tree is passed. A recomputed matrix
+ * is a new version even if it is unchanged, unless beagleSetTransitionMatrixCache skips it.
+ * Operations are not skipped when beagleUpdatePartials accumulates scale factors into
+ * cumulativeScaleIndex, with automatic, always or dynamic scaling, and in
+ * beagleUpdatePartialsByPartition. Disabled by default.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetBufferVersioning(int instance,
+                                               int enable);
+
+/**
+ * @brief Enable rescaling of partials by powers of two
+ *
+ * When enabled, rescaling a pattern multiplies its partials by the power of two that brings
+ * the largest of them into [1, 2), instead of dividing by the largest. The multiplication is
+ * exact, and the scale factor is found from the exponent of the largest partial without a
+ * log. Raw scale factors are then exact powers of two, log scale factors are multiples of
+ * log(2), and accumulating or removing raw scale factors sums their integer exponents instead
+ * of taking logs. Log likelihoods agree with the default rescaling to rounding. Scale factors
+ * computed while disabled must not be accumulated or removed while enabled.
+ * Disabled by default.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetPowerOfTwoScaling(int instance,
+                                                int enable);
+
+/**
+ * @brief Rescale only the patterns whose partials have fallen below a threshold
+ *
+ * When the threshold is positive, an operation that writes a scale buffer rescales only the
+ * patterns whose largest partial is below the threshold, and gives the others a scale factor
+ * of one. A scale buffer whose factors are then all one is flagged as unwritten, and
+ * beagleAccumulateScaleFactors and beagleRemoveScaleFactors skip it. On moderate trees most
+ * operations rescale nothing, so the client may keep passing a write scale buffer for every
+ * operation. Log likelihoods agree with rescaling every pattern to rounding, provided the
+ * threshold is high enough that the product of two partials at the threshold cannot
+ * underflow, e.g. 2^-32 for single precision. A threshold of zero disables the mode.
+ * Disabled by default.
+ * Only available for native CPU implementations with manual scaling; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance             Instance number (input)
+ * @param threshold            Smallest largest partial left unscaled, in [0, 1) (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetScalingThreshold(int instance,
+                                               double threshold);
+
+/**
+ * @brief Keep the sums of a single-precision instance in double precision
+ *
+ * When enabled, a single-precision instance keeps its partials, transition matrices and scale
+ * buffers in single precision, and additionally keeps a double-precision copy of every scale
+ * buffer in which cumulative scale factors are summed. Site log likelihoods are completed
+ * with these double sums and returned, and summed over the patterns, at double precision, so
+ * that deep trees rescaled at many nodes keep an accurate log likelihood. Enabling the mode
+ * copies the current scale buffers, so it may be enabled at any time.
+ * Only manual scaling is supported; instances created with automatic, always or dynamic
+ * scaling, and implementations other than the native CPU ones, return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ * Disabled by default, and has no effect on double-precision instances.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetMixedPrecision(int instance,
+                                             int enable);
+
 /**
  * @brief Set the compact state representation for tip node
  *
@@ -454,6 +1272,25 @@ BEAGLE_DLLEXPORT int beagleSetTipStates(int instance,
                        int tipIndex,
                        const int* inStates);
 
+/**
+ * @brief Enable bit-packed storage of compact tip states
+ *
+ * When enabled, the instance stores the compact state representation of each tip in 2, 4 or 8
+ * bits per pattern, the fewest that hold states 0 to stateCount (missing), in place of an int,
+ * and unpacks a tip into a per-thread buffer for each operation or likelihood calculation that
+ * reads it. This reduces the memory of instances dominated by compact tips by 4 to 16 times,
+ * at the cost of the unpacking. Tips already set are converted. Disabled by default.
+ * Only available for native CPU implementations with at most 255 states; other instances
+ * return BEAGLE_ERROR_NO_IMPLEMENTATION, or BEAGLE_ERROR_OUT_OF_RANGE for more states.
+ *
+ * @param instance             Instance number (input)
+ * @param enable               Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTipStatesPacking(int instance,
+                                               int enable);
+
 /**
  * @brief Set an instance partials buffer for tip node
  *
@@ -462,6 +1299,11 @@ BEAGLE_DLLEXPORT int beagleSetTipStates(int instance,
  * to set the partial likelihoods for the observed states. Internally, the partials will be copied
  * categoryCount times.
  *
+ * CPU implementations created with compact buffers keep a tip whose every pattern is one-hot,
+ * or all ones, as compact states, exactly as if it had been set with beagleSetTipStates, so that
+ * the faster states kernels are used. A tip with any other ambiguity keeps its partials, as does
+ * a tip set later with beagleSetPartials.
+ *
  * @param instance      Instance number in which to set a partialsBuffer (input)
  * @param tipIndex      Index of destination partialsBuffer (input)
  * @param inPartials    Pointer to partials values to set (input)
@@ -596,6 +1438,115 @@ BEAGLE_DLLEXPORT int beagleSetCategoryRatesWithIndex(int instance,
  */
 BEAGLE_DLLEXPORT int beagleSetPatternWeights(int instance,
                                        const double* inPatternWeights);
+
+/**
+ * @brief Compress alignment columns into unique site patterns
+ *
+ * This function finds the distinct columns of an alignment and sums the weights of the sites
+ * sharing each one. Patterns are numbered in the order of their first site. The columns are
+ * hashed and compared by threadCount threads, each taking a contiguous block of sites; short
+ * alignments use fewer threads. States are compared as given, so missing data should be coded
+ * consistently. The function does not need an instance and may be called before any is
+ * created, for example to learn the patternCount to create one with.
+ *
+ * @param taxonCount            Number of taxa (input)
+ * @param siteCount             Number of alignment columns (input)
+ * @param inSiteStates          Array of taxonCount rows of siteCount compact states (input)
+ * @param inSiteWeights         Array of siteCount site weights, NULL weighs each site as 1 (input)
+ * @param threadCount           Number of threads to use, 0 or less for one per hardware
+ *                               thread (input)
+ * @param outPatternCount       Pointer to the number of unique patterns (output)
+ * @param outPatternStates      Array of at least taxonCount * siteCount elements to hold
+ *                               taxonCount rows of outPatternCount pattern states, packed,
+ *                               each suitable for beagleSetTipStates (output)
+ * @param outPatternWeights     Array of at least siteCount elements to hold the weights of
+ *                               the patterns (output)
+ * @param outSitePatterns       Array of siteCount elements to hold the pattern of each site,
+ *                               or NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCompressSitePatterns(int taxonCount,
+                                                int siteCount,
+                                                const int* inSiteStates,
+                                                const double* inSiteWeights,
+                                                int threadCount,
+                                                int* outPatternCount,
+                                                int* outPatternStates,
+                                                double* outPatternWeights,
+                                                int* outSitePatterns);
+
+/**
+ * @brief Set compressed site patterns as tip states and pattern weights
+ *
+ * This function sets the compact states of tips 0 to taxonCount - 1 from the rows of
+ * inPatternStates, as beagleSetTipStates would, and then the pattern weights, as
+ * beagleSetPatternWeights would, for patterns returned by beagleCompressSitePatterns.
+ * The instance must have been created with patternCount patterns and at least taxonCount
+ * compact buffers.
+ *
+ * @param instance              Instance number (input)
+ * @param taxonCount            Number of taxa (input)
+ * @param patternCount          Number of patterns of the instance (input)
+ * @param inPatternStates       Array of taxonCount rows of patternCount states (input)
+ * @param inPatternWeights      Array of patternCount weights, or NULL to leave the weights
+ *                               unchanged (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCompressedSitePatterns(int instance,
+                                                     int taxonCount,
+                                                     int patternCount,
+                                                     const int* inPatternStates,
+                                                     const double* inPatternWeights);
+
+/**
+ * @brief Enable site repeats
+ *
+ * When enabled, each partials operation combines the site repeat classes of its children, in
+ * which two patterns share a class when their states agree at every tip of the subtree. The
+ * classes of a compact tip are its states, so tips should be set with beagleSetTipStates; tip
+ * and other partials set directly have no classes, nor do their ancestors. beagleUpdatePartials
+ * then computes one pattern per class of a destination with at most a quarter as many classes
+ * as patterns and copies it to the other patterns of the class. Operations on two compact
+ * tips, operations that read existing scale factors, use automatic scaling, or are split by
+ * partition (including the automatic partitions of threaded instances) compute every
+ * pattern. Disabled by default.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance              Instance number (input)
+ * @param enable                Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetSiteRepeats(int instance,
+                                          int enable);
+
+/**
+ * @brief Enable or disable skipping patterns that are gaps below a partials buffer
+ *
+ * This function enables or disables gap pattern skipping for an instance. While enabled,
+ * the instance marks the patterns of each tip whose compact state is missing
+ * (stateCount or more) or whose partials are all 1.0, at beagleSetTipStates and
+ * beagleSetTipPartials, and the patterns of each destination of beagleUpdatePartials that
+ * are marked in both of its children. beagleUpdatePartials then sets the partials of a
+ * marked pattern to 1.0 instead of computing them, which is what the computation gives when
+ * every row of the transition matrices sums to one; on heavily gapped alignments this skips
+ * much of the work near the tips. Operations that read existing scale factors, use automatic
+ * scaling, or are split by partition (including the automatic partitions of threaded
+ * instances) compute every pattern, as do the ancestors of partials set directly.
+ * Disabled by default.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance              Instance number (input)
+ * @param enable                Non-zero to enable, zero to disable (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetGapPatternSkipping(int instance,
+                                                 int enable);
    
 /**
  * @brief Set pattern partition assignments
@@ -653,6 +1604,35 @@ BEAGLE_DLLEXPORT int beagleConvolveTransitionMatrices(int instance,
                                     const int* resultIndices,
                                     int matrixCount);
 
+/**
+ * @brief Multiply chains of transition probability matrices
+ *
+ * This function computes, for each chain, the product M_1 M_2 ... M_k of its transition
+ * probability matrices, e.g. the matrices of the epochs an edge crosses, in one call instead
+ * of k - 1 calls to beagleConvolveTransitionMatrices. Chains are multiplied concurrently, so
+ * result matrices must not appear in any chain. Scratch matrices hold intermediate
+ * products on instances that need them and may be overwritten; they must be distinct from
+ * all chain and result matrices.
+ *
+ * @param instance                  Instance number (input)
+ * @param chainIndices              Indices of the matrices of all chains, one chain after the
+ *                                   other, in the order they are multiplied (input)
+ * @param chainLengths              Number of matrices in each chain, at least one (input)
+ * @param scratchIndices            List of indices of scratch matrices, one per chain (input,
+ *                                   NULL if no chain holds more than two matrices)
+ * @param resultIndices             List of indices of resulting transition probability matrices
+ *                                   (input)
+ * @param chainCount                Number of chains
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleConvolveTransitionMatrixChains(int instance,
+                                                          const int* chainIndices,
+                                                          const int* chainLengths,
+                                                          const int* scratchIndices,
+                                                          const int* resultIndices,
+                                                          int chainCount);
+
 /**
  * @brief Calculate a list of transition probability matrices
  *
@@ -740,6 +1720,97 @@ BEAGLE_DLLEXPORT int beagleUpdateTransitionMatricesWithMultipleModels(int instan
                                                                       const double* edgeLengths,
                                                                       int count);
 
+/**
+ * @brief Calculate a list of transition probability matrices directly from a rate matrix
+ *
+ * This function calculates a list of transition probability matrices as exp(Q r t) for the
+ * rate matrix Q, each category rate r and each edge length t, by scaling and squaring of a
+ * Pade approximant rather than from an eigen decomposition. Q need not be reversible nor
+ * diagonalizable, which suits non-reversible models whose eigen decompositions are complex or
+ * ill-conditioned. Category rates are taken from beagleSetCategoryRates. Matrices are computed
+ * on the host, across the threads of the instance, and then set as by
+ * beagleSetTransitionMatrices. Derivative matrices are not computed.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance                  Instance number (input)
+ * @param inRateMatrix              Rate matrix, row-major with stateCount * stateCount entries
+ *                                   (input)
+ * @param probabilityIndices        List of indices of transition probability matrices to update
+ *                                   (input)
+ * @param edgeLengths               List of edge lengths with which to perform calculations (input)
+ * @param count                     Length of lists
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateTransitionMatricesWithRateMatrix(int instance,
+                                                                  const double* inRateMatrix,
+                                                                  const int* probabilityIndices,
+                                                                  const double* edgeLengths,
+                                                                  int count);
+
+/**
+ * @brief Calculate the derivatives of transition probability matrices with respect to a
+ *         parameter of the rate matrix
+ *
+ * This function calculates, for each edge length t and category rate r, the derivative of
+ * exp(Q r t) with respect to a model parameter, given the derivative dQ of the rate matrix with
+ * respect to it, as the upper right block of the exponential of the block matrix [Q dQ; 0 Q] r t.
+ * The matrices are computed as by beagleUpdateTransitionMatricesWithRateMatrix and can be
+ * passed to beagleCalculateParameterDerivatives. Only available for native CPU
+ * implementations; other instances return BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance                  Instance number (input)
+ * @param inRateMatrix              Rate matrix, row-major with stateCount * stateCount entries
+ *                                   (input)
+ * @param inRateMatrixDerivative    Derivative of the rate matrix with respect to the parameter,
+ *                                   row-major with stateCount * stateCount entries (input)
+ * @param derivativeIndices         List of indices of transition probability matrices to hold
+ *                                   the derivatives (input)
+ * @param edgeLengths               List of edge lengths with which to perform calculations (input)
+ * @param count                     Length of lists
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateTransitionMatrixDerivativesWithRateMatrix(int instance,
+                                                                           const double* inRateMatrix,
+                                                                           const double* inRateMatrixDerivative,
+                                                                           const int* derivativeIndices,
+                                                                           const double* edgeLengths,
+                                                                           int count);
+
+/**
+ * @brief Calculate a list of transition probability matrices for several replicates at once
+ *
+ * Replicates evaluate the same topology under different models and edge lengths within one
+ * instance, as for the chains of Metropolis-coupled MCMC. Each of replicateCount replicates
+ * owns an equal block of the categoryCount categories: category l belongs to replicate
+ * r = l / (categoryCount / replicateCount). beagleUpdatePartials and the scaling functions then
+ * treat all replicates in one pass, as they do categories. This function calculates each
+ * matrix in probabilityIndices for every replicate r from the eigen decomposition
+ * eigenIndices[r], with the rates set by beagleSetCategoryRates for the categories of r and
+ * the edge length edgeLengths[i * replicateCount + r] for matrix i. Derivative matrices are not
+ * computed. Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance                  Instance number (input)
+ * @param eigenIndices              Index of the eigen decomposition of each replicate (input)
+ * @param probabilityIndices        List of indices of transition probability matrices to update
+ *                                   (input)
+ * @param edgeLengths               Edge lengths, replicateCount for each matrix, one matrix after
+ *                                   the other (input)
+ * @param count                     Number of matrices (input)
+ * @param replicateCount            Number of replicates, a divisor of categoryCount (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateTransitionMatricesForReplicates(int instance,
+                                                                 const int* eigenIndices,
+                                                                 const int* probabilityIndices,
+                                                                 const double* edgeLengths,
+                                                                 int count,
+                                                                 int replicateCount);
+
 /**
  * @brief Set a finite-time transition probability matrix
  *
@@ -832,6 +1903,29 @@ BEAGLE_DLLEXPORT int beagleUpdatePartials(const int instance,
                          int operationCount,
                          int cumulativeScaleIndex);
 
+/**
+ * @brief Calculate partials on several instances in one call
+ *
+ * This function has the effect of calling beagleUpdatePartials on each of a list of distinct
+ * instances, for example one per data partition. The instances are updated concurrently by
+ * threads owned by the library, the calling thread driving the first, and the call returns
+ * once all are done. If any instance fails, the first error code in list order is returned.
+ *
+ * @param instances                 List of distinct instance numbers (input)
+ * @param instanceCount             Number of instances (input)
+ * @param operations                BeagleOperation list for each instance (input)
+ * @param operationCounts           Number of operations for each instance (input)
+ * @param cumulativeScaleIndices    Index number of scaleBuffer to store accumulated factors for
+ *                                   each instance (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdatePartialsMulti(const int* instances,
+                                               int instanceCount,
+                                               const BeagleOperation* const* operations,
+                                               const int* operationCounts,
+                                               const int* cumulativeScaleIndices);
+
 /**
  * @brief A list of integer indices which specify a partial likelihoods operation for a partitioned analysis.
  */
@@ -864,6 +1958,59 @@ BEAGLE_DLLEXPORT int beagleUpdatePartialsByPartition(const int instance,
                                                      const BeagleOperationByPartition* operations,
                                                      int operationCount);
 
+/**
+ * @brief Set the pre-order partials of the root
+ *
+ * This function copies a set of state frequencies into every category and pattern of a
+ * partials buffer, which then serves as the pre-order partials of the root in
+ * beagleUpdatePrePartials.
+ *
+ * @param instance                  Instance number (input)
+ * @param bufferIndices             List of indices of destination partialsBuffers (input)
+ * @param stateFrequenciesIndices   List of indices of state frequencies for each buffer (input)
+ * @param count                     Number of buffers (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetRootPrePartials(int instance,
+                                              const int* bufferIndices,
+                                              const int* stateFrequenciesIndices,
+                                              int count);
+
+/**
+ * @brief Calculate pre-order partials using a list of operations
+ *
+ * The pre-order partials of a node hold, for each state at the parent end of the edge above
+ * the node, the joint probability of that state and of the data outside the subtree of the
+ * node. Each operation computes them for the node in destinationPartials from the pre-order
+ * partials of its parent in child1Partials, with the transition matrix of the edge above the
+ * parent in child1TransitionMatrix, and the post-order partials or tip states of its sibling
+ * in child2Partials, with the transition matrix of the edge above the sibling in
+ * child2TransitionMatrix. For the children of the root, child1Partials holds the buffer set
+ * by beagleSetRootPrePartials and child1TransitionMatrix is BEAGLE_OP_NONE. A root with more
+ * than two children is expanded into a chain of operations through intermediate buffers,
+ * as BEAGLE_OP_NONE leaves the partials in child1Partials unchanged. Operations are computed
+ * in order, so parents must precede their children.
+ *
+ * Scale factors are written to destinationScaleWrite and accumulated into
+ * cumulativeScaleIndex under manual scaling, as in beagleUpdatePartials; other scaling modes
+ * do not apply. Pre-order and post-order partials share scale factors along an edge, so
+ * beagleCalculateEdgeDerivatives does not need them.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance                  Instance number (input)
+ * @param operations                BeagleOperation list specifying operations (input)
+ * @param operationCount            Number of operations (input)
+ * @param cumulativeScaleIndex      Index number of scaleBuffer to store accumulated factors (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdatePrePartials(const int instance,
+                                             const BeagleOperation* operations,
+                                             int operationCount,
+                                             int cumulativeScaleIndex);
+
 /**
  * @brief Block until all calculations that write to the specified partials have completed.
  *
@@ -1037,6 +2184,98 @@ BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoods(int instance,
                                       int count,
                                       double* outSumLogLikelihood);
 
+/**
+ * @brief Calculate root log likelihoods on several instances in one call
+ *
+ * This function has the effect of calling beagleCalculateRootLogLikelihoods on each of a list of
+ * distinct instances, concurrently as in beagleUpdatePartialsMulti. The index lists hold count
+ * entries for each instance, those of instance i starting at entry i * count.
+ *
+ * @param instances                List of distinct instance numbers (input)
+ * @param instanceCount            Number of instances (input)
+ * @param bufferIndices            List of partialsBuffer indices to integrate (input)
+ * @param categoryWeightsIndices   List of weights to apply to each partialsBuffer (input)
+ * @param stateFrequenciesIndices  List of state frequencies for each partialsBuffer (input)
+ * @param cumulativeScaleIndices   List of scaleBuffers containing accumulated factors to apply to
+ *                                  each partialsBuffer (input)
+ * @param count                    Number of partialsBuffer to integrate per instance (input)
+ * @param outSumLogLikelihoods     Destination for the log likelihood of each instance (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoodsMulti(const int* instances,
+                                                           int instanceCount,
+                                                           const int* bufferIndices,
+                                                           const int* categoryWeightsIndices,
+                                                           const int* stateFrequenciesIndices,
+                                                           const int* cumulativeScaleIndices,
+                                                           int count,
+                                                           double* outSumLogLikelihoods);
+
+/**
+ * @brief Calculate root log likelihoods under several sets of pattern weights
+ *
+ * This function integrates the partials as beagleCalculateRootLogLikelihoods does, once, and
+ * returns for each of weightVectorCount sets of pattern weights the sum of the site log
+ * likelihoods weighted by that set, as if beagleSetPatternWeights had been called with it
+ * before. The weights set by beagleSetPatternWeights are not used or changed. This suits
+ * non-parametric bootstrap replicates on a fixed tree, which differ only in their weights.
+ * Patterns with a weight of zero do not contribute, even when their likelihood is zero.
+ *
+ * @param instance                 Instance number (input)
+ * @param bufferIndices            List of partialsBuffer indices to integrate (input)
+ * @param categoryWeightsIndices   List of weights to apply to each partialsBuffer (input)
+ * @param stateFrequenciesIndices  List of state frequencies for each partialsBuffer (input)
+ * @param cumulativeScaleIndices   List of scaleBuffers containing accumulated factors to apply to
+ *                                  each partialsBuffer (input)
+ * @param count                    Number of partialsBuffer to integrate (input)
+ * @param inPatternWeights         Pattern weights, patternCount for each set, one set after the
+ *                                  other (input)
+ * @param weightVectorCount        Number of sets of pattern weights (input)
+ * @param outSumLogLikelihoods     Destination for the log likelihood under each set (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoodsWithPatternWeights(int instance,
+                                                                        const int* bufferIndices,
+                                                                        const int* categoryWeightsIndices,
+                                                                        const int* stateFrequenciesIndices,
+                                                                        const int* cumulativeScaleIndices,
+                                                                        int count,
+                                                                        const double* inPatternWeights,
+                                                                        int weightVectorCount,
+                                                                        double* outSumLogLikelihoods);
+
+/**
+ * @brief Calculate the root log likelihood of each of several replicates
+ *
+ * This function integrates the partials of a root node for each replicate separately, as
+ * laid out by beagleUpdateTransitionMatricesForReplicates: replicate r is integrated over its
+ * own block of categories with the matching entries of the category weights, which should sum
+ * to one within each block, and with its own state frequencies. Scale factors are shared by
+ * all replicates. Site log likelihoods are not kept for beagleGetSiteLogLikelihoods.
+ * Only available for native CPU implementations; other instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance                 Instance number (input)
+ * @param bufferIndex              Index of the partialsBuffer to integrate (input)
+ * @param categoryWeightsIndex     Index of the weights of all categories (input)
+ * @param stateFrequenciesIndices  Index of the state frequencies of each replicate (input)
+ * @param cumulativeScaleIndex     Index of the scaleBuffer containing accumulated factors, or
+ *                                  BEAGLE_OP_NONE (input)
+ * @param replicateCount           Number of replicates, a divisor of categoryCount (input)
+ * @param outSumLogLikelihoods     Destination for the log likelihood of each replicate (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoodsForReplicates(int instance,
+                                                                   int bufferIndex,
+                                                                   int categoryWeightsIndex,
+                                                                   const int* stateFrequenciesIndices,
+                                                                   int cumulativeScaleIndex,
+                                                                   int replicateCount,
+                                                                   double* outSumLogLikelihoods);
+
 /**
  * @brief Calculate site log likelihoods at a root node with per partition buffers
  *
@@ -1074,6 +2313,40 @@ BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoodsByPartition(int instance,
                                                                   double* outSumLogLikelihoodByPartition,
                                                                   double* outSumLogLikelihood);
 
+/**
+ * @brief Update partials and calculate the log likelihood at the root in one call
+ *
+ * This function is equivalent to beagleUpdatePartials with the same operations followed by
+ * beagleCalculateRootLogLikelihoods at the destinationPartials of the last operation, with
+ * cumulativeScaleIndex as scale buffer for both. When writeRootPartials is zero, native CPU
+ * implementations integrate the partials of the last operation as they are computed without
+ * writing them to its destination buffer, which then keeps its previous contents. This is
+ * done only with manual scaling and when the last operation neither reads nor writes a scale
+ * buffer; otherwise, and for other implementations, the root partials are written as with
+ * the two calls.
+ *
+ * @param instance                 Instance number (input)
+ * @param operations               BeagleOperation list specifying operations, the last one
+ *                                  computing the root (input)
+ * @param operationCount           Number of operations, at least one (input)
+ * @param cumulativeScaleIndex     Index number of scaleBuffer to accumulate factors into and
+ *                                  to apply at the root, or BEAGLE_OP_NONE (input)
+ * @param categoryWeightsIndex     Index of category weights (input)
+ * @param stateFrequenciesIndex    Index of state frequencies (input)
+ * @param writeRootPartials        Whether the root partials must be written (input)
+ * @param outSumLogLikelihood      Pointer to destination for resulting log likelihood (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdatePartialsAndCalculateRootLogLikelihood(int instance,
+                                                                       const BeagleOperation* operations,
+                                                                       int operationCount,
+                                                                       int cumulativeScaleIndex,
+                                                                       int categoryWeightsIndex,
+                                                                       int stateFrequenciesIndex,
+                                                                       int writeRootPartials,
+                                                                       double* outSumLogLikelihood);
+
 /**
  * @brief Calculate site log likelihoods and derivatives along an edge
  *
@@ -1115,6 +2388,53 @@ BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoods(int instance,
                                       double* outSumFirstDerivative,
                                       double* outSumSecondDerivative);
 
+/**
+ * @brief Calculate site log likelihoods and derivatives along several edges
+ *
+ * This function integrates the partials at a parent and child node along each of a list of
+ * edges, as beagleCalculateEdgeLogLikelihoods does for one, and returns the log likelihood
+ * and derivatives of every site on every edge. The results of edge e are in row e of each
+ * output, patternCount in length, as beagleGetSiteLogLikelihoods and beagleGetSiteDerivatives
+ * would return them after that edge.
+ *
+ * @param instance                  Instance number (input)
+ * @param parentBufferIndices       List of indices of parent partialsBuffers (input)
+ * @param childBufferIndices        List of indices of child partialsBuffers (input)
+ * @param probabilityIndices        List indices of transition probability matrices for each
+ *                                   edge (input)
+ * @param firstDerivativeIndices    List indices of first derivative matrices, or NULL (input)
+ * @param secondDerivativeIndices   List indices of second derivative matrices, or NULL; requires
+ *                                   firstDerivativeIndices (input)
+ * @param categoryWeightsIndices    List of weights to apply on each edge (input)
+ * @param stateFrequenciesIndices   List of state frequencies for each edge (input)
+ * @param cumulativeScaleIndices    List of scaleBuffers containing accumulated factors to apply
+ *                                   on each edge (input)
+ * @param count                     Number of edges (input)
+ * @param outSiteLogLikelihoods     Pointer to destination for the site log likelihoods,
+ *                                   count * patternCount in length (output)
+ * @param outSiteFirstDerivatives   Pointer to destination for the site first derivatives,
+ *                                   count * patternCount in length, used if
+ *                                   firstDerivativeIndices is given (output)
+ * @param outSiteSecondDerivatives  Pointer to destination for the site second derivatives,
+ *                                   count * patternCount in length, used if
+ *                                   secondDerivativeIndices is given (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeSiteLogLikelihoods(int instance,
+                                                           const int* parentBufferIndices,
+                                                           const int* childBufferIndices,
+                                                           const int* probabilityIndices,
+                                                           const int* firstDerivativeIndices,
+                                                           const int* secondDerivativeIndices,
+                                                           const int* categoryWeightsIndices,
+                                                           const int* stateFrequenciesIndices,
+                                                           const int* cumulativeScaleIndices,
+                                                           int count,
+                                                           double* outSiteLogLikelihoods,
+                                                           double* outSiteFirstDerivatives,
+                                                           double* outSiteSecondDerivatives);
+
 /**
  * @brief Calculate multiple site log likelihoods and derivatives along an edge with 
  *         per partition buffers
@@ -1170,6 +2490,129 @@ BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoodsByPartition(
                                                     double* outSumSecondDerivativeByPartition,
                                                     double* outSumSecondDerivative);
 
+/**
+ * @brief Calculate the derivatives of the log likelihood with respect to a list of edge lengths
+ *
+ * This function integrates the post-order partials below and the pre-order partials above each
+ * edge, as computed by beagleUpdatePartials and beagleUpdatePrePartials, to return the
+ * derivative of the log likelihood with respect to the length of every edge in one call. The
+ * cost of each edge is that of one edge likelihood, so that a full gradient grows linearly with
+ * the number of edges.
+ *
+ * @param instance                  Instance number (input)
+ * @param postBufferIndices         List of indices of post-order partialsBuffers or compact tips
+ *                                   below each edge (input)
+ * @param preBufferIndices          List of indices of pre-order partialsBuffers above each edge
+ *                                   (input)
+ * @param probabilityIndices        List of indices of transition probability matrices of each
+ *                                   edge (input)
+ * @param firstDerivativeIndices    List of indices of first derivative matrices of each edge
+ *                                   (input)
+ * @param categoryWeightsIndices    List of indices of category weights for each edge (input)
+ * @param count                     Number of edges (input)
+ * @param outDerivatives            Pointer to destination for the site derivatives of each edge,
+ *                                   count * patternCount in length, or NULL (output)
+ * @param outSumDerivatives         Pointer to destination for the derivative of each edge, count in
+ *                                   length (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeDerivatives(int instance,
+                                                    const int* postBufferIndices,
+                                                    const int* preBufferIndices,
+                                                    const int* probabilityIndices,
+                                                    const int* firstDerivativeIndices,
+                                                    const int* categoryWeightsIndices,
+                                                    int count,
+                                                    double* outDerivatives,
+                                                    double* outSumDerivatives);
+
+/**
+ * @brief Calculate the derivatives of the log likelihood with respect to model parameters
+ *
+ * This function combines, for every edge, the post-order partials below and the pre-order
+ * partials above it with the derivative of its transition probability matrix with respect to
+ * each of a list of parameters, as computed by
+ * beagleUpdateTransitionMatrixDerivativesWithRateMatrix or set by the caller, and sums over the
+ * edges to return the derivative of the log likelihood with respect to each parameter. This
+ * equals the sum over the edges of beagleCalculateEdgeDerivatives with the derivative matrices of
+ * one parameter, but integrates the likelihood of each edge once for all parameters. A
+ * parameter that also changes the state frequencies at the root contributes through them a
+ * further term that is not included.
+ *
+ * @param instance                  Instance number (input)
+ * @param postBufferIndices         List of indices of post-order partialsBuffers or compact tips
+ *                                   below each edge (input)
+ * @param preBufferIndices          List of indices of pre-order partialsBuffers above each edge
+ *                                   (input)
+ * @param probabilityIndices        List of indices of transition probability matrices of each
+ *                                   edge (input)
+ * @param derivativeIndices         List of indices of derivative matrices, count for each
+ *                                   parameter, one parameter after the other (input)
+ * @param categoryWeightsIndices    List of indices of category weights for each edge (input)
+ * @param count                     Number of edges (input)
+ * @param parameterCount            Number of parameters (input)
+ * @param outSumDerivatives         Pointer to destination for the derivative with respect to each
+ *                                   parameter, parameterCount in length (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateParameterDerivatives(int instance,
+                                                         const int* postBufferIndices,
+                                                         const int* preBufferIndices,
+                                                         const int* probabilityIndices,
+                                                         const int* derivativeIndices,
+                                                         const int* categoryWeightsIndices,
+                                                         int count,
+                                                         int parameterCount,
+                                                         double* outSumDerivatives);
+
+/**
+ * @brief Calculate edge log likelihoods for one edge over a list of candidate matrices
+ *
+ * This function integrates the same parent and child partials against each of a list of
+ * transition probability matrices, as computed for trial lengths of one edge, and returns the
+ * log likelihood and optional derivatives for every matrix. It is equivalent to calling
+ * beagleCalculateEdgeLogLikelihoods once per matrix, but each pattern of the partials is read
+ * once for all matrices, which suits the line searches of edge length optimization. The site
+ * log likelihoods and derivatives returned by beagleGetSiteLogLikelihoods and
+ * beagleGetSiteDerivatives are left unspecified.
+ *
+ * @param instance                  Instance number (input)
+ * @param parentBufferIndex         Index of the parent partialsBuffer (input)
+ * @param childBufferIndex          Index of the child partialsBuffer or compact tip (input)
+ * @param probabilityIndices        List of indices of transition probability matrices (input)
+ * @param firstDerivativeIndices    List of indices of first derivative matrices, or NULL (input)
+ * @param secondDerivativeIndices   List of indices of second derivative matrices, or NULL
+ *                                   (input)
+ * @param categoryWeightsIndex      Index of category weights (input)
+ * @param stateFrequenciesIndex     Index of state frequencies (input)
+ * @param cumulativeScaleIndex      Index of the scaleBuffer containing accumulated factors
+ *                                   (input)
+ * @param matrixCount               Number of matrices (input)
+ * @param outSumLogLikelihoods      Pointer to destination for the log likelihood of each
+ *                                   matrix, matrixCount in length (output)
+ * @param outSumFirstDerivatives    Pointer to destination for the first derivative of each
+ *                                   matrix, or NULL (output)
+ * @param outSumSecondDerivatives   Pointer to destination for the second derivative of each
+ *                                   matrix, or NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoodsForMatrices(int instance,
+                                                                  int parentBufferIndex,
+                                                                  int childBufferIndex,
+                                                                  const int* probabilityIndices,
+                                                                  const int* firstDerivativeIndices,
+                                                                  const int* secondDerivativeIndices,
+                                                                  int categoryWeightsIndex,
+                                                                  int stateFrequenciesIndex,
+                                                                  int cumulativeScaleIndex,
+                                                                  int matrixCount,
+                                                                  double* outSumLogLikelihoods,
+                                                                  double* outSumFirstDerivatives,
+                                                                  double* outSumSecondDerivatives);
+
 
 /**
  * @brief Returns log likelihood sum and subsequent to an asynchronous integration call.
@@ -110,6 +110,7 @@ int* getRandomTipStates( int nsites, int stateCount, unsigned int *seed )
 //     if (inFlags & BEAGLE_FLAG_VECTOR_NONE)        fprintf(stdout, " VECTOR_NONE");
 //     if (inFlags & BEAGLE_FLAG_VECTOR_SSE)         fprintf(stdout, " VECTOR_SSE");
 //     if (inFlags & BEAGLE_FLAG_VECTOR_AVX)         fprintf(stdout, " VECTOR_AVX");
+//     if (inFlags & BEAGLE_FLAG_VECTOR_AVX512)      fprintf(stdout, " VECTOR_AVX512");
 //     if (inFlags & BEAGLE_FLAG_THREADING_NONE)     fprintf(stdout, " THREADING_NONE");
 //     if (inFlags & BEAGLE_FLAG_THREADING_OPENMP)   fprintf(stdout, " THREADING_OPENMP");
 //     if (inFlags & BEAGLE_FLAG_THREADING_CPP)      fprintf(stdout, " THREADING_CPP");
@@ -137,7 +138,8 @@ int benchmarkResource(int resource,
                          char** implName,
                          long* benchedFlags,
                          double* benchmarkResult,
-                         bool instOnly) {
+                         bool instOnly,
+                         int threadCount) {
 
     int edgeCount = ntaxa*2-2;
     int internalCount = ntaxa-1;
@@ -169,6 +171,11 @@ int benchmarkResource(int resource,
         return BEAGLE_ERROR_NO_IMPLEMENTATION;
     } 
         
+    if (threadCount > 0 && beagleSetCPUThreadCount(instance, threadCount) != BEAGLE_SUCCESS) {
+        beagleFinalizeInstance(instance);
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
     *resourceNumber = instDetails.resourceNumber;
     *benchedFlags = instDetails.flags;
     *implName = instDetails.implName;
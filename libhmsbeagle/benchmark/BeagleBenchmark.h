@@ -56,6 +56,8 @@
 namespace beagle {
 namespace benchmark {
 
+// Times the likelihood of a random tree on resource, the best of nreps; a threadCount
+// above 0 is passed to beagleSetCPUThreadCount
 int benchmarkResource(int resource, 
                          int stateCount, 
                          int ntaxa, 
@@ -75,7 +77,8 @@ int benchmarkResource(int resource,
                          char** implName,
                          long* benchedFlags,
                          double* benchmarkResult,
-                         bool instOnly);
+                         bool instOnly,
+                         int threadCount);
 
 #endif // __beagle_benchmark__
 
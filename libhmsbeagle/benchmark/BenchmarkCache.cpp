@@ -0,0 +1,181 @@
+/*
+ *  BenchmarkCache.cpp
+ *  Persistent results of resource benchmarks
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "libhmsbeagle/benchmark/BenchmarkCache.h"
+
+namespace beagle {
+namespace benchmark {
+
+std::string getBenchmarkCacheFileName() {
+    const char* fileName = getenv("BEAGLE_BENCHMARK_CACHE");
+    if (fileName != NULL && fileName[0] != '\0')
+        return fileName;
+
+#ifdef _WIN32
+    const char* home = getenv("USERPROFILE");
+#else
+    const char* home = getenv("HOME");
+#endif
+    if (home == NULL || home[0] == '\0')
+        return "";
+
+    return std::string(home) + "/.beagle_benchmark_cache";
+}
+
+std::string getHostFingerprint() {
+    std::ostringstream fingerprint;
+    fingerprint << "threads " << std::thread::hardware_concurrency();
+
+#if defined(__linux__)
+    std::ifstream cpuInfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuInfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            fingerprint << " " << line;
+            break;
+        }
+    }
+#endif
+
+    return fingerprint.str();
+}
+
+std::string hashKey(const std::string& text) {
+    // 64-bit FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < text.size(); i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= 1099511628211ULL;
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", hash);
+    return hex;
+}
+
+// one line per resource: the key and the fields of CachedBenchmark, separated by tabs
+static bool parseLine(const std::string& line,
+                      const std::string& key,
+                      CachedBenchmark& result) {
+    if (line.size() <= key.size() || line.compare(0, key.size(), key) != 0 ||
+        line[key.size()] != '\t')
+        return false;
+
+    std::istringstream fields(line.substr(key.size() + 1));
+    std::string field;
+    std::vector<std::string> values;
+    while (std::getline(fields, field, '\t'))
+        values.push_back(field);
+    // results stored before the thread count was added have six fields
+    if (values.size() != 6 && values.size() != 7)
+        return false;
+
+    result.number           = atoi(values[0].c_str());
+    result.returnCode       = atoi(values[1].c_str());
+    result.benchedFlags     = atol(values[2].c_str());
+    result.benchmarkResult  = atof(values[3].c_str());
+    result.performanceRatio = atof(values[4].c_str());
+    result.implName         = values[5];
+    result.threadCount      = (values.size() > 6 ? atoi(values[6].c_str()) : 0);
+    return true;
+}
+
+bool readBenchmarkCache(const std::string& fileName,
+                        const std::string& key,
+                        std::vector<CachedBenchmark>& results) {
+    results.clear();
+
+    std::ifstream file(fileName.c_str());
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        CachedBenchmark result;
+        if (parseLine(line, key, result))
+            results.push_back(result);
+    }
+
+    return !results.empty();
+}
+
+bool writeBenchmarkCache(const std::string& fileName,
+                         const std::string& key,
+                         const std::vector<CachedBenchmark>& results) {
+    // keep the results of other keys
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(fileName.c_str());
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, key.size(), key) != 0 || line.size() <= key.size() ||
+                line[key.size()] != '\t')
+                lines.push_back(line);
+        }
+    }
+
+    std::ostringstream tmpName;
+    tmpName << fileName << ".tmp" << getpid();
+
+    FILE* file = fopen(tmpName.str().c_str(), "w");
+    if (file == NULL)
+        return false;
+
+    for (size_t i = 0; i < lines.size(); i++)
+        fprintf(file, "%s\n", lines[i].c_str());
+    for (size_t i = 0; i < results.size(); i++) {
+        const CachedBenchmark& r = results[i];
+        fprintf(file, "%s\t%d\t%d\t%ld\t%.17g\t%.17g\t%s\t%d\n", key.c_str(), r.number,
+                r.returnCode, r.benchedFlags, r.benchmarkResult, r.performanceRatio,
+                r.implName.c_str(), r.threadCount);
+    }
+
+    bool written = (fclose(file) == 0);
+#ifdef _WIN32
+    if (written)
+        remove(fileName.c_str());
+#endif
+    if (!written || rename(tmpName.str().c_str(), fileName.c_str()) != 0) {
+        remove(tmpName.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}   // namespace benchmark
+}   // namespace beagle
@@ -0,0 +1,72 @@
+/*
+ *  BenchmarkCache.h
+ *  Persistent results of resource benchmarks
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __beagle_benchmark_cache__
+#define __beagle_benchmark_cache__
+
+#include <string>
+#include <vector>
+
+namespace beagle {
+namespace benchmark {
+
+/*
+ * The benchmark of one resource, as stored in the cache.
+ */
+struct CachedBenchmark {
+    int number;
+    int returnCode;
+    long benchedFlags;
+    double benchmarkResult;
+    double performanceRatio;
+    std::string implName;
+    int threadCount;
+};
+
+/// returns the cache file named by the BEAGLE_BENCHMARK_CACHE environment variable, or
+/// .beagle_benchmark_cache in the home directory; empty if neither is known
+std::string getBenchmarkCacheFileName();
+
+/// describes the host processors, for keys of benchmarks run on this machine
+std::string getHostFingerprint();
+
+/// returns a short hash of text, for keys that hold long descriptions
+std::string hashKey(const std::string& text);
+
+/// reads the results stored under key; returns false if there are none or the file cannot
+/// be read
+bool readBenchmarkCache(const std::string& fileName,
+                        const std::string& key,
+                        std::vector<CachedBenchmark>& results);
+
+/// stores results under key, replacing any results stored under it before; the file is
+/// replaced at once, so that concurrent readers see either version. Returns false if the
+/// file cannot be written.
+bool writeBenchmarkCache(const std::string& fileName,
+                         const std::string& key,
+                         const std::vector<CachedBenchmark>& results);
+
+}   // namespace benchmark
+}   // namespace beagle
+
+#endif // __beagle_benchmark_cache__
@@ -0,0 +1,717 @@
+/*
+ *  hmsbeaglemodule.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Python bindings of the BEAGLE API over the buffer protocol. Arrays are taken from any
+ * C-contiguous buffer of native doubles (float64) or 32-bit integers (int32), such as NumPy
+ * arrays, and handed to BEAGLE in place: nothing is copied on the way in or out. Sizes are
+ * checked against the dimensions of the instance, so a short array raises ValueError rather
+ * than overrunning. The calls that compute release the GIL, so Python threads can drive
+ * distinct instances in parallel.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <cstring>
+#include <map>
+
+#include "libhmsbeagle/beagle.h"
+
+namespace {
+
+/// the dimensions of an instance, to check the lengths of the arrays passed to it
+struct Shape {
+    int tipCount;
+    int stateCount;
+    int patternCount;
+    int categoryCount;
+    int eigenValueCount;    // twice the state count for complex decompositions
+};
+
+/// the shapes of the instances created through this module, only used with the GIL held
+std::map<int, Shape> shapes;
+
+PyObject* BeagleError = NULL;
+
+/// raises BeagleError for a BEAGLE error code, with the code as its second argument
+PyObject* raiseError(const char* call,
+                     int errorCode) {
+    PyObject* value = Py_BuildValue("(si)", call, errorCode);
+    if (value != NULL) {
+        PyErr_SetObject(BeagleError, value);
+        Py_DECREF(value);
+    }
+    return NULL;
+}
+
+/// returns None, or raises BeagleError if the call failed
+PyObject* result(const char* call,
+                 int errorCode) {
+    if (errorCode < 0)
+        return raiseError(call, errorCode);
+    Py_RETURN_NONE;
+}
+
+bool getShape(int instance,
+              Shape* shape) {
+    std::map<int, Shape>::iterator found = shapes.find(instance);
+    if (found == shapes.end()) {
+        raiseError("instance", BEAGLE_ERROR_UNINITIALIZED_INSTANCE);
+        return false;
+    }
+    *shape = found->second;
+    return true;
+}
+
+/// true if a buffer format names a native type code, optionally with a byte order that matches
+bool isNativeFormat(const char* format,
+                    const char* codes) {
+    if (format == NULL)
+        return false;
+    char order = format[0];
+    if (order == '@' || order == '=')
+        format++;
+    else if (order == '<' || order == '>' || order == '!') {
+        const int one = 1;
+        bool littleEndian = (*(const char*) &one == 1);
+        if ((order == '<') != littleEndian)
+            return false;
+        format++;
+    }
+    return format[0] != '\0' && format[1] == '\0' && strchr(codes, format[0]) != NULL;
+}
+
+/*
+ * A view of an array argument, released when it goes out of scope. Holding the view keeps
+ * the exporter from resizing or freeing the memory while BEAGLE works on it without the GIL.
+ */
+class ArrayView {
+public:
+    ArrayView() : held(false), count(0) {}
+
+    ~ArrayView() {
+        if (held)
+            PyBuffer_Release(&view);
+    }
+
+    /// takes a C-contiguous array of at least minimumCount doubles; None gives a NULL view
+    /// if allowNone is set
+    bool doubles(PyObject* object,
+                 const char* name,
+                 Py_ssize_t minimumCount,
+                 bool writable,
+                 bool allowNone = false) {
+        return take(object, name, minimumCount, writable, allowNone, sizeof(double), "d");
+    }
+
+    /// takes a C-contiguous array of at least minimumCount 32-bit integers
+    bool ints(PyObject* object,
+              const char* name,
+              Py_ssize_t minimumCount,
+              bool allowNone = false) {
+        return take(object, name, minimumCount, false, allowNone, sizeof(int),
+                    (sizeof(long) == sizeof(int) ? "il" : "i"));
+    }
+
+    double* asDoubles() const { return (held ? (double*) view.buf : NULL); }
+
+    int* asInts() const { return (held ? (int*) view.buf : NULL); }
+
+    /// the number of values
+    Py_ssize_t size() const { return count; }
+
+private:
+    bool take(PyObject* object,
+              const char* name,
+              Py_ssize_t minimumCount,
+              bool writable,
+              bool allowNone,
+              size_t itemSize,
+              const char* codes) {
+        if (object == Py_None && allowNone)
+            return true;
+        int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+        if (PyObject_GetBuffer(object, &view, flags) != 0)
+            return false;
+        held = true;
+        if ((size_t) view.itemsize != itemSize || !isNativeFormat(view.format, codes)) {
+            PyErr_Format(PyExc_TypeError, "%s must be an array of %s", name,
+                         (itemSize == sizeof(double) ? "float64" : "int32"));
+            return false;
+        }
+        count = view.len / view.itemsize;
+        if (count < minimumCount) {
+            PyErr_Format(PyExc_ValueError, "%s holds %zd values, at least %zd are needed",
+                         name, count, minimumCount);
+            return false;
+        }
+        return true;
+    }
+
+    Py_buffer view;
+    bool held;
+    Py_ssize_t count;
+};
+
+PyObject* getVersion(PyObject* self,
+                     PyObject* args) {
+    return PyUnicode_FromString(beagleGetVersion());
+}
+
+PyObject* getCitation(PyObject* self,
+                      PyObject* args) {
+    return PyUnicode_FromString(beagleGetCitation());
+}
+
+PyObject* createInstance(PyObject* self,
+                         PyObject* args,
+                         PyObject* keywords) {
+    static const char* names[] = { "tipCount", "partialsBufferCount", "compactBufferCount",
+        "stateCount", "patternCount", "eigenBufferCount", "matrixBufferCount",
+        "categoryCount", "scaleBufferCount", "resourceList", "preferenceFlags",
+        "requirementFlags", NULL };
+    int tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount;
+    int eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount;
+    PyObject* resourceObject = Py_None;
+    long preferenceFlags = 0;
+    long requirementFlags = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "iiiiiiiii|Oll", (char**) names,
+                                     &tipCount, &partialsBufferCount, &compactBufferCount,
+                                     &stateCount, &patternCount, &eigenBufferCount,
+                                     &matrixBufferCount, &categoryCount, &scaleBufferCount,
+                                     &resourceObject, &preferenceFlags, &requirementFlags))
+        return NULL;
+
+    ArrayView resources;
+    if (!resources.ints(resourceObject, "resourceList", 0, true))
+        return NULL;
+
+    BeagleInstanceDetails details;
+    int instance;
+    Py_BEGIN_ALLOW_THREADS
+    instance = beagleCreateInstance(tipCount, partialsBufferCount, compactBufferCount,
+                                    stateCount, patternCount, eigenBufferCount,
+                                    matrixBufferCount, categoryCount, scaleBufferCount,
+                                    resources.asInts(), (int) resources.size(),
+                                    preferenceFlags, requirementFlags, &details);
+    Py_END_ALLOW_THREADS
+    if (instance < 0)
+        return raiseError("createInstance", instance);
+
+    Shape shape = { tipCount, stateCount, patternCount, categoryCount,
+        (details.flags & BEAGLE_FLAG_EIGEN_COMPLEX ? 2 * stateCount : stateCount) };
+    shapes[instance] = shape;
+
+    return Py_BuildValue("(i{s:i,s:z,s:z,s:l})", instance,
+                         "resourceNumber", details.resourceNumber,
+                         "resourceName", details.resourceName,
+                         "implName", details.implName,
+                         "flags", details.flags);
+}
+
+PyObject* finalizeInstance(PyObject* self,
+                           PyObject* args) {
+    int instance;
+    if (!PyArg_ParseTuple(args, "i", &instance))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleFinalizeInstance(instance);
+    Py_END_ALLOW_THREADS
+    shapes.erase(instance);
+    return result("finalizeInstance", errorCode);
+}
+
+PyObject* setCPUThreadCount(PyObject* self,
+                            PyObject* args) {
+    int instance, threadCount;
+    if (!PyArg_ParseTuple(args, "ii", &instance, &threadCount))
+        return NULL;
+    return result("setCPUThreadCount", beagleSetCPUThreadCount(instance, threadCount));
+}
+
+PyObject* setTipStates(PyObject* self,
+                       PyObject* args) {
+    int instance, tipIndex;
+    PyObject* statesObject;
+    Shape shape;
+    ArrayView states;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &tipIndex, &statesObject) ||
+        !getShape(instance, &shape) ||
+        !states.ints(statesObject, "inStates", shape.patternCount))
+        return NULL;
+    return result("setTipStates", beagleSetTipStates(instance, tipIndex, states.asInts()));
+}
+
+PyObject* setTipPartials(PyObject* self,
+                         PyObject* args) {
+    int instance, tipIndex;
+    PyObject* partialsObject;
+    Shape shape;
+    ArrayView partials;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &tipIndex, &partialsObject) ||
+        !getShape(instance, &shape) ||
+        !partials.doubles(partialsObject, "inPartials",
+                          (Py_ssize_t) shape.stateCount * shape.patternCount, false))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleSetTipPartials(instance, tipIndex, partials.asDoubles());
+    Py_END_ALLOW_THREADS
+    return result("setTipPartials", errorCode);
+}
+
+PyObject* setPartials(PyObject* self,
+                      PyObject* args) {
+    int instance, bufferIndex;
+    PyObject* partialsObject;
+    Shape shape;
+    ArrayView partials;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &bufferIndex, &partialsObject) ||
+        !getShape(instance, &shape) ||
+        !partials.doubles(partialsObject, "inPartials",
+                          (Py_ssize_t) shape.stateCount * shape.patternCount *
+                          shape.categoryCount, false))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleSetPartials(instance, bufferIndex, partials.asDoubles());
+    Py_END_ALLOW_THREADS
+    return result("setPartials", errorCode);
+}
+
+PyObject* getPartials(PyObject* self,
+                      PyObject* args) {
+    int instance, bufferIndex, scaleIndex;
+    PyObject* partialsObject;
+    Shape shape;
+    ArrayView partials;
+    if (!PyArg_ParseTuple(args, "iiiO", &instance, &bufferIndex, &scaleIndex, &partialsObject) ||
+        !getShape(instance, &shape) ||
+        !partials.doubles(partialsObject, "outPartials",
+                          (Py_ssize_t) shape.stateCount * shape.patternCount *
+                          shape.categoryCount, true))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleGetPartials(instance, bufferIndex, scaleIndex, partials.asDoubles());
+    Py_END_ALLOW_THREADS
+    return result("getPartials", errorCode);
+}
+
+PyObject* setPatternWeights(PyObject* self,
+                            PyObject* args) {
+    int instance;
+    PyObject* weightsObject;
+    Shape shape;
+    ArrayView weights;
+    if (!PyArg_ParseTuple(args, "iO", &instance, &weightsObject) ||
+        !getShape(instance, &shape) ||
+        !weights.doubles(weightsObject, "inPatternWeights", shape.patternCount, false))
+        return NULL;
+    return result("setPatternWeights", beagleSetPatternWeights(instance, weights.asDoubles()));
+}
+
+PyObject* setStateFrequencies(PyObject* self,
+                              PyObject* args) {
+    int instance, index;
+    PyObject* frequenciesObject;
+    Shape shape;
+    ArrayView frequencies;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &index, &frequenciesObject) ||
+        !getShape(instance, &shape) ||
+        !frequencies.doubles(frequenciesObject, "inStateFrequencies", shape.stateCount, false))
+        return NULL;
+    return result("setStateFrequencies",
+                  beagleSetStateFrequencies(instance, index, frequencies.asDoubles()));
+}
+
+PyObject* setCategoryWeights(PyObject* self,
+                             PyObject* args) {
+    int instance, index;
+    PyObject* weightsObject;
+    Shape shape;
+    ArrayView weights;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &index, &weightsObject) ||
+        !getShape(instance, &shape) ||
+        !weights.doubles(weightsObject, "inCategoryWeights", shape.categoryCount, false))
+        return NULL;
+    return result("setCategoryWeights",
+                  beagleSetCategoryWeights(instance, index, weights.asDoubles()));
+}
+
+PyObject* setCategoryRates(PyObject* self,
+                           PyObject* args) {
+    int instance;
+    PyObject* ratesObject;
+    Shape shape;
+    ArrayView rates;
+    if (!PyArg_ParseTuple(args, "iO", &instance, &ratesObject) ||
+        !getShape(instance, &shape) ||
+        !rates.doubles(ratesObject, "inCategoryRates", shape.categoryCount, false))
+        return NULL;
+    return result("setCategoryRates", beagleSetCategoryRates(instance, rates.asDoubles()));
+}
+
+PyObject* setEigenDecomposition(PyObject* self,
+                                PyObject* args) {
+    int instance, eigenIndex;
+    PyObject *vectorsObject, *inverseObject, *valuesObject;
+    Shape shape;
+    ArrayView vectors, inverse, values;
+    if (!PyArg_ParseTuple(args, "iiOOO", &instance, &eigenIndex, &vectorsObject,
+                          &inverseObject, &valuesObject) ||
+        !getShape(instance, &shape))
+        return NULL;
+    Py_ssize_t matrixSize = (Py_ssize_t) shape.stateCount * shape.stateCount;
+    if (!vectors.doubles(vectorsObject, "inEigenVectors", matrixSize, false) ||
+        !inverse.doubles(inverseObject, "inInverseEigenVectors", matrixSize, false) ||
+        !values.doubles(valuesObject, "inEigenValues", shape.eigenValueCount, false))
+        return NULL;
+    return result("setEigenDecomposition",
+                  beagleSetEigenDecomposition(instance, eigenIndex, vectors.asDoubles(),
+                                              inverse.asDoubles(), values.asDoubles()));
+}
+
+PyObject* setTransitionMatrix(PyObject* self,
+                              PyObject* args) {
+    int instance, matrixIndex;
+    PyObject* matrixObject;
+    double paddedValue = 1.0;
+    Shape shape;
+    ArrayView matrix;
+    if (!PyArg_ParseTuple(args, "iiO|d", &instance, &matrixIndex, &matrixObject, &paddedValue) ||
+        !getShape(instance, &shape) ||
+        !matrix.doubles(matrixObject, "inMatrix",
+                        (Py_ssize_t) shape.stateCount * shape.stateCount * shape.categoryCount,
+                        false))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleSetTransitionMatrix(instance, matrixIndex, matrix.asDoubles(), paddedValue);
+    Py_END_ALLOW_THREADS
+    return result("setTransitionMatrix", errorCode);
+}
+
+PyObject* getTransitionMatrix(PyObject* self,
+                              PyObject* args) {
+    int instance, matrixIndex;
+    PyObject* matrixObject;
+    Shape shape;
+    ArrayView matrix;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &matrixIndex, &matrixObject) ||
+        !getShape(instance, &shape) ||
+        !matrix.doubles(matrixObject, "outMatrix",
+                        (Py_ssize_t) shape.stateCount * shape.stateCount * shape.categoryCount,
+                        true))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleGetTransitionMatrix(instance, matrixIndex, matrix.asDoubles());
+    Py_END_ALLOW_THREADS
+    return result("getTransitionMatrix", errorCode);
+}
+
+PyObject* updateTransitionMatrices(PyObject* self,
+                                   PyObject* args) {
+    int instance, eigenIndex;
+    PyObject *probabilityObject, *firstObject, *secondObject, *lengthsObject;
+    Shape shape;
+    ArrayView probabilityIndices, firstIndices, secondIndices, edgeLengths;
+    if (!PyArg_ParseTuple(args, "iiOOOO", &instance, &eigenIndex, &probabilityObject,
+                          &firstObject, &secondObject, &lengthsObject) ||
+        !getShape(instance, &shape) ||
+        !probabilityIndices.ints(probabilityObject, "probabilityIndices", 0))
+        return NULL;
+    Py_ssize_t count = probabilityIndices.size();
+    if (!firstIndices.ints(firstObject, "firstDerivativeIndices", count, true) ||
+        !secondIndices.ints(secondObject, "secondDerivativeIndices", count, true) ||
+        !edgeLengths.doubles(lengthsObject, "edgeLengths", count, false))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleUpdateTransitionMatrices(instance, eigenIndex,
+                                               probabilityIndices.asInts(),
+                                               firstIndices.asInts(), secondIndices.asInts(),
+                                               edgeLengths.asDoubles(), (int) count);
+    Py_END_ALLOW_THREADS
+    return result("updateTransitionMatrices", errorCode);
+}
+
+PyObject* updatePartials(PyObject* self,
+                         PyObject* args) {
+    int instance, cumulativeScaleIndex;
+    PyObject* operationsObject;
+    Shape shape;
+    ArrayView operations;
+    if (!PyArg_ParseTuple(args, "iOi", &instance, &operationsObject, &cumulativeScaleIndex) ||
+        !getShape(instance, &shape) ||
+        !operations.ints(operationsObject, "operations", 0))
+        return NULL;
+    if (operations.size() % BEAGLE_OP_COUNT != 0) {
+        PyErr_Format(PyExc_ValueError, "operations must hold %d integers per operation",
+                     (int) BEAGLE_OP_COUNT);
+        return NULL;
+    }
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleUpdatePartials(instance, (const BeagleOperation*) operations.asInts(),
+                                     (int) (operations.size() / BEAGLE_OP_COUNT),
+                                     cumulativeScaleIndex);
+    Py_END_ALLOW_THREADS
+    return result("updatePartials", errorCode);
+}
+
+PyObject* waitForPartials(PyObject* self,
+                          PyObject* args) {
+    int instance;
+    PyObject* indicesObject;
+    ArrayView indices;
+    if (!PyArg_ParseTuple(args, "iO", &instance, &indicesObject) ||
+        !indices.ints(indicesObject, "destinationPartials", 0))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleWaitForPartials(instance, indices.asInts(), (int) indices.size());
+    Py_END_ALLOW_THREADS
+    return result("waitForPartials", errorCode);
+}
+
+PyObject* accumulateScaleFactors(PyObject* self,
+                                 PyObject* args) {
+    int instance, cumulativeScaleIndex;
+    PyObject* indicesObject;
+    ArrayView indices;
+    if (!PyArg_ParseTuple(args, "iOi", &instance, &indicesObject, &cumulativeScaleIndex) ||
+        !indices.ints(indicesObject, "scaleIndices", 0))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleAccumulateScaleFactors(instance, indices.asInts(), (int) indices.size(),
+                                             cumulativeScaleIndex);
+    Py_END_ALLOW_THREADS
+    return result("accumulateScaleFactors", errorCode);
+}
+
+PyObject* resetScaleFactors(PyObject* self,
+                            PyObject* args) {
+    int instance, cumulativeScaleIndex;
+    if (!PyArg_ParseTuple(args, "ii", &instance, &cumulativeScaleIndex))
+        return NULL;
+    return result("resetScaleFactors", beagleResetScaleFactors(instance, cumulativeScaleIndex));
+}
+
+/// returns the sum, including when it is not finite so that the caller can rescale and retry
+PyObject* calculateRootLogLikelihoods(PyObject* self,
+                                      PyObject* args) {
+    int instance;
+    PyObject *buffersObject, *weightsObject, *frequenciesObject, *scalesObject;
+    ArrayView buffers, weights, frequencies, scales;
+    if (!PyArg_ParseTuple(args, "iOOOO", &instance, &buffersObject, &weightsObject,
+                          &frequenciesObject, &scalesObject) ||
+        !buffers.ints(buffersObject, "bufferIndices", 1))
+        return NULL;
+    Py_ssize_t count = buffers.size();
+    if (!weights.ints(weightsObject, "categoryWeightsIndices", count) ||
+        !frequencies.ints(frequenciesObject, "stateFrequenciesIndices", count) ||
+        !scales.ints(scalesObject, "cumulativeScaleIndices", count))
+        return NULL;
+    double sumLogLikelihood = 0.0;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleCalculateRootLogLikelihoods(instance, buffers.asInts(), weights.asInts(),
+                                                  frequencies.asInts(), scales.asInts(),
+                                                  (int) count, &sumLogLikelihood);
+    Py_END_ALLOW_THREADS
+    if (errorCode < 0 && errorCode != BEAGLE_ERROR_FLOATING_POINT)
+        return raiseError("calculateRootLogLikelihoods", errorCode);
+    return PyFloat_FromDouble(sumLogLikelihood);
+}
+
+/// returns the sums of the log likelihood and of the derivatives asked for, None otherwise
+PyObject* calculateEdgeLogLikelihoods(PyObject* self,
+                                      PyObject* args) {
+    int instance;
+    PyObject *parentsObject, *childrenObject, *probabilityObject, *firstObject, *secondObject;
+    PyObject *weightsObject, *frequenciesObject, *scalesObject;
+    ArrayView parents, children, probabilities, firsts, seconds, weights, frequencies, scales;
+    if (!PyArg_ParseTuple(args, "iOOOOOOOO", &instance, &parentsObject, &childrenObject,
+                          &probabilityObject, &firstObject, &secondObject, &weightsObject,
+                          &frequenciesObject, &scalesObject) ||
+        !parents.ints(parentsObject, "parentBufferIndices", 1))
+        return NULL;
+    Py_ssize_t count = parents.size();
+    if (!children.ints(childrenObject, "childBufferIndices", count) ||
+        !probabilities.ints(probabilityObject, "probabilityIndices", count) ||
+        !firsts.ints(firstObject, "firstDerivativeIndices", count, true) ||
+        !seconds.ints(secondObject, "secondDerivativeIndices", count, true) ||
+        !weights.ints(weightsObject, "categoryWeightsIndices", count) ||
+        !frequencies.ints(frequenciesObject, "stateFrequenciesIndices", count) ||
+        !scales.ints(scalesObject, "cumulativeScaleIndices", count))
+        return NULL;
+    double sums[3] = { 0.0, 0.0, 0.0 };
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleCalculateEdgeLogLikelihoods(instance, parents.asInts(), children.asInts(),
+                                                  probabilities.asInts(), firsts.asInts(),
+                                                  seconds.asInts(), weights.asInts(),
+                                                  frequencies.asInts(), scales.asInts(),
+                                                  (int) count, &sums[0],
+                                                  (firsts.asInts() != NULL ? &sums[1] : NULL),
+                                                  (seconds.asInts() != NULL ? &sums[2] : NULL));
+    Py_END_ALLOW_THREADS
+    if (errorCode < 0 && errorCode != BEAGLE_ERROR_FLOATING_POINT)
+        return raiseError("calculateEdgeLogLikelihoods", errorCode);
+    PyObject* first = (firsts.asInts() != NULL ? PyFloat_FromDouble(sums[1]) : Py_None);
+    PyObject* second = (seconds.asInts() != NULL ? PyFloat_FromDouble(sums[2]) : Py_None);
+    return Py_BuildValue("(dOO)", sums[0], first, second);
+}
+
+PyObject* getSiteLogLikelihoods(PyObject* self,
+                                PyObject* args) {
+    int instance;
+    PyObject* outObject;
+    Shape shape;
+    ArrayView siteLogLikelihoods;
+    if (!PyArg_ParseTuple(args, "iO", &instance, &outObject) ||
+        !getShape(instance, &shape) ||
+        !siteLogLikelihoods.doubles(outObject, "outLogLikelihoods", shape.patternCount, true))
+        return NULL;
+    int errorCode;
+    Py_BEGIN_ALLOW_THREADS
+    errorCode = beagleGetSiteLogLikelihoods(instance, siteLogLikelihoods.asDoubles());
+    Py_END_ALLOW_THREADS
+    return result("getSiteLogLikelihoods", errorCode);
+}
+
+PyMethodDef methods[] = {
+    { "getVersion", getVersion, METH_NOARGS, "getVersion() -> str" },
+    { "getCitation", getCitation, METH_NOARGS, "getCitation() -> str" },
+    { "createInstance", (PyCFunction) (void (*)(void)) createInstance,
+      METH_VARARGS | METH_KEYWORDS,
+      "createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,\n"
+      "               patternCount, eigenBufferCount, matrixBufferCount, categoryCount,\n"
+      "               scaleBufferCount, resourceList=None, preferenceFlags=0,\n"
+      "               requirementFlags=0) -> (instance, details)" },
+    { "finalizeInstance", finalizeInstance, METH_VARARGS, "finalizeInstance(instance)" },
+    { "setCPUThreadCount", setCPUThreadCount, METH_VARARGS,
+      "setCPUThreadCount(instance, threadCount)" },
+    { "setTipStates", setTipStates, METH_VARARGS,
+      "setTipStates(instance, tipIndex, inStates: int32[patternCount])" },
+    { "setTipPartials", setTipPartials, METH_VARARGS,
+      "setTipPartials(instance, tipIndex, inPartials: float64[patternCount * stateCount])" },
+    { "setPartials", setPartials, METH_VARARGS,
+      "setPartials(instance, bufferIndex,\n"
+      "            inPartials: float64[categoryCount * patternCount * stateCount])" },
+    { "getPartials", getPartials, METH_VARARGS,
+      "getPartials(instance, bufferIndex, scaleIndex,\n"
+      "            outPartials: float64[categoryCount * patternCount * stateCount])" },
+    { "setPatternWeights", setPatternWeights, METH_VARARGS,
+      "setPatternWeights(instance, inPatternWeights: float64[patternCount])" },
+    { "setStateFrequencies", setStateFrequencies, METH_VARARGS,
+      "setStateFrequencies(instance, index, inStateFrequencies: float64[stateCount])" },
+    { "setCategoryWeights", setCategoryWeights, METH_VARARGS,
+      "setCategoryWeights(instance, index, inCategoryWeights: float64[categoryCount])" },
+    { "setCategoryRates", setCategoryRates, METH_VARARGS,
+      "setCategoryRates(instance, inCategoryRates: float64[categoryCount])" },
+    { "setEigenDecomposition", setEigenDecomposition, METH_VARARGS,
+      "setEigenDecomposition(instance, eigenIndex, inEigenVectors, inInverseEigenVectors,\n"
+      "                      inEigenValues)" },
+    { "setTransitionMatrix", setTransitionMatrix, METH_VARARGS,
+      "setTransitionMatrix(instance, matrixIndex,\n"
+      "                    inMatrix: float64[categoryCount * stateCount * stateCount],\n"
+      "                    paddedValue=1.0)" },
+    { "getTransitionMatrix", getTransitionMatrix, METH_VARARGS,
+      "getTransitionMatrix(instance, matrixIndex,\n"
+      "                    outMatrix: float64[categoryCount * stateCount * stateCount])" },
+    { "updateTransitionMatrices", updateTransitionMatrices, METH_VARARGS,
+      "updateTransitionMatrices(instance, eigenIndex, probabilityIndices: int32[count],\n"
+      "                         firstDerivativeIndices, secondDerivativeIndices,\n"
+      "                         edgeLengths: float64[count])\n"
+      "The derivative indices may be None. Runs without the GIL." },
+    { "updatePartials", updatePartials, METH_VARARGS,
+      "updatePartials(instance, operations: int32[operationCount * 7], cumulativeScaleIndex)\n"
+      "Runs without the GIL." },
+    { "waitForPartials", waitForPartials, METH_VARARGS,
+      "waitForPartials(instance, destinationPartials: int32[count])" },
+    { "accumulateScaleFactors", accumulateScaleFactors, METH_VARARGS,
+      "accumulateScaleFactors(instance, scaleIndices: int32[count], cumulativeScaleIndex)" },
+    { "resetScaleFactors", resetScaleFactors, METH_VARARGS,
+      "resetScaleFactors(instance, cumulativeScaleIndex)" },
+    { "calculateRootLogLikelihoods", calculateRootLogLikelihoods, METH_VARARGS,
+      "calculateRootLogLikelihoods(instance, bufferIndices, categoryWeightsIndices,\n"
+      "                            stateFrequenciesIndices, cumulativeScaleIndices) -> float\n"
+      "Runs without the GIL." },
+    { "calculateEdgeLogLikelihoods", calculateEdgeLogLikelihoods, METH_VARARGS,
+      "calculateEdgeLogLikelihoods(instance, parentBufferIndices, childBufferIndices,\n"
+      "                            probabilityIndices, firstDerivativeIndices,\n"
+      "                            secondDerivativeIndices, categoryWeightsIndices,\n"
+      "                            stateFrequenciesIndices, cumulativeScaleIndices)\n"
+      "    -> (logLikelihood, firstDerivative, secondDerivative)\n"
+      "Runs without the GIL." },
+    { "getSiteLogLikelihoods", getSiteLogLikelihoods, METH_VARARGS,
+      "getSiteLogLikelihoods(instance, outLogLikelihoods: float64[patternCount])" },
+    { NULL, NULL, 0, NULL }
+};
+
+PyModuleDef moduleDefinition = {
+    PyModuleDef_HEAD_INIT,
+    "hmsbeagle",
+    "BEAGLE over the buffer protocol: NumPy arrays are passed in place, without copies.",
+    -1,
+    methods
+};
+
+}   // namespace
+
+PyMODINIT_FUNC PyInit_hmsbeagle(void) {
+    PyObject* module = PyModule_Create(&moduleDefinition);
+    if (module == NULL)
+        return NULL;
+
+    // the module and this file each hold a reference
+    BeagleError = PyErr_NewException("hmsbeagle.BeagleError", NULL, NULL);
+    Py_XINCREF(BeagleError);
+    if (PyModule_AddObject(module, "BeagleError", BeagleError) != 0) {
+        Py_XDECREF(BeagleError);
+        Py_CLEAR(BeagleError);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    PyModule_AddIntConstant(module, "BEAGLE_OP_NONE", BEAGLE_OP_NONE);
+    PyModule_AddIntConstant(module, "BEAGLE_OP_COUNT", BEAGLE_OP_COUNT);
+    PyModule_AddIntConstant(module, "BEAGLE_ERROR_FLOATING_POINT", BEAGLE_ERROR_FLOATING_POINT);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_PRECISION_SINGLE", BEAGLE_FLAG_PRECISION_SINGLE);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_PRECISION_DOUBLE", BEAGLE_FLAG_PRECISION_DOUBLE);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_PROCESSOR_CPU", BEAGLE_FLAG_PROCESSOR_CPU);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_PROCESSOR_GPU", BEAGLE_FLAG_PROCESSOR_GPU);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_SCALING_MANUAL", BEAGLE_FLAG_SCALING_MANUAL);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_SCALING_AUTO", BEAGLE_FLAG_SCALING_AUTO);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_VECTOR_SSE", BEAGLE_FLAG_VECTOR_SSE);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_THREADING_CPP", BEAGLE_FLAG_THREADING_CPP);
+    PyModule_AddIntConstant(module, "BEAGLE_FLAG_EIGEN_COMPLEX", BEAGLE_FLAG_EIGEN_COMPLEX);
+
+    return module;
+}
@@ -0,0 +1,23 @@
+import subprocess
+
+from setuptools import setup, Extension
+
+
+def pkgconfig(*packages, **kw):
+    flag_map = {'-I': 'include_dirs', '-L': 'library_dirs', '-l': 'libraries'}
+    output = subprocess.check_output(["pkg-config", "--libs", "--cflags"] + list(packages))
+    for token in output.decode().split():
+        kw.setdefault(flag_map.get(token[:2]), []).append(token[2:])
+    kw.pop(None, None)
+    return kw
+
+
+hmsbeagle_module = Extension("hmsbeagle",
+                             sources=["hmsbeaglemodule.cpp"],
+                             language="c++",
+                             **pkgconfig("hmsbeagle-1"))
+
+setup(name="hmsbeagle",
+      version="0.1",
+      description="BEAGLE over the buffer protocol, for NumPy arrays without copies",
+      ext_modules=[hmsbeagle_module])
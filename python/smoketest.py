@@ -0,0 +1,116 @@
+"""Checks the bindings against a likelihood computed without BEAGLE.
+
+The problem of test.py, three tips under JC69, is evaluated through the module with arrays
+of the standard array module, so neither NumPy nor a GPU is needed, and compared with the
+same likelihood summed directly from the closed-form JC69 transition probabilities. Exits
+non-zero on a mismatch.
+"""
+
+import math
+import sys
+from array import array
+
+import hmsbeagle
+
+mars    = "CCGAG-AGCAGCAATGGAT-GAGGCATGGCG"
+saturn  = "GCGCGCAGCTGCTGTAGATGGAGGCATGACG"
+jupiter = "GCGCGCAGCAGCTGTGGATGGAAGGATGACG"
+
+table = {'A': 0, 'C': 1, 'G': 2, 'T': 3, '-': 4}
+
+# matrices 0 to 3 are for the edges above nodes 0 to 3; node 3 joins tips 0 and 1, and the
+# root, node 4, joins tip 2 and node 3
+edgeLengths = [0.1, 0.1, 0.2, 0.1]
+
+
+def states(sequence):
+    return array('i', [table[c] for c in sequence.upper()])
+
+
+def jc69(length):
+    same = 0.25 + 0.75 * math.exp(-4.0 / 3.0 * length)
+    other = 0.25 - 0.25 * math.exp(-4.0 / 3.0 * length)
+    return [[same if i == j else other for j in range(4)] for i in range(4)]
+
+
+def childTerm(matrix, partials):
+    return [sum(matrix[i][j] * partials[j] for j in range(4)) for i in range(4)]
+
+
+def tipPartials(c):
+    state = table[c]
+    return [1.0] * 4 if state == 4 else [1.0 if i == state else 0.0 for i in range(4)]
+
+
+def directLogL():
+    matrices = [jc69(t) for t in edgeLengths]
+    logL = 0.0
+    for a, b, c in zip(mars, saturn, jupiter):
+        left = childTerm(matrices[0], tipPartials(a))
+        right = childTerm(matrices[1], tipPartials(b))
+        node3 = [left[i] * right[i] for i in range(4)]
+        tip = childTerm(matrices[2], tipPartials(c))
+        inner = childTerm(matrices[3], node3)
+        logL += math.log(sum(0.25 * tip[i] * inner[i] for i in range(4)))
+    return logL
+
+
+def beagleLogL():
+    nPatterns = len(mars)
+    instance, details = hmsbeagle.createInstance(3, 2, 3, 4, nPatterns, 1, 4, 1, 0,
+                                                 requirementFlags=hmsbeagle.BEAGLE_FLAG_PRECISION_DOUBLE)
+    print("Using resource %s (%s)" % (details["resourceName"], details["implName"]))
+
+    hmsbeagle.setTipStates(instance, 0, states(mars))
+    hmsbeagle.setTipStates(instance, 1, states(saturn))
+    hmsbeagle.setTipStates(instance, 2, states(jupiter))
+
+    hmsbeagle.setPatternWeights(instance, array('d', [1.0] * nPatterns))
+    hmsbeagle.setStateFrequencies(instance, 0, array('d', [0.25] * 4))
+    hmsbeagle.setCategoryWeights(instance, 0, array('d', [1.0]))
+    hmsbeagle.setCategoryRates(instance, array('d', [1.0]))
+
+    evec = array('d', [1.0,  2.0,  0.0,  0.5,
+                       1.0, -2.0,  0.5,  0.0,
+                       1.0,  2.0,  0.0, -0.5,
+                       1.0, -2.0, -0.5,  0.0])
+    ivec = array('d', [0.25,   0.25,  0.25,   0.25,
+                       0.125, -0.125, 0.125, -0.125,
+                       0.0,    1.0,   0.0,   -1.0,
+                       1.0,    0.0,  -1.0,    0.0])
+    eval = array('d', [0.0, -4.0 / 3.0, -4.0 / 3.0, -4.0 / 3.0])
+    hmsbeagle.setEigenDecomposition(instance, 0, evec, ivec, eval)
+
+    hmsbeagle.updateTransitionMatrices(instance, 0, array('i', [0, 1, 2, 3]), None, None,
+                                       array('d', edgeLengths))
+
+    none = hmsbeagle.BEAGLE_OP_NONE
+    operations = array('i', [3, none, none, 0, 0, 1, 1,
+                             4, none, none, 2, 2, 3, 3])
+    hmsbeagle.updatePartials(instance, operations, none)
+
+    zero = array('i', [0])
+    logL = hmsbeagle.calculateRootLogLikelihoods(instance, array('i', [4]), zero, zero,
+                                                 array('i', [none]))
+
+    # the site values are written in place into the array
+    siteLogLikelihoods = array('d', [0.0] * nPatterns)
+    hmsbeagle.getSiteLogLikelihoods(instance, siteLogLikelihoods)
+
+    hmsbeagle.finalizeInstance(instance)
+    return logL, sum(siteLogLikelihoods)
+
+
+def main():
+    expected = directLogL()
+    logL, siteSum = beagleLogL()
+    print("logL = %.10f, sum of site logL = %.10f, direct logL = %.10f" % (logL, siteSum, expected))
+    for value in (logL, siteSum):
+        if abs(value - expected) > 1e-9 * (1.0 + abs(expected)):
+            print("Failed: the bindings do not reproduce the direct likelihood")
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,59 @@
+import numpy as np
+
+import hmsbeagle
+
+mars    = "CCGAG-AGCAGCAATGGAT-GAGGCATGGCG"
+saturn  = "GCGCGCAGCTGCTGTAGATGGAGGCATGACG"
+jupiter = "GCGCGCAGCAGCTGTGGATGGAAGGATGACG"
+
+table = {'A': 0, 'C': 1, 'G': 2, 'T': 3, '-': 4}
+
+def states(sequence):
+    return np.array([table[c] for c in sequence.upper()], dtype=np.int32)
+
+nPatterns = len(mars)
+
+instance, details = hmsbeagle.createInstance(3, 2, 3, 4, nPatterns, 1, 4, 1, 0)
+print("Using resource %s (%s)" % (details["resourceName"], details["implName"]))
+
+hmsbeagle.setTipStates(instance, 0, states(mars))
+hmsbeagle.setTipStates(instance, 1, states(saturn))
+hmsbeagle.setTipStates(instance, 2, states(jupiter))
+
+hmsbeagle.setPatternWeights(instance, np.ones(nPatterns))
+hmsbeagle.setStateFrequencies(instance, 0, np.full(4, 0.25))
+hmsbeagle.setCategoryWeights(instance, 0, np.ones(1))
+hmsbeagle.setCategoryRates(instance, np.ones(1))
+
+evec = np.array([1.0,  2.0,  0.0,  0.5,
+                 1.0, -2.0,  0.5,  0.0,
+                 1.0,  2.0,  0.0, -0.5,
+                 1.0, -2.0, -0.5,  0.0])
+ivec = np.array([0.25,   0.25,  0.25,   0.25,
+                 0.125, -0.125, 0.125, -0.125,
+                 0.0,    1.0,   0.0,   -1.0,
+                 1.0,    0.0,  -1.0,    0.0])
+eval = np.array([0.0, -1.3333333333333333, -1.3333333333333333, -1.3333333333333333])
+hmsbeagle.setEigenDecomposition(instance, 0, evec, ivec, eval)
+
+hmsbeagle.updateTransitionMatrices(instance, 0,
+                                   np.array([0, 1, 2, 3], dtype=np.int32), None, None,
+                                   np.array([0.1, 0.1, 0.2, 0.1]))
+
+none = hmsbeagle.BEAGLE_OP_NONE
+operations = np.array([[3, none, none, 0, 0, 1, 1],
+                       [4, none, none, 2, 2, 3, 3]], dtype=np.int32)
+hmsbeagle.updatePartials(instance, operations, none)
+
+one = np.array([0], dtype=np.int32)
+logL = hmsbeagle.calculateRootLogLikelihoods(instance, np.array([4], dtype=np.int32),
+                                             one, one, np.array([none], dtype=np.int32))
+
+siteLogLikelihoods = np.empty(nPatterns)
+hmsbeagle.getSiteLogLikelihoods(instance, siteLogLikelihoods)
+
+print(logL)
+print(siteLogLikelihoods.sum())
+
+hmsbeagle.finalizeInstance(instance)
+print("Woof!")